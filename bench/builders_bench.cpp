@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "vulkan_builders.h"
+
+namespace {
+
+using gfx::vk_api::build;
+using TimelineInfo = VkTimelineSemaphoreSubmitInfoKHR;
+
+constexpr int REPETITIONS = 51;
+constexpr uint32_t COUNT = 1 << 14;
+
+// Handles and values the structures point to, different for every element
+// so nothing folds into a constant.
+struct Inputs {
+  explicit Inputs(uint32_t count)
+      : command_buffers(count), semaphores(count), values(count)
+  {
+    for (uint32_t i = 0; i < count; ++i) {
+      command_buffers[i] =
+          reinterpret_cast<VkCommandBuffer>(static_cast<uintptr_t>(i + 1));
+      semaphores[i] = reinterpret_cast<VkSemaphore>(
+          static_cast<uintptr_t>(count + i + 1));
+      values[i] = i + 1;
+    }
+  }
+
+  std::vector<VkCommandBuffer> command_buffers;
+  std::vector<VkSemaphore> semaphores;
+  std::vector<uint64_t> values;
+};
+
+// A submit and the timeline values chained to it.
+struct Submit {
+  VkSubmitInfo submit;
+  TimelineInfo timeline;
+};
+
+auto fill_by_hand(const Inputs& inputs, uint32_t i, Submit& out) -> void
+{
+  out.timeline = {};
+  out.timeline.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  out.timeline.signalSemaphoreValueCount = 1;
+  out.timeline.pSignalSemaphoreValues = &inputs.values[i];
+  out.submit = {};
+  out.submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  out.submit.pNext = &out.timeline;
+  out.submit.commandBufferCount = 1;
+  out.submit.pCommandBuffers = &inputs.command_buffers[i];
+  out.submit.signalSemaphoreCount = 1;
+  out.submit.pSignalSemaphores = &inputs.semaphores[i];
+}
+
+auto fill_with_builder(const Inputs& inputs, uint32_t i, Submit& out) -> void
+{
+  out.timeline = build<TimelineInfo>()
+                     .set(&TimelineInfo::signalSemaphoreValueCount, 1)
+                     .set(&TimelineInfo::pSignalSemaphoreValues,
+                          &inputs.values[i]);
+  out.submit = build<VkSubmitInfo>()
+                   .set(&VkSubmitInfo::commandBufferCount, 1)
+                   .set(&VkSubmitInfo::pCommandBuffers,
+                        &inputs.command_buffers[i])
+                   .set(&VkSubmitInfo::signalSemaphoreCount, 1)
+                   .set(&VkSubmitInfo::pSignalSemaphores,
+                        &inputs.semaphores[i])
+                   .next(out.timeline);
+}
+
+auto fill_by_hand(uint32_t i, VkImageViewCreateInfo& out) -> void
+{
+  out = {};
+  out.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  out.image = reinterpret_cast<VkImage>(static_cast<uintptr_t>(i + 1));
+  out.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  out.format = VK_FORMAT_R8G8B8A8_UNORM;
+  out.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, i % 12, 1, 0, 1};
+}
+
+auto fill_with_builder(uint32_t i, VkImageViewCreateInfo& out) -> void
+{
+  VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, i % 12, 1, 0,
+                                   1};
+  out = build<VkImageViewCreateInfo>()
+            .set(&VkImageViewCreateInfo::image,
+                 reinterpret_cast<VkImage>(static_cast<uintptr_t>(i + 1)))
+            .set(&VkImageViewCreateInfo::viewType, VK_IMAGE_VIEW_TYPE_2D)
+            .set(&VkImageViewCreateInfo::format, VK_FORMAT_R8G8B8A8_UNORM)
+            .set(&VkImageViewCreateInfo::subresourceRange, range);
+}
+
+auto same(const Submit& a, const Submit& b) -> bool
+{
+  return a.submit.sType == b.submit.sType &&
+         (a.submit.pNext == &a.timeline) == (b.submit.pNext == &b.timeline) &&
+         a.submit.waitSemaphoreCount == b.submit.waitSemaphoreCount &&
+         a.submit.pWaitSemaphores == b.submit.pWaitSemaphores &&
+         a.submit.pWaitDstStageMask == b.submit.pWaitDstStageMask &&
+         a.submit.commandBufferCount == b.submit.commandBufferCount &&
+         a.submit.pCommandBuffers == b.submit.pCommandBuffers &&
+         a.submit.signalSemaphoreCount == b.submit.signalSemaphoreCount &&
+         a.submit.pSignalSemaphores == b.submit.pSignalSemaphores &&
+         a.timeline.sType == b.timeline.sType &&
+         a.timeline.pNext == b.timeline.pNext &&
+         a.timeline.waitSemaphoreValueCount ==
+             b.timeline.waitSemaphoreValueCount &&
+         a.timeline.pWaitSemaphoreValues == b.timeline.pWaitSemaphoreValues &&
+         a.timeline.signalSemaphoreValueCount ==
+             b.timeline.signalSemaphoreValueCount &&
+         a.timeline.pSignalSemaphoreValues ==
+             b.timeline.pSignalSemaphoreValues;
+}
+
+auto same(const VkImageViewCreateInfo& a, const VkImageViewCreateInfo& b)
+    -> bool
+{
+  const VkImageSubresourceRange& x = a.subresourceRange;
+  const VkImageSubresourceRange& y = b.subresourceRange;
+  return a.sType == b.sType && a.pNext == b.pNext && a.flags == b.flags &&
+         a.image == b.image && a.viewType == b.viewType &&
+         a.format == b.format && a.components.r == b.components.r &&
+         a.components.g == b.components.g &&
+         a.components.b == b.components.b &&
+         a.components.a == b.components.a && x.aspectMask == y.aspectMask &&
+         x.baseMipLevel == y.baseMipLevel && x.levelCount == y.levelCount &&
+         x.baseArrayLayer == y.baseArrayLayer && x.layerCount == y.layerCount;
+}
+
+// Median wall time of filling every element, in nanoseconds per element.
+template <typename Fill>
+auto measure(Fill fill) -> double
+{
+  std::vector<double> samples;
+  for (int i = 0; i < REPETITIONS; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t element = 0; element < COUNT; ++element) {
+      fill(element);
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    samples.push_back(elapsed.count() / COUNT);
+  }
+  std::nth_element(samples.begin(), samples.begin() + REPETITIONS / 2,
+                   samples.end());
+  return samples[REPETITIONS / 2];
+}
+
+// Times both ways of filling the structures and compares what they wrote.
+template <typename T, typename ByHand, typename WithBuilder>
+auto compare(const char* name, ByHand by_hand, WithBuilder with_builder)
+    -> bool
+{
+  std::vector<T> hand(COUNT);
+  std::vector<T> built(COUNT);
+  double hand_ns = measure([&](uint32_t i) { by_hand(i, hand[i]); });
+  double built_ns = measure([&](uint32_t i) { with_builder(i, built[i]); });
+  bool identical = true;
+  for (uint32_t i = 0; i < COUNT && identical; ++i) {
+    identical = same(hand[i], built[i]);
+  }
+
+  std::cout << std::left << std::setw(24) << name << std::right << std::fixed
+            << std::setprecision(3) << std::setw(12) << hand_ns
+            << std::setw(12) << built_ns << std::setw(10)
+            << built_ns / hand_ns << (identical ? "" : "  contents differ")
+            << std::endl;
+  return identical;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Structure builder benchmark                                  //
+//                                                              //
+// Fills the same structures by hand and with the builders, and //
+// checks both wrote the same fields. The builders fold into    //
+// plain stores, so both columns should match within noise.     //
+// Usage: vulkan-learning-builders-bench                        //
+// ************************************************************ //
+auto main() -> int
+{
+  Inputs inputs(COUNT);
+
+  std::cout << COUNT << " structures, ns per structure:" << std::endl;
+  std::cout << std::left << std::setw(24) << "structure" << std::right
+            << std::setw(12) << "by hand" << std::setw(12) << "builder"
+            << std::setw(10) << "ratio" << std::endl;
+
+  bool identical = compare<Submit>(
+      "VkSubmitInfo + timeline",
+      [&](uint32_t i, Submit& out) { fill_by_hand(inputs, i, out); },
+      [&](uint32_t i, Submit& out) { fill_with_builder(inputs, i, out); });
+  identical = compare<VkImageViewCreateInfo>(
+                  "VkImageViewCreateInfo",
+                  [](uint32_t i, VkImageViewCreateInfo& out) {
+                    fill_by_hand(i, out);
+                  },
+                  [](uint32_t i, VkImageViewCreateInfo& out) {
+                    fill_with_builder(i, out);
+                  }) &&
+              identical;
+  return identical ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "async_io.h"
+#include "thread_pool.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr int REPETITIONS = 3;
+constexpr uint64_t SMALL_FILE_SIZE = 16 << 10;
+constexpr uint32_t LARGE_FILE_COUNT = 4;
+
+using Clock = std::chrono::steady_clock;
+
+struct Scenario {
+  const char* name;
+  std::vector<std::string> paths;
+  // Reads of the urgent files are the ones measured in the mixed case.
+  std::vector<gfx::IoPriority> priorities;
+};
+
+struct Results {
+  uint64_t bytes;
+  double seconds;
+  // Of the measured reads, in milliseconds.
+  std::vector<double> latencies;
+  uint64_t submissions;
+  uint32_t failed;
+};
+
+auto write_file(const std::string& path, uint64_t size) -> void
+{
+  std::vector<char> data(std::min<size_t>(size, 1 << 20));
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 31 + size);
+  }
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  for (uint64_t written = 0; written < size; written += data.size()) {
+    uint64_t chunk = std::min<uint64_t>(data.size(), size - written);
+    file.write(data.data(), static_cast<std::streamsize>(chunk));
+  }
+}
+
+// Drops the files from the page cache, so the reads hit the disk.
+auto evict(const std::vector<std::string>& paths) -> void
+{
+#if !defined(_WIN32)
+  for (const std::string& path : paths) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor >= 0) {
+      fdatasync(descriptor);
+      posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+      close(descriptor);
+    }
+  }
+#endif
+}
+
+auto run(gfx::ThreadPool& thread_pool, gfx::IoBackend backend,
+         const Scenario& scenario) -> Results
+{
+  Results results = {};
+  for (int repetition = 0; repetition < REPETITIONS; ++repetition) {
+    evict(scenario.paths);
+    gfx::AsyncIo io(thread_pool, {backend});
+    std::vector<gfx::IoFile> files;
+    uint64_t total = 0;
+    for (const std::string& path : scenario.paths) {
+      files.push_back(io.open(path.c_str()));
+      total += io.size(files.back());
+    }
+    // Stands in for a mapped staging buffer.
+    std::vector<std::byte> destination(static_cast<size_t>(total));
+
+    auto start = Clock::now();
+    uint64_t offset = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+      uint64_t size = io.size(files[i]);
+      bool measured = scenario.priorities[i] == gfx::IoPriority::urgent;
+      auto issued = Clock::now();
+      io.read({files[i], 0, size, destination.data() + offset,
+               scenario.priorities[i],
+               [&results, issued, measured](const gfx::IoResult& result) {
+                 if (result.status != gfx::IoStatus::done) {
+                   ++results.failed;
+                 }
+                 if (measured) {
+                   std::chrono::duration<double, std::milli> latency =
+                       Clock::now() - issued;
+                   results.latencies.push_back(latency.count());
+                 }
+               }});
+      offset += size;
+    }
+    io.wait_idle();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    results.bytes += total;
+    results.seconds += elapsed.count();
+    results.submissions += io.stats().submissions;
+  }
+  std::sort(results.latencies.begin(), results.latencies.end());
+  return results;
+}
+
+auto percentile(const std::vector<double>& sorted, double fraction) -> double
+{
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  auto index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Asynchronous I/O benchmark                                   //
+//                                                              //
+// Reads many small files, a few large ones, then both at once  //
+// with the small reads urgent and the large ones in the        //
+// background, through io_uring when the kernel has it and      //
+// through the thread pool. The files are dropped from the page //
+// cache before each run. Latencies are from read() to the      //
+// callback, of the urgent reads.                               //
+// Usage: vulkan-learning-io-bench [small count] [large MiB]    //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  uint32_t small_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2048;
+  uint64_t large_size =
+      (argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64) << 20;
+  if (small_count == 0 || large_size == 0) {
+    std::cerr << "The count and the size must be positive." << std::endl;
+    return 1;
+  }
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-io";
+  std::filesystem::create_directories(directory);
+
+  Scenario small = {"small", {}, {}};
+  for (uint32_t i = 0; i < small_count; ++i) {
+    small.paths.push_back(
+        (directory / ("small_" + std::to_string(i))).string());
+    small.priorities.push_back(gfx::IoPriority::urgent);
+    write_file(small.paths.back(), SMALL_FILE_SIZE);
+  }
+  Scenario large = {"large", {}, {}};
+  for (uint32_t i = 0; i < LARGE_FILE_COUNT; ++i) {
+    large.paths.push_back(
+        (directory / ("large_" + std::to_string(i))).string());
+    large.priorities.push_back(gfx::IoPriority::urgent);
+    write_file(large.paths.back(), large_size);
+  }
+  Scenario mixed = {"mixed", large.paths, {}};
+  mixed.priorities.assign(LARGE_FILE_COUNT, gfx::IoPriority::background);
+  mixed.paths.insert(mixed.paths.end(), small.paths.begin(),
+                     small.paths.end());
+  mixed.priorities.resize(mixed.paths.size(), gfx::IoPriority::urgent);
+
+  // Blocking reads leave the cores idle, the fallback wants more threads.
+  gfx::ThreadPool thread_pool(
+      std::max(gfx::ThreadPool::default_worker_count(), 4u));
+  std::vector<gfx::IoBackend> backends = {gfx::IoBackend::thread_pool};
+  if (gfx::AsyncIo(thread_pool).backend() == gfx::IoBackend::io_uring) {
+    backends.insert(backends.begin(), gfx::IoBackend::io_uring);
+  }
+
+  std::cout << small_count << " files of " << (SMALL_FILE_SIZE >> 10)
+            << " KiB, " << LARGE_FILE_COUNT << " of " << (large_size >> 20)
+            << " MiB, " << thread_pool.worker_count() << " workers:"
+            << std::endl;
+  std::cout << std::left << std::setw(8) << "files" << std::setw(13)
+            << "backend" << std::right << std::setw(10) << "MB/s"
+            << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+            << std::setw(10) << "max ms" << std::setw(13) << "submissions"
+            << std::endl;
+  bool failed = false;
+  for (const Scenario* scenario : {&small, &large, &mixed}) {
+    for (gfx::IoBackend backend : backends) {
+      Results results = run(thread_pool, backend, *scenario);
+      failed = failed || results.failed > 0;
+      std::cout << std::left << std::setw(8) << scenario->name
+                << std::setw(13)
+                << (backend == gfx::IoBackend::io_uring ? "io_uring"
+                                                        : "thread_pool")
+                << std::right << std::fixed << std::setprecision(0)
+                << std::setw(10) << results.bytes / results.seconds / 1e6
+                << std::setprecision(3) << std::setw(10)
+                << percentile(results.latencies, 0.5) << std::setw(10)
+                << percentile(results.latencies, 0.99) << std::setw(10)
+                << percentile(results.latencies, 1.0) << std::setw(13)
+                << results.submissions / REPETITIONS << std::defaultfloat
+                << std::endl;
+    }
+  }
+
+  std::filesystem::remove_all(directory);
+  if (failed) {
+    std::cerr << "Some reads failed." << std::endl;
+  }
+  return failed ? 1 : 0;
+}
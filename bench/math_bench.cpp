@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "math_kernels.h"
+
+namespace {
+
+using gfx::math::SimdLevel;
+
+constexpr int REPETITIONS = 51;
+
+// Backing storage of the SoA views, one vector per component.
+struct Arrays {
+  explicit Arrays(size_t components, uint32_t count)
+      : data(components, std::vector<float>(count))
+  {
+  }
+  auto operator[](size_t component) -> float*
+  {
+    return data[component].data();
+  }
+  std::vector<std::vector<float>> data;
+};
+
+struct Scene {
+  explicit Scene(uint32_t count)
+      : count(count),
+        trs(10, count),
+        affines(12, count),
+        local(4, count),
+        world(4, count),
+        visible(count)
+  {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> size(0.5f, 4.0f);
+    for (uint32_t i = 0; i < count; ++i) {
+      gfx::math::Quat q = gfx::math::normalize(
+          gfx::math::Quat{unit(random), unit(random), unit(random),
+                          unit(random)});
+      float values[10] = {position(random), position(random),
+                          position(random), q.x, q.y, q.z, q.w,
+                          size(random), size(random), size(random)};
+      for (int c = 0; c < 10; ++c) {
+        trs[c][i] = values[c];
+      }
+      for (int c = 0; c < 3; ++c) {
+        local[c][i] = unit(random);
+      }
+      local[3][i] = size(random);
+    }
+  }
+
+  auto transforms() -> gfx::math::TransformSoA
+  {
+    return {{trs[0], trs[1], trs[2]},
+            {trs[3], trs[4], trs[5], trs[6]},
+            {trs[7], trs[8], trs[9]}};
+  }
+  auto affine_soa() -> gfx::math::AffineSoA
+  {
+    gfx::math::AffineSoA soa;
+    for (int e = 0; e < 12; ++e) {
+      soa.rows[e] = affines[e];
+    }
+    return soa;
+  }
+  auto local_spheres() -> gfx::math::SphereSoA
+  {
+    return {{local[0], local[1], local[2]}, local[3]};
+  }
+  auto world_spheres() -> gfx::math::SphereSoA
+  {
+    return {{world[0], world[1], world[2]}, world[3]};
+  }
+
+  uint32_t count;
+  Arrays trs;
+  Arrays affines;
+  Arrays local;
+  Arrays world;
+  std::vector<uint32_t> visible;
+  uint32_t visible_count = 0;
+};
+
+// Median wall time of a kernel, in nanoseconds per element.
+template <typename Kernel>
+auto measure(uint32_t count, Kernel kernel) -> double
+{
+  std::vector<double> samples;
+  for (int i = 0; i < REPETITIONS; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    kernel();
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    samples.push_back(elapsed.count() / count);
+  }
+  std::nth_element(samples.begin(), samples.begin() + REPETITIONS / 2,
+                   samples.end());
+  return samples[REPETITIONS / 2];
+}
+
+auto max_difference(Arrays& a, Arrays& b, uint32_t count) -> float
+{
+  float difference = 0.0f;
+  for (size_t c = 0; c < a.data.size(); ++c) {
+    for (uint32_t i = 0; i < count; ++i) {
+      difference = std::max(difference, std::abs(a[c][i] - b[c][i]));
+    }
+  }
+  return difference;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Math kernel benchmark                                        //
+//                                                              //
+// Runs every SoA kernel at each SIMD level the CPU supports on //
+// the same random scene, and checks the results against the    //
+// scalar level. Usage: vulkan-learning-math-bench [count]      //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  uint32_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1 << 16;
+  if (count == 0) {
+    std::cerr << "The element count must be positive." << std::endl;
+    return 1;
+  }
+
+  gfx::math::Mat4 view_projection =
+      gfx::math::perspective(1.0f, 16.0f / 9.0f, 0.1f, 500.0f) *
+      gfx::math::look_at({0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.2f},
+                         {0.0f, 0.0f, 1.0f});
+  gfx::math::Frustum frustum = gfx::math::extract_frustum(view_projection);
+
+  // Reference results.
+  Scene reference(count);
+  const gfx::math::MathKernels& scalar =
+      *gfx::math::kernels(SimdLevel::scalar);
+  scalar.compose(reference.transforms(), count, reference.affine_soa());
+  scalar.transform_spheres(reference.affine_soa(), reference.local_spheres(),
+                           count, reference.world_spheres());
+  reference.visible_count = scalar.cull_spheres(
+      frustum, reference.world_spheres(), count, reference.visible.data());
+
+  std::cout << count << " elements, best level "
+            << gfx::math::simd_level_name(gfx::math::best_simd_level())
+            << ", ns per element:" << std::endl;
+  std::cout << std::left << std::setw(8) << "level" << std::right
+            << std::setw(12) << "compose" << std::setw(12) << "spheres"
+            << std::setw(12) << "cull" << std::setw(14) << "max error"
+            << std::endl;
+
+  bool mismatch = false;
+  for (SimdLevel level : {SimdLevel::scalar, SimdLevel::sse2, SimdLevel::avx2,
+                          SimdLevel::neon}) {
+    const gfx::math::MathKernels* kernels = gfx::math::kernels(level);
+    if (kernels == nullptr) {
+      continue;
+    }
+    Scene scene(count);
+    double compose_ns = measure(count, [&] {
+      kernels->compose(scene.transforms(), count, scene.affine_soa());
+    });
+    double spheres_ns = measure(count, [&] {
+      kernels->transform_spheres(scene.affine_soa(), scene.local_spheres(),
+                                 count, scene.world_spheres());
+    });
+    double cull_ns = measure(count, [&] {
+      scene.visible_count = kernels->cull_spheres(
+          frustum, scene.world_spheres(), count, scene.visible.data());
+    });
+
+    float error = std::max(
+        max_difference(scene.affines, reference.affines, count),
+        max_difference(scene.world, reference.world, count));
+    // Spheres right on a plane may go either way between levels.
+    bool same_visible = scene.visible_count == reference.visible_count;
+    mismatch = mismatch || error > 1e-3f || !same_visible;
+
+    std::cout << std::left << std::setw(8)
+              << gfx::math::simd_level_name(level) << std::right
+              << std::fixed << std::setprecision(3) << std::setw(12)
+              << compose_ns << std::setw(12) << spheres_ns << std::setw(12)
+              << cull_ns << std::setw(14) << std::scientific
+              << std::setprecision(2) << error << std::defaultfloat
+              << (same_visible ? "" : "  visible count differs")
+              << std::endl;
+  }
+  return mismatch ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+#include "scene.h"
+#include "thread_pool.h"
+
+namespace {
+
+constexpr int REPETITIONS = 11;
+// Share of the entities moving each frame in the partial update.
+constexpr uint32_t MOVING_PERCENT = 1;
+
+struct Timings {
+  double full_ms;
+  double partial_ms;
+  double collect_ms;
+  uint32_t uploaded;
+};
+
+// Median wall time of a step, in milliseconds.
+template <typename Step>
+auto measure(Step step) -> double
+{
+  std::vector<double> samples;
+  for (int i = 0; i < REPETITIONS; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    step();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    samples.push_back(elapsed.count());
+  }
+  std::nth_element(samples.begin(), samples.begin() + REPETITIONS / 2,
+                   samples.end());
+  return samples[REPETITIONS / 2];
+}
+
+auto run(gfx::ThreadPool& thread_pool, uint32_t count) -> Timings
+{
+  gfx::Scene scene(thread_pool);
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+  std::uniform_real_distribution<float> angle(0.0f, 6.28f);
+  std::vector<gfx::Entity> entities;
+  entities.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    gfx::Entity entity =
+        scene.create(gfx::RENDERABLE | gfx::BOUNDS_COMPONENT);
+    scene.set_transform(
+        entity, {position(random), position(random), position(random)},
+        gfx::math::axis_angle({0.0f, 0.0f, 1.0f}, angle(random)),
+        {1.0f, 1.0f, 1.0f});
+    scene.set_bounds(entity, {{0.0f, 0.0f, 0.0f}, 1.0f});
+    scene.set_mesh(entity, i % 64);
+    entities.push_back(entity);
+  }
+  scene.update_transforms();
+  scene.collect_instance_updates();
+
+  Timings timings = {};
+  // A system moving every entity, rows split across the pool.
+  timings.full_ms = measure([&] {
+    scene.parallel_for_each(
+        gfx::TRANSFORM_COMPONENT, 4096,
+        [](gfx::Archetype& archetype, uint32_t begin, uint32_t end) {
+          float* z = archetype.transforms().translation[2];
+          for (uint32_t row = begin; row < end; ++row) {
+            z[row] += 0.01f;
+          }
+          archetype.mark_transforms_dirty(begin, end);
+        });
+    scene.update_transforms();
+  });
+  scene.collect_instance_updates();
+
+  // Few moving entities, created together so their rows are adjacent.
+  uint32_t moving = std::max(count * MOVING_PERCENT / 100, 1u);
+  timings.partial_ms = measure([&] {
+    for (uint32_t i = 0; i < moving; ++i) {
+      scene.set_transform(entities[i], {0.0f, 0.0f, position(random)},
+                          gfx::math::identity_quat(), {1.0f, 1.0f, 1.0f});
+    }
+    scene.update_transforms();
+  });
+  timings.collect_ms = measure([&] {
+    for (uint32_t i = 0; i < moving; ++i) {
+      scene.set_mesh(entities[i], (i + 1) % 64);
+    }
+    scene.collect_instance_updates();
+  });
+  timings.uploaded = scene.stats().uploaded_instances;
+  return timings;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Scene benchmark                                              //
+//                                                              //
+// Times the transform update of every entity, the update of    //
+// the 1% that moved, and the collection of the changed         //
+// instances for the renderer, from 1k entities up to max, on   //
+// the calling thread alone and on the whole thread pool.       //
+// Usage: vulkan-learning-scene-bench [max]                     //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  uint32_t max_count =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  if (max_count < 1000) {
+    std::cerr << "The entity count must be at least 1000." << std::endl;
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<gfx::ThreadPool>> pools;
+  pools.push_back(std::make_unique<gfx::ThreadPool>(0));
+  if (gfx::ThreadPool::default_worker_count() > 0) {
+    pools.push_back(std::make_unique<gfx::ThreadPool>());
+  }
+
+  std::cout << "Milliseconds per frame:" << std::endl;
+  std::cout << std::right << std::setw(10) << "entities" << std::setw(9)
+            << "threads" << std::setw(12) << "full" << std::setw(12)
+            << "ns/entity" << std::setw(12) << "1% moved" << std::setw(12)
+            << "collect" << std::setw(12) << "uploaded" << std::endl;
+  for (uint32_t count = 1000; count <= max_count; count *= 10) {
+    for (const auto& pool : pools) {
+      Timings timings = run(*pool, count);
+      std::cout << std::setw(10) << count << std::setw(9)
+                << pool->worker_count() + 1 << std::fixed
+                << std::setprecision(3) << std::setw(12) << timings.full_ms
+                << std::setw(12) << timings.full_ms * 1e6 / count
+                << std::setw(12) << timings.partial_ms << std::setw(12)
+                << timings.collect_ms << std::setw(12) << timings.uploaded
+                << std::defaultfloat << std::endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "host_allocator.h"
+#include "ktx2.h"
+#include "texture_streamer.h"
+#include "thread_pool.h"
+#include "vulkan_builders.h"
+#include "vulkan_null_driver.h"
+#include "vulkan_sync.h"
+
+#if defined(GFX_HAS_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace {
+
+using namespace gfx::vk_api;
+
+constexpr int REPETITIONS = 5;
+constexpr uint32_t RGBA8_BYTES = 4;
+// Frames the upload pass gives up after.
+constexpr uint32_t MAX_UPLOAD_FRAMES = 100000;
+
+// Header, level index and a basic data format descriptor with 1x1 blocks.
+auto write_ktx2(const std::string& path, uint32_t size,
+                gfx::Ktx2Supercompression scheme, uint32_t seed)
+    -> std::vector<std::byte>
+{
+  uint32_t level_count = 1;
+  while ((size >> level_count) > 0) {
+    ++level_count;
+  }
+
+  std::vector<std::vector<std::byte>> levels(level_count);
+  std::vector<std::vector<std::byte>> stored(level_count);
+  for (uint32_t level = 0; level < level_count; ++level) {
+    uint32_t extent = std::max(size >> level, 1u);
+    levels[level].resize(size_t{extent} * extent * RGBA8_BYTES);
+    // Smooth gradients with some noise, compressible like real albedo.
+    uint32_t state = seed * 747796405u + level;
+    for (size_t i = 0; i < levels[level].size(); ++i) {
+      state = state * 1664525u + 1013904223u;
+      size_t texel = i / RGBA8_BYTES;
+      auto value = static_cast<uint32_t>((texel % extent) + (texel / extent) +
+                                         ((state >> 28) & 7));
+      levels[level][i] = static_cast<std::byte>(value);
+    }
+    stored[level] = levels[level];
+#if defined(GFX_HAS_ZLIB)
+    if (scheme == gfx::Ktx2Supercompression::zlib) {
+      uLongf compressed_size = compressBound(levels[level].size());
+      stored[level].resize(compressed_size);
+      compress2(reinterpret_cast<Bytef*>(stored[level].data()),
+                &compressed_size,
+                reinterpret_cast<const Bytef*>(levels[level].data()),
+                levels[level].size(), Z_BEST_SPEED);
+      stored[level].resize(compressed_size);
+    }
+#endif
+  }
+
+  uint32_t dfd[11] = {44, 0, 2 | (40u << 16), 0, 0, RGBA8_BYTES, 0, 0, 0, 0, 0};
+  // 80 bytes, the supercompression global data fields stay 0.
+  uint32_t header[20] = {};
+  const uint8_t identifier[12] = {0xab, 'K', 'T', 'X', ' ', '2',
+                                  '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+  memcpy(header, identifier, sizeof(identifier));
+  header[3] = VK_FORMAT_R8G8B8A8_UNORM;
+  header[4] = 1;
+  header[5] = size;
+  header[6] = size;
+  header[9] = 1;
+  header[10] = level_count;
+  header[11] = static_cast<uint32_t>(scheme);
+  uint64_t dfd_offset = sizeof(header) + level_count * sizeof(gfx::Ktx2Level);
+  header[12] = static_cast<uint32_t>(dfd_offset);
+  header[13] = sizeof(dfd);
+
+  // Smallest level first, each 16 bytes aligned.
+  std::vector<gfx::Ktx2Level> level_index(level_count);
+  uint64_t offset = (dfd_offset + sizeof(dfd) + 15) / 16 * 16;
+  for (uint32_t level = level_count; level-- > 0;) {
+    level_index[level] = {offset, stored[level].size(), levels[level].size()};
+    offset = (offset + stored[level].size() + 15) / 16 * 16;
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(level_index.data()),
+             level_count * sizeof(gfx::Ktx2Level));
+  file.write(reinterpret_cast<const char*>(dfd), sizeof(dfd));
+  for (uint32_t level = level_count; level-- > 0;) {
+    file.seekp(static_cast<std::streamoff>(level_index[level].offset));
+    file.write(reinterpret_cast<const char*>(stored[level].data()),
+               stored[level].size());
+  }
+  return levels[0];
+}
+
+// Median wall time of a step, in milliseconds.
+template <typename Step>
+auto measure(Step step) -> double
+{
+  std::vector<double> samples;
+  for (int i = 0; i < REPETITIONS; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    step();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    samples.push_back(elapsed.count());
+  }
+  std::nth_element(samples.begin(), samples.begin() + REPETITIONS / 2,
+                   samples.end());
+  return samples[REPETITIONS / 2];
+}
+
+// Streams every texture in to its full resolution, one frame per submit,
+// and reports the upload throughput. Returns false if it did not complete.
+auto run_upload(VulkanDevice& device,
+                gfx::ThreadPool& thread_pool,
+                const std::vector<std::string>& paths) -> bool
+{
+  TextureStreamingLimits limits;
+  // Nothing is evicted, every level is uploaded once.
+  limits.memory_budget = std::numeric_limits<VkDeviceSize>::max();
+  limits.max_pending_steps = static_cast<uint32_t>(paths.size());
+  std::unique_ptr<TextureStreamer> streamer;
+  if (TextureStreamer::create(device, thread_pool, limits, streamer) !=
+      VK_SUCCESS) {
+    std::cerr << "Could not create the texture streamer." << std::endl;
+    return false;
+  }
+  std::vector<TextureHandle> textures(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (streamer->load(paths[i].c_str(), textures[i]) != VK_SUCCESS) {
+      std::cerr << "Could not load " << paths[i] << std::endl;
+      return false;
+    }
+  }
+
+  VkCommandPoolCreateInfo pool_create_info =
+      build<VkCommandPoolCreateInfo>()
+          .set(&VkCommandPoolCreateInfo::flags,
+               VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)
+          .set(&VkCommandPoolCreateInfo::queueFamilyIndex,
+               device.graphics_family);
+  VkCommandPool pool;
+  if (device.vkCreateCommandPool(device.logical_device, &pool_create_info,
+                                 allocation_callbacks(),
+                                 &pool) != VK_SUCCESS) {
+    std::cerr << "Could not create a command pool." << std::endl;
+    return false;
+  }
+  VkCommandBufferAllocateInfo allocate_info =
+      build<VkCommandBufferAllocateInfo>()
+          .set(&VkCommandBufferAllocateInfo::commandPool, pool)
+          .set(&VkCommandBufferAllocateInfo::level,
+               VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+          .set(&VkCommandBufferAllocateInfo::commandBufferCount, 1);
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  VkResult result = device.vkAllocateCommandBuffers(
+      device.logical_device, &allocate_info, &command_buffer);
+  VkCommandBufferBeginInfo begin_info = build<VkCommandBufferBeginInfo>().set(
+      &VkCommandBufferBeginInfo::flags,
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  VkSubmitInfo submit_info =
+      build<VkSubmitInfo>()
+          .set(&VkSubmitInfo::commandBufferCount, 1)
+          .set(&VkSubmitInfo::pCommandBuffers, &command_buffer);
+
+  // Each frame waits for the previous one, the staging region it reuses is
+  // free then.
+  uint64_t uploaded_bytes = 0;
+  uint32_t frames = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (result == VK_SUCCESS && frames < MAX_UPLOAD_FRAMES &&
+         streamer->stats().complete_textures < textures.size()) {
+    for (TextureHandle texture : textures) {
+      streamer->request(texture, 0);
+    }
+    device.vkResetCommandPool(device.logical_device, pool, 0);
+    device.vkBeginCommandBuffer(command_buffer, &begin_info);
+    result = streamer->record_uploads(command_buffer);
+    device.vkEndCommandBuffer(command_buffer);
+    uint64_t value = device.graphics_timeline->submit(&submit_info, 1);
+    if (value == 0 || !device.graphics_timeline->wait_until(value)) {
+      result = VK_ERROR_DEVICE_LOST;
+    }
+    uploaded_bytes += streamer->stats().uploaded_bytes;
+    ++frames;
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  device.vkDestroyCommandPool(device.logical_device, pool,
+                              allocation_callbacks());
+  bool complete = streamer->stats().complete_textures == textures.size();
+  if (!complete) {
+    std::cerr << "The textures were not streamed in: " << result_name(result)
+              << "." << std::endl;
+    return false;
+  }
+
+  std::cout << "upload: " << std::fixed << std::setprecision(1)
+            << uploaded_bytes / 1e6 << " MB in " << frames << " frames, "
+            << std::setprecision(3) << elapsed.count() << " ms, "
+            << std::setprecision(0) << uploaded_bytes / (elapsed.count() * 1e3)
+            << " MB/s" << std::defaultfloat << std::endl;
+  return true;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Texture streaming benchmark                                  //
+//                                                              //
+// Writes a set of KTX2 textures, plain and supercompressed     //
+// with every scheme the build supports, then times opening     //
+// them and decoding all their levels on the calling thread and //
+// on the thread pool, the CPU side of the texture streamer.    //
+// The files are read back from the page cache. When a device   //
+// can be created, the plain textures are then streamed to it   //
+// and the upload throughput is reported: on lavapipe (--device //
+// llvmpipe) for numbers comparable across machines, on the     //
+// null driver for the CPU side of the uploads alone.           //
+// Usage: vulkan-learning-texture-bench [size] [count]          //
+//        [--device name] [--null-driver]                       //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  std::vector<const char*> arguments;
+  const char* device_name = nullptr;
+  bool null_driver = false;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--null-driver") == 0) {
+      null_driver = true;
+    }
+    else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+      device_name = argv[++i];
+    }
+    else {
+      arguments.push_back(argv[i]);
+    }
+  }
+  uint32_t size = arguments.size() > 0
+                      ? std::strtoul(arguments[0], nullptr, 10)
+                      : 2048;
+  uint32_t count = arguments.size() > 1
+                       ? std::strtoul(arguments[1], nullptr, 10)
+                       : 16;
+  if (size == 0 || count == 0) {
+    std::cerr << "The size and the count must be positive." << std::endl;
+    return 1;
+  }
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-textures";
+  std::filesystem::create_directories(directory);
+
+  std::vector<std::unique_ptr<gfx::ThreadPool>> pools;
+  pools.push_back(std::make_unique<gfx::ThreadPool>(0));
+  if (gfx::ThreadPool::default_worker_count() > 0) {
+    pools.push_back(std::make_unique<gfx::ThreadPool>());
+  }
+
+  std::cout << count << " textures of " << size << "x" << size
+            << " RGBA8 with all levels:" << std::endl;
+  std::cout << std::left << std::setw(8) << "scheme" << std::right
+            << std::setw(9) << "threads" << std::setw(12) << "ratio"
+            << std::setw(12) << "open ms" << std::setw(12) << "decode ms"
+            << std::setw(12) << "MB/s" << std::endl;
+  bool mismatch = false;
+  std::vector<std::string> upload_paths;
+  for (auto scheme :
+       {gfx::Ktx2Supercompression::none, gfx::Ktx2Supercompression::zstd,
+        gfx::Ktx2Supercompression::zlib}) {
+    // The bench writes zlib only, zstd files come from the asset tools.
+    bool writable = scheme != gfx::Ktx2Supercompression::zstd;
+    if (!gfx::Ktx2File::supports(scheme) || !writable) {
+      continue;
+    }
+    const char* name =
+        scheme == gfx::Ktx2Supercompression::none ? "none" : "zlib";
+    std::vector<std::string> paths;
+    std::vector<std::byte> reference;
+    for (uint32_t i = 0; i < count; ++i) {
+      paths.push_back((directory / (std::string(name) + "_" +
+                                    std::to_string(i) + ".ktx2"))
+                          .string());
+      std::vector<std::byte> level = write_ktx2(paths.back(), size, scheme, i);
+      if (i == 0) {
+        reference = std::move(level);
+      }
+    }
+    if (scheme == gfx::Ktx2Supercompression::none) {
+      upload_paths = paths;
+    }
+
+    std::vector<gfx::Ktx2File> files(count);
+    double open_ms = measure([&] {
+      for (uint32_t i = 0; i < count; ++i) {
+        if (!files[i].open(paths[i].c_str())) {
+          std::cerr << "Could not open " << paths[i] << std::endl;
+          std::exit(1);
+        }
+      }
+    });
+    uint64_t stored_bytes = 0;
+    uint64_t decoded_bytes = 0;
+    for (const gfx::Ktx2File& file : files) {
+      for (uint32_t level = 0; level < file.level_count(); ++level) {
+        stored_bytes += file.level(level).size;
+        decoded_bytes += file.level(level).uncompressed_size;
+      }
+    }
+
+    for (const auto& pool : pools) {
+      std::vector<std::vector<std::byte>> decoded(count);
+      std::atomic<bool> failed = false;
+      double decode_ms = measure([&] {
+        pool->parallel_for(count, 1, [&](uint32_t begin, uint32_t end) {
+          for (uint32_t i = begin; i < end; ++i) {
+            const gfx::Ktx2File& file = files[i];
+            size_t bytes = 0;
+            for (uint32_t level = 0; level < file.level_count(); ++level) {
+              bytes += file.level(level).uncompressed_size;
+            }
+            decoded[i].resize(bytes);
+            size_t offset = 0;
+            for (uint32_t level = 0; level < file.level_count(); ++level) {
+              if (!file.read_level(level, decoded[i].data() + offset)) {
+                failed = true;
+              }
+              offset += file.level(level).uncompressed_size;
+            }
+          }
+        });
+      });
+      mismatch = mismatch || failed ||
+                 memcmp(decoded[0].data(), reference.data(),
+                        reference.size()) != 0;
+
+      std::cout << std::left << std::setw(8) << name << std::right
+                << std::setw(9) << pool->worker_count() + 1 << std::fixed
+                << std::setprecision(3) << std::setw(12)
+                << static_cast<double>(stored_bytes) / decoded_bytes
+                << std::setw(12) << open_ms << std::setw(12) << decode_ms
+                << std::setw(12) << std::setprecision(0)
+                << decoded_bytes / (decode_ms * 1e3) << std::defaultfloat
+                << std::endl;
+    }
+  }
+
+  // The upload pass is optional, without a device only the decoding is
+  // measured.
+  bool uploaded = true;
+  if (null_driver) {
+    enable_null_driver();
+  }
+  VulkanDevice device;
+  VkResult initialized = initialize(true);
+  VkResult created = initialized;
+  if (initialized == VK_SUCCESS) {
+    created = create_headless_device(device, device_name);
+  }
+  if (created != VK_SUCCESS) {
+    std::cout << "No device (" << result_name(created)
+              << "), the uploads are not measured." << std::endl;
+  }
+  else {
+    // The streamer decodes on workers, it needs one at least.
+    gfx::ThreadPool thread_pool(
+        std::max(gfx::ThreadPool::default_worker_count(), 1u));
+    uploaded = run_upload(device, thread_pool, upload_paths);
+    gfx::destroy_device(device);
+  }
+  if (initialized == VK_SUCCESS) {
+    destroy();
+  }
+
+  std::filesystem::remove_all(directory);
+  if (mismatch) {
+    std::cerr << "Decoded levels differ from the written ones." << std::endl;
+  }
+  return mismatch || !uploaded ? 1 : 0;
+}
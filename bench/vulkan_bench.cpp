@@ -0,0 +1,1279 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "culling.h"
+#include "dynamic_resolution.h"
+#include "geometry.h"
+#include "host_allocator.h"
+#include "log.h"
+#include "metrics.h"
+#include "shader_cache.h"
+#include "thread_pool.h"
+#include "vulkan_api.h"
+#include "vulkan_builders.h"
+#include "vulkan_capture.h"
+#include "vulkan_compute_jobs.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_dynamic_resolution.h"
+#include "vulkan_metrics.h"
+#include "vulkan_null_driver.h"
+#include "vulkan_object_cache.h"
+#include "vulkan_recovery.h"
+#include "vulkan_startup.h"
+#include "vulkan_submit.h"
+#include "vulkan_sync.h"
+
+namespace {
+
+using namespace gfx::vk_api;
+using Clock = std::chrono::steady_clock;
+
+// Run before the measured iterations of the frame loop and the uploads, so
+// driver caches and lazy allocations settle.
+constexpr int WARMUP_ITERATIONS = 10;
+// Frames of the frame loop written to the trace, from the end of the warm up.
+constexpr uint32_t CAPTURED_FRAMES = 16;
+constexpr uint32_t FRAMES_IN_FLIGHT = 2;
+constexpr VkExtent3D FRAME_EXTENT = {1280, 720, 1};
+// Split between the recording threads, so every thread count records the
+// same work.
+constexpr uint32_t RECORDED_COPIES = 16384;
+constexpr VkDeviceSize COPY_SIZE = 256;
+constexpr VkDeviceSize COPY_BUFFER_SIZE = 1 << 20;
+constexpr uint32_t LIVE_ALLOCATIONS = 64;
+constexpr VkDeviceSize ALLOCATION_SIZES[] = {4 << 10, 64 << 10, 256 << 10,
+                                             1 << 20, 4 << 20};
+constexpr VkDeviceSize UPLOAD_SIZE = 64 << 20;
+// Passes of a frame looking up their objects, and frames between two
+// evictions of the target, as a resize would.
+constexpr uint32_t CACHED_PASSES = 16;
+constexpr int FRAMES_PER_RESIZE = 50;
+// Levels adjustments of RGBA8 images, as batches of compute jobs with a few
+// in flight. The kernel is compiled next to the benchmark.
+constexpr uint32_t IMAGE_WIDTH = 1920;
+constexpr uint32_t IMAGE_HEIGHT = 1080;
+constexpr VkDeviceSize IMAGE_SIZE = IMAGE_WIDTH * IMAGE_HEIGHT * 4;
+constexpr uint32_t BATCH_JOBS = 8;
+constexpr uint32_t JOBS_IN_FLIGHT = 3;
+constexpr const char* LEVELS_KERNEL_PATH = "shaders/adjust_levels.comp.spv";
+constexpr const char* SHADER_INDEX_PATH = "shaders/bench.index";
+// Instances scattered around the camera, about a tenth of them in view,
+// culled on the CPU and by the compute passes compiled next to the
+// benchmark.
+constexpr uint32_t CULLED_MESHES = 16;
+constexpr uint32_t CULLED_INSTANCES = 1 << 16;
+constexpr const char* BUILD_DRAWS_PATH = "shaders/build_draws.comp.spv";
+constexpr const char* CULL_INSTANCES_PATH = "shaders/cull_instances.comp.spv";
+
+struct Options {
+  const char* device_name = nullptr;
+  int iterations = 200;
+  std::vector<uint32_t> thread_counts = {1, 2, 4, 8};
+  std::string json_path = "vulkan-learning-bench.json";
+  std::string baseline_path;
+  // Allowed p50 slowdown against the baseline, as a fraction.
+  double tolerance = 0.1;
+  // Measures the CPU side alone, the driver calls are then reproducible.
+  bool null_driver = false;
+  // Trace of the frame loop for vulkan-learning-replay, none when empty.
+  std::string capture_path;
+  // Shares the metrics of the device for vkl-top.
+  bool metrics = false;
+};
+
+struct Result {
+  std::string name;
+  const char* unit;
+  std::vector<double> samples;
+  // Bytes moved per iteration, 0 when throughput means nothing.
+  VkDeviceSize bytes;
+  // Per sample, on the null driver only.
+  double calls;
+  double submits;
+  double barriers;
+  double allocations;
+};
+
+auto elapsed_ms(Clock::time_point start) -> double
+{
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+  return elapsed.count();
+}
+
+// Nearest rank on sorted samples.
+auto percentile(const std::vector<double>& sorted, double fraction) -> double
+{
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  auto rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+auto create_command_pool(VulkanDevice& device) -> VkCommandPool
+{
+  VkCommandPoolCreateInfo create_info =
+      build<VkCommandPoolCreateInfo>()
+          .set(&VkCommandPoolCreateInfo::flags,
+               VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)
+          .set(&VkCommandPoolCreateInfo::queueFamilyIndex,
+               device.graphics_family);
+  VkCommandPool pool;
+  if (device.vkCreateCommandPool(device.logical_device, &create_info,
+                                 allocation_callbacks(),
+                                 &pool) != VK_SUCCESS) {
+    std::cerr << "Could not create a command pool!" << std::endl;
+    std::terminate();
+  }
+  return pool;
+}
+
+auto allocate_command_buffer(VulkanDevice& device, VkCommandPool pool)
+    -> VkCommandBuffer
+{
+  VkCommandBufferAllocateInfo allocate_info =
+      build<VkCommandBufferAllocateInfo>()
+          .set(&VkCommandBufferAllocateInfo::commandPool, pool)
+          .set(&VkCommandBufferAllocateInfo::level,
+               VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+          .set(&VkCommandBufferAllocateInfo::commandBufferCount, 1);
+  VkCommandBuffer command_buffer;
+  if (device.vkAllocateCommandBuffers(device.logical_device, &allocate_info,
+                                      &command_buffer) != VK_SUCCESS) {
+    std::cerr << "Could not allocate a command buffer!" << std::endl;
+    std::terminate();
+  }
+  return command_buffer;
+}
+
+auto make_buffer(VulkanDevice& device, VkDeviceSize size,
+                 VkBufferUsageFlags usage, VkMemoryPropertyFlags required)
+    -> Buffer
+{
+  Buffer buffer;
+  if (create_buffer(device, size, usage, required, 0, false, buffer) !=
+      VK_SUCCESS) {
+    std::cerr << "Could not create a buffer!" << std::endl;
+    std::terminate();
+  }
+  return buffer;
+}
+
+auto begin(VulkanDevice& device, VkCommandBuffer command_buffer) -> void
+{
+  VkCommandBufferBeginInfo begin_info =
+      build<VkCommandBufferBeginInfo>().set(
+          &VkCommandBufferBeginInfo::flags,
+          VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  device.vkBeginCommandBuffer(command_buffer, &begin_info);
+}
+
+// Returns the timeline value signaled once the command buffers retire.
+auto submit(VulkanDevice& device, const VkCommandBuffer* command_buffers,
+            uint32_t count) -> uint64_t
+{
+  VkSubmitInfo submit_info =
+      build<VkSubmitInfo>()
+          .set(&VkSubmitInfo::commandBufferCount, count)
+          .set(&VkSubmitInfo::pCommandBuffers, command_buffers);
+  uint64_t value = device.graphics_timeline->submit(&submit_info, 1);
+  if (value == 0) {
+    std::cerr << "Could not submit the benchmark work!" << std::endl;
+    std::terminate();
+  }
+  return value;
+}
+
+// Hands command buffers of the graphics queue to the device's aggregator,
+// from any thread.
+auto enqueue(VulkanDevice& device, const VkCommandBuffer* command_buffers,
+             uint32_t count) -> void
+{
+  SubmitRequest request = {};
+  request.queue = device.graphics_queue;
+  request.command_buffer_count = count;
+  request.command_buffers = command_buffers;
+  device.submit_aggregator->enqueue(request);
+}
+
+// Submits what was enqueued, once per frame. Returns the timeline value
+// signaled once it retires.
+auto flush(VulkanDevice& device) -> uint64_t
+{
+  if (device.submit_aggregator->flush().result != VK_SUCCESS) {
+    std::cerr << "Could not submit the benchmark work!" << std::endl;
+    std::terminate();
+  }
+  return device.graphics_timeline->last_submitted_value();
+}
+
+auto destroy_now(VulkanDevice& device, Buffer& buffer) -> void
+{
+  device.vkDestroyBuffer(device.logical_device, buffer.buffer,
+                         allocation_callbacks());
+  device.vkFreeMemory(device.logical_device, buffer.memory,
+                      allocation_callbacks());
+  buffer = {};
+}
+
+// Device local image of the frame extent.
+auto create_frame_target(VulkanDevice& device, VkImageUsageFlags usage,
+                         VkDeviceMemory& memory) -> VkImage
+{
+  auto image_create_info =
+      build<VkImageCreateInfo>()
+          .set(&VkImageCreateInfo::imageType, VK_IMAGE_TYPE_2D)
+          .set(&VkImageCreateInfo::format, VK_FORMAT_R8G8B8A8_UNORM)
+          .set(&VkImageCreateInfo::extent, FRAME_EXTENT)
+          .set(&VkImageCreateInfo::mipLevels, 1)
+          .set(&VkImageCreateInfo::arrayLayers, 1)
+          .set(&VkImageCreateInfo::samples, VK_SAMPLE_COUNT_1_BIT)
+          .set(&VkImageCreateInfo::tiling, VK_IMAGE_TILING_OPTIMAL)
+          .set(&VkImageCreateInfo::usage, usage)
+          .set(&VkImageCreateInfo::sharingMode, VK_SHARING_MODE_EXCLUSIVE)
+          .set(&VkImageCreateInfo::initialLayout, VK_IMAGE_LAYOUT_UNDEFINED);
+  VkImage image;
+  VkMemoryRequirements requirements;
+  if (device.vkCreateImage(device.logical_device, &image_create_info.get(),
+                           allocation_callbacks(), &image) != VK_SUCCESS) {
+    std::cerr << "Could not create the frame target!" << std::endl;
+    std::terminate();
+  }
+  device.vkGetImageMemoryRequirements(device.logical_device, image,
+                                      &requirements);
+  VkMemoryAllocateInfo allocate_info =
+      build<VkMemoryAllocateInfo>()
+          .set(&VkMemoryAllocateInfo::allocationSize, requirements.size)
+          .set(&VkMemoryAllocateInfo::memoryTypeIndex,
+               find_memory_type(device, requirements.memoryTypeBits,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+  if (device.vkAllocateMemory(device.logical_device, &allocate_info,
+                              allocation_callbacks(), &memory) != VK_SUCCESS ||
+      device.vkBindImageMemory(device.logical_device, image, memory, 0) !=
+          VK_SUCCESS) {
+    std::cerr << "Could not allocate the frame target!" << std::endl;
+    std::terminate();
+  }
+  return image;
+}
+
+// Instance and device creation and teardown, in full, every iteration.
+auto run_startup(const Options& options) -> Result
+{
+  Result result = {"startup", "ms", {}, 0, 0, 0, 0, 0};
+  int iterations = std::max(options.iterations / 10, 5);
+  for (int i = 0; i < iterations; ++i) {
+    startup_timings() = {};
+    auto start = Clock::now();
+    VulkanDevice device;
+    if (initialize(true) != VK_SUCCESS ||
+        create_headless_device(device, options.device_name) != VK_SUCCESS) {
+      std::cerr << "Could not create the device!" << std::endl;
+      std::terminate();
+    }
+    result.samples.push_back(elapsed_ms(start));
+    gfx::destroy_device(device);
+    destroy();
+  }
+  return result;
+}
+
+// CPU time of a frame recording and submitting a clear of an offscreen
+// target, with the frames in flight throttled by the GPU.
+auto run_frame_loop(VulkanDevice& device, const Options& options) -> Result
+{
+  Result result = {"frame_loop", "ms", {}, 0, 0, 0, 0, 0};
+
+  VkDeviceMemory memory;
+  VkImage image =
+      create_frame_target(device, VK_IMAGE_USAGE_TRANSFER_DST_BIT, memory);
+
+  struct Frame {
+    VkCommandPool pool;
+    VkCommandBuffer command_buffer;
+    uint64_t retired_value;
+  };
+  Frame frames[FRAMES_IN_FLIGHT];
+  for (Frame& frame : frames) {
+    frame.pool = create_command_pool(device);
+    frame.command_buffer = allocate_command_buffer(device, frame.pool);
+    frame.retired_value = 0;
+  }
+
+  VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  // The previous contents are discarded, no frame reads them.
+  VkImageMemoryBarrier barrier =
+      build<VkImageMemoryBarrier>()
+          .set(&VkImageMemoryBarrier::dstAccessMask,
+               VK_ACCESS_TRANSFER_WRITE_BIT)
+          .set(&VkImageMemoryBarrier::oldLayout, VK_IMAGE_LAYOUT_UNDEFINED)
+          .set(&VkImageMemoryBarrier::newLayout,
+               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+          .set(&VkImageMemoryBarrier::srcQueueFamilyIndex,
+               VK_QUEUE_FAMILY_IGNORED)
+          .set(&VkImageMemoryBarrier::dstQueueFamilyIndex,
+               VK_QUEUE_FAMILY_IGNORED)
+          .set(&VkImageMemoryBarrier::image, image)
+          .set(&VkImageMemoryBarrier::subresourceRange, range);
+  for (int i = 0; i < WARMUP_ITERATIONS + options.iterations; ++i) {
+    if (i == WARMUP_ITERATIONS && !options.capture_path.empty() &&
+        !begin_capture(device, options.capture_path.c_str(),
+                       CAPTURED_FRAMES)) {
+      std::cerr << "Could not capture to " << options.capture_path << "."
+                << std::endl;
+    }
+    auto start = Clock::now();
+    Frame& frame = frames[i % FRAMES_IN_FLIGHT];
+    device.graphics_timeline->wait_until(frame.retired_value);
+    device.vkResetCommandPool(device.logical_device, frame.pool, 0);
+    begin(device, frame.command_buffer);
+    device.vkCmdPipelineBarrier(frame.command_buffer,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                0, nullptr, 1, &barrier);
+    float shade = static_cast<float>(i % 256) / 255.0f;
+    VkClearColorValue color = {{shade, shade, shade, 1.0f}};
+    device.vkCmdClearColorImage(frame.command_buffer, image,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color,
+                                1, &range);
+    device.vkEndCommandBuffer(frame.command_buffer);
+    enqueue(device, &frame.command_buffer, 1);
+    frame.retired_value = flush(device);
+    if (i >= WARMUP_ITERATIONS) {
+      result.samples.push_back(elapsed_ms(start));
+    }
+    end_capture_frame();
+    end_metrics_frame();
+  }
+
+  device.graphics_timeline->wait_idle();
+  for (Frame& frame : frames) {
+    device.vkDestroyCommandPool(device.logical_device, frame.pool,
+                                allocation_callbacks());
+  }
+  device.vkDestroyImage(device.logical_device, image, allocation_callbacks());
+  device.vkFreeMemory(device.logical_device, memory, allocation_callbacks());
+  return result;
+}
+
+// Wall time of recording the same copies into one command buffer per
+// thread, each from its own pool. Every thread enqueues its command buffer
+// to the aggregator, which submits them at once.
+auto run_recording(VulkanDevice& device, uint32_t thread_count,
+                   const Options& options) -> Result
+{
+  Result result = {"record_threads_" + std::to_string(thread_count),
+                   "ms", {}, 0, 0, 0, 0, 0};
+  gfx::ThreadPool thread_pool(thread_count - 1);
+  Buffer source = make_buffer(device, COPY_BUFFER_SIZE,
+                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  Buffer destination = make_buffer(device, COPY_BUFFER_SIZE,
+                                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  std::vector<VkCommandPool> pools(thread_count);
+  std::vector<VkCommandBuffer> command_buffers(thread_count);
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    pools[i] = create_command_pool(device);
+    command_buffers[i] = allocate_command_buffer(device, pools[i]);
+  }
+
+  uint32_t copies_per_thread = RECORDED_COPIES / thread_count;
+  auto record = [&](uint32_t begin_index, uint32_t end_index) {
+    for (uint32_t i = begin_index; i < end_index; ++i) {
+      begin(device, command_buffers[i]);
+      for (uint32_t copy = 0; copy < copies_per_thread; ++copy) {
+        VkDeviceSize offset =
+            (copy * COPY_SIZE) % (COPY_BUFFER_SIZE - COPY_SIZE);
+        VkBufferCopy region = {offset, offset, COPY_SIZE};
+        device.vkCmdCopyBuffer(command_buffers[i], source.buffer,
+                               destination.buffer, 1, &region);
+      }
+      device.vkEndCommandBuffer(command_buffers[i]);
+      enqueue(device, &command_buffers[i], 1);
+    }
+  };
+  for (int i = 0; i < options.iterations; ++i) {
+    for (VkCommandPool pool : pools) {
+      device.vkResetCommandPool(device.logical_device, pool, 0);
+    }
+    auto start = Clock::now();
+    thread_pool.parallel_for(thread_count, 1, record);
+    result.samples.push_back(elapsed_ms(start));
+    // Keeps the recorded buffers honest, drivers may defer work to submit.
+    device.graphics_timeline->wait_until(flush(device));
+  }
+
+  for (VkCommandPool pool : pools) {
+    device.vkDestroyCommandPool(device.logical_device, pool,
+                                allocation_callbacks());
+  }
+  destroy_now(device, source);
+  destroy_now(device, destination);
+  return result;
+}
+
+// Time to free a buffer and create one of another size, with a fixed
+// number of buffers alive.
+auto run_allocator_churn(VulkanDevice& device, const Options& options)
+    -> Result
+{
+  Result result = {"allocator_churn", "us", {}, 0, 0, 0, 0, 0};
+  // Same sequence every run.
+  std::mt19937 random(1);
+  std::uniform_int_distribution<size_t> pick_size(
+      0, std::size(ALLOCATION_SIZES) - 1);
+  std::uniform_int_distribution<uint32_t> pick_live(0, LIVE_ALLOCATIONS - 1);
+  auto allocate = [&] {
+    return make_buffer(device, ALLOCATION_SIZES[pick_size(random)],
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                           VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  };
+
+  std::vector<Buffer> live;
+  for (uint32_t i = 0; i < LIVE_ALLOCATIONS; ++i) {
+    live.push_back(allocate());
+  }
+  for (int i = 0; i < options.iterations * 10; ++i) {
+    Buffer& buffer = live[pick_live(random)];
+    auto start = Clock::now();
+    destroy_now(device, buffer);
+    buffer = allocate();
+    result.samples.push_back(elapsed_ms(start) * 1000.0);
+  }
+  for (Buffer& buffer : live) {
+    destroy_now(device, buffer);
+  }
+  return result;
+}
+
+// Copy to a mapped staging buffer, then to device local memory, waited for.
+auto run_upload(VulkanDevice& device, const Options& options) -> Result
+{
+  Result result = {"upload", "ms", {}, UPLOAD_SIZE, 0, 0, 0, 0};
+  Buffer staging = make_buffer(device, UPLOAD_SIZE,
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  Buffer destination = make_buffer(device, UPLOAD_SIZE,
+                                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  std::vector<std::byte> data(UPLOAD_SIZE);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<std::byte>(i * 7);
+  }
+  VkCommandPool pool = create_command_pool(device);
+  VkCommandBuffer command_buffer = allocate_command_buffer(device, pool);
+
+  int iterations = std::max(options.iterations / 10, 10);
+  for (int i = 0; i < WARMUP_ITERATIONS + iterations; ++i) {
+    auto start = Clock::now();
+    memcpy(staging.mapped, data.data(), data.size());
+    device.vkResetCommandPool(device.logical_device, pool, 0);
+    begin(device, command_buffer);
+    VkBufferCopy region = {0, 0, UPLOAD_SIZE};
+    device.vkCmdCopyBuffer(command_buffer, staging.buffer, destination.buffer,
+                           1, &region);
+    device.vkEndCommandBuffer(command_buffer);
+    device.graphics_timeline->wait_until(submit(device, &command_buffer, 1));
+    if (i >= WARMUP_ITERATIONS) {
+      result.samples.push_back(elapsed_ms(start));
+    }
+  }
+
+  device.vkDestroyCommandPool(device.logical_device, pool,
+                              allocation_callbacks());
+  destroy_now(device, staging);
+  destroy_now(device, destination);
+  return result;
+}
+
+// Lookups of the render pass, target view, framebuffer and sampler of every
+// pass of a frame. Most frames only hit, the target is evicted every few
+// frames and its view and framebuffers are created again.
+auto run_object_cache(VulkanDevice& device, const Options& options)
+    -> Result
+{
+  Result result = {"object_cache", "us", {}, 0, 0, 0, 0, 0};
+  ObjectCache& cache = *device.object_cache;
+  VkDeviceMemory memory;
+  VkImage image = create_frame_target(
+      device, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, memory);
+
+  VkAttachmentDescription attachment = {
+      0,
+      VK_FORMAT_R8G8B8A8_UNORM,
+      VK_SAMPLE_COUNT_1_BIT,
+      VK_ATTACHMENT_LOAD_OP_CLEAR,
+      VK_ATTACHMENT_STORE_OP_STORE,
+      VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  VkAttachmentReference color = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color;
+  VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  VkImageViewCreateInfo view_create_info =
+      build<VkImageViewCreateInfo>()
+          .set(&VkImageViewCreateInfo::image, image)
+          .set(&VkImageViewCreateInfo::viewType, VK_IMAGE_VIEW_TYPE_2D)
+          .set(&VkImageViewCreateInfo::format, VK_FORMAT_R8G8B8A8_UNORM)
+          .set(&VkImageViewCreateInfo::subresourceRange, range);
+  VkSamplerCreateInfo sampler_create_info =
+      build<VkSamplerCreateInfo>()
+          .set(&VkSamplerCreateInfo::magFilter, VK_FILTER_LINEAR)
+          .set(&VkSamplerCreateInfo::minFilter, VK_FILTER_LINEAR)
+          .set(&VkSamplerCreateInfo::mipmapMode,
+               VK_SAMPLER_MIPMAP_MODE_LINEAR);
+
+  for (int i = 0; i < WARMUP_ITERATIONS + options.iterations; ++i) {
+    if (i % FRAMES_PER_RESIZE == FRAMES_PER_RESIZE - 1) {
+      cache.evict_image(image);
+      device.deletion_queue->next_frame();
+    }
+    auto start = Clock::now();
+    for (uint32_t pass = 0; pass < CACHED_PASSES; ++pass) {
+      // Passes clear or keep the target, and sample their inputs with
+      // different lod biases.
+      attachment.loadOp = pass % 2 == 0 ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                                        : VK_ATTACHMENT_LOAD_OP_LOAD;
+      attachment.initialLayout =
+          pass % 2 == 0 ? VK_IMAGE_LAYOUT_UNDEFINED
+                        : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      VkRenderPassCreateInfo render_pass_create_info =
+          build<VkRenderPassCreateInfo>()
+              .set(&VkRenderPassCreateInfo::attachmentCount, 1)
+              .set(&VkRenderPassCreateInfo::pAttachments, &attachment)
+              .set(&VkRenderPassCreateInfo::subpassCount, 1)
+              .set(&VkRenderPassCreateInfo::pSubpasses, &subpass);
+      VkRenderPass render_pass = cache.render_pass(render_pass_create_info);
+      VkImageView view = cache.image_view(view_create_info);
+      VkFramebufferCreateInfo framebuffer_create_info =
+          build<VkFramebufferCreateInfo>()
+              .set(&VkFramebufferCreateInfo::renderPass, render_pass)
+              .set(&VkFramebufferCreateInfo::attachmentCount, 1)
+              .set(&VkFramebufferCreateInfo::pAttachments, &view)
+              .set(&VkFramebufferCreateInfo::width, FRAME_EXTENT.width)
+              .set(&VkFramebufferCreateInfo::height, FRAME_EXTENT.height)
+              .set(&VkFramebufferCreateInfo::layers, 1);
+      sampler_create_info.mipLodBias = static_cast<float>(pass % 4);
+      if (render_pass == VK_NULL_HANDLE || view == VK_NULL_HANDLE ||
+          cache.framebuffer(framebuffer_create_info) == VK_NULL_HANDLE ||
+          cache.sampler(sampler_create_info) == VK_NULL_HANDLE) {
+        std::cerr << "Could not create the cached objects!" << std::endl;
+        std::terminate();
+      }
+    }
+    if (i >= WARMUP_ITERATIONS) {
+      result.samples.push_back(elapsed_ms(start) * 1000.0);
+    }
+  }
+
+  ObjectCacheStats stats = cache.stats();
+  GFX_LOG_INFO("Object cache: {} framebuffer hits, {} misses, {} evicted.",
+               stats.framebuffers.hits, stats.framebuffers.misses,
+               stats.framebuffers.evictions);
+  cache.evict_image(image);
+  device.deletion_queue->flush();
+  device.vkDestroyImage(device.logical_device, image, allocation_callbacks());
+  device.vkFreeMemory(device.logical_device, memory, allocation_callbacks());
+  return result;
+}
+
+// The frame loop at a dynamic resolution: each frame clears the scaled
+// region of a full size target and upscales it to the output, timed on the
+// GPU. The null driver takes no GPU time, the scale then stays at its
+// maximum.
+auto run_dynamic_resolution(VulkanDevice& device, const Options& options)
+    -> Result
+{
+  Result result = {"dynamic_resolution", "ms", {}, 0, 0, 0, 0, 0};
+  VkDeviceMemory target_memory;
+  VkImage target = create_frame_target(
+      device, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      target_memory);
+  VkDeviceMemory output_memory;
+  VkImage output = create_frame_target(
+      device, VK_IMAGE_USAGE_TRANSFER_DST_BIT, output_memory);
+  VkExtent2D output_extent = {FRAME_EXTENT.width, FRAME_EXTENT.height};
+
+  VkCommandPool pools[FRAMES_IN_FLIGHT];
+  VkCommandBuffer command_buffers[FRAMES_IN_FLIGHT];
+  uint64_t retired_values[FRAMES_IN_FLIGHT] = {};
+  for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+    pools[i] = create_command_pool(device);
+    command_buffers[i] = allocate_command_buffer(device, pools[i]);
+  }
+  GpuFrameTimer timer(device, FRAMES_IN_FLIGHT);
+  gfx::ResolutionController controller;
+
+  VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  auto barrier = [&](VkImage image, VkImageLayout old_layout,
+                     VkImageLayout new_layout, VkAccessFlags source_access,
+                     VkAccessFlags destination_access) {
+    return build<VkImageMemoryBarrier>()
+        .set(&VkImageMemoryBarrier::srcAccessMask, source_access)
+        .set(&VkImageMemoryBarrier::dstAccessMask, destination_access)
+        .set(&VkImageMemoryBarrier::oldLayout, old_layout)
+        .set(&VkImageMemoryBarrier::newLayout, new_layout)
+        .set(&VkImageMemoryBarrier::srcQueueFamilyIndex,
+             VK_QUEUE_FAMILY_IGNORED)
+        .set(&VkImageMemoryBarrier::dstQueueFamilyIndex,
+             VK_QUEUE_FAMILY_IGNORED)
+        .set(&VkImageMemoryBarrier::image, image)
+        .set(&VkImageMemoryBarrier::subresourceRange, range)
+        .get();
+  };
+  // Both images are discarded every frame.
+  VkImageMemoryBarrier discard[] = {
+      barrier(target, VK_IMAGE_LAYOUT_UNDEFINED,
+              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+              VK_ACCESS_TRANSFER_WRITE_BIT),
+      barrier(output, VK_IMAGE_LAYOUT_UNDEFINED,
+              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+              VK_ACCESS_TRANSFER_WRITE_BIT)};
+  VkImageMemoryBarrier rendered =
+      barrier(target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+              VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+  int frame_count = WARMUP_ITERATIONS + options.iterations;
+  for (int i = 0; i < frame_count; ++i) {
+    auto start = Clock::now();
+    uint32_t slot = i % FRAMES_IN_FLIGHT;
+    device.graphics_timeline->wait_until(retired_values[slot]);
+    double gpu_ms;
+    if (i >= static_cast<int>(FRAMES_IN_FLIGHT) &&
+        timer.read(i - FRAMES_IN_FLIGHT, gpu_ms)) {
+      controller.update(gpu_ms);
+    }
+    VkExtent2D extent = render_extent(controller, output_extent);
+
+    VkCommandBuffer command_buffer = command_buffers[slot];
+    device.vkResetCommandPool(device.logical_device, pools[slot], 0);
+    begin(device, command_buffer);
+    timer.begin(command_buffer, i);
+    device.vkCmdPipelineBarrier(command_buffer,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                0, nullptr, 2, discard);
+    VkClearColorValue color = {{0.25f, 0.5f, 0.75f, 1.0f}};
+    device.vkCmdClearColorImage(command_buffer, target,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color,
+                                1, &range);
+    device.vkCmdPipelineBarrier(command_buffer,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                0, nullptr, 1, &rendered);
+    record_upscale(device, command_buffer, target, extent, output,
+                   output_extent);
+    timer.end(command_buffer, i);
+    device.vkEndCommandBuffer(command_buffer);
+    retired_values[slot] = submit(device, &command_buffer, 1);
+    if (i >= WARMUP_ITERATIONS) {
+      result.samples.push_back(elapsed_ms(start));
+    }
+  }
+  GFX_LOG_INFO("Dynamic resolution: scale {}, GPU frame {} ms.",
+               controller.scale(), controller.smoothed_ms());
+
+  device.graphics_timeline->wait_idle();
+  for (VkCommandPool pool : pools) {
+    device.vkDestroyCommandPool(device.logical_device, pool,
+                                allocation_callbacks());
+  }
+  for (auto [image, memory] :
+       {std::pair(target, target_memory), std::pair(output, output_memory)}) {
+    device.vkDestroyImage(device.logical_device, image,
+                          allocation_callbacks());
+    device.vkFreeMemory(device.logical_device, memory,
+                        allocation_callbacks());
+  }
+  return result;
+}
+
+// Frustum culling of a scattered scene through the geometry batcher, on the
+// CPU without culling shaders and on the GPU with them. A CPU sample is the
+// cull time the batcher reports, a GPU one the CPU time of the frame that
+// records the passes, whose GPU time the null driver does not have.
+auto run_culling(VulkanDevice& device, const GeometryShaders& shaders,
+                 const Options& options) -> Result
+{
+  bool gpu = !shaders.cull_instances.empty();
+  Result result = {gpu ? "culling_gpu" : "culling_cpu", "ms", {}, 0, 0, 0, 0,
+                   0};
+  GeometryLimits limits;
+  limits.mesh_capacity = CULLED_MESHES;
+  limits.instance_capacity = CULLED_INSTANCES;
+  std::unique_ptr<GeometryBatcher> batcher;
+  if (GeometryBatcher::create(device, limits, shaders, batcher) !=
+          VK_SUCCESS ||
+      batcher->uses_gpu_culling() != gpu) {
+    std::cerr << "Could not create the geometry batcher!" << std::endl;
+    std::terminate();
+  }
+
+  // Cubes of growing sizes.
+  const uint32_t cube_indices[] = {0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5,
+                                   0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6,
+                                   0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3};
+  std::vector<BoundingSphere> bounds;
+  for (uint32_t i = 0; i < CULLED_MESHES; ++i) {
+    float size = 0.5f + 0.25f * static_cast<float>(i);
+    Vertex vertices[8] = {};
+    for (uint32_t corner = 0; corner < 8; ++corner) {
+      vertices[corner].position[0] = corner & 4 ? size : -size;
+      vertices[corner].position[1] = corner & 2 ? size : -size;
+      vertices[corner].position[2] = corner & 1 ? size : -size;
+    }
+    MeshHandle mesh;
+    if (batcher->add_mesh(vertices, 8, cube_indices, std::size(cube_indices),
+                          mesh) != VK_SUCCESS) {
+      std::cerr << "Could not add a mesh!" << std::endl;
+      std::terminate();
+    }
+    bounds.push_back(compute_bounding_sphere(vertices, 8));
+  }
+  std::vector<Instance> instances(CULLED_INSTANCES);
+  std::mt19937 random(13);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+  for (uint32_t i = 0; i < CULLED_INSTANCES; ++i) {
+    Instance& instance = instances[i];
+    float transform[12] = {1.0f, 0.0f, 0.0f, position(random),
+                           0.0f, 1.0f, 0.0f, position(random),
+                           0.0f, 0.0f, 1.0f, position(random)};
+    memcpy(instance.transform, transform, sizeof(transform));
+    instance.mesh = i % CULLED_MESHES;
+    uint32_t index;
+    if (batcher->add_instance({instance.mesh}, transform, index) !=
+        VK_SUCCESS) {
+      std::cerr << "Could not add an instance!" << std::endl;
+      std::terminate();
+    }
+  }
+  CullingView view = {
+      gfx::math::perspective(1.0f, 16.0f / 9.0f, 0.1f, 200.0f) *
+          gfx::math::look_at({0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f},
+                             {0.0f, 1.0f, 0.0f}),
+      nullptr, false};
+
+  VkCommandPool pools[FRAMES_IN_FLIGHT];
+  VkCommandBuffer command_buffers[FRAMES_IN_FLIGHT];
+  uint64_t retired_values[FRAMES_IN_FLIGHT] = {};
+  for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; ++i) {
+    pools[i] = create_command_pool(device);
+    command_buffers[i] = allocate_command_buffer(device, pools[i]);
+  }
+  for (int i = 0; i < WARMUP_ITERATIONS + options.iterations; ++i) {
+    auto start = Clock::now();
+    uint32_t slot = i % FRAMES_IN_FLIGHT;
+    device.graphics_timeline->wait_until(retired_values[slot]);
+    VkCommandBuffer command_buffer = command_buffers[slot];
+    device.vkResetCommandPool(device.logical_device, pools[slot], 0);
+    begin(device, command_buffer);
+    batcher->record_build(command_buffer, &view);
+    device.vkEndCommandBuffer(command_buffer);
+    retired_values[slot] = submit(device, &command_buffer, 1);
+    if (i >= WARMUP_ITERATIONS) {
+      result.samples.push_back(gpu ? elapsed_ms(start)
+                                   : batcher->stats().cpu_cull_ms);
+    }
+  }
+
+  if (!gpu) {
+    std::vector<uint32_t> visible(CULLED_INSTANCES);
+    uint32_t expected = cull_instances(
+        gfx::math::extract_frustum(view.view_projection), bounds.data(),
+        CULLED_MESHES, instances.data(), CULLED_INSTANCES, visible.data());
+    uint32_t culled = batcher->stats().visible_instances;
+    if (culled != expected) {
+      std::cerr << "The batcher left " << culled << " instances instead of "
+                << expected << "!" << std::endl;
+      std::terminate();
+    }
+    GFX_LOG_INFO("CPU culling: {} of {} instances visible.", culled,
+                 CULLED_INSTANCES);
+  }
+
+  device.graphics_timeline->wait_idle();
+  for (VkCommandPool pool : pools) {
+    device.vkDestroyCommandPool(device.logical_device, pool,
+                                allocation_callbacks());
+  }
+  return result;
+}
+
+// Push constants of the levels kernel, after the range.
+struct Levels {
+  float black;
+  float white;
+  float gamma;
+};
+
+// What the kernel computes for a channel, within rounding.
+auto adjust_level(uint32_t channel, const Levels& levels) -> uint32_t
+{
+  float level = std::clamp(
+      (channel / 255.0f - levels.black) / (levels.white - levels.black), 0.0f,
+      1.0f);
+  return static_cast<uint32_t>(
+      std::lround(std::pow(level, 1.0f / levels.gamma) * 255.0f));
+}
+
+// A batch of levels adjustments, each job uploading its image, running the
+// kernel over it and reading the result back. A sample is the whole batch,
+// the transfers of a job then overlap the work of its neighbours.
+auto run_compute_jobs(VulkanDevice& device, const Options& options) -> Result
+{
+  Result result = {
+      "compute_jobs", "ms", {}, 2 * BATCH_JOBS * IMAGE_SIZE, 0, 0, 0, 0};
+  ShaderCache shader_cache(device, SHADER_INDEX_PATH);
+  const Shader* shader = nullptr;
+  ComputeKernel kernel;
+  if (shader_cache.load(LEVELS_KERNEL_PATH, shader) != VK_SUCCESS ||
+      create_compute_kernel(device, shader_cache, *shader, kernel) !=
+          VK_SUCCESS) {
+    std::cerr << "Could not create the levels kernel!" << std::endl;
+    std::terminate();
+  }
+  std::vector<std::vector<uint32_t>> images(BATCH_JOBS);
+  std::vector<std::vector<uint32_t>> outputs(BATCH_JOBS);
+  std::mt19937 random(7);
+  for (uint32_t i = 0; i < BATCH_JOBS; ++i) {
+    images[i].resize(IMAGE_WIDTH * IMAGE_HEIGHT);
+    std::generate(images[i].begin(), images[i].end(), std::ref(random));
+    outputs[i].resize(IMAGE_WIDTH * IMAGE_HEIGHT);
+  }
+  Levels levels = {0.1f, 0.9f, 2.2f};
+
+  std::unique_ptr<ComputeJobQueue> queue;
+  if (ComputeJobQueue::create(device, JOBS_IN_FLIGHT, queue) != VK_SUCCESS) {
+    std::cerr << "Could not create the compute job queue!" << std::endl;
+    std::terminate();
+  }
+  int iterations = std::max(options.iterations / 10, 10);
+  for (int i = 0; i < WARMUP_ITERATIONS + iterations; ++i) {
+    auto start = Clock::now();
+    for (uint32_t j = 0; j < BATCH_JOBS; ++j) {
+      ComputeJob job = {&kernel,
+                        {{images[j].data(), nullptr, IMAGE_SIZE},
+                         {nullptr, outputs[j].data(), IMAGE_SIZE}},
+                        {IMAGE_WIDTH, IMAGE_HEIGHT, 1},
+                        &levels};
+      if (queue->submit(job) == 0) {
+        std::cerr << "Could not submit a compute job!" << std::endl;
+        std::terminate();
+      }
+    }
+    if (!queue->wait_idle()) {
+      std::cerr << "A compute job failed!" << std::endl;
+      std::terminate();
+    }
+    if (i >= WARMUP_ITERATIONS) {
+      result.samples.push_back(elapsed_ms(start));
+    }
+  }
+
+  // The null driver runs no kernel.
+  if (!options.null_driver) {
+    for (uint32_t shift : {0, 8, 16}) {
+      uint32_t expected =
+          adjust_level((images[0][0] >> shift) & 0xff, levels);
+      uint32_t channel = (outputs[0][0] >> shift) & 0xff;
+      if (std::max(expected, channel) - std::min(expected, channel) > 1) {
+        std::cerr << "The levels kernel computed " << channel << " instead of "
+                  << expected << "!" << std::endl;
+        std::terminate();
+      }
+    }
+  }
+  queue.reset();
+  destroy_compute_kernel(device, kernel);
+  return result;
+}
+
+// Time to recover a lost device, restoring a device local and a host
+// visible buffer from their CPU copies. The null driver loses the device on
+// demand, the scenario runs on it only.
+auto run_device_recovery(VulkanDevice& device, const Options& options)
+    -> Result
+{
+  Result result = {"device_recovery", "ms", {}, 0, 0, 0, 0, 0};
+  std::vector<uint32_t> contents(COPY_BUFFER_SIZE / sizeof(uint32_t));
+  for (size_t i = 0; i < contents.size(); ++i) {
+    contents[i] = static_cast<uint32_t>(i);
+  }
+  std::unique_ptr<ResidentBuffer> vertices;
+  std::unique_ptr<ResidentBuffer> constants;
+  if (ResidentBuffer::create(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             contents.data(), COPY_BUFFER_SIZE,
+                             vertices) != VK_SUCCESS ||
+      ResidentBuffer::create(device, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                             contents.data(), COPY_BUFFER_SIZE,
+                             constants) != VK_SUCCESS) {
+    std::cerr << "Could not create the resident buffers!" << std::endl;
+    std::terminate();
+  }
+
+  int iterations = std::max(options.iterations / 10, 5);
+  for (int i = 0; i < iterations; ++i) {
+    lose_null_driver_device();
+    VkSubmitInfo submit_info = make_struct<VkSubmitInfo>();
+    if (device.graphics_timeline->submit(&submit_info, 1) != 0 ||
+        !device.graphics_timeline->device_lost()) {
+      std::cerr << "The device was not lost!" << std::endl;
+      std::terminate();
+    }
+    RecoveryTimings timings;
+    if (recover_device(device, &timings) != VK_SUCCESS) {
+      std::cerr << "Could not recover the device!" << std::endl;
+      std::terminate();
+    }
+    if (memcmp(constants->buffer().mapped, contents.data(),
+               COPY_BUFFER_SIZE) != 0) {
+      std::cerr << "The recovered buffer lost its contents!" << std::endl;
+      std::terminate();
+    }
+    result.samples.push_back(timings.total_ms);
+  }
+  return result;
+}
+
+// Driver work of the scenario per sample, counted since the stats were last
+// reset.
+auto add_driver_stats(Result& result) -> void
+{
+  NullDriverStats stats = null_driver_stats();
+  auto samples =
+      static_cast<double>(std::max<size_t>(result.samples.size(), 1));
+  result.calls = stats.calls / samples;
+  result.submits = stats.submits / samples;
+  result.barriers = stats.barriers / samples;
+  result.allocations = stats.allocations / samples;
+}
+
+auto write_json(const std::string& path, const char* device_name,
+                const std::vector<Result>& results) -> bool
+{
+  std::ofstream out(path, std::ios::trunc);
+  out << "{\n  \"device\": \"" << device_name << "\",\n  \"scenarios\": [\n";
+  out << std::fixed << std::setprecision(4);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    const std::vector<double>& samples = result.samples;
+    double mean = 0.0;
+    for (double sample : samples) {
+      mean += sample / samples.size();
+    }
+    out << "    {\"name\": \"" << result.name << "\", \"unit\": \""
+        << result.unit << "\", \"samples\": " << samples.size()
+        << ", \"mean\": " << mean
+        << ", \"p50\": " << percentile(samples, 0.5)
+        << ", \"p90\": " << percentile(samples, 0.9)
+        << ", \"p99\": " << percentile(samples, 0.99)
+        << ", \"max\": " << percentile(samples, 1.0);
+    if (result.bytes > 0) {
+      out << ", \"mb_per_s\": "
+          << result.bytes / (percentile(samples, 0.5) * 1e3);
+    }
+    if (result.calls > 0) {
+      out << ", \"calls\": " << result.calls
+          << ", \"submits\": " << result.submits
+          << ", \"barriers\": " << result.barriers
+          << ", \"allocations\": " << result.allocations;
+    }
+    out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+  return static_cast<bool>(out);
+}
+
+struct Baseline {
+  std::string name;
+  double p50;
+  // 0 unless the baseline ran on the null driver.
+  double calls;
+};
+
+// Reads the scenarios of a file write_json() wrote. Fails when the file
+// cannot be read or holds no scenario.
+auto read_baseline(const std::string& path, std::vector<Baseline>& baseline)
+    -> bool
+{
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  std::string json = text.str();
+  const std::string name_key = "\"name\": \"";
+  const std::string p50_key = "\"p50\": ";
+  const std::string calls_key = "\"calls\": ";
+  for (size_t name = json.find(name_key); name != std::string::npos;
+       name = json.find(name_key, name + 1)) {
+    size_t name_begin = name + name_key.size();
+    size_t name_end = json.find('"', name_begin);
+    size_t end = json.find('}', name_end);
+    size_t p50 = json.find(p50_key, name_end);
+    if (end == std::string::npos || p50 > end) {
+      break;
+    }
+    size_t calls = json.find(calls_key, name_end);
+    baseline.push_back(
+        {json.substr(name_begin, name_end - name_begin),
+         std::strtod(json.c_str() + p50 + p50_key.size(), nullptr),
+         calls < end
+             ? std::strtod(json.c_str() + calls + calls_key.size(), nullptr)
+             : 0.0});
+  }
+  return !baseline.empty();
+}
+
+auto parse_options(int argc, char** argv, Options& options) -> bool
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+    if (argument == "--null-driver") {
+      options.null_driver = true;
+      continue;
+    }
+    if (argument == "--metrics") {
+      options.metrics = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char* value = argv[++i];
+    if (argument == "--device") {
+      options.device_name = value;
+    }
+    else if (argument == "--iterations") {
+      options.iterations = std::max(std::atoi(value), 1);
+    }
+    else if (argument == "--threads") {
+      options.thread_counts.clear();
+      std::stringstream list(value);
+      std::string count;
+      while (std::getline(list, count, ',')) {
+        options.thread_counts.push_back(
+            std::max<uint32_t>(std::strtoul(count.c_str(), nullptr, 10), 1));
+      }
+    }
+    else if (argument == "--json") {
+      options.json_path = value;
+    }
+    else if (argument == "--baseline") {
+      options.baseline_path = value;
+    }
+    else if (argument == "--tolerance") {
+      options.tolerance = std::strtod(value, nullptr);
+    }
+    else if (argument == "--capture") {
+      options.capture_path = value;
+    }
+    else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Vulkan benchmark                                             //
+//                                                              //
+// Headless scenarios on a device without a surface: startup, a //
+// frame loop clearing an offscreen target, command recording   //
+// at several thread counts, buffer allocation churn, staging   //
+// uploads, object cache lookups, a frame loop at a dynamic     //
+// resolution, frustum culling on the CPU and the GPU, batches  //
+// of compute jobs and, on the null driver, recoveries from a   //
+// lost device. The GPU culling and the compute jobs run the    //
+// shaders compiled to shaders/ in the working directory, the   //
+// build directory, and are skipped without them. Writes        //
+// percentiles of every scenario as JSON, and with a baseline   //
+// from an earlier run, fails when a p50 got slower than the    //
+// tolerance allows, or when the baseline has no scenario to    //
+// compare. Run it on lavapipe (--device llvmpipe) for          //
+// numbers comparable across machines, or on the null driver to //
+// measure the CPU side alone. The null driver also counts the  //
+// driver calls, submits and barriers of every scenario, and    //
+// more calls than in the baseline fail too. With a capture     //
+// path, frames of the frame loop are written to a trace for    //
+// vulkan-learning-replay, the capture then slows every         //
+// scenario down. With --metrics, the devices and the host      //
+// allocator share their metrics for vkl-top.                   //
+// Usage: vulkan-learning-bench [--device name] [--iterations   //
+//        n] [--threads 1,2,4] [--json path] [--baseline path]  //
+//        [--tolerance 0.1] [--null-driver] [--capture path]    //
+//        [--metrics]                                           //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    std::cerr << "Usage: vulkan-learning-bench [--device name] [--iterations "
+                 "n] [--threads 1,2,4] [--json path] [--baseline path] "
+                 "[--tolerance 0.1] [--null-driver] [--capture path] "
+                 "[--metrics]"
+              << std::endl;
+    return 1;
+  }
+  if (options.null_driver) {
+    enable_null_driver();
+  }
+  // Every device registers its cache counters, startup's too.
+  if (options.metrics) {
+    gfx::enable_metrics();
+    host_allocator().publish_metrics();
+  }
+
+  std::vector<Result> results;
+  auto measure = [&](const std::function<Result()>& run) {
+    reset_null_driver_stats();
+    Result result = run();
+    if (options.null_driver) {
+      add_driver_stats(result);
+    }
+    results.push_back(std::move(result));
+  };
+  measure([&] { return run_startup(options); });
+
+  if (!options.capture_path.empty()) {
+    enable_capture();
+  }
+  VulkanDevice device;
+  VkResult created = initialize(true);
+  if (created == VK_SUCCESS) {
+    created = create_headless_device(device, options.device_name);
+  }
+  if (created != VK_SUCCESS) {
+    std::cerr << "Could not create the device: " << result_name(created)
+              << "." << std::endl;
+    return 1;
+  }
+  std::string device_name =
+      physical_device_snapshot().find(device.physical_device)->properties
+          .deviceName;
+  measure([&] { return run_frame_loop(device, options); });
+  for (uint32_t thread_count : options.thread_counts) {
+    measure([&] { return run_recording(device, thread_count, options); });
+  }
+  measure([&] { return run_allocator_churn(device, options); });
+  measure([&] { return run_upload(device, options); });
+  measure([&] { return run_object_cache(device, options); });
+  measure([&] { return run_dynamic_resolution(device, options); });
+  measure([&] { return run_culling(device, {}, options); });
+  GeometryShaders culling_shaders;
+  culling_shaders.build_draws = load_spirv(BUILD_DRAWS_PATH);
+  culling_shaders.cull_instances = load_spirv(CULL_INSTANCES_PATH);
+  if (culling_shaders.build_draws.empty() ||
+      culling_shaders.cull_instances.empty()) {
+    GFX_LOG_WARNING("{} not found, the GPU culling is not measured.",
+                    CULL_INSTANCES_PATH);
+  }
+  else {
+    measure([&] { return run_culling(device, culling_shaders, options); });
+  }
+  if (!std::filesystem::exists(LEVELS_KERNEL_PATH)) {
+    GFX_LOG_WARNING("{} not found, the compute jobs are not measured.",
+                    LEVELS_KERNEL_PATH);
+  }
+  else {
+    measure([&] { return run_compute_jobs(device, options); });
+  }
+  if (options.null_driver) {
+    measure([&] { return run_device_recovery(device, options); });
+  }
+  gfx::destroy_device(device);
+  destroy();
+
+  for (Result& result : results) {
+    std::sort(result.samples.begin(), result.samples.end());
+  }
+  // Keeps the log of the teardown above the results.
+  gfx::flush_log();
+  std::cout << "\n" << device_name << ":\n";
+  std::cout << std::left << std::setw(20) << "scenario" << std::right
+            << std::setw(6) << "unit" << std::setw(12) << "p50"
+            << std::setw(12) << "p90" << std::setw(12) << "p99"
+            << std::setw(12) << "max" << std::endl;
+  for (const Result& result : results) {
+    std::cout << std::left << std::setw(20) << result.name << std::right
+              << std::setw(6) << result.unit << std::fixed
+              << std::setprecision(3) << std::setw(12)
+              << percentile(result.samples, 0.5) << std::setw(12)
+              << percentile(result.samples, 0.9) << std::setw(12)
+              << percentile(result.samples, 0.99) << std::setw(12)
+              << percentile(result.samples, 1.0) << std::defaultfloat
+              << std::endl;
+  }
+  if (!write_json(options.json_path, device_name.c_str(), results)) {
+    std::cerr << "Could not write " << options.json_path << "." << std::endl;
+    return 1;
+  }
+
+  if (options.baseline_path.empty()) {
+    return 0;
+  }
+  // A missing baseline would silently turn the regression gate off.
+  std::vector<Baseline> baseline;
+  if (!read_baseline(options.baseline_path, baseline)) {
+    std::cerr << "Could not read a scenario from " << options.baseline_path
+              << "." << std::endl;
+    return 1;
+  }
+  // Scenarios this run did not measure are not compared.
+  bool regressed = false;
+  for (const Baseline& scenario : baseline) {
+    auto result = std::find_if(
+        results.begin(), results.end(),
+        [&](const Result& r) { return r.name == scenario.name; });
+    if (result == results.end()) {
+      std::cerr << scenario.name
+                << " of the baseline has no result, it is not compared."
+                << std::endl;
+      continue;
+    }
+    double p50 = percentile(result->samples, 0.5);
+    if (scenario.p50 > 0.0 &&
+        p50 > scenario.p50 * (1.0 + options.tolerance)) {
+      std::cerr << scenario.name << " regressed: p50 " << p50 << " "
+                << result->unit << " against " << scenario.p50 << "."
+                << std::endl;
+      regressed = true;
+    }
+    // Waits may poll a few more times, the rest is deterministic.
+    if (scenario.calls > 0.0 && result->calls > 0.0 &&
+        result->calls > scenario.calls * (1.0 + options.tolerance)) {
+      std::cerr << scenario.name << " regressed: " << result->calls
+                << " driver calls against " << scenario.calls << "."
+                << std::endl;
+      regressed = true;
+    }
+  }
+  return regressed ? 1 : 0;
+}
@@ -0,0 +1,196 @@
+#include "asset_archive.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(GFX_HAS_LZ4)
+#include <lz4.h>
+#endif
+#if defined(GFX_HAS_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(GFX_HAS_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace {
+
+// Returns false unless the chunk decompresses to exactly out_size bytes. The
+// buffers go unused when no compression library is available.
+auto decompress_chunk(gfx::ArchiveCompression compression,
+                      [[maybe_unused]] const std::byte* source,
+                      [[maybe_unused]] size_t size,
+                      [[maybe_unused]] std::byte* out,
+                      [[maybe_unused]] size_t out_size) -> bool
+{
+  switch (compression) {
+#if defined(GFX_HAS_LZ4)
+    case gfx::ArchiveCompression::lz4:
+      return LZ4_decompress_safe(reinterpret_cast<const char*>(source),
+                                 reinterpret_cast<char*>(out),
+                                 static_cast<int>(size),
+                                 static_cast<int>(out_size)) ==
+             static_cast<int>(out_size);
+#endif
+#if defined(GFX_HAS_ZSTD)
+    case gfx::ArchiveCompression::zstd: {
+      size_t written = ZSTD_decompress(out, out_size, source, size);
+      return !ZSTD_isError(written) && written == out_size;
+    }
+#endif
+#if defined(GFX_HAS_ZLIB)
+    case gfx::ArchiveCompression::zlib: {
+      uLongf written = static_cast<uLongf>(out_size);
+      return uncompress(reinterpret_cast<Bytef*>(out), &written,
+                        reinterpret_cast<const Bytef*>(source),
+                        static_cast<uLong>(size)) == Z_OK &&
+             written == out_size;
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+auto gfx::hash_asset_path(std::string_view path) -> uint64_t
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : path) {
+    auto byte = static_cast<uint8_t>(c == '\\' ? '/' : c);
+    hash = (hash ^ byte) * 1099511628211ull;
+  }
+  return hash;
+}
+
+gfx::AssetArchive::AssetArchive()
+    : entries_(nullptr), entry_count_(0), chunk_size_(0)
+{
+}
+
+auto gfx::AssetArchive::open(const char* path) -> bool
+{
+  entries_ = nullptr;
+  entry_count_ = 0;
+  if (!file_.open(path) || file_.size() < sizeof(ArchiveHeader)) {
+    return false;
+  }
+  ArchiveHeader header;
+  memcpy(&header, file_.data(), sizeof(header));
+  size_t entries_end =
+      sizeof(header) + size_t{header.entry_count} * sizeof(ArchiveEntry);
+  if (header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION ||
+      header.chunk_size == 0 || file_.size() < entries_end) {
+    return false;
+  }
+  // The mapping is page aligned and the header a multiple of 8 bytes.
+  entries_ =
+      reinterpret_cast<const ArchiveEntry*>(file_.data() + sizeof(header));
+  entry_count_ = header.entry_count;
+  chunk_size_ = header.chunk_size;
+  return true;
+}
+
+auto gfx::AssetArchive::find(uint64_t hash) const -> const ArchiveEntry*
+{
+  const ArchiveEntry* end = entries_ + entry_count_;
+  const ArchiveEntry* found = std::lower_bound(
+      entries_, end, hash,
+      [](const ArchiveEntry& entry, uint64_t value) {
+        return entry.hash < value;
+      });
+  return found != end && found->hash == hash ? found : nullptr;
+}
+
+auto gfx::AssetArchive::find(std::string_view path) const
+    -> const ArchiveEntry*
+{
+  return find(hash_asset_path(path));
+}
+
+auto gfx::AssetArchive::entries() const -> const ArchiveEntry*
+{
+  return entries_;
+}
+
+auto gfx::AssetArchive::entry_count() const -> uint32_t
+{
+  return entry_count_;
+}
+
+auto gfx::AssetArchive::payload(const ArchiveEntry& entry) const
+    -> const std::byte*
+{
+  if (entry.offset > file_.size() || entry.size > file_.size() - entry.offset) {
+    return nullptr;
+  }
+  return file_.data() + entry.offset;
+}
+
+auto gfx::AssetArchive::read(const ArchiveEntry& entry, std::byte* out) const
+    -> bool
+{
+  const std::byte* source = payload(entry);
+  if (source == nullptr) {
+    return false;
+  }
+  if (entry.compression == ArchiveCompression::none) {
+    if (entry.size != entry.uncompressed_size) {
+      return false;
+    }
+    memcpy(out, source, entry.size);
+    return true;
+  }
+  if (!supports(entry.compression)) {
+    return false;
+  }
+
+  uint64_t chunk_count =
+      (entry.uncompressed_size + chunk_size_ - 1) / chunk_size_;
+  if (chunk_count * sizeof(uint32_t) > entry.size) {
+    return false;
+  }
+  const std::byte* chunk = source + chunk_count * sizeof(uint32_t);
+  const std::byte* end = source + entry.size;
+  for (uint64_t i = 0; i < chunk_count; ++i) {
+    uint32_t stored;
+    memcpy(&stored, source + i * sizeof(uint32_t), sizeof(stored));
+    auto expected = static_cast<size_t>(std::min<uint64_t>(
+        chunk_size_, entry.uncompressed_size - i * chunk_size_));
+    if (stored > static_cast<size_t>(end - chunk)) {
+      return false;
+    }
+    if (stored == expected) {
+      memcpy(out, chunk, expected);
+    }
+    else if (!decompress_chunk(entry.compression, chunk, stored, out,
+                               expected)) {
+      return false;
+    }
+    chunk += stored;
+    out += expected;
+  }
+  return true;
+}
+
+auto gfx::AssetArchive::supports(ArchiveCompression compression) -> bool
+{
+  switch (compression) {
+    case ArchiveCompression::none:
+      return true;
+#if defined(GFX_HAS_LZ4)
+    case ArchiveCompression::lz4:
+      return true;
+#endif
+#if defined(GFX_HAS_ZSTD)
+    case ArchiveCompression::zstd:
+      return true;
+#endif
+#if defined(GFX_HAS_ZLIB)
+    case ArchiveCompression::zlib:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "mapped_file.h"
+
+namespace gfx {
+
+enum class ArchiveCompression : uint32_t {
+  none = 0,
+  lz4 = 1,
+  zstd = 2,
+  zlib = 3
+};
+
+constexpr uint32_t ARCHIVE_MAGIC = 0x414c4b56;  // "VKLA"
+constexpr uint32_t ARCHIVE_VERSION = 1;
+// Payloads start on this boundary, the block size unbuffered reads need.
+constexpr uint32_t ARCHIVE_ALIGNMENT = 4096;
+// Compressed payloads are split in chunks of this many uncompressed bytes.
+constexpr uint32_t ARCHIVE_CHUNK_SIZE = 256 << 10;
+
+// File layout: the header, the entries sorted by hash, then the payloads.
+struct ArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t alignment;
+  uint32_t chunk_size;
+  uint32_t reserved;
+};
+
+struct ArchiveEntry {
+  // hash_asset_path() of the path relative to the packed directory.
+  uint64_t hash;
+  // Of the payload in the file, a multiple of the alignment.
+  uint64_t offset;
+  uint64_t size;
+  uint64_t uncompressed_size;
+  // Uncompressed payloads are the asset itself. Compressed ones start with
+  // the stored size of each chunk as a uint32_t, followed by the chunks.
+  // Chunks that did not shrink are stored as is.
+  ArchiveCompression compression;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(ArchiveHeader) == 24 && sizeof(ArchiveEntry) == 40,
+              "Archive structures must match the file.");
+
+// FNV-1a of the path with forward slashes, case sensitive.
+auto hash_asset_path(std::string_view path) -> uint64_t;
+
+// ************************************************************ //
+// AssetArchive                                                 //
+//                                                              //
+// Packed asset file mapped in memory. Opening only checks the  //
+// header, lookups are a binary search over the mapped entries  //
+// with no parsing, and uncompressed payloads are read in place //
+// or straight from the file into a staging buffer. Can be read //
+// from any thread.                                             //
+// ************************************************************ //
+class AssetArchive {
+ public:
+  AssetArchive();
+
+  // Returns false if the file cannot be mapped or is not an archive.
+  auto open(const char* path) -> bool;
+
+  // Null if the archive has no such asset.
+  auto find(uint64_t hash) const -> const ArchiveEntry*;
+  auto find(std::string_view path) const -> const ArchiveEntry*;
+  auto entries() const -> const ArchiveEntry*;
+  auto entry_count() const -> uint32_t;
+
+  // Stored payload in the mapping. Null if the entry points outside the
+  // file.
+  auto payload(const ArchiveEntry& entry) const -> const std::byte*;
+  // Writes the uncompressed_size bytes of the asset to out. Returns false
+  // if the payload is corrupt or its compression unsupported.
+  auto read(const ArchiveEntry& entry, std::byte* out) const -> bool;
+
+  // Whether this build can decompress the scheme.
+  static auto supports(ArchiveCompression compression) -> bool;
+
+ private:
+  os::MappedFile file_;
+  const ArchiveEntry* entries_;
+  uint32_t entry_count_;
+  uint32_t chunk_size_;
+};
+
+}  // namespace gfx
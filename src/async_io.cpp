@@ -0,0 +1,635 @@
+#include "async_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "log.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+#if defined(GFX_HAS_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+#if defined(_WIN32)
+const intptr_t INVALID_HANDLE =
+    reinterpret_cast<intptr_t>(INVALID_HANDLE_VALUE);
+#else
+constexpr intptr_t INVALID_HANDLE = -1;
+#endif
+
+// Both backends take 32 bit lengths.
+constexpr uint64_t MAX_CHUNK_SIZE = 1ull << 30;
+
+// Blocking read of a chunk. Returns the byte count, or a negative errno like
+// an io_uring completion.
+auto read_at(intptr_t handle, std::byte* destination, uint64_t size,
+             uint64_t offset) -> int64_t
+{
+#if defined(_WIN32)
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD read = 0;
+  if (!ReadFile(reinterpret_cast<HANDLE>(handle), destination,
+                static_cast<DWORD>(size), &read, &overlapped)) {
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -EIO;
+  }
+  return read;
+#else
+  for (;;) {
+    ssize_t read = pread(static_cast<int>(handle), destination, size,
+                         static_cast<off_t>(offset));
+    if (read >= 0) {
+      return read;
+    }
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+#endif
+}
+
+#if defined(GFX_HAS_IO_URING)
+// Background reads use the idle I/O scheduling class, the others keep the
+// thread's class.
+constexpr uint16_t IOPRIO_CLASS_IDLE = 3 << 13;
+// Completions of cancel entries rather than of reads. Request ids count up
+// from 1 and never reach it.
+constexpr uint64_t CANCEL_USER_DATA = ~0ull;
+#endif
+
+}  // namespace
+
+#if defined(GFX_HAS_IO_URING)
+
+struct gfx::AsyncIo::Ring {
+  int descriptor;
+  void* sq_memory;
+  size_t sq_memory_size;
+  void* cq_memory;
+  size_t cq_memory_size;
+  io_uring_sqe* entries;
+  size_t entries_size;
+
+  uint32_t* sq_head;
+  uint32_t* sq_tail;
+  uint32_t* sq_array;
+  uint32_t sq_mask;
+  uint32_t sq_entries;
+  // Local tail, published to the kernel by enter().
+  uint32_t tail;
+
+  uint32_t* cq_head;
+  uint32_t* cq_tail;
+  io_uring_cqe* cqes;
+  uint32_t cq_mask;
+
+  // Zeroed, or null when the submission queue is full.
+  auto next_entry() -> io_uring_sqe*
+  {
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries) {
+      return nullptr;
+    }
+    uint32_t index = tail & sq_mask;
+    memset(&entries[index], 0, sizeof(io_uring_sqe));
+    sq_array[index] = index;
+    ++tail;
+    return &entries[index];
+  }
+
+  auto unsubmitted() const -> uint32_t
+  {
+    return tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  // Takes back the entries enter() failed to submit and returns their user
+  // data, the kernel never sees them.
+  auto take_unsubmitted() -> std::vector<uint64_t>
+  {
+    std::vector<uint64_t> user_data;
+    uint32_t head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    for (uint32_t i = head; i != tail; ++i) {
+      user_data.push_back(entries[sq_array[i & sq_mask]].user_data);
+    }
+    tail = head;
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    return user_data;
+  }
+
+  // Submits the new entries and waits for wait_for completions. Returns
+  // false with errno set if the kernel took none.
+  auto enter(uint32_t wait_for) -> bool
+  {
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    uint32_t flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+      if (syscall(__NR_io_uring_enter, descriptor, unsubmitted(), wait_for,
+                  flags, nullptr, 0) >= 0) {
+        return true;
+      }
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+  }
+};
+
+#else
+
+struct gfx::AsyncIo::Ring {};
+
+#endif
+
+gfx::AsyncIo::AsyncIo(ThreadPool& thread_pool, const AsyncIoLimits& limits)
+    : thread_pool_(thread_pool),
+      limits_(limits),
+      backend_(IoBackend::thread_pool),
+      next_request_(1),
+      in_flight_(0),
+      stats_{},
+      faults_{}
+{
+  limits_.queue_depth = std::max(limits_.queue_depth, 1u);
+  limits_.chunk_size =
+      std::clamp(limits_.chunk_size, uint64_t{1}, MAX_CHUNK_SIZE);
+  if (limits_.backend != IoBackend::thread_pool && create_ring_()) {
+    backend_ = IoBackend::io_uring;
+  }
+}
+
+gfx::AsyncIo::~AsyncIo()
+{
+  std::vector<IoRequest> pending;
+  for (const auto& [id, request] : requests_) {
+    pending.push_back(id);
+  }
+  for (IoRequest id : pending) {
+    cancel(id);
+  }
+  wait_idle();
+  for (IoFile file = 0; file < files_.size(); ++file) {
+    if (files_[file].handle != INVALID_HANDLE) {
+      close(file);
+    }
+  }
+  destroy_ring_();
+}
+
+auto gfx::AsyncIo::open(const char* path) -> IoFile
+{
+  File file;
+#if defined(_WIN32)
+  HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return INVALID_IO_FILE;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(handle, &size)) {
+    CloseHandle(handle);
+    return INVALID_IO_FILE;
+  }
+  file = {reinterpret_cast<intptr_t>(handle),
+          static_cast<uint64_t>(size.QuadPart)};
+#else
+  int descriptor = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (descriptor < 0) {
+    return INVALID_IO_FILE;
+  }
+  struct stat status;
+  if (fstat(descriptor, &status) != 0) {
+    ::close(descriptor);
+    return INVALID_IO_FILE;
+  }
+  file = {descriptor, static_cast<uint64_t>(status.st_size)};
+#endif
+
+  if (free_files_.empty()) {
+    files_.push_back(file);
+    return static_cast<IoFile>(files_.size() - 1);
+  }
+  IoFile index = free_files_.back();
+  free_files_.pop_back();
+  files_[index] = file;
+  return index;
+}
+
+auto gfx::AsyncIo::size(IoFile file) const -> uint64_t
+{
+  return files_[file].size;
+}
+
+auto gfx::AsyncIo::close(IoFile file) -> void
+{
+#if defined(_WIN32)
+  CloseHandle(reinterpret_cast<HANDLE>(files_[file].handle));
+#else
+  ::close(static_cast<int>(files_[file].handle));
+#endif
+  files_[file] = {INVALID_HANDLE, 0};
+  free_files_.push_back(file);
+}
+
+auto gfx::AsyncIo::read(IoRead read) -> IoRequest
+{
+  IoRequest id = next_request_++;
+  auto priority = static_cast<uint32_t>(read.priority);
+  bool empty = read.size == 0;
+  requests_.emplace(id, Request{std::move(read), 0, false, false});
+  ++stats_.reads;
+  if (empty) {
+    finish_(id, IoStatus::done);
+  }
+  else {
+    queues_[priority].push_back(id);
+  }
+  return id;
+}
+
+auto gfx::AsyncIo::cancel(IoRequest id) -> bool
+{
+  auto found = requests_.find(id);
+  if (found == requests_.end()) {
+    return false;
+  }
+  Request& request = found->second;
+  if (!request.in_flight) {
+    auto& queue = queues_[static_cast<uint32_t>(request.read.priority)];
+    queue.erase(std::find(queue.begin(), queue.end(), id));
+    finish_(id, IoStatus::cancelled);
+    return true;
+  }
+  if (request.cancelled) {
+    return true;
+  }
+  request.cancelled = true;
+#if defined(GFX_HAS_IO_URING)
+  // Best effort, a full ring only means the chunk runs to completion.
+  if (backend_ == IoBackend::io_uring) {
+    if (io_uring_sqe* entry = ring_->next_entry()) {
+      entry->opcode = IORING_OP_ASYNC_CANCEL;
+      entry->fd = -1;
+      entry->addr = id;
+      entry->user_data = CANCEL_USER_DATA;
+    }
+  }
+#endif
+  return true;
+}
+
+auto gfx::AsyncIo::poll() -> uint32_t
+{
+  reap_();
+  submit_queued_();
+
+  // Callbacks may queue or cancel reads.
+  std::vector<std::pair<IoResult, IoCallback>> finished;
+  finished.swap(finished_);
+  for (auto& [result, callback] : finished) {
+    if (callback) {
+      callback(result);
+    }
+  }
+  return static_cast<uint32_t>(finished.size());
+}
+
+auto gfx::AsyncIo::wait(IoRequest id) -> void
+{
+  for (;;) {
+    poll();
+    if (requests_.count(id) == 0) {
+      return;
+    }
+    block_();
+  }
+}
+
+auto gfx::AsyncIo::wait_idle() -> void
+{
+  for (;;) {
+    poll();
+    if (requests_.empty() && finished_.empty()) {
+      return;
+    }
+    block_();
+  }
+}
+
+auto gfx::AsyncIo::backend() const -> IoBackend { return backend_; }
+
+auto gfx::AsyncIo::stats() const -> IoStats
+{
+  IoStats stats = stats_;
+  stats.queued = 0;
+  for (const auto& queue : queues_) {
+    stats.queued += static_cast<uint32_t>(queue.size());
+  }
+  stats.in_flight = in_flight_;
+  return stats;
+}
+
+auto gfx::AsyncIo::inject_faults(const IoFaults& faults) -> void
+{
+  faults_ = faults;
+}
+
+auto gfx::AsyncIo::submit_queued_() -> void
+{
+  for (auto& queue : queues_) {
+    while (in_flight_ < limits_.queue_depth && !queue.empty()) {
+      IoRequest id = queue.front();
+      if (!submit_chunk_(id, requests_.at(id))) {
+        break;
+      }
+      queue.pop_front();
+    }
+  }
+
+#if defined(GFX_HAS_IO_URING)
+  if (backend_ == IoBackend::io_uring && ring_->unsubmitted() > 0) {
+    ++stats_.submissions;
+    // A busy completion queue takes the entries on a later poll().
+    if (!enter_(0) && errno != EAGAIN && errno != EBUSY) {
+      GFX_LOG_ERROR("io_uring submission failed: {}", strerror(errno));
+      fail_unsubmitted_(errno);
+    }
+  }
+#endif
+}
+
+auto gfx::AsyncIo::submit_chunk_(IoRequest id, Request& request) -> bool
+{
+  const IoRead& read = request.read;
+  intptr_t handle = files_[read.file].handle;
+  std::byte* destination = read.destination + request.done;
+  uint64_t offset = read.offset + request.done;
+  uint64_t size = std::min(read.size - request.done, limits_.chunk_size);
+
+#if defined(GFX_HAS_IO_URING)
+  if (backend_ == IoBackend::io_uring) {
+    io_uring_sqe* entry = ring_->next_entry();
+    if (entry == nullptr) {
+      return false;
+    }
+    entry->opcode = IORING_OP_READ;
+    entry->fd = static_cast<int>(handle);
+    entry->addr = reinterpret_cast<uint64_t>(destination);
+    entry->len = static_cast<uint32_t>(size);
+    entry->off = offset;
+    entry->user_data = id;
+    if (read.priority == IoPriority::background) {
+      entry->ioprio = IOPRIO_CLASS_IDLE;
+    }
+    request.in_flight = true;
+    ++in_flight_;
+    return true;
+  }
+#endif
+
+  request.in_flight = true;
+  ++in_flight_;
+  ++stats_.submissions;
+  thread_pool_.submit([this, id, handle, destination, size, offset] {
+    int64_t result = read_at(handle, destination, size, offset);
+    // Notified under the lock, once it is released the owner may reap the
+    // chunk and destroy this.
+    std::lock_guard<std::mutex> lock(completed_mutex_);
+    completed_.emplace_back(id, result);
+    chunk_completed_.notify_one();
+  });
+  return true;
+}
+
+auto gfx::AsyncIo::reap_() -> void
+{
+#if defined(GFX_HAS_IO_URING)
+  if (backend_ == IoBackend::io_uring) {
+    uint32_t head = *ring_->cq_head;
+    uint32_t tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& completion = ring_->cqes[head & ring_->cq_mask];
+      if (completion.user_data != CANCEL_USER_DATA) {
+        complete_chunk_(completion.user_data, completion.res);
+      }
+    }
+    __atomic_store_n(ring_->cq_head, head, __ATOMIC_RELEASE);
+    return;
+  }
+#endif
+
+  std::vector<std::pair<IoRequest, int64_t>> completed;
+  {
+    std::lock_guard<std::mutex> lock(completed_mutex_);
+    completed.swap(completed_);
+  }
+  for (const auto& [id, result] : completed) {
+    complete_chunk_(id, result);
+  }
+}
+
+auto gfx::AsyncIo::block_() -> void
+{
+  if (in_flight_ == 0) {
+    return;
+  }
+#if defined(GFX_HAS_IO_URING)
+  if (backend_ == IoBackend::io_uring) {
+    // The chunks the kernel took still complete, only the entries it
+    // refused fail.
+    if (!enter_(1) && errno != EAGAIN && errno != EBUSY) {
+      GFX_LOG_ERROR("io_uring wait failed: {}", strerror(errno));
+      fail_unsubmitted_(errno);
+    }
+    return;
+  }
+#endif
+  std::unique_lock<std::mutex> lock(completed_mutex_);
+  chunk_completed_.wait(lock, [this] { return !completed_.empty(); });
+}
+
+auto gfx::AsyncIo::complete_chunk_(IoRequest id, int64_t result) -> void
+{
+  if (faults_.chunk_failures > 0) {
+    --faults_.chunk_failures;
+    result = -faults_.chunk_error;
+  }
+  --in_flight_;
+  Request& request = requests_.at(id);
+  request.in_flight = false;
+  if (result > 0) {
+    request.done += static_cast<uint64_t>(result);
+    stats_.bytes_read += static_cast<uint64_t>(result);
+  }
+
+  auto& queue = queues_[static_cast<uint32_t>(request.read.priority)];
+  if (request.cancelled) {
+    finish_(id, IoStatus::cancelled);
+  }
+  else if (result == -EINTR || result == -EAGAIN) {
+    queue.push_front(id);
+  }
+  // Reading nothing before the end means the file is shorter than the read.
+  else if (result <= 0) {
+    if (result < 0) {
+      GFX_LOG_ERROR("Read {} failed: {}", id,
+                    strerror(static_cast<int>(-result)));
+    }
+    finish_(id, IoStatus::failed);
+  }
+  else if (request.done == request.read.size) {
+    finish_(id, IoStatus::done);
+  }
+  // Short read or next chunk, ahead of the reads queued since.
+  else {
+    queue.push_front(id);
+  }
+}
+
+auto gfx::AsyncIo::finish_(IoRequest id, IoStatus status) -> void
+{
+  auto found = requests_.find(id);
+  finished_.emplace_back(IoResult{id, status, found->second.done},
+                         std::move(found->second.read.callback));
+  requests_.erase(found);
+  switch (status) {
+    case IoStatus::done:
+      ++stats_.completed;
+      break;
+    case IoStatus::failed:
+      ++stats_.failed;
+      break;
+    case IoStatus::cancelled:
+      ++stats_.cancelled;
+      break;
+  }
+}
+
+#if defined(GFX_HAS_IO_URING)
+
+auto gfx::AsyncIo::create_ring_() -> bool
+{
+  // Room for a cancel entry per read in flight, the completion queue is
+  // twice as large so it cannot overflow.
+  io_uring_params params = {};
+  auto descriptor = static_cast<int>(
+      syscall(__NR_io_uring_setup, limits_.queue_depth * 2, &params));
+  if (descriptor < 0) {
+    return false;
+  }
+  // IORING_OP_READ came with the same kernel.
+  if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+    ::close(descriptor);
+    return false;
+  }
+
+  auto ring = std::make_unique<Ring>();
+  ring->descriptor = descriptor;
+  ring->sq_memory_size =
+      params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cq_memory_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    ring->sq_memory_size = ring->cq_memory_size =
+        std::max(ring->sq_memory_size, ring->cq_memory_size);
+  }
+  ring->sq_memory =
+      mmap(nullptr, ring->sq_memory_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_SQ_RING);
+  ring->cq_memory =
+      single_mmap ? ring->sq_memory
+                  : mmap(nullptr, ring->cq_memory_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, descriptor,
+                         IORING_OFF_CQ_RING);
+  ring->entries_size = params.sq_entries * sizeof(io_uring_sqe);
+  void* entries =
+      mmap(nullptr, ring->entries_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_SQES);
+  if (ring->sq_memory == MAP_FAILED || ring->cq_memory == MAP_FAILED ||
+      entries == MAP_FAILED) {
+    if (entries != MAP_FAILED) {
+      munmap(entries, ring->entries_size);
+    }
+    if (ring->cq_memory != MAP_FAILED && !single_mmap) {
+      munmap(ring->cq_memory, ring->cq_memory_size);
+    }
+    if (ring->sq_memory != MAP_FAILED) {
+      munmap(ring->sq_memory, ring->sq_memory_size);
+    }
+    ::close(descriptor);
+    return false;
+  }
+
+  auto* sq = static_cast<char*>(ring->sq_memory);
+  auto* cq = static_cast<char*>(ring->cq_memory);
+  ring->entries = static_cast<io_uring_sqe*>(entries);
+  ring->sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+  ring->sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+  ring->sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+  ring->sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->tail = *ring->sq_tail;
+  ring->cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+  ring->cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+  ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  ring->cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+  ring_ = std::move(ring);
+  return true;
+}
+
+auto gfx::AsyncIo::enter_(uint32_t wait_for) -> bool
+{
+  if (faults_.enter_failures > 0) {
+    --faults_.enter_failures;
+    errno = faults_.enter_error;
+    return false;
+  }
+  return ring_->enter(wait_for);
+}
+
+auto gfx::AsyncIo::fail_unsubmitted_(int error) -> void
+{
+  for (uint64_t user_data : ring_->take_unsubmitted()) {
+    if (user_data != CANCEL_USER_DATA) {
+      complete_chunk_(user_data, -error);
+    }
+  }
+}
+
+auto gfx::AsyncIo::destroy_ring_() -> void
+{
+  if (!ring_) {
+    return;
+  }
+  munmap(ring_->entries, ring_->entries_size);
+  if (ring_->cq_memory != ring_->sq_memory) {
+    munmap(ring_->cq_memory, ring_->cq_memory_size);
+  }
+  munmap(ring_->sq_memory, ring_->sq_memory_size);
+  ::close(ring_->descriptor);
+  ring_.reset();
+}
+
+#else
+
+auto gfx::AsyncIo::create_ring_() -> bool { return false; }
+
+auto gfx::AsyncIo::fail_unsubmitted_(int) -> void {}
+
+auto gfx::AsyncIo::destroy_ring_() -> void {}
+
+#endif
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "thread_pool.h"
+
+namespace gfx {
+
+enum class IoBackend { automatic, io_uring, thread_pool };
+
+// Queued reads of a higher class are always submitted first.
+enum class IoPriority : uint32_t { urgent = 0, normal = 1, background = 2 };
+constexpr uint32_t IO_PRIORITY_COUNT = 3;
+
+// Reads fail on an I/O error, one the ring could not submit, or past the
+// end of the file.
+enum class IoStatus { done, failed, cancelled };
+
+using IoFile = uint32_t;
+constexpr IoFile INVALID_IO_FILE = ~0u;
+using IoRequest = uint64_t;
+
+struct IoResult {
+  IoRequest request;
+  IoStatus status;
+  // Read into the destination, less than the size unless done.
+  uint64_t bytes;
+};
+using IoCallback = std::function<void(const IoResult&)>;
+
+struct IoRead {
+  IoFile file;
+  uint64_t offset;
+  uint64_t size;
+  // Holds size bytes until the read completes. Point it at a mapped staging
+  // buffer to upload the data without another copy.
+  std::byte* destination;
+  IoPriority priority = IoPriority::normal;
+  IoCallback callback;
+};
+
+struct AsyncIoLimits {
+  IoBackend backend = IoBackend::automatic;
+  // Reads in flight at once, across all priorities.
+  uint32_t queue_depth = 64;
+  // Larger reads are split, so they cannot hold back a higher priority
+  // read for long and can be cancelled part way.
+  uint64_t chunk_size = 1ull << 20;
+};
+
+struct IoStats {
+  uint64_t reads;
+  uint64_t completed;
+  uint64_t failed;
+  uint64_t cancelled;
+  uint64_t bytes_read;
+  // Calls submitting chunks, a batch of queued chunks takes one.
+  uint64_t submissions;
+  uint32_t queued;
+  uint32_t in_flight;
+};
+
+// Errors the next calls see in place of their outcome, for reaching the
+// paths a healthy kernel seldom takes. Each failure counts down once.
+struct IoFaults {
+  // errno of io_uring_enter, which then submits nothing.
+  int enter_error;
+  uint32_t enter_failures;
+  // errno completing chunks, whatever they read.
+  int chunk_error;
+  uint32_t chunk_failures;
+};
+
+// ************************************************************ //
+// AsyncIo                                                      //
+//                                                              //
+// Asynchronous file reads. read() only queues, poll() submits  //
+// as many queued chunks as the queue depth allows in one       //
+// batch, highest priority first, reaps the finished ones and   //
+// runs their callbacks on the calling thread. On Linux the     //
+// chunks go to an io_uring ring. Elsewhere, or when the kernel //
+// has none, each is a blocking read on the thread pool. Not    //
+// thread safe: one thread owns the instance and polls it,      //
+// typically once per frame.                                    //
+// ************************************************************ //
+class AsyncIo {
+ public:
+  // The thread pool must outlive the instance.
+  explicit AsyncIo(ThreadPool& thread_pool, const AsyncIoLimits& limits = {});
+  // Cancels the queued reads and waits for the ones in flight, their
+  // callbacks still run.
+  ~AsyncIo();
+
+  AsyncIo(const AsyncIo&) = delete;
+  AsyncIo& operator=(const AsyncIo&) = delete;
+
+  // Opens are synchronous. Returns INVALID_IO_FILE on failure.
+  auto open(const char* path) -> IoFile;
+  auto size(IoFile file) const -> uint64_t;
+  // No read of the file may be pending.
+  auto close(IoFile file) -> void;
+
+  auto read(IoRead read) -> IoRequest;
+  // A queued read is dropped, one in flight stops after its current chunk.
+  // Its callback gets the cancelled status on a later poll(). Returns false
+  // if the request already finished.
+  auto cancel(IoRequest request) -> bool;
+
+  // Returns the number of callbacks run.
+  auto poll() -> uint32_t;
+  // Blocks until the request finished and its callback ran.
+  auto wait(IoRequest request) -> void;
+  auto wait_idle() -> void;
+
+  auto backend() const -> IoBackend;
+  auto stats() const -> IoStats;
+  // Replaces the faults still pending.
+  auto inject_faults(const IoFaults& faults) -> void;
+
+ private:
+  struct Request {
+    IoRead read;
+    // Bytes read so far, the next chunk starts there.
+    uint64_t done;
+    bool in_flight;
+    bool cancelled;
+  };
+
+  // Platform handle, a file descriptor or a Windows HANDLE.
+  struct File {
+    intptr_t handle;
+    uint64_t size;
+  };
+
+  // io_uring state, defined by the Linux backend.
+  struct Ring;
+
+  auto submit_queued_() -> void;
+  // Returns false when the ring has no free entry.
+  auto submit_chunk_(IoRequest id, Request& request) -> bool;
+  auto reap_() -> void;
+  // Blocks until at least one chunk in flight completes.
+  auto block_() -> void;
+  // result is the byte count read, or a negative errno.
+  auto complete_chunk_(IoRequest id, int64_t result) -> void;
+  auto finish_(IoRequest id, IoStatus status) -> void;
+
+  auto create_ring_() -> bool;
+  // Ring::enter() unless a fault is injected.
+  auto enter_(uint32_t wait_for) -> bool;
+  // Fails the chunks of the ring entries the kernel refused with the errno,
+  // their requests finish as failed unless cancelled.
+  auto fail_unsubmitted_(int error) -> void;
+  auto destroy_ring_() -> void;
+
+  ThreadPool& thread_pool_;
+  AsyncIoLimits limits_;
+  IoBackend backend_;
+  std::unique_ptr<Ring> ring_;
+
+  std::vector<File> files_;
+  std::vector<IoFile> free_files_;
+
+  IoRequest next_request_;
+  std::unordered_map<IoRequest, Request> requests_;
+  std::deque<IoRequest> queues_[IO_PRIORITY_COUNT];
+  uint32_t in_flight_;
+  // Finished since the last poll(), with their callbacks.
+  std::vector<std::pair<IoResult, IoCallback>> finished_;
+
+  // Chunks the thread pool completed, as request and result.
+  std::mutex completed_mutex_;
+  std::condition_variable chunk_completed_;
+  std::vector<std::pair<IoRequest, int64_t>> completed_;
+
+  IoStats stats_;
+  IoFaults faults_;
+};
+
+}  // namespace gfx
@@ -0,0 +1,507 @@
+#include "culling.h"
+#include <algorithm>
+#include <cmath>
+#include "log.h"
+#include "math_kernels.h"
+#include "host_allocator.h"
+#include "vulkan_builders.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_recovery.h"
+
+namespace gfx::vk_api {
+
+namespace {
+
+// Must match local_size_x and local_size_y of the downsample shader.
+constexpr uint32_t DOWNSAMPLE_GROUP_SIZE = 8;
+
+struct DownsampleConstants {
+  uint32_t source_size[2];
+  uint32_t destination_size[2];
+};
+
+// Instances transposed at once by the CPU culling, the scratch arrays then
+// stay within the L1 cache.
+constexpr uint32_t CULL_CHUNK_SIZE = 256;
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::compute_bounding_sphere(const Vertex* vertices,
+                                          uint32_t vertex_count)
+    -> BoundingSphere
+{
+  BoundingSphere sphere = {{0.0f, 0.0f, 0.0f}, 0.0f};
+  if (vertex_count == 0) {
+    return sphere;
+  }
+
+  auto position = [vertices](uint32_t i) {
+    return math::Vec3{vertices[i].position[0], vertices[i].position[1],
+                      vertices[i].position[2]};
+  };
+  // Centered on the bounding box, which is close enough for culling.
+  math::Aabb box = {position(0), position(0)};
+  for (uint32_t i = 1; i < vertex_count; ++i) {
+    box.min = math::min(box.min, position(i));
+    box.max = math::max(box.max, position(i));
+  }
+  sphere.center = (box.min + box.max) * 0.5f;
+  for (uint32_t i = 0; i < vertex_count; ++i) {
+    sphere.radius =
+        std::max(sphere.radius, math::length(position(i) - sphere.center));
+  }
+  return sphere;
+}
+
+auto gfx::vk_api::cull_instances(const math::Frustum& frustum,
+                                 const BoundingSphere* mesh_bounds,
+                                 uint32_t mesh_count, const Instance* instances,
+                                 uint32_t instance_count, uint32_t* visible)
+    -> uint32_t
+{
+  alignas(32) float rows[12][CULL_CHUNK_SIZE];
+  alignas(32) float local[4][CULL_CHUNK_SIZE];
+  alignas(32) float world[4][CULL_CHUNK_SIZE];
+  // Instance index of each chunk element, and the visible elements.
+  uint32_t source[CULL_CHUNK_SIZE];
+  uint32_t chunk_visible[CULL_CHUNK_SIZE];
+
+  math::AffineSoA transforms;
+  for (int e = 0; e < 12; ++e) {
+    transforms.rows[e] = rows[e];
+  }
+  math::SphereSoA local_spheres = {{local[0], local[1], local[2]}, local[3]};
+  math::SphereSoA world_spheres = {{world[0], world[1], world[2]}, world[3]};
+
+  uint32_t count = 0;
+  for (uint32_t first = 0; first < instance_count;
+       first += CULL_CHUNK_SIZE) {
+    uint32_t end = std::min(first + CULL_CHUNK_SIZE, instance_count);
+    uint32_t size = 0;
+    for (uint32_t i = first; i < end; ++i) {
+      const Instance& instance = instances[i];
+      if (instance.mesh >= mesh_count) {
+        continue;
+      }
+      for (int e = 0; e < 12; ++e) {
+        rows[e][size] = instance.transform[e];
+      }
+      const BoundingSphere& bounds = mesh_bounds[instance.mesh];
+      local[0][size] = bounds.center.x;
+      local[1][size] = bounds.center.y;
+      local[2][size] = bounds.center.z;
+      local[3][size] = bounds.radius;
+      source[size++] = i;
+    }
+
+    math::transform_spheres(transforms, local_spheres, size, world_spheres);
+    uint32_t chunk_count =
+        math::cull_spheres(frustum, world_spheres, size, chunk_visible);
+    for (uint32_t i = 0; i < chunk_count; ++i) {
+      visible[count++] = source[chunk_visible[i]];
+    }
+  }
+  return count;
+}
+
+gfx::vk_api::DepthPyramid::DepthPyramid(
+    VulkanDevice& device, VkImageView depth_view, uint32_t width,
+    uint32_t height, const std::vector<uint32_t>& downsample_spirv)
+    : device_(device),
+      depth_view_(depth_view),
+      downsample_spirv_(downsample_spirv),
+      width_(width),
+      height_(height),
+      mip_count_(1),
+      initialized_(false),
+      image_(VK_NULL_HANDLE),
+      memory_(VK_NULL_HANDLE),
+      view_(VK_NULL_HANDLE),
+      sampler_(VK_NULL_HANDLE),
+      descriptor_set_layout_(VK_NULL_HANDLE),
+      pipeline_layout_(VK_NULL_HANDLE),
+      pipeline_(VK_NULL_HANDLE),
+      descriptor_pool_(VK_NULL_HANDLE),
+      resource_id_(0)
+{
+  // Level 0 is a copy of the depth buffer, each level then halves the size.
+  while ((std::max(width_, height_) >> mip_count_) > 0) {
+    ++mip_count_;
+  }
+}
+
+auto gfx::vk_api::DepthPyramid::create(
+    VulkanDevice& device, VkImageView depth_view, uint32_t width,
+    uint32_t height, const std::vector<uint32_t>& downsample_spirv,
+    std::unique_ptr<DepthPyramid>& pyramid) -> VkResult
+{
+  // What was created before a failure goes away with the pyramid.
+  std::unique_ptr<DepthPyramid> created(
+      new DepthPyramid(device, depth_view, width, height, downsample_spirv));
+  VkResult result = created->create_();
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create the depth pyramid: {}!",
+                  result_name(result));
+    return result;
+  }
+  DepthPyramid* self = created.get();
+  self->resource_id_ = device.resources->add(
+      [self](VulkanDevice&) { self->release_(); },
+      [self](VulkanDevice&) { return self->create_(); });
+  pyramid = std::move(created);
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::DepthPyramid::create_() -> VkResult
+{
+  uint32_t families[] = {device_.graphics_family, device_.compute_family};
+  auto image_create_info =
+      build<VkImageCreateInfo>()
+          .set(&VkImageCreateInfo::imageType, VK_IMAGE_TYPE_2D)
+          .set(&VkImageCreateInfo::format, VK_FORMAT_R32_SFLOAT)
+          .set(&VkImageCreateInfo::extent, VkExtent3D{width_, height_, 1})
+          .set(&VkImageCreateInfo::mipLevels, mip_count_)
+          .set(&VkImageCreateInfo::arrayLayers, 1)
+          .set(&VkImageCreateInfo::samples, VK_SAMPLE_COUNT_1_BIT)
+          .set(&VkImageCreateInfo::tiling, VK_IMAGE_TILING_OPTIMAL)
+          .set(&VkImageCreateInfo::usage,
+               VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT)
+          .set(&VkImageCreateInfo::sharingMode, VK_SHARING_MODE_EXCLUSIVE)
+          .set(&VkImageCreateInfo::initialLayout, VK_IMAGE_LAYOUT_UNDEFINED);
+  if (device_.compute_family != device_.graphics_family) {
+    image_create_info
+        .set(&VkImageCreateInfo::sharingMode, VK_SHARING_MODE_CONCURRENT)
+        .set(&VkImageCreateInfo::queueFamilyIndexCount, std::size(families))
+        .set(&VkImageCreateInfo::pQueueFamilyIndices, families);
+  }
+  VkResult result =
+      device_.vkCreateImage(device_.logical_device, &image_create_info.get(),
+                            allocation_callbacks(), &image_);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkMemoryRequirements requirements;
+  device_.vkGetImageMemoryRequirements(device_.logical_device, image_,
+                                       &requirements);
+  uint32_t memory_type =
+      find_memory_type(device_, requirements.memoryTypeBits,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  VkMemoryAllocateInfo allocate_info =
+      build<VkMemoryAllocateInfo>()
+          .set(&VkMemoryAllocateInfo::allocationSize, requirements.size)
+          .set(&VkMemoryAllocateInfo::memoryTypeIndex, memory_type);
+  if (memory_type == UINT32_MAX) {
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  result = device_.vkAllocateMemory(device_.logical_device, &allocate_info,
+                                    allocation_callbacks(), &memory_);
+  if (result == VK_SUCCESS) {
+    result =
+        device_.vkBindImageMemory(device_.logical_device, image_, memory_, 0);
+  }
+
+  // The full view for sampling, one view per level for the reduction.
+  if (result == VK_SUCCESS) {
+    result = create_view_(0, mip_count_, view_);
+  }
+  for (uint32_t mip = 0; mip < mip_count_ && result == VK_SUCCESS; ++mip) {
+    VkImageView view;
+    result = create_view_(mip, 1, view);
+    if (result == VK_SUCCESS) {
+      mip_views_.push_back(view);
+    }
+  }
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkSamplerCreateInfo sampler_create_info =
+      build<VkSamplerCreateInfo>()
+          .set(&VkSamplerCreateInfo::magFilter, VK_FILTER_NEAREST)
+          .set(&VkSamplerCreateInfo::minFilter, VK_FILTER_NEAREST)
+          .set(&VkSamplerCreateInfo::mipmapMode,
+               VK_SAMPLER_MIPMAP_MODE_NEAREST)
+          .set(&VkSamplerCreateInfo::addressModeU,
+               VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE)
+          .set(&VkSamplerCreateInfo::addressModeV,
+               VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE)
+          .set(&VkSamplerCreateInfo::addressModeW,
+               VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE)
+          .set(&VkSamplerCreateInfo::maxLod, static_cast<float>(mip_count_));
+  result = device_.vkCreateSampler(device_.logical_device,
+                                   &sampler_create_info,
+                                   allocation_callbacks(), &sampler_);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  // Binding 0: source level, 1: destination level.
+  VkDescriptorSetLayoutBinding bindings[] = {
+      {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+       VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+      {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT,
+       nullptr}};
+  using SetLayoutInfo = VkDescriptorSetLayoutCreateInfo;
+  VkDescriptorSetLayoutCreateInfo set_layout_create_info =
+      build<SetLayoutInfo>()
+          .set(&SetLayoutInfo::bindingCount, std::size(bindings))
+          .set(&SetLayoutInfo::pBindings, bindings);
+  result = device_.vkCreateDescriptorSetLayout(
+      device_.logical_device, &set_layout_create_info, allocation_callbacks(),
+      &descriptor_set_layout_);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkPushConstantRange push_constant_range = {VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                             sizeof(DownsampleConstants)};
+  using LayoutInfo = VkPipelineLayoutCreateInfo;
+  VkPipelineLayoutCreateInfo layout_create_info =
+      build<LayoutInfo>()
+          .set(&LayoutInfo::setLayoutCount, 1)
+          .set(&LayoutInfo::pSetLayouts, &descriptor_set_layout_)
+          .set(&LayoutInfo::pushConstantRangeCount, 1)
+          .set(&LayoutInfo::pPushConstantRanges, &push_constant_range);
+  result = device_.vkCreatePipelineLayout(device_.logical_device,
+                                          &layout_create_info,
+                                          allocation_callbacks(),
+                                          &pipeline_layout_);
+  if (result == VK_SUCCESS) {
+    result = create_compute_pipeline(device_, downsample_spirv_,
+                                     pipeline_layout_, pipeline_);
+  }
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkDescriptorPoolSize pool_sizes[] = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, mip_count_},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, mip_count_}};
+  using PoolInfo = VkDescriptorPoolCreateInfo;
+  VkDescriptorPoolCreateInfo pool_create_info =
+      build<PoolInfo>()
+          .set(&PoolInfo::maxSets, mip_count_)
+          .set(&PoolInfo::poolSizeCount, std::size(pool_sizes))
+          .set(&PoolInfo::pPoolSizes, pool_sizes);
+  result = device_.vkCreateDescriptorPool(device_.logical_device,
+                                          &pool_create_info,
+                                          allocation_callbacks(),
+                                          &descriptor_pool_);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  descriptor_sets_.resize(mip_count_);
+  std::vector<VkDescriptorSetLayout> set_layouts(mip_count_,
+                                                 descriptor_set_layout_);
+  using AllocateInfo = VkDescriptorSetAllocateInfo;
+  VkDescriptorSetAllocateInfo set_allocate_info =
+      build<AllocateInfo>()
+          .set(&AllocateInfo::descriptorPool, descriptor_pool_)
+          .set(&AllocateInfo::descriptorSetCount, mip_count_)
+          .set(&AllocateInfo::pSetLayouts, set_layouts.data());
+  result = device_.vkAllocateDescriptorSets(
+      device_.logical_device, &set_allocate_info, descriptor_sets_.data());
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  // Level 0 reads the depth buffer, written on its own.
+  for (uint32_t mip = 0; mip < mip_count_; ++mip) {
+    VkDescriptorImageInfo source = {};
+    if (mip > 0) {
+      source = {sampler_, mip_views_[mip - 1], VK_IMAGE_LAYOUT_GENERAL};
+    }
+    VkDescriptorImageInfo destination = {VK_NULL_HANDLE, mip_views_[mip],
+                                         VK_IMAGE_LAYOUT_GENERAL};
+    VkWriteDescriptorSet writes[] = {
+        build<VkWriteDescriptorSet>()
+            .set(&VkWriteDescriptorSet::dstSet, descriptor_sets_[mip])
+            .set(&VkWriteDescriptorSet::dstBinding, 1)
+            .set(&VkWriteDescriptorSet::descriptorCount, 1)
+            .set(&VkWriteDescriptorSet::descriptorType,
+                 VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)
+            .set(&VkWriteDescriptorSet::pImageInfo, &destination),
+        build<VkWriteDescriptorSet>()
+            .set(&VkWriteDescriptorSet::dstSet, descriptor_sets_[mip])
+            .set(&VkWriteDescriptorSet::dstBinding, 0)
+            .set(&VkWriteDescriptorSet::descriptorCount, 1)
+            .set(&VkWriteDescriptorSet::descriptorType,
+                 VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+            .set(&VkWriteDescriptorSet::pImageInfo, &source)};
+    device_.vkUpdateDescriptorSets(device_.logical_device,
+                                   mip > 0 ? 2 : 1, writes, 0, nullptr);
+  }
+  write_depth_view_();
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::DepthPyramid::write_depth_view_() -> void
+{
+  if (depth_view_ == VK_NULL_HANDLE) {
+    return;
+  }
+  VkDescriptorImageInfo source = {sampler_, depth_view_,
+                                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  VkWriteDescriptorSet write =
+      build<VkWriteDescriptorSet>()
+          .set(&VkWriteDescriptorSet::dstSet, descriptor_sets_[0])
+          .set(&VkWriteDescriptorSet::dstBinding, 0)
+          .set(&VkWriteDescriptorSet::descriptorCount, 1)
+          .set(&VkWriteDescriptorSet::descriptorType,
+               VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+          .set(&VkWriteDescriptorSet::pImageInfo, &source);
+  device_.vkUpdateDescriptorSets(device_.logical_device, 1, &write, 0,
+                                 nullptr);
+}
+
+auto gfx::vk_api::DepthPyramid::create_view_(uint32_t base_mip,
+                                             uint32_t mip_count,
+                                             VkImageView& view) -> VkResult
+{
+  VkImageViewCreateInfo view_create_info =
+      build<VkImageViewCreateInfo>()
+          .set(&VkImageViewCreateInfo::image, image_)
+          .set(&VkImageViewCreateInfo::viewType, VK_IMAGE_VIEW_TYPE_2D)
+          .set(&VkImageViewCreateInfo::format, VK_FORMAT_R32_SFLOAT)
+          .set(&VkImageViewCreateInfo::subresourceRange,
+               VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, base_mip,
+                                       mip_count, 0, 1});
+  return device_.vkCreateImageView(device_.logical_device, &view_create_info,
+                                   allocation_callbacks(), &view);
+}
+
+gfx::vk_api::DepthPyramid::~DepthPyramid()
+{
+  if (resource_id_ != 0) {
+    device_.resources->remove(resource_id_);
+  }
+  release_();
+}
+
+auto gfx::vk_api::DepthPyramid::release_() -> void
+{
+  DeletionQueue& deletion_queue = *device_.deletion_queue;
+  deletion_queue.destroy(pipeline_);
+  deletion_queue.destroy(pipeline_layout_);
+  deletion_queue.destroy(descriptor_set_layout_);
+  deletion_queue.destroy(descriptor_pool_);
+  deletion_queue.destroy(sampler_);
+  for (VkImageView view : mip_views_) {
+    deletion_queue.destroy(view);
+  }
+  deletion_queue.destroy(view_);
+  deletion_queue.destroy(image_);
+  deletion_queue.destroy(memory_);
+  pipeline_ = VK_NULL_HANDLE;
+  pipeline_layout_ = VK_NULL_HANDLE;
+  descriptor_set_layout_ = VK_NULL_HANDLE;
+  descriptor_pool_ = VK_NULL_HANDLE;
+  sampler_ = VK_NULL_HANDLE;
+  mip_views_.clear();
+  view_ = VK_NULL_HANDLE;
+  image_ = VK_NULL_HANDLE;
+  memory_ = VK_NULL_HANDLE;
+  descriptor_sets_.clear();
+  // The new image starts undefined, and the depth buffer is gone too.
+  initialized_ = false;
+  depth_view_ = VK_NULL_HANDLE;
+}
+
+auto gfx::vk_api::DepthPyramid::set_depth_view(VkImageView depth_view)
+    -> void
+{
+  depth_view_ = depth_view;
+  write_depth_view_();
+}
+
+auto gfx::vk_api::DepthPyramid::record_build(VkCommandBuffer command_buffer)
+    -> void
+{
+  if (depth_view_ == VK_NULL_HANDLE) {
+    return;
+  }
+  auto image_barrier = [this](uint32_t base_mip, uint32_t mip_count,
+                              VkAccessFlags src_access,
+                              VkAccessFlags dst_access,
+                              VkImageLayout old_layout) {
+    return build<VkImageMemoryBarrier>()
+        .set(&VkImageMemoryBarrier::srcAccessMask, src_access)
+        .set(&VkImageMemoryBarrier::dstAccessMask, dst_access)
+        .set(&VkImageMemoryBarrier::oldLayout, old_layout)
+        .set(&VkImageMemoryBarrier::newLayout, VK_IMAGE_LAYOUT_GENERAL)
+        .set(&VkImageMemoryBarrier::srcQueueFamilyIndex,
+             VK_QUEUE_FAMILY_IGNORED)
+        .set(&VkImageMemoryBarrier::dstQueueFamilyIndex,
+             VK_QUEUE_FAMILY_IGNORED)
+        .set(&VkImageMemoryBarrier::image, image_)
+        .set(&VkImageMemoryBarrier::subresourceRange,
+             VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, base_mip,
+                                     mip_count, 0, 1})
+        .get();
+  };
+
+  // The whole pyramid is rewritten, previous reads must be done first.
+  VkImageMemoryBarrier start =
+      initialized_
+          ? image_barrier(0, mip_count_, VK_ACCESS_SHADER_READ_BIT,
+                          VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL)
+          : image_barrier(0, mip_count_, 0, VK_ACCESS_SHADER_WRITE_BIT,
+                          VK_IMAGE_LAYOUT_UNDEFINED);
+  device_.vkCmdPipelineBarrier(command_buffer,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0,
+                               nullptr, 0, nullptr, 1, &start);
+  initialized_ = true;
+
+  device_.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_);
+  uint32_t source_width = width_;
+  uint32_t source_height = height_;
+  for (uint32_t mip = 0; mip < mip_count_; ++mip) {
+    uint32_t width = std::max(width_ >> mip, 1u);
+    uint32_t height = std::max(height_ >> mip, 1u);
+    DownsampleConstants constants = {{source_width, source_height},
+                                     {width, height}};
+    device_.vkCmdBindDescriptorSets(
+        command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout_, 0, 1,
+        &descriptor_sets_[mip], 0, nullptr);
+    device_.vkCmdPushConstants(command_buffer, pipeline_layout_,
+                               VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                               sizeof(constants), &constants);
+    device_.vkCmdDispatch(
+        command_buffer,
+        (width + DOWNSAMPLE_GROUP_SIZE - 1) / DOWNSAMPLE_GROUP_SIZE,
+        (height + DOWNSAMPLE_GROUP_SIZE - 1) / DOWNSAMPLE_GROUP_SIZE, 1);
+
+    // The level is read by the next reduction and by the culling pass.
+    VkImageMemoryBarrier written =
+        image_barrier(mip, 1, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+    device_.vkCmdPipelineBarrier(command_buffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0,
+                                 nullptr, 0, nullptr, 1, &written);
+    source_width = width;
+    source_height = height;
+  }
+}
+
+auto gfx::vk_api::DepthPyramid::view() const -> VkImageView { return view_; }
+
+auto gfx::vk_api::DepthPyramid::sampler() const -> VkSampler
+{
+  return sampler_;
+}
+
+auto gfx::vk_api::DepthPyramid::width() const -> uint32_t { return width_; }
+
+auto gfx::vk_api::DepthPyramid::height() const -> uint32_t { return height_; }
+
+auto gfx::vk_api::DepthPyramid::mip_count() const -> uint32_t
+{
+  return mip_count_;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "geometry.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+auto compute_bounding_sphere(const Vertex* vertices, uint32_t vertex_count)
+    -> BoundingSphere;
+
+// ************************************************************ //
+// CPU frustum culling                                          //
+//                                                              //
+// Fallback for devices without GPU culling. Instances are      //
+// transposed to SoA in small chunks, then their mesh bounding  //
+// spheres are moved to world space and tested against the      //
+// frustum by the math kernels of the active SIMD level. The    //
+// indices of the visible instances are written in order to     //
+// visible, which must hold instance_count entries. Instances   //
+// of unknown meshes are never visible.                         //
+// ************************************************************ //
+auto cull_instances(const math::Frustum& frustum,
+                    const BoundingSphere* mesh_bounds, uint32_t mesh_count,
+                    const Instance* instances, uint32_t instance_count,
+                    uint32_t* visible) -> uint32_t;
+
+// ************************************************************ //
+// DepthPyramid                                                 //
+//                                                              //
+// Hierarchical Z buffer built from a depth buffer: every mip   //
+// holds the farthest depth of the texels it covers, so a       //
+// single fetch at the right level tells whether a screen area  //
+// is fully hidden. Built from the previous frame's depth and   //
+// used to cull the current frame's instances.                  //
+// ************************************************************ //
+class DepthPyramid {
+ public:
+  // The depth view must stay valid as long as the pyramid or until
+  // replaced. Returns the result of the call that failed, pyramid is only
+  // set on success.
+  static auto create(VulkanDevice& device, VkImageView depth_view,
+                     uint32_t width, uint32_t height,
+                     const std::vector<uint32_t>& downsample_spirv,
+                     std::unique_ptr<DepthPyramid>& pyramid) -> VkResult;
+  ~DepthPyramid();
+
+  DepthPyramid(const DepthPyramid&) = delete;
+  DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+  // Reads the depth buffer from the view from the next build on, once the
+  // frames building the pyramid retired. The depth buffer goes away with a
+  // lost device, the recovered pyramid has no view until given the new one.
+  auto set_depth_view(VkImageView depth_view) -> void;
+  // Reduces the depth buffer, which must be in the shader read only layout.
+  // The pyramid is left in the general layout, readable by compute shaders.
+  // Records nothing without a depth view.
+  auto record_build(VkCommandBuffer command_buffer) -> void;
+
+  auto view() const -> VkImageView;
+  auto sampler() const -> VkSampler;
+  auto width() const -> uint32_t;
+  auto height() const -> uint32_t;
+  auto mip_count() const -> uint32_t;
+
+ private:
+  DepthPyramid(VulkanDevice& device, VkImageView depth_view, uint32_t width,
+               uint32_t height, const std::vector<uint32_t>& downsample_spirv);
+
+  auto create_() -> VkResult;
+  auto create_view_(uint32_t base_mip, uint32_t mip_count, VkImageView& view)
+      -> VkResult;
+  // Points the first reduction at the depth view.
+  auto write_depth_view_() -> void;
+  auto release_() -> void;
+
+  VulkanDevice& device_;
+  VkImageView depth_view_;
+  // Kept to create the pipeline again once the device is recovered.
+  std::vector<uint32_t> downsample_spirv_;
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t mip_count_;
+  bool initialized_;
+
+  VkImage image_;
+  VkDeviceMemory memory_;
+  VkImageView view_;
+  std::vector<VkImageView> mip_views_;
+  VkSampler sampler_;
+
+  VkDescriptorSetLayout descriptor_set_layout_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline pipeline_;
+  VkDescriptorPool descriptor_pool_;
+  // One set per mip, reading the previous level or the depth buffer.
+  std::vector<VkDescriptorSet> descriptor_sets_;
+  uint64_t resource_id_;
+};
+
+// What record_build() culls against.
+struct CullingView {
+  math::Mat4 view_projection;
+  // Previous frame's depth, null to skip occlusion culling.
+  const DepthPyramid* depth_pyramid;
+  // Recorded on the async compute queue, the draws then wait for the build
+  // with a semaphore instead of a barrier.
+  bool async_compute;
+};
+
+}  // namespace gfx::vk_api
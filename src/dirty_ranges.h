@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace gfx {
+
+// ************************************************************ //
+// DirtyRanges                                                  //
+//                                                              //
+// Sorted, disjoint [begin, end) ranges of elements changed     //
+// since the last clear(), so only those are copied or          //
+// uploaded. Overlapping and touching ranges are merged. Past   //
+// max_ranges, the two ranges with the smallest gap between     //
+// them are merged, trading a few clean elements for a bounded  //
+// number of copies.                                            //
+// ************************************************************ //
+class DirtyRanges {
+ public:
+  struct Range {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  explicit DirtyRanges(size_t max_ranges = 32) : max_ranges_(max_ranges) {}
+
+  auto add(uint32_t begin, uint32_t end) -> void
+  {
+    if (begin >= end) {
+      return;
+    }
+    // First range ending at or after begin, everything it touches merges.
+    auto first = std::lower_bound(
+        ranges_.begin(), ranges_.end(), begin,
+        [](const Range& range, uint32_t value) { return range.end < value; });
+    auto last = first;
+    while (last != ranges_.end() && last->begin <= end) {
+      begin = std::min(begin, last->begin);
+      end = std::max(end, last->end);
+      ++last;
+    }
+    first = ranges_.erase(first, last);
+    ranges_.insert(first, Range{begin, end});
+
+    if (ranges_.size() > max_ranges_) {
+      merge_closest_();
+    }
+  }
+
+  auto add(uint32_t element) -> void { add(element, element + 1); }
+
+  // Drops the parts at or past size, after the elements were removed.
+  auto truncate(uint32_t size) -> void
+  {
+    while (!ranges_.empty() && ranges_.back().begin >= size) {
+      ranges_.pop_back();
+    }
+    if (!ranges_.empty()) {
+      ranges_.back().end = std::min(ranges_.back().end, size);
+    }
+  }
+
+  auto clear() -> void { ranges_.clear(); }
+  auto empty() const -> bool { return ranges_.empty(); }
+  auto ranges() const -> const std::vector<Range>& { return ranges_; }
+
+  // Number of elements covered by the ranges.
+  auto element_count() const -> uint32_t
+  {
+    uint32_t count = 0;
+    for (const Range& range : ranges_) {
+      count += range.end - range.begin;
+    }
+    return count;
+  }
+
+ private:
+  auto merge_closest_() -> void
+  {
+    size_t closest = 0;
+    for (size_t i = 1; i + 1 < ranges_.size(); ++i) {
+      if (ranges_[i + 1].begin - ranges_[i].end <
+          ranges_[closest + 1].begin - ranges_[closest].end) {
+        closest = i;
+      }
+    }
+    ranges_[closest].end = ranges_[closest + 1].end;
+    ranges_.erase(ranges_.begin() + closest + 1);
+  }
+
+  size_t max_ranges_;
+  std::vector<Range> ranges_;
+};
+
+}  // namespace gfx
@@ -0,0 +1,55 @@
+#include "dynamic_resolution.h"
+#include <algorithm>
+#include <cmath>
+
+gfx::ResolutionController::ResolutionController(
+    const ResolutionSettings& settings)
+    : settings_(settings),
+      scale_(settings.max_scale),
+      smoothed_ms_(0.0),
+      settling_(0)
+{
+}
+
+auto gfx::ResolutionController::update(double gpu_ms) -> float
+{
+  if (settling_ > 0) {
+    --settling_;
+    return scale_;
+  }
+  smoothed_ms_ = smoothed_ms_ == 0.0
+                     ? gpu_ms
+                     : smoothed_ms_ + settings_.smoothing *
+                                          (gpu_ms - smoothed_ms_);
+  double error = smoothed_ms_ / settings_.target_ms - 1.0;
+  if (std::abs(error) <= settings_.hysteresis || smoothed_ms_ <= 0.0) {
+    return scale_;
+  }
+
+  // The time follows the pixel count, the square of the scale.
+  float ideal = scale_ * static_cast<float>(
+                             std::sqrt(settings_.target_ms / smoothed_ms_));
+  float next = std::clamp(ideal, scale_ - settings_.max_step,
+                          scale_ + settings_.max_step);
+  next = std::clamp(next, settings_.min_scale, settings_.max_scale);
+  if (next == scale_) {
+    return scale_;
+  }
+  // What the frames would take at the new scale, until they are measured.
+  smoothed_ms_ *= (next * next) / (scale_ * scale_);
+  scale_ = next;
+  settling_ = settings_.settle_frames;
+  return scale_;
+}
+
+auto gfx::ResolutionController::scale() const -> float { return scale_; }
+
+auto gfx::ResolutionController::smoothed_ms() const -> double
+{
+  return smoothed_ms_;
+}
+
+auto gfx::ResolutionController::scaled(uint32_t size) const -> uint32_t
+{
+  return std::max(1u, static_cast<uint32_t>(size * scale_ + 0.5f));
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+namespace gfx {
+
+struct ResolutionSettings {
+  // GPU time of a frame the controller holds.
+  double target_ms = 16.0;
+  // Bounds of the scale of each side of the render resolution.
+  float min_scale = 0.5f;
+  float max_scale = 1.0f;
+  // Smoothed times within this fraction of the target keep the scale.
+  double hysteresis = 0.1;
+  // Weight of the newest frame in the smoothed time.
+  double smoothing = 0.25;
+  // Largest change of the scale in one step.
+  float max_step = 0.1f;
+  // Frames ignored after a change, those in flight still ran at the old
+  // resolution.
+  uint32_t settle_frames = 3;
+};
+
+// ************************************************************ //
+// ResolutionController                                         //
+//                                                              //
+// Picks the render resolution scale of the next frame from the //
+// GPU times of the finished ones. The times are smoothed, and  //
+// while they stay in the hysteresis band around the target the //
+// scale is kept, so noise does not resize every frame. Outside //
+// it, the GPU time is taken as proportional to the pixel count //
+// and the scale moves, by at most max_step, to where the       //
+// smoothed time meets the target. Knows nothing of the GPU,    //
+// synthetic times drive it like measured ones.                 //
+// ************************************************************ //
+class ResolutionController {
+ public:
+  explicit ResolutionController(const ResolutionSettings& settings = {});
+
+  // Records the GPU time of a finished frame, returns the scale of the next
+  // one.
+  auto update(double gpu_ms) -> float;
+  auto scale() const -> float;
+  // Smoothed GPU time, 0 before the first update.
+  auto smoothed_ms() const -> double;
+  // Side of the render resolution for an output side, at least 1.
+  auto scaled(uint32_t size) const -> uint32_t;
+
+ private:
+  ResolutionSettings settings_;
+  float scale_;
+  double smoothed_ms_;
+  uint32_t settling_;
+};
+
+}  // namespace gfx
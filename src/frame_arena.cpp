@@ -0,0 +1,106 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <new>
+
+gfx::FrameArena::FrameArena(size_t chunk_size)
+    : current_(0),
+      offset_(0),
+      used_before_(0),
+      capacity_(0),
+      chunk_size_(chunk_size),
+      peak_(0),
+      upstream_allocations_(0)
+{
+}
+
+gfx::FrameArena::~FrameArena()
+{
+  for (Chunk& chunk : chunks_) {
+    ::operator delete(chunk.memory);
+  }
+}
+
+auto gfx::FrameArena::marker() const -> Marker
+{
+  return {current_, offset_, used_before_};
+}
+
+auto gfx::FrameArena::rewind(Marker marker) -> void
+{
+  current_ = marker.chunk;
+  offset_ = marker.offset;
+  used_before_ = marker.used_before;
+}
+
+auto gfx::FrameArena::bytes_used() const -> size_t
+{
+  return used_before_ + offset_;
+}
+
+auto gfx::FrameArena::peak_bytes_used() const -> size_t { return peak_; }
+
+auto gfx::FrameArena::capacity() const -> size_t { return capacity_; }
+
+auto gfx::FrameArena::upstream_allocations() const -> size_t
+{
+  return upstream_allocations_;
+}
+
+auto gfx::FrameArena::do_allocate(size_t bytes, size_t alignment) -> void*
+{
+  while (current_ < chunks_.size()) {
+    Chunk& chunk = chunks_[current_];
+    uintptr_t base = reinterpret_cast<uintptr_t>(chunk.memory);
+    uintptr_t aligned = (base + offset_ + alignment - 1) & ~(alignment - 1);
+    size_t end = static_cast<size_t>(aligned - base) + bytes;
+    if (end <= chunk.size) {
+      offset_ = end;
+      peak_ = std::max(peak_, used_before_ + offset_);
+      return reinterpret_cast<void*>(aligned);
+    }
+    // The current chunk is exhausted. Move on to the next one if it can hold
+    // the allocation, otherwise a larger chunk is inserted in its place.
+    if (current_ + 1 < chunks_.size() &&
+        chunks_[current_ + 1].size >= bytes + alignment) {
+      used_before_ += chunk.size;
+      ++current_;
+      offset_ = 0;
+      continue;
+    }
+    break;
+  }
+
+  size_t size = std::max(chunk_size_, bytes + alignment);
+  Chunk chunk = {static_cast<std::byte*>(::operator new(size)), size};
+  ++upstream_allocations_;
+  capacity_ += size;
+  // Chunks grow geometrically so a warming up arena settles quickly.
+  chunk_size_ *= 2;
+
+  size_t index = 0;
+  if (!chunks_.empty()) {
+    used_before_ += chunks_[current_].size;
+    index = current_ + 1;
+  }
+  chunks_.insert(chunks_.begin() + index, chunk);
+  current_ = index;
+  offset_ = 0;
+  return do_allocate(bytes, alignment);
+}
+
+auto gfx::FrameArena::do_deallocate(void*, size_t, size_t) -> void
+{
+  // Memory is released in bulk by rewind().
+}
+
+auto gfx::FrameArena::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept -> bool
+{
+  return this == &other;
+}
+
+auto gfx::frame_arena() -> FrameArena&
+{
+  thread_local FrameArena arena;
+  return arena;
+}
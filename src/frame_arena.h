@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace gfx {
+
+// ************************************************************ //
+// FrameArena                                                   //
+//                                                              //
+// Linear allocator for CPU side scratch memory. Allocations    //
+// bump a pointer inside chunks obtained from the heap, and     //
+// deallocation is a no-op: memory comes back all at once when  //
+// the enclosing ArenaScope ends. Chunks are kept across        //
+// frames, so once warmed up a frame performs no heap           //
+// allocation at all. Each thread owns its own arena.           //
+// ************************************************************ //
+class FrameArena : public std::pmr::memory_resource {
+ public:
+  struct Marker {
+    size_t chunk;
+    size_t offset;
+    size_t used_before;
+  };
+
+  explicit FrameArena(size_t chunk_size = 64 * 1024);
+  ~FrameArena() override;
+
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  auto marker() const -> Marker;
+  // Releases every allocation made since the marker was taken.
+  auto rewind(Marker marker) -> void;
+
+  // Bytes handed out and not rewound yet.
+  auto bytes_used() const -> size_t;
+  auto peak_bytes_used() const -> size_t;
+  auto capacity() const -> size_t;
+  // Number of chunks requested from the heap since creation. It stays
+  // constant in steady state.
+  auto upstream_allocations() const -> size_t;
+
+ private:
+  struct Chunk {
+    std::byte* memory;
+    size_t size;
+  };
+
+  auto do_allocate(size_t bytes, size_t alignment) -> void* override;
+  auto do_deallocate(void*, size_t, size_t) -> void override;
+  auto do_is_equal(const std::pmr::memory_resource& other) const noexcept
+      -> bool override;
+
+  std::vector<Chunk> chunks_;
+  size_t current_;
+  size_t offset_;
+  // Size of the chunks before the current one, so the bytes in use are
+  // known without walking the chunks.
+  size_t used_before_;
+  size_t capacity_;
+  size_t chunk_size_;
+  size_t peak_;
+  size_t upstream_allocations_;
+};
+
+// The arena of the calling thread.
+auto frame_arena() -> FrameArena&;
+
+// Rewinds the calling thread's arena when leaving the scope, so functions
+// that also run outside of frames do not grow the arena.
+class ArenaScope {
+ public:
+  ArenaScope() : arena_(frame_arena()), marker_(arena_.marker()) {}
+  ~ArenaScope() { arena_.rewind(marker_); }
+
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+ private:
+  FrameArena& arena_;
+  FrameArena::Marker marker_;
+};
+
+// Scratch containers allocated from the calling thread's arena. They must not
+// outlive the enclosing ArenaScope or frame.
+template <typename T>
+using ScratchVector = std::pmr::vector<T>;
+
+}  // namespace gfx
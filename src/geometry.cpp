@@ -0,0 +1,886 @@
+#include "geometry.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "culling.h"
+#include "host_allocator.h"
+#include "log.h"
+#include "vulkan_builders.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_recovery.h"
+
+namespace gfx::vk_api {
+
+namespace {
+
+// Must match local_size_x of the build_draws compute shader.
+constexpr uint32_t BUILD_DRAWS_GROUP_SIZE = 64;
+
+struct BuildDrawsConstants {
+  uint32_t instance_count;
+  uint32_t mesh_count;
+};
+
+// Matches the CullData uniform of the cull_instances compute shader.
+struct CullData {
+  float view_projection[16];
+  float planes[6][4];
+  float pyramid_size[2];
+  float padding[2];
+};
+
+// Instance i of a build is instances[instance_index(i)].
+template <typename InstanceIndex>
+auto build_commands(const MeshRange* meshes, uint32_t mesh_count,
+                    const Instance* instances, uint32_t instance_count,
+                    InstanceIndex instance_index,
+                    VkDrawIndexedIndirectCommand* commands,
+                    uint32_t* instance_indices) -> uint32_t
+{
+  for (uint32_t i = 0; i < mesh_count; ++i) {
+    commands[i] = {meshes[i].index_count, 0, meshes[i].first_index,
+                   meshes[i].vertex_offset, 0};
+  }
+  // Count the instances of every mesh.
+  for (uint32_t i = 0; i < instance_count; ++i) {
+    const Instance& instance = instances[instance_index(i)];
+    if (instance.mesh < mesh_count) {
+      ++commands[instance.mesh].instanceCount;
+    }
+  }
+  // Lay the meshes out one after the other.
+  uint32_t first_instance = 0;
+  uint32_t non_empty = 0;
+  for (uint32_t i = 0; i < mesh_count; ++i) {
+    commands[i].firstInstance = first_instance;
+    first_instance += commands[i].instanceCount;
+    non_empty += commands[i].instanceCount > 0 ? 1 : 0;
+    commands[i].instanceCount = 0;
+  }
+  // Scatter, counting again the way the compute shader does.
+  for (uint32_t i = 0; i < instance_count; ++i) {
+    uint32_t index = instance_index(i);
+    if (instances[index].mesh < mesh_count) {
+      VkDrawIndexedIndirectCommand& command = commands[instances[index].mesh];
+      instance_indices[command.firstInstance + command.instanceCount++] =
+          index;
+    }
+  }
+  return non_empty;
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::build_draw_commands(const MeshRange* meshes,
+                                      uint32_t mesh_count,
+                                      const Instance* instances,
+                                      uint32_t instance_count,
+                                      VkDrawIndexedIndirectCommand* commands,
+                                      uint32_t* instance_indices) -> uint32_t
+{
+  return build_commands(meshes, mesh_count, instances, instance_count,
+                        [](uint32_t i) { return i; }, commands,
+                        instance_indices);
+}
+
+auto gfx::vk_api::build_visible_draw_commands(
+    const MeshRange* meshes, uint32_t mesh_count, const Instance* instances,
+    const uint32_t* visible, uint32_t visible_count,
+    VkDrawIndexedIndirectCommand* commands, uint32_t* instance_indices)
+    -> uint32_t
+{
+  return build_commands(meshes, mesh_count, instances, visible_count,
+                        [visible](uint32_t i) { return visible[i]; }, commands,
+                        instance_indices);
+}
+
+gfx::vk_api::GeometryBatcher::GeometryBatcher(VulkanDevice& device,
+                                              const GeometryLimits& limits)
+    : device_(device),
+      limits_(limits),
+      vertices_{},
+      indices_{},
+      vertex_count_(0),
+      index_count_(0),
+      bounds_{},
+      template_dirty_(true),
+      frames_(limits.frames_in_flight),
+      frame_(0),
+      compacted_(false),
+      descriptor_set_layout_(VK_NULL_HANDLE),
+      pyramid_set_layout_(VK_NULL_HANDLE),
+      pipeline_layout_(VK_NULL_HANDLE),
+      build_pipeline_(VK_NULL_HANDLE),
+      cull_pipeline_(VK_NULL_HANDLE),
+      occlusion_cull_pipeline_(VK_NULL_HANDLE),
+      compact_pipeline_(VK_NULL_HANDLE),
+      descriptor_pool_(VK_NULL_HANDLE),
+      last_draw_commands_(0),
+      last_draw_calls_(0),
+      last_visible_instances_(0),
+      last_cpu_cull_ms_(0.0),
+      resource_id_(0)
+{
+  for (auto& frame : frames_) {
+    frame.instances = {};
+    frame.commands = {};
+    frame.instance_indices = {};
+    frame.cull_data = {};
+    frame.compacted = {};
+    frame.descriptor_set = VK_NULL_HANDLE;
+    frame.pyramid_set = VK_NULL_HANDLE;
+    frame.bound_pyramid = nullptr;
+  }
+}
+
+auto gfx::vk_api::GeometryBatcher::create(
+    VulkanDevice& device, const GeometryLimits& limits,
+    const GeometryShaders& shaders, std::unique_ptr<GeometryBatcher>& batcher)
+    -> VkResult
+{
+  // What was created before a failure goes away with the batcher.
+  std::unique_ptr<GeometryBatcher> created(new GeometryBatcher(device, limits));
+  VkResult result = created->create_buffers_();
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create the geometry buffers: {}!",
+                  result_name(result));
+    return result;
+  }
+  // Without a first instance in indirect commands the instance ranges cannot
+  // be expressed, the CPU then records direct draws instead.
+  if (!shaders.build_draws.empty() &&
+      device.enabled_features.drawIndirectFirstInstance) {
+    created->shaders_ = shaders;
+    result = created->create_pipelines_();
+    if (result != VK_SUCCESS) {
+      GFX_LOG_ERROR("Could not create the geometry pipelines: {}!",
+                    result_name(result));
+      return result;
+    }
+  }
+  GeometryBatcher* self = created.get();
+  self->resource_id_ = device.resources->add(
+      [self](VulkanDevice&) { self->release_(); },
+      [self](VulkanDevice&) { return self->restore_(); });
+  batcher = std::move(created);
+  return VK_SUCCESS;
+}
+
+gfx::vk_api::GeometryBatcher::~GeometryBatcher()
+{
+  if (resource_id_ != 0) {
+    device_.resources->remove(resource_id_);
+  }
+  release_();
+}
+
+auto gfx::vk_api::GeometryBatcher::release_() -> void
+{
+  destroy_buffer(device_, vertices_);
+  destroy_buffer(device_, indices_);
+  destroy_buffer(device_, bounds_);
+  for (auto& frame : frames_) {
+    destroy_buffer(device_, frame.instances);
+    destroy_buffer(device_, frame.commands);
+    destroy_buffer(device_, frame.instance_indices);
+    destroy_buffer(device_, frame.cull_data);
+    destroy_buffer(device_, frame.compacted);
+  }
+  // Descriptor sets go away with their pool.
+  device_.deletion_queue->destroy(build_pipeline_);
+  device_.deletion_queue->destroy(cull_pipeline_);
+  device_.deletion_queue->destroy(occlusion_cull_pipeline_);
+  device_.deletion_queue->destroy(compact_pipeline_);
+  device_.deletion_queue->destroy(pipeline_layout_);
+  device_.deletion_queue->destroy(descriptor_set_layout_);
+  device_.deletion_queue->destroy(pyramid_set_layout_);
+  device_.deletion_queue->destroy(descriptor_pool_);
+  build_pipeline_ = VK_NULL_HANDLE;
+  cull_pipeline_ = VK_NULL_HANDLE;
+  occlusion_cull_pipeline_ = VK_NULL_HANDLE;
+  compact_pipeline_ = VK_NULL_HANDLE;
+  pipeline_layout_ = VK_NULL_HANDLE;
+  descriptor_set_layout_ = VK_NULL_HANDLE;
+  pyramid_set_layout_ = VK_NULL_HANDLE;
+  descriptor_pool_ = VK_NULL_HANDLE;
+  for (auto& frame : frames_) {
+    frame.descriptor_set = VK_NULL_HANDLE;
+    frame.pyramid_set = VK_NULL_HANDLE;
+    frame.bound_pyramid = nullptr;
+  }
+}
+
+auto gfx::vk_api::GeometryBatcher::restore_() -> VkResult
+{
+  VkResult result = create_buffers_();
+  if (result == VK_SUCCESS && !shaders_.build_draws.empty()) {
+    result = create_pipelines_();
+  }
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  memcpy(vertices_.mapped, vertex_data_.data(),
+         vertex_data_.size() * sizeof(Vertex));
+  memcpy(indices_.mapped, index_data_.data(),
+         index_data_.size() * sizeof(uint32_t));
+  memcpy(bounds_.mapped, mesh_bounds_.data(),
+         mesh_bounds_.size() * sizeof(BoundingSphere));
+  // Every frame uploads all the instances again.
+  mark_instances_dirty_(0, static_cast<uint32_t>(instances_.size()));
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::GeometryBatcher::add_mesh(const Vertex* vertices,
+                                            uint32_t vertex_count,
+                                            const uint32_t* indices,
+                                            uint32_t index_count,
+                                            MeshHandle& mesh) -> VkResult
+{
+  if (meshes_.size() == limits_.mesh_capacity ||
+      vertex_count > limits_.vertex_capacity - vertex_count_ ||
+      index_count > limits_.index_capacity - index_count_) {
+    GFX_LOG_ERROR("Geometry megabuffers are full!");
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+
+  MeshRange range = {index_count_, index_count,
+                     static_cast<int32_t>(vertex_count_)};
+  memcpy(static_cast<Vertex*>(vertices_.mapped) + vertex_count_, vertices,
+         vertex_count * sizeof(Vertex));
+  memcpy(static_cast<uint32_t*>(indices_.mapped) + index_count_, indices,
+         index_count * sizeof(uint32_t));
+  vertex_data_.insert(vertex_data_.end(), vertices, vertices + vertex_count);
+  index_data_.insert(index_data_.end(), indices, indices + index_count);
+  vertex_count_ += vertex_count;
+  index_count_ += index_count;
+
+  BoundingSphere bounds = compute_bounding_sphere(vertices, vertex_count);
+  static_cast<BoundingSphere*>(bounds_.mapped)[meshes_.size()] = bounds;
+  mesh_bounds_.push_back(bounds);
+  meshes_.push_back(range);
+  mesh_instance_counts_.push_back(0);
+  template_dirty_ = true;
+  mesh = MeshHandle{static_cast<uint32_t>(meshes_.size() - 1)};
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::GeometryBatcher::mesh(MeshHandle handle) const
+    -> const MeshRange&
+{
+  return meshes_[handle.index];
+}
+
+auto gfx::vk_api::GeometryBatcher::add_instance(MeshHandle mesh,
+                                                const float transform[12],
+                                                uint32_t& instance)
+    -> VkResult
+{
+  if (instances_.size() == limits_.instance_capacity) {
+    GFX_LOG_ERROR("Geometry instance buffer is full!");
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+
+  Instance added = {};
+  memcpy(added.transform, transform, sizeof(added.transform));
+  added.mesh = mesh.index;
+  instances_.push_back(added);
+
+  instance = static_cast<uint32_t>(instances_.size() - 1);
+  ++mesh_instance_counts_[mesh.index];
+  mark_instances_dirty_(instance, instance + 1);
+  template_dirty_ = true;
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::GeometryBatcher::set_transform(uint32_t instance,
+                                                 const float transform[12])
+    -> void
+{
+  memcpy(instances_[instance].transform, transform,
+         sizeof(instances_[instance].transform));
+  mark_instances_dirty_(instance, instance + 1);
+}
+
+auto gfx::vk_api::GeometryBatcher::clear_instances() -> void
+{
+  // Shrinking always fits.
+  resize_instances(0);
+}
+
+auto gfx::vk_api::GeometryBatcher::resize_instances(uint32_t count)
+    -> VkResult
+{
+  if (count > limits_.instance_capacity) {
+    GFX_LOG_ERROR("Geometry instance buffer is full!");
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  auto old_count = static_cast<uint32_t>(instances_.size());
+  for (uint32_t i = count; i < old_count; ++i) {
+    if (instances_[i].mesh < meshes_.size()) {
+      --mesh_instance_counts_[instances_[i].mesh];
+    }
+  }
+  Instance empty = {};
+  empty.mesh = UINT32_MAX;
+  instances_.resize(count, empty);
+
+  for (auto& frame : frames_) {
+    frame.dirty_instances.truncate(count);
+  }
+  mark_instances_dirty_(old_count, count);
+  template_dirty_ = template_dirty_ || count < old_count;
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::GeometryBatcher::write_instances(
+    uint32_t first, uint32_t count, const math::Affine* transforms,
+    const uint32_t* meshes) -> void
+{
+  for (uint32_t i = 0; i < count; ++i) {
+    Instance& instance = instances_[first + i];
+    memcpy(instance.transform, transforms[i].rows, sizeof(instance.transform));
+    if (instance.mesh == meshes[i]) {
+      continue;
+    }
+    if (instance.mesh < meshes_.size()) {
+      --mesh_instance_counts_[instance.mesh];
+    }
+    instance.mesh = meshes[i];
+    if (instance.mesh < meshes_.size()) {
+      ++mesh_instance_counts_[instance.mesh];
+    }
+    template_dirty_ = true;
+  }
+  mark_instances_dirty_(first, first + count);
+}
+
+auto gfx::vk_api::GeometryBatcher::apply_instance_updates(
+    const InstanceUpdates& updates) -> VkResult
+{
+  VkResult result = resize_instances(updates.instance_count);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  for (const InstanceUpdates::Range& range : updates.ranges) {
+    write_instances(range.first, range.count, range.transforms,
+                    range.meshes);
+  }
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::GeometryBatcher::record_build(VkCommandBuffer command_buffer,
+                                                const CullingView* view)
+    -> void
+{
+  // The buffers of this slot were last used frames_in_flight frames ago.
+  frame_ = (frame_ + 1) % limits_.frames_in_flight;
+  FrameBuffers& frame = frames_[frame_];
+
+  auto instance_count = static_cast<uint32_t>(instances_.size());
+  auto mesh_count = static_cast<uint32_t>(meshes_.size());
+
+  // Each set holds its own copy, only what changed since it was last used
+  // is written.
+  auto* mapped_instances = static_cast<Instance*>(frame.instances.mapped);
+  for (const DirtyRanges::Range& range : frame.dirty_instances.ranges()) {
+    memcpy(mapped_instances + range.begin, instances_.data() + range.begin,
+           (range.end - range.begin) * sizeof(Instance));
+  }
+  frame.dirty_instances.clear();
+
+  auto* commands =
+      static_cast<VkDrawIndexedIndirectCommand*>(frame.commands.mapped);
+  auto* draw_count = reinterpret_cast<uint32_t*>(
+      static_cast<std::byte*>(frame.commands.mapped) + draw_count_offset_());
+  *draw_count = mesh_count;
+  compacted_ = false;
+  last_visible_instances_ = instance_count;
+  last_cpu_cull_ms_ = 0.0;
+
+  if (view != nullptr && !uses_gpu_culling()) {
+    record_cpu_culling_(frame, *view);
+    return;
+  }
+  if (!uses_gpu_build()) {
+    build_draw_commands(meshes_.data(), mesh_count, instances_.data(),
+                        instance_count, commands,
+                        static_cast<uint32_t*>(frame.instance_indices.mapped));
+    return;
+  }
+
+  // The compute pass only scatters the instances into ranges laid out on the
+  // CPU, counting them again from zero.
+  if (template_dirty_) {
+    update_command_template_();
+  }
+  memcpy(commands, command_template_.data(),
+         command_template_.size() * sizeof(VkDrawIndexedIndirectCommand));
+  if (instance_count == 0) {
+    return;
+  }
+
+  if (view != nullptr) {
+    record_gpu_culling_(command_buffer, frame, *view);
+  }
+  else {
+    BuildDrawsConstants constants = {instance_count, mesh_count};
+    device_.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                              build_pipeline_);
+    device_.vkCmdBindDescriptorSets(command_buffer,
+                                    VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    pipeline_layout_, 0, 1,
+                                    &frame.descriptor_set, 0, nullptr);
+    device_.vkCmdPushConstants(command_buffer, pipeline_layout_,
+                               VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                               sizeof(constants), &constants);
+    device_.vkCmdDispatch(
+        command_buffer,
+        (instance_count + BUILD_DRAWS_GROUP_SIZE - 1) / BUILD_DRAWS_GROUP_SIZE,
+        1, 1);
+  }
+
+  // On the async compute queue the draws wait on a semaphore instead.
+  if (view != nullptr && view->async_compute) {
+    return;
+  }
+  VkMemoryBarrier barrier =
+      build<VkMemoryBarrier>()
+          .set(&VkMemoryBarrier::srcAccessMask, VK_ACCESS_SHADER_WRITE_BIT)
+          .set(&VkMemoryBarrier::dstAccessMask,
+               VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                   VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+  device_.vkCmdPipelineBarrier(command_buffer,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                   VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                               0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+auto gfx::vk_api::GeometryBatcher::record_draws(VkCommandBuffer command_buffer)
+    -> void
+{
+  FrameBuffers& frame = frames_[frame_];
+  auto mesh_count = static_cast<uint32_t>(meshes_.size());
+  constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+  VkBuffer vertex_buffers[] = {vertices_.buffer, frame.instance_indices.buffer};
+  VkDeviceSize offsets[] = {0, 0};
+  device_.vkCmdBindVertexBuffers(command_buffer, 0, 2, vertex_buffers,
+                                 offsets);
+  device_.vkCmdBindIndexBuffer(command_buffer, indices_.buffer, 0,
+                               VK_INDEX_TYPE_UINT32);
+
+  last_draw_commands_ = mesh_count;
+  if (mesh_count == 0) {
+    last_draw_calls_ = 0;
+  }
+  else if (compacted_) {
+    // The draw count and the commands of the visible meshes, packed.
+    device_.vkCmdDrawIndexedIndirectCountKHR(
+        command_buffer, frame.compacted.buffer, sizeof(uint32_t),
+        frame.compacted.buffer, 0, limits_.mesh_capacity, stride);
+    last_draw_calls_ = 1;
+  }
+  else if (!device_.enabled_features.drawIndirectFirstInstance) {
+    // The commands were built on the CPU, issue them directly.
+    const auto* commands =
+        static_cast<const VkDrawIndexedIndirectCommand*>(frame.commands.mapped);
+    last_draw_calls_ = 0;
+    for (uint32_t i = 0; i < mesh_count; ++i) {
+      if (commands[i].instanceCount == 0) {
+        continue;
+      }
+      device_.vkCmdDrawIndexed(command_buffer, commands[i].indexCount,
+                               commands[i].instanceCount,
+                               commands[i].firstIndex,
+                               commands[i].vertexOffset,
+                               commands[i].firstInstance);
+      ++last_draw_calls_;
+    }
+  }
+  else if (device_.draw_indirect_count_supported) {
+    device_.vkCmdDrawIndexedIndirectCountKHR(
+        command_buffer, frame.commands.buffer, 0, frame.commands.buffer,
+        draw_count_offset_(), limits_.mesh_capacity, stride);
+    last_draw_calls_ = 1;
+  }
+  else if (device_.enabled_features.multiDrawIndirect) {
+    device_.vkCmdDrawIndexedIndirect(command_buffer, frame.commands.buffer, 0,
+                                     mesh_count, stride);
+    last_draw_calls_ = 1;
+  }
+  else {
+    for (uint32_t i = 0; i < mesh_count; ++i) {
+      device_.vkCmdDrawIndexedIndirect(command_buffer, frame.commands.buffer,
+                                       i * stride, 1, stride);
+    }
+    last_draw_calls_ = mesh_count;
+  }
+}
+
+auto gfx::vk_api::GeometryBatcher::uses_gpu_build() const -> bool
+{
+  return build_pipeline_ != VK_NULL_HANDLE;
+}
+
+auto gfx::vk_api::GeometryBatcher::uses_gpu_culling() const -> bool
+{
+  return cull_pipeline_ != VK_NULL_HANDLE;
+}
+
+auto gfx::vk_api::GeometryBatcher::instance_buffer() const -> VkBuffer
+{
+  return frames_[frame_].instances.buffer;
+}
+
+auto gfx::vk_api::GeometryBatcher::draw_commands() const
+    -> const VkDrawIndexedIndirectCommand*
+{
+  return static_cast<const VkDrawIndexedIndirectCommand*>(
+      frames_[frame_].commands.mapped);
+}
+
+auto gfx::vk_api::GeometryBatcher::instance_indices() const -> const uint32_t*
+{
+  return static_cast<const uint32_t*>(frames_[frame_].instance_indices.mapped);
+}
+
+auto gfx::vk_api::GeometryBatcher::stats() const -> GeometryStats
+{
+  GeometryStats stats;
+  stats.meshes = static_cast<uint32_t>(meshes_.size());
+  stats.instances = static_cast<uint32_t>(instances_.size());
+  stats.vertices = vertex_count_;
+  stats.indices = index_count_;
+  stats.draw_commands = last_draw_commands_;
+  stats.draw_calls = last_draw_calls_;
+  stats.visible_instances = last_visible_instances_;
+  stats.cpu_cull_ms = last_cpu_cull_ms_;
+  return stats;
+}
+
+auto gfx::vk_api::GeometryBatcher::create_buffers_() -> VkResult
+{
+  // Everything is written by the CPU, device local memory is only used when
+  // it is also host visible.
+  constexpr VkMemoryPropertyFlags host_memory =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  constexpr VkMemoryPropertyFlags device_memory =
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+  VkResult result = create_buffer(
+      device_, limits_.vertex_capacity * sizeof(Vertex),
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, host_memory, device_memory, false,
+      vertices_);
+  if (result == VK_SUCCESS) {
+    result = create_buffer(device_, limits_.index_capacity * sizeof(uint32_t),
+                           VK_BUFFER_USAGE_INDEX_BUFFER_BIT, host_memory,
+                           device_memory, false, indices_);
+  }
+  // Read by the culling, which may run on the compute queue.
+  if (result == VK_SUCCESS) {
+    result = create_buffer(
+        device_, limits_.mesh_capacity * sizeof(BoundingSphere),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_memory, device_memory, true,
+        bounds_);
+  }
+
+  for (auto& frame : frames_) {
+    if (result == VK_SUCCESS) {
+      result = create_buffer(
+          device_, limits_.instance_capacity * sizeof(Instance),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_memory, device_memory,
+          true, frame.instances);
+    }
+    if (result == VK_SUCCESS) {
+      result = create_buffer(device_, draw_count_offset_() + sizeof(uint32_t),
+                             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             host_memory, device_memory, true,
+                             frame.commands);
+    }
+    if (result == VK_SUCCESS) {
+      result = create_buffer(
+          device_, limits_.instance_capacity * sizeof(uint32_t),
+          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          host_memory, device_memory, true, frame.instance_indices);
+    }
+    if (result == VK_SUCCESS) {
+      result = create_buffer(device_, sizeof(CullData),
+                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, host_memory,
+                             device_memory, true, frame.cull_data);
+    }
+    if (result == VK_SUCCESS) {
+      result = create_buffer(
+          device_,
+          sizeof(uint32_t) +
+              limits_.mesh_capacity * sizeof(VkDrawIndexedIndirectCommand),
+          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          host_memory, device_memory, true, frame.compacted);
+    }
+  }
+  return result;
+}
+
+auto gfx::vk_api::GeometryBatcher::create_pipelines_() -> VkResult
+{
+  const GeometryShaders& shaders = shaders_;
+  // Binding 0: instances, 1: commands, 2: instance indices, 3: mesh bounds,
+  // 4: cull data, 5: compacted commands. All passes share the layout.
+  VkDescriptorSetLayoutBinding bindings[6];
+  for (uint32_t i = 0; i < std::size(bindings); ++i) {
+    bindings[i] = {i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                   VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+  }
+  bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  using SetLayoutInfo = VkDescriptorSetLayoutCreateInfo;
+  VkDescriptorSetLayoutCreateInfo set_layout_create_info =
+      build<SetLayoutInfo>()
+          .set(&SetLayoutInfo::bindingCount, std::size(bindings))
+          .set(&SetLayoutInfo::pBindings, bindings);
+  // Set 1 binding 0: depth pyramid, only used by the occlusion culling.
+  VkDescriptorSetLayoutBinding pyramid_binding = {
+      0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+      VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+  VkDescriptorSetLayoutCreateInfo pyramid_layout_create_info =
+      build<SetLayoutInfo>()
+          .set(&SetLayoutInfo::bindingCount, 1)
+          .set(&SetLayoutInfo::pBindings, &pyramid_binding);
+  VkResult result = device_.vkCreateDescriptorSetLayout(
+      device_.logical_device, &set_layout_create_info, allocation_callbacks(),
+      &descriptor_set_layout_);
+  if (result == VK_SUCCESS) {
+    result = device_.vkCreateDescriptorSetLayout(
+        device_.logical_device, &pyramid_layout_create_info,
+        allocation_callbacks(), &pyramid_set_layout_);
+  }
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkDescriptorSetLayout set_layouts[] = {descriptor_set_layout_,
+                                         pyramid_set_layout_};
+  VkPushConstantRange push_constant_range = {VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                             sizeof(BuildDrawsConstants)};
+  using LayoutInfo = VkPipelineLayoutCreateInfo;
+  VkPipelineLayoutCreateInfo layout_create_info =
+      build<LayoutInfo>()
+          .set(&LayoutInfo::setLayoutCount, std::size(set_layouts))
+          .set(&LayoutInfo::pSetLayouts, set_layouts)
+          .set(&LayoutInfo::pushConstantRangeCount, 1)
+          .set(&LayoutInfo::pPushConstantRanges, &push_constant_range);
+  result = device_.vkCreatePipelineLayout(device_.logical_device,
+                                          &layout_create_info,
+                                          allocation_callbacks(),
+                                          &pipeline_layout_);
+  if (result == VK_SUCCESS) {
+    result = create_compute_pipeline(device_, shaders.build_draws,
+                                     pipeline_layout_, build_pipeline_);
+  }
+  if (result == VK_SUCCESS && !shaders.cull_instances.empty()) {
+    result = create_compute_pipeline(device_, shaders.cull_instances,
+                                     pipeline_layout_, cull_pipeline_);
+  }
+  if (result == VK_SUCCESS && !shaders.cull_instances.empty() &&
+      !shaders.cull_instances_occlusion.empty()) {
+    result = create_compute_pipeline(device_, shaders.cull_instances_occlusion,
+                                     pipeline_layout_,
+                                     occlusion_cull_pipeline_);
+  }
+  // Compacted commands are only worth it with a GPU side draw count.
+  if (result == VK_SUCCESS && !shaders.compact_draws.empty() &&
+      device_.draw_indirect_count_supported) {
+    result = create_compute_pipeline(device_, shaders.compact_draws,
+                                     pipeline_layout_, compact_pipeline_);
+  }
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkDescriptorPoolSize pool_sizes[] = {
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5 * limits_.frames_in_flight},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, limits_.frames_in_flight},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, limits_.frames_in_flight}};
+  using PoolInfo = VkDescriptorPoolCreateInfo;
+  VkDescriptorPoolCreateInfo pool_create_info =
+      build<PoolInfo>()
+          .set(&PoolInfo::maxSets, 2 * limits_.frames_in_flight)
+          .set(&PoolInfo::poolSizeCount, std::size(pool_sizes))
+          .set(&PoolInfo::pPoolSizes, pool_sizes);
+  result = device_.vkCreateDescriptorPool(device_.logical_device,
+                                          &pool_create_info,
+                                          allocation_callbacks(),
+                                          &descriptor_pool_);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  for (auto& frame : frames_) {
+    VkDescriptorSet sets[std::size(set_layouts)];
+    using AllocateInfo = VkDescriptorSetAllocateInfo;
+    VkDescriptorSetAllocateInfo allocate_info =
+        build<AllocateInfo>()
+            .set(&AllocateInfo::descriptorPool, descriptor_pool_)
+            .set(&AllocateInfo::descriptorSetCount, std::size(set_layouts))
+            .set(&AllocateInfo::pSetLayouts, set_layouts);
+    result = device_.vkAllocateDescriptorSets(device_.logical_device,
+                                              &allocate_info, sets);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+    frame.descriptor_set = sets[0];
+    frame.pyramid_set = sets[1];
+
+    VkDescriptorBufferInfo buffer_infos[] = {
+        {frame.instances.buffer, 0, VK_WHOLE_SIZE},
+        {frame.commands.buffer, 0, VK_WHOLE_SIZE},
+        {frame.instance_indices.buffer, 0, VK_WHOLE_SIZE},
+        {bounds_.buffer, 0, VK_WHOLE_SIZE},
+        {frame.cull_data.buffer, 0, VK_WHOLE_SIZE},
+        {frame.compacted.buffer, 0, VK_WHOLE_SIZE}};
+    VkWriteDescriptorSet writes[std::size(buffer_infos)];
+    for (uint32_t i = 0; i < std::size(buffer_infos); ++i) {
+      writes[i] =
+          build<VkWriteDescriptorSet>()
+              .set(&VkWriteDescriptorSet::dstSet, frame.descriptor_set)
+              .set(&VkWriteDescriptorSet::dstBinding, i)
+              .set(&VkWriteDescriptorSet::descriptorCount, 1)
+              .set(&VkWriteDescriptorSet::descriptorType,
+                   bindings[i].descriptorType)
+              .set(&VkWriteDescriptorSet::pBufferInfo, &buffer_infos[i]);
+    }
+    device_.vkUpdateDescriptorSets(device_.logical_device, std::size(writes),
+                                   writes, 0, nullptr);
+  }
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::GeometryBatcher::record_cpu_culling_(
+    FrameBuffers& frame, const CullingView& view) -> void
+{
+  auto start = std::chrono::steady_clock::now();
+  auto instance_count = static_cast<uint32_t>(instances_.size());
+  auto mesh_count = static_cast<uint32_t>(meshes_.size());
+
+  // Frustum only, the depth pyramid lives on the GPU.
+  visible_.resize(instance_count);
+  math::Frustum frustum = math::extract_frustum(view.view_projection);
+  uint32_t visible_count =
+      cull_instances(frustum, mesh_bounds_.data(), mesh_count,
+                     instances_.data(), instance_count, visible_.data());
+  build_visible_draw_commands(
+      meshes_.data(), mesh_count, instances_.data(), visible_.data(),
+      visible_count,
+      static_cast<VkDrawIndexedIndirectCommand*>(frame.commands.mapped),
+      static_cast<uint32_t*>(frame.instance_indices.mapped));
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  last_visible_instances_ = visible_count;
+  last_cpu_cull_ms_ = elapsed.count();
+}
+
+auto gfx::vk_api::GeometryBatcher::record_gpu_culling_(
+    VkCommandBuffer command_buffer, FrameBuffers& frame,
+    const CullingView& view) -> void
+{
+  auto instance_count = static_cast<uint32_t>(instances_.size());
+  auto mesh_count = static_cast<uint32_t>(meshes_.size());
+  bool occlusion = view.depth_pyramid != nullptr &&
+                   occlusion_cull_pipeline_ != VK_NULL_HANDLE;
+
+  auto* cull_data = static_cast<CullData*>(frame.cull_data.mapped);
+  math::Frustum frustum = math::extract_frustum(view.view_projection);
+  memcpy(cull_data->view_projection, view.view_projection.m,
+         sizeof(cull_data->view_projection));
+  memcpy(cull_data->planes, frustum.planes, sizeof(cull_data->planes));
+  cull_data->pyramid_size[0] =
+      occlusion ? static_cast<float>(view.depth_pyramid->width()) : 0.0f;
+  cull_data->pyramid_size[1] =
+      occlusion ? static_cast<float>(view.depth_pyramid->height()) : 0.0f;
+
+  // The slot's previous frame is done, its pyramid set can be rewritten.
+  if (occlusion && frame.bound_pyramid != view.depth_pyramid) {
+    VkDescriptorImageInfo image_info = {view.depth_pyramid->sampler(),
+                                        view.depth_pyramid->view(),
+                                        VK_IMAGE_LAYOUT_GENERAL};
+    VkWriteDescriptorSet write =
+        build<VkWriteDescriptorSet>()
+            .set(&VkWriteDescriptorSet::dstSet, frame.pyramid_set)
+            .set(&VkWriteDescriptorSet::dstBinding, 0)
+            .set(&VkWriteDescriptorSet::descriptorCount, 1)
+            .set(&VkWriteDescriptorSet::descriptorType,
+                 VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+            .set(&VkWriteDescriptorSet::pImageInfo, &image_info);
+    device_.vkUpdateDescriptorSets(device_.logical_device, 1, &write, 0,
+                                   nullptr);
+    frame.bound_pyramid = view.depth_pyramid;
+  }
+
+  BuildDrawsConstants constants = {instance_count, mesh_count};
+  VkDescriptorSet sets[] = {frame.descriptor_set, frame.pyramid_set};
+  device_.vkCmdBindPipeline(
+      command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+      occlusion ? occlusion_cull_pipeline_ : cull_pipeline_);
+  device_.vkCmdBindDescriptorSets(command_buffer,
+                                  VK_PIPELINE_BIND_POINT_COMPUTE,
+                                  pipeline_layout_, 0, occlusion ? 2 : 1, sets,
+                                  0, nullptr);
+  device_.vkCmdPushConstants(command_buffer, pipeline_layout_,
+                             VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                             &constants);
+  device_.vkCmdDispatch(
+      command_buffer,
+      (instance_count + BUILD_DRAWS_GROUP_SIZE - 1) / BUILD_DRAWS_GROUP_SIZE, 1,
+      1);
+
+  if (compact_pipeline_ == VK_NULL_HANDLE) {
+    return;
+  }
+  *static_cast<uint32_t*>(frame.compacted.mapped) = 0;
+  VkMemoryBarrier barrier =
+      build<VkMemoryBarrier>()
+          .set(&VkMemoryBarrier::srcAccessMask, VK_ACCESS_SHADER_WRITE_BIT)
+          .set(&VkMemoryBarrier::dstAccessMask, VK_ACCESS_SHADER_READ_BIT);
+  device_.vkCmdPipelineBarrier(command_buffer,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                               &barrier, 0, nullptr, 0, nullptr);
+  // The layout is shared, the sets and constants stay bound.
+  device_.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            compact_pipeline_);
+  device_.vkCmdDispatch(
+      command_buffer,
+      (mesh_count + BUILD_DRAWS_GROUP_SIZE - 1) / BUILD_DRAWS_GROUP_SIZE, 1, 1);
+  compacted_ = true;
+}
+
+auto gfx::vk_api::GeometryBatcher::update_command_template_() -> void
+{
+  command_template_.resize(meshes_.size());
+  uint32_t first_instance = 0;
+  for (size_t i = 0; i < meshes_.size(); ++i) {
+    command_template_[i] = {meshes_[i].index_count, 0, meshes_[i].first_index,
+                            meshes_[i].vertex_offset, first_instance};
+    first_instance += mesh_instance_counts_[i];
+  }
+  template_dirty_ = false;
+}
+
+auto gfx::vk_api::GeometryBatcher::mark_instances_dirty_(uint32_t begin,
+                                                         uint32_t end) -> void
+{
+  for (auto& frame : frames_) {
+    frame.dirty_instances.add(begin, end);
+  }
+}
+
+auto gfx::vk_api::GeometryBatcher::draw_count_offset_() const -> VkDeviceSize
+{
+  return limits_.mesh_capacity * sizeof(VkDrawIndexedIndirectCommand);
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "dirty_ranges.h"
+#include "math.h"
+#include "scene.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+struct Vertex {
+  float position[3];
+  float normal[3];
+  float uv[2];
+};
+
+// Sub-range of the shared megabuffers holding one mesh.
+struct MeshRange {
+  uint32_t first_index;
+  uint32_t index_count;
+  int32_t vertex_offset;
+};
+
+// Matches the vec4 mesh bounds of the culling shaders.
+using BoundingSphere = math::Sphere;
+
+struct MeshHandle {
+  uint32_t index;
+};
+
+// Matches the Instance structure of the build_draws compute shader.
+struct Instance {
+  // Rows of a 3x4 object to world matrix.
+  float transform[12];
+  uint32_t mesh;
+  uint32_t padding[3];
+};
+static_assert(sizeof(Instance) == 64, "Instance must match the shader layout.");
+
+struct GeometryLimits {
+  uint32_t vertex_capacity = 1 << 20;
+  uint32_t index_capacity = 1 << 22;
+  uint32_t mesh_capacity = 4096;
+  uint32_t instance_capacity = 1 << 17;
+  uint32_t frames_in_flight = 3;
+};
+
+struct GeometryStats {
+  uint32_t meshes;
+  uint32_t instances;
+  uint32_t vertices;
+  uint32_t indices;
+  // Indirect commands issued by the last record_draws(), and the draw calls
+  // recorded to issue them.
+  uint32_t draw_commands;
+  uint32_t draw_calls;
+  // Instances left by the last CPU culling, all of them when culled on the
+  // GPU or not culled.
+  uint32_t visible_instances;
+  double cpu_cull_ms;
+};
+
+// SPIR-V of the compute passes, any of them may be empty.
+struct GeometryShaders {
+  std::vector<uint32_t> build_draws;
+  std::vector<uint32_t> cull_instances;
+  // cull_instances built with OCCLUSION defined.
+  std::vector<uint32_t> cull_instances_occlusion;
+  std::vector<uint32_t> compact_draws;
+};
+
+struct CullingView;
+class DepthPyramid;
+
+// Reference implementation of the build_draws compute pass. Emits one
+// indexed indirect command per mesh, and writes the instances of each mesh
+// contiguously to instance_indices starting at the command's firstInstance.
+// The commands buffer holds mesh_count entries and instance_indices
+// instance_count entries. Returns the number of meshes with instances.
+auto build_draw_commands(const MeshRange* meshes, uint32_t mesh_count,
+                         const Instance* instances, uint32_t instance_count,
+                         VkDrawIndexedIndirectCommand* commands,
+                         uint32_t* instance_indices) -> uint32_t;
+// Same for the visible instances only, given by their indices.
+auto build_visible_draw_commands(const MeshRange* meshes, uint32_t mesh_count,
+                                 const Instance* instances,
+                                 const uint32_t* visible,
+                                 uint32_t visible_count,
+                                 VkDrawIndexedIndirectCommand* commands,
+                                 uint32_t* instance_indices) -> uint32_t;
+
+// ************************************************************ //
+// GeometryBatcher                                              //
+//                                                              //
+// Every mesh lives in a sub-range of a few shared vertex and   //
+// index megabuffers, and every instance in a shared instance   //
+// buffer. A compute pass sorts the instances per mesh and      //
+// builds the indirect commands, so the whole scene is drawn    //
+// with a single indirect draw. Without the compute shader the  //
+// commands are built on the CPU by build_draw_commands().      //
+//                                                              //
+// Given a view, the instances are culled first: on the GPU     //
+// against the frustum and the previous frame's depth pyramid,  //
+// then the non-empty commands are compacted for a draw         //
+// indirect count. Without the culling shader the frustum test  //
+// runs on the CPU with SIMD and the commands are built there.  //
+//                                                              //
+// The meshes and instances are kept on the CPU as well, the    //
+// buffers and pipelines are created and filled again when the  //
+// device is recovered.                                         //
+// ************************************************************ //
+class GeometryBatcher {
+ public:
+  // Missing shaders select the CPU path of their pass. The device must
+  // outlive the batcher. Returns the result of creating the buffers or the
+  // pipelines, batcher is only set on success.
+  static auto create(VulkanDevice& device, const GeometryLimits& limits,
+                     const GeometryShaders& shaders,
+                     std::unique_ptr<GeometryBatcher>& batcher) -> VkResult;
+  ~GeometryBatcher();
+
+  GeometryBatcher(const GeometryBatcher&) = delete;
+  GeometryBatcher& operator=(const GeometryBatcher&) = delete;
+
+  // Copies the mesh into the megabuffers. Meshes live as long as the
+  // batcher. Returns VK_ERROR_OUT_OF_DEVICE_MEMORY when the megabuffers are
+  // full, mesh is only set on success.
+  auto add_mesh(const Vertex* vertices, uint32_t vertex_count,
+                const uint32_t* indices, uint32_t index_count,
+                MeshHandle& mesh) -> VkResult;
+  auto mesh(MeshHandle handle) const -> const MeshRange&;
+
+  // Sets instance to the index of the new instance. Returns
+  // VK_ERROR_OUT_OF_DEVICE_MEMORY when the instance buffer is full.
+  auto add_instance(MeshHandle mesh, const float transform[12],
+                    uint32_t& instance) -> VkResult;
+  auto set_transform(uint32_t instance, const float transform[12]) -> void;
+  auto clear_instances() -> void;
+  // New instances have no mesh and are not drawn until written. Returns
+  // VK_ERROR_OUT_OF_DEVICE_MEMORY, changing nothing, past the capacity.
+  auto resize_instances(uint32_t count) -> VkResult;
+  auto write_instances(uint32_t first, uint32_t count,
+                       const math::Affine* transforms, const uint32_t* meshes)
+      -> void;
+  // Mirrors the scene's renderable instances, uploading only the changes.
+  auto apply_instance_updates(const InstanceUpdates& updates) -> VkResult;
+
+  // Uploads this frame's instances and records the build of the indirect
+  // commands, culled against the view when given. Must be recorded outside
+  // of a render pass, once per frame. With async_compute the command buffer
+  // belongs to the compute queue and the caller synchronizes the draws.
+  auto record_build(VkCommandBuffer command_buffer,
+                    const CullingView* view = nullptr) -> void;
+  // Binds the megabuffers and records the indirect draw of every instance.
+  // Vertices are bound at binding 0, and the per-instance index into the
+  // instance buffer at binding 1.
+  auto record_draws(VkCommandBuffer command_buffer) -> void;
+
+  auto uses_gpu_build() const -> bool;
+  auto uses_gpu_culling() const -> bool;
+  // Instance buffer of the current frame, for the vertex shader.
+  auto instance_buffer() const -> VkBuffer;
+  // Indirect commands and instance indices written by the last
+  // record_build(), once its command buffer completed. Compacted commands
+  // are not included.
+  auto draw_commands() const -> const VkDrawIndexedIndirectCommand*;
+  auto instance_indices() const -> const uint32_t*;
+  auto stats() const -> GeometryStats;
+
+ private:
+  // Buffers rewritten every frame, one set per frame in flight.
+  struct FrameBuffers {
+    Buffer instances;
+    // Indirect commands, followed by the draw count.
+    Buffer commands;
+    Buffer instance_indices;
+    // Culling matrices and planes.
+    Buffer cull_data;
+    // Draw count, followed by the non-empty commands.
+    Buffer compacted;
+    VkDescriptorSet descriptor_set;
+    // Depth pyramid sampled by the occlusion culling.
+    VkDescriptorSet pyramid_set;
+    const DepthPyramid* bound_pyramid;
+    // Instances changed since the set was last uploaded.
+    DirtyRanges dirty_instances;
+  };
+
+  GeometryBatcher(VulkanDevice& device, const GeometryLimits& limits);
+
+  auto create_buffers_() -> VkResult;
+  auto create_pipelines_() -> VkResult;
+  auto release_() -> void;
+  auto restore_() -> VkResult;
+  auto record_cpu_culling_(FrameBuffers& frame, const CullingView& view)
+      -> void;
+  auto record_gpu_culling_(VkCommandBuffer command_buffer,
+                           FrameBuffers& frame, const CullingView& view)
+      -> void;
+  auto update_command_template_() -> void;
+  auto mark_instances_dirty_(uint32_t begin, uint32_t end) -> void;
+  auto draw_count_offset_() const -> VkDeviceSize;
+
+  VulkanDevice& device_;
+  GeometryLimits limits_;
+
+  // Only set when the compute passes are used.
+  GeometryShaders shaders_;
+
+  Buffer vertices_;
+  Buffer indices_;
+  uint32_t vertex_count_;
+  uint32_t index_count_;
+  // Contents of the megabuffers, to fill them again.
+  std::vector<Vertex> vertex_data_;
+  std::vector<uint32_t> index_data_;
+
+  std::vector<MeshRange> meshes_;
+  std::vector<BoundingSphere> mesh_bounds_;
+  Buffer bounds_;
+  std::vector<Instance> instances_;
+  // Instances of each mesh, to lay out the commands.
+  std::vector<uint32_t> mesh_instance_counts_;
+  bool template_dirty_;
+
+  // Commands with their instance ranges laid out and no instances yet,
+  // written over the frame's commands before the compute pass fills them.
+  std::vector<VkDrawIndexedIndirectCommand> command_template_;
+  std::vector<FrameBuffers> frames_;
+  uint32_t frame_;
+
+  // Indices of the instances left by the CPU culling.
+  std::vector<uint32_t> visible_;
+  // Whether the frame's draws read the compacted commands.
+  bool compacted_;
+
+  VkDescriptorSetLayout descriptor_set_layout_;
+  VkDescriptorSetLayout pyramid_set_layout_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline build_pipeline_;
+  VkPipeline cull_pipeline_;
+  VkPipeline occlusion_cull_pipeline_;
+  VkPipeline compact_pipeline_;
+  VkDescriptorPool descriptor_pool_;
+
+  uint32_t last_draw_commands_;
+  uint32_t last_draw_calls_;
+  uint32_t last_visible_instances_;
+  double last_cpu_cull_ms_;
+  uint64_t resource_id_;
+};
+
+}  // namespace gfx::vk_api
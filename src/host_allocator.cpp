@@ -0,0 +1,406 @@
+#include "host_allocator.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string>
+
+namespace {
+
+auto align_up(uintptr_t value, size_t alignment) -> uintptr_t
+{
+  return (value + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+}
+
+// Returns how much the peak was raised by, racing raises add up to the
+// final peak.
+auto update_peak(std::atomic<uint64_t>& peak, uint64_t value) -> uint64_t
+{
+  uint64_t current = peak.load(std::memory_order_relaxed);
+  while (current < value) {
+    if (peak.compare_exchange_weak(current, value)) {
+      return value - current;
+    }
+  }
+  return 0;
+}
+
+// Intrusive doubly linked lists of slabs.
+template <typename T>
+auto push_front(T*& head, T* node) -> void
+{
+  node->previous = nullptr;
+  node->next = head;
+  if (head != nullptr) {
+    head->previous = node;
+  }
+  head = node;
+}
+
+template <typename T>
+auto unlink(T*& head, T* node) -> void
+{
+  if (node->previous != nullptr) {
+    node->previous->next = node->next;
+  }
+  else {
+    head = node->next;
+  }
+  if (node->next != nullptr) {
+    node->next->previous = node->previous;
+  }
+}
+
+constexpr const char* SCOPE_NAMES[] = {"command", "object", "cache", "device",
+                                       "instance"};
+// The total is accounted after the scopes.
+constexpr uint32_t TOTAL = VK_SYSTEM_ALLOCATION_SCOPE_RANGE_SIZE;
+
+}  // namespace
+
+gfx::vk_api::HostAllocator::HostAllocator()
+    : callbacks_(),
+      pooled_bytes_(0),
+      released_slabs_(0),
+      internal_bytes_(0),
+      scopes_(),
+      total_(),
+      published_(false)
+{
+  callbacks_.pUserData = this;
+  callbacks_.pfnAllocation = &HostAllocator::vk_allocation_;
+  callbacks_.pfnReallocation = &HostAllocator::vk_reallocation_;
+  callbacks_.pfnFree = &HostAllocator::vk_free_;
+  callbacks_.pfnInternalAllocation = &HostAllocator::vk_internal_allocation_;
+  callbacks_.pfnInternalFree = &HostAllocator::vk_internal_free_;
+
+  for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+    pools_[i].available = nullptr;
+    pools_[i].full = nullptr;
+    pools_[i].block_size = SMALLEST_SIZE_CLASS << i;
+  }
+}
+
+gfx::vk_api::HostAllocator::~HostAllocator()
+{
+  for (Pool& pool : pools_) {
+    for (Slab* slab : {pool.available, pool.full}) {
+      while (slab != nullptr) {
+        Slab* next = slab->next;
+        ::operator delete(slab, std::align_val_t{SLAB_SIZE});
+        slab = next;
+      }
+    }
+  }
+}
+
+auto gfx::vk_api::HostAllocator::callbacks() const
+    -> const VkAllocationCallbacks*
+{
+  return &callbacks_;
+}
+
+auto gfx::vk_api::HostAllocator::report() const -> HostAllocatorReport
+{
+  auto snapshot = [](const Counters& counters) -> HostAllocationStats {
+    return {counters.bytes.load(), counters.peak_bytes.load(),
+            counters.allocations.load(), counters.live_allocations.load()};
+  };
+
+  HostAllocatorReport report = {};
+  for (size_t i = 0; i < VK_SYSTEM_ALLOCATION_SCOPE_RANGE_SIZE; ++i) {
+    report.scopes[i] = snapshot(scopes_[i]);
+  }
+  report.total = snapshot(total_);
+  report.internal_bytes = internal_bytes_.load();
+  report.pooled_bytes = pooled_bytes_.load();
+  report.released_slabs = released_slabs_.load();
+  return report;
+}
+
+auto gfx::vk_api::HostAllocator::print_report(std::ostream& out) const -> void
+{
+  HostAllocatorReport current = report();
+
+  auto print = [&out](const char* name, const HostAllocationStats& stats) {
+    out << "  " << name << ": " << stats.bytes << " bytes in "
+        << stats.live_allocations << " allocations (peak " << stats.peak_bytes
+        << " bytes, " << stats.allocations << " allocations total)\n";
+  };
+
+  out << "Vulkan host memory:\n";
+  for (size_t i = 0; i < VK_SYSTEM_ALLOCATION_SCOPE_RANGE_SIZE; ++i) {
+    print(SCOPE_NAMES[i], current.scopes[i]);
+  }
+  print("total", current.total);
+  out << "  driver internal: " << current.internal_bytes << " bytes\n"
+      << "  pooled: " << current.pooled_bytes << " bytes ("
+      << current.released_slabs << " slabs released)\n";
+}
+
+auto gfx::vk_api::HostAllocator::publish_metrics() -> void
+{
+  if (published_.load()) {
+    return;
+  }
+  auto publish = [this](const std::string& name, const Counters& counters) {
+    CounterGauges gauges = {
+        register_gauge(("vk.host." + name + ".bytes").c_str(),
+                       MetricUnit::bytes),
+        register_gauge(("vk.host." + name + ".peak_bytes").c_str(),
+                       MetricUnit::bytes)};
+    gauges.bytes.set(static_cast<int64_t>(counters.bytes.load()));
+    gauges.peak_bytes.set(static_cast<int64_t>(counters.peak_bytes.load()));
+    gauges_.push_back(gauges);
+  };
+  for (uint32_t i = 0; i < TOTAL; ++i) {
+    publish(SCOPE_NAMES[i], scopes_[i]);
+  }
+  publish("total", total_);
+  published_.store(true, std::memory_order_release);
+}
+
+auto gfx::vk_api::HostAllocator::allocate_(size_t size, size_t alignment,
+                                           VkSystemAllocationScope scope)
+    -> void*
+{
+  if (size == 0) {
+    return nullptr;
+  }
+  alignment = std::max<size_t>(alignment, 16);
+  size_t needed = block_size_needed_(size, alignment);
+  uint32_t size_class = size_class_(needed);
+
+  std::byte* base;
+  if (size_class == LARGE_SIZE_CLASS) {
+    base = static_cast<std::byte*>(::operator new(needed, std::nothrow));
+  }
+  else {
+    base = pool_block_(size_class);
+  }
+  if (base == nullptr) {
+    return nullptr;
+  }
+
+  uintptr_t aligned =
+      align_up(reinterpret_cast<uintptr_t>(base) + sizeof(Header), alignment);
+  Header* header = reinterpret_cast<Header*>(aligned) - 1;
+  header->base = base;
+  header->size = size;
+  header->size_class = size_class;
+  header->scope = static_cast<uint32_t>(scope);
+
+  account_(header->scope, static_cast<int64_t>(size), 1);
+  return reinterpret_cast<void*>(aligned);
+}
+
+auto gfx::vk_api::HostAllocator::reallocate_(void* original, size_t size,
+                                             size_t alignment,
+                                             VkSystemAllocationScope scope)
+    -> void*
+{
+  if (original == nullptr) {
+    return allocate_(size, alignment, scope);
+  }
+  if (size == 0) {
+    free_(original);
+    return nullptr;
+  }
+
+  Header* header = static_cast<Header*>(original) - 1;
+  alignment = std::max<size_t>(alignment, 16);
+
+  // Grow or shrink in place while the block still fits.
+  uintptr_t address = reinterpret_cast<uintptr_t>(original);
+  bool aligned = (address & (alignment - 1)) == 0;
+  if (aligned && header->size_class != LARGE_SIZE_CLASS &&
+      address - reinterpret_cast<uintptr_t>(header->base) + size <=
+          pools_[header->size_class].block_size) {
+    account_(header->scope,
+             static_cast<int64_t>(size) - static_cast<int64_t>(header->size),
+             0);
+    header->size = size;
+    return original;
+  }
+
+  void* memory = allocate_(size, alignment, scope);
+  if (memory == nullptr) {
+    return nullptr;
+  }
+  std::memcpy(memory, original,
+              std::min<size_t>(size, static_cast<size_t>(header->size)));
+  free_(original);
+  return memory;
+}
+
+auto gfx::vk_api::HostAllocator::free_(void* memory) -> void
+{
+  if (memory == nullptr) {
+    return;
+  }
+  Header* header = static_cast<Header*>(memory) - 1;
+  account_(header->scope, -static_cast<int64_t>(header->size), -1);
+
+  std::byte* base = header->base;
+  if (header->size_class == LARGE_SIZE_CLASS) {
+    ::operator delete(base);
+    return;
+  }
+
+  free_pool_block_(header->size_class, base);
+}
+
+auto gfx::vk_api::HostAllocator::block_size_needed_(size_t size,
+                                                    size_t alignment)
+    -> size_t
+{
+  // Blocks are 16 byte aligned. The header takes 32 bytes once rounded up,
+  // larger alignments may need up to (alignment - 16) bytes of padding.
+  return align_up(sizeof(Header), 16) + size + (alignment - 16);
+}
+
+auto gfx::vk_api::HostAllocator::size_class_(size_t block_size) -> uint32_t
+{
+  for (uint32_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+    if (block_size <= (SMALLEST_SIZE_CLASS << i)) {
+      return i;
+    }
+  }
+  return LARGE_SIZE_CLASS;
+}
+
+auto gfx::vk_api::HostAllocator::pool_block_(uint32_t size_class) -> std::byte*
+{
+  Pool& pool = pools_[size_class];
+  std::lock_guard<std::mutex> lock(pool.mutex);
+
+  Slab* slab = pool.available;
+  if (slab == nullptr) {
+    slab = static_cast<Slab*>(::operator new(
+        SLAB_SIZE, std::align_val_t{SLAB_SIZE}, std::nothrow));
+    if (slab == nullptr) {
+      return nullptr;
+    }
+    slab->free_list = nullptr;
+    slab->carved = static_cast<uint32_t>(align_up(sizeof(Slab), 16));
+    slab->live = 0;
+    push_front(pool.available, slab);
+    pooled_bytes_ += SLAB_SIZE;
+  }
+
+  std::byte* block;
+  if (slab->free_list != nullptr) {
+    block = reinterpret_cast<std::byte*>(slab->free_list);
+    slab->free_list = slab->free_list->next;
+  }
+  else {
+    block = reinterpret_cast<std::byte*>(slab) + slab->carved;
+    slab->carved += static_cast<uint32_t>(pool.block_size);
+  }
+  ++slab->live;
+  if (!has_room_(pool, *slab)) {
+    unlink(pool.available, slab);
+    push_front(pool.full, slab);
+  }
+  return block;
+}
+
+auto gfx::vk_api::HostAllocator::free_pool_block_(uint32_t size_class,
+                                                  std::byte* block) -> void
+{
+  Pool& pool = pools_[size_class];
+  auto* slab = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(block) &
+                                       ~static_cast<uintptr_t>(SLAB_SIZE - 1));
+  std::lock_guard<std::mutex> lock(pool.mutex);
+
+  if (!has_room_(pool, *slab)) {
+    unlink(pool.full, slab);
+    push_front(pool.available, slab);
+  }
+  auto* free_block = reinterpret_cast<FreeBlock*>(block);
+  free_block->next = slab->free_list;
+  slab->free_list = free_block;
+  --slab->live;
+
+  // The last slab with room stays, a block freed and allocated again in a
+  // loop would otherwise take a slab from the system every time.
+  if (slab->live == 0 && (slab != pool.available || slab->next != nullptr)) {
+    unlink(pool.available, slab);
+    ::operator delete(slab, std::align_val_t{SLAB_SIZE});
+    pooled_bytes_ -= SLAB_SIZE;
+    ++released_slabs_;
+  }
+}
+
+auto gfx::vk_api::HostAllocator::has_room_(const Pool& pool, const Slab& slab)
+    -> bool
+{
+  return slab.free_list != nullptr ||
+         slab.carved + pool.block_size <= SLAB_SIZE;
+}
+
+auto gfx::vk_api::HostAllocator::account_(uint32_t scope, int64_t bytes,
+                                          int64_t live) -> void
+{
+  bool published = published_.load(std::memory_order_acquire);
+  for (uint32_t i : {scope, TOTAL}) {
+    Counters& counters = i < TOTAL ? scopes_[i] : total_;
+    uint64_t current = counters.bytes.fetch_add(bytes) + bytes;
+    counters.live_allocations.fetch_add(live);
+    if (live > 0) {
+      counters.allocations.fetch_add(live);
+    }
+    uint64_t raised = update_peak(counters.peak_bytes, current);
+    if (published) {
+      // Deltas rather than values, racing updates cannot leave a stale one.
+      gauges_[i].bytes.add(bytes);
+      gauges_[i].peak_bytes.add(static_cast<int64_t>(raised));
+    }
+  }
+}
+
+VKAPI_ATTR auto VKAPI_CALL gfx::vk_api::HostAllocator::vk_allocation_(
+    void* user_data, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) -> void*
+{
+  return static_cast<HostAllocator*>(user_data)->allocate_(size, alignment,
+                                                           scope);
+}
+
+VKAPI_ATTR auto VKAPI_CALL gfx::vk_api::HostAllocator::vk_reallocation_(
+    void* user_data, void* original, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) -> void*
+{
+  return static_cast<HostAllocator*>(user_data)->reallocate_(
+      original, size, alignment, scope);
+}
+
+VKAPI_ATTR auto VKAPI_CALL gfx::vk_api::HostAllocator::vk_free_(void* user_data,
+                                                    void* memory) -> void
+{
+  static_cast<HostAllocator*>(user_data)->free_(memory);
+}
+
+VKAPI_ATTR auto VKAPI_CALL gfx::vk_api::HostAllocator::vk_internal_allocation_(
+    void* user_data, size_t size, VkInternalAllocationType,
+    VkSystemAllocationScope) -> void
+{
+  static_cast<HostAllocator*>(user_data)->internal_bytes_ += size;
+}
+
+VKAPI_ATTR auto VKAPI_CALL gfx::vk_api::HostAllocator::vk_internal_free_(
+    void* user_data, size_t size, VkInternalAllocationType,
+    VkSystemAllocationScope) -> void
+{
+  static_cast<HostAllocator*>(user_data)->internal_bytes_ -= size;
+}
+
+auto gfx::vk_api::host_allocator() -> HostAllocator&
+{
+  static HostAllocator allocator;
+  return allocator;
+}
+
+auto gfx::vk_api::allocation_callbacks() -> const VkAllocationCallbacks*
+{
+  return host_allocator().callbacks();
+}
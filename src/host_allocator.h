@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "metrics.h"
+#include "vulkan_ext.h"
+
+namespace gfx::vk_api {
+
+struct HostAllocationStats {
+  uint64_t bytes;
+  uint64_t peak_bytes;
+  uint64_t allocations;
+  uint64_t live_allocations;
+};
+
+struct HostAllocatorReport {
+  // Indexed by VkSystemAllocationScope.
+  HostAllocationStats scopes[VK_SYSTEM_ALLOCATION_SCOPE_RANGE_SIZE];
+  HostAllocationStats total;
+  // Memory the driver allocated by itself and reported to us.
+  uint64_t internal_bytes;
+  // Memory reserved by the size class pools, used or not.
+  uint64_t pooled_bytes;
+  // Slabs handed back to the system once all their blocks were free.
+  uint64_t released_slabs;
+};
+
+// ************************************************************ //
+// HostAllocator                                                //
+//                                                              //
+// Host memory allocator handed to the driver through           //
+// VkAllocationCallbacks. Small allocations are served from     //
+// size class pools carved out of large slabs, bigger ones go   //
+// to the system allocator. A slab whose blocks are all free    //
+// again is released, unless it is the last one of its pool     //
+// with room. Every allocation is accounted per allocation      //
+// scope with peak tracking. Once published, bytes and peaks    //
+// are also gauges of the metrics registry.                     //
+// ************************************************************ //
+class HostAllocator {
+ public:
+  HostAllocator();
+  ~HostAllocator();
+
+  HostAllocator(const HostAllocator&) = delete;
+  HostAllocator& operator=(const HostAllocator&) = delete;
+
+  auto callbacks() const -> const VkAllocationCallbacks*;
+  auto report() const -> HostAllocatorReport;
+  auto print_report(std::ostream& out) const -> void;
+  // Registers the vk.host.<scope>.bytes and .peak_bytes gauges, and the
+  // total ones, updated by every allocation from then on. Call once, after
+  // enable_metrics() and while no other thread allocates.
+  auto publish_metrics() -> void;
+
+ private:
+  // 64 to 4096 bytes. A block holds the 32 byte header as well, smaller
+  // classes could never be chosen.
+  static constexpr size_t SIZE_CLASS_COUNT = 7;
+  static constexpr size_t SMALLEST_SIZE_CLASS = 64;
+  static constexpr size_t SLAB_SIZE = 64 * 1024;
+  static constexpr uint32_t LARGE_SIZE_CLASS = UINT32_MAX;
+
+  // Stored right before every pointer handed to the driver.
+  struct Header {
+    std::byte* base;
+    uint64_t size;
+    uint32_t size_class;
+    uint32_t scope;
+  };
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // At the start of every slab. Slabs are aligned to their size, a block
+  // finds its slab by masking its address.
+  struct Slab {
+    Slab* previous;
+    Slab* next;
+    FreeBlock* free_list;
+    uint32_t carved;
+    uint32_t live;
+  };
+
+  // Slabs with a free or never carved block are available, the others
+  // full. A slab is in one of the two lists.
+  struct Pool {
+    std::mutex mutex;
+    Slab* available;
+    Slab* full;
+    size_t block_size;
+  };
+
+  struct Counters {
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> peak_bytes;
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> live_allocations;
+  };
+
+  struct CounterGauges {
+    Gauge bytes;
+    Gauge peak_bytes;
+  };
+
+  auto allocate_(size_t size, size_t alignment,
+                 VkSystemAllocationScope scope) -> void*;
+  auto reallocate_(void* original, size_t size, size_t alignment,
+                   VkSystemAllocationScope scope) -> void*;
+  auto free_(void* memory) -> void;
+
+  static auto block_size_needed_(size_t size, size_t alignment) -> size_t;
+  static auto size_class_(size_t block_size) -> uint32_t;
+  auto pool_block_(uint32_t size_class) -> std::byte*;
+  auto free_pool_block_(uint32_t size_class, std::byte* block) -> void;
+  static auto has_room_(const Pool& pool, const Slab& slab) -> bool;
+  auto account_(uint32_t scope, int64_t bytes, int64_t live) -> void;
+
+  // Entry points called by the driver.
+  static VKAPI_ATTR auto VKAPI_CALL vk_allocation_(
+      void* user_data, size_t size, size_t alignment,
+      VkSystemAllocationScope scope) -> void*;
+  static VKAPI_ATTR auto VKAPI_CALL vk_reallocation_(
+      void* user_data, void* original, size_t size, size_t alignment,
+      VkSystemAllocationScope scope) -> void*;
+  static VKAPI_ATTR auto VKAPI_CALL vk_free_(void* user_data, void* memory)
+      -> void;
+  static VKAPI_ATTR auto VKAPI_CALL vk_internal_allocation_(
+      void* user_data, size_t size, VkInternalAllocationType type,
+      VkSystemAllocationScope scope) -> void;
+  static VKAPI_ATTR auto VKAPI_CALL vk_internal_free_(
+      void* user_data, size_t size, VkInternalAllocationType type,
+      VkSystemAllocationScope scope) -> void;
+
+  VkAllocationCallbacks callbacks_;
+  Pool pools_[SIZE_CLASS_COUNT];
+  std::atomic<uint64_t> pooled_bytes_;
+  std::atomic<uint64_t> released_slabs_;
+  std::atomic<uint64_t> internal_bytes_;
+  Counters scopes_[VK_SYSTEM_ALLOCATION_SCOPE_RANGE_SIZE];
+  Counters total_;
+  // Per scope, then the total. Only read once published_ is set.
+  std::vector<CounterGauges> gauges_;
+  std::atomic<bool> published_;
+};
+
+// Process wide allocator used by every Vulkan create and destroy call.
+auto host_allocator() -> HostAllocator&;
+auto allocation_callbacks() -> const VkAllocationCallbacks*;
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,258 @@
+#include "ktx2.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(GFX_HAS_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(GFX_HAS_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace {
+
+constexpr uint8_t KTX2_IDENTIFIER[12] = {0xab, 'K',  'T',  'X',  ' ',  '2',
+                                         '0',  0xbb, '\r', '\n', 0x1a, '\n'};
+
+// Fixed part of the file, followed by the level index.
+struct Ktx2Header {
+  uint8_t identifier[12];
+  uint32_t vk_format;
+  uint32_t type_size;
+  uint32_t pixel_width;
+  uint32_t pixel_height;
+  uint32_t pixel_depth;
+  uint32_t layer_count;
+  uint32_t face_count;
+  uint32_t level_count;
+  uint32_t supercompression_scheme;
+  uint32_t dfd_byte_offset;
+  uint32_t dfd_byte_length;
+  uint32_t kvd_byte_offset;
+  uint32_t kvd_byte_length;
+  uint64_t sgd_byte_offset;
+  uint64_t sgd_byte_length;
+};
+static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header must match the file.");
+
+// Texel block of a format: its dimensions and its size in bytes.
+struct FormatBlock {
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t size;
+};
+
+// Formats a texture can be streamed in.
+constexpr FormatBlock FORMAT_BLOCKS[] = {
+    {VK_FORMAT_R8_UNORM, 1, 1, 1},
+    {VK_FORMAT_R8_SRGB, 1, 1, 1},
+    {VK_FORMAT_R8G8_UNORM, 1, 1, 2},
+    {VK_FORMAT_R8G8_SRGB, 1, 1, 2},
+    {VK_FORMAT_R8G8B8A8_UNORM, 1, 1, 4},
+    {VK_FORMAT_R8G8B8A8_SRGB, 1, 1, 4},
+    {VK_FORMAT_B8G8R8A8_UNORM, 1, 1, 4},
+    {VK_FORMAT_B8G8R8A8_SRGB, 1, 1, 4},
+    {VK_FORMAT_A2B10G10R10_UNORM_PACK32, 1, 1, 4},
+    {VK_FORMAT_B10G11R11_UFLOAT_PACK32, 1, 1, 4},
+    {VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, 1, 1, 4},
+    {VK_FORMAT_R16_SFLOAT, 1, 1, 2},
+    {VK_FORMAT_R16G16_SFLOAT, 1, 1, 4},
+    {VK_FORMAT_R16G16B16A16_SFLOAT, 1, 1, 8},
+    {VK_FORMAT_R32_SFLOAT, 1, 1, 4},
+    {VK_FORMAT_R32G32_SFLOAT, 1, 1, 8},
+    {VK_FORMAT_R32G32B32A32_SFLOAT, 1, 1, 16},
+    {VK_FORMAT_BC1_RGB_UNORM_BLOCK, 4, 4, 8},
+    {VK_FORMAT_BC1_RGB_SRGB_BLOCK, 4, 4, 8},
+    {VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 4, 4, 8},
+    {VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 4, 4, 8},
+    {VK_FORMAT_BC2_UNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC2_SRGB_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC3_UNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC3_SRGB_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC4_UNORM_BLOCK, 4, 4, 8},
+    {VK_FORMAT_BC4_SNORM_BLOCK, 4, 4, 8},
+    {VK_FORMAT_BC5_UNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC5_SNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC6H_UFLOAT_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC6H_SFLOAT_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC7_UNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_BC7_SRGB_BLOCK, 4, 4, 16},
+    {VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, 4, 4, 8},
+    {VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, 4, 4, 8},
+    {VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK, 4, 4, 8},
+    {VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK, 4, 4, 8},
+    {VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK, 4, 4, 16},
+    {VK_FORMAT_EAC_R11_UNORM_BLOCK, 4, 4, 8},
+    {VK_FORMAT_EAC_R11G11_UNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_ASTC_4x4_UNORM_BLOCK, 4, 4, 16},
+    {VK_FORMAT_ASTC_4x4_SRGB_BLOCK, 4, 4, 16},
+    {VK_FORMAT_ASTC_6x6_UNORM_BLOCK, 6, 6, 16},
+    {VK_FORMAT_ASTC_6x6_SRGB_BLOCK, 6, 6, 16},
+    {VK_FORMAT_ASTC_8x8_UNORM_BLOCK, 8, 8, 16},
+    {VK_FORMAT_ASTC_8x8_SRGB_BLOCK, 8, 8, 16},
+};
+
+// Null for the formats missing from the table.
+auto find_format_block(VkFormat format) -> const FormatBlock*
+{
+  for (const FormatBlock& block : FORMAT_BLOCKS) {
+    if (block.format == format) {
+      return &block;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+gfx::Ktx2File::Ktx2File()
+    : format_(VK_FORMAT_UNDEFINED),
+      width_(0),
+      height_(0),
+      block_width_(1),
+      block_height_(1),
+      block_size_(0),
+      supercompression_(Ktx2Supercompression::none)
+{
+}
+
+auto gfx::Ktx2File::open(const char* path) -> bool
+{
+  if (!file_.open(path) || file_.size() < sizeof(Ktx2Header)) {
+    return false;
+  }
+  Ktx2Header header;
+  memcpy(&header, file_.data(), sizeof(header));
+  if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) !=
+      0) {
+    return false;
+  }
+  // Basis textures have no Vulkan format until transcoded.
+  format_ = static_cast<VkFormat>(header.vk_format);
+  supercompression_ =
+      static_cast<Ktx2Supercompression>(header.supercompression_scheme);
+  const FormatBlock* block = find_format_block(format_);
+  if (block == nullptr || header.pixel_width == 0 ||
+      header.pixel_height == 0 || header.pixel_depth > 1 ||
+      header.layer_count > 1 || header.face_count != 1 ||
+      !supports(supercompression_)) {
+    return false;
+  }
+  width_ = header.pixel_width;
+  height_ = header.pixel_height;
+  block_width_ = block->width;
+  block_height_ = block->height;
+  block_size_ = block->size;
+
+  // 0 asks the loader to generate the mips, only the base level is stored.
+  uint32_t level_count = std::max(header.level_count, 1u);
+  uint32_t full_chain = 1;
+  while ((std::max(width_, height_) >> full_chain) > 0) {
+    ++full_chain;
+  }
+  size_t index_end = sizeof(header) + level_count * sizeof(Ktx2Level);
+  if (level_count > full_chain || file_.size() < index_end) {
+    return false;
+  }
+  levels_.resize(level_count);
+  memcpy(levels_.data(), file_.data() + sizeof(header),
+         level_count * sizeof(Ktx2Level));
+  // The copies to the image read whole blocks of the level, its size must
+  // be what its extent takes in the format.
+  for (uint32_t i = 0; i < level_count; ++i) {
+    const Ktx2Level& level = levels_[i];
+    VkExtent3D extent = level_extent(i);
+    uint64_t blocks =
+        uint64_t{(extent.width + block_width_ - 1) / block_width_} *
+        ((extent.height + block_height_ - 1) / block_height_);
+    if (level.offset > file_.size() ||
+        level.size > file_.size() - level.offset ||
+        level.uncompressed_size != blocks * block_size_ ||
+        (supercompression_ == Ktx2Supercompression::none &&
+         level.size != level.uncompressed_size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+auto gfx::Ktx2File::format() const -> VkFormat { return format_; }
+
+auto gfx::Ktx2File::width() const -> uint32_t { return width_; }
+
+auto gfx::Ktx2File::height() const -> uint32_t { return height_; }
+
+auto gfx::Ktx2File::level_count() const -> uint32_t
+{
+  return static_cast<uint32_t>(levels_.size());
+}
+
+auto gfx::Ktx2File::supercompression() const -> Ktx2Supercompression
+{
+  return supercompression_;
+}
+
+auto gfx::Ktx2File::level(uint32_t level) const -> const Ktx2Level&
+{
+  return levels_[level];
+}
+
+auto gfx::Ktx2File::level_extent(uint32_t level) const -> VkExtent3D
+{
+  return {std::max(width_ >> level, 1u), std::max(height_ >> level, 1u), 1};
+}
+
+auto gfx::Ktx2File::block_width() const -> uint32_t { return block_width_; }
+
+auto gfx::Ktx2File::block_height() const -> uint32_t { return block_height_; }
+
+auto gfx::Ktx2File::block_size() const -> uint32_t { return block_size_; }
+
+auto gfx::Ktx2File::read_level(uint32_t level, std::byte* out) const -> bool
+{
+  const Ktx2Level& range = levels_[level];
+  const std::byte* source = file_.data() + range.offset;
+  switch (supercompression_) {
+    case Ktx2Supercompression::none:
+      memcpy(out, source, range.size);
+      return true;
+#if defined(GFX_HAS_ZSTD)
+    case Ktx2Supercompression::zstd: {
+      size_t written = ZSTD_decompress(out, range.uncompressed_size, source,
+                                       range.size);
+      return !ZSTD_isError(written) && written == range.uncompressed_size;
+    }
+#endif
+#if defined(GFX_HAS_ZLIB)
+    case Ktx2Supercompression::zlib: {
+      uLongf written = static_cast<uLongf>(range.uncompressed_size);
+      return uncompress(reinterpret_cast<Bytef*>(out), &written,
+                        reinterpret_cast<const Bytef*>(source),
+                        static_cast<uLong>(range.size)) == Z_OK &&
+             written == range.uncompressed_size;
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+auto gfx::Ktx2File::supports(Ktx2Supercompression scheme) -> bool
+{
+  switch (scheme) {
+    case Ktx2Supercompression::none:
+      return true;
+#if defined(GFX_HAS_ZSTD)
+    case Ktx2Supercompression::zstd:
+      return true;
+#endif
+#if defined(GFX_HAS_ZLIB)
+    case Ktx2Supercompression::zlib:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "mapped_file.h"
+#include "vulkan_ext.h"
+
+namespace gfx {
+
+enum class Ktx2Supercompression : uint32_t {
+  none = 0,
+  basis_lz = 1,
+  zstd = 2,
+  zlib = 3
+};
+
+struct Ktx2Level {
+  // Position and size in the file, compressed when supercompressed.
+  uint64_t offset;
+  uint64_t size;
+  uint64_t uncompressed_size;
+};
+
+// ************************************************************ //
+// Ktx2File                                                     //
+//                                                              //
+// KTX2 container mapped in memory. Only the header and the     //
+// level index are read on open, level data is read and         //
+// decompressed on demand, from any thread. Supports single     //
+// layer, single face 2D textures of a Vulkan format, stored    //
+// plain or supercompressed with the libraries the build found. //
+// Level 0 is the largest.                                      //
+// ************************************************************ //
+class Ktx2File {
+ public:
+  Ktx2File();
+
+  // Returns false if the file cannot be mapped or is not a supported KTX2,
+  // including formats without a known texel block and levels whose size
+  // does not match their extent.
+  auto open(const char* path) -> bool;
+
+  auto format() const -> VkFormat;
+  auto width() const -> uint32_t;
+  auto height() const -> uint32_t;
+  auto level_count() const -> uint32_t;
+  auto supercompression() const -> Ktx2Supercompression;
+  auto level(uint32_t level) const -> const Ktx2Level&;
+  auto level_extent(uint32_t level) const -> VkExtent3D;
+  // Texel block of the format, 1x1 for uncompressed formats, and its size
+  // in bytes.
+  auto block_width() const -> uint32_t;
+  auto block_height() const -> uint32_t;
+  auto block_size() const -> uint32_t;
+
+  // Writes the uncompressed level to out, which holds uncompressed_size
+  // bytes. Returns false if the data is corrupt.
+  auto read_level(uint32_t level, std::byte* out) const -> bool;
+
+  // Whether this build can decompress the scheme.
+  static auto supports(Ktx2Supercompression scheme) -> bool;
+
+ private:
+  os::MappedFile file_;
+  VkFormat format_;
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t block_width_;
+  uint32_t block_height_;
+  uint32_t block_size_;
+  Ktx2Supercompression supercompression_;
+  std::vector<Ktx2Level> levels_;
+};
+
+}  // namespace gfx
@@ -0,0 +1,329 @@
+#include "log.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Messages a thread can log before the log thread catches up.
+constexpr uint64_t RING_SIZE = 512;
+constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(10);
+// Longest an error waits for the messages other threads are writing.
+constexpr auto DRAIN_TIMEOUT = std::chrono::milliseconds(1);
+constexpr const char* LEVEL_NAMES[] = {"trace", "debug", "info", "warning",
+                                       "error"};
+
+// Written by its thread, read by the log thread.
+struct Ring {
+  gfx::LogMessage messages[RING_SIZE];
+  alignas(64) std::atomic<uint64_t> head{0};
+  alignas(64) std::atomic<uint64_t> tail{0};
+  // Time of the message being written, 0 when none is. Set to 1 before the
+  // time is taken, so a flush never misses a message older than itself.
+  std::atomic<uint64_t> pending_ns{0};
+  std::atomic<uint64_t> dropped{0};
+  // Its thread exited, another thread may take it over once empty.
+  std::atomic<bool> retired{false};
+};
+
+struct Line {
+  uint64_t time_ns;
+  gfx::LogLevel level;
+  std::string text;
+};
+
+// Trivially destructible, so threads logging during static destruction see
+// it after the logger is gone.
+std::atomic<bool> SHUT_DOWN(false);
+
+class Logger {
+ public:
+  Logger() : start_ns_(now_ns()), stopping_(false)
+  {
+    thread_ = std::thread([this] { run_(); });
+  }
+
+  ~Logger()
+  {
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex_);
+      stopping_ = true;
+    }
+    stop_.notify_one();
+    thread_.join();
+    SHUT_DOWN = true;
+    flush(UINT64_MAX);
+  }
+
+  static auto now_ns() -> uint64_t
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Reuses the ring of an exited thread when one is empty.
+  auto acquire_ring() -> Ring*
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    for (const std::unique_ptr<Ring>& ring : rings_) {
+      if (ring->retired &&
+          ring->head.load(std::memory_order_relaxed) ==
+              ring->tail.load(std::memory_order_acquire)) {
+        ring->retired = false;
+        return ring.get();
+      }
+    }
+    rings_.push_back(std::make_unique<Ring>());
+    return rings_.back().get();
+  }
+
+  // Formats the published messages in time order. A message being written
+  // may be older than the ones published, lines from its time on wait for
+  // the next flush so that they come out sorted. Lines before written_until
+  // are written regardless.
+  auto flush(uint64_t written_until = 0) -> void
+  {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    uint64_t cutoff = now_ns();
+    flushed_rings_.clear();
+    {
+      std::lock_guard<std::mutex> rings_lock(rings_mutex_);
+      for (const std::unique_ptr<Ring>& ring : rings_) {
+        flushed_rings_.push_back(ring.get());
+        uint64_t pending = ring->pending_ns.load();
+        if (pending != 0) {
+          cutoff = std::min(cutoff, pending);
+        }
+      }
+    }
+    cutoff = std::max(cutoff, written_until);
+    uint64_t dropped = 0;
+    for (Ring* ring : flushed_rings_) {
+      uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      for (; tail != head; ++tail) {
+        const gfx::LogMessage& message = ring->messages[tail % RING_SIZE];
+        lines_.push_back({message.time_ns, message.level, format_(message)});
+      }
+      ring->tail.store(tail, std::memory_order_release);
+      dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    if (dropped > 0) {
+      lines_.push_back({now_ns(), gfx::LogLevel::warning,
+                        std::to_string(dropped) +
+                            " log messages dropped, their ring was full."});
+    }
+    std::stable_sort(
+        lines_.begin(), lines_.end(),
+        [](const Line& a, const Line& b) { return a.time_ns < b.time_ns; });
+    auto end = std::partition_point(
+        lines_.begin(), lines_.end(),
+        [cutoff](const Line& line) { return line.time_ns < cutoff; });
+    FILE* previous = nullptr;
+    for (auto line = lines_.begin(); line != end; ++line) {
+      FILE* stream = line->level >= gfx::LogLevel::warning ? stderr : stdout;
+      // stdout is buffered when redirected, stderr is not: switching streams
+      // writes out the previous one, so both interleave in time order.
+      if (previous != nullptr && previous != stream) {
+        fflush(previous);
+      }
+      previous = stream;
+      uint64_t since_start =
+          line->time_ns - std::min(line->time_ns, start_ns_);
+      double seconds = static_cast<double>(since_start) / 1e9;
+      fprintf(stream, "[%10.6f] %-7s %s\n", seconds,
+              LEVEL_NAMES[static_cast<uint32_t>(line->level)],
+              line->text.c_str());
+    }
+    if (end != lines_.begin()) {
+      fflush(stdout);
+      fflush(stderr);
+    }
+    lines_.erase(lines_.begin(), end);
+  }
+
+  // Writes everything up to an error logged at time_ns. The messages other
+  // threads began before it are waited for, briefly, so the error is not
+  // written ahead of them.
+  auto drain(uint64_t time_ns) -> void
+  {
+    auto deadline = Clock::now() + DRAIN_TIMEOUT;
+    while (Clock::now() < deadline && writing_before_(time_ns)) {
+      std::this_thread::yield();
+    }
+    flush(time_ns + 1);
+  }
+
+ private:
+  auto run_() -> void
+  {
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    while (!stopping_) {
+      stop_.wait_for(lock, FLUSH_INTERVAL);
+      lock.unlock();
+      flush();
+      lock.lock();
+    }
+  }
+
+  auto writing_before_(uint64_t time_ns) -> bool
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    for (const std::unique_ptr<Ring>& ring : rings_) {
+      uint64_t pending = ring->pending_ns.load();
+      if (pending != 0 && pending <= time_ns) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static auto format_(const gfx::LogMessage& message) -> std::string
+  {
+    std::string text;
+    uint32_t next = 0;
+    char value[32];
+    for (const char* c = message.format; *c != '\0'; ++c) {
+      if (c[0] != '{' || c[1] != '}' || next >= message.argument_count) {
+        text += *c;
+        continue;
+      }
+      ++c;
+      const gfx::LogArgument& argument = message.arguments[next++];
+      switch (argument.type) {
+        case gfx::LogArgumentType::signed_integer:
+          snprintf(value, sizeof(value), "%lld",
+                   static_cast<long long>(argument.signed_integer));
+          text += value;
+          break;
+        case gfx::LogArgumentType::unsigned_integer:
+          snprintf(value, sizeof(value), "%llu",
+                   static_cast<unsigned long long>(argument.unsigned_integer));
+          text += value;
+          break;
+        case gfx::LogArgumentType::floating:
+          snprintf(value, sizeof(value), "%g", argument.floating);
+          text += value;
+          break;
+        case gfx::LogArgumentType::boolean:
+          text += argument.unsigned_integer != 0 ? "true" : "false";
+          break;
+        case gfx::LogArgumentType::character:
+          text += static_cast<char>(argument.unsigned_integer);
+          break;
+        case gfx::LogArgumentType::pointer:
+          snprintf(value, sizeof(value), "%p", argument.pointer);
+          text += value;
+          break;
+        case gfx::LogArgumentType::text:
+          text.append(message.text + argument.text.offset, argument.text.size);
+          break;
+      }
+    }
+    return text;
+  }
+
+  uint64_t start_ns_;
+  std::mutex rings_mutex_;
+  // Never freed before the logger, their threads keep pointers to them.
+  std::vector<std::unique_ptr<Ring>> rings_;
+  std::mutex flush_mutex_;
+  // The rings a flush goes through, kept so the periodic flushes of an idle
+  // logger allocate nothing.
+  std::vector<Ring*> flushed_rings_;
+  // Formatted lines not written yet, held back by a message being written.
+  std::vector<Line> lines_;
+  std::mutex stop_mutex_;
+  std::condition_variable stop_;
+  bool stopping_;
+  std::thread thread_;
+};
+
+auto logger() -> Logger&
+{
+  static Logger logger;
+  return logger;
+}
+
+// Retires the ring of the thread when it exits.
+class ThreadRing {
+ public:
+  ThreadRing() : ring_(logger().acquire_ring()), head_(ring_->head) {}
+  ~ThreadRing() { ring_->retired = true; }
+
+  ThreadRing(const ThreadRing&) = delete;
+  ThreadRing& operator=(const ThreadRing&) = delete;
+
+  auto ring() -> Ring& { return *ring_; }
+  // Of the message begun last, only this thread moves the head.
+  auto head() -> uint64_t& { return head_; }
+
+ private:
+  Ring* ring_;
+  uint64_t head_;
+};
+
+auto thread_ring() -> ThreadRing&
+{
+  thread_local ThreadRing ring;
+  return ring;
+}
+
+}  // namespace
+
+auto gfx::begin_log_message(LogLevel level, const char* format)
+    -> LogMessage*
+{
+  if (SHUT_DOWN.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  ThreadRing& thread = thread_ring();
+  Ring& ring = thread.ring();
+  uint64_t head = thread.head();
+  if (head - ring.tail.load(std::memory_order_acquire) == RING_SIZE) {
+    if (level < LogLevel::error) {
+      ring.dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    // Errors are not dropped, the ring is emptied here instead.
+    logger().flush();
+  }
+  LogMessage& message = ring.messages[head % RING_SIZE];
+  ring.pending_ns.store(1);
+  message.time_ns = Logger::now_ns();
+  ring.pending_ns.store(message.time_ns);
+  message.format = format;
+  message.level = level;
+  message.argument_count = 0;
+  message.text_size = 0;
+  return &message;
+}
+
+auto gfx::end_log_message(LogLevel level) -> void
+{
+  ThreadRing& thread = thread_ring();
+  Ring& ring = thread.ring();
+  uint64_t time_ns = ring.messages[thread.head() % RING_SIZE].time_ns;
+  ring.head.store(++thread.head(), std::memory_order_release);
+  ring.pending_ns.store(0);
+  if (level == LogLevel::error) {
+    logger().drain(time_ns);
+  }
+}
+
+auto gfx::flush_log() -> void
+{
+  if (!SHUT_DOWN.load(std::memory_order_relaxed)) {
+    logger().flush(Logger::now_ns());
+  }
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+// Messages under this level are compiled out, along with the evaluation of
+// their arguments: 0 trace, 1 debug, 2 info, 3 warning. Errors are always
+// kept, they come before terminating.
+#if !defined(GFX_LOG_LEVEL)
+#if defined(NDEBUG)
+#define GFX_LOG_LEVEL 2
+#else
+#define GFX_LOG_LEVEL 1
+#endif
+#endif
+
+namespace gfx {
+
+enum class LogLevel : uint8_t { trace, debug, info, warning, error };
+
+constexpr uint32_t LOG_MAX_ARGUMENTS = 8;
+// Bytes of the string arguments of a message, the rest is cut.
+constexpr uint32_t LOG_TEXT_SIZE = 128;
+
+enum class LogArgumentType : uint8_t {
+  signed_integer,
+  unsigned_integer,
+  floating,
+  boolean,
+  character,
+  pointer,
+  text
+};
+
+struct LogArgument {
+  LogArgumentType type;
+  union {
+    int64_t signed_integer;
+    uint64_t unsigned_integer;
+    double floating;
+    const void* pointer;
+    // In the text of the message.
+    struct {
+      uint16_t offset;
+      uint16_t size;
+    } text;
+  };
+};
+
+// A message as the logging thread leaves it, formatted later by the log
+// thread. The format is not copied, it must be a string literal.
+struct LogMessage {
+  uint64_t time_ns;
+  const char* format;
+  LogLevel level;
+  uint8_t argument_count;
+  uint16_t text_size;
+  LogArgument arguments[LOG_MAX_ARGUMENTS];
+  char text[LOG_TEXT_SIZE];
+};
+
+// ************************************************************ //
+// Log                                                          //
+//                                                              //
+// Asynchronous logger. Every thread writes its messages to a   //
+// ring of its own without locking: the time, the format and    //
+// the arguments, strings copied. A background thread formats  //
+// them every few milliseconds in time order, to stdout, and    //
+// warnings and errors to stderr. A full ring drops messages    //
+// and counts them rather than waiting. Errors flush before     //
+// returning, the process usually terminates right after.       //
+// Formats replace each {} by the next argument.                //
+// ************************************************************ //
+
+// Returns null when the ring of the calling thread is full.
+auto begin_log_message(LogLevel level, const char* format) -> LogMessage*;
+// Publishes the message begun last on the calling thread.
+auto end_log_message(LogLevel level) -> void;
+// Writes every message logged so far, on the calling thread.
+auto flush_log() -> void;
+
+template <typename T>
+auto add_log_argument(LogMessage& message, const T& value) -> void
+{
+  LogArgument& argument = message.arguments[message.argument_count];
+  if constexpr (std::is_enum_v<T>) {
+    add_log_argument(message, static_cast<std::underlying_type_t<T>>(value));
+    return;
+  }
+  else if constexpr (std::is_same_v<T, bool>) {
+    argument.type = LogArgumentType::boolean;
+    argument.unsigned_integer = value;
+  }
+  else if constexpr (std::is_same_v<T, char>) {
+    argument.type = LogArgumentType::character;
+    argument.unsigned_integer = static_cast<unsigned char>(value);
+  }
+  else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    argument.type = LogArgumentType::signed_integer;
+    argument.signed_integer = value;
+  }
+  else if constexpr (std::is_integral_v<T>) {
+    argument.type = LogArgumentType::unsigned_integer;
+    argument.unsigned_integer = value;
+  }
+  else if constexpr (std::is_floating_point_v<T>) {
+    argument.type = LogArgumentType::floating;
+    argument.floating = value;
+  }
+  else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+    std::string_view text;
+    if constexpr (std::is_pointer_v<T>) {
+      text = value != nullptr ? std::string_view(value) : "(null)";
+    }
+    else if constexpr (std::is_array_v<T>) {
+      // Up to the terminator, or the whole array without one.
+      text = std::string_view(
+          value, std::find(value, value + std::extent_v<T>, '\0') - value);
+    }
+    else {
+      text = value;
+    }
+    size_t size = std::min<size_t>(text.size(),
+                                   LOG_TEXT_SIZE - message.text_size);
+    argument.type = LogArgumentType::text;
+    argument.text.offset = message.text_size;
+    argument.text.size = static_cast<uint16_t>(size);
+    memcpy(message.text + message.text_size, text.data(), size);
+    message.text_size += static_cast<uint16_t>(size);
+  }
+  else {
+    static_assert(std::is_pointer_v<T>, "The type cannot be logged.");
+    argument.type = LogArgumentType::pointer;
+    argument.pointer = value;
+  }
+  ++message.argument_count;
+}
+
+template <typename... Args>
+auto log_message(LogLevel level, const char* format, const Args&... args)
+    -> void
+{
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGUMENTS,
+                "Too many arguments to log.");
+  LogMessage* message = begin_log_message(level, format);
+  if (message == nullptr) {
+    return;
+  }
+  (add_log_argument(*message, args), ...);
+  end_log_message(level);
+}
+
+}  // namespace gfx
+
+#if GFX_LOG_LEVEL <= 0
+#define GFX_LOG_TRACE(...) \
+  ::gfx::log_message(::gfx::LogLevel::trace, __VA_ARGS__)
+#else
+#define GFX_LOG_TRACE(...) static_cast<void>(0)
+#endif
+#if GFX_LOG_LEVEL <= 1
+#define GFX_LOG_DEBUG(...) \
+  ::gfx::log_message(::gfx::LogLevel::debug, __VA_ARGS__)
+#else
+#define GFX_LOG_DEBUG(...) static_cast<void>(0)
+#endif
+#if GFX_LOG_LEVEL <= 2
+#define GFX_LOG_INFO(...) \
+  ::gfx::log_message(::gfx::LogLevel::info, __VA_ARGS__)
+#else
+#define GFX_LOG_INFO(...) static_cast<void>(0)
+#endif
+#if GFX_LOG_LEVEL <= 3
+#define GFX_LOG_WARNING(...) \
+  ::gfx::log_message(::gfx::LogLevel::warning, __VA_ARGS__)
+#else
+#define GFX_LOG_WARNING(...) static_cast<void>(0)
+#endif
+#define GFX_LOG_ERROR(...) \
+  ::gfx::log_message(::gfx::LogLevel::error, __VA_ARGS__)
@@ -1,11 +1,24 @@
 #include <iostream>
+#include <optional>
+#include <utility>
+#include "host_allocator.h"
+#include "metrics.h"
 #include "vulkan_api.h"
 
 int main()
 {
   std::cout << "Vulkan learning!\n";
 
-  gfx::load_backend();
+  // Before the device registers its metrics, vkl-top shows them.
+  gfx::enable_metrics();
+  // The host memory of the driver per allocation scope, live rather than
+  // only in the report printed at exit.
+  gfx::vk_api::host_allocator().publish_metrics();
+
+  if (!gfx::load_backend()) {
+    std::cerr << "Could not load the Vulkan backend.\n";
+    return 1;
+  }
   std::cout << "Vulkan backend loaded.\n";
 
   // Create the platform window.
@@ -17,14 +30,30 @@ int main()
   gfx::vk_api::enumerate_all_physical_devices();
 
   std::cout << "\nCreate the device.\n";
-  gfx::Device device = gfx::create_device(window.get_parameters());
+  std::optional<gfx::Device> created =
+      gfx::create_device(window.get_parameters());
+  if (!created) {
+    std::cerr << "Could not create the device.\n";
+    gfx::unload_backend();
+    return 1;
+  }
+  gfx::Device device = std::move(*created);
   gfx::print_device_name(device);
+  gfx::vk_api::print_startup_timings(std::cout);
 
-  gfx::create_swap_chain(device);
+  VkResult swap_chain = gfx::create_swap_chain(device);
+  if (swap_chain != VK_SUCCESS) {
+    std::cerr << "Could not create the swap chain: "
+              << gfx::vk_api::result_name(swap_chain) << ".\n";
+    gfx::destroy_device(device);
+    gfx::unload_backend();
+    return 1;
+  }
 
   std::cout << "\n\n*********LOOP*********\n\n\n";
 
   gfx::destroy_device(device);
+  gfx::vk_api::host_allocator().print_report(std::cout);
   gfx::unload_backend();
   std::cout << "Vulkan backend unloaded.\n";
   return 0;
@@ -0,0 +1,151 @@
+#include "mapped_file.h"
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+os::MappedFile::MappedFile()
+    : data_(nullptr),
+      size_(0),
+      open_(false)
+#if defined(_WIN32)
+      ,
+      file_(INVALID_HANDLE_VALUE),
+      mapping_(nullptr)
+#endif
+{
+}
+
+os::MappedFile::~MappedFile() { close(); }
+
+os::MappedFile::MappedFile(MappedFile&& other) noexcept : MappedFile()
+{
+  *this = std::move(other);
+}
+
+os::MappedFile& os::MappedFile::operator=(MappedFile&& other) noexcept
+{
+  if (this != &other) {
+    close();
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(open_, other.open_);
+#if defined(_WIN32)
+    std::swap(file_, other.file_);
+    std::swap(mapping_, other.mapping_);
+#endif
+  }
+  return *this;
+}
+
+#if defined(_WIN32)
+
+auto os::MappedFile::open(const char* path) -> bool
+{
+  close();
+  file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_, &size)) {
+    close();
+    return false;
+  }
+  open_ = true;
+  size_ = static_cast<size_t>(size.QuadPart);
+  // Empty files cannot be mapped.
+  if (size_ == 0) {
+    return true;
+  }
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ == nullptr) {
+    close();
+    return false;
+  }
+  data_ = static_cast<const std::byte*>(
+      MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (data_ == nullptr) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+auto os::MappedFile::close() -> void
+{
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  open_ = false;
+  file_ = INVALID_HANDLE_VALUE;
+  mapping_ = nullptr;
+}
+
+#else
+
+auto os::MappedFile::open(const char* path) -> bool
+{
+  close();
+  int file = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (file < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0) {
+    ::close(file);
+    return false;
+  }
+  size_t size = static_cast<size_t>(status.st_size);
+  void* data = nullptr;
+  // Empty files cannot be mapped.
+  if (size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+  }
+  // The mapping keeps the file referenced.
+  ::close(file);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<const std::byte*>(data);
+  size_ = size;
+  open_ = true;
+  return true;
+}
+
+auto os::MappedFile::close() -> void
+{
+  if (data_ != nullptr) {
+    munmap(const_cast<std::byte*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  open_ = false;
+}
+
+#endif
+
+auto os::MappedFile::is_open() const -> bool { return open_; }
+
+auto os::MappedFile::data() const -> const std::byte* { return data_; }
+
+auto os::MappedFile::size() const -> size_t { return size_; }
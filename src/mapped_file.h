@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace os {
+
+// ************************************************************ //
+// MappedFile                                                   //
+//                                                              //
+// Read only view of a whole file mapped in memory, pages are   //
+// only read when touched. The mapping lives until close() or   //
+// destruction.                                                 //
+// ************************************************************ //
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  // Returns false if the file cannot be opened or mapped. Empty files open
+  // with a null data pointer.
+  auto open(const char* path) -> bool;
+  auto close() -> void;
+
+  auto is_open() const -> bool;
+  auto data() const -> const std::byte*;
+  auto size() const -> size_t;
+
+ private:
+  const std::byte* data_;
+  size_t size_;
+  bool open_;
+#if defined(_WIN32)
+  void* file_;
+  void* mapping_;
+#endif
+};
+
+}  // namespace os
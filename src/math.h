@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+namespace gfx::math {
+
+// ************************************************************ //
+// Math types                                                   //
+//                                                              //
+// Plain structures laid out like their GLSL counterparts, with //
+// the operations used on single values. Work done on many      //
+// values at once goes through the SoA kernels of               //
+// math_kernels.h instead.                                      //
+// ************************************************************ //
+
+struct Vec3 {
+  float x, y, z;
+};
+
+struct Vec4 {
+  float x, y, z, w;
+};
+
+// Unit quaternion, w is the real part.
+struct Quat {
+  float x, y, z, w;
+};
+
+// Column major, m[column * 4 + row].
+struct Mat4 {
+  float m[16];
+};
+
+// Rows of a 3x4 affine transform, the layout of the instance transforms.
+struct Affine {
+  float rows[12];
+};
+
+struct Aabb {
+  Vec3 min;
+  Vec3 max;
+};
+
+// Matches a vec4 holding the center and the radius.
+struct Sphere {
+  Vec3 center;
+  float radius;
+};
+static_assert(sizeof(Sphere) == 16, "Sphere must match a vec4.");
+
+// Normalized planes (a, b, c, d), a point p is inside when
+// a * p.x + b * p.y + c * p.z + d >= 0 for all six planes, in the order
+// left, right, bottom, top, near, far.
+struct Frustum {
+  Vec4 planes[6];
+};
+
+inline auto operator+(Vec3 a, Vec3 b) -> Vec3
+{
+  return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+inline auto operator-(Vec3 a, Vec3 b) -> Vec3
+{
+  return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+inline auto operator*(Vec3 v, float s) -> Vec3
+{
+  return {v.x * s, v.y * s, v.z * s};
+}
+
+inline auto dot(Vec3 a, Vec3 b) -> float
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline auto cross(Vec3 a, Vec3 b) -> Vec3
+{
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+          a.x * b.y - a.y * b.x};
+}
+
+inline auto length(Vec3 v) -> float { return std::sqrt(dot(v, v)); }
+
+inline auto normalize(Vec3 v) -> Vec3
+{
+  float l = length(v);
+  return l > 0.0f ? v * (1.0f / l) : v;
+}
+
+inline auto min(Vec3 a, Vec3 b) -> Vec3
+{
+  return {std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)};
+}
+
+inline auto max(Vec3 a, Vec3 b) -> Vec3
+{
+  return {std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)};
+}
+
+inline auto identity_quat() -> Quat { return {0.0f, 0.0f, 0.0f, 1.0f}; }
+
+// Rotation of angle radians around a unit axis.
+inline auto axis_angle(Vec3 axis, float angle) -> Quat
+{
+  float s = std::sin(angle * 0.5f);
+  return {axis.x * s, axis.y * s, axis.z * s, std::cos(angle * 0.5f)};
+}
+
+// Rotation b followed by rotation a.
+inline auto operator*(Quat a, Quat b) -> Quat
+{
+  return {a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+          a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+          a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+          a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
+}
+
+inline auto normalize(Quat q) -> Quat
+{
+  float l = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+  return l > 0.0f ? Quat{q.x / l, q.y / l, q.z / l, q.w / l} : q;
+}
+
+inline auto rotate(Quat q, Vec3 v) -> Vec3
+{
+  Vec3 u = {q.x, q.y, q.z};
+  Vec3 t = cross(u, v) * 2.0f;
+  return v + t * q.w + cross(u, t);
+}
+
+// Scale, then rotation, then translation.
+inline auto compose(Vec3 translation, Quat rotation, Vec3 scale) -> Affine
+{
+  float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+  float r[3][3] = {
+      {1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y - z * w),
+       2.0f * (x * z + y * w)},
+      {2.0f * (x * y + z * w), 1.0f - 2.0f * (x * x + z * z),
+       2.0f * (y * z - x * w)},
+      {2.0f * (x * z - y * w), 2.0f * (y * z + x * w),
+       1.0f - 2.0f * (x * x + y * y)}};
+  float t[3] = {translation.x, translation.y, translation.z};
+  float s[3] = {scale.x, scale.y, scale.z};
+  Affine affine;
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      affine.rows[row * 4 + column] = r[row][column] * s[column];
+    }
+    affine.rows[row * 4 + 3] = t[row];
+  }
+  return affine;
+}
+
+inline auto transform_point(const Affine& a, Vec3 p) -> Vec3
+{
+  const float* m = a.rows;
+  return {m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+          m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+          m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]};
+}
+
+// The sphere still encloses the object under non uniform scale.
+inline auto transform_sphere(const Affine& a, const Sphere& sphere) -> Sphere
+{
+  const float* m = a.rows;
+  float scale_x = m[0] * m[0] + m[4] * m[4] + m[8] * m[8];
+  float scale_y = m[1] * m[1] + m[5] * m[5] + m[9] * m[9];
+  float scale_z = m[2] * m[2] + m[6] * m[6] + m[10] * m[10];
+  return {transform_point(a, sphere.center),
+          sphere.radius *
+              std::sqrt(std::max(scale_x, std::max(scale_y, scale_z)))};
+}
+
+inline auto identity() -> Mat4
+{
+  return {{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+           0.0f, 0.0f, 0.0f, 0.0f, 1.0f}};
+}
+
+inline auto operator*(const Mat4& a, const Mat4& b) -> Mat4
+{
+  Mat4 result;
+  for (int column = 0; column < 4; ++column) {
+    for (int row = 0; row < 4; ++row) {
+      float sum = 0.0f;
+      for (int k = 0; k < 4; ++k) {
+        sum += a.m[k * 4 + row] * b.m[column * 4 + k];
+      }
+      result.m[column * 4 + row] = sum;
+    }
+  }
+  return result;
+}
+
+inline auto to_mat4(const Affine& a) -> Mat4
+{
+  Mat4 result = identity();
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 4; ++column) {
+      result.m[column * 4 + row] = a.rows[row * 4 + column];
+    }
+  }
+  return result;
+}
+
+// Right handed view looking from eye to target.
+inline auto look_at(Vec3 eye, Vec3 target, Vec3 up) -> Mat4
+{
+  Vec3 f = normalize(target - eye);
+  Vec3 s = normalize(cross(f, up));
+  Vec3 u = cross(s, f);
+  return {{s.x, u.x, -f.x, 0.0f, s.y, u.y, -f.y, 0.0f, s.z, u.z, -f.z, 0.0f,
+           -dot(s, eye), -dot(u, eye), dot(f, eye), 1.0f}};
+}
+
+// Right handed projection to the Vulkan clip volume: y down, 0 <= z <= w.
+inline auto perspective(float vertical_fov, float aspect, float z_near,
+                        float z_far) -> Mat4
+{
+  float f = 1.0f / std::tan(vertical_fov * 0.5f);
+  Mat4 result = {};
+  result.m[0] = f / aspect;
+  result.m[5] = -f;
+  result.m[10] = z_far / (z_near - z_far);
+  result.m[11] = -1.0f;
+  result.m[14] = z_near * z_far / (z_near - z_far);
+  return result;
+}
+
+// Clip planes of a view projection matrix, for the Vulkan clip volume.
+inline auto extract_frustum(const Mat4& view_projection) -> Frustum
+{
+  auto row = [&view_projection](int i) {
+    const float* m = view_projection.m;
+    return Vec4{m[i], m[4 + i], m[8 + i], m[12 + i]};
+  };
+  auto add = [](Vec4 a, Vec4 b) {
+    return Vec4{a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w};
+  };
+  auto sub = [](Vec4 a, Vec4 b) {
+    return Vec4{a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w};
+  };
+
+  Frustum frustum = {{add(row(3), row(0)), sub(row(3), row(0)),
+                      add(row(3), row(1)), sub(row(3), row(1)), row(2),
+                      sub(row(3), row(2))}};
+  for (Vec4& plane : frustum.planes) {
+    float l = length(Vec3{plane.x, plane.y, plane.z});
+    if (l > 0.0f) {
+      plane = {plane.x / l, plane.y / l, plane.z / l, plane.w / l};
+    }
+  }
+  return frustum;
+}
+
+inline auto is_visible(const Frustum& frustum, const Sphere& sphere) -> bool
+{
+  for (const Vec4& plane : frustum.planes) {
+    if (dot(Vec3{plane.x, plane.y, plane.z}, sphere.center) + plane.w <
+        -sphere.radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline auto is_visible(const Frustum& frustum, const Aabb& box) -> bool
+{
+  // Only the corner farthest along each plane normal matters.
+  for (const Vec4& plane : frustum.planes) {
+    Vec3 corner = {plane.x >= 0.0f ? box.max.x : box.min.x,
+                   plane.y >= 0.0f ? box.max.y : box.min.y,
+                   plane.z >= 0.0f ? box.max.z : box.min.z};
+    if (dot(Vec3{plane.x, plane.y, plane.z}, corner) + plane.w < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace gfx::math
@@ -0,0 +1,157 @@
+#include "math_kernels.h"
+#include <atomic>
+#include "math_kernels_impl.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace gfx::math {
+
+// Defined in math_kernels_avx2.cpp, the only file built with AVX2 enabled.
+// Null when the compiler could not build it.
+auto avx2_kernels() -> const MathKernels*;
+
+namespace {
+
+constexpr MathKernels SCALAR_KERNELS =
+    impl::kernel_table<impl::ScalarLanes>(SimdLevel::scalar);
+#if defined(GFX_MATH_SSE2)
+constexpr MathKernels SSE2_KERNELS =
+    impl::kernel_table<impl::Sse2Lanes>(SimdLevel::sse2);
+#endif
+#if defined(GFX_MATH_NEON)
+constexpr MathKernels NEON_KERNELS =
+    impl::kernel_table<impl::NeonLanes>(SimdLevel::neon);
+#endif
+
+std::atomic<const MathKernels*> ACTIVE_KERNELS = nullptr;
+
+auto cpu_supports_avx2() -> bool
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  // The OS must also save the YMM registers.
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+}  // namespace
+
+}  // namespace gfx::math
+
+auto gfx::math::simd_level_name(SimdLevel level) -> const char*
+{
+  switch (level) {
+    case SimdLevel::scalar:
+      return "scalar";
+    case SimdLevel::sse2:
+      return "sse2";
+    case SimdLevel::avx2:
+      return "avx2";
+    case SimdLevel::neon:
+      return "neon";
+  }
+  return "unknown";
+}
+
+auto gfx::math::kernels(SimdLevel level) -> const MathKernels*
+{
+  switch (level) {
+    case SimdLevel::scalar:
+      return &SCALAR_KERNELS;
+    case SimdLevel::sse2:
+#if defined(GFX_MATH_SSE2)
+      return &SSE2_KERNELS;
+#else
+      return nullptr;
+#endif
+    case SimdLevel::avx2:
+      return cpu_supports_avx2() ? avx2_kernels() : nullptr;
+    case SimdLevel::neon:
+#if defined(GFX_MATH_NEON)
+      return &NEON_KERNELS;
+#else
+      return nullptr;
+#endif
+  }
+  return nullptr;
+}
+
+auto gfx::math::best_simd_level() -> SimdLevel
+{
+  for (SimdLevel level :
+       {SimdLevel::avx2, SimdLevel::sse2, SimdLevel::neon}) {
+    if (kernels(level) != nullptr) {
+      return level;
+    }
+  }
+  return SimdLevel::scalar;
+}
+
+auto gfx::math::active_kernels() -> const MathKernels&
+{
+  const MathKernels* active = ACTIVE_KERNELS.load(std::memory_order_acquire);
+  if (active == nullptr) {
+    // Racing threads all pick the same table.
+    active = kernels(best_simd_level());
+    ACTIVE_KERNELS.store(active, std::memory_order_release);
+  }
+  return *active;
+}
+
+auto gfx::math::set_simd_level(SimdLevel level) -> bool
+{
+  const MathKernels* selected = kernels(level);
+  if (selected == nullptr) {
+    return false;
+  }
+  ACTIVE_KERNELS.store(selected, std::memory_order_release);
+  return true;
+}
+
+auto gfx::math::offset(const TransformSoA& soa, uint32_t offset)
+    -> TransformSoA
+{
+  TransformSoA result;
+  for (int i = 0; i < 3; ++i) {
+    result.translation[i] = soa.translation[i] + offset;
+    result.scale[i] = soa.scale[i] + offset;
+  }
+  for (int i = 0; i < 4; ++i) {
+    result.rotation[i] = soa.rotation[i] + offset;
+  }
+  return result;
+}
+
+auto gfx::math::offset(const AffineSoA& soa, uint32_t offset) -> AffineSoA
+{
+  AffineSoA result;
+  for (int i = 0; i < 12; ++i) {
+    result.rows[i] = soa.rows[i] + offset;
+  }
+  return result;
+}
+
+auto gfx::math::offset(const SphereSoA& soa, uint32_t offset) -> SphereSoA
+{
+  return {{soa.center[0] + offset, soa.center[1] + offset,
+           soa.center[2] + offset},
+          soa.radius + offset};
+}
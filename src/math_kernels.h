@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include "math.h"
+
+namespace gfx::math {
+
+// ************************************************************ //
+// SoA kernels                                                  //
+//                                                              //
+// Batched versions of the math.h operations working on         //
+// structures of arrays, so SIMD lanes map to consecutive       //
+// elements without any shuffling. Every level below provides   //
+// the same kernels; the best one the CPU supports is picked at //
+// startup and the others stay reachable for comparison. Tails  //
+// shorter than a register run through the scalar kernels.      //
+// ************************************************************ //
+
+// Each array holds one float per element.
+struct TransformSoA {
+  float* translation[3];
+  // Unit quaternions, x y z w.
+  float* rotation[4];
+  float* scale[3];
+};
+
+// Rows of 3x4 affine transforms, element i of rows[r * 4 + c] is row r,
+// column c of transform i.
+struct AffineSoA {
+  float* rows[12];
+};
+
+struct SphereSoA {
+  float* center[3];
+  float* radius;
+};
+
+enum class SimdLevel { scalar, sse2, avx2, neon };
+
+struct MathKernels {
+  SimdLevel level;
+  // Elements processed per iteration.
+  uint32_t width;
+  // Scale, then rotation, then translation.
+  void (*compose)(const TransformSoA& transforms, uint32_t count,
+                  const AffineSoA& out);
+  void (*transform_spheres)(const AffineSoA& transforms,
+                            const SphereSoA& spheres, uint32_t count,
+                            const SphereSoA& out);
+  // Writes the indices of the visible spheres to visible, in order, and
+  // returns how many there are.
+  uint32_t (*cull_spheres)(const Frustum& frustum, const SphereSoA& spheres,
+                           uint32_t count, uint32_t* visible);
+};
+
+auto simd_level_name(SimdLevel level) -> const char*;
+// Null when the level is not built for this target or the CPU lacks it.
+auto kernels(SimdLevel level) -> const MathKernels*;
+// Widest level supported by the build and the CPU.
+auto best_simd_level() -> SimdLevel;
+// Kernels used by the functions below, the best level by default.
+auto active_kernels() -> const MathKernels&;
+// Returns false and changes nothing when the level is unsupported.
+auto set_simd_level(SimdLevel level) -> bool;
+
+inline auto compose(const TransformSoA& transforms, uint32_t count,
+                    const AffineSoA& out) -> void
+{
+  active_kernels().compose(transforms, count, out);
+}
+
+inline auto transform_spheres(const AffineSoA& transforms,
+                              const SphereSoA& spheres, uint32_t count,
+                              const SphereSoA& out) -> void
+{
+  active_kernels().transform_spheres(transforms, spheres, count, out);
+}
+
+inline auto cull_spheres(const Frustum& frustum, const SphereSoA& spheres,
+                         uint32_t count, uint32_t* visible) -> uint32_t
+{
+  return active_kernels().cull_spheres(frustum, spheres, count, visible);
+}
+
+// Advances every array of a view by offset elements, to process a range.
+auto offset(const TransformSoA& soa, uint32_t offset) -> TransformSoA;
+auto offset(const AffineSoA& soa, uint32_t offset) -> AffineSoA;
+auto offset(const SphereSoA& soa, uint32_t offset) -> SphereSoA;
+
+}  // namespace gfx::math
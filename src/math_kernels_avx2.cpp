@@ -0,0 +1,24 @@
+// Built with AVX2 code generation enabled, see CMakeLists.txt. Nothing in
+// here may run before math_kernels.cpp checked the CPU supports it.
+#include "math_kernels_impl.h"
+
+namespace gfx::math {
+
+#if defined(__AVX2__)
+
+namespace {
+
+constexpr MathKernels AVX2_KERNELS =
+    impl::kernel_table<impl::Avx2Lanes>(SimdLevel::avx2);
+
+}  // namespace
+
+auto avx2_kernels() -> const MathKernels* { return &AVX2_KERNELS; }
+
+#else
+
+auto avx2_kernels() -> const MathKernels* { return nullptr; }
+
+#endif
+
+}  // namespace gfx::math
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <cmath>
+#include "math_kernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GFX_MATH_SSE2
+#endif
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define GFX_MATH_NEON
+#endif
+
+namespace gfx::math {
+
+// Kernels are written once against a lane type wrapping one register, and
+// instantiated for every SIMD level. Only math_kernels*.cpp include this.
+// Everything has internal linkage: math_kernels_avx2.cpp instantiates the
+// same templates with AVX2 code generation, and the linker must never
+// merge those copies with the ones the other levels run.
+namespace {
+namespace impl {
+
+struct ScalarLanes {
+  using Register = float;
+  using Mask = bool;
+  static constexpr uint32_t width = 1;
+
+  static auto load(const float* p) -> Register { return *p; }
+  static auto store(float* p, Register r) -> void { *p = r; }
+  static auto set(float value) -> Register { return value; }
+  static auto add(Register a, Register b) -> Register { return a + b; }
+  static auto sub(Register a, Register b) -> Register { return a - b; }
+  static auto mul(Register a, Register b) -> Register { return a * b; }
+  static auto max(Register a, Register b) -> Register
+  {
+    return a > b ? a : b;
+  }
+  static auto sqrt(Register a) -> Register { return std::sqrt(a); }
+  static auto all() -> Mask { return true; }
+  static auto greater_equal(Register a, Register b) -> Mask { return a >= b; }
+  static auto both(Mask a, Mask b) -> Mask { return a && b; }
+  static auto bits(Mask m) -> uint32_t { return m ? 1 : 0; }
+};
+
+#if defined(GFX_MATH_SSE2)
+struct Sse2Lanes {
+  using Register = __m128;
+  using Mask = __m128;
+  static constexpr uint32_t width = 4;
+
+  static auto load(const float* p) -> Register { return _mm_loadu_ps(p); }
+  static auto store(float* p, Register r) -> void { _mm_storeu_ps(p, r); }
+  static auto set(float value) -> Register { return _mm_set1_ps(value); }
+  static auto add(Register a, Register b) -> Register
+  {
+    return _mm_add_ps(a, b);
+  }
+  static auto sub(Register a, Register b) -> Register
+  {
+    return _mm_sub_ps(a, b);
+  }
+  static auto mul(Register a, Register b) -> Register
+  {
+    return _mm_mul_ps(a, b);
+  }
+  static auto max(Register a, Register b) -> Register
+  {
+    return _mm_max_ps(a, b);
+  }
+  static auto sqrt(Register a) -> Register { return _mm_sqrt_ps(a); }
+  static auto all() -> Mask
+  {
+    return _mm_castsi128_ps(_mm_set1_epi32(-1));
+  }
+  static auto greater_equal(Register a, Register b) -> Mask
+  {
+    return _mm_cmpge_ps(a, b);
+  }
+  static auto both(Mask a, Mask b) -> Mask { return _mm_and_ps(a, b); }
+  static auto bits(Mask m) -> uint32_t
+  {
+    return static_cast<uint32_t>(_mm_movemask_ps(m));
+  }
+};
+#endif
+
+#if defined(__AVX2__)
+struct Avx2Lanes {
+  using Register = __m256;
+  using Mask = __m256;
+  static constexpr uint32_t width = 8;
+
+  static auto load(const float* p) -> Register { return _mm256_loadu_ps(p); }
+  static auto store(float* p, Register r) -> void { _mm256_storeu_ps(p, r); }
+  static auto set(float value) -> Register { return _mm256_set1_ps(value); }
+  static auto add(Register a, Register b) -> Register
+  {
+    return _mm256_add_ps(a, b);
+  }
+  static auto sub(Register a, Register b) -> Register
+  {
+    return _mm256_sub_ps(a, b);
+  }
+  static auto mul(Register a, Register b) -> Register
+  {
+    return _mm256_mul_ps(a, b);
+  }
+  static auto max(Register a, Register b) -> Register
+  {
+    return _mm256_max_ps(a, b);
+  }
+  static auto sqrt(Register a) -> Register { return _mm256_sqrt_ps(a); }
+  static auto all() -> Mask
+  {
+    return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  }
+  static auto greater_equal(Register a, Register b) -> Mask
+  {
+    return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+  }
+  static auto both(Mask a, Mask b) -> Mask { return _mm256_and_ps(a, b); }
+  static auto bits(Mask m) -> uint32_t
+  {
+    return static_cast<uint32_t>(_mm256_movemask_ps(m));
+  }
+};
+#endif
+
+#if defined(GFX_MATH_NEON)
+struct NeonLanes {
+  using Register = float32x4_t;
+  using Mask = uint32x4_t;
+  static constexpr uint32_t width = 4;
+
+  static auto load(const float* p) -> Register { return vld1q_f32(p); }
+  static auto store(float* p, Register r) -> void { vst1q_f32(p, r); }
+  static auto set(float value) -> Register { return vdupq_n_f32(value); }
+  static auto add(Register a, Register b) -> Register
+  {
+    return vaddq_f32(a, b);
+  }
+  static auto sub(Register a, Register b) -> Register
+  {
+    return vsubq_f32(a, b);
+  }
+  static auto mul(Register a, Register b) -> Register
+  {
+    return vmulq_f32(a, b);
+  }
+  static auto max(Register a, Register b) -> Register
+  {
+    return vmaxq_f32(a, b);
+  }
+  static auto sqrt(Register a) -> Register { return vsqrtq_f32(a); }
+  static auto all() -> Mask { return vdupq_n_u32(0xffffffffu); }
+  static auto greater_equal(Register a, Register b) -> Mask
+  {
+    return vcgeq_f32(a, b);
+  }
+  static auto both(Mask a, Mask b) -> Mask { return vandq_u32(a, b); }
+  static auto bits(Mask m) -> uint32_t
+  {
+    const uint32x4_t weights = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(m, weights));
+  }
+};
+#endif
+
+// Each kernel processes whole registers only and returns the number of
+// elements done, the caller finishes with ScalarLanes.
+
+template <typename L>
+auto compose_lanes(const TransformSoA& transforms, uint32_t count,
+                   const AffineSoA& out) -> uint32_t
+{
+  using R = typename L::Register;
+  const R one = L::set(1.0f);
+  const R two = L::set(2.0f);
+  uint32_t i = 0;
+  for (; i + L::width <= count; i += L::width) {
+    R x = L::load(transforms.rotation[0] + i);
+    R y = L::load(transforms.rotation[1] + i);
+    R z = L::load(transforms.rotation[2] + i);
+    R w = L::load(transforms.rotation[3] + i);
+    R xx = L::mul(x, x), yy = L::mul(y, y), zz = L::mul(z, z);
+    R xy = L::mul(x, y), xz = L::mul(x, z), yz = L::mul(y, z);
+    R wx = L::mul(w, x), wy = L::mul(w, y), wz = L::mul(w, z);
+    R r[9] = {L::sub(one, L::mul(two, L::add(yy, zz))),
+              L::mul(two, L::sub(xy, wz)),
+              L::mul(two, L::add(xz, wy)),
+              L::mul(two, L::add(xy, wz)),
+              L::sub(one, L::mul(two, L::add(xx, zz))),
+              L::mul(two, L::sub(yz, wx)),
+              L::mul(two, L::sub(xz, wy)),
+              L::mul(two, L::add(yz, wx)),
+              L::sub(one, L::mul(two, L::add(xx, yy)))};
+    R s[3] = {L::load(transforms.scale[0] + i),
+              L::load(transforms.scale[1] + i),
+              L::load(transforms.scale[2] + i)};
+    for (int row = 0; row < 3; ++row) {
+      for (int column = 0; column < 3; ++column) {
+        L::store(out.rows[row * 4 + column] + i,
+                 L::mul(r[row * 3 + column], s[column]));
+      }
+      L::store(out.rows[row * 4 + 3] + i,
+               L::load(transforms.translation[row] + i));
+    }
+  }
+  return i;
+}
+
+template <typename L>
+auto transform_spheres_lanes(const AffineSoA& transforms,
+                             const SphereSoA& spheres, uint32_t count,
+                             const SphereSoA& out) -> uint32_t
+{
+  using R = typename L::Register;
+  uint32_t i = 0;
+  for (; i + L::width <= count; i += L::width) {
+    R m[12];
+    for (int e = 0; e < 12; ++e) {
+      m[e] = L::load(transforms.rows[e] + i);
+    }
+    R c[3] = {L::load(spheres.center[0] + i), L::load(spheres.center[1] + i),
+              L::load(spheres.center[2] + i)};
+    for (int row = 0; row < 3; ++row) {
+      const R* r = m + row * 4;
+      L::store(out.center[row] + i,
+               L::add(L::add(L::mul(r[0], c[0]), L::mul(r[1], c[1])),
+                      L::add(L::mul(r[2], c[2]), r[3])));
+    }
+    // Squared length of each column, the radius follows the largest.
+    R scale[3];
+    for (int column = 0; column < 3; ++column) {
+      scale[column] = L::add(
+          L::add(L::mul(m[column], m[column]),
+                 L::mul(m[4 + column], m[4 + column])),
+          L::mul(m[8 + column], m[8 + column]));
+    }
+    L::store(out.radius + i,
+             L::mul(L::load(spheres.radius + i),
+                    L::sqrt(L::max(scale[0], L::max(scale[1], scale[2])))));
+  }
+  return i;
+}
+
+template <typename L>
+auto cull_spheres_lanes(const Frustum& frustum, const SphereSoA& spheres,
+                        uint32_t count, uint32_t* visible,
+                        uint32_t& visible_count) -> uint32_t
+{
+  using R = typename L::Register;
+  R planes[6][4];
+  for (int p = 0; p < 6; ++p) {
+    const Vec4& plane = frustum.planes[p];
+    planes[p][0] = L::set(plane.x);
+    planes[p][1] = L::set(plane.y);
+    planes[p][2] = L::set(plane.z);
+    planes[p][3] = L::set(plane.w);
+  }
+  const R zero = L::set(0.0f);
+
+  uint32_t i = 0;
+  for (; i + L::width <= count; i += L::width) {
+    R x = L::load(spheres.center[0] + i);
+    R y = L::load(spheres.center[1] + i);
+    R z = L::load(spheres.center[2] + i);
+    R negative_radius = L::sub(zero, L::load(spheres.radius + i));
+    typename L::Mask inside = L::all();
+    for (const auto& plane : planes) {
+      R distance = L::add(L::add(L::mul(plane[0], x), L::mul(plane[1], y)),
+                          L::add(L::mul(plane[2], z), plane[3]));
+      inside = L::both(inside, L::greater_equal(distance, negative_radius));
+    }
+    uint32_t bits = L::bits(inside);
+    for (uint32_t lane = 0; lane < L::width; ++lane) {
+      if (bits & (1u << lane)) {
+        visible[visible_count++] = i + lane;
+      }
+    }
+  }
+  return i;
+}
+
+// Entry points of a level: whole registers with L, the tail scalar.
+
+template <typename L>
+auto compose(const TransformSoA& transforms, uint32_t count,
+             const AffineSoA& out) -> void
+{
+  uint32_t done = compose_lanes<L>(transforms, count, out);
+  compose_lanes<ScalarLanes>(offset(transforms, done), count - done,
+                             offset(out, done));
+}
+
+template <typename L>
+auto transform_spheres(const AffineSoA& transforms, const SphereSoA& spheres,
+                       uint32_t count, const SphereSoA& out) -> void
+{
+  uint32_t done = transform_spheres_lanes<L>(transforms, spheres, count, out);
+  transform_spheres_lanes<ScalarLanes>(offset(transforms, done),
+                                       offset(spheres, done), count - done,
+                                       offset(out, done));
+}
+
+template <typename L>
+auto cull_spheres(const Frustum& frustum, const SphereSoA& spheres,
+                  uint32_t count, uint32_t* visible) -> uint32_t
+{
+  uint32_t visible_count = 0;
+  uint32_t done =
+      cull_spheres_lanes<L>(frustum, spheres, count, visible, visible_count);
+  uint32_t first_tail = visible_count;
+  cull_spheres_lanes<ScalarLanes>(frustum, offset(spheres, done),
+                                  count - done, visible, visible_count);
+  for (uint32_t i = first_tail; i < visible_count; ++i) {
+    visible[i] += done;
+  }
+  return visible_count;
+}
+
+template <typename L>
+constexpr auto kernel_table(SimdLevel level) -> MathKernels
+{
+  return {level, L::width, compose<L>, transform_spheres<L>, cull_spheres<L>};
+}
+
+}  // namespace impl
+}  // namespace
+
+}  // namespace gfx::math
@@ -0,0 +1,308 @@
+#include "metrics.h"
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "log.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+namespace {
+
+// Until metrics are enabled, and for good when they are not.
+gfx::MetricsSegment LOCAL_SEGMENT;
+gfx::MetricsSegment* SEGMENT = &LOCAL_SEGMENT;
+bool ENABLED = false;
+// Guards registration, updates never take it.
+std::mutex REGISTRY_MUTEX;
+uint32_t HISTOGRAM_COUNT = 0;
+// Handed out past the limits, their values are never shown.
+gfx::MetricSlot DUMMY_SLOT;
+gfx::HistogramSlot DUMMY_HISTOGRAM;
+
+auto segment_name(uint32_t pid) -> std::string
+{
+#if defined(_WIN32)
+  return "Local\\vkl-metrics." + std::to_string(pid);
+#else
+  return "/vkl-metrics." + std::to_string(pid);
+#endif
+}
+
+#if defined(_WIN32)
+
+auto current_pid() -> uint32_t
+{
+  return GetCurrentProcessId();
+}
+
+// The mapping goes away with the last handle to it, nothing to clean up.
+auto create_segment() -> gfx::MetricsSegment*
+{
+  HANDLE mapping = CreateFileMappingA(
+      INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+      static_cast<DWORD>(sizeof(gfx::MetricsSegment)),
+      segment_name(current_pid()).c_str());
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+  void* data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+  if (data == nullptr) {
+    CloseHandle(mapping);
+    return nullptr;
+  }
+  // Left open for the life of the process.
+  return static_cast<gfx::MetricsSegment*>(data);
+}
+
+#else
+
+auto current_pid() -> uint32_t
+{
+  return static_cast<uint32_t>(getpid());
+}
+
+// Removes the name at exit. The mapping itself stays valid, threads still
+// updating metrics are unaffected.
+class SegmentName {
+ public:
+  explicit SegmentName(std::string name) : name_(std::move(name)) {}
+  ~SegmentName() { shm_unlink(name_.c_str()); }
+
+  SegmentName(const SegmentName&) = delete;
+  SegmentName& operator=(const SegmentName&) = delete;
+
+ private:
+  std::string name_;
+};
+
+auto create_segment() -> gfx::MetricsSegment*
+{
+  std::string name = segment_name(current_pid());
+  // Left behind by a crashed process with the same id.
+  shm_unlink(name.c_str());
+  int file = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (file < 0) {
+    return nullptr;
+  }
+  static SegmentName unlink_at_exit(name);
+  void* data = MAP_FAILED;
+  if (ftruncate(file, sizeof(gfx::MetricsSegment)) == 0) {
+    data = mmap(nullptr, sizeof(gfx::MetricsSegment), PROT_READ | PROT_WRITE,
+                MAP_SHARED, file, 0);
+  }
+  // The mapping keeps the segment referenced.
+  close(file);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  return static_cast<gfx::MetricsSegment*>(data);
+}
+
+#endif
+
+// Registers a metric or returns the one of that name. Returns null when the
+// registry is full or the name has another kind.
+auto register_metric(const char* name, gfx::MetricKind kind,
+                     gfx::MetricUnit unit, uint32_t& histogram)
+    -> gfx::MetricSlot*
+{
+  uint32_t count = SEGMENT->metric_count.load(std::memory_order_relaxed);
+  histogram = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    gfx::MetricSlot& slot = SEGMENT->metrics[i];
+    if (strncmp(slot.name, name, gfx::METRIC_NAME_SIZE - 1) == 0) {
+      if (slot.kind != kind) {
+        GFX_LOG_WARNING("The metric {} is registered with another kind.",
+                        name);
+        return nullptr;
+      }
+      return &slot;
+    }
+    if (slot.kind == gfx::MetricKind::histogram) {
+      ++histogram;
+    }
+  }
+  if (count == gfx::METRICS_MAX ||
+      (kind == gfx::MetricKind::histogram &&
+       HISTOGRAM_COUNT == gfx::METRICS_MAX_HISTOGRAMS)) {
+    GFX_LOG_WARNING("Too many metrics, {} is not shown.", name);
+    return nullptr;
+  }
+  gfx::MetricSlot& slot = SEGMENT->metrics[count];
+  strncpy(slot.name, name, gfx::METRIC_NAME_SIZE - 1);
+  slot.name[gfx::METRIC_NAME_SIZE - 1] = '\0';
+  slot.kind = kind;
+  slot.unit = unit;
+  slot.value.store(0, std::memory_order_relaxed);
+  if (kind == gfx::MetricKind::histogram) {
+    ++HISTOGRAM_COUNT;
+  }
+  // Readers see the slot complete once counted.
+  SEGMENT->metric_count.store(count + 1, std::memory_order_release);
+  return &slot;
+}
+
+}  // namespace
+
+auto gfx::enable_metrics() -> bool
+{
+  std::lock_guard<std::mutex> lock(REGISTRY_MUTEX);
+  if (ENABLED) {
+    return true;
+  }
+  if (LOCAL_SEGMENT.metric_count.load(std::memory_order_relaxed) > 0) {
+    // The handles already given out point into private memory, the metrics
+    // stay there.
+    GFX_LOG_WARNING(
+        "Metrics were registered before being enabled, they stay private.");
+    return false;
+  }
+  MetricsSegment* segment = create_segment();
+  if (segment == nullptr) {
+    GFX_LOG_WARNING("Could not create the shared metrics segment.");
+    return false;
+  }
+  segment->version = METRICS_VERSION;
+  segment->pid = current_pid();
+  segment->metric_count.store(0, std::memory_order_relaxed);
+  segment->magic.store(METRICS_MAGIC, std::memory_order_release);
+  SEGMENT = segment;
+  ENABLED = true;
+  GFX_LOG_INFO("Metrics shared as {}.", segment_name(segment->pid));
+  return true;
+}
+
+auto gfx::metrics_enabled() -> bool
+{
+  return ENABLED;
+}
+
+auto gfx::register_counter(const char* name, MetricUnit unit) -> Counter
+{
+  std::lock_guard<std::mutex> lock(REGISTRY_MUTEX);
+  uint32_t histogram;
+  MetricSlot* slot =
+      register_metric(name, MetricKind::counter, unit, histogram);
+  return Counter(slot != nullptr ? *slot : DUMMY_SLOT);
+}
+
+auto gfx::register_gauge(const char* name, MetricUnit unit) -> Gauge
+{
+  std::lock_guard<std::mutex> lock(REGISTRY_MUTEX);
+  uint32_t histogram;
+  MetricSlot* slot = register_metric(name, MetricKind::gauge, unit, histogram);
+  return Gauge(slot != nullptr ? *slot : DUMMY_SLOT);
+}
+
+auto gfx::register_histogram(const char* name, MetricUnit unit) -> Histogram
+{
+  std::lock_guard<std::mutex> lock(REGISTRY_MUTEX);
+  uint32_t histogram;
+  MetricSlot* slot =
+      register_metric(name, MetricKind::histogram, unit, histogram);
+  if (slot == nullptr) {
+    return Histogram(DUMMY_SLOT, DUMMY_HISTOGRAM);
+  }
+  return Histogram(*slot, SEGMENT->histograms[histogram]);
+}
+
+gfx::MetricsView::MetricsView()
+    : segment_(nullptr)
+#if defined(_WIN32)
+      ,
+      mapping_(nullptr)
+#endif
+{
+}
+
+gfx::MetricsView::~MetricsView() { close(); }
+
+#if defined(_WIN32)
+
+auto gfx::MetricsView::open(uint32_t pid) -> bool
+{
+  close();
+  mapping_ =
+      OpenFileMappingA(FILE_MAP_READ, FALSE, segment_name(pid).c_str());
+  if (mapping_ == nullptr) {
+    return false;
+  }
+  segment_ = static_cast<const MetricsSegment*>(
+      MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, sizeof(MetricsSegment)));
+  if (segment_ == nullptr ||
+      segment_->magic.load(std::memory_order_acquire) != METRICS_MAGIC ||
+      segment_->version != METRICS_VERSION) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+auto gfx::MetricsView::close() -> void
+{
+  if (segment_ != nullptr) {
+    UnmapViewOfFile(segment_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+  }
+  segment_ = nullptr;
+  mapping_ = nullptr;
+}
+
+#else
+
+auto gfx::MetricsView::open(uint32_t pid) -> bool
+{
+  close();
+  int file = shm_open(segment_name(pid).c_str(), O_RDONLY, 0);
+  if (file < 0) {
+    return false;
+  }
+  struct stat status;
+  void* data = MAP_FAILED;
+  // Smaller while the process is still creating it.
+  if (fstat(file, &status) == 0 &&
+      static_cast<size_t>(status.st_size) >= sizeof(MetricsSegment)) {
+    data = mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED, file,
+                0);
+  }
+  ::close(file);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  segment_ = static_cast<const MetricsSegment*>(data);
+  if (segment_->magic.load(std::memory_order_acquire) != METRICS_MAGIC ||
+      segment_->version != METRICS_VERSION) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+auto gfx::MetricsView::close() -> void
+{
+  if (segment_ != nullptr) {
+    munmap(const_cast<MetricsSegment*>(segment_), sizeof(MetricsSegment));
+  }
+  segment_ = nullptr;
+}
+
+#endif
+
+auto gfx::MetricsView::segment() const -> const MetricsSegment*
+{
+  return segment_;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace gfx {
+
+constexpr uint32_t METRICS_MAGIC = 0x4d4c4b56;  // "VKLM"
+constexpr uint32_t METRICS_VERSION = 1;
+constexpr uint32_t METRICS_MAX = 128;
+constexpr uint32_t METRICS_MAX_HISTOGRAMS = 16;
+constexpr uint32_t METRIC_NAME_SIZE = 48;
+// Four buckets per power of two, up to 2^32.
+constexpr uint32_t HISTOGRAM_BUCKETS = 128;
+
+enum class MetricKind : uint32_t { counter = 1, gauge, histogram };
+enum class MetricUnit : uint32_t { none, bytes, nanoseconds };
+
+// Alone on its cache line, threads updating different metrics do not share
+// lines.
+struct alignas(64) MetricSlot {
+  char name[METRIC_NAME_SIZE];
+  MetricKind kind;
+  MetricUnit unit;
+  // Total of a counter, signed value of a gauge, sample count of a
+  // histogram.
+  std::atomic<uint64_t> value;
+};
+
+struct alignas(64) HistogramSlot {
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+};
+
+// The shared memory segment, readers only load from it. Slots are written
+// before the counts that publish them.
+struct MetricsSegment {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t pid;
+  std::atomic<uint32_t> metric_count;
+  MetricSlot metrics[METRICS_MAX];
+  // Histogram i belongs to the i-th histogram metric.
+  HistogramSlot histograms[METRICS_MAX_HISTOGRAMS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Shared metrics need lock-free 64 bit atomics.");
+
+constexpr auto histogram_bucket(uint64_t value) -> uint32_t
+{
+  if (value < 4) {
+    return static_cast<uint32_t>(value);
+  }
+  uint32_t exponent = 63;
+  while ((value >> exponent) == 0) {
+    --exponent;
+  }
+  uint32_t bucket =
+      4 * (exponent - 1) + static_cast<uint32_t>((value >> (exponent - 2)) & 3);
+  return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// Smallest value of the bucket.
+constexpr auto histogram_bucket_start(uint32_t bucket) -> uint64_t
+{
+  if (bucket < 4) {
+    return bucket;
+  }
+  return uint64_t{4 + bucket % 4} << (bucket / 4 - 1);
+}
+
+class Counter {
+ public:
+  explicit Counter(MetricSlot& slot) : slot_(&slot) {}
+
+  auto add(uint64_t count = 1) -> void
+  {
+    slot_->value.fetch_add(count, std::memory_order_relaxed);
+  }
+
+ private:
+  MetricSlot* slot_;
+};
+
+class Gauge {
+ public:
+  explicit Gauge(MetricSlot& slot) : slot_(&slot) {}
+
+  auto set(int64_t value) -> void
+  {
+    slot_->value.store(static_cast<uint64_t>(value),
+                       std::memory_order_relaxed);
+  }
+  auto add(int64_t delta) -> void
+  {
+    slot_->value.fetch_add(static_cast<uint64_t>(delta),
+                           std::memory_order_relaxed);
+  }
+
+ private:
+  MetricSlot* slot_;
+};
+
+class Histogram {
+ public:
+  Histogram(MetricSlot& slot, HistogramSlot& histogram)
+      : slot_(&slot), histogram_(&histogram)
+  {
+  }
+
+  auto record(uint64_t value) -> void
+  {
+    histogram_->buckets[histogram_bucket(value)].fetch_add(
+        1, std::memory_order_relaxed);
+    histogram_->sum.fetch_add(value, std::memory_order_relaxed);
+    slot_->value.fetch_add(1, std::memory_order_relaxed);
+  }
+
+ private:
+  MetricSlot* slot_;
+  HistogramSlot* histogram_;
+};
+
+// ************************************************************ //
+// Metrics                                                      //
+//                                                              //
+// Registry of counters, gauges and histograms updated with     //
+// relaxed atomics, never a lock. Once enabled, it lives in a   //
+// shared memory segment named after the process id that        //
+// vkl-top maps read only, so watching a process costs it       //
+// nothing. Otherwise it lives in private memory and the        //
+// metrics work all the same. Registering takes a lock, keep    //
+// the handles. Registering a name again returns the same       //
+// metric, past the limits a shared dummy one.                  //
+// ************************************************************ //
+
+// Call before registering any metric. Returns false when the segment cannot
+// be created or metrics were already registered, which then stay private.
+auto enable_metrics() -> bool;
+auto metrics_enabled() -> bool;
+
+auto register_counter(const char* name, MetricUnit unit = MetricUnit::none)
+    -> Counter;
+auto register_gauge(const char* name, MetricUnit unit = MetricUnit::none)
+    -> Gauge;
+auto register_histogram(const char* name,
+                        MetricUnit unit = MetricUnit::nanoseconds)
+    -> Histogram;
+
+// Read only view of the metrics of another process.
+class MetricsView {
+ public:
+  MetricsView();
+  ~MetricsView();
+
+  MetricsView(const MetricsView&) = delete;
+  MetricsView& operator=(const MetricsView&) = delete;
+
+  // Returns false when the process has no metrics or another version.
+  auto open(uint32_t pid) -> bool;
+  auto close() -> void;
+  auto segment() const -> const MetricsSegment*;
+
+ private:
+  const MetricsSegment* segment_;
+#if defined(_WIN32)
+  void* mapping_;
+#endif
+};
+
+}  // namespace gfx
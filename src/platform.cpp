@@ -1,5 +1,7 @@
 #include "platform.h"
-#include <iostream>
+#include <cstring>
+#include <exception>
+#include "log.h"
 
 os::Window::Window() : parameters_() {}
 
@@ -62,7 +64,7 @@ auto os::Window::create(const char* title) -> void
   wcex.hIconSm = NULL;
 
   if (!RegisterClassEx(&wcex)) {
-    std::cerr << "Failed to register window class ex.\n";
+    GFX_LOG_ERROR("Failed to register window class ex.");
     std::terminate();
   }
 
@@ -71,247 +73,88 @@ auto os::Window::create(const char* title) -> void
       CreateWindow(WND_CLASS_NAME, title, WS_OVERLAPPEDWINDOW, 20, 20, 500, 500,
                    nullptr, nullptr, parameters_.instance, nullptr);
   if (!parameters_.handle) {
-    std::cerr << "Failed to create window.\n";
+    GFX_LOG_ERROR("Failed to create window.");
     std::terminate();
   }
 }
 
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
 
-Window::~Window()
+os::Window::~Window()
 {
-  xcb_destroy_window(Parameters.Connection, Parameters.Handle);
-  xcb_disconnect(Parameters.Connection);
+  if (parameters_.connection == nullptr) {
+    return;
+  }
+  if (parameters_.handle != 0) {
+    xcb_destroy_window(parameters_.connection, parameters_.handle);
+  }
+  xcb_disconnect(parameters_.connection);
 }
 
-bool Window::Create(const char *title)
+auto os::Window::create(const char* title) -> void
 {
-  int screen_index;
-  Parameters.Connection = xcb_connect(nullptr, &screen_index);
-
-  if (!Parameters.Connection) {
-    return false;
+  int screen_index = 0;
+  parameters_.connection = xcb_connect(nullptr, &screen_index);
+  if (xcb_connection_has_error(parameters_.connection)) {
+    GFX_LOG_ERROR("Failed to connect to the X server.");
+    std::terminate();
   }
 
-  const xcb_setup_t *setup = xcb_get_setup(Parameters.Connection);
+  const xcb_setup_t* setup = xcb_get_setup(parameters_.connection);
   xcb_screen_iterator_t screen_iterator = xcb_setup_roots_iterator(setup);
-
   while (screen_index-- > 0) {
     xcb_screen_next(&screen_iterator);
   }
+  xcb_screen_t* screen = screen_iterator.data;
 
-  xcb_screen_t *screen = screen_iterator.data;
-
-  Parameters.Handle = xcb_generate_id(Parameters.Connection);
-
+  // Create window
+  parameters_.handle = xcb_generate_id(parameters_.connection);
   uint32_t value_list[] = {screen->white_pixel,
                            XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_KEY_PRESS |
                                XCB_EVENT_MASK_STRUCTURE_NOTIFY};
-
-  xcb_create_window(Parameters.Connection, XCB_COPY_FROM_PARENT,
-                    Parameters.Handle, screen->root, 20, 20, 500, 500, 0,
+  xcb_create_window(parameters_.connection, XCB_COPY_FROM_PARENT,
+                    parameters_.handle, screen->root, 20, 20, 500, 500, 0,
                     XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
                     XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, value_list);
-
-  xcb_flush(Parameters.Connection);
-
-  xcb_change_property(Parameters.Connection, XCB_PROP_MODE_REPLACE,
-                      Parameters.Handle, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
-                      strlen(title), title);
-
-  return true;
-}
-
-bool Window::RenderingLoop(ProjectBase &project) const
-{
-  // Prepare notification for window destruction
-  xcb_intern_atom_cookie_t protocols_cookie =
-      xcb_intern_atom(Parameters.Connection, 1, 12, "WM_PROTOCOLS");
-  xcb_intern_atom_reply_t *protocols_reply =
-      xcb_intern_atom_reply(Parameters.Connection, protocols_cookie, 0);
-  xcb_intern_atom_cookie_t delete_cookie =
-      xcb_intern_atom(Parameters.Connection, 0, 16, "WM_DELETE_WINDOW");
-  xcb_intern_atom_reply_t *delete_reply =
-      xcb_intern_atom_reply(Parameters.Connection, delete_cookie, 0);
-  xcb_change_property(Parameters.Connection, XCB_PROP_MODE_REPLACE,
-                      Parameters.Handle, (*protocols_reply).atom, 4, 32, 1,
-                      &(*delete_reply).atom);
-  free(protocols_reply);
-
-  // Display window
-  xcb_map_window(Parameters.Connection, Parameters.Handle);
-  xcb_flush(Parameters.Connection);
-
-  // Main message loop
-  xcb_generic_event_t *event;
-  bool loop = true;
-  bool resize = false;
-  bool result = true;
-
-  while (loop) {
-    event = xcb_poll_for_event(Parameters.Connection);
-
-    if (event) {
-      // Process events
-      switch (event->response_type & 0x7f) {
-          // Resize
-        case XCB_CONFIGURE_NOTIFY: {
-          xcb_configure_notify_event_t *configure_event =
-              (xcb_configure_notify_event_t *)event;
-          static uint16_t width = configure_event->width;
-          static uint16_t height = configure_event->height;
-
-          if (((configure_event->width > 0) &&
-               (width != configure_event->width)) ||
-              ((configure_event->height > 0) &&
-               (height != configure_event->height))) {
-            resize = true;
-            width = configure_event->width;
-            height = configure_event->height;
-          }
-        } break;
-          // Close
-        case XCB_CLIENT_MESSAGE:
-          if ((*(xcb_client_message_event_t *)event).data.data32[0] ==
-              (*delete_reply).atom) {
-            loop = false;
-            free(delete_reply);
-          }
-          break;
-        case XCB_KEY_PRESS:
-          loop = false;
-          break;
-      }
-      free(event);
-    }
-    else {
-      // Draw
-      if (resize) {
-        resize = false;
-        if (!project.OnWindowSizeChanged()) {
-          result = false;
-          break;
-        }
-      }
-      if (project.ReadyToDraw()) {
-        if (!project.Draw()) {
-          result = false;
-          break;
-        }
-      }
-      else {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      }
-    }
-  }
-
-  return result;
+  xcb_change_property(parameters_.connection, XCB_PROP_MODE_REPLACE,
+                      parameters_.handle, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+                      static_cast<uint32_t>(strlen(title)), title);
+  xcb_map_window(parameters_.connection, parameters_.handle);
+  xcb_flush(parameters_.connection);
 }
 
 #elif defined(VK_USE_PLATFORM_XLIB_KHR)
 
-Window::~Window()
-{
-  XDestroyWindow(Parameters.DisplayPtr, Parameters.Handle);
-  XCloseDisplay(Parameters.DisplayPtr);
-}
-
-bool Window::Create(const char *title)
+os::Window::~Window()
 {
-  Parameters.DisplayPtr = XOpenDisplay(nullptr);
-  if (!Parameters.DisplayPtr) {
-    return false;
+  if (parameters_.display_ptr == nullptr) {
+    return;
   }
-
-  int default_screen = DefaultScreen(Parameters.DisplayPtr);
-
-  Parameters.Handle = XCreateSimpleWindow(
-      Parameters.DisplayPtr, DefaultRootWindow(Parameters.DisplayPtr), 20, 20,
-      500, 500, 1, BlackPixel(Parameters.DisplayPtr, default_screen),
-      WhitePixel(Parameters.DisplayPtr, default_screen));
-
-  // XSync( Parameters.DisplayPtr, false );
-  XSetStandardProperties(Parameters.DisplayPtr, Parameters.Handle, title, title,
-                         None, nullptr, 0, nullptr);
-  XSelectInput(Parameters.DisplayPtr, Parameters.Handle,
-               ExposureMask | KeyPressMask | StructureNotifyMask);
-
-  return true;
+  if (parameters_.handle != 0) {
+    XDestroyWindow(parameters_.display_ptr, parameters_.handle);
+  }
+  XCloseDisplay(parameters_.display_ptr);
 }
 
-bool Window::RenderingLoop(ProjectBase &project) const
+auto os::Window::create(const char* title) -> void
 {
-  // Prepare notification for window destruction
-  Atom delete_window_atom;
-  delete_window_atom =
-      XInternAtom(Parameters.DisplayPtr, "WM_DELETE_WINDOW", false);
-  XSetWMProtocols(Parameters.DisplayPtr, Parameters.Handle, &delete_window_atom,
-                  1);
-
-  // Display window
-  XClearWindow(Parameters.DisplayPtr, Parameters.Handle);
-  XMapWindow(Parameters.DisplayPtr, Parameters.Handle);
-
-  // Main message loop
-  XEvent event;
-  bool loop = true;
-  bool resize = false;
-  bool result = true;
-
-  while (loop) {
-    if (XPending(Parameters.DisplayPtr)) {
-      XNextEvent(Parameters.DisplayPtr, &event);
-      switch (event.type) {
-          // Process events
-        case ConfigureNotify: {
-          static int width = event.xconfigure.width;
-          static int height = event.xconfigure.height;
-
-          if (((event.xconfigure.width > 0) &&
-               (event.xconfigure.width != width)) ||
-              ((event.xconfigure.height > 0) &&
-               (event.xconfigure.width != height))) {
-            width = event.xconfigure.width;
-            height = event.xconfigure.height;
-            resize = true;
-          }
-        } break;
-        case KeyPress:
-          loop = false;
-          break;
-        case DestroyNotify:
-          loop = false;
-          break;
-        case ClientMessage:
-          if (static_cast<unsigned int>(event.xclient.data.l[0]) ==
-              delete_window_atom) {
-            loop = false;
-          }
-          break;
-      }
-    }
-    else {
-      // Draw
-      if (resize) {
-        resize = false;
-        if (!project.OnWindowSizeChanged()) {
-          result = false;
-          break;
-        }
-      }
-      if (project.ReadyToDraw()) {
-        if (!project.Draw()) {
-          result = false;
-          break;
-        }
-      }
-      else {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      }
-    }
+  parameters_.display_ptr = XOpenDisplay(nullptr);
+  if (parameters_.display_ptr == nullptr) {
+    GFX_LOG_ERROR("Failed to open the X display.");
+    std::terminate();
   }
 
-  return result;
+  // Create window
+  int default_screen = DefaultScreen(parameters_.display_ptr);
+  parameters_.handle = XCreateSimpleWindow(
+      parameters_.display_ptr, DefaultRootWindow(parameters_.display_ptr), 20,
+      20, 500, 500, 1, BlackPixel(parameters_.display_ptr, default_screen),
+      WhitePixel(parameters_.display_ptr, default_screen));
+  XStoreName(parameters_.display_ptr, parameters_.handle, title);
+  XSelectInput(parameters_.display_ptr, parameters_.handle,
+               ExposureMask | KeyPressMask | StructureNotifyMask);
+  XMapWindow(parameters_.display_ptr, parameters_.handle);
+  XFlush(parameters_.display_ptr);
 }
 
 #endif
@@ -4,6 +4,12 @@
 #define NOMINMAX
 #include <Windows.h>
 
+#elif defined(VK_USE_PLATFORM_XCB_KHR)
+#include <xcb/xcb.h>
+
+#elif defined(VK_USE_PLATFORM_XLIB_KHR)
+#include <X11/Xlib.h>
+
 #endif
 
 namespace os {
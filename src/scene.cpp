@@ -0,0 +1,519 @@
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include "log.h"
+
+namespace gfx {
+
+namespace {
+
+// Rows per task of the parallel transform update.
+constexpr uint32_t TRANSFORM_GRAIN = 4096;
+
+constexpr uint32_t NO_MESH = UINT32_MAX;
+constexpr Entity NO_ENTITY = {UINT32_MAX, 0};
+
+auto has(ComponentMask mask, ComponentMask components) -> bool
+{
+  return (mask & components) == components;
+}
+
+}  // namespace
+
+}  // namespace gfx
+
+gfx::Archetype::Archetype(ComponentMask mask)
+    : mask_(mask), columns_(COLUMN_COUNT)
+{
+}
+
+auto gfx::Archetype::mask() const -> ComponentMask { return mask_; }
+
+auto gfx::Archetype::size() const -> uint32_t
+{
+  return static_cast<uint32_t>(entities_.size());
+}
+
+auto gfx::Archetype::entity(uint32_t row) const -> Entity
+{
+  return entities_[row];
+}
+
+auto gfx::Archetype::transforms() -> math::TransformSoA
+{
+  return {{column_(TRANSLATION), column_(TRANSLATION + 1),
+           column_(TRANSLATION + 2)},
+          {column_(ROTATION), column_(ROTATION + 1), column_(ROTATION + 2),
+           column_(ROTATION + 3)},
+          {column_(SCALE), column_(SCALE + 1), column_(SCALE + 2)}};
+}
+
+auto gfx::Archetype::world_transforms() -> math::AffineSoA
+{
+  math::AffineSoA soa;
+  for (uint32_t i = 0; i < 12; ++i) {
+    soa.rows[i] = column_(WORLD_TRANSFORM + i);
+  }
+  return soa;
+}
+
+auto gfx::Archetype::local_bounds() -> math::SphereSoA
+{
+  return {{column_(LOCAL_BOUNDS), column_(LOCAL_BOUNDS + 1),
+           column_(LOCAL_BOUNDS + 2)},
+          column_(LOCAL_BOUNDS + 3)};
+}
+
+auto gfx::Archetype::world_bounds() -> math::SphereSoA
+{
+  return {{column_(WORLD_BOUNDS), column_(WORLD_BOUNDS + 1),
+           column_(WORLD_BOUNDS + 2)},
+          column_(WORLD_BOUNDS + 3)};
+}
+
+auto gfx::Archetype::meshes() -> uint32_t* { return meshes_.data(); }
+
+auto gfx::Archetype::materials() -> uint32_t* { return materials_.data(); }
+
+auto gfx::Archetype::mark_transforms_dirty(uint32_t begin, uint32_t end)
+    -> void
+{
+  dirty_transforms_.add(begin, end);
+}
+
+auto gfx::Archetype::column_(uint32_t column) -> float*
+{
+  return columns_[column].data();
+}
+
+auto gfx::Archetype::push_(Entity entity) -> uint32_t
+{
+  uint32_t row = size();
+  entities_.push_back(entity);
+
+  auto push_values = [this](uint32_t first,
+                            std::initializer_list<float> values) {
+    uint32_t column = first;
+    for (float value : values) {
+      columns_[column++].push_back(value);
+    }
+  };
+  if (mask_ & TRANSFORM_COMPONENT) {
+    push_values(TRANSLATION, {0.0f, 0.0f, 0.0f});
+    push_values(ROTATION, {0.0f, 0.0f, 0.0f, 1.0f});
+    push_values(SCALE, {1.0f, 1.0f, 1.0f});
+    push_values(WORLD_TRANSFORM, {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+                                  0.0f, 0.0f, 0.0f, 1.0f, 0.0f});
+  }
+  if (mask_ & BOUNDS_COMPONENT) {
+    push_values(LOCAL_BOUNDS, {0.0f, 0.0f, 0.0f, 0.0f});
+    push_values(WORLD_BOUNDS, {0.0f, 0.0f, 0.0f, 0.0f});
+  }
+  if (mask_ & MESH_COMPONENT) {
+    meshes_.push_back(NO_MESH);
+  }
+  if (mask_ & MATERIAL_COMPONENT) {
+    materials_.push_back(0);
+  }
+
+  mark_row_dirty_(row);
+  return row;
+}
+
+auto gfx::Archetype::remove_(uint32_t row) -> Entity
+{
+  uint32_t last = size() - 1;
+  Entity moved = row != last ? entities_[last] : NO_ENTITY;
+  auto swap_remove = [row](auto& values) {
+    if (!values.empty()) {
+      values[row] = values.back();
+      values.pop_back();
+    }
+  };
+  swap_remove(entities_);
+  for (auto& column : columns_) {
+    swap_remove(column);
+  }
+  swap_remove(meshes_);
+  swap_remove(materials_);
+
+  dirty_transforms_.truncate(last);
+  dirty_instances_.truncate(last);
+  if (row != last) {
+    mark_row_dirty_(row);
+  }
+  return moved;
+}
+
+auto gfx::Archetype::mark_row_dirty_(uint32_t row) -> void
+{
+  if (mask_ & TRANSFORM_COMPONENT) {
+    dirty_transforms_.add(row);
+  }
+  if (has(mask_, RENDERABLE)) {
+    dirty_instances_.add(row);
+  }
+}
+
+auto gfx::Archetype::copy_row_(const Archetype& source, uint32_t source_row,
+                               uint32_t row) -> void
+{
+  for (uint32_t column = 0; column < COLUMN_COUNT; ++column) {
+    if (!columns_[column].empty() && !source.columns_[column].empty()) {
+      columns_[column][row] = source.columns_[column][source_row];
+    }
+  }
+  if (!meshes_.empty() && !source.meshes_.empty()) {
+    meshes_[row] = source.meshes_[source_row];
+  }
+  if (!materials_.empty() && !source.materials_.empty()) {
+    materials_[row] = source.materials_[source_row];
+  }
+}
+
+gfx::Scene::Scene(ThreadPool& thread_pool)
+    : thread_pool_(thread_pool),
+      entity_count_(0),
+      first_renumbered_(SIZE_MAX),
+      updates_{0, {}},
+      updated_transforms_(0),
+      uploaded_instances_(0),
+      update_ms_(0.0)
+{
+}
+
+auto gfx::Scene::create(ComponentMask components) -> Entity
+{
+  uint32_t index;
+  if (!free_indices_.empty()) {
+    index = free_indices_.back();
+    free_indices_.pop_back();
+  }
+  else {
+    index = static_cast<uint32_t>(locations_.size());
+    locations_.push_back({0, nullptr, 0});
+  }
+
+  Location& location = locations_[index];
+  Entity entity = {index, location.generation};
+  location.archetype = &archetype_(components);
+  location.row = location.archetype->push_(entity);
+  renumber_after_(*location.archetype);
+  ++entity_count_;
+  return entity;
+}
+
+auto gfx::Scene::destroy(Entity entity) -> void
+{
+  const Location& location = location_(entity);
+  remove_row_(*location.archetype, location.row);
+
+  Location& freed = locations_[entity.index];
+  freed.archetype = nullptr;
+  ++freed.generation;
+  free_indices_.push_back(entity.index);
+  --entity_count_;
+}
+
+auto gfx::Scene::alive(Entity entity) const -> bool
+{
+  return entity.index < locations_.size() &&
+         locations_[entity.index].archetype != nullptr &&
+         locations_[entity.index].generation == entity.generation;
+}
+
+auto gfx::Scene::add_components(Entity entity, ComponentMask components)
+    -> void
+{
+  move_(entity, location_(entity).archetype->mask() | components);
+}
+
+auto gfx::Scene::remove_components(Entity entity, ComponentMask components)
+    -> void
+{
+  move_(entity, location_(entity).archetype->mask() & ~components);
+}
+
+auto gfx::Scene::components(Entity entity) const -> ComponentMask
+{
+  return location_(entity).archetype->mask();
+}
+
+auto gfx::Scene::set_transform(Entity entity, math::Vec3 translation,
+                               math::Quat rotation, math::Vec3 scale) -> void
+{
+  const Location& location = location_(entity);
+  Archetype& archetype = *location.archetype;
+  if (!(archetype.mask() & TRANSFORM_COMPONENT)) {
+    GFX_LOG_ERROR("The entity has no transform!");
+    std::terminate();
+  }
+  float values[10] = {translation.x, translation.y, translation.z,
+                      rotation.x,    rotation.y,    rotation.z,
+                      rotation.w,    scale.x,       scale.y,
+                      scale.z};
+  for (uint32_t i = 0; i < 10; ++i) {
+    archetype.columns_[Archetype::TRANSLATION + i][location.row] = values[i];
+  }
+  archetype.dirty_transforms_.add(location.row);
+}
+
+auto gfx::Scene::set_bounds(Entity entity, const math::Sphere& bounds)
+    -> void
+{
+  const Location& location = location_(entity);
+  Archetype& archetype = *location.archetype;
+  if (!(archetype.mask() & BOUNDS_COMPONENT)) {
+    GFX_LOG_ERROR("The entity has no bounds!");
+    std::terminate();
+  }
+  float values[4] = {bounds.center.x, bounds.center.y, bounds.center.z,
+                     bounds.radius};
+  for (uint32_t i = 0; i < 4; ++i) {
+    archetype.columns_[Archetype::LOCAL_BOUNDS + i][location.row] = values[i];
+    // Without a transform the local bounds are the world bounds.
+    archetype.columns_[Archetype::WORLD_BOUNDS + i][location.row] = values[i];
+  }
+  archetype.mark_row_dirty_(location.row);
+}
+
+auto gfx::Scene::set_mesh(Entity entity, uint32_t mesh) -> void
+{
+  const Location& location = location_(entity);
+  Archetype& archetype = *location.archetype;
+  if (!(archetype.mask() & MESH_COMPONENT)) {
+    GFX_LOG_ERROR("The entity has no mesh!");
+    std::terminate();
+  }
+  archetype.meshes_[location.row] = mesh;
+  archetype.dirty_instances_.add(location.row);
+}
+
+auto gfx::Scene::set_material(Entity entity, uint32_t material) -> void
+{
+  const Location& location = location_(entity);
+  Archetype& archetype = *location.archetype;
+  if (!(archetype.mask() & MATERIAL_COMPONENT)) {
+    GFX_LOG_ERROR("The entity has no material!");
+    std::terminate();
+  }
+  archetype.materials_[location.row] = material;
+}
+
+auto gfx::Scene::world_transform(Entity entity) const -> math::Affine
+{
+  const Location& location = location_(entity);
+  const Archetype& archetype = *location.archetype;
+  math::Affine affine = {};
+  if (archetype.mask() & TRANSFORM_COMPONENT) {
+    for (uint32_t i = 0; i < 12; ++i) {
+      affine.rows[i] =
+          archetype.columns_[Archetype::WORLD_TRANSFORM + i][location.row];
+    }
+  }
+  else {
+    affine.rows[0] = affine.rows[5] = affine.rows[10] = 1.0f;
+  }
+  return affine;
+}
+
+auto gfx::Scene::world_bounds(Entity entity) const -> math::Sphere
+{
+  const Location& location = location_(entity);
+  const Archetype& archetype = *location.archetype;
+  if (!(archetype.mask() & BOUNDS_COMPONENT)) {
+    return {{0.0f, 0.0f, 0.0f}, 0.0f};
+  }
+  const auto& columns = archetype.columns_;
+  return {{columns[Archetype::WORLD_BOUNDS][location.row],
+           columns[Archetype::WORLD_BOUNDS + 1][location.row],
+           columns[Archetype::WORLD_BOUNDS + 2][location.row]},
+          columns[Archetype::WORLD_BOUNDS + 3][location.row]};
+}
+
+auto gfx::Scene::for_each(ComponentMask components,
+                          const std::function<void(Archetype&)>& body) -> void
+{
+  for (auto& archetype : archetypes_) {
+    if (has(archetype->mask(), components) && archetype->size() > 0) {
+      body(*archetype);
+    }
+  }
+}
+
+auto gfx::Scene::parallel_for_each(
+    ComponentMask components, uint32_t grain,
+    const std::function<void(Archetype&, uint32_t, uint32_t)>& body) -> void
+{
+  for_each(components, [this, grain, &body](Archetype& archetype) {
+    thread_pool_.parallel_for(archetype.size(), grain,
+                              [&archetype, &body](uint32_t begin,
+                                                  uint32_t end) {
+                                body(archetype, begin, end);
+                              });
+  });
+}
+
+auto gfx::Scene::update_transforms() -> void
+{
+  auto start = std::chrono::steady_clock::now();
+  updated_transforms_ = 0;
+
+  for_each(TRANSFORM_COMPONENT, [this](Archetype& archetype) {
+    bool bounds = (archetype.mask() & BOUNDS_COMPONENT) != 0;
+    bool renderable = has(archetype.mask(), RENDERABLE);
+    math::TransformSoA transforms = archetype.transforms();
+    math::AffineSoA world = archetype.world_transforms();
+
+    for (const DirtyRanges::Range& range :
+         archetype.dirty_transforms_.ranges()) {
+      thread_pool_.parallel_for(
+          range.end - range.begin, TRANSFORM_GRAIN,
+          [&](uint32_t begin, uint32_t end) {
+            uint32_t first = range.begin + begin;
+            math::compose(math::offset(transforms, first), end - begin,
+                          math::offset(world, first));
+            if (bounds) {
+              math::transform_spheres(
+                  math::offset(world, first),
+                  math::offset(archetype.local_bounds(), first), end - begin,
+                  math::offset(archetype.world_bounds(), first));
+            }
+          });
+      if (renderable) {
+        archetype.dirty_instances_.add(range.begin, range.end);
+      }
+    }
+    updated_transforms_ += archetype.dirty_transforms_.element_count();
+    archetype.dirty_transforms_.clear();
+  });
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  update_ms_ = elapsed.count();
+}
+
+auto gfx::Scene::collect_instance_updates() -> const InstanceUpdates&
+{
+  // Renumbered archetypes are sent whole.
+  uint32_t instance_count = 0;
+  uint32_t staged_count = 0;
+  for (size_t i = 0; i < archetypes_.size(); ++i) {
+    Archetype& archetype = *archetypes_[i];
+    if (!has(archetype.mask(), RENDERABLE)) {
+      continue;
+    }
+    if (i >= first_renumbered_) {
+      archetype.dirty_instances_.add(0, archetype.size());
+    }
+    instance_count += archetype.size();
+    staged_count += archetype.dirty_instances_.element_count();
+  }
+  first_renumbered_ = SIZE_MAX;
+
+  // Sized up front, the ranges point into them.
+  staged_transforms_.resize(staged_count);
+  staged_meshes_.resize(staged_count);
+  updates_.instance_count = instance_count;
+  updates_.ranges.clear();
+
+  uint32_t first_instance = 0;
+  uint32_t staged = 0;
+  for (auto& archetype : archetypes_) {
+    if (!has(archetype->mask(), RENDERABLE)) {
+      continue;
+    }
+    math::AffineSoA world = archetype->world_transforms();
+    const uint32_t* meshes = archetype->meshes();
+    for (const DirtyRanges::Range& range :
+         archetype->dirty_instances_.ranges()) {
+      updates_.ranges.push_back({first_instance + range.begin,
+                                 range.end - range.begin,
+                                 staged_transforms_.data() + staged,
+                                 staged_meshes_.data() + staged});
+      for (uint32_t row = range.begin; row < range.end; ++row, ++staged) {
+        for (uint32_t i = 0; i < 12; ++i) {
+          staged_transforms_[staged].rows[i] = world.rows[i][row];
+        }
+        staged_meshes_[staged] = meshes[row];
+      }
+    }
+    archetype->dirty_instances_.clear();
+    first_instance += archetype->size();
+  }
+
+  uploaded_instances_ = staged_count;
+  return updates_;
+}
+
+auto gfx::Scene::stats() const -> SceneStats
+{
+  SceneStats stats;
+  stats.entities = entity_count_;
+  stats.archetypes = static_cast<uint32_t>(archetypes_.size());
+  stats.updated_transforms = updated_transforms_;
+  stats.uploaded_instances = uploaded_instances_;
+  stats.update_ms = update_ms_;
+  return stats;
+}
+
+auto gfx::Scene::archetype_(ComponentMask mask) -> Archetype&
+{
+  for (auto& archetype : archetypes_) {
+    if (archetype->mask() == mask) {
+      return *archetype;
+    }
+  }
+  // Appended last, so no existing instance is renumbered.
+  archetypes_.push_back(std::make_unique<Archetype>(mask));
+  return *archetypes_.back();
+}
+
+auto gfx::Scene::location_(Entity entity) const -> const Location&
+{
+  if (!alive(entity)) {
+    GFX_LOG_ERROR("Use of a destroyed entity!");
+    std::terminate();
+  }
+  return locations_[entity.index];
+}
+
+auto gfx::Scene::move_(Entity entity, ComponentMask mask) -> void
+{
+  Location location = location_(entity);
+  if (location.archetype->mask() == mask) {
+    return;
+  }
+  Archetype& target = archetype_(mask);
+  uint32_t row = target.push_(entity);
+  target.copy_row_(*location.archetype, location.row, row);
+  renumber_after_(target);
+  remove_row_(*location.archetype, location.row);
+
+  locations_[entity.index].archetype = &target;
+  locations_[entity.index].row = row;
+}
+
+auto gfx::Scene::remove_row_(Archetype& archetype, uint32_t row) -> void
+{
+  Entity moved = archetype.remove_(row);
+  if (moved.index != NO_ENTITY.index) {
+    locations_[moved.index].row = row;
+  }
+  renumber_after_(archetype);
+}
+
+auto gfx::Scene::renumber_after_(const Archetype& archetype) -> void
+{
+  if (!has(archetype.mask(), RENDERABLE)) {
+    return;
+  }
+  for (size_t i = 0; i < archetypes_.size(); ++i) {
+    if (archetypes_[i].get() == &archetype) {
+      first_renumbered_ = std::min(first_renumbered_, i + 1);
+      return;
+    }
+  }
+}
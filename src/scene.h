@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "dirty_ranges.h"
+#include "math_kernels.h"
+#include "thread_pool.h"
+
+namespace gfx {
+
+// Bit per component type, an archetype holds one combination.
+using ComponentMask = uint32_t;
+// Translation, rotation and scale, and the world transform composed from
+// them.
+constexpr ComponentMask TRANSFORM_COMPONENT = 1 << 0;
+// Local bounding sphere, and its world space version.
+constexpr ComponentMask BOUNDS_COMPONENT = 1 << 1;
+// Index of a mesh of the GeometryBatcher.
+constexpr ComponentMask MESH_COMPONENT = 1 << 2;
+constexpr ComponentMask MATERIAL_COMPONENT = 1 << 3;
+// Entities drawn by the renderer.
+constexpr ComponentMask RENDERABLE = TRANSFORM_COMPONENT | MESH_COMPONENT;
+
+struct Entity {
+  uint32_t index;
+  // Detects handles of destroyed entities whose slot was reused.
+  uint32_t generation;
+};
+
+// ************************************************************ //
+// Archetype                                                    //
+//                                                              //
+// Storage of every entity with the same set of components,     //
+// one array per component field. Rows are dense: removing an   //
+// entity moves the last row into its place, so systems iterate //
+// over plain arrays without holes.                             //
+// ************************************************************ //
+class Archetype {
+ public:
+  explicit Archetype(ComponentMask mask);
+
+  auto mask() const -> ComponentMask;
+  auto size() const -> uint32_t;
+  auto entity(uint32_t row) const -> Entity;
+
+  // Views over all rows, only valid for the archetype's components and
+  // until rows are added or removed.
+  auto transforms() -> math::TransformSoA;
+  auto world_transforms() -> math::AffineSoA;
+  auto local_bounds() -> math::SphereSoA;
+  auto world_bounds() -> math::SphereSoA;
+  auto meshes() -> uint32_t*;
+  auto materials() -> uint32_t*;
+
+  // Systems writing transforms mark the rows, update_transforms() then
+  // recomputes their world transforms and bounds.
+  auto mark_transforms_dirty(uint32_t begin, uint32_t end) -> void;
+
+ private:
+  friend class Scene;
+
+  // Float columns, one per component field.
+  enum Column : uint32_t {
+    TRANSLATION = 0,
+    ROTATION = TRANSLATION + 3,
+    SCALE = ROTATION + 4,
+    WORLD_TRANSFORM = SCALE + 3,
+    LOCAL_BOUNDS = WORLD_TRANSFORM + 12,
+    WORLD_BOUNDS = LOCAL_BOUNDS + 4,
+    COLUMN_COUNT = WORLD_BOUNDS + 4
+  };
+
+  auto column_(uint32_t column) -> float*;
+  // Appends a row with default components.
+  auto push_(Entity entity) -> uint32_t;
+  // Returns the entity moved into the row, if any.
+  auto remove_(uint32_t row) -> Entity;
+  auto mark_row_dirty_(uint32_t row) -> void;
+  // Copies the components both archetypes have.
+  auto copy_row_(const Archetype& source, uint32_t source_row, uint32_t row)
+      -> void;
+
+  ComponentMask mask_;
+  std::vector<Entity> entities_;
+  // Columns of components the archetype lacks stay empty.
+  std::vector<std::vector<float>> columns_;
+  std::vector<uint32_t> meshes_;
+  std::vector<uint32_t> materials_;
+  DirtyRanges dirty_transforms_;
+  // Rows whose instance changed since the last collect_instance_updates().
+  DirtyRanges dirty_instances_;
+};
+
+// Changed instances, AoS for the upload. Instance i of the renderer is the
+// i-th renderable row, archetype after archetype.
+struct InstanceUpdates {
+  struct Range {
+    uint32_t first;
+    uint32_t count;
+    const math::Affine* transforms;
+    const uint32_t* meshes;
+  };
+
+  uint32_t instance_count;
+  std::vector<Range> ranges;
+};
+
+struct SceneStats {
+  uint32_t entities;
+  uint32_t archetypes;
+  // Rows recomputed by the last update_transforms().
+  uint32_t updated_transforms;
+  // Instances handed out by the last collect_instance_updates().
+  uint32_t uploaded_instances;
+  double update_ms;
+};
+
+// ************************************************************ //
+// Scene                                                        //
+//                                                              //
+// Entity storage grouped by archetype. update_transforms()     //
+// recomputes the world transforms and bounds of the changed    //
+// rows on the thread pool with the SoA math kernels, and       //
+// collect_instance_updates() hands the renderer only the       //
+// instances changed since the last call. Adding or removing    //
+// renderable entities renumbers the instances of the following //
+// archetypes, which are then sent again.                       //
+// ************************************************************ //
+class Scene {
+ public:
+  explicit Scene(ThreadPool& thread_pool);
+
+  Scene(const Scene&) = delete;
+  Scene& operator=(const Scene&) = delete;
+
+  auto create(ComponentMask components) -> Entity;
+  auto destroy(Entity entity) -> void;
+  auto alive(Entity entity) const -> bool;
+  auto add_components(Entity entity, ComponentMask components) -> void;
+  auto remove_components(Entity entity, ComponentMask components) -> void;
+  auto components(Entity entity) const -> ComponentMask;
+
+  auto set_transform(Entity entity, math::Vec3 translation,
+                     math::Quat rotation, math::Vec3 scale) -> void;
+  auto set_bounds(Entity entity, const math::Sphere& bounds) -> void;
+  auto set_mesh(Entity entity, uint32_t mesh) -> void;
+  auto set_material(Entity entity, uint32_t material) -> void;
+  // As of the last update_transforms().
+  auto world_transform(Entity entity) const -> math::Affine;
+  auto world_bounds(Entity entity) const -> math::Sphere;
+
+  // Dense iteration over the archetypes holding all the components.
+  auto for_each(ComponentMask components,
+                const std::function<void(Archetype&)>& body) -> void;
+  // Same, with the rows of each archetype split across the thread pool.
+  auto parallel_for_each(
+      ComponentMask components, uint32_t grain,
+      const std::function<void(Archetype&, uint32_t, uint32_t)>& body)
+      -> void;
+
+  auto update_transforms() -> void;
+  // The returned ranges stay valid until the next call.
+  auto collect_instance_updates() -> const InstanceUpdates&;
+
+  auto stats() const -> SceneStats;
+
+ private:
+  struct Location {
+    uint32_t generation;
+    Archetype* archetype;
+    uint32_t row;
+  };
+
+  auto archetype_(ComponentMask mask) -> Archetype&;
+  auto location_(Entity entity) const -> const Location&;
+  auto move_(Entity entity, ComponentMask mask) -> void;
+  auto remove_row_(Archetype& archetype, uint32_t row) -> void;
+  // The archetype changed size, the instances after it are renumbered.
+  auto renumber_after_(const Archetype& archetype) -> void;
+
+  ThreadPool& thread_pool_;
+  std::vector<std::unique_ptr<Archetype>> archetypes_;
+  std::vector<Location> locations_;
+  std::vector<uint32_t> free_indices_;
+  uint32_t entity_count_;
+
+  // First archetype whose instances were renumbered, SIZE_MAX when none.
+  size_t first_renumbered_;
+  InstanceUpdates updates_;
+  std::vector<math::Affine> staged_transforms_;
+  std::vector<uint32_t> staged_meshes_;
+
+  uint32_t updated_transforms_;
+  uint32_t uploaded_instances_;
+  double update_ms_;
+};
+
+}  // namespace gfx
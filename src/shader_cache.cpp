@@ -0,0 +1,460 @@
+#include "shader_cache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "host_allocator.h"
+#include "log.h"
+#include "mapped_file.h"
+#include "vulkan_builders.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_recovery.h"
+
+namespace {
+
+constexpr uint32_t INDEX_MAGIC = 0x43534b56;  // "VKSC"
+// Bump when the layout of the index or of ShaderReflection changes.
+constexpr uint32_t INDEX_VERSION = 1;
+
+// Bounds checked reads from the mapped index.
+class IndexReader {
+ public:
+  IndexReader(const std::byte* data, size_t size)
+      : data_(data), end_(data + size)
+  {
+  }
+
+  template <typename T>
+  auto read(T& value) -> bool
+  {
+    if (static_cast<size_t>(end_ - data_) < sizeof(T)) {
+      return false;
+    }
+    memcpy(&value, data_, sizeof(T));
+    data_ += sizeof(T);
+    return true;
+  }
+
+  auto read(std::string& value, size_t size) -> bool
+  {
+    if (static_cast<size_t>(end_ - data_) < size) {
+      return false;
+    }
+    value.assign(reinterpret_cast<const char*>(data_), size);
+    data_ += size;
+    return true;
+  }
+
+ private:
+  const std::byte* data_;
+  const std::byte* end_;
+};
+
+template <typename T>
+auto write(std::ofstream& file, const T& value) -> void
+{
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+}  // namespace
+
+gfx::vk_api::ShaderCache::ShaderCache(VulkanDevice& device,
+                                      std::string index_path)
+    : device_(device),
+      index_path_(std::move(index_path)),
+      index_dirty_(false),
+      index_hits_(0),
+      reflected_(0),
+      load_ms_(0.0),
+      resource_id_(0)
+{
+  read_index_();
+  resource_id_ = device_.resources->add(
+      [this](VulkanDevice&) { release_(); },
+      [this](VulkanDevice&) { return restore_(); });
+}
+
+gfx::vk_api::ShaderCache::~ShaderCache()
+{
+  device_.resources->remove(resource_id_);
+  if (index_dirty_) {
+    save_index();
+  }
+  release_();
+}
+
+auto gfx::vk_api::ShaderCache::load(const std::string& path,
+                                     const Shader*& shader) -> VkResult
+{
+  auto loaded = shaders_.find(path);
+  if (loaded != shaders_.end()) {
+    shader = &loaded->second;
+    return VK_SUCCESS;
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  std::error_code error;
+  uint64_t file_size = std::filesystem::file_size(path, error);
+  int64_t modified = 0;
+  if (!error) {
+    modified = std::filesystem::last_write_time(path, error)
+                   .time_since_epoch()
+                   .count();
+  }
+  if (error) {
+    GFX_LOG_ERROR("Could not read shader: {}", path);
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+
+  os::MappedFile file;
+  auto map = [&file, &path]() {
+    if (!file.open(path.c_str()) || file.size() == 0 ||
+        file.size() % sizeof(uint32_t) != 0) {
+      GFX_LOG_ERROR("Invalid SPIR-V binary: {}", path);
+      return false;
+    }
+    return true;
+  };
+  auto code = [&file]() {
+    return reinterpret_cast<const uint32_t*>(file.data());
+  };
+
+  auto entry = index_.find(path);
+  if (entry != index_.end() && entry->second.file_size == file_size &&
+      entry->second.modified == modified) {
+    ++index_hits_;
+  }
+  else {
+    if (!map()) {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    size_t word_count = file.size() / sizeof(uint32_t);
+    IndexEntry reflected = {file_size, modified,
+                            hash_spirv(code(), word_count), {}};
+    if (!reflect_spirv(code(), word_count, reflected.reflection)) {
+      GFX_LOG_ERROR("Could not reflect shader: {}", path);
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    entry = index_.insert_or_assign(path, std::move(reflected)).first;
+    index_dirty_ = true;
+    ++reflected_;
+  }
+
+  // A hash shared with a loaded module is only trusted once the contents
+  // match. The index entry of a file that fails from here on stays, its
+  // reflection is valid.
+  if (!file.is_open() && !map()) {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  size_t word_count = file.size() / sizeof(uint32_t);
+  auto module = modules_.find(entry->second.hash);
+  if (module == modules_.end()) {
+    VkShaderModule created;
+    VkResult result = create_shader_module(device_, code(), word_count,
+                                           created);
+    if (result != VK_SUCCESS) {
+      GFX_LOG_ERROR("Could not create shader module: {}", path);
+      return result;
+    }
+    module = modules_
+                 .emplace(entry->second.hash,
+                          Module{created, std::vector<uint32_t>(
+                                              code(), code() + word_count)})
+                 .first;
+  }
+  else if (module->second.code.size() != word_count ||
+           memcmp(module->second.code.data(), code(), file.size()) != 0) {
+    GFX_LOG_ERROR("Shader content hash collides with a loaded shader: {}",
+                  path);
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+
+  Shader& loaded_shader = shaders_[path];
+  loaded_shader = {entry->second.hash, module->second.handle,
+                   &entry->second.reflection};
+  shader = &loaded_shader;
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  load_ms_ += elapsed.count();
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::ShaderCache::pipeline_layout(
+    std::initializer_list<const Shader*> shaders,
+    const PipelineLayout*& layout) -> VkResult
+{
+  std::vector<ShaderBinding> bindings;
+  VkPushConstantRange push_constants = {};
+  for (const Shader* shader : shaders) {
+    const ShaderReflection& reflection = *shader->reflection;
+    for (const ShaderBinding& binding : reflection.bindings) {
+      auto same = std::find_if(
+          bindings.begin(), bindings.end(), [&](const ShaderBinding& other) {
+            return other.set == binding.set &&
+                   other.binding == binding.binding;
+          });
+      if (same == bindings.end()) {
+        bindings.push_back(binding);
+      }
+      else if (same->type != binding.type || same->count != binding.count) {
+        GFX_LOG_ERROR("Shader stages disagree on set {} binding {}!",
+                      binding.set, binding.binding);
+        return VK_ERROR_INITIALIZATION_FAILED;
+      }
+      else {
+        same->stages |= binding.stages;
+      }
+    }
+    if (reflection.push_constant_size > 0) {
+      push_constants.stageFlags |= reflection.stage;
+      push_constants.size =
+          std::max(push_constants.size, reflection.push_constant_size);
+    }
+  }
+  std::sort(bindings.begin(), bindings.end(),
+            [](const ShaderBinding& a, const ShaderBinding& b) {
+              return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+            });
+
+  std::vector<uint32_t> key;
+  for (const ShaderBinding& binding : bindings) {
+    key.insert(key.end(), {binding.set, binding.binding,
+                           static_cast<uint32_t>(binding.type),
+                           binding.count, binding.stages});
+  }
+  key.insert(key.end(), {push_constants.stageFlags, push_constants.size});
+  auto cached = pipeline_layouts_.find(key);
+  if (cached != pipeline_layouts_.end()) {
+    layout = &cached->second;
+    return VK_SUCCESS;
+  }
+
+  PipelineLayout created;
+  VkResult result = create_pipeline_layout_(key, created);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  layout = &pipeline_layouts_.emplace(std::move(key), std::move(created))
+                .first->second;
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::ShaderCache::save_index() -> bool
+{
+  // Written aside then renamed, a crash never leaves a truncated index.
+  std::string temporary_path = index_path_ + ".tmp";
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+      return false;
+    }
+    write(file, INDEX_MAGIC);
+    write(file, INDEX_VERSION);
+    write(file, static_cast<uint32_t>(index_.size()));
+    for (const auto& [path, entry] : index_) {
+      write(file, static_cast<uint32_t>(path.size()));
+      file.write(path.data(), path.size());
+      write(file, entry.file_size);
+      write(file, entry.modified);
+      write(file, entry.hash);
+      const ShaderReflection& reflection = entry.reflection;
+      write(file, reflection.stage);
+      write(file, reflection.push_constant_size);
+      write(file, reflection.local_size);
+      write(file, static_cast<uint32_t>(reflection.bindings.size()));
+      for (const ShaderBinding& binding : reflection.bindings) {
+        write(file, binding);
+      }
+    }
+    if (!file) {
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary_path, index_path_, error);
+  if (error) {
+    return false;
+  }
+  index_dirty_ = false;
+  return true;
+}
+
+auto gfx::vk_api::ShaderCache::stats() const -> ShaderCacheStats
+{
+  return {static_cast<uint32_t>(shaders_.size()),
+          static_cast<uint32_t>(modules_.size()),
+          index_hits_,
+          reflected_,
+          static_cast<uint32_t>(pipeline_layouts_.size()),
+          load_ms_};
+}
+
+auto gfx::vk_api::ShaderCache::read_index_() -> void
+{
+  os::MappedFile file;
+  if (!file.open(index_path_.c_str())) {
+    return;
+  }
+  IndexReader reader(file.data(), file.size());
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint32_t entry_count = 0;
+  if (!reader.read(magic) || magic != INDEX_MAGIC ||
+      !reader.read(version) || version != INDEX_VERSION ||
+      !reader.read(entry_count)) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < entry_count; ++i) {
+    std::string path;
+    uint32_t path_size = 0;
+    IndexEntry entry = {};
+    ShaderReflection& reflection = entry.reflection;
+    uint32_t binding_count = 0;
+    bool valid = reader.read(path_size) && reader.read(path, path_size) &&
+                 reader.read(entry.file_size) && reader.read(entry.modified) &&
+                 reader.read(entry.hash) && reader.read(reflection.stage) &&
+                 reader.read(reflection.push_constant_size) &&
+                 reader.read(reflection.local_size) &&
+                 reader.read(binding_count);
+    for (uint32_t b = 0; valid && b < binding_count; ++b) {
+      ShaderBinding binding;
+      valid = reader.read(binding);
+      if (valid) {
+        reflection.bindings.push_back(binding);
+      }
+    }
+    // A damaged index is dropped whole, every shader is reflected again.
+    if (!valid) {
+      index_.clear();
+      return;
+    }
+    index_.emplace(std::move(path), std::move(entry));
+  }
+}
+
+auto gfx::vk_api::ShaderCache::create_pipeline_layout_(
+    const std::vector<uint32_t>& key, PipelineLayout& layout) -> VkResult
+{
+  // Five words per binding, sorted by set then binding, then two for the
+  // push constants.
+  size_t binding_words = key.size() - 2;
+  VkPushConstantRange push_constants = {key[binding_words], 0,
+                                        key[binding_words + 1]};
+  // Set layouts created before a failure stay cached.
+  PipelineLayout created = {};
+  uint32_t set_count = binding_words == 0 ? 0 : key[binding_words - 5] + 1;
+  size_t next = 0;
+  for (uint32_t set = 0; set < set_count; ++set) {
+    std::vector<VkDescriptorSetLayoutBinding> set_bindings;
+    for (; next < binding_words && key[next] == set; next += 5) {
+      set_bindings.push_back({key[next + 1],
+                              static_cast<VkDescriptorType>(key[next + 2]),
+                              key[next + 3], key[next + 4], nullptr});
+    }
+    VkDescriptorSetLayout set_layout;
+    VkResult result = set_layout_(set_bindings, set_layout);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+    created.set_layouts.push_back(set_layout);
+  }
+
+  using LayoutInfo = VkPipelineLayoutCreateInfo;
+  VkPipelineLayoutCreateInfo layout_create_info =
+      build<LayoutInfo>()
+          .set(&LayoutInfo::setLayoutCount,
+               static_cast<uint32_t>(created.set_layouts.size()))
+          .set(&LayoutInfo::pSetLayouts, created.set_layouts.data())
+          .set(&LayoutInfo::pushConstantRangeCount,
+               push_constants.size > 0 ? 1u : 0u)
+          .set(&LayoutInfo::pPushConstantRanges, &push_constants);
+  VkResult result = device_.vkCreatePipelineLayout(
+      device_.logical_device, &layout_create_info, allocation_callbacks(),
+      &created.layout);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create pipeline layout: {}!",
+                  result_name(result));
+    return result;
+  }
+  layout = std::move(created);
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::ShaderCache::set_layout_(
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+    VkDescriptorSetLayout& set_layout) -> VkResult
+{
+  std::vector<uint32_t> key;
+  for (const VkDescriptorSetLayoutBinding& binding : bindings) {
+    key.insert(key.end(), {binding.binding,
+                           static_cast<uint32_t>(binding.descriptorType),
+                           binding.descriptorCount, binding.stageFlags});
+  }
+  auto cached = set_layouts_.find(key);
+  if (cached != set_layouts_.end()) {
+    set_layout = cached->second;
+    return VK_SUCCESS;
+  }
+
+  using SetLayoutInfo = VkDescriptorSetLayoutCreateInfo;
+  VkDescriptorSetLayoutCreateInfo set_layout_create_info =
+      build<SetLayoutInfo>()
+          .set(&SetLayoutInfo::bindingCount,
+               static_cast<uint32_t>(bindings.size()))
+          .set(&SetLayoutInfo::pBindings, bindings.data());
+  VkResult result = device_.vkCreateDescriptorSetLayout(
+      device_.logical_device, &set_layout_create_info, allocation_callbacks(),
+      &set_layout);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create descriptor set layout: {}!",
+                  result_name(result));
+    return result;
+  }
+  set_layouts_.emplace(std::move(key), set_layout);
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::ShaderCache::release_() -> void
+{
+  for (auto& [hash, module] : modules_) {
+    device_.deletion_queue->destroy(module.handle);
+    module.handle = VK_NULL_HANDLE;
+  }
+  for (auto& [key, layout] : pipeline_layouts_) {
+    device_.deletion_queue->destroy(layout.layout);
+    layout = {};
+  }
+  for (auto& [key, set_layout] : set_layouts_) {
+    device_.deletion_queue->destroy(set_layout);
+  }
+  set_layouts_.clear();
+}
+
+auto gfx::vk_api::ShaderCache::restore_() -> VkResult
+{
+  for (auto& [path, shader] : shaders_) {
+    // The shaders sharing the module expect the content it was made of,
+    // which it keeps.
+    Module& module = modules_[shader.hash];
+    if (module.handle == VK_NULL_HANDLE) {
+      VkResult result = create_shader_module(
+          device_, module.code.data(), module.code.size(), module.handle);
+      if (result != VK_SUCCESS) {
+        GFX_LOG_ERROR("Could not create shader module: {}", path);
+        return result;
+      }
+    }
+    shader.module = module.handle;
+  }
+  // The set layouts are cached again along.
+  for (auto& [key, layout] : pipeline_layouts_) {
+    VkResult result = create_pipeline_layout_(key, layout);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+  }
+  return VK_SUCCESS;
+}
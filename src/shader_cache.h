@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "shader_reflection.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+struct Shader {
+  // Content hash, files with the same content share the module.
+  uint64_t hash;
+  VkShaderModule module;
+  const ShaderReflection* reflection;
+};
+
+struct PipelineLayout {
+  VkPipelineLayout layout;
+  // One per set up to the highest one used, unused sets are empty.
+  std::vector<VkDescriptorSetLayout> set_layouts;
+};
+
+struct ShaderCacheStats {
+  uint32_t files;
+  // Distinct modules created, at most one per content hash.
+  uint32_t modules;
+  // Files whose reflection came from the index.
+  uint32_t index_hits;
+  // Files parsed because the index had no up to date entry.
+  uint32_t reflected;
+  uint32_t pipeline_layouts;
+  double load_ms;
+};
+
+// ************************************************************ //
+// ShaderCache                                                  //
+//                                                              //
+// Loads SPIR-V files by memory mapping them, creates one       //
+// module per distinct content and builds pipeline layouts from //
+// the reflected interfaces. Reflection results are kept in an  //
+// index file keyed by path, size and modification time, so     //
+// unchanged shaders are never parsed again. Files with the     //
+// content hash of a module already created share it once their //
+// code compares equal. Modules keep their code: when the       //
+// device is recovered, the modules and layouts are created     //
+// again in place, so the shaders and layouts handed out stay   //
+// valid. Not thread safe.                                      //
+// ************************************************************ //
+class ShaderCache {
+ public:
+  // The index is read here, and written back on destruction if it changed.
+  ShaderCache(VulkanDevice& device, std::string index_path);
+  ~ShaderCache();
+
+  ShaderCache(const ShaderCache&) = delete;
+  ShaderCache& operator=(const ShaderCache&) = delete;
+
+  // Returns VK_ERROR_INITIALIZATION_FAILED if the file cannot be read or
+  // reflected, shader is only set on success. Shaders stay valid for the
+  // lifetime of the cache.
+  auto load(const std::string& path, const Shader*& shader) -> VkResult;
+  // Layout of the merged interfaces of the stages, shared by every pipeline
+  // with the same interface and owned by the cache. Returns
+  // VK_ERROR_INITIALIZATION_FAILED if the stages disagree on a binding,
+  // layout is only set on success.
+  auto pipeline_layout(std::initializer_list<const Shader*> shaders,
+                       const PipelineLayout*& layout) -> VkResult;
+  // Returns false if the index could not be written.
+  auto save_index() -> bool;
+
+  auto stats() const -> ShaderCacheStats;
+
+ private:
+  struct IndexEntry {
+    uint64_t file_size;
+    int64_t modified;
+    uint64_t hash;
+    ShaderReflection reflection;
+  };
+
+  struct Module {
+    VkShaderModule handle;
+    // Compared with the files of the same hash, and used to create the
+    // module again once the device is recovered.
+    std::vector<uint32_t> code;
+  };
+
+  auto read_index_() -> void;
+  // Layout of the flattened bindings and push constant range of the key.
+  auto create_pipeline_layout_(const std::vector<uint32_t>& key,
+                               PipelineLayout& layout) -> VkResult;
+  auto set_layout_(const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+                   VkDescriptorSetLayout& set_layout) -> VkResult;
+  auto release_() -> void;
+  // Modules are created again from the code they keep.
+  auto restore_() -> VkResult;
+
+  VulkanDevice& device_;
+  std::string index_path_;
+  std::unordered_map<std::string, IndexEntry> index_;
+  bool index_dirty_;
+
+  // Node based, so references handed out stay valid.
+  std::unordered_map<std::string, Shader> shaders_;
+  std::unordered_map<uint64_t, Module> modules_;
+  // Keyed by the flattened bindings and push constant ranges.
+  std::map<std::vector<uint32_t>, VkDescriptorSetLayout> set_layouts_;
+  std::map<std::vector<uint32_t>, PipelineLayout> pipeline_layouts_;
+
+  uint32_t index_hits_;
+  uint32_t reflected_;
+  double load_ms_;
+  uint64_t resource_id_;
+};
+
+}  // namespace gfx::vk_api
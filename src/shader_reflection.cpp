@@ -0,0 +1,434 @@
+#include "shader_reflection.h"
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+
+namespace {
+
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+constexpr size_t SPIRV_HEADER_WORDS = 5;
+// Deepest type nesting followed, guards against cyclic malformed modules.
+constexpr int MAX_TYPE_DEPTH = 16;
+
+// Opcodes, decorations and enumerants of the SPIR-V specification.
+constexpr uint32_t OP_ENTRY_POINT = 15;
+constexpr uint32_t OP_EXECUTION_MODE = 16;
+constexpr uint32_t OP_TYPE_INT = 21;
+constexpr uint32_t OP_TYPE_FLOAT = 22;
+constexpr uint32_t OP_TYPE_VECTOR = 23;
+constexpr uint32_t OP_TYPE_MATRIX = 24;
+constexpr uint32_t OP_TYPE_IMAGE = 25;
+constexpr uint32_t OP_TYPE_SAMPLER = 26;
+constexpr uint32_t OP_TYPE_SAMPLED_IMAGE = 27;
+constexpr uint32_t OP_TYPE_ARRAY = 28;
+constexpr uint32_t OP_TYPE_RUNTIME_ARRAY = 29;
+constexpr uint32_t OP_TYPE_STRUCT = 30;
+constexpr uint32_t OP_TYPE_POINTER = 32;
+constexpr uint32_t OP_CONSTANT = 43;
+constexpr uint32_t OP_VARIABLE = 59;
+constexpr uint32_t OP_DECORATE = 71;
+constexpr uint32_t OP_MEMBER_DECORATE = 72;
+
+constexpr uint32_t DECORATION_BUFFER_BLOCK = 3;
+constexpr uint32_t DECORATION_ARRAY_STRIDE = 6;
+constexpr uint32_t DECORATION_MATRIX_STRIDE = 7;
+constexpr uint32_t DECORATION_BINDING = 33;
+constexpr uint32_t DECORATION_DESCRIPTOR_SET = 34;
+constexpr uint32_t DECORATION_OFFSET = 35;
+
+constexpr uint32_t EXECUTION_MODE_LOCAL_SIZE = 17;
+
+constexpr uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+constexpr uint32_t STORAGE_UNIFORM = 2;
+constexpr uint32_t STORAGE_PUSH_CONSTANT = 9;
+constexpr uint32_t STORAGE_STORAGE_BUFFER = 12;
+
+constexpr uint32_t DIM_BUFFER = 5;
+constexpr uint32_t DIM_SUBPASS_DATA = 6;
+// Sampled operand of images used as storage images.
+constexpr uint32_t IMAGE_STORAGE = 2;
+
+constexpr uint32_t NO_DECORATION = UINT32_MAX;
+
+// Defining instruction and decorations of a result id.
+struct IdInfo {
+  uint32_t opcode = 0;
+  // Position of the instruction in the module.
+  size_t word = 0;
+  uint32_t set = NO_DECORATION;
+  uint32_t binding = NO_DECORATION;
+  uint32_t array_stride = 0;
+  bool buffer_block = false;
+};
+
+struct MemberLayout {
+  uint32_t offset = 0;
+  uint32_t matrix_stride = 0;
+};
+
+class Module {
+ public:
+  Module(const uint32_t* code, uint32_t bound) : code_(code), ids_(bound) {}
+
+  auto id(uint32_t id) -> IdInfo*
+  {
+    return id < ids_.size() ? &ids_[id] : nullptr;
+  }
+
+  auto define(uint32_t id, uint32_t opcode, size_t word) -> bool
+  {
+    IdInfo* info = this->id(id);
+    if (info == nullptr) {
+      return false;
+    }
+    info->opcode = opcode;
+    info->word = word;
+    return true;
+  }
+
+  auto member(uint32_t structure, uint32_t member) -> MemberLayout&
+  {
+    std::vector<MemberLayout>& layouts = members_[structure];
+    if (layouts.size() <= member) {
+      layouts.resize(member + 1);
+    }
+    return layouts[member];
+  }
+
+  // Operand i of the instruction defining id, instruction word 0 included.
+  auto operand(const IdInfo& info, size_t i) const -> uint32_t
+  {
+    return code_[info.word + i];
+  }
+
+  auto word_count(const IdInfo& info) const -> uint32_t
+  {
+    return code_[info.word] >> 16;
+  }
+
+  // Bytes taken by a value of the type, as laid out by its decorations.
+  auto type_size(uint32_t type, int depth = 0) -> uint32_t
+  {
+    IdInfo* info = id(type);
+    if (info == nullptr || depth > MAX_TYPE_DEPTH) {
+      return 0;
+    }
+    switch (info->opcode) {
+      case OP_TYPE_INT:
+      case OP_TYPE_FLOAT:
+        return operand(*info, 2) / 8;
+      case OP_TYPE_VECTOR:
+      case OP_TYPE_MATRIX:
+        return operand(*info, 3) * type_size(operand(*info, 2), depth + 1);
+      case OP_TYPE_ARRAY: {
+        uint32_t stride = info->array_stride != 0
+                              ? info->array_stride
+                              : type_size(operand(*info, 2), depth + 1);
+        return constant(operand(*info, 3)) * stride;
+      }
+      case OP_TYPE_STRUCT: {
+        uint32_t size = 0;
+        uint32_t member_count = word_count(*info) - 2;
+        for (uint32_t m = 0; m < member_count; ++m) {
+          uint32_t member_type = operand(*info, 2 + m);
+          MemberLayout layout = member(type, m);
+          IdInfo* member_info = id(member_type);
+          uint32_t member_size =
+              layout.matrix_stride != 0 && member_info != nullptr &&
+                      member_info->opcode == OP_TYPE_MATRIX
+                  ? operand(*member_info, 3) * layout.matrix_stride
+                  : type_size(member_type, depth + 1);
+          size = std::max(size, layout.offset + member_size);
+        }
+        return size;
+      }
+      default:
+        return 0;
+    }
+  }
+
+  // Value of a 32 bits integer constant, 0 if id is not one.
+  auto constant(uint32_t constant) -> uint32_t
+  {
+    IdInfo* info = id(constant);
+    return info != nullptr && info->opcode == OP_CONSTANT
+               ? operand(*info, 3)
+               : 0;
+  }
+
+ private:
+  const uint32_t* code_;
+  std::vector<IdInfo> ids_;
+  std::unordered_map<uint32_t, std::vector<MemberLayout>> members_;
+};
+
+// Words of the shortest valid instruction, for the opcodes read.
+auto min_word_count(uint32_t opcode) -> uint32_t
+{
+  switch (opcode) {
+    case OP_TYPE_IMAGE:
+      return 9;
+    case OP_TYPE_INT:
+    case OP_TYPE_VECTOR:
+    case OP_TYPE_MATRIX:
+    case OP_TYPE_ARRAY:
+    case OP_TYPE_POINTER:
+    case OP_CONSTANT:
+    case OP_VARIABLE:
+      return 4;
+    case OP_TYPE_FLOAT:
+    case OP_TYPE_SAMPLED_IMAGE:
+    case OP_TYPE_RUNTIME_ARRAY:
+      return 3;
+    default:
+      return 2;
+  }
+}
+
+auto stage_of(uint32_t execution_model, VkShaderStageFlagBits& stage) -> bool
+{
+  constexpr VkShaderStageFlagBits STAGES[] = {
+      VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+      VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+      VK_SHADER_STAGE_GEOMETRY_BIT, VK_SHADER_STAGE_FRAGMENT_BIT,
+      VK_SHADER_STAGE_COMPUTE_BIT};
+  if (execution_model >= std::size(STAGES)) {
+    return false;
+  }
+  stage = STAGES[execution_model];
+  return true;
+}
+
+// Descriptor type of a variable of the given storage class and type.
+auto descriptor_type_of(Module& module, uint32_t storage_class,
+                        const IdInfo& type, VkDescriptorType& descriptor_type)
+    -> bool
+{
+  switch (type.opcode) {
+    case OP_TYPE_STRUCT:
+      if (storage_class == STORAGE_STORAGE_BUFFER || type.buffer_block) {
+        descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      }
+      else {
+        descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+      }
+      return storage_class == STORAGE_STORAGE_BUFFER ||
+             storage_class == STORAGE_UNIFORM;
+    case OP_TYPE_SAMPLER:
+      descriptor_type = VK_DESCRIPTOR_TYPE_SAMPLER;
+      return true;
+    case OP_TYPE_SAMPLED_IMAGE: {
+      const IdInfo* image = module.id(module.operand(type, 2));
+      if (image == nullptr || image->opcode != OP_TYPE_IMAGE) {
+        return false;
+      }
+      descriptor_type = module.operand(*image, 3) == DIM_BUFFER
+                            ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
+                            : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      return true;
+    }
+    case OP_TYPE_IMAGE: {
+      uint32_t dim = module.operand(type, 3);
+      bool storage = module.operand(type, 7) == IMAGE_STORAGE;
+      if (dim == DIM_SUBPASS_DATA) {
+        descriptor_type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+      }
+      else if (dim == DIM_BUFFER) {
+        descriptor_type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                  : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+      }
+      else {
+        descriptor_type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                  : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+auto gfx::vk_api::reflect_spirv(const uint32_t* code, size_t word_count,
+                                ShaderReflection& reflection) -> bool
+{
+  // Every id is defined by an instruction, a larger bound is malformed.
+  if (word_count < SPIRV_HEADER_WORDS || code[0] != SPIRV_MAGIC ||
+      code[3] > word_count) {
+    return false;
+  }
+  Module module(code, code[3]);
+  reflection = {};
+  bool has_entry_point = false;
+  uint32_t entry_point = 0;
+  std::vector<size_t> variables;
+  // Applied once the structures they decorate are known, structures are
+  // declared after their decorations.
+  std::vector<size_t> member_decorations;
+
+  for (size_t word = SPIRV_HEADER_WORDS; word < word_count;) {
+    uint32_t count = code[word] >> 16;
+    uint32_t opcode = code[word] & 0xffff;
+    if (count == 0 || word + count > word_count) {
+      return false;
+    }
+    const uint32_t* operands = code + word + 1;
+
+    switch (opcode) {
+      case OP_ENTRY_POINT:
+        if (!has_entry_point) {
+          if (count < 3 || !stage_of(operands[0], reflection.stage)) {
+            return false;
+          }
+          entry_point = operands[1];
+          has_entry_point = true;
+        }
+        break;
+      case OP_EXECUTION_MODE:
+        if (count >= 6 && has_entry_point && operands[0] == entry_point &&
+            operands[1] == EXECUTION_MODE_LOCAL_SIZE) {
+          std::copy(operands + 2, operands + 5, reflection.local_size);
+        }
+        break;
+      case OP_DECORATE: {
+        IdInfo* target = count >= 3 ? module.id(operands[0]) : nullptr;
+        if (target == nullptr) {
+          break;
+        }
+        uint32_t value = count >= 4 ? operands[2] : 0;
+        switch (operands[1]) {
+          case DECORATION_DESCRIPTOR_SET:
+            target->set = value;
+            break;
+          case DECORATION_BINDING:
+            target->binding = value;
+            break;
+          case DECORATION_ARRAY_STRIDE:
+            target->array_stride = value;
+            break;
+          case DECORATION_BUFFER_BLOCK:
+            target->buffer_block = true;
+            break;
+        }
+        break;
+      }
+      case OP_MEMBER_DECORATE:
+        if (count >= 5 && (operands[2] == DECORATION_OFFSET ||
+                           operands[2] == DECORATION_MATRIX_STRIDE)) {
+          member_decorations.push_back(word);
+        }
+        break;
+      case OP_TYPE_INT:
+      case OP_TYPE_FLOAT:
+      case OP_TYPE_VECTOR:
+      case OP_TYPE_MATRIX:
+      case OP_TYPE_IMAGE:
+      case OP_TYPE_SAMPLER:
+      case OP_TYPE_SAMPLED_IMAGE:
+      case OP_TYPE_ARRAY:
+      case OP_TYPE_RUNTIME_ARRAY:
+      case OP_TYPE_STRUCT:
+      case OP_TYPE_POINTER:
+        if (count < min_word_count(opcode) ||
+            !module.define(operands[0], opcode, word)) {
+          return false;
+        }
+        break;
+      case OP_CONSTANT:
+      case OP_VARIABLE:
+        if (count < min_word_count(opcode) ||
+            !module.define(operands[1], opcode, word)) {
+          return false;
+        }
+        if (opcode == OP_VARIABLE) {
+          variables.push_back(word);
+        }
+        break;
+    }
+    word += count;
+  }
+  if (!has_entry_point) {
+    return false;
+  }
+
+  for (size_t word : member_decorations) {
+    const uint32_t* operands = code + word + 1;
+    // A member the structure does not have is malformed, its index would
+    // size the layouts.
+    const IdInfo* structure = module.id(operands[0]);
+    if (structure == nullptr || structure->opcode != OP_TYPE_STRUCT ||
+        operands[1] >= module.word_count(*structure) - 2) {
+      return false;
+    }
+    MemberLayout& layout = module.member(operands[0], operands[1]);
+    if (operands[2] == DECORATION_OFFSET) {
+      layout.offset = operands[3];
+    }
+    else {
+      layout.matrix_stride = operands[3];
+    }
+  }
+
+  for (size_t word : variables) {
+    uint32_t storage_class = code[word + 3];
+    if (storage_class != STORAGE_UNIFORM_CONSTANT &&
+        storage_class != STORAGE_UNIFORM &&
+        storage_class != STORAGE_PUSH_CONSTANT &&
+        storage_class != STORAGE_STORAGE_BUFFER) {
+      continue;
+    }
+    const IdInfo* pointer = module.id(code[word + 1]);
+    if (pointer == nullptr || pointer->opcode != OP_TYPE_POINTER) {
+      return false;
+    }
+    uint32_t type = module.operand(*pointer, 3);
+
+    if (storage_class == STORAGE_PUSH_CONSTANT) {
+      reflection.push_constant_size =
+          std::max(reflection.push_constant_size, module.type_size(type));
+      continue;
+    }
+    const IdInfo* variable = module.id(code[word + 2]);
+    if (variable->set == NO_DECORATION ||
+        variable->binding == NO_DECORATION) {
+      continue;
+    }
+
+    ShaderBinding binding = {};
+    binding.set = variable->set;
+    binding.binding = variable->binding;
+    binding.count = 1;
+    binding.stages = reflection.stage;
+    const IdInfo* info = module.id(type);
+    if (info != nullptr && info->opcode == OP_TYPE_RUNTIME_ARRAY) {
+      return false;
+    }
+    if (info != nullptr && info->opcode == OP_TYPE_ARRAY) {
+      binding.count = module.constant(module.operand(*info, 3));
+      info = module.id(module.operand(*info, 2));
+    }
+    if (info == nullptr ||
+        !descriptor_type_of(module, storage_class, *info, binding.type)) {
+      return false;
+    }
+    reflection.bindings.push_back(binding);
+  }
+
+  std::sort(reflection.bindings.begin(), reflection.bindings.end(),
+            [](const ShaderBinding& a, const ShaderBinding& b) {
+              return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+            });
+  return true;
+}
+
+auto gfx::vk_api::hash_spirv(const uint32_t* code, size_t word_count)
+    -> uint64_t
+{
+  // Whole words at a time, SPIR-V is always a multiple of 4 bytes.
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < word_count; ++i) {
+    hash = (hash ^ code[i]) * 1099511628211ull;
+  }
+  return hash;
+}
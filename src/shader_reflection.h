@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "vulkan_ext.h"
+
+namespace gfx::vk_api {
+
+struct ShaderBinding {
+  uint32_t set;
+  uint32_t binding;
+  VkDescriptorType type;
+  // Elements of descriptor arrays, 1 otherwise.
+  uint32_t count;
+  VkShaderStageFlags stages;
+};
+
+// Interface of a shader entry point, as declared in its SPIR-V.
+struct ShaderReflection {
+  VkShaderStageFlagBits stage;
+  // Sorted by set, then binding.
+  std::vector<ShaderBinding> bindings;
+  // Bytes of the push constant block, 0 without one.
+  uint32_t push_constant_size;
+  // Compute shaders only.
+  uint32_t local_size[3];
+};
+
+// ************************************************************ //
+// SPIR-V reflection                                            //
+//                                                              //
+// Walks the instructions of a SPIR-V module once, collecting   //
+// the descriptor bindings and the push constant block of its   //
+// first entry point. Only what pipeline layouts need is read,  //
+// unbounded descriptor arrays are rejected.                    //
+// ************************************************************ //
+// Returns false if the module is malformed or unsupported.
+auto reflect_spirv(const uint32_t* code, size_t word_count,
+                   ShaderReflection& reflection) -> bool;
+
+// 64 bits FNV-1a of the module words, identical modules share a hash.
+auto hash_spirv(const uint32_t* code, size_t word_count) -> uint64_t;
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,642 @@
+#include "texture_streamer.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <thread>
+#include "host_allocator.h"
+#include "log.h"
+#include "vulkan_builders.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_recovery.h"
+
+namespace {
+
+constexpr VkPipelineStageFlags SAMPLING_STAGES =
+    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+auto image_barrier(VkImage image, uint32_t mip_count, VkAccessFlags src_access,
+                   VkAccessFlags dst_access, VkImageLayout old_layout,
+                   VkImageLayout new_layout) -> VkImageMemoryBarrier
+{
+  return gfx::vk_api::build<VkImageMemoryBarrier>()
+      .set(&VkImageMemoryBarrier::srcAccessMask, src_access)
+      .set(&VkImageMemoryBarrier::dstAccessMask, dst_access)
+      .set(&VkImageMemoryBarrier::oldLayout, old_layout)
+      .set(&VkImageMemoryBarrier::newLayout, new_layout)
+      .set(&VkImageMemoryBarrier::srcQueueFamilyIndex,
+           VK_QUEUE_FAMILY_IGNORED)
+      .set(&VkImageMemoryBarrier::dstQueueFamilyIndex,
+           VK_QUEUE_FAMILY_IGNORED)
+      .set(&VkImageMemoryBarrier::image, image)
+      .set(&VkImageMemoryBarrier::subresourceRange,
+           VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, mip_count, 0,
+                                   1})
+      .get();
+}
+
+// Bytes of the levels [first, end) of the file.
+auto level_bytes(const gfx::Ktx2File& file, uint32_t first, uint32_t end)
+    -> VkDeviceSize
+{
+  VkDeviceSize bytes = 0;
+  for (uint32_t level = first; level < end; ++level) {
+    bytes += file.level(level).uncompressed_size;
+  }
+  return bytes;
+}
+
+}  // namespace
+
+gfx::vk_api::TextureStreamer::TextureStreamer(
+    VulkanDevice& device, ThreadPool& thread_pool,
+    const TextureStreamingLimits& limits)
+    : device_(device),
+      thread_pool_(thread_pool),
+      limits_(limits),
+      staging_{},
+      region_size_(0),
+      region_used_(0),
+      frame_(0),
+      resident_bytes_(0),
+      reserved_bytes_(0),
+      pending_decodes_(0),
+      uploaded_bytes_(0),
+      evicted_levels_(0),
+      resource_id_(0)
+{
+  limits_.frames_in_flight = std::max(limits_.frames_in_flight, 1u);
+  // Regions start 16 bytes aligned, like every texel block size.
+  region_size_ = limits_.staging_size / limits_.frames_in_flight / 16 * 16;
+}
+
+auto gfx::vk_api::TextureStreamer::create(
+    VulkanDevice& device, ThreadPool& thread_pool,
+    const TextureStreamingLimits& limits,
+    std::unique_ptr<TextureStreamer>& streamer) -> VkResult
+{
+  std::unique_ptr<TextureStreamer> created(
+      new TextureStreamer(device, thread_pool, limits));
+  VkResult result = created->create_staging_();
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  TextureStreamer* self = created.get();
+  self->resource_id_ = device.resources->add(
+      [self](VulkanDevice&) { self->release_(); },
+      [self](VulkanDevice&) { return self->create_staging_(); });
+  streamer = std::move(created);
+  return VK_SUCCESS;
+}
+
+gfx::vk_api::TextureStreamer::~TextureStreamer()
+{
+  if (resource_id_ != 0) {
+    device_.resources->remove(resource_id_);
+  }
+  release_();
+}
+
+auto gfx::vk_api::TextureStreamer::load(const char* path,
+                                        TextureHandle& texture) -> VkResult
+{
+  auto loaded = std::make_unique<Texture>();
+  if (!loaded->file.open(path)) {
+    GFX_LOG_ERROR("Unsupported texture: {}", path);
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+  const Ktx2File& file = loaded->file;
+  uint32_t level_count = file.level_count();
+  // Levels are uploaded a block row at a time at least.
+  VkDeviceSize row_size =
+      VkDeviceSize{(file.width() + file.block_width() - 1) /
+                   file.block_width()} *
+      file.block_size();
+  if (row_size + 16 > region_size_) {
+    GFX_LOG_ERROR("Texture rows exceed the staging region: {}", path);
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+
+  uint32_t tail_level = level_count - 1;
+  while (tail_level > 0) {
+    VkExtent3D extent = file.level_extent(tail_level - 1);
+    if (std::max(extent.width, extent.height) > limits_.mip_tail_size) {
+      break;
+    }
+    --tail_level;
+  }
+  loaded->tail_level = tail_level;
+  loaded->wanted_level = tail_level;
+  loaded->last_requested = frame_;
+  loaded->first_level = level_count;
+  loaded->image = VK_NULL_HANDLE;
+  loaded->memory = VK_NULL_HANDLE;
+  loaded->memory_size = 0;
+  loaded->view = VK_NULL_HANDLE;
+
+  textures_.push_back(std::move(loaded));
+  texture = static_cast<TextureHandle>(textures_.size() - 1);
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::TextureStreamer::request(TextureHandle texture,
+                                           uint32_t finest_level) -> void
+{
+  Texture& requested = *textures_[texture];
+  requested.wanted_level = std::min(finest_level, requested.tail_level);
+  requested.last_requested = frame_;
+}
+
+auto gfx::vk_api::TextureStreamer::record_uploads(
+    VkCommandBuffer command_buffer) -> VkResult
+{
+  region_used_ = 0;
+  uploaded_bytes_ = 0;
+  evicted_levels_ = 0;
+
+  std::vector<Texture*> ready;
+  for (auto& texture : textures_) {
+    Step* step = texture->step.get();
+    if (step == nullptr || !step->decoded.load(std::memory_order_acquire)) {
+      continue;
+    }
+    if (step->failed) {
+      GFX_LOG_ERROR("Could not decode texture level {}!", step->first_level);
+      drop_step_(*texture);
+      continue;
+    }
+    ready.push_back(texture.get());
+  }
+  // Partial uploads finish first, then the smallest steps go.
+  auto upload_order = [](const Texture* texture) {
+    const Step& step = *texture->step;
+    bool started = step.image != VK_NULL_HANDLE;
+    return std::make_pair(!started,
+                          texture->file.level(step.first_level).size);
+  };
+  std::sort(ready.begin(), ready.end(),
+            [&](const Texture* a, const Texture* b) {
+              return upload_order(a) < upload_order(b);
+            });
+  VkResult result = VK_SUCCESS;
+  for (Texture* texture : ready) {
+    result = upload_step_(*texture, command_buffer);
+    if (result != VK_SUCCESS) {
+      break;
+    }
+  }
+  // A full staging region leaves the other steps to the next frames.
+  if (result == VK_INCOMPLETE) {
+    result = VK_SUCCESS;
+  }
+  if (result == VK_SUCCESS) {
+    result = start_steps_(command_buffer);
+  }
+  ++frame_;
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not record the texture uploads: {}!",
+                  result_name(result));
+  }
+  return result;
+}
+
+auto gfx::vk_api::TextureStreamer::view(TextureHandle texture) const
+    -> VkImageView
+{
+  return textures_[texture]->view;
+}
+
+auto gfx::vk_api::TextureStreamer::resident_level(TextureHandle texture) const
+    -> uint32_t
+{
+  return textures_[texture]->first_level;
+}
+
+auto gfx::vk_api::TextureStreamer::stats() const -> TextureStats
+{
+  TextureStats stats = {};
+  stats.textures = static_cast<uint32_t>(textures_.size());
+  for (const auto& texture : textures_) {
+    stats.complete_textures += texture->first_level <= texture->wanted_level;
+    stats.pending_steps += texture->step != nullptr;
+  }
+  stats.resident_bytes = resident_bytes_;
+  stats.memory_budget = limits_.memory_budget;
+  stats.uploaded_bytes = uploaded_bytes_;
+  stats.evicted_levels = evicted_levels_;
+  return stats;
+}
+
+auto gfx::vk_api::TextureStreamer::create_staging_() -> VkResult
+{
+  VkResult result = create_buffer(
+      device_, region_size_ * limits_.frames_in_flight,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      0, false, staging_);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create the staging buffer: {}!",
+                  result_name(result));
+  }
+  return result;
+}
+
+auto gfx::vk_api::TextureStreamer::release_() -> void
+{
+  // Decodes write to the steps destroyed below.
+  while (pending_decodes_.load() > 0) {
+    std::this_thread::yield();
+  }
+  for (auto& texture : textures_) {
+    if (Step* step = texture->step.get()) {
+      // The budget is held by the reservation until the image exists.
+      if (step->image != VK_NULL_HANDLE) {
+        resident_bytes_ -= step->memory_size;
+      }
+      else {
+        reserved_bytes_ -= step->reserved_bytes;
+      }
+      device_.deletion_queue->destroy(step->image);
+      device_.deletion_queue->destroy(step->memory);
+      texture->step.reset();
+    }
+    destroy_image_(*texture);
+    texture->first_level = texture->file.level_count();
+  }
+  destroy_buffer(device_, staging_);
+}
+
+auto gfx::vk_api::TextureStreamer::start_steps_(
+    VkCommandBuffer command_buffer) -> VkResult
+{
+  uint32_t pending_steps = 0;
+  std::vector<Texture*> growing;
+  for (auto& texture : textures_) {
+    if (texture->step) {
+      ++pending_steps;
+    }
+    else if (texture->first_level > texture->wanted_level) {
+      growing.push_back(texture.get());
+    }
+  }
+  // A texture first gets its whole tail, then one level per step.
+  auto next_level = [](const Texture* texture) {
+    return texture->first_level == texture->file.level_count()
+               ? texture->tail_level
+               : texture->first_level - 1;
+  };
+  std::sort(growing.begin(), growing.end(),
+            [&](const Texture* a, const Texture* b) {
+              return a->file.level(next_level(a)).size <
+                     b->file.level(next_level(b)).size;
+            });
+
+  for (Texture* texture : growing) {
+    if (pending_steps >= limits_.max_pending_steps) {
+      break;
+    }
+    uint32_t first_level = next_level(texture);
+    VkDeviceSize bytes =
+        level_bytes(texture->file, first_level, texture->first_level);
+    // Tails are always loaded, the budget only limits the finer levels.
+    bool tail = texture->first_level == texture->file.level_count();
+    VkResult result =
+        tail ? VK_SUCCESS : evict_(bytes, texture, command_buffer);
+    if (result == VK_INCOMPLETE) {
+      continue;
+    }
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+
+    auto step = std::make_unique<Step>();
+    step->first_level = first_level;
+    step->decoded = false;
+    step->failed = false;
+    step->reserved_bytes = bytes;
+    step->image = VK_NULL_HANDLE;
+    step->memory = VK_NULL_HANDLE;
+    step->memory_size = 0;
+    step->upload_level = first_level;
+    step->uploaded_rows = 0;
+    size_t offset = 0;
+    for (uint32_t level = first_level; level < texture->first_level;
+         ++level) {
+      step->level_offsets.push_back(offset);
+      offset += texture->file.level(level).uncompressed_size;
+    }
+    reserved_bytes_ += bytes;
+    ++pending_steps;
+
+    // The step outlives the decode: it is only dropped once decoded, and
+    // the destructor waits for pending decodes.
+    ++pending_decodes_;
+    thread_pool_.submit([this, texture, step = step.get(), offset]() {
+      step->data.resize(offset);
+      bool decoded = true;
+      for (size_t i = 0; decoded && i < step->level_offsets.size(); ++i) {
+        decoded = texture->file.read_level(
+            step->first_level + static_cast<uint32_t>(i),
+            step->data.data() + step->level_offsets[i]);
+      }
+      step->failed = !decoded;
+      step->decoded.store(true, std::memory_order_release);
+      --pending_decodes_;
+    });
+    texture->step = std::move(step);
+  }
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::TextureStreamer::evict_(VkDeviceSize bytes,
+                                          const Texture* keep,
+                                          VkCommandBuffer command_buffer)
+    -> VkResult
+{
+  while (resident_bytes_ + reserved_bytes_ + bytes > limits_.memory_budget) {
+    // Least recently requested texture holding levels above its tail, and
+    // not needed this frame.
+    Texture* victim = nullptr;
+    for (auto& texture : textures_) {
+      if (texture.get() == keep || texture->step ||
+          texture->first_level >= texture->tail_level ||
+          texture->last_requested >= frame_) {
+        continue;
+      }
+      if (victim == nullptr ||
+          texture->last_requested < victim->last_requested) {
+        victim = texture.get();
+      }
+    }
+    if (victim == nullptr) {
+      return VK_INCOMPLETE;
+    }
+
+    uint32_t first_level = victim->first_level + 1;
+    VkImage image;
+    VkDeviceMemory memory;
+    VkDeviceSize memory_size;
+    VkResult result =
+        create_image_(*victim, first_level, image, memory, memory_size);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+    VkImageMemoryBarrier barrier = image_barrier(
+        image, victim->file.level_count() - first_level, 0,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    device_.vkCmdPipelineBarrier(command_buffer,
+                                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                 0, nullptr, 1, &barrier);
+    resident_bytes_ += memory_size;
+    result = swap_image_(*victim, command_buffer, image, memory, memory_size,
+                         first_level);
+    // Grows back once requested again.
+    victim->wanted_level = std::max(victim->wanted_level, first_level);
+    ++evicted_levels_;
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+  }
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::TextureStreamer::upload_step_(
+    Texture& texture, VkCommandBuffer command_buffer) -> VkResult
+{
+  Step& step = *texture.step;
+  const Ktx2File& file = texture.file;
+  uint32_t level_count = file.level_count();
+  if (step.image == VK_NULL_HANDLE) {
+    VkResult result = create_image_(texture, step.first_level, step.image,
+                                    step.memory, step.memory_size);
+    if (result != VK_SUCCESS) {
+      drop_step_(texture);
+      return result;
+    }
+    VkImageMemoryBarrier barrier = image_barrier(
+        step.image, level_count - step.first_level, 0,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    device_.vkCmdPipelineBarrier(command_buffer,
+                                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                 0, nullptr, 1, &barrier);
+    reserved_bytes_ -= step.reserved_bytes;
+    resident_bytes_ += step.memory_size;
+  }
+
+  // Whole block rows are copied, as many as fit in the region.
+  VkDeviceSize region = (frame_ % limits_.frames_in_flight) * region_size_;
+  auto* staging = static_cast<std::byte*>(staging_.mapped) + region;
+  while (step.upload_level < texture.first_level) {
+    uint32_t level = step.upload_level;
+    VkExtent3D extent = file.level_extent(level);
+    uint32_t block_rows =
+        (extent.height + file.block_height() - 1) / file.block_height();
+    uint32_t row_blocks =
+        (extent.width + file.block_width() - 1) / file.block_width();
+    // open() checked the level holds exactly these rows.
+    VkDeviceSize block_size = file.block_size();
+    VkDeviceSize row_size = row_blocks * block_size;
+    // Buffer offsets must be multiples of the block size and of 4.
+    VkDeviceSize alignment = std::lcm(block_size, VkDeviceSize{4});
+    VkDeviceSize offset =
+        (region_used_ + alignment - 1) / alignment * alignment;
+    VkDeviceSize rows =
+        offset < region_size_ ? (region_size_ - offset) / row_size : 0;
+    rows = std::min<VkDeviceSize>(rows, block_rows - step.uploaded_rows);
+    if (rows == 0) {
+      return VK_INCOMPLETE;
+    }
+
+    memcpy(staging + offset,
+           step.data.data() + step.level_offsets[level - step.first_level] +
+               step.uploaded_rows * row_size,
+           rows * row_size);
+    uint32_t y = step.uploaded_rows * file.block_height();
+    uint32_t height = std::min(static_cast<uint32_t>(rows) *
+                                   file.block_height(),
+                               extent.height - y);
+    VkBufferImageCopy copy = {
+        region + offset,
+        0,
+        0,
+        {VK_IMAGE_ASPECT_COLOR_BIT, level - step.first_level, 0, 1},
+        {0, static_cast<int32_t>(y), 0},
+        {extent.width, height, 1}};
+    device_.vkCmdCopyBufferToImage(command_buffer, staging_.buffer,
+                                   step.image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                                   &copy);
+    region_used_ = offset + rows * row_size;
+    uploaded_bytes_ += rows * row_size;
+
+    step.uploaded_rows += static_cast<uint32_t>(rows);
+    if (step.uploaded_rows == block_rows) {
+      ++step.upload_level;
+      step.uploaded_rows = 0;
+    }
+  }
+
+  // The texture owns the step's image from here, even on failure.
+  VkResult result = swap_image_(texture, command_buffer, step.image,
+                                step.memory, step.memory_size,
+                                step.first_level);
+  texture.step.reset();
+  return result;
+}
+
+auto gfx::vk_api::TextureStreamer::drop_step_(Texture& texture) -> void
+{
+  // Only steps without an image are dropped, they just hold a reservation.
+  reserved_bytes_ -= texture.step->reserved_bytes;
+  texture.wanted_level = texture.first_level;
+  texture.step.reset();
+}
+
+auto gfx::vk_api::TextureStreamer::create_image_(const Texture& texture,
+                                                 uint32_t first_level,
+                                                 VkImage& image,
+                                                 VkDeviceMemory& memory,
+                                                 VkDeviceSize& memory_size)
+    -> VkResult
+{
+  const Ktx2File& file = texture.file;
+  auto image_create_info =
+      build<VkImageCreateInfo>()
+          .set(&VkImageCreateInfo::imageType, VK_IMAGE_TYPE_2D)
+          .set(&VkImageCreateInfo::format, file.format())
+          .set(&VkImageCreateInfo::extent, file.level_extent(first_level))
+          .set(&VkImageCreateInfo::mipLevels,
+               file.level_count() - first_level)
+          .set(&VkImageCreateInfo::arrayLayers, 1)
+          .set(&VkImageCreateInfo::samples, VK_SAMPLE_COUNT_1_BIT)
+          .set(&VkImageCreateInfo::tiling, VK_IMAGE_TILING_OPTIMAL)
+          .set(&VkImageCreateInfo::usage,
+               VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                   VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                   VK_IMAGE_USAGE_SAMPLED_BIT)
+          .set(&VkImageCreateInfo::sharingMode, VK_SHARING_MODE_EXCLUSIVE)
+          .set(&VkImageCreateInfo::initialLayout, VK_IMAGE_LAYOUT_UNDEFINED);
+  VkResult result =
+      device_.vkCreateImage(device_.logical_device, &image_create_info.get(),
+                            allocation_callbacks(), &image);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkMemoryRequirements requirements;
+  device_.vkGetImageMemoryRequirements(device_.logical_device, image,
+                                       &requirements);
+  uint32_t memory_type =
+      find_memory_type(device_, requirements.memoryTypeBits,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  VkMemoryAllocateInfo allocate_info =
+      build<VkMemoryAllocateInfo>()
+          .set(&VkMemoryAllocateInfo::allocationSize, requirements.size)
+          .set(&VkMemoryAllocateInfo::memoryTypeIndex, memory_type);
+  memory = VK_NULL_HANDLE;
+  result = memory_type == UINT32_MAX
+               ? VK_ERROR_OUT_OF_DEVICE_MEMORY
+               : device_.vkAllocateMemory(device_.logical_device,
+                                          &allocate_info,
+                                          allocation_callbacks(), &memory);
+  if (result == VK_SUCCESS) {
+    result =
+        device_.vkBindImageMemory(device_.logical_device, image, memory, 0);
+  }
+  if (result != VK_SUCCESS) {
+    // Never used by the GPU, no need to wait for the frames in flight.
+    device_.vkDestroyImage(device_.logical_device, image,
+                           allocation_callbacks());
+    if (memory != VK_NULL_HANDLE) {
+      device_.vkFreeMemory(device_.logical_device, memory,
+                           allocation_callbacks());
+    }
+    image = VK_NULL_HANDLE;
+    memory = VK_NULL_HANDLE;
+    return result;
+  }
+  memory_size = requirements.size;
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::TextureStreamer::swap_image_(
+    Texture& texture, VkCommandBuffer command_buffer, VkImage image,
+    VkDeviceMemory memory, VkDeviceSize memory_size, uint32_t first_level)
+    -> VkResult
+{
+  const Ktx2File& file = texture.file;
+  uint32_t level_count = file.level_count();
+  if (texture.image != VK_NULL_HANDLE) {
+    // Earlier frames may still sample the old image.
+    VkImageMemoryBarrier barrier = image_barrier(
+        texture.image, level_count - texture.first_level, 0,
+        VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    device_.vkCmdPipelineBarrier(command_buffer, SAMPLING_STAGES,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                                 0, nullptr, 1, &barrier);
+    std::vector<VkImageCopy> copies;
+    for (uint32_t level = std::max(texture.first_level, first_level);
+         level < level_count; ++level) {
+      copies.push_back(
+          {{VK_IMAGE_ASPECT_COLOR_BIT, level - texture.first_level, 0, 1},
+           {0, 0, 0},
+           {VK_IMAGE_ASPECT_COLOR_BIT, level - first_level, 0, 1},
+           {0, 0, 0},
+           file.level_extent(level)});
+    }
+    device_.vkCmdCopyImage(command_buffer, texture.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(copies.size()),
+                           copies.data());
+  }
+  VkImageMemoryBarrier barrier = image_barrier(
+      image, level_count - first_level, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  device_.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               SAMPLING_STAGES, 0, 0, nullptr, 0, nullptr, 1,
+                               &barrier);
+
+  destroy_image_(texture);
+  texture.image = image;
+  texture.memory = memory;
+  texture.memory_size = memory_size;
+  texture.first_level = first_level;
+
+  VkImageViewCreateInfo view_create_info =
+      build<VkImageViewCreateInfo>()
+          .set(&VkImageViewCreateInfo::image, image)
+          .set(&VkImageViewCreateInfo::viewType, VK_IMAGE_VIEW_TYPE_2D)
+          .set(&VkImageViewCreateInfo::format, file.format())
+          .set(&VkImageViewCreateInfo::subresourceRange,
+               VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                                       level_count - first_level, 0, 1});
+  VkResult result =
+      device_.vkCreateImageView(device_.logical_device, &view_create_info,
+                                allocation_callbacks(), &texture.view);
+  if (result != VK_SUCCESS) {
+    texture.view = VK_NULL_HANDLE;
+  }
+  return result;
+}
+
+auto gfx::vk_api::TextureStreamer::destroy_image_(Texture& texture) -> void
+{
+  // The deletion queue keeps them until the frames using them retire.
+  device_.deletion_queue->destroy(texture.view);
+  device_.deletion_queue->destroy(texture.image);
+  device_.deletion_queue->destroy(texture.memory);
+  resident_bytes_ -= texture.memory_size;
+  texture.view = VK_NULL_HANDLE;
+  texture.image = VK_NULL_HANDLE;
+  texture.memory = VK_NULL_HANDLE;
+  texture.memory_size = 0;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "ktx2.h"
+#include "thread_pool.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+struct TextureStreamingLimits {
+  // Host visible upload memory, split evenly between the frames in flight.
+  // Levels larger than a frame's share are uploaded over several frames.
+  VkDeviceSize staging_size = 48ull << 20;
+  // Device memory the textures may take, finest levels are evicted past it.
+  VkDeviceSize memory_budget = 512ull << 20;
+  // Levels this size or smaller are loaded with the texture and never
+  // evicted, so every texture can be sampled.
+  uint32_t mip_tail_size = 128;
+  // Steps decoding or waiting for their upload at once, which bounds the
+  // decoded data held in memory.
+  uint32_t max_pending_steps = 16;
+  uint32_t frames_in_flight = 3;
+};
+
+using TextureHandle = uint32_t;
+
+struct TextureStats {
+  uint32_t textures;
+  // Textures whose finest wanted level is resident.
+  uint32_t complete_textures;
+  VkDeviceSize resident_bytes;
+  VkDeviceSize memory_budget;
+  // Steps waiting for their levels to be decoded or uploaded.
+  uint32_t pending_steps;
+  // During the last record_uploads().
+  VkDeviceSize uploaded_bytes;
+  uint32_t evicted_levels;
+};
+
+// ************************************************************ //
+// TextureStreamer                                              //
+//                                                              //
+// Streams KTX2 textures in progressively. A texture starts     //
+// with its mip tail, then grows one level at a time towards    //
+// the finest level requested, smallest steps first across all  //
+// textures. Levels are decoded on the thread pool, copied to a //
+// staging ring and uploaded within a per frame byte budget.    //
+// Residency changes reallocate the image with the new level    //
+// range and copy the kept levels on the GPU, so the image and  //
+// its view change. Past the memory budget, the finest levels   //
+// of the least recently requested textures are evicted. When   //
+// the device is lost every level is dropped, the textures then //
+// stream in again from their files, mip tail first.            //
+// ************************************************************ //
+class TextureStreamer {
+ public:
+  // The device and the thread pool must outlive the streamer. Returns the
+  // result of creating the staging buffer, streamer is only set on success.
+  static auto create(VulkanDevice& device, ThreadPool& thread_pool,
+                     const TextureStreamingLimits& limits,
+                     std::unique_ptr<TextureStreamer>& streamer) -> VkResult;
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+  // Maps the file and queues its mip tail. Returns
+  // VK_ERROR_FORMAT_NOT_SUPPORTED if the file is not a supported KTX2
+  // texture, and VK_ERROR_OUT_OF_DEVICE_MEMORY if a block row of it does
+  // not fit in a frame's staging region. texture is only set on success.
+  // Textures live as long as the streamer.
+  auto load(const char* path, TextureHandle& texture) -> VkResult;
+  // Finest level the renderer needs this frame, 0 for the full resolution.
+  // Textures not requested for a while are the first evicted.
+  auto request(TextureHandle texture, uint32_t finest_level) -> void;
+
+  // Records this frame's uploads, evictions and image swaps. Must be
+  // recorded outside of a render pass on the graphics queue, once per
+  // frame, before the draws sampling the textures. Returns the result of
+  // the first image or view that could not be created: that texture stays
+  // at its levels, and what was recorded must still be submitted.
+  auto record_uploads(VkCommandBuffer command_buffer) -> VkResult;
+
+  // Null until the mip tail is uploaded. Changes when the residency does,
+  // fetch it again after every record_uploads(). In the shader read only
+  // layout.
+  auto view(TextureHandle texture) const -> VkImageView;
+  // Finest resident level, the level count when none is.
+  auto resident_level(TextureHandle texture) const -> uint32_t;
+  auto stats() const -> TextureStats;
+
+ private:
+  // Growth of a texture by the levels [first_level, texture first level).
+  struct Step {
+    uint32_t first_level;
+    // Decoded levels, back to back, with their position in data.
+    std::vector<std::byte> data;
+    std::vector<size_t> level_offsets;
+    std::atomic<bool> decoded;
+    bool failed;
+    // Budget held for the step until its image exists.
+    VkDeviceSize reserved_bytes;
+
+    VkImage image;
+    VkDeviceMemory memory;
+    VkDeviceSize memory_size;
+    // Upload progress, in level and in block rows of that level.
+    uint32_t upload_level;
+    uint32_t uploaded_rows;
+  };
+
+  struct Texture {
+    Ktx2File file;
+    uint32_t tail_level;
+    uint32_t wanted_level;
+    uint64_t last_requested;
+    // First level held by the image, the level count when there is none.
+    uint32_t first_level;
+    VkImage image;
+    VkDeviceMemory memory;
+    VkDeviceSize memory_size;
+    VkImageView view;
+    std::unique_ptr<Step> step;
+  };
+
+  TextureStreamer(VulkanDevice& device, ThreadPool& thread_pool,
+                  const TextureStreamingLimits& limits);
+
+  auto create_staging_() -> VkResult;
+  // Drops the steps and the images, the textures keep their files and
+  // requests.
+  auto release_() -> void;
+  auto start_steps_(VkCommandBuffer command_buffer) -> VkResult;
+  // Shrinks least recently requested textures until bytes more fit in the
+  // budget. Returns VK_INCOMPLETE if not enough could be freed.
+  auto evict_(VkDeviceSize bytes, const Texture* keep,
+              VkCommandBuffer command_buffer) -> VkResult;
+  // Uploads as much of the step as fits in the frame's staging region.
+  // Returns VK_INCOMPLETE when the region is full.
+  auto upload_step_(Texture& texture, VkCommandBuffer command_buffer)
+      -> VkResult;
+  // Drops a step whose image was not created yet, the texture stays at its
+  // levels rather than retrying every frame.
+  auto drop_step_(Texture& texture) -> void;
+  // Nothing is left created on failure.
+  auto create_image_(const Texture& texture, uint32_t first_level,
+                     VkImage& image, VkDeviceMemory& memory,
+                     VkDeviceSize& memory_size) -> VkResult;
+  // Copies the levels both images hold from the texture's image, then
+  // replaces it with the new one, left in the shader read only layout. The
+  // image is swapped even when its view cannot be created, the view is then
+  // null.
+  auto swap_image_(Texture& texture, VkCommandBuffer command_buffer,
+                   VkImage image, VkDeviceMemory memory,
+                   VkDeviceSize memory_size, uint32_t first_level)
+      -> VkResult;
+  auto destroy_image_(Texture& texture) -> void;
+
+  VulkanDevice& device_;
+  ThreadPool& thread_pool_;
+  TextureStreamingLimits limits_;
+
+  Buffer staging_;
+  VkDeviceSize region_size_;
+  VkDeviceSize region_used_;
+  uint64_t frame_;
+
+  std::vector<std::unique_ptr<Texture>> textures_;
+  VkDeviceSize resident_bytes_;
+  VkDeviceSize reserved_bytes_;
+  std::atomic<uint32_t> pending_decodes_;
+
+  VkDeviceSize uploaded_bytes_;
+  uint32_t evicted_levels_;
+  uint64_t resource_id_;
+};
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,127 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+gfx::ThreadPool::ThreadPool(uint32_t worker_count)
+    : running_(0), stopping_(false)
+{
+  workers_.reserve(worker_count);
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    workers_.emplace_back([this] { worker_loop_(); });
+  }
+}
+
+gfx::ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_available_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+auto gfx::ThreadPool::submit(std::function<void()> task) -> void
+{
+  if (workers_.empty()) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  task_available_.notify_one();
+}
+
+auto gfx::ThreadPool::parallel_for(
+    uint32_t count, uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)>& body) -> void
+{
+  grain = std::max(grain, 1u);
+  uint32_t chunk_count = (count + grain - 1) / grain;
+  if (chunk_count == 0) {
+    return;
+  }
+  if (chunk_count == 1 || workers_.empty()) {
+    body(0, count);
+    return;
+  }
+
+  // Shared with the helpers, which may still be queued after the caller
+  // took the last chunk.
+  struct Job {
+    std::atomic<uint32_t> next_chunk{0};
+    std::atomic<uint32_t> chunks_done{0};
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  auto job = std::make_shared<Job>();
+  auto run_chunks = [job, count, grain, chunk_count, &body] {
+    uint32_t done = 0;
+    for (uint32_t chunk = job->next_chunk++; chunk < chunk_count;
+         chunk = job->next_chunk++) {
+      uint32_t begin = chunk * grain;
+      body(begin, std::min(begin + grain, count));
+      ++done;
+    }
+    if (done > 0 && job->chunks_done.fetch_add(done) + done == chunk_count) {
+      std::lock_guard<std::mutex> lock(job->mutex);
+      job->done.notify_all();
+    }
+  };
+
+  // Helpers that find no chunk left return without touching body.
+  uint32_t helpers =
+      std::min(static_cast<uint32_t>(workers_.size()), chunk_count - 1);
+  for (uint32_t i = 0; i < helpers; ++i) {
+    submit(run_chunks);
+  }
+  run_chunks();
+
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->done.wait(lock, [&job, chunk_count] {
+    return job->chunks_done.load() == chunk_count;
+  });
+}
+
+auto gfx::ThreadPool::wait_idle() -> void
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return tasks_.empty() && running_ == 0; });
+}
+
+auto gfx::ThreadPool::worker_count() const -> uint32_t
+{
+  return static_cast<uint32_t>(workers_.size());
+}
+
+auto gfx::ThreadPool::default_worker_count() -> uint32_t
+{
+  uint32_t hardware_threads = std::thread::hardware_concurrency();
+  return hardware_threads > 1 ? hardware_threads - 1 : 0;
+}
+
+auto gfx::ThreadPool::worker_loop_() -> void
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    task_available_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+    if (tasks_.empty()) {
+      return;
+    }
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    ++running_;
+    lock.unlock();
+    task();
+    lock.lock();
+    --running_;
+    if (tasks_.empty() && running_ == 0) {
+      idle_.notify_all();
+    }
+  }
+}
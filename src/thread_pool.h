@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gfx {
+
+// ************************************************************ //
+// ThreadPool                                                   //
+//                                                              //
+// Fixed set of worker threads taking tasks from a shared       //
+// queue. parallel_for() splits a range in chunks the workers   //
+// and the calling thread take in turns, and returns once all   //
+// of them are done, so it may be called from any thread.       //
+// ************************************************************ //
+class ThreadPool {
+ public:
+  // Defaults to one worker per hardware thread besides the caller's.
+  explicit ThreadPool(uint32_t worker_count = default_worker_count());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  auto submit(std::function<void()> task) -> void;
+  // Calls body(begin, end) over [0, count) in chunks of at most grain.
+  auto parallel_for(uint32_t count, uint32_t grain,
+                    const std::function<void(uint32_t, uint32_t)>& body)
+      -> void;
+  // Blocks until every submitted task has run.
+  auto wait_idle() -> void;
+
+  auto worker_count() const -> uint32_t;
+  static auto default_worker_count() -> uint32_t;
+
+ private:
+  auto worker_loop_() -> void;
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  std::condition_variable idle_;
+  std::deque<std::function<void()>> tasks_;
+  uint32_t running_;
+  bool stopping_;
+};
+
+}  // namespace gfx
@@ -1,35 +1,65 @@
 #include "vulkan_api.h"
+#if defined(_WIN32)
 #include <Windows.h>
-#include <map>
-#include <set>
-
+#else
+#include <dlfcn.h>
+#endif
+#include <fstream>
+#include <utility>
+#include "frame_arena.h"
+#include "host_allocator.h"
+#include "log.h"
+#include "metrics.h"
+#include "vulkan_builders.h"
+#include "vulkan_capture.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_metrics.h"
+#include "vulkan_null_driver.h"
+#include "vulkan_object_cache.h"
+#include "vulkan_recovery.h"
+#include "vulkan_startup.h"
+#include "vulkan_submit.h"
+#include "vulkan_sync.h"
+
+#if defined(_WIN32)
+#define VULKAN_LIBRARY_NAME "vulkan-1.dll"
+#define load_library LoadLibrary
 #define load_proc_address GetProcAddress
+#define free_library FreeLibrary
+#else
+#define VULKAN_LIBRARY_NAME "libvulkan.so.1"
+#define load_library(name) dlopen(name, RTLD_NOW | RTLD_LOCAL)
+#define load_proc_address dlsym
+#define free_library dlclose
+#endif
 
+// The loaders return from initialize() when an entry point is missing.
 #define vk_load_exported_function(fun)                               \
   if (!(fun = (PFN_##fun)load_proc_address(VULKAN_LIBRARY, #fun))) { \
-    std::cerr << "Could not load exported function: " << #fun << "!" \
-              << std::endl;                                          \
-    std::terminate();                                                \
+    GFX_LOG_ERROR("Could not load exported function: {}!", #fun);    \
+    return fail_initialize(VK_ERROR_INITIALIZATION_FAILED);          \
   }
 
-#define vk_global_level_function(fun)                                    \
-  if (!(fun = (PFN_##fun)vkGetInstanceProcAddr(nullptr, #fun))) {        \
-    std::cerr << "Could not load global level function: " << #fun << "!" \
-              << std::endl;                                              \
-    std::terminate();                                                    \
+#define vk_global_level_function(fun)                                 \
+  if (!(fun = (PFN_##fun)vkGetInstanceProcAddr(nullptr, #fun))) {     \
+    GFX_LOG_ERROR("Could not load global level function: {}!", #fun); \
+    return fail_initialize(VK_ERROR_INITIALIZATION_FAILED);           \
   }
 
-#define vk_instance_level_function(fun)                                    \
-  if (!(fun = (PFN_##fun)vkGetInstanceProcAddr(VK_INSTANCE, #fun))) {      \
-    std::cerr << "Could not load instance level function: " << #fun << "!" \
-              << std::endl;                                                \
-    std::terminate();                                                      \
+#define vk_instance_level_function(fun)                                 \
+  if (!(fun = (PFN_##fun)vkGetInstanceProcAddr(VK_INSTANCE, #fun))) {   \
+    GFX_LOG_ERROR("Could not load instance level function: {}!", #fun); \
+    return fail_initialize(VK_ERROR_INITIALIZATION_FAILED);             \
   }
 
 namespace gfx::vk_api {
 
 // Vulkan dynamic library handle.
+#if defined(_WIN32)
 typedef HMODULE LibraryHandle;
+#else
+typedef void* LibraryHandle;
+#endif
 LibraryHandle VULKAN_LIBRARY;
 // Vulkan instance definition.
 VkInstance VK_INSTANCE;
@@ -39,45 +69,179 @@ const std::vector<const char*> DEVICE_EXTENSIONS = {
 
 }  // namespace gfx::vk_api
 
-auto gfx::vk_api::initialize() -> void
+namespace gfx::vk_api {
+
+namespace {
+
+// Releases what a failed initialize() loaded, returns the result.
+auto fail_initialize(VkResult result) -> VkResult
+{
+  if (VK_INSTANCE != VK_NULL_HANDLE && vkDestroyInstance != nullptr) {
+    vkDestroyInstance(VK_INSTANCE, allocation_callbacks());
+  }
+  VK_INSTANCE = VK_NULL_HANDLE;
+  if (VULKAN_LIBRARY != nullptr) {
+    free_library(VULKAN_LIBRARY);
+    VULKAN_LIBRARY = nullptr;
+  }
+  return result;
+}
+
+// Runs fn(present_queue) serialized with the submissions of the timeline on
+// the same queue, if there is one. A dedicated present queue is only used by
+// the render thread.
+template <typename F>
+auto with_present_queue(VulkanDevice& device, F&& fn) -> VkResult
 {
-  // Step 1: Load Vulkan library:
-  VULKAN_LIBRARY = LoadLibrary("vulkan-1.dll");
-  if (VULKAN_LIBRARY == nullptr) {
-    std::cerr << "Could not load Vulkan library!\n";
-    std::terminate();
+  if (device.graphics_timeline &&
+      device.present_queue == device.graphics_queue) {
+    return device.graphics_timeline->with_queue(fn);
+  }
+  if (device.compute_timeline && device.present_queue == device.compute_queue) {
+    return device.compute_timeline->with_queue(fn);
+  }
+  return fn(device.present_queue);
+}
+
+// Destroys the swap chain and the semaphores of the surface, not the surface.
+auto release_surface(VulkanDevice& device, Surface& surface) -> void
+{
+  // The cached views and framebuffers of the images go before them.
+  for (VkImage image : surface.images) {
+    device.object_cache->evict_image(image);
+  }
+  if (surface.swap_chain != VK_NULL_HANDLE) {
+    device.vkDestroySwapchainKHR(device.logical_device, surface.swap_chain,
+                                 allocation_callbacks());
   }
-  std::cout << "Vulkan library loaded.\n";
+  for (VkSemaphore semaphore : {surface.image_available_semaphore,
+                                surface.rendering_finished_semaphore}) {
+    if (semaphore != VK_NULL_HANDLE) {
+      device.vkDestroySemaphore(device.logical_device, semaphore,
+                                allocation_callbacks());
+    }
+  }
+  surface.swap_chain = VK_NULL_HANDLE;
+  surface.images.clear();
+  surface.image_available_semaphore = VK_NULL_HANDLE;
+  surface.rendering_finished_semaphore = VK_NULL_HANDLE;
+}
+
+auto create_surface_semaphores(VulkanDevice& device, Surface& surface)
+    -> VkResult
+{
+  surface.image_available_semaphore = create_semaphore(device);
+  surface.rendering_finished_semaphore = create_semaphore(device);
+  if (surface.image_available_semaphore == VK_NULL_HANDLE ||
+      surface.rendering_finished_semaphore == VK_NULL_HANDLE) {
+    release_surface(device, surface);
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  return VK_SUCCESS;
+}
+
+// Completes the surface around its VkSurfaceKHR, which is destroyed on
+// failure. The device releases the semaphores and the swap chain when lost
+// and creates them again once recovered.
+auto attach_surface(VulkanDevice& device, const os::WindowParameters& window,
+                    VkSurfaceKHR handle, Surface& surface) -> VkResult
+{
+  surface.window = window;
+  surface.surface = handle;
+  VkResult result = create_surface_semaphores(device, surface);
+  if (result != VK_SUCCESS) {
+    destroy_window_surface(handle);
+    surface.surface = VK_NULL_HANDLE;
+    return result;
+  }
+  Surface* target = &surface;
+  surface.resource_id = device.resources->add(
+      [target](VulkanDevice& device) { release_surface(device, *target); },
+      [target](VulkanDevice& device) {
+        VkResult result = create_surface_semaphores(device, *target);
+        // Only surfaces that had a swap chain get one, the extent is left
+        // from it.
+        if (result == VK_SUCCESS && target->extent.width != 0) {
+          result = create_surface_swap_chain(device, *target);
+        }
+        return result;
+      });
+  return VK_SUCCESS;
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::initialize(bool headless) -> VkResult
+{
+  ArenaScope scratch;
+  // The timings are of this instance alone, not added to those of an
+  // instance destroyed before, as on a device loss.
+  StartupTimings& timings = startup_timings();
+  timings = {};
+  auto stage_start = std::chrono::steady_clock::now();
+  // Returns the time elapsed since the previous stage ended.
+  auto end_stage = [&stage_start]() -> double {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::milli> elapsed = now - stage_start;
+    stage_start = now;
+    return elapsed.count();
+  };
 
-  // Step 2: Load the exported entry point.
-  vk_load_exported_function(vkGetInstanceProcAddr);
-  std::cout << "Vulkan exported entry point loaded.\n";
+  VULKAN_LIBRARY = nullptr;
+  VK_INSTANCE = VK_NULL_HANDLE;
+  vkDestroyInstance = nullptr;
+
+  // Step 1 and 2: Load Vulkan library and its exported entry point, unless
+  // the null driver stands in for both.
+  if (null_driver_enabled()) {
+    if (!headless) {
+      GFX_LOG_ERROR("The null driver only creates headless devices!");
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    vkGetInstanceProcAddr = null_driver_entry_point();
+    GFX_LOG_INFO("Vulkan null driver loaded.");
+  }
+  else {
+    VULKAN_LIBRARY = load_library(VULKAN_LIBRARY_NAME);
+    if (VULKAN_LIBRARY == nullptr) {
+      GFX_LOG_ERROR("Could not load Vulkan library!");
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    GFX_LOG_INFO("Vulkan library loaded.");
+    vk_load_exported_function(vkGetInstanceProcAddr);
+    GFX_LOG_INFO("Vulkan exported entry point loaded.");
+  }
 
   // Step 3: Load global level entry points.
   vk_global_level_function(vkCreateInstance);
   vk_global_level_function(vkEnumerateInstanceExtensionProperties);
-  std::cout << "Vulkan global level entry points loaded.\n";
+  GFX_LOG_INFO("Vulkan global level entry points loaded.");
+  timings.library_load_ms = end_stage();
 
   // Step 4: Checking Whether an Instance Extension Is Supported.
 
   uint32_t extensions_count = 0;
-  if ((vkEnumerateInstanceExtensionProperties(nullptr, &extensions_count,
-                                              nullptr) != VK_SUCCESS) ||
-      (extensions_count == 0)) {
-    std::cerr << "Error occurred during instance extensions enumeration!"
-              << std::endl;
-    std::terminate();
-  }
-  std::vector<VkExtensionProperties> available_extensions(extensions_count);
-  if (vkEnumerateInstanceExtensionProperties(nullptr, &extensions_count,
-                                             available_extensions.data()) !=
-      VK_SUCCESS) {
-    std::cerr << "Error occurred during instance extensions enumeration!"
-              << std::endl;
-    std::terminate();
+  VkResult result = vkEnumerateInstanceExtensionProperties(
+      nullptr, &extensions_count, nullptr);
+  if (result == VK_SUCCESS && extensions_count == 0 && !headless) {
+    result = VK_ERROR_EXTENSION_NOT_PRESENT;
+  }
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Error occurred during instance extensions enumeration!");
+    return fail_initialize(result);
+  }
+  ScratchVector<VkExtensionProperties> available_extensions(extensions_count,
+                                                           &frame_arena());
+  result = vkEnumerateInstanceExtensionProperties(
+      nullptr, &extensions_count, available_extensions.data());
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Error occurred during instance extensions enumeration!");
+    return fail_initialize(result);
   }
 
-  std::vector<const char*> extensions = {
+  const char* surface_extensions[] = {
     VK_KHR_SURFACE_EXTENSION_NAME,
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
     VK_KHR_WIN32_SURFACE_EXTENSION_NAME
@@ -88,13 +252,32 @@ auto gfx::vk_api::initialize() -> void
 #endif
   };
 
-  for (size_t i = 0; i < extensions.size(); ++i) {
-    if (!check_extension_availability(extensions[i], available_extensions)) {
-      std::cerr << "Could not find instance extension named \"" << extensions[i]
-                << "\"!" << std::endl;
-      std::terminate();
+  // Headless instances enable no surface extension, they cannot create
+  // surfaces.
+  StackArray<const char*, 3> extensions;
+  uint32_t surface_extension_count =
+      headless ? 0 : std::size(surface_extensions);
+  for (uint32_t i = 0; i < surface_extension_count; ++i) {
+    if (!check_extension_availability(surface_extensions[i],
+                                      available_extensions.data(),
+                                      extensions_count)) {
+      GFX_LOG_ERROR("Could not find instance extension named \"{}\"!",
+                    surface_extensions[i]);
+      return fail_initialize(VK_ERROR_EXTENSION_NOT_PRESENT);
     }
+    extensions.push_back(surface_extensions[i]);
   }
+  // The instance is created for Vulkan 1.0, device extensions such as
+  // timeline semaphores depend on this one, and their features are only
+  // queried through it.
+  bool properties2 = check_extension_availability(
+      VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+      available_extensions.data(), extensions_count);
+  if (properties2) {
+    extensions.push_back(
+        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+  }
+  timings.instance_extensions_ms = end_stage();
 
   // Step 5: Create the Vulkan Instance.
   // The Vulkan Instance stores all per-application states.
@@ -103,130 +286,194 @@ auto gfx::vk_api::initialize() -> void
   // information to the driver to optimize for our specific application, for
   // example because it uses a well-known graphics engine with certain special
   // behavior.
-  VkApplicationInfo application_info = {
-      VK_STRUCTURE_TYPE_APPLICATION_INFO,  // sType
-      nullptr,                             // *pNext
-      "vulkan-learning",                   // *pApplicationName
-      VK_MAKE_VERSION(1, 0, 0),            // applicationVersion
-      "No Engine",                         // *pEngineName
-      VK_MAKE_VERSION(1, 0, 0),            // engineVersion
-      VK_MAKE_VERSION(1, 0, 0)             // apiVersion
-  };
+  constexpr VkApplicationInfo application_info =
+      build<VkApplicationInfo>()
+          .set(&VkApplicationInfo::pApplicationName, "vulkan-learning")
+          .set(&VkApplicationInfo::applicationVersion, VK_MAKE_VERSION(1, 0, 0))
+          .set(&VkApplicationInfo::pEngineName, "No Engine")
+          .set(&VkApplicationInfo::engineVersion, VK_MAKE_VERSION(1, 0, 0))
+          .set(&VkApplicationInfo::apiVersion, VK_MAKE_VERSION(1, 0, 0));
 
   // This struct is not optional and tells the Vulkan driver which global
   // extensions and validation layers we want to use. Global here means that
   // they apply to the entire program and not a specific device.
 
-  VkInstanceCreateInfo instance_create_info = {
-      VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,    // sType
-      nullptr,                                   //  pNext
-      0,                                         //  flags
-      &application_info,                         // *pApplicationInfo
-      0,                                         //  enabledLayerCount
-      nullptr,                                   // *ppEnabledLayerNames
-      static_cast<uint32_t>(extensions.size()),  //  enabledExtensionCount
-      &extensions[0]                             // *ppEnabledExtensionNames
-  };
+  VkInstanceCreateInfo instance_create_info =
+      build<VkInstanceCreateInfo>()
+          .set(&VkInstanceCreateInfo::pApplicationInfo, &application_info)
+          .set(&VkInstanceCreateInfo::enabledExtensionCount,
+               extensions.count())
+          .set(&VkInstanceCreateInfo::ppEnabledExtensionNames,
+               extensions.data());
 
   // Try create the vulkan instance.
-  if (vkCreateInstance(&instance_create_info, nullptr, &VK_INSTANCE) !=
-      VK_SUCCESS) {
-    std::cerr << "Could not create Vulkan instance!" << std::endl;
-    std::terminate();
+  result = vkCreateInstance(&instance_create_info, allocation_callbacks(),
+                            &VK_INSTANCE);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create Vulkan instance: {}!", result_name(result));
+    VK_INSTANCE = VK_NULL_HANDLE;
+    return fail_initialize(result);
   }
-  std::cout << "Vulkan Instance created.\n";
+  GFX_LOG_INFO("Vulkan Instance created.");
+  timings.instance_creation_ms = end_stage();
 
-  // Step 5: Load instance level entry points.
+  // Step 5: Load instance level entry points, the destructor first to
+  // destroy the instance if another one is missing.
+  vk_instance_level_function(vkDestroyInstance);
   vk_instance_level_function(vkEnumeratePhysicalDevices);
   vk_instance_level_function(vkGetPhysicalDeviceProperties);
   vk_instance_level_function(vkGetPhysicalDeviceFeatures);
   vk_instance_level_function(vkGetPhysicalDeviceQueueFamilyProperties);
+  vk_instance_level_function(vkGetPhysicalDeviceMemoryProperties);
   vk_instance_level_function(vkCreateDevice);
   vk_instance_level_function(vkGetDeviceProcAddr);
-  vk_instance_level_function(vkDestroyInstance);
   vk_instance_level_function(vkEnumerateDeviceExtensionProperties);
+  // Optional, the features of the device extensions stay unknown without.
+  vkGetPhysicalDeviceFeatures2KHR = nullptr;
+  if (properties2) {
+    vk_instance_level_function(vkGetPhysicalDeviceFeatures2KHR);
+  }
   // Swap chain extensions functions.
-  vk_instance_level_function(vkGetPhysicalDeviceSurfaceSupportKHR);
-  vk_instance_level_function(vkGetPhysicalDeviceSurfaceCapabilitiesKHR);
-  vk_instance_level_function(vkGetPhysicalDeviceSurfaceFormatsKHR);
-  vk_instance_level_function(vkGetPhysicalDeviceSurfacePresentModesKHR);
-  vk_instance_level_function(vkDestroySurfaceKHR);
+  if (!headless) {
+    vk_instance_level_function(vkGetPhysicalDeviceSurfaceSupportKHR);
+    vk_instance_level_function(vkGetPhysicalDeviceSurfaceCapabilitiesKHR);
+    vk_instance_level_function(vkGetPhysicalDeviceSurfaceFormatsKHR);
+    vk_instance_level_function(vkGetPhysicalDeviceSurfacePresentModesKHR);
+    vk_instance_level_function(vkDestroySurfaceKHR);
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
-  vk_instance_level_function(vkCreateWin32SurfaceKHR);
+    vk_instance_level_function(vkCreateWin32SurfaceKHR);
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-  vk_instance_level_function(vkCreateXcbSurfaceKHR);
+    vk_instance_level_function(vkCreateXcbSurfaceKHR);
 #elif defined(VK_USE_PLATFORM_XLIB_KHR)
-  vk_instance_level_function(vkCreateXlibSurfaceKHR);
+    vk_instance_level_function(vkCreateXlibSurfaceKHR);
 #endif
+  }
 
-  std::cout << "Vulkan instance level entry points loaded.\n";
+  GFX_LOG_INFO("Vulkan instance level entry points loaded.");
+  timings.entry_points_ms = end_stage();
 
-  std::cout << "Vulkan api initialized.\n";
-}
+  // Step 6: Query the physical devices in the background, the application
+  // keeps going (creating its window) until it needs a device.
+  begin_physical_device_snapshot(VK_INSTANCE);
 
-auto gfx::vk_api::destroy() -> void { vkDestroyInstance(VK_INSTANCE, nullptr); }
+  GFX_LOG_INFO("Vulkan api initialized.");
+  return VK_SUCCESS;
+}
 
-auto gfx::vk_api::create_device(const os::WindowParameters& window)
-    -> VulkanDevice
+auto gfx::vk_api::destroy() -> void
 {
-  VulkanDevice device = {};
-
-  // Step 1: create the surface.
-  VkSurfaceKHR surface = create_window_surface(window);
-  device.surface = surface;
-
-  // Step 2: pick the most suitable physical device.
-  device.physical_device = pick_best_physical_device_for_surface(surface);
-
-  // Step 3: create the logical device.
+  release_physical_device_snapshot();
+  vkDestroyInstance(VK_INSTANCE, allocation_callbacks());
+}
 
-  QueueFamilyIndices indices =
-      find_queue_families(device.physical_device, surface);
+auto gfx::vk_api::create_logical_device(
+    VulkanDevice& device, const PhysicalDeviceInfo& physical_device,
+    const QueueFamilyIndices& indices, bool presentable) -> VkResult
+{
+  ArenaScope scratch;
   float queue_priority = 1.0f;
 
-  // Create a set of all unique queue families that are necessary for the
+  // One queue create info per unique queue family that is necessary for the
   // required queues.
-  std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
-  std::set<uint32_t> unique_queue_families = {indices.graphics_family.value(),
-                                              indices.present_family.value()};
-
-  for (uint32_t queueFamily : unique_queue_families) {
-    VkDeviceQueueCreateInfo queue_create_info = {};
-    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_create_info.queueFamilyIndex = queueFamily;
-    queue_create_info.queueCount = 1;
-    queue_create_info.pQueuePriorities = &queue_priority;
-    queue_create_infos.push_back(queue_create_info);
+  StackArray<VkDeviceQueueCreateInfo, 3> queue_create_infos;
+  auto queue_create_info =
+      build<VkDeviceQueueCreateInfo>()
+          .set(&VkDeviceQueueCreateInfo::queueFamilyIndex,
+               indices.graphics_family.value())
+          .set(&VkDeviceQueueCreateInfo::queueCount, 1)
+          .set(&VkDeviceQueueCreateInfo::pQueuePriorities, &queue_priority);
+  queue_create_infos.push_back(queue_create_info);
+  if (indices.present_family.value() != indices.graphics_family.value()) {
+    queue_create_infos.push_back(
+        queue_create_info.set(&VkDeviceQueueCreateInfo::queueFamilyIndex,
+                              indices.present_family.value()));
+  }
+  if (indices.compute_family.has_value() &&
+      indices.compute_family.value() != indices.present_family.value()) {
+    queue_create_infos.push_back(
+        queue_create_info.set(&VkDeviceQueueCreateInfo::queueFamilyIndex,
+                              indices.compute_family.value()));
   }
 
-  // Specifying used device features.
+  // Specifying used device features. Indirect draws need both features to
+  // issue every batch in one call.
   VkPhysicalDeviceFeatures device_features = {};
+  device_features.multiDrawIndirect =
+      physical_device.features.multiDrawIndirect;
+  device_features.drawIndirectFirstInstance =
+      physical_device.features.drawIndirectFirstInstance;
+  device.enabled_features = device_features;
+  device.presentable = presentable;
+
+  // Optional extensions: timeline semaphores let the CPU track GPU progress
+  // without fences, they are enabled whenever the device reports the
+  // feature.
+  ScratchVector<const char*> enabled_extensions(&frame_arena());
+  if (presentable) {
+    enabled_extensions.insert(enabled_extensions.end(),
+                              DEVICE_EXTENSIONS.begin(),
+                              DEVICE_EXTENSIONS.end());
+  }
+
+  auto timeline_features =
+      build<VkPhysicalDeviceTimelineSemaphoreFeaturesKHR>()
+          .set(&VkPhysicalDeviceTimelineSemaphoreFeaturesKHR::timelineSemaphore,
+               VK_TRUE)
+          .get();
+  device.timeline_semaphore_supported = physical_device.timeline_semaphore;
+  if (device.timeline_semaphore_supported) {
+    enabled_extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+  }
+  // Lets the GPU decide how many indirect draws to issue.
+  device.draw_indirect_count_supported = physical_device.supports_extension(
+      VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  if (device.draw_indirect_count_supported) {
+    enabled_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  }
 
   // Creating the logical device.
-  VkDeviceCreateInfo create_info = {};
-  create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  create_info.queueCreateInfoCount =
-      static_cast<uint32_t>(queue_create_infos.size());
-  create_info.pQueueCreateInfos = queue_create_infos.data();
-  create_info.pEnabledFeatures = &device_features;
-  create_info.enabledExtensionCount =
-      static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-  create_info.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
-
-  if (vkCreateDevice(device.physical_device, &create_info, nullptr,
-                     &device.logical_device) != VK_SUCCESS) {
-    std::cerr << "failed to create logical device!\n";
-    std::terminate();
+  auto create_info =
+      build<VkDeviceCreateInfo>()
+          .set(&VkDeviceCreateInfo::queueCreateInfoCount,
+               queue_create_infos.count())
+          .set(&VkDeviceCreateInfo::pQueueCreateInfos,
+               queue_create_infos.data())
+          .set(&VkDeviceCreateInfo::pEnabledFeatures, &device_features)
+          .set(&VkDeviceCreateInfo::enabledExtensionCount,
+               enabled_extensions.size())
+          .set(&VkDeviceCreateInfo::ppEnabledExtensionNames,
+               enabled_extensions.data());
+  if (device.timeline_semaphore_supported) {
+    create_info.next(timeline_features);
+  }
+
+  VkResult result = vkCreateDevice(device.physical_device, &create_info.get(),
+                                   allocation_callbacks(),
+                                   &device.logical_device);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("failed to create logical device: {}!",
+                  result_name(result));
+    device.logical_device = VK_NULL_HANDLE;
+    return result;
   }
+  // Destroys the device created so far. A recovered device still holds the
+  // functions of the lost one, until they are loaded again.
+  device.vkDestroyDevice = nullptr;
+  auto fail = [&device](VkResult result) -> VkResult {
+    if (device.vkDestroyDevice != nullptr) {
+      device.vkDestroyDevice(device.logical_device, allocation_callbacks());
+    }
+    device.logical_device = VK_NULL_HANDLE;
+    return result;
+  };
 
   // Load Device-Level functions.
 
 #define vk_device_level_function(fun)                                       \
   if (!(device.fun =                                                        \
             (PFN_##fun)vkGetDeviceProcAddr(device.logical_device, #fun))) { \
-    std::cerr << "Could not load device level function: " << #fun << "!"    \
-              << std::endl;                                                 \
-    std::terminate();                                                       \
+    GFX_LOG_ERROR("Could not load device level function: {}!", #fun);       \
+    return fail(VK_ERROR_INITIALIZATION_FAILED);                            \
   }
 
   vk_device_level_function(vkGetDeviceQueue);
@@ -235,6 +482,7 @@ auto gfx::vk_api::create_device(const os::WindowParameters& window)
   vk_device_level_function(vkCreateSemaphore);
   vk_device_level_function(vkCreateCommandPool);
   vk_device_level_function(vkAllocateCommandBuffers);
+  vk_device_level_function(vkResetCommandPool);
   vk_device_level_function(vkBeginCommandBuffer);
   vk_device_level_function(vkCmdPipelineBarrier);
   vk_device_level_function(vkCmdClearColorImage);
@@ -243,33 +491,288 @@ auto gfx::vk_api::create_device(const os::WindowParameters& window)
   vk_device_level_function(vkFreeCommandBuffers);
   vk_device_level_function(vkDestroyCommandPool);
   vk_device_level_function(vkDestroySemaphore);
-  vk_device_level_function(vkCreateSwapchainKHR);
-  vk_device_level_function(vkGetSwapchainImagesKHR);
-  vk_device_level_function(vkAcquireNextImageKHR);
-  vk_device_level_function(vkQueuePresentKHR);
-  vk_device_level_function(vkDestroySwapchainKHR);
+  vk_device_level_function(vkCreateFence);
+  vk_device_level_function(vkDestroyFence);
+  vk_device_level_function(vkResetFences);
+  vk_device_level_function(vkWaitForFences);
+  vk_device_level_function(vkGetFenceStatus);
+  vk_device_level_function(vkQueueWaitIdle);
+  vk_device_level_function(vkAllocateMemory);
+  vk_device_level_function(vkMapMemory);
+  vk_device_level_function(vkCreateBuffer);
+  vk_device_level_function(vkGetBufferMemoryRequirements);
+  vk_device_level_function(vkBindBufferMemory);
+  vk_device_level_function(vkCreateImage);
+  vk_device_level_function(vkGetImageMemoryRequirements);
+  vk_device_level_function(vkBindImageMemory);
+  vk_device_level_function(vkCreateImageView);
+  vk_device_level_function(vkCreateSampler);
+  vk_device_level_function(vkCreateRenderPass);
+  vk_device_level_function(vkCreateFramebuffer);
+  vk_device_level_function(vkCreateQueryPool);
+  vk_device_level_function(vkCmdResetQueryPool);
+  vk_device_level_function(vkCmdWriteTimestamp);
+  vk_device_level_function(vkGetQueryPoolResults);
+  vk_device_level_function(vkCreateShaderModule);
+  vk_device_level_function(vkCreateDescriptorSetLayout);
+  vk_device_level_function(vkCreatePipelineLayout);
+  vk_device_level_function(vkCreateComputePipelines);
+  vk_device_level_function(vkCreateDescriptorPool);
+  vk_device_level_function(vkAllocateDescriptorSets);
+  vk_device_level_function(vkUpdateDescriptorSets);
+  vk_device_level_function(vkCmdBindPipeline);
+  vk_device_level_function(vkCmdBindDescriptorSets);
+  vk_device_level_function(vkCmdPushConstants);
+  vk_device_level_function(vkCmdDispatch);
+  vk_device_level_function(vkCmdCopyBuffer);
+  vk_device_level_function(vkCmdCopyBufferToImage);
+  vk_device_level_function(vkCmdCopyImage);
+  vk_device_level_function(vkCmdBlitImage);
+  vk_device_level_function(vkCmdBindVertexBuffers);
+  vk_device_level_function(vkCmdBindIndexBuffer);
+  vk_device_level_function(vkCmdDrawIndexed);
+  vk_device_level_function(vkCmdDrawIndexedIndirect);
+  vk_device_level_function(vkFreeMemory);
+  vk_device_level_function(vkDestroyBuffer);
+  vk_device_level_function(vkDestroyBufferView);
+  vk_device_level_function(vkDestroyImage);
+  vk_device_level_function(vkDestroyImageView);
+  vk_device_level_function(vkDestroySampler);
+  vk_device_level_function(vkDestroyShaderModule);
+  vk_device_level_function(vkDestroyPipelineCache);
+  vk_device_level_function(vkDestroyPipelineLayout);
+  vk_device_level_function(vkDestroyPipeline);
+  vk_device_level_function(vkDestroyRenderPass);
+  vk_device_level_function(vkDestroyFramebuffer);
+  vk_device_level_function(vkDestroyDescriptorSetLayout);
+  vk_device_level_function(vkDestroyDescriptorPool);
+  vk_device_level_function(vkDestroyQueryPool);
+  vk_device_level_function(vkDestroyEvent);
+  if (presentable) {
+    vk_device_level_function(vkCreateSwapchainKHR);
+    vk_device_level_function(vkGetSwapchainImagesKHR);
+    vk_device_level_function(vkAcquireNextImageKHR);
+    vk_device_level_function(vkQueuePresentKHR);
+    vk_device_level_function(vkDestroySwapchainKHR);
+  }
+  if (device.timeline_semaphore_supported) {
+    vk_device_level_function(vkGetSemaphoreCounterValueKHR);
+    vk_device_level_function(vkWaitSemaphoresKHR);
+    vk_device_level_function(vkSignalSemaphoreKHR);
+  }
+  if (device.draw_indirect_count_supported) {
+    vk_device_level_function(vkCmdDrawIndexedIndirectCountKHR);
+  }
 
 #undef vk_device_level_function
 
+  // Capture wraps the functions before anything is created through them.
+  if (capture_enabled()) {
+    install_capture(device);
+  }
+  if (metrics_enabled()) {
+    install_metrics(device);
+  }
+
   // Retrieving queue handles.
-  device.vkGetDeviceQueue(device.logical_device,
-                          indices.graphics_family.value(), 0,
+  device.graphics_family = indices.graphics_family.value();
+  device.present_family = indices.present_family.value();
+  device.vkGetDeviceQueue(device.logical_device, device.graphics_family, 0,
                           &device.graphics_queue);
-  device.vkGetDeviceQueue(device.logical_device, indices.present_family.value(),
-                          0, &device.present_queue);
+  device.vkGetDeviceQueue(device.logical_device, device.present_family, 0,
+                          &device.present_queue);
+  // Without an async compute family, compute work goes to the graphics queue.
+  device.compute_family =
+      indices.compute_family.value_or(device.graphics_family);
+  device.vkGetDeviceQueue(device.logical_device, device.compute_family, 0,
+                          &device.compute_queue);
+
+  // Track the GPU progress of the graphics queue.
+  device.graphics_timeline =
+      std::make_shared<QueueTimeline>(device, device.graphics_queue);
+  // A queue is externally synchronized, a shared one has a single timeline.
+  device.compute_timeline =
+      device.compute_queue == device.graphics_queue
+          ? device.graphics_timeline
+          : std::make_shared<QueueTimeline>(device, device.compute_queue);
+  // Objects released by the application are destroyed once the frames that
+  // may use them have retired.
+  device.deletion_queue = std::make_shared<DeletionQueue>(device);
+  // Evicted objects go through the deletion queue.
+  device.object_cache = std::make_shared<ObjectCache>(device);
+  // Producers hand their work to the aggregator, which submits it once per
+  // frame. Graphics submissions are tracked by the graphics timeline.
+  device.submit_aggregator = std::make_shared<SubmitAggregator>(device);
+  device.submit_aggregator->set_timeline(device.graphics_queue,
+                                         device.graphics_timeline);
+  // Recoveries create the device again into the same structure, the objects
+  // registered so far are kept.
+  if (!device.resources) {
+    device.resources = std::make_shared<DeviceResources>();
+  }
+  return VK_SUCCESS;
+}
 
-  // Create queue semapthores.
-  device.image_available_semaphore = create_semaphore(device);
-  device.rendering_finished_semaphore = create_semaphore(device);
+auto gfx::vk_api::create_device(const os::WindowParameters& window,
+                                VulkanDevice& device, Surface& surface)
+    -> VkResult
+{
+  ArenaScope scratch;
+  StartupTimings& timings = startup_timings();
+  device = {};
+
+  // Step 1: create the surface, while the physical devices are still being
+  // queried.
+  VkSurfaceKHR handle;
+  VkResult result;
+  {
+    StartupTimer timer(timings.surface_creation_ms);
+    result = create_window_surface(window, handle);
+  }
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  auto fail = [handle](VkResult result) -> VkResult {
+    destroy_window_surface(handle);
+    return result;
+  };
 
-  return device;
+  // Step 2: pick the most suitable physical device.
+  const PhysicalDeviceInfo* physical_device;
+  QueueFamilyIndices indices;
+  {
+    const PhysicalDeviceSnapshot& snapshot = physical_device_snapshot();
+    StartupTimer timer(timings.device_selection_ms);
+    if (snapshot.devices.empty()) {
+      GFX_LOG_ERROR("failed to find GPUs with Vulkan support!");
+      return fail(VK_ERROR_INCOMPATIBLE_DRIVER);
+    }
+    physical_device = pick_best_physical_device_for_surface(handle);
+    if (physical_device == nullptr) {
+      return fail(VK_ERROR_INCOMPATIBLE_DRIVER);
+    }
+    indices = find_queue_families(*physical_device, handle);
+  }
+  device.physical_device = physical_device->handle;
+  device.memory_properties = physical_device->memory_properties;
+
+  // Step 3: create the logical device.
+  StartupTimer timer(timings.device_creation_ms);
+
+  result = create_logical_device(device, *physical_device, indices, true);
+  if (result != VK_SUCCESS) {
+    return fail(result);
+  }
+  result = attach_surface(device, window, handle, surface);
+  if (result != VK_SUCCESS) {
+    destroy_logical_device(device);
+  }
+  return result;
 }
 
-auto gfx::vk_api::create_device_swap_chain(VulkanDevice& device) -> void
+auto gfx::vk_api::create_headless_device(VulkanDevice& device,
+                                         const char* device_name) -> VkResult
 {
-  if (device.logical_device != VK_NULL_HANDLE) {
-    device.vkDeviceWaitIdle(device.logical_device);
+  StartupTimings& timings = startup_timings();
+  device = {};
+
+  // Without a surface, any device with a graphics queue will do.
+  const PhysicalDeviceInfo* physical_device = nullptr;
+  QueueFamilyIndices indices;
+  {
+    const PhysicalDeviceSnapshot& snapshot = physical_device_snapshot();
+    StartupTimer timer(timings.device_selection_ms);
+    if (device_name == nullptr) {
+      physical_device = pick_best_physical_device_for_surface(VK_NULL_HANDLE);
+      if (physical_device == nullptr) {
+        return VK_ERROR_INCOMPATIBLE_DRIVER;
+      }
+    }
+    for (size_t i = 0; i < snapshot.devices.size() && !physical_device; ++i) {
+      if (strstr(snapshot.devices[i].properties.deviceName, device_name)) {
+        physical_device = &snapshot.devices[i];
+      }
+    }
+    if (physical_device == nullptr) {
+      GFX_LOG_ERROR("No device named \"{}\"!", device_name);
+      return VK_ERROR_INCOMPATIBLE_DRIVER;
+    }
+    indices = find_queue_families(*physical_device, VK_NULL_HANDLE);
+    if (!indices.is_complete()) {
+      GFX_LOG_ERROR("The device has no graphics queue!");
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
   }
+  device.physical_device = physical_device->handle;
+  device.memory_properties = physical_device->memory_properties;
+
+  StartupTimer timer(timings.device_creation_ms);
+  return create_logical_device(device, *physical_device, indices, false);
+}
+
+auto gfx::vk_api::destroy_logical_device(VulkanDevice& device) -> void
+{
+  if (device.logical_device == VK_NULL_HANDLE) {
+    return;
+  }
+  // Presentation is not tracked by the queue timeline. A lost device returns
+  // at once.
+  with_present_queue(device, device.vkQueueWaitIdle);
+
+  // The deletion queue only waits for the work submitted on the graphics
+  // timeline before freeing in bulk.
+  device.object_cache.reset();
+  device.submit_aggregator.reset();
+  device.deletion_queue.reset();
+  // Runs the pending deferred deletions and releases the timeline objects.
+  device.compute_timeline.reset();
+  device.graphics_timeline.reset();
+
+  device.vkDestroyDevice(device.logical_device, allocation_callbacks());
+  device.logical_device = VK_NULL_HANDLE;
+}
+
+auto gfx::vk_api::result_name(VkResult result) -> const char*
+{
+  switch (result) {
+#define result_case(value) \
+  case value:              \
+    return #value;
+
+    result_case(VK_SUCCESS);
+    result_case(VK_NOT_READY);
+    result_case(VK_TIMEOUT);
+    result_case(VK_EVENT_SET);
+    result_case(VK_EVENT_RESET);
+    result_case(VK_INCOMPLETE);
+    result_case(VK_SUBOPTIMAL_KHR);
+    result_case(VK_ERROR_OUT_OF_HOST_MEMORY);
+    result_case(VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    result_case(VK_ERROR_INITIALIZATION_FAILED);
+    result_case(VK_ERROR_DEVICE_LOST);
+    result_case(VK_ERROR_MEMORY_MAP_FAILED);
+    result_case(VK_ERROR_LAYER_NOT_PRESENT);
+    result_case(VK_ERROR_EXTENSION_NOT_PRESENT);
+    result_case(VK_ERROR_FEATURE_NOT_PRESENT);
+    result_case(VK_ERROR_INCOMPATIBLE_DRIVER);
+    result_case(VK_ERROR_TOO_MANY_OBJECTS);
+    result_case(VK_ERROR_FORMAT_NOT_SUPPORTED);
+    result_case(VK_ERROR_FRAGMENTED_POOL);
+    result_case(VK_ERROR_SURFACE_LOST_KHR);
+    result_case(VK_ERROR_NATIVE_WINDOW_IN_USE_KHR);
+    result_case(VK_ERROR_OUT_OF_DATE_KHR);
+    result_case(VK_ERROR_INCOMPATIBLE_DISPLAY_KHR);
+
+#undef result_case
+    default:
+      return "VK_ERROR_UNKNOWN";
+  }
+}
+
+auto gfx::vk_api::create_surface_swap_chain(VulkanDevice& device,
+                                            Surface& surface) -> VkResult
+{
+  ArenaScope scratch;
   /*
    * Acquiring Surface Capabilities. Acquired capabilities contain important
    * information about ranges (limits) that are supported by the swap chain,
@@ -277,60 +780,66 @@ auto gfx::vk_api::create_device_swap_chain(VulkanDevice& device) -> void
    * dimensions of images
    */
   VkSurfaceCapabilitiesKHR surface_capabilities;
-  if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
-          device.physical_device, device.surface, &surface_capabilities) !=
-      VK_SUCCESS) {
-    std::cerr << "Could not check presentation surface capabilities!"
-              << std::endl;
-    std::terminate();
+  VkResult result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+      device.physical_device, surface.surface, &surface_capabilities);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not check presentation surface capabilities!");
+    return result;
   }
   // Acquiring Supported Surface Formats.
   uint32_t formats_count;
-  if ((vkGetPhysicalDeviceSurfaceFormatsKHR(device.physical_device,
-                                            device.surface, &formats_count,
-                                            nullptr) != VK_SUCCESS) ||
-      (formats_count == 0)) {
-    std::cerr
-        << "Error occurred during presentation surface formats enumeration!"
-        << std::endl;
-    std::terminate();
-  }
-  std::vector<VkSurfaceFormatKHR> surface_formats(formats_count);
-  if (vkGetPhysicalDeviceSurfaceFormatsKHR(
-          device.physical_device, device.surface, &formats_count,
-          surface_formats.data()) != VK_SUCCESS) {
-    std::cerr
-        << "Error occurred during presentation surface formats enumeration!"
-        << std::endl;
-    std::terminate();
+  result = vkGetPhysicalDeviceSurfaceFormatsKHR(
+      device.physical_device, surface.surface, &formats_count, nullptr);
+  if (result == VK_SUCCESS && formats_count == 0) {
+    result = VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR(
+        "Error occurred during presentation surface formats enumeration!");
+    return result;
+  }
+  ScratchVector<VkSurfaceFormatKHR> surface_formats(formats_count,
+                                                    &frame_arena());
+  result = vkGetPhysicalDeviceSurfaceFormatsKHR(
+      device.physical_device, surface.surface, &formats_count,
+      surface_formats.data());
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR(
+        "Error occurred during presentation surface formats enumeration!");
+    return result;
   }
 
   // Acquiring Supported Present Modes.
   uint32_t present_modes_count;
-  if ((vkGetPhysicalDeviceSurfacePresentModesKHR(
-           device.physical_device, device.surface, &present_modes_count,
-           nullptr) != VK_SUCCESS) ||
-      (present_modes_count == 0)) {
-    std::cerr << "Error occurred during presentation surface present modes "
-                 "enumeration!"
-              << std::endl;
-    std::terminate();
-  }
-  std::vector<VkPresentModeKHR> present_modes(present_modes_count);
-  if (vkGetPhysicalDeviceSurfacePresentModesKHR(
-          device.physical_device, device.surface, &present_modes_count,
-          present_modes.data()) != VK_SUCCESS) {
-    std::cerr << "Error occurred during presentation surface present modes "
-                 "enumeration!"
-              << std::endl;
-    std::terminate();
+  result = vkGetPhysicalDeviceSurfacePresentModesKHR(
+      device.physical_device, surface.surface, &present_modes_count, nullptr);
+  if (result == VK_SUCCESS && present_modes_count == 0) {
+    result = VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR(
+        "Error occurred during presentation surface present modes "
+        "enumeration!");
+    return result;
+  }
+  ScratchVector<VkPresentModeKHR> present_modes(present_modes_count,
+                                                &frame_arena());
+  result = vkGetPhysicalDeviceSurfacePresentModesKHR(
+      device.physical_device, surface.surface, &present_modes_count,
+      present_modes.data());
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR(
+        "Error occurred during presentation surface present modes "
+        "enumeration!");
+    return result;
   }
 
   // Selecting the Number of Swap Chain Images.
   uint32_t desired_number_of_images =
       get_swap_chain_num_images(surface_capabilities);
   // Selecting a Format for Swap Chain Images.
-  VkSurfaceFormatKHR desired_format = get_swap_chain_format(surface_formats);
+  VkSurfaceFormatKHR desired_format =
+      get_swap_chain_format(surface_formats.data(), formats_count);
   // Selecting the Size of the Swap Chain Images.
   VkExtent2D desired_extent = get_swap_chain_extent(surface_capabilities);
   // Selecting Swap Chain Usage Flags.
@@ -341,17 +850,17 @@ auto gfx::vk_api::create_device_swap_chain(VulkanDevice& device) -> void
       get_swap_chain_transform(surface_capabilities);
   // Selecting Presentation Mode.
   VkPresentModeKHR desired_present_mode =
-      get_swap_chain_present_mode(present_modes);
+      get_swap_chain_present_mode(present_modes.data(), present_modes_count);
 
-  VkSwapchainKHR old_swap_chain = device.swap_chain;
+  VkSwapchainKHR old_swap_chain = surface.swap_chain;
 
   if (static_cast<int>(desired_usage) == -1) {
-    std::cerr << "Invalid swap chain desired usage." << std::endl;
-    std::terminate();
+    GFX_LOG_ERROR("Invalid swap chain desired usage.");
+    return VK_ERROR_FEATURE_NOT_PRESENT;
   }
   if (static_cast<int>(desired_present_mode) == -1) {
-    std::cerr << "Invalid swap chain desired present mode." << std::endl;
-    std::terminate();
+    GFX_LOG_ERROR("Invalid swap chain desired present mode.");
+    return VK_ERROR_FEATURE_NOT_PRESENT;
   }
   if ((desired_extent.width == 0) || (desired_extent.height == 0)) {
     // Current surface size is (0, 0) so we can't create a swap chain and render
@@ -360,127 +869,109 @@ auto gfx::vk_api::create_device_swap_chain(VulkanDevice& device) -> void
     // TODO!.
   }
 
-  VkSwapchainCreateInfoKHR swap_chain_create_info = {
-      VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,  // sType
-      nullptr,                                      // *pNext
-      0,                                            // flags
-      device.surface,                               // surface
-      desired_number_of_images,                     // minImageCount
-      desired_format.format,                        // imageFormat
-      desired_format.colorSpace,                    // imageColorSpace
-      desired_extent,                               // imageExtent
-      1,                                            // imageArrayLayers
-      desired_usage,                                // imageUsage
-      VK_SHARING_MODE_EXCLUSIVE,                    // imageSharingMode
-      0,                                            // queueFamilyIndexCount
-      nullptr,                                      // pQueueFamilyIndices
-      desired_transform,                            //  preTransform
-      VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,            // compositeAlpha
-      desired_present_mode,                         // presentMode
-      VK_TRUE,                                      // clipped
-      old_swap_chain                                // oldSwapchain
-  };
-
-  if (device.vkCreateSwapchainKHR(device.logical_device,
-                                  &swap_chain_create_info, nullptr,
-                                  &device.swap_chain) != VK_SUCCESS) {
-    std::cerr << "Could not create swap chain!" << std::endl;
-    std::terminate;
+  using SwapchainInfo = VkSwapchainCreateInfoKHR;
+  VkSwapchainCreateInfoKHR swap_chain_create_info =
+      build<SwapchainInfo>()
+          .set(&SwapchainInfo::surface, surface.surface)
+          .set(&SwapchainInfo::minImageCount, desired_number_of_images)
+          .set(&SwapchainInfo::imageFormat, desired_format.format)
+          .set(&SwapchainInfo::imageColorSpace, desired_format.colorSpace)
+          .set(&SwapchainInfo::imageExtent, desired_extent)
+          .set(&SwapchainInfo::imageArrayLayers, 1)
+          .set(&SwapchainInfo::imageUsage, desired_usage)
+          .set(&SwapchainInfo::imageSharingMode, VK_SHARING_MODE_EXCLUSIVE)
+          .set(&SwapchainInfo::preTransform, desired_transform)
+          .set(&SwapchainInfo::compositeAlpha,
+               VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR)
+          .set(&SwapchainInfo::presentMode, desired_present_mode)
+          .set(&SwapchainInfo::clipped, VK_TRUE)
+          .set(&SwapchainInfo::oldSwapchain, old_swap_chain);
+
+  VkSwapchainKHR swap_chain;
+  result = device.vkCreateSwapchainKHR(device.logical_device,
+                                       &swap_chain_create_info,
+                                       allocation_callbacks(), &swap_chain);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create swap chain: {}!", result_name(result));
+    return result;
+  }
+  // The views and framebuffers of the old images go with them.
+  for (VkImage image : surface.images) {
+    device.object_cache->evict_image(image);
+  }
+  surface.swap_chain = swap_chain;
+  surface.format = desired_format.format;
+  surface.extent = desired_extent;
+  // The old swap chain may still be used by frames in flight, and its images
+  // by their presents. The deletion queue destroys it once the current frame
+  // retires, after the rendering its last present waited on and a frame of
+  // presents on the new swap chain later, without idling the present queue.
+  device.deletion_queue->destroy(old_swap_chain);
+
+  uint32_t image_count = 0;
+  result = device.vkGetSwapchainImagesKHR(device.logical_device, swap_chain,
+                                          &image_count, nullptr);
+  if (result == VK_SUCCESS) {
+    surface.images.resize(image_count);
+    result = device.vkGetSwapchainImagesKHR(device.logical_device, swap_chain,
+                                            &image_count,
+                                            surface.images.data());
   }
-  if (old_swap_chain != VK_NULL_HANDLE) {
-    device.vkDestroySwapchainKHR(device.logical_device, old_swap_chain,
-                                 nullptr);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not get the swap chain images!");
+    surface.images.clear();
   }
+  return result;
 }
 
 auto gfx::vk_api::check_physical_device_extension_support(
-    VkPhysicalDevice device) -> bool
+    const PhysicalDeviceInfo& device) -> bool
 {
-  uint32_t extension_count;
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
-                                       nullptr);
-
-  std::vector<VkExtensionProperties> available_extensions(extension_count);
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
-                                       available_extensions.data());
-
-  std::set<std::string> required_extensions(DEVICE_EXTENSIONS.begin(),
-                                            DEVICE_EXTENSIONS.end());
-
-  for (const auto& extension : available_extensions) {
-    required_extensions.erase(extension.extensionName);
+  for (const char* extension : DEVICE_EXTENSIONS) {
+    if (!device.supports_extension(extension)) {
+      return false;
+    }
   }
-
-  return required_extensions.empty();
+  return true;
 }
 
 auto gfx::vk_api::pick_best_physical_device_for_surface(VkSurfaceKHR surface)
-    -> VkPhysicalDevice
+    -> const PhysicalDeviceInfo*
 {
-  VkPhysicalDevice physical_device = VK_NULL_HANDLE;
-
-  uint32_t device_count = 0;
-  if (vkEnumeratePhysicalDevices(VK_INSTANCE, &device_count, nullptr) !=
-      VK_SUCCESS) {
-    std::cerr << "Error occurred during physical devices enumeration!"
-              << std::endl;
-    std::terminate();
-  }
-  if (device_count == 0) {
-    std::cerr << "failed to find GPUs with Vulkan support!\n";
-    std::terminate();
-  }
+  const PhysicalDeviceInfo* physical_device = nullptr;
 
-  std::vector<VkPhysicalDevice> devices(device_count);
-  vkEnumeratePhysicalDevices(VK_INSTANCE, &device_count, devices.data());
-
-  if ((vkEnumeratePhysicalDevices(VK_INSTANCE, &device_count, nullptr) !=
-       VK_SUCCESS) ||
-      (device_count == 0)) {
-    std::cerr << "Error occurred during physical devices enumeration!"
-              << std::endl;
-    std::terminate();
-  }
-
-  // Use an ordered map to automatically sort candidates by increasing score
-  std::multimap<int, VkPhysicalDevice> candidates;
-
-  for (const auto& device : devices) {
+  // Keep the candidate with the highest score, ties go to the later device.
+  int best_score = 0;
+  for (const auto& device : physical_device_snapshot().devices) {
     int score = rate_physical_device_suitability(device, surface);
-    candidates.insert(std::make_pair(score, device));
+    if (score > 0 && score >= best_score) {
+      best_score = score;
+      physical_device = &device;
+    }
   }
   // Check if the best candidate is suitable at all
-  if (candidates.rbegin()->first > 0) {
-    physical_device = candidates.rbegin()->second;
-  }
-  else {
-    std::cerr << "Failed to find a suitable GPU!" << std::endl;
-    std::terminate();
+  if (physical_device == nullptr) {
+    GFX_LOG_ERROR("Failed to find a suitable GPU!");
   }
 
   return physical_device;
 }
 
-auto gfx::vk_api::rate_physical_device_suitability(VkPhysicalDevice device,
-                                                   VkSurfaceKHR surface) -> int
+auto gfx::vk_api::rate_physical_device_suitability(
+    const PhysicalDeviceInfo& device, VkSurfaceKHR surface) -> int
 {
   if (!is_physical_device_suitable_for_surface(device, surface)) return 0;
 
-  VkPhysicalDeviceProperties device_properties;
-  VkPhysicalDeviceFeatures device_features;
-  vkGetPhysicalDeviceProperties(device, &device_properties);
-  vkGetPhysicalDeviceFeatures(device, &device_features);
-
   int score = 0;
 
   // Discrete GPUs have a significant performance advantage
-  if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+  if (device.properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
     score += 1000;
   }
   // Maximum possible size of textures affects graphics quality
-  score += device_properties.limits.maxImageDimension2D;
+  score += device.properties.limits.maxImageDimension2D;
   // Application can't function without geometry shaders
-  if (!device_features.geometryShader) {
+  if (!device.features.geometryShader) {
     return 0;
   }
 
@@ -488,36 +979,40 @@ auto gfx::vk_api::rate_physical_device_suitability(VkPhysicalDevice device,
 }
 
 auto gfx::vk_api::is_physical_device_suitable_for_surface(
-    VkPhysicalDevice device, VkSurfaceKHR surface) -> bool
+    const PhysicalDeviceInfo& device, VkSurfaceKHR surface) -> bool
 {
-  QueueFamilyIndices indices = find_queue_families(device, surface);
-  bool extensions_supported = check_physical_device_extension_support(device);
-  return indices.is_complete() && extensions_supported;
+  // The extension check is free, do it before querying the surface support.
+  // Headless devices, without a surface, need no swap chain.
+  if (surface != VK_NULL_HANDLE &&
+      !check_physical_device_extension_support(device)) {
+    return false;
+  }
+  return find_queue_families(device, surface).is_complete();
 }
 
-auto gfx::vk_api::find_queue_families(VkPhysicalDevice device,
+auto gfx::vk_api::find_queue_families(const PhysicalDeviceInfo& device,
                                       VkSurfaceKHR surface)
     -> QueueFamilyIndices
 {
   QueueFamilyIndices indices;
 
-  uint32_t queue_family_count = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count,
-                                           nullptr);
-
-  std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count,
-                                           queue_families.data());
-
-  int i = 0;
-  for (const auto& queueFamily : queue_families) {
+  uint32_t i = 0;
+  for (const auto& queueFamily : device.queue_families) {
     if (queueFamily.queueCount > 0 &&
         queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
       indices.graphics_family = i;
     }
 
+    // Headless devices "present" from the graphics queue, which keeps the
+    // present queue valid for the code waiting on it.
     VkBool32 present_support = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
+    if (surface == VK_NULL_HANDLE) {
+      present_support = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+    }
+    else {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device.handle, i, surface,
+                                           &present_support);
+    }
 
     if (queueFamily.queueCount > 0 && present_support) {
       indices.present_family = i;
@@ -530,39 +1025,33 @@ auto gfx::vk_api::find_queue_families(VkPhysicalDevice device,
     i++;
   }
 
+  // A family without graphics support maps to the async compute hardware.
+  for (uint32_t family = 0; family < device.queue_families.size(); ++family) {
+    const VkQueueFamilyProperties& properties = device.queue_families[family];
+    if (properties.queueCount > 0 &&
+        (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(properties.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      indices.compute_family = family;
+      break;
+    }
+  }
+
   return indices;
 }
 
 auto gfx::vk_api::enumerate_all_physical_devices() -> void
 {
-  uint32_t device_count = 0;
-  if (vkEnumeratePhysicalDevices(VK_INSTANCE, &device_count, nullptr) !=
-      VK_SUCCESS) {
-    std::cerr << "Error occurred during physical devices enumeration!"
-              << std::endl;
-    return;
-  }
-  std::vector<VkPhysicalDevice> devices(device_count);
-  vkEnumeratePhysicalDevices(VK_INSTANCE, &device_count, devices.data());
-
-  if ((vkEnumeratePhysicalDevices(VK_INSTANCE, &device_count, nullptr) !=
-       VK_SUCCESS) ||
-      (device_count == 0)) {
-    return;
-  }
-
-  for (const auto& device : devices) {
-    VkPhysicalDeviceProperties device_properties;
-    vkGetPhysicalDeviceProperties(device, &device_properties);
-    std::cout << "Device name: " << device_properties.deviceName << "\n";
+  for (const auto& device : physical_device_snapshot().devices) {
+    GFX_LOG_INFO("Device name: {}", device.properties.deviceName);
   }
 }
 
 auto gfx::vk_api::check_extension_availability(
     const char* extension_name,
-    const std::vector<VkExtensionProperties>& available_extensions) -> bool
+    const VkExtensionProperties* available_extensions,
+    uint32_t available_extension_count) -> bool
 {
-  for (size_t i = 0; i < available_extensions.size(); ++i) {
+  for (uint32_t i = 0; i < available_extension_count; ++i) {
     if (strcmp(available_extensions[i].extensionName, extension_name) == 0) {
       return true;
     }
@@ -570,77 +1059,410 @@ auto gfx::vk_api::check_extension_availability(
   return false;
 }
 
-auto gfx::vk_api::create_window_surface(os::WindowParameters window)
-    -> VkSurfaceKHR
+auto gfx::vk_api::create_window_surface(os::WindowParameters window,
+                                        VkSurfaceKHR& surface) -> VkResult
 {
-  VkSurfaceKHR surface;
+  VkResult result = VK_ERROR_EXTENSION_NOT_PRESENT;
 
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
 
-  VkWin32SurfaceCreateInfoKHR surface_create_info = {
-      VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,  // sType
-      nullptr,                                          // *pNext
-      0,                                                // flags
-      window.instance,                                  // hinstance
-      window.handle                                     // hwnd
-  };
+  VkWin32SurfaceCreateInfoKHR surface_create_info =
+      build<VkWin32SurfaceCreateInfoKHR>()
+          .set(&VkWin32SurfaceCreateInfoKHR::hinstance, window.instance)
+          .set(&VkWin32SurfaceCreateInfoKHR::hwnd, window.handle);
 
-  if (vkCreateWin32SurfaceKHR(VK_INSTANCE, &surface_create_info, nullptr,
-                              &surface) != VK_SUCCESS) {
-    std::cerr << "Error occurred during window surface creation." << std::endl;
-    std::terminate();
-  }
+  result = vkCreateWin32SurfaceKHR(VK_INSTANCE, &surface_create_info,
+                                   allocation_callbacks(), &surface);
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-  VkXcbSurfaceCreateInfoKHR surface_create_info = {
-      VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR,  // sType
-      nullptr,                                        // *pNext
-      0,                                              // flags
-      window.connection,                              // connection
-      window.handle                                   // window
-  };
+  VkXcbSurfaceCreateInfoKHR surface_create_info =
+      build<VkXcbSurfaceCreateInfoKHR>()
+          .set(&VkXcbSurfaceCreateInfoKHR::connection, window.connection)
+          .set(&VkXcbSurfaceCreateInfoKHR::window, window.handle);
 
-  if (vkCreateXcbSurfaceKHR(VK_INSTANCE, &surface_create_info, nullptr,
-                            &surface) != VK_SUCCESS) {
-    std::cerr << "Error occurred during window surface creation." << std::endl;
-    std::terminate();
-  }
+  result = vkCreateXcbSurfaceKHR(VK_INSTANCE, &surface_create_info,
+                                 allocation_callbacks(), &surface);
 #elif defined(VK_USE_PLATFORM_XLIB_KHR)
-  VkXlibSurfaceCreateInfoKHR surface_create_info = {
-      VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,  // sType
-      nullptr,                                         // *pNext
-      0,                                               // flags
-      window.display_ptr,                              // *dpy
-      window.handle                                    // window
-  };
-  if (vkCreateXlibSurfaceKHR(VK_INSTANCE, &surface_create_info, nullptr,
-                             &surface) != VK_SUCCESS) {
-    std::cerr << "Error occurred during window surface creation." << std::endl;
-    std::terminate();
-  }
+  VkXlibSurfaceCreateInfoKHR surface_create_info =
+      build<VkXlibSurfaceCreateInfoKHR>()
+          .set(&VkXlibSurfaceCreateInfoKHR::dpy, window.display_ptr)
+          .set(&VkXlibSurfaceCreateInfoKHR::window, window.handle);
+  result = vkCreateXlibSurfaceKHR(VK_INSTANCE, &surface_create_info,
+                                  allocation_callbacks(), &surface);
 
 #endif
-  return surface;
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Error occurred during window surface creation: {}.",
+                  result_name(result));
+    surface = VK_NULL_HANDLE;
+  }
+  return result;
+}
+
+auto gfx::vk_api::destroy_window_surface(VkSurfaceKHR surface) -> void
+{
+  vkDestroySurfaceKHR(VK_INSTANCE, surface, allocation_callbacks());
+}
+
+auto gfx::vk_api::create_surface(VulkanDevice& device,
+                                 const os::WindowParameters& window,
+                                 Surface& surface) -> VkResult
+{
+  if (!device.presentable) {
+    GFX_LOG_ERROR("Surfaces need a presentable device!");
+    return VK_ERROR_EXTENSION_NOT_PRESENT;
+  }
+  VkSurfaceKHR handle;
+  VkResult result = create_window_surface(window, handle);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  // The device was picked for the first window, the others may be on an
+  // output its present queue does not reach.
+  VkBool32 supported = VK_FALSE;
+  result = vkGetPhysicalDeviceSurfaceSupportKHR(
+      device.physical_device, device.present_family, handle, &supported);
+  if (result != VK_SUCCESS || supported != VK_TRUE) {
+    GFX_LOG_ERROR("The present queue cannot present to the window!");
+    destroy_window_surface(handle);
+    return result != VK_SUCCESS ? result : VK_ERROR_INCOMPATIBLE_DISPLAY_KHR;
+  }
+  return attach_surface(device, window, handle, surface);
+}
+
+auto gfx::vk_api::destroy_surface(VulkanDevice& device, Surface& surface)
+    -> void
+{
+  if (surface.surface == VK_NULL_HANDLE) {
+    return;
+  }
+  device.resources->remove(surface.resource_id);
+  // The semaphores may still be waited on by the rendering the last present
+  // waited on, and the images by the presentation, which the queue timeline
+  // does not track.
+  with_present_queue(device, device.vkQueueWaitIdle);
+  device.graphics_timeline->wait_until(surface.last_present_value);
+  release_surface(device, surface);
+  destroy_window_surface(surface.surface);
+  surface.surface = VK_NULL_HANDLE;
+  surface.extent = {};
+}
+
+auto gfx::vk_api::acquire_next_image(VulkanDevice& device, Surface& surface,
+                                     uint64_t timeout) -> VkResult
+{
+  return device.vkAcquireNextImageKHR(
+      device.logical_device, surface.swap_chain, timeout,
+      surface.image_available_semaphore, VK_NULL_HANDLE, &surface.image_index);
+}
+
+auto gfx::vk_api::present_surfaces(VulkanDevice& device,
+                                   Surface* const* surfaces,
+                                   uint32_t surface_count) -> VkResult
+{
+  // A present without swap chains is invalid usage.
+  if (surface_count == 0) {
+    return VK_SUCCESS;
+  }
+  ArenaScope scratch;
+  ScratchVector<VkSemaphore> wait_semaphores(surface_count, &frame_arena());
+  ScratchVector<VkSwapchainKHR> swap_chains(surface_count, &frame_arena());
+  ScratchVector<uint32_t> image_indices(surface_count, &frame_arena());
+  ScratchVector<VkResult> results(surface_count, &frame_arena());
+  for (uint32_t i = 0; i < surface_count; ++i) {
+    wait_semaphores[i] = surfaces[i]->rendering_finished_semaphore;
+    swap_chains[i] = surfaces[i]->swap_chain;
+    image_indices[i] = surfaces[i]->image_index;
+  }
+
+  VkPresentInfoKHR present_info =
+      build<VkPresentInfoKHR>()
+          .set(&VkPresentInfoKHR::waitSemaphoreCount, surface_count)
+          .set(&VkPresentInfoKHR::pWaitSemaphores, wait_semaphores.data())
+          .set(&VkPresentInfoKHR::swapchainCount, surface_count)
+          .set(&VkPresentInfoKHR::pSwapchains, swap_chains.data())
+          .set(&VkPresentInfoKHR::pImageIndices, image_indices.data())
+          .set(&VkPresentInfoKHR::pResults, results.data());
+  VkResult result = with_present_queue(device, [&](VkQueue queue) {
+    return device.vkQueuePresentKHR(queue, &present_info);
+  });
+  // The rendering the present waited on was submitted by now.
+  uint64_t rendered = device.graphics_timeline->last_submitted_value();
+  for (uint32_t i = 0; i < surface_count; ++i) {
+    surfaces[i]->present_result = results[i];
+    surfaces[i]->last_present_value = rendered;
+  }
+  return result;
 }
 
 auto gfx::vk_api::create_semaphore(VulkanDevice& device) -> VkSemaphore
 {
-  VkSemaphoreCreateInfo semaphore_create_info = {
-      VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,  // sType
-      nullptr,                                  // pNext
-      0                                         // flags
-  };
+  constexpr auto semaphore_create_info = make_struct<VkSemaphoreCreateInfo>();
+
+  VkSemaphore semaphore;
+
+  if (device.vkCreateSemaphore(device.logical_device, &semaphore_create_info,
+                               allocation_callbacks(),
+                               &semaphore) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create semaphore!");
+    return VK_NULL_HANDLE;
+  }
+
+  return semaphore;
+}
+
+auto gfx::vk_api::create_timeline_semaphore(VulkanDevice& device,
+                                            uint64_t initial_value)
+    -> VkSemaphore
+{
+  auto semaphore_type_create_info =
+      build<VkSemaphoreTypeCreateInfoKHR>()
+          .set(&VkSemaphoreTypeCreateInfoKHR::semaphoreType,
+               VK_SEMAPHORE_TYPE_TIMELINE_KHR)
+          .set(&VkSemaphoreTypeCreateInfoKHR::initialValue, initial_value)
+          .get();
+
+  VkSemaphoreCreateInfo semaphore_create_info =
+      build<VkSemaphoreCreateInfo>().next(semaphore_type_create_info);
 
   VkSemaphore semaphore;
 
   if (device.vkCreateSemaphore(device.logical_device, &semaphore_create_info,
-                               nullptr, &semaphore) != VK_SUCCESS) {
-    std::cerr << "Could not create semaphore!" << std::endl;
-    std::terminate();
+                               allocation_callbacks(),
+                               &semaphore) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create timeline semaphore!");
+    return VK_NULL_HANDLE;
   }
 
   return semaphore;
 }
 
+auto gfx::vk_api::create_fence(VulkanDevice& device, bool signaled) -> VkFence
+{
+  VkFenceCreateFlags flags = signaled ? VK_FENCE_CREATE_SIGNALED_BIT : 0;
+
+  VkFenceCreateInfo fence_create_info =
+      build<VkFenceCreateInfo>().set(&VkFenceCreateInfo::flags, flags);
+
+  VkFence fence;
+
+  if (device.vkCreateFence(device.logical_device, &fence_create_info,
+                           allocation_callbacks(), &fence) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create fence!");
+    return VK_NULL_HANDLE;
+  }
+
+  return fence;
+}
+
+auto gfx::vk_api::find_memory_type(const VulkanDevice& device,
+                                   uint32_t type_bits,
+                                   VkMemoryPropertyFlags required,
+                                   VkMemoryPropertyFlags preferred) -> uint32_t
+{
+  const VkPhysicalDeviceMemoryProperties& properties = device.memory_properties;
+  uint32_t fallback = UINT32_MAX;
+  for (uint32_t i = 0; i < properties.memoryTypeCount; ++i) {
+    VkMemoryPropertyFlags flags = properties.memoryTypes[i].propertyFlags;
+    if (!(type_bits & (1u << i)) || (flags & required) != required) {
+      continue;
+    }
+    if ((flags & preferred) == preferred) {
+      return i;
+    }
+    if (fallback == UINT32_MAX) {
+      fallback = i;
+    }
+  }
+  return fallback;
+}
+
+auto gfx::vk_api::create_buffer(VulkanDevice& device, VkDeviceSize size,
+                                VkBufferUsageFlags usage,
+                                VkMemoryPropertyFlags required,
+                                VkMemoryPropertyFlags preferred,
+                                bool shared_with_compute, Buffer& buffer)
+    -> VkResult
+{
+  buffer = {};
+  buffer.size = size;
+
+  auto buffer_create_info =
+      build<VkBufferCreateInfo>()
+          .set(&VkBufferCreateInfo::size, size)
+          .set(&VkBufferCreateInfo::usage, usage)
+          .set(&VkBufferCreateInfo::sharingMode, VK_SHARING_MODE_EXCLUSIVE);
+  // Concurrent sharing saves the ownership transfers between the queues.
+  uint32_t families[] = {device.graphics_family, device.compute_family};
+  if (shared_with_compute && device.compute_family != device.graphics_family) {
+    buffer_create_info
+        .set(&VkBufferCreateInfo::sharingMode, VK_SHARING_MODE_CONCURRENT)
+        .set(&VkBufferCreateInfo::queueFamilyIndexCount, std::size(families))
+        .set(&VkBufferCreateInfo::pQueueFamilyIndices, families);
+  }
+  VkResult result = device.vkCreateBuffer(
+      device.logical_device, &buffer_create_info.get(), allocation_callbacks(),
+      &buffer.buffer);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create buffer: {}!", result_name(result));
+    buffer = {};
+    return result;
+  }
+
+  VkMemoryRequirements requirements;
+  device.vkGetBufferMemoryRequirements(device.logical_device, buffer.buffer,
+                                       &requirements);
+  uint32_t memory_type = find_memory_type(device, requirements.memoryTypeBits,
+                                          required, preferred);
+  if (memory_type == UINT32_MAX) {
+    GFX_LOG_ERROR("Could not find a memory type for the buffer!");
+    result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+
+  if (result == VK_SUCCESS) {
+    VkMemoryAllocateInfo allocate_info =
+        build<VkMemoryAllocateInfo>()
+            .set(&VkMemoryAllocateInfo::allocationSize, requirements.size)
+            .set(&VkMemoryAllocateInfo::memoryTypeIndex, memory_type);
+    result = device.vkAllocateMemory(device.logical_device, &allocate_info,
+                                     allocation_callbacks(), &buffer.memory);
+    if (result != VK_SUCCESS) {
+      GFX_LOG_ERROR("Could not allocate buffer memory: {}!",
+                    result_name(result));
+      buffer.memory = VK_NULL_HANDLE;
+    }
+  }
+  if (result == VK_SUCCESS) {
+    result = device.vkBindBufferMemory(device.logical_device, buffer.buffer,
+                                       buffer.memory, 0);
+    if (result != VK_SUCCESS) {
+      GFX_LOG_ERROR("Could not bind buffer memory: {}!", result_name(result));
+    }
+  }
+  if (result == VK_SUCCESS &&
+      (device.memory_properties.memoryTypes[memory_type].propertyFlags &
+       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+    result = device.vkMapMemory(device.logical_device, buffer.memory, 0,
+                                VK_WHOLE_SIZE, 0, &buffer.mapped);
+    if (result != VK_SUCCESS) {
+      GFX_LOG_ERROR("Could not map buffer memory: {}!", result_name(result));
+    }
+  }
+
+  if (result != VK_SUCCESS) {
+    // Nothing used the buffer yet, it is destroyed right away.
+    device.vkDestroyBuffer(device.logical_device, buffer.buffer,
+                           allocation_callbacks());
+    if (buffer.memory != VK_NULL_HANDLE) {
+      device.vkFreeMemory(device.logical_device, buffer.memory,
+                          allocation_callbacks());
+    }
+    buffer = {};
+  }
+  return result;
+}
+
+auto gfx::vk_api::destroy_buffer(VulkanDevice& device, Buffer& buffer) -> void
+{
+  // Freeing the memory also unmaps it.
+  device.deletion_queue->destroy(buffer.buffer);
+  device.deletion_queue->destroy(buffer.memory);
+  buffer = {};
+}
+
+auto gfx::vk_api::create_shader_module(VulkanDevice& device,
+                                       const std::vector<uint32_t>& spirv,
+                                       VkShaderModule& module) -> VkResult
+{
+  return create_shader_module(device, spirv.data(), spirv.size(), module);
+}
+
+auto gfx::vk_api::create_shader_module(VulkanDevice& device,
+                                       const uint32_t* code, size_t word_count,
+                                       VkShaderModule& module) -> VkResult
+{
+  VkShaderModuleCreateInfo shader_module_create_info =
+      build<VkShaderModuleCreateInfo>()
+          .set(&VkShaderModuleCreateInfo::codeSize,
+               word_count * sizeof(uint32_t))
+          .set(&VkShaderModuleCreateInfo::pCode, code);
+
+  module = VK_NULL_HANDLE;
+  VkResult result = device.vkCreateShaderModule(
+      device.logical_device, &shader_module_create_info,
+      allocation_callbacks(), &module);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create shader module: {}!", result_name(result));
+    module = VK_NULL_HANDLE;
+  }
+  return result;
+}
+
+auto gfx::vk_api::create_compute_pipeline(VulkanDevice& device,
+                                          const std::vector<uint32_t>& spirv,
+                                          VkPipelineLayout layout,
+                                          VkPipeline& pipeline) -> VkResult
+{
+  pipeline = VK_NULL_HANDLE;
+  VkShaderModule shader_module;
+  VkResult result = create_shader_module(device, spirv, shader_module);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  result = create_compute_pipeline(device, shader_module, layout, pipeline);
+  // The module is not needed once the pipeline exists.
+  device.vkDestroyShaderModule(device.logical_device, shader_module,
+                               allocation_callbacks());
+  return result;
+}
+
+auto gfx::vk_api::create_compute_pipeline(VulkanDevice& device,
+                                          VkShaderModule module,
+                                          VkPipelineLayout layout,
+                                          VkPipeline& pipeline) -> VkResult
+{
+  using StageInfo = VkPipelineShaderStageCreateInfo;
+  VkPipelineShaderStageCreateInfo stage_create_info =
+      build<StageInfo>()
+          .set(&StageInfo::stage, VK_SHADER_STAGE_COMPUTE_BIT)
+          .set(&StageInfo::module, module)
+          .set(&StageInfo::pName, "main");
+  using PipelineInfo = VkComputePipelineCreateInfo;
+  VkComputePipelineCreateInfo pipeline_create_info =
+      build<PipelineInfo>()
+          .set(&PipelineInfo::stage, stage_create_info)
+          .set(&PipelineInfo::layout, layout);
+
+  pipeline = VK_NULL_HANDLE;
+  VkResult result = device.vkCreateComputePipelines(
+      device.logical_device, VK_NULL_HANDLE, 1, &pipeline_create_info,
+      allocation_callbacks(), &pipeline);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create compute pipeline: {}!",
+                  result_name(result));
+    pipeline = VK_NULL_HANDLE;
+  }
+  return result;
+}
+
+auto gfx::vk_api::load_spirv(const char* path) -> std::vector<uint32_t>
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return {};
+  }
+  std::streamsize size = file.tellg();
+  if (size <= 0 || size % sizeof(uint32_t) != 0) {
+    GFX_LOG_ERROR("Invalid SPIR-V binary: {}", path);
+    return {};
+  }
+  std::vector<uint32_t> spirv(static_cast<size_t>(size) / sizeof(uint32_t));
+  file.seekg(0);
+  if (!file.read(reinterpret_cast<char*>(spirv.data()), size)) {
+    return {};
+  }
+  return spirv;
+}
+
 auto gfx::vk_api::get_swap_chain_num_images(
     VkSurfaceCapabilitiesKHR& surface_capabilities) -> uint32_t
 {
@@ -685,20 +1507,21 @@ auto gfx::vk_api::get_swap_chain_extent(
 }
 
 auto gfx::vk_api::get_swap_chain_format(
-    std::vector<VkSurfaceFormatKHR>& surface_formats) -> VkSurfaceFormatKHR
+    const VkSurfaceFormatKHR* surface_formats, uint32_t surface_format_count)
+    -> VkSurfaceFormatKHR
 {
   // If the list contains only one entry with undefined format
   // it means that there are no preferred surface formats and any can be chosen
-  if ((surface_formats.size() == 1) &&
+  if ((surface_format_count == 1) &&
       (surface_formats[0].format == VK_FORMAT_UNDEFINED)) {
     return {VK_FORMAT_R8G8B8A8_UNORM, VK_COLORSPACE_SRGB_NONLINEAR_KHR};
   }
 
   // Check if list contains most widely used R8 G8 B8 A8 format
   // with nonlinear color space
-  for (VkSurfaceFormatKHR& surface_format : surface_formats) {
-    if (surface_format.format == VK_FORMAT_R8G8B8A8_UNORM) {
-      return surface_format;
+  for (uint32_t i = 0; i < surface_format_count; ++i) {
+    if (surface_formats[i].format == VK_FORMAT_R8G8B8A8_UNORM) {
+      return surface_formats[i];
     }
   }
 
@@ -717,43 +1540,27 @@ auto gfx::vk_api::get_swap_chain_usage_flags(
     return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
            VK_IMAGE_USAGE_TRANSFER_DST_BIT;
   }
-  std::cerr << "VK_IMAGE_USAGE_TRANSFER_DST image usage is not supported by "
-               "the swap chain!"
-            << std::endl
-            << "Supported swap chain's image usages include:" << std::endl
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT
-                    ? "    VK_IMAGE_USAGE_TRANSFER_SRC\n"
-                    : "")
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_TRANSFER_DST_BIT
-                    ? "    VK_IMAGE_USAGE_TRANSFER_DST\n"
-                    : "")
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_SAMPLED_BIT
-                    ? "    VK_IMAGE_USAGE_SAMPLED\n"
-                    : "")
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_STORAGE_BIT
-                    ? "    VK_IMAGE_USAGE_STORAGE\n"
-                    : "")
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-                    ? "    VK_IMAGE_USAGE_COLOR_ATTACHMENT\n"
-                    : "")
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
-                    ? "    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT\n"
-                    : "")
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT
-                    ? "    VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT\n"
-                    : "")
-            << (surface_capabilities.supportedUsageFlags &
-                        VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT
-                    ? "    VK_IMAGE_USAGE_INPUT_ATTACHMENT"
-                    : "")
-            << std::endl;
+  GFX_LOG_ERROR(
+      "VK_IMAGE_USAGE_TRANSFER_DST image usage is not supported by the swap "
+      "chain! Supported swap chain's image usages include:");
+  constexpr std::pair<VkImageUsageFlagBits, const char*> USAGES[] = {
+      {VK_IMAGE_USAGE_TRANSFER_SRC_BIT, "VK_IMAGE_USAGE_TRANSFER_SRC"},
+      {VK_IMAGE_USAGE_TRANSFER_DST_BIT, "VK_IMAGE_USAGE_TRANSFER_DST"},
+      {VK_IMAGE_USAGE_SAMPLED_BIT, "VK_IMAGE_USAGE_SAMPLED"},
+      {VK_IMAGE_USAGE_STORAGE_BIT, "VK_IMAGE_USAGE_STORAGE"},
+      {VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+       "VK_IMAGE_USAGE_COLOR_ATTACHMENT"},
+      {VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+       "VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT"},
+      {VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+       "VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT"},
+      {VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+       "VK_IMAGE_USAGE_INPUT_ATTACHMENT"}};
+  for (const auto& [usage, name] : USAGES) {
+    if (surface_capabilities.supportedUsageFlags & usage) {
+      GFX_LOG_ERROR("    {}", name);
+    }
+  }
   return static_cast<VkImageUsageFlags>(-1);
 }
 
@@ -778,63 +1585,76 @@ auto gfx::vk_api::get_swap_chain_transform(
 }
 
 auto gfx::vk_api::get_swap_chain_present_mode(
-    std::vector<VkPresentModeKHR>& present_modes) -> VkPresentModeKHR
+    const VkPresentModeKHR* present_modes, uint32_t present_mode_count)
+    -> VkPresentModeKHR
 {
   // FIFO present mode is always available
   // MAILBOX is the lowest latency V-Sync enabled mode (something like
   // triple-buffering) so use it if available
-  for (VkPresentModeKHR& present_mode : present_modes) {
-    if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-      return present_mode;
+  for (VkPresentModeKHR wanted :
+       {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR}) {
+    for (uint32_t i = 0; i < present_mode_count; ++i) {
+      if (present_modes[i] == wanted) {
+        return wanted;
+      }
     }
   }
-  for (VkPresentModeKHR& present_mode : present_modes) {
-    if (present_mode == VK_PRESENT_MODE_FIFO_KHR) {
-      return present_mode;
-    }
-  }
-  std::cout << "FIFO present mode is not supported by the swap chain!"
-            << std::endl;
+  GFX_LOG_ERROR("FIFO present mode is not supported by the swap chain!");
   return static_cast<VkPresentModeKHR>(-1);
 }
 
-auto gfx::load_backend() -> void { vk_api::initialize(); }
+auto gfx::load_backend() -> bool
+{
+  return vk_api::initialize() == VK_SUCCESS;
+}
 
 auto gfx::unload_backend() -> void { vk_api::destroy(); }
 
-auto gfx::create_device(const os::WindowParameters& window) -> Device
+auto gfx::create_device(const os::WindowParameters& window)
+    -> std::optional<Device>
 {
-  return vk_api::create_device(window);
+  vk_api::WindowDevice device;
+  device.surface = std::make_shared<vk_api::Surface>();
+  if (vk_api::create_device(window, device.device, *device.surface) !=
+      VK_SUCCESS) {
+    return std::nullopt;
+  }
+  return Device(device);
 }
 
 auto gfx::print_device_name(vk_api::VulkanDevice device) -> void
 {
-  VkPhysicalDeviceProperties device_properties;
-  vk_api::vkGetPhysicalDeviceProperties(device.physical_device,
-                                        &device_properties);
-  std::cout << "Device name: " << device_properties.deviceName << "\n";
+  vk_api::PhysicalDeviceInfo info;
+  if (vk_api::physical_device_info(device.physical_device, info)) {
+    GFX_LOG_INFO("Device name: {}", info.properties.deviceName);
+  }
 }
 
-auto gfx::destroy_device(vk_api::VulkanDevice device) -> void
+auto gfx::destroy_device(vk_api::VulkanDevice& device) -> void
 {
-  if (device.logical_device != VK_NULL_HANDLE) {
-    device.vkDeviceWaitIdle(device.logical_device);
-  }
-  if (device.image_available_semaphore != VK_NULL_HANDLE) {
-    device.vkDestroySemaphore(device.logical_device,
-                              device.image_available_semaphore, nullptr);
-  }
-  if (device.rendering_finished_semaphore != VK_NULL_HANDLE) {
-    device.vkDestroySemaphore(device.logical_device,
-                              device.rendering_finished_semaphore, nullptr);
+  if (device.logical_device == VK_NULL_HANDLE) {
+    return;
   }
-  if (device.swap_chain != VK_NULL_HANDLE) {
-    device.vkDestroySwapchainKHR(device.logical_device, device.swap_chain,
-                                 nullptr);
+  vk_api::destroy_logical_device(device);
+}
+
+auto gfx::print_device_name(const vk_api::WindowDevice& device) -> void
+{
+  print_device_name(device.device);
+}
+
+auto gfx::destroy_device(vk_api::WindowDevice& device) -> void
+{
+  if (device.device.logical_device == VK_NULL_HANDLE) {
+    return;
   }
+  vk_api::destroy_surface(device.device, *device.surface);
+  destroy_device(device.device);
+}
 
-  device.vkDestroyDevice(device.logical_device, nullptr);
-  vk_api::vkDestroySurfaceKHR(vk_api::VK_INSTANCE, device.surface, nullptr);
+auto gfx::create_swap_chain(vk_api::WindowDevice& device) -> VkResult
+{
+  return vk_api::create_surface_swap_chain(device.device, *device.surface);
 }
 
 auto gfx::print_device_name(const gfx::Device& device) -> void
@@ -845,7 +1665,10 @@ auto gfx::print_device_name(const gfx::Device& device) -> void
 auto gfx::destroy_device(const Device& device) -> void
 {
   device.self_->destroy_();
-  std::cout << "Device destroyed.\n";
+  GFX_LOG_INFO("Device destroyed.");
 }
 
-auto gfx::create_swap_chain(const Device& device) -> void {}
+auto gfx::create_swap_chain(const Device& device) -> VkResult
+{
+  return device.self_->create_swap_chain_();
+}
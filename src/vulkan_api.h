@@ -1,11 +1,12 @@
 #pragma once
 
-#include <vulkan/vulkan.h>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <vector>
 #include "platform.h"
+#include "vulkan_ext.h"
+#include "vulkan_startup.h"
 
 namespace gfx::vk_api {
 
@@ -38,10 +39,13 @@ vk_function_definition(vkEnumeratePhysicalDevices);
 vk_function_definition(vkGetPhysicalDeviceProperties);
 vk_function_definition(vkGetPhysicalDeviceFeatures);
 vk_function_definition(vkGetPhysicalDeviceQueueFamilyProperties);
+vk_function_definition(vkGetPhysicalDeviceMemoryProperties);
 vk_function_definition(vkCreateDevice);
 vk_function_definition(vkGetDeviceProcAddr);
 vk_function_definition(vkDestroyInstance);
 vk_function_definition(vkEnumerateDeviceExtensionProperties);
+// Physical device properties 2 extension, only loaded when supported.
+vk_function_definition(vkGetPhysicalDeviceFeatures2KHR);
 // Swap chain extensions.
 vk_function_definition(vkGetPhysicalDeviceSurfaceSupportKHR);
 vk_function_definition(vkGetPhysicalDeviceSurfaceCapabilitiesKHR);
@@ -56,9 +60,17 @@ vk_function_definition(vkCreateXcbSurfaceKHR);
 vk_function_definition(vkCreateXlibSurfaceKHR);
 #endif
 
+class QueueTimeline;
+class DeletionQueue;
+class SubmitAggregator;
+class DeviceResources;
+class ObjectCache;
+
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphics_family;
   std::optional<uint32_t> present_family;
+  // Compute only family, if the device has one.
+  std::optional<uint32_t> compute_family;
 
   bool is_complete()
   {
@@ -66,15 +78,45 @@ struct QueueFamilyIndices {
   }
 };
 
+// A buffer bound to its own allocation.
+struct Buffer {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  // Persistent mapping of host visible buffers, null otherwise.
+  void* mapped;
+};
+
 struct VulkanDevice {
   VkPhysicalDevice physical_device;
   VkDevice logical_device;
   VkQueue graphics_queue;
   VkQueue present_queue;
-  VkSurfaceKHR surface;
-  VkSemaphore image_available_semaphore;
-  VkSemaphore rendering_finished_semaphore;
-  VkSwapchainKHR swap_chain;
+  // Async compute queue, the graphics queue when there is none.
+  VkQueue compute_queue;
+  uint32_t graphics_family;
+  uint32_t present_family;
+  uint32_t compute_family;
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  VkPhysicalDeviceFeatures enabled_features;
+  bool timeline_semaphore_supported;
+  bool draw_indirect_count_supported;
+  // Has the swap chain extension, surfaces can be created on it.
+  bool presentable;
+  // GPU progress tracking for submissions on the graphics queue.
+  std::shared_ptr<QueueTimeline> graphics_timeline;
+  // Same for the compute queue, the graphics timeline when they are the
+  // same queue.
+  std::shared_ptr<QueueTimeline> compute_timeline;
+  // Objects released while the GPU may still use them.
+  std::shared_ptr<DeletionQueue> deletion_queue;
+  // Collects the frame's submissions and issues them in few batches.
+  std::shared_ptr<SubmitAggregator> submit_aggregator;
+  // Render passes, framebuffers, image views and samplers by create info.
+  std::shared_ptr<ObjectCache> object_cache;
+  // Objects created again from CPU copies when the device is lost. Kept
+  // across recoveries.
+  std::shared_ptr<DeviceResources> resources;
 
   // ************************************************************ //
   // Device level functions                                       //
@@ -88,6 +130,7 @@ struct VulkanDevice {
   vk_device_function_definition(vkCreateSemaphore);
   vk_device_function_definition(vkCreateCommandPool);
   vk_device_function_definition(vkAllocateCommandBuffers);
+  vk_device_function_definition(vkResetCommandPool);
   vk_device_function_definition(vkBeginCommandBuffer);
   vk_device_function_definition(vkCmdPipelineBarrier);
   vk_device_function_definition(vkCmdClearColorImage);
@@ -96,6 +139,76 @@ struct VulkanDevice {
   vk_device_function_definition(vkFreeCommandBuffers);
   vk_device_function_definition(vkDestroyCommandPool);
   vk_device_function_definition(vkDestroySemaphore);
+  vk_device_function_definition(vkCreateFence);
+  vk_device_function_definition(vkDestroyFence);
+  vk_device_function_definition(vkResetFences);
+  vk_device_function_definition(vkWaitForFences);
+  vk_device_function_definition(vkGetFenceStatus);
+  vk_device_function_definition(vkQueueWaitIdle);
+  // Memory and buffers.
+  vk_device_function_definition(vkAllocateMemory);
+  vk_device_function_definition(vkMapMemory);
+  vk_device_function_definition(vkCreateBuffer);
+  vk_device_function_definition(vkGetBufferMemoryRequirements);
+  vk_device_function_definition(vkBindBufferMemory);
+  // Images.
+  vk_device_function_definition(vkCreateImage);
+  vk_device_function_definition(vkGetImageMemoryRequirements);
+  vk_device_function_definition(vkBindImageMemory);
+  vk_device_function_definition(vkCreateImageView);
+  vk_device_function_definition(vkCreateSampler);
+  // Render passes.
+  vk_device_function_definition(vkCreateRenderPass);
+  vk_device_function_definition(vkCreateFramebuffer);
+  // Timestamp queries.
+  vk_device_function_definition(vkCreateQueryPool);
+  vk_device_function_definition(vkCmdResetQueryPool);
+  vk_device_function_definition(vkCmdWriteTimestamp);
+  vk_device_function_definition(vkGetQueryPoolResults);
+  // Compute pipelines and descriptors.
+  vk_device_function_definition(vkCreateShaderModule);
+  vk_device_function_definition(vkCreateDescriptorSetLayout);
+  vk_device_function_definition(vkCreatePipelineLayout);
+  vk_device_function_definition(vkCreateComputePipelines);
+  vk_device_function_definition(vkCreateDescriptorPool);
+  vk_device_function_definition(vkAllocateDescriptorSets);
+  vk_device_function_definition(vkUpdateDescriptorSets);
+  // Command recording.
+  vk_device_function_definition(vkCmdBindPipeline);
+  vk_device_function_definition(vkCmdBindDescriptorSets);
+  vk_device_function_definition(vkCmdPushConstants);
+  vk_device_function_definition(vkCmdDispatch);
+  vk_device_function_definition(vkCmdCopyBuffer);
+  vk_device_function_definition(vkCmdCopyBufferToImage);
+  vk_device_function_definition(vkCmdCopyImage);
+  vk_device_function_definition(vkCmdBlitImage);
+  vk_device_function_definition(vkCmdBindVertexBuffers);
+  vk_device_function_definition(vkCmdBindIndexBuffer);
+  vk_device_function_definition(vkCmdDrawIndexed);
+  vk_device_function_definition(vkCmdDrawIndexedIndirect);
+  // Object destruction.
+  vk_device_function_definition(vkFreeMemory);
+  vk_device_function_definition(vkDestroyBuffer);
+  vk_device_function_definition(vkDestroyBufferView);
+  vk_device_function_definition(vkDestroyImage);
+  vk_device_function_definition(vkDestroyImageView);
+  vk_device_function_definition(vkDestroySampler);
+  vk_device_function_definition(vkDestroyShaderModule);
+  vk_device_function_definition(vkDestroyPipelineCache);
+  vk_device_function_definition(vkDestroyPipelineLayout);
+  vk_device_function_definition(vkDestroyPipeline);
+  vk_device_function_definition(vkDestroyRenderPass);
+  vk_device_function_definition(vkDestroyFramebuffer);
+  vk_device_function_definition(vkDestroyDescriptorSetLayout);
+  vk_device_function_definition(vkDestroyDescriptorPool);
+  vk_device_function_definition(vkDestroyQueryPool);
+  vk_device_function_definition(vkDestroyEvent);
+  // Timeline semaphore extension, only loaded when supported.
+  vk_device_function_definition(vkGetSemaphoreCounterValueKHR);
+  vk_device_function_definition(vkWaitSemaphoresKHR);
+  vk_device_function_definition(vkSignalSemaphoreKHR);
+  // Draw indirect count extension, only loaded when supported.
+  vk_device_function_definition(vkCmdDrawIndexedIndirectCountKHR);
   // Swap chain extensions.
   vk_device_function_definition(vkCreateSwapchainKHR);
   vk_device_function_definition(vkGetSwapchainImagesKHR);
@@ -104,29 +217,156 @@ struct VulkanDevice {
   vk_device_function_definition(vkDestroySwapchainKHR);
 };
 
+// A window the device presents to, and its swap chain. Any number of them
+// share a presentable device. Not copyable, the device refers to it to
+// create its swap chain again after a recovery.
+struct Surface {
+  Surface() = default;
+  Surface(const Surface&) = delete;
+  Surface& operator=(const Surface&) = delete;
+
+  // To create the surface again once lost.
+  os::WindowParameters window;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+  VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {};
+  std::vector<VkImage> images;
+  // Signaled by the acquire, for the rendering to wait on.
+  VkSemaphore image_available_semaphore = VK_NULL_HANDLE;
+  // Signaled by the rendering, waited on by the present.
+  VkSemaphore rendering_finished_semaphore = VK_NULL_HANDLE;
+  // Image acquired for the current frame.
+  uint32_t image_index = 0;
+  // Of this swap chain in the last present.
+  VkResult present_result = VK_SUCCESS;
+  // Graphics timeline value of the rendering the last present waited on.
+  uint64_t last_present_value = 0;
+  // Registration with the device resources.
+  uint64_t resource_id = 0;
+};
+
+// What the gfx layer creates, a device and the surface of its window.
+struct WindowDevice {
+  VulkanDevice device;
+  std::shared_ptr<Surface> surface;
+};
+
 // Api.
-auto initialize() -> void;
+// Creation functions return the result of the call that failed, or for the
+// checks around the calls VK_ERROR_INITIALIZATION_FAILED (an entry point is
+// missing), VK_ERROR_EXTENSION_NOT_PRESENT, VK_ERROR_INCOMPATIBLE_DRIVER (no
+// suitable device) or VK_ERROR_FEATURE_NOT_PRESENT. What they created before
+// failing is destroyed.
+// Headless instances have no surface extension, only headless devices can be
+// created from them.
+auto initialize(bool headless = false) -> VkResult;
 auto destroy() -> void;
-auto create_device(const os::WindowParameters& window) -> VulkanDevice;
-auto is_physical_device_suitable_for_surface(VkPhysicalDevice device,
+// Device able to present to the window, whose surface is created along. It
+// has no swap chain yet.
+auto create_device(const os::WindowParameters& window, VulkanDevice& device,
+                   Surface& surface) -> VkResult;
+// Device without a surface or a swap chain, for offscreen and benchmark
+// work. Picks the first device whose name contains device_name when given,
+// e.g. "llvmpipe" for lavapipe, the best rated one otherwise.
+auto create_headless_device(VulkanDevice& device,
+                            const char* device_name = nullptr) -> VkResult;
+// Creates the logical device on an already picked physical device, with its
+// queues and helpers. Only presentable devices enable the swap chain
+// extension.
+auto create_logical_device(VulkanDevice& device,
+                           const PhysicalDeviceInfo& physical_device,
+                           const QueueFamilyIndices& indices,
+                           bool presentable) -> VkResult;
+// Destroys the helpers and the logical device, the surfaces must be
+// destroyed first. Also valid on a lost device.
+auto destroy_logical_device(VulkanDevice& device) -> void;
+// Name of the enumerator, for logging.
+auto result_name(VkResult result) -> const char*;
+auto is_physical_device_suitable_for_surface(const PhysicalDeviceInfo& device,
                                              VkSurfaceKHR surface) -> bool;
-auto check_physical_device_extension_support(VkPhysicalDevice device) -> bool;
+auto check_physical_device_extension_support(const PhysicalDeviceInfo& device)
+    -> bool;
 auto enumerate_all_physical_devices() -> void;
+// Null when no device is suitable.
 auto pick_best_physical_device_for_surface(VkSurfaceKHR surface)
-    -> VkPhysicalDevice;
-auto rate_physical_device_suitability(VkPhysicalDevice device,
+    -> const PhysicalDeviceInfo*;
+auto rate_physical_device_suitability(const PhysicalDeviceInfo& device,
                                       VkSurfaceKHR surface) -> int;
-auto find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface)
+auto find_queue_families(const PhysicalDeviceInfo& device, VkSurfaceKHR surface)
     -> QueueFamilyIndices;
 auto check_extension_availability(
     const char* extension_name,
-    const std::vector<VkExtensionProperties>& available_extensions) -> bool;
-auto create_window_surface(os::WindowParameters window) -> VkSurfaceKHR;
+    const VkExtensionProperties* available_extensions,
+    uint32_t available_extension_count) -> bool;
+auto create_window_surface(os::WindowParameters window, VkSurfaceKHR& surface)
+    -> VkResult;
+auto destroy_window_surface(VkSurfaceKHR surface) -> void;
+// Surface of another window on a presentable device, with no swap chain
+// yet. VK_ERROR_INCOMPATIBLE_DISPLAY_KHR when the present queue of the
+// device cannot present to it.
+auto create_surface(VulkanDevice& device, const os::WindowParameters& window,
+                    Surface& surface) -> VkResult;
+// Waits for the presents and the rendering in flight, then destroys the
+// swap chain and the surface.
+auto destroy_surface(VulkanDevice& device, Surface& surface) -> void;
+// Signals the surface's image_available_semaphore once its next image is
+// ready, image_index is the image to render to.
+auto acquire_next_image(VulkanDevice& device, Surface& surface,
+                        uint64_t timeout = UINT64_MAX) -> VkResult;
+// Presents the acquired image of every surface in a single call, each
+// waiting on its rendering_finished_semaphore. Returns the most severe
+// result, the result of every surface is in its present_result. Without
+// surfaces, nothing is presented.
+auto present_surfaces(VulkanDevice& device, Surface* const* surfaces,
+                      uint32_t surface_count) -> VkResult;
+// These return VK_NULL_HANDLE on failure.
 auto create_semaphore(VulkanDevice& device) -> VkSemaphore;
-auto create_device_swap_chain(VulkanDevice& device) -> void;
+auto create_timeline_semaphore(VulkanDevice& device, uint64_t initial_value)
+    -> VkSemaphore;
+auto create_fence(VulkanDevice& device, bool signaled) -> VkFence;
+// Returns the index of a memory type allowed by type_bits with the required
+// properties, favoring the preferred ones, or UINT32_MAX.
+auto find_memory_type(const VulkanDevice& device, uint32_t type_bits,
+                      VkMemoryPropertyFlags required,
+                      VkMemoryPropertyFlags preferred = 0) -> uint32_t;
+// The following return the result of the failing call and leave null
+// handles behind on failure.
+// Host visible buffers are mapped for their whole lifetime. Host visible
+// memory is expected to be requested along with host coherent. Buffers shared
+// with compute can be used on the graphics and compute queues alike. Without
+// a memory type matching required, VK_ERROR_OUT_OF_DEVICE_MEMORY.
+auto create_buffer(VulkanDevice& device, VkDeviceSize size,
+                   VkBufferUsageFlags usage, VkMemoryPropertyFlags required,
+                   VkMemoryPropertyFlags preferred, bool shared_with_compute,
+                   Buffer& buffer) -> VkResult;
+// Hands the buffer to the deletion queue.
+auto destroy_buffer(VulkanDevice& device, Buffer& buffer) -> void;
+auto create_shader_module(VulkanDevice& device,
+                          const std::vector<uint32_t>& spirv,
+                          VkShaderModule& module) -> VkResult;
+auto create_shader_module(VulkanDevice& device, const uint32_t* code,
+                          size_t word_count, VkShaderModule& module)
+    -> VkResult;
+// Creates a compute pipeline running the main entry point of the shader.
+auto create_compute_pipeline(VulkanDevice& device,
+                             const std::vector<uint32_t>& spirv,
+                             VkPipelineLayout layout, VkPipeline& pipeline)
+    -> VkResult;
+// Same, from a module the caller keeps ownership of.
+auto create_compute_pipeline(VulkanDevice& device, VkShaderModule module,
+                             VkPipelineLayout layout, VkPipeline& pipeline)
+    -> VkResult;
+// Reads a SPIR-V binary, returns an empty vector if it cannot be read.
+auto load_spirv(const char* path) -> std::vector<uint32_t>;
+// Creates the swap chain of the surface, replacing the current one if any,
+// e.g. after a resize.
+auto create_surface_swap_chain(VulkanDevice& device, Surface& surface)
+    -> VkResult;
 auto get_swap_chain_num_images(VkSurfaceCapabilitiesKHR& surface_capabilities)
     -> uint32_t;
-auto get_swap_chain_format(std::vector<VkSurfaceFormatKHR>& surface_formats)
+auto get_swap_chain_format(const VkSurfaceFormatKHR* surface_formats,
+                           uint32_t surface_format_count)
     -> VkSurfaceFormatKHR;
 auto get_swap_chain_extent(VkSurfaceCapabilitiesKHR& surface_capabilities)
     -> VkExtent2D;
@@ -134,7 +374,8 @@ auto get_swap_chain_usage_flags(VkSurfaceCapabilitiesKHR& surface_capabilities)
     -> VkImageUsageFlags;
 auto get_swap_chain_transform(VkSurfaceCapabilitiesKHR& surface_capabilities)
     -> VkSurfaceTransformFlagBitsKHR;
-auto get_swap_chain_present_mode(std::vector<VkPresentModeKHR>& present_modes)
+auto get_swap_chain_present_mode(const VkPresentModeKHR* present_modes,
+                                 uint32_t present_mode_count)
     -> VkPresentModeKHR;
 
 }  // namespace gfx::vk_api
@@ -143,6 +384,14 @@ auto get_swap_chain_present_mode(std::vector<VkPresentModeKHR>& present_modes)
 
 namespace gfx {
 
+// The implementations Device forwards to, declared before its Model so
+// that the unqualified calls find them.
+auto print_device_name(vk_api::VulkanDevice device) -> void;
+auto destroy_device(vk_api::VulkanDevice& device) -> void;
+auto print_device_name(const vk_api::WindowDevice& device) -> void;
+auto destroy_device(vk_api::WindowDevice& device) -> void;
+auto create_swap_chain(vk_api::WindowDevice& device) -> VkResult;
+
 class Device {
  public:
   template <typename T>
@@ -152,14 +401,14 @@ class Device {
 
   friend auto print_device_name(const Device& device) -> void;
   friend auto destroy_device(const Device& device) -> void;
-  friend auto create_swap_chain(const Device& device) -> void;
+  friend auto create_swap_chain(const Device& device) -> VkResult;
 
  private:
   struct Concept {
     virtual ~Concept() = default;
     virtual auto print_name_() -> void = 0;
     virtual auto destroy_() -> void = 0;
-    virtual auto create_swap_chain_() -> void = 0;
+    virtual auto create_swap_chain_() -> VkResult = 0;
   };
 
   template <typename T>
@@ -169,9 +418,9 @@ class Device {
 
     auto print_name_() -> void override { print_device_name(user_model_); }
     auto destroy_() -> void override { destroy_device(user_model_); }
-    auto create_swap_chain_() -> void override
+    auto create_swap_chain_() -> VkResult override
     {
-      create_swap_chain(user_model_);
+      return create_swap_chain(user_model_);
     }
 
     T user_model_;
@@ -182,15 +431,14 @@ class Device {
 
 // api.
 
-auto load_backend() -> void;
+// Return false, and no device, when the backend cannot be used.
+auto load_backend() -> bool;
 auto unload_backend() -> void;
-auto create_device(const os::WindowParameters& window) -> Device;
-
-}  // namespace gfx
-
-namespace gfx {
-
-auto print_device_name(vk_api::VulkanDevice device) -> void;
-auto destroy_device(vk_api::VulkanDevice device) -> void;
+auto create_device(const os::WindowParameters& window)
+    -> std::optional<Device>;
+// The friends of Device, for the qualified calls.
+auto print_device_name(const Device& device) -> void;
+auto destroy_device(const Device& device) -> void;
+auto create_swap_chain(const Device& device) -> VkResult;
 
 }  // namespace gfx
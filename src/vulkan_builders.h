@@ -0,0 +1,272 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <type_traits>
+#include "log.h"
+#include "vulkan_ext.h"
+
+namespace gfx::vk_api {
+
+// ************************************************************ //
+// Structure builders                                           //
+//                                                              //
+// Compile time helpers to fill Vulkan structures by field      //
+// name instead of long positional aggregates. sType is filled  //
+// from the structure type and pNext chains are checked against //
+// the structures each extension is allowed to extend. All of   //
+// it is constexpr and folds away to plain stores, which        //
+// bench/builders_bench.cpp checks against hand filled          //
+// structures.                                                  //
+// ************************************************************ //
+
+// The VkStructureType of each structure.
+template <typename T>
+struct StructureType;
+
+// Whether Next may appear in the pNext chain of Base.
+template <typename Next, typename Base>
+struct Extends : std::false_type {
+};
+
+#define vk_structure_type(type, value)                \
+  template <>                                         \
+  struct StructureType<type> {                        \
+    static constexpr VkStructureType sType = value;   \
+  }
+
+#define vk_structure_extends(next, base) \
+  template <>                            \
+  struct Extends<next, base> : std::true_type {}
+
+vk_structure_type(VkApplicationInfo, VK_STRUCTURE_TYPE_APPLICATION_INFO);
+vk_structure_type(VkInstanceCreateInfo,
+                  VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO);
+vk_structure_type(VkDeviceQueueCreateInfo,
+                  VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO);
+vk_structure_type(VkDeviceCreateInfo, VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO);
+vk_structure_type(VkPhysicalDeviceFeatures2,
+                  VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2);
+vk_structure_type(VkSubmitInfo, VK_STRUCTURE_TYPE_SUBMIT_INFO);
+vk_structure_type(VkFenceCreateInfo, VK_STRUCTURE_TYPE_FENCE_CREATE_INFO);
+vk_structure_type(VkSemaphoreCreateInfo,
+                  VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO);
+vk_structure_type(VkCommandPoolCreateInfo,
+                  VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO);
+vk_structure_type(VkCommandBufferAllocateInfo,
+                  VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO);
+vk_structure_type(VkCommandBufferBeginInfo,
+                  VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO);
+vk_structure_type(VkMemoryAllocateInfo,
+                  VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO);
+vk_structure_type(VkBufferCreateInfo, VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO);
+vk_structure_type(VkImageCreateInfo, VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO);
+vk_structure_type(VkImageViewCreateInfo,
+                  VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO);
+vk_structure_type(VkSamplerCreateInfo, VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO);
+vk_structure_type(VkRenderPassCreateInfo,
+                  VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO);
+vk_structure_type(VkFramebufferCreateInfo,
+                  VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO);
+vk_structure_type(VkQueryPoolCreateInfo,
+                  VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO);
+vk_structure_type(VkShaderModuleCreateInfo,
+                  VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO);
+vk_structure_type(VkPipelineShaderStageCreateInfo,
+                  VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO);
+vk_structure_type(VkComputePipelineCreateInfo,
+                  VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO);
+vk_structure_type(VkPipelineLayoutCreateInfo,
+                  VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO);
+vk_structure_type(VkDescriptorSetLayoutCreateInfo,
+                  VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO);
+vk_structure_type(VkDescriptorPoolCreateInfo,
+                  VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO);
+vk_structure_type(VkDescriptorSetAllocateInfo,
+                  VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO);
+vk_structure_type(VkWriteDescriptorSet, VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET);
+vk_structure_type(VkMemoryBarrier, VK_STRUCTURE_TYPE_MEMORY_BARRIER);
+vk_structure_type(VkBufferMemoryBarrier,
+                  VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER);
+vk_structure_type(VkImageMemoryBarrier, VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER);
+vk_structure_type(VkSwapchainCreateInfoKHR,
+                  VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR);
+vk_structure_type(VkPresentInfoKHR, VK_STRUCTURE_TYPE_PRESENT_INFO_KHR);
+#if defined(VK_USE_PLATFORM_WIN32_KHR)
+vk_structure_type(VkWin32SurfaceCreateInfoKHR,
+                  VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR);
+#elif defined(VK_USE_PLATFORM_XCB_KHR)
+vk_structure_type(VkXcbSurfaceCreateInfoKHR,
+                  VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR);
+#elif defined(VK_USE_PLATFORM_XLIB_KHR)
+vk_structure_type(VkXlibSurfaceCreateInfoKHR,
+                  VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR);
+#endif
+// Timeline semaphores.
+vk_structure_type(VkPhysicalDeviceTimelineSemaphoreFeaturesKHR,
+                  VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR);
+vk_structure_type(VkSemaphoreTypeCreateInfoKHR,
+                  VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR);
+vk_structure_type(VkTimelineSemaphoreSubmitInfoKHR,
+                  VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR);
+vk_structure_type(VkSemaphoreWaitInfoKHR,
+                  VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR);
+vk_structure_type(VkSemaphoreSignalInfoKHR,
+                  VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR);
+
+vk_structure_extends(VkPhysicalDeviceFeatures2, VkDeviceCreateInfo);
+vk_structure_extends(VkPhysicalDeviceTimelineSemaphoreFeaturesKHR,
+                     VkDeviceCreateInfo);
+vk_structure_extends(VkPhysicalDeviceTimelineSemaphoreFeaturesKHR,
+                     VkPhysicalDeviceFeatures2);
+vk_structure_extends(VkSemaphoreTypeCreateInfoKHR, VkSemaphoreCreateInfo);
+vk_structure_extends(VkTimelineSemaphoreSubmitInfoKHR, VkSubmitInfo);
+
+// Returns a zero initialized structure with its sType filled.
+template <typename T>
+constexpr auto make_struct() -> T
+{
+  T value{};
+  value.sType = StructureType<T>::sType;
+  return value;
+}
+
+// std::type_identity of C++20, keeps a parameter out of the deduction.
+template <typename T>
+struct TypeIdentity {
+  using type = T;
+};
+
+// ************************************************************ //
+// StructBuilder                                                //
+//                                                              //
+// Fluent builder setting fields through member pointers:       //
+//   build<VkFenceCreateInfo>()                                 //
+//       .set(&VkFenceCreateInfo::flags, flags)                 //
+//       .get();                                                //
+// ************************************************************ //
+template <typename T>
+class StructBuilder {
+ public:
+  constexpr StructBuilder() : value_(make_struct<T>()) {}
+
+  // The member alone decides the field type, the value converts to it
+  // implicitly, so narrowing conversions warn as in an assignment.
+  template <typename M>
+  constexpr auto set(M T::*member,
+                     const typename TypeIdentity<M>::type& value) &
+      -> StructBuilder&
+  {
+    value_.*member = value;
+    return *this;
+  }
+
+  // Chained on a temporary every step returns a new builder by value. Through
+  // references the structure would have to live in memory and be copied out
+  // at the end, by value it folds into the stores of the final structure.
+  template <typename M>
+  constexpr auto set(M T::*member,
+                     const typename TypeIdentity<M>::type& value) &&
+      -> StructBuilder
+  {
+    StructBuilder builder = *this;
+    builder.set(member, value);
+    return builder;
+  }
+
+  // Links the extension at the front of the pNext chain. The extension must
+  // outlive the built structure.
+  template <typename Next>
+  constexpr auto next(Next& extension) & -> StructBuilder&
+  {
+    static_assert(Extends<Next, T>::value,
+                  "Structure is not allowed in this pNext chain.");
+    extension.pNext = const_cast<void*>(value_.pNext);
+    value_.pNext = &extension;
+    return *this;
+  }
+
+  template <typename Next>
+  constexpr auto next(Next& extension) && -> StructBuilder
+  {
+    StructBuilder builder = *this;
+    builder.next(extension);
+    return builder;
+  }
+
+  constexpr auto get() const& -> const T& { return value_; }
+  constexpr auto get() && -> T { return value_; }
+  constexpr operator T() const { return value_; }
+
+ private:
+  T value_;
+};
+
+template <typename T>
+constexpr auto build() -> StructBuilder<T>
+{
+  return StructBuilder<T>();
+}
+
+// ************************************************************ //
+// StackArray                                                   //
+//                                                              //
+// Fixed capacity array living on the stack, used to assemble   //
+// create info arrays without touching the heap.                //
+// ************************************************************ //
+template <typename T, size_t N>
+class StackArray {
+ public:
+  constexpr StackArray() : values_(), size_(0) {}
+
+  constexpr auto push_back(const T& value) -> T&
+  {
+    if (size_ == N) {
+      GFX_LOG_ERROR("StackArray capacity of {} exceeded!", N);
+      std::terminate();
+    }
+    values_[size_] = value;
+    return values_[size_++];
+  }
+
+  constexpr auto operator[](size_t index) -> T& { return values_[index]; }
+  constexpr auto operator[](size_t index) const -> const T&
+  {
+    return values_[index];
+  }
+  constexpr auto data() -> T* { return values_; }
+  constexpr auto data() const -> const T* { return values_; }
+  constexpr auto size() const -> size_t { return size_; }
+  constexpr auto count() const -> uint32_t
+  {
+    return static_cast<uint32_t>(size_);
+  }
+  constexpr auto empty() const -> bool { return size_ == 0; }
+  constexpr auto begin() -> T* { return values_; }
+  constexpr auto end() -> T* { return values_ + size_; }
+  constexpr auto begin() const -> const T* { return values_; }
+  constexpr auto end() const -> const T* { return values_ + size_; }
+
+ private:
+  T values_[N];
+  size_t size_;
+};
+
+// The builders must fold into constants: building a structure in a constant
+// expression proves no runtime work is left behind.
+static_assert(build<VkFenceCreateInfo>()
+                      .set(&VkFenceCreateInfo::flags,
+                           VK_FENCE_CREATE_SIGNALED_BIT)
+                      .get()
+                      .flags == VK_FENCE_CREATE_SIGNALED_BIT,
+              "Structure builders must be usable in constant expressions.");
+static_assert(make_struct<VkSubmitInfo>().sType ==
+                  VK_STRUCTURE_TYPE_SUBMIT_INFO,
+              "Structure builders must be usable in constant expressions.");
+static_assert(sizeof(StructBuilder<VkSubmitInfo>) == sizeof(VkSubmitInfo),
+              "Builders must not add storage to the built structure.");
+
+#undef vk_structure_type
+#undef vk_structure_extends
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,1831 @@
+#include "vulkan_capture.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "log.h"
+#include "vulkan_trace.h"
+
+namespace gfx::vk_api {
+
+namespace {
+
+struct CapturedObject {
+  VkObjectType type;
+  uint64_t handle;
+  // Descriptor sets and command buffers of a pool, images of a swap chain.
+  uint32_t parent;
+  std::vector<uint32_t> children;
+  // Keys of the records recreating the object in STATE.
+  std::vector<uint64_t> records;
+  // Allocation size of memory objects.
+  VkDeviceSize size;
+  bool timeline;
+};
+
+struct StateRecord {
+  uint32_t owner;
+  TraceOp op;
+  std::vector<std::byte> bytes;
+};
+
+struct MappedMemory {
+  const std::byte* data;
+  VkDeviceSize size;
+  // Hash of every chunk as the trace last saw it, once snapshot is set.
+  std::vector<uint64_t> written;
+  bool snapshot;
+};
+
+struct CommandBufferState {
+  uint32_t id;
+  // The commands since the last begin, ready to be written.
+  TraceRecord record;
+  // Written to the current capture since the last begin.
+  bool emitted;
+};
+
+// Contents are kept to tell the blobs sharing a hash apart.
+struct WrittenBlob {
+  uint32_t id;
+  std::vector<std::byte> data;
+};
+
+using DescriptorKey = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+bool ENABLED = false;
+// Guards everything below. Calls into the device run outside of it, except
+// queue operations, whose order in the trace must be the submission order.
+std::mutex CAPTURE_MUTEX;
+// The table the wrappers forward to.
+VulkanDevice ORIGINAL;
+
+std::map<std::pair<VkObjectType, uint64_t>, uint32_t> IDS;
+std::unordered_map<uint32_t, CapturedObject> OBJECTS;
+uint32_t NEXT_ID = 1;
+// Records recreating the live objects, in call order.
+std::map<uint64_t, StateRecord> STATE;
+uint64_t NEXT_RECORD = 0;
+// The record of the last write to every descriptor set binding and element.
+std::map<DescriptorKey, uint64_t> DESCRIPTOR_WRITES;
+std::map<uint32_t, MappedMemory> MAPPED;
+std::unordered_map<VkCommandBuffer, CommandBufferState> COMMAND_BUFFERS;
+std::unordered_map<VkQueue, uint32_t> QUEUE_FAMILIES;
+std::unordered_map<uint32_t, VkSwapchainCreateInfoKHR> SWAPCHAINS;
+
+// Capture in progress.
+std::atomic<bool> CAPTURING = false;
+std::ofstream OUTPUT;
+uint32_t FRAME_COUNT = 0;
+uint32_t FRAMES = 0;
+std::unordered_multimap<uint64_t, WrittenBlob> BLOBS;
+uint32_t NEXT_BLOB = 1;
+// GPU progress the application saw, which replay has to wait for too.
+std::unordered_map<uint32_t, uint64_t> OBSERVED_VALUES;
+std::unordered_set<uint32_t> OBSERVED_FENCES;
+
+template <typename T>
+auto handle_key(T handle) -> uint64_t
+{
+  return reinterpret_cast<uint64_t>(handle);
+}
+
+template <typename T>
+auto find_in_chain(const void* next, VkStructureType type) -> const T*
+{
+  for (auto* structure = static_cast<const VkBaseInStructure*>(next);
+       structure != nullptr; structure = structure->pNext) {
+    if (structure->sType == type) {
+      return reinterpret_cast<const T*>(structure);
+    }
+  }
+  return nullptr;
+}
+
+// FNV-1a over 8 byte words, the tail byte by byte.
+auto hash_bytes(const std::byte* data, size_t size) -> uint64_t
+{
+  uint64_t hash = 0xcbf29ce484222325ull ^ size;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ static_cast<uint64_t>(data[i])) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+template <typename T>
+auto find_id(VkObjectType type, T handle) -> uint32_t
+{
+  if (handle == VK_NULL_HANDLE) {
+    return 0;
+  }
+  auto id = IDS.find({type, handle_key(handle)});
+  return id == IDS.end() ? 0 : id->second;
+}
+
+// The handle with its id in place, for the structures written as is.
+template <typename T>
+auto as_id(VkObjectType type, T handle) -> T
+{
+  return id_as_handle<T>(find_id(type, handle));
+}
+
+template <typename T>
+auto ids_of(VkObjectType type, const T* handles, uint32_t count)
+    -> std::vector<uint32_t>
+{
+  std::vector<uint32_t> ids(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    ids[i] = find_id(type, handles[i]);
+  }
+  return ids;
+}
+
+template <typename T>
+auto put_ids(TraceRecord& record, VkObjectType type, const T* handles,
+             uint32_t count) -> void
+{
+  std::vector<uint32_t> ids = ids_of(type, handles, count);
+  record.put_array(ids.data(), count);
+}
+
+template <typename T>
+auto register_object(VkObjectType type, T handle, uint32_t parent = 0)
+    -> uint32_t
+{
+  uint32_t id = NEXT_ID++;
+  IDS[{type, handle_key(handle)}] = id;
+  OBJECTS[id] = {type, handle_key(handle), parent, {}, {}, 0, false};
+  if (parent != 0) {
+    OBJECTS[parent].children.push_back(id);
+  }
+  return id;
+}
+
+auto write(const TraceRecord& record) -> void
+{
+  if (CAPTURING) {
+    std::vector<std::byte> bytes = record.bytes();
+    OUTPUT.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  }
+}
+
+// Keeps the record for the setup of later captures.
+auto keep_state(uint32_t owner, const TraceRecord& record) -> uint64_t
+{
+  uint64_t key = NEXT_RECORD++;
+  STATE[key] = {owner, record.op(), record.bytes()};
+  OBJECTS[owner].records.push_back(key);
+  return key;
+}
+
+// Same, and writes it to the current capture.
+auto add_state(uint32_t owner, const TraceRecord& record) -> uint64_t
+{
+  write(record);
+  return keep_state(owner, record);
+}
+
+auto forget(uint32_t id) -> void
+{
+  auto object = OBJECTS.find(id);
+  if (object == OBJECTS.end()) {
+    return;
+  }
+  for (uint32_t child : object->second.children) {
+    forget(child);
+  }
+  for (uint64_t key : object->second.records) {
+    STATE.erase(key);
+  }
+  if (object->second.type == VK_OBJECT_TYPE_DESCRIPTOR_SET) {
+    DESCRIPTOR_WRITES.erase(
+        DESCRIPTOR_WRITES.lower_bound({id, 0, 0}),
+        DESCRIPTOR_WRITES.lower_bound({id + 1, 0, 0}));
+  }
+  if (object->second.type == VK_OBJECT_TYPE_COMMAND_BUFFER) {
+    COMMAND_BUFFERS.erase(
+        reinterpret_cast<VkCommandBuffer>(object->second.handle));
+  }
+  MAPPED.erase(id);
+  SWAPCHAINS.erase(id);
+  OBSERVED_VALUES.erase(id);
+  OBSERVED_FENCES.erase(id);
+  IDS.erase({object->second.type, object->second.handle});
+  OBJECTS.erase(object);
+}
+
+// Children go along with their pool, replay knows it.
+template <typename T>
+auto destroyed(VkObjectType type, T handle) -> void
+{
+  uint32_t id = find_id(type, handle);
+  if (id == 0) {
+    return;
+  }
+  write(TraceRecord(TraceOp::destroy).put(type).put(id));
+  forget(id);
+}
+
+auto write_blob(const std::byte* data, size_t size) -> uint32_t
+{
+  uint64_t hash = hash_bytes(data, size);
+  auto [first, last] = BLOBS.equal_range(hash);
+  for (auto blob = first; blob != last; ++blob) {
+    const std::vector<std::byte>& written = blob->second.data;
+    if (written.size() == size && memcmp(written.data(), data, size) == 0) {
+      return blob->second.id;
+    }
+  }
+  uint32_t id = NEXT_BLOB++;
+  BLOBS.emplace(hash,
+                WrittenBlob{id, std::vector<std::byte>(data, data + size)});
+  write(TraceRecord(TraceOp::blob).put(id).put_array(
+      data, static_cast<uint32_t>(size)));
+  return id;
+}
+
+// Writes the chunks of mapped memory changed since the trace last saw them.
+auto write_memory_changes() -> void
+{
+  for (auto& [id, mapped] : MAPPED) {
+    size_t chunk_count =
+        (mapped.size + TRACE_CHUNK_SIZE - 1) / TRACE_CHUNK_SIZE;
+    mapped.written.resize(chunk_count);
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+      VkDeviceSize offset = chunk * TRACE_CHUNK_SIZE;
+      size_t size = static_cast<size_t>(
+          std::min<VkDeviceSize>(TRACE_CHUNK_SIZE, mapped.size - offset));
+      uint64_t hash = hash_bytes(mapped.data + offset, size);
+      if (mapped.snapshot && mapped.written[chunk] == hash) {
+        continue;
+      }
+      mapped.written[chunk] = hash;
+      uint32_t blob = write_blob(mapped.data + offset, size);
+      write(TraceRecord(TraceOp::memory_write).put(id).put(offset).put(blob));
+    }
+    mapped.snapshot = true;
+  }
+}
+
+auto finish_capture() -> void
+{
+  uint32_t frames = FRAMES;
+  OUTPUT.seekp(offsetof(TraceHeader, frame_count));
+  OUTPUT.write(reinterpret_cast<const char*>(&frames), sizeof(frames));
+  OUTPUT.seekp(offsetof(TraceHeader, id_count));
+  OUTPUT.write(reinterpret_cast<const char*>(&NEXT_ID), sizeof(NEXT_ID));
+  OUTPUT.seekp(offsetof(TraceHeader, blob_count));
+  OUTPUT.write(reinterpret_cast<const char*>(&NEXT_BLOB), sizeof(NEXT_BLOB));
+  OUTPUT.close();
+  CAPTURING = false;
+  BLOBS.clear();
+  OBSERVED_VALUES.clear();
+  OBSERVED_FENCES.clear();
+  for (auto& [id, mapped] : MAPPED) {
+    mapped.snapshot = false;
+  }
+  GFX_LOG_INFO("Captured {} frames.", frames);
+}
+
+auto semaphore_record(uint32_t id, bool timeline, uint64_t value)
+    -> TraceRecord
+{
+  TraceRecord record(TraceOp::create_semaphore);
+  record.put(id).put(uint32_t{timeline}).put(value);
+  return record;
+}
+
+auto fence_record(uint32_t id, bool signaled) -> TraceRecord
+{
+  TraceRecord record(TraceOp::create_fence);
+  record.put(id).put(uint32_t{signaled});
+  return record;
+}
+
+auto image_create_record(uint32_t id, VkImageCreateInfo info) -> TraceRecord
+{
+  TraceRecord record(TraceOp::create_image);
+  const uint32_t* families = info.pQueueFamilyIndices;
+  uint32_t family_count =
+      families != nullptr ? info.queueFamilyIndexCount : 0;
+  info.pNext = nullptr;
+  info.pQueueFamilyIndices = nullptr;
+  record.put(id).put(info).put_array(families, family_count);
+  return record;
+}
+
+// The write with its image, buffer and texel buffer view infos.
+auto put_descriptor_write(TraceRecord& record,
+                          const VkWriteDescriptorSet& write) -> void
+{
+  VkWriteDescriptorSet stored = write;
+  stored.pNext = nullptr;
+  stored.dstSet = as_id(VK_OBJECT_TYPE_DESCRIPTOR_SET, write.dstSet);
+  stored.pImageInfo = nullptr;
+  stored.pBufferInfo = nullptr;
+  stored.pTexelBufferView = nullptr;
+  std::vector<VkDescriptorImageInfo> images;
+  std::vector<VkDescriptorBufferInfo> buffers;
+  std::vector<uint32_t> texel_views;
+  if (write.pImageInfo != nullptr) {
+    images.assign(write.pImageInfo, write.pImageInfo + write.descriptorCount);
+    for (VkDescriptorImageInfo& image : images) {
+      image.sampler = as_id(VK_OBJECT_TYPE_SAMPLER, image.sampler);
+      image.imageView = as_id(VK_OBJECT_TYPE_IMAGE_VIEW, image.imageView);
+    }
+  }
+  if (write.pBufferInfo != nullptr) {
+    buffers.assign(write.pBufferInfo,
+                   write.pBufferInfo + write.descriptorCount);
+    for (VkDescriptorBufferInfo& buffer : buffers) {
+      buffer.buffer = as_id(VK_OBJECT_TYPE_BUFFER, buffer.buffer);
+    }
+  }
+  if (write.pTexelBufferView != nullptr) {
+    texel_views = ids_of(VK_OBJECT_TYPE_BUFFER_VIEW, write.pTexelBufferView,
+                         write.descriptorCount);
+  }
+  record.put(stored);
+  record.put_array(images.data(), static_cast<uint32_t>(images.size()));
+  record.put_array(buffers.data(), static_cast<uint32_t>(buffers.size()));
+  record.put_array(texel_views.data(),
+                   static_cast<uint32_t>(texel_views.size()));
+}
+
+// Appends a command to the commands of its command buffer.
+auto record_command(VkCommandBuffer command_buffer, const TraceRecord& command)
+    -> void
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  auto state = COMMAND_BUFFERS.find(command_buffer);
+  if (state != COMMAND_BUFFERS.end()) {
+    state->second.record.put_record(command);
+  }
+}
+
+// Device.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkGetDeviceQueue(VkDevice device,
+                                                   uint32_t family,
+                                                   uint32_t index,
+                                                   VkQueue* queue) -> void
+{
+  ORIGINAL.vkGetDeviceQueue(device, family, index, queue);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  QUEUE_FAMILIES[*queue] = family;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDeviceWaitIdle(VkDevice device)
+    -> VkResult
+{
+  VkResult result = ORIGINAL.vkDeviceWaitIdle(device);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (result == VK_SUCCESS) {
+    write(TraceRecord(TraceOp::device_wait_idle));
+  }
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyDevice(
+    VkDevice device, const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    if (CAPTURING) {
+      GFX_LOG_WARNING(
+          "Device destroyed during the capture, the trace ends early.");
+      finish_capture();
+    }
+    IDS.clear();
+    OBJECTS.clear();
+    STATE.clear();
+    DESCRIPTOR_WRITES.clear();
+    MAPPED.clear();
+    COMMAND_BUFFERS.clear();
+    QUEUE_FAMILIES.clear();
+    SWAPCHAINS.clear();
+  }
+  auto destroy_device = ORIGINAL.vkDestroyDevice;
+  ORIGINAL = {};
+  destroy_device(device, allocator);
+}
+
+// Synchronization.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateSemaphore(
+    VkDevice device, const VkSemaphoreCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkSemaphore* semaphore)
+    -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateSemaphore(device, create_info, allocator, semaphore);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  auto* type_info = find_in_chain<VkSemaphoreTypeCreateInfoKHR>(
+      create_info->pNext, VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR);
+  bool timeline = type_info != nullptr &&
+                  type_info->semaphoreType == VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_SEMAPHORE, *semaphore);
+  OBJECTS[id].timeline = timeline;
+  add_state(id, semaphore_record(id, timeline,
+                                 timeline ? type_info->initialValue : 0));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroySemaphore(
+    VkDevice device, VkSemaphore semaphore,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_SEMAPHORE, semaphore);
+  }
+  ORIGINAL.vkDestroySemaphore(device, semaphore, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateFence(
+    VkDevice device, const VkFenceCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkFence* fence) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateFence(device, create_info, allocator, fence);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_FENCE, *fence);
+  add_state(id, fence_record(id, (create_info->flags &
+                                  VK_FENCE_CREATE_SIGNALED_BIT) != 0));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyFence(
+    VkDevice device, VkFence fence, const VkAllocationCallbacks* allocator)
+    -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_FENCE, fence);
+  }
+  ORIGINAL.vkDestroyFence(device, fence, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkResetFences(VkDevice device,
+                                                uint32_t fence_count,
+                                                const VkFence* fences)
+    -> VkResult
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (CAPTURING) {
+    TraceRecord record(TraceOp::reset_fences);
+    put_ids(record, VK_OBJECT_TYPE_FENCE, fences, fence_count);
+    write(record);
+    for (uint32_t i = 0; i < fence_count; ++i) {
+      OBSERVED_FENCES.erase(find_id(VK_OBJECT_TYPE_FENCE, fences[i]));
+    }
+  }
+  return ORIGINAL.vkResetFences(device, fence_count, fences);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkWaitForFences(VkDevice device,
+                                                  uint32_t fence_count,
+                                                  const VkFence* fences,
+                                                  VkBool32 wait_all,
+                                                  uint64_t timeout)
+    -> VkResult
+{
+  VkResult result = ORIGINAL.vkWaitForFences(device, fence_count, fences,
+                                             wait_all, timeout);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (CAPTURING && result == VK_SUCCESS) {
+    TraceRecord record(TraceOp::wait_for_fences);
+    record.put(wait_all);
+    put_ids(record, VK_OBJECT_TYPE_FENCE, fences, fence_count);
+    write(record);
+    for (uint32_t i = 0; i < fence_count && wait_all; ++i) {
+      OBSERVED_FENCES.insert(find_id(VK_OBJECT_TYPE_FENCE, fences[i]));
+    }
+  }
+  return result;
+}
+
+// A fence seen signaled is a wait as far as replay is concerned.
+VKAPI_ATTR auto VKAPI_CALL capture_vkGetFenceStatus(VkDevice device,
+                                                   VkFence fence) -> VkResult
+{
+  VkResult result = ORIGINAL.vkGetFenceStatus(device, fence);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = find_id(VK_OBJECT_TYPE_FENCE, fence);
+  if (CAPTURING && result == VK_SUCCESS &&
+      OBSERVED_FENCES.insert(id).second) {
+    write(TraceRecord(TraceOp::wait_for_fences)
+              .put(VkBool32{VK_TRUE})
+              .put_array(&id, 1));
+  }
+  return result;
+}
+
+// Same for timeline values.
+VKAPI_ATTR auto VKAPI_CALL capture_vkGetSemaphoreCounterValueKHR(
+    VkDevice device, VkSemaphore semaphore, uint64_t* value) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkGetSemaphoreCounterValueKHR(device, semaphore, value);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = find_id(VK_OBJECT_TYPE_SEMAPHORE, semaphore);
+  if (CAPTURING && result == VK_SUCCESS && *value > OBSERVED_VALUES[id]) {
+    OBSERVED_VALUES[id] = *value;
+    write(TraceRecord(TraceOp::wait_semaphores)
+              .put(VkSemaphoreWaitFlagsKHR{0})
+              .put_array(&id, 1)
+              .put_array(value, 1));
+  }
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkWaitSemaphoresKHR(
+    VkDevice device, const VkSemaphoreWaitInfoKHR* wait_info,
+    uint64_t timeout) -> VkResult
+{
+  VkResult result = ORIGINAL.vkWaitSemaphoresKHR(device, wait_info, timeout);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (CAPTURING && result == VK_SUCCESS) {
+    TraceRecord record(TraceOp::wait_semaphores);
+    record.put(wait_info->flags);
+    put_ids(record, VK_OBJECT_TYPE_SEMAPHORE, wait_info->pSemaphores,
+            wait_info->semaphoreCount);
+    record.put_array(wait_info->pValues, wait_info->semaphoreCount);
+    write(record);
+    bool wait_any = (wait_info->flags & VK_SEMAPHORE_WAIT_ANY_BIT_KHR) != 0;
+    for (uint32_t i = 0; i < wait_info->semaphoreCount && !wait_any; ++i) {
+      uint64_t& observed = OBSERVED_VALUES[find_id(
+          VK_OBJECT_TYPE_SEMAPHORE, wait_info->pSemaphores[i])];
+      observed = std::max(observed, wait_info->pValues[i]);
+    }
+  }
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkSignalSemaphoreKHR(
+    VkDevice device, const VkSemaphoreSignalInfoKHR* signal_info)
+    -> VkResult
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (CAPTURING) {
+    write(TraceRecord(TraceOp::signal_semaphore)
+              .put(find_id(VK_OBJECT_TYPE_SEMAPHORE, signal_info->semaphore))
+              .put(signal_info->value));
+  }
+  return ORIGINAL.vkSignalSemaphoreKHR(device, signal_info);
+}
+
+// Queues.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkQueueSubmit(VkQueue queue,
+                                                uint32_t submit_count,
+                                                const VkSubmitInfo* submits,
+                                                VkFence fence) -> VkResult
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (!CAPTURING) {
+    return ORIGINAL.vkQueueSubmit(queue, submit_count, submits, fence);
+  }
+
+  // Host writes reach the GPU at submission.
+  write_memory_changes();
+  TraceRecord record(TraceOp::queue_submit);
+  record.put(QUEUE_FAMILIES[queue])
+      .put(find_id(VK_OBJECT_TYPE_FENCE, fence))
+      .put(submit_count);
+  for (uint32_t i = 0; i < submit_count; ++i) {
+    const VkSubmitInfo& submit = submits[i];
+    for (uint32_t j = 0; j < submit.commandBufferCount; ++j) {
+      auto state = COMMAND_BUFFERS.find(submit.pCommandBuffers[j]);
+      if (state != COMMAND_BUFFERS.end() && !state->second.emitted) {
+        write(state->second.record);
+        state->second.emitted = true;
+      }
+    }
+    auto* timeline_info = find_in_chain<VkTimelineSemaphoreSubmitInfoKHR>(
+        submit.pNext, VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR);
+    std::vector<uint64_t> wait_values(submit.waitSemaphoreCount, 0);
+    std::vector<uint64_t> signal_values(submit.signalSemaphoreCount, 0);
+    if (timeline_info != nullptr) {
+      for (uint32_t j = 0; j < timeline_info->waitSemaphoreValueCount &&
+                           j < submit.waitSemaphoreCount;
+           ++j) {
+        wait_values[j] = timeline_info->pWaitSemaphoreValues[j];
+      }
+      for (uint32_t j = 0; j < timeline_info->signalSemaphoreValueCount &&
+                           j < submit.signalSemaphoreCount;
+           ++j) {
+        signal_values[j] = timeline_info->pSignalSemaphoreValues[j];
+      }
+    }
+    put_ids(record, VK_OBJECT_TYPE_SEMAPHORE, submit.pWaitSemaphores,
+            submit.waitSemaphoreCount);
+    record.put_array(submit.pWaitDstStageMask, submit.waitSemaphoreCount);
+    record.put_array(wait_values.data(), submit.waitSemaphoreCount);
+    put_ids(record, VK_OBJECT_TYPE_COMMAND_BUFFER, submit.pCommandBuffers,
+            submit.commandBufferCount);
+    put_ids(record, VK_OBJECT_TYPE_SEMAPHORE, submit.pSignalSemaphores,
+            submit.signalSemaphoreCount);
+    record.put_array(signal_values.data(), submit.signalSemaphoreCount);
+  }
+  write(record);
+  OBSERVED_FENCES.erase(find_id(VK_OBJECT_TYPE_FENCE, fence));
+  return ORIGINAL.vkQueueSubmit(queue, submit_count, submits, fence);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkQueueWaitIdle(VkQueue queue) -> VkResult
+{
+  VkResult result = ORIGINAL.vkQueueWaitIdle(queue);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (result == VK_SUCCESS) {
+    write(TraceRecord(TraceOp::queue_wait_idle).put(QUEUE_FAMILIES[queue]));
+  }
+  return result;
+}
+
+// Memory and resources.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkAllocateMemory(
+    VkDevice device, const VkMemoryAllocateInfo* allocate_info,
+    const VkAllocationCallbacks* allocator, VkDeviceMemory* memory)
+    -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkAllocateMemory(device, allocate_info, allocator, memory);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  VkMemoryPropertyFlags flags =
+      ORIGINAL.memory_properties.memoryTypes[allocate_info->memoryTypeIndex]
+          .propertyFlags;
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_DEVICE_MEMORY, *memory);
+  OBJECTS[id].size = allocate_info->allocationSize;
+  add_state(id, TraceRecord(TraceOp::allocate_memory)
+                    .put(id)
+                    .put(allocate_info->allocationSize)
+                    .put(flags));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkFreeMemory(
+    VkDevice device, VkDeviceMemory memory,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_DEVICE_MEMORY, memory);
+  }
+  ORIGINAL.vkFreeMemory(device, memory, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkMapMemory(VkDevice device,
+                                              VkDeviceMemory memory,
+                                              VkDeviceSize offset,
+                                              VkDeviceSize size,
+                                              VkMemoryMapFlags flags,
+                                              void** data) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkMapMemory(device, memory, offset, size, flags, data);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = find_id(VK_OBJECT_TYPE_DEVICE_MEMORY, memory);
+  if (size == VK_WHOLE_SIZE) {
+    size = OBJECTS[id].size - offset;
+  }
+  MAPPED[id] = {static_cast<const std::byte*>(*data), size, {}, false};
+  add_state(id, TraceRecord(TraceOp::map_memory).put(id).put(offset).put(
+                    size));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateBuffer(
+    VkDevice device, const VkBufferCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkBuffer* buffer) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateBuffer(device, create_info, allocator, buffer);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  VkBufferCreateInfo info = *create_info;
+  uint32_t family_count = info.pQueueFamilyIndices != nullptr
+                              ? info.queueFamilyIndexCount
+                              : 0;
+  info.pNext = nullptr;
+  info.pQueueFamilyIndices = nullptr;
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_BUFFER, *buffer);
+  add_state(id, TraceRecord(TraceOp::create_buffer)
+                    .put(id)
+                    .put(info)
+                    .put_array(create_info->pQueueFamilyIndices,
+                               family_count));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyBuffer(
+    VkDevice device, VkBuffer buffer, const VkAllocationCallbacks* allocator)
+    -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_BUFFER, buffer);
+  }
+  ORIGINAL.vkDestroyBuffer(device, buffer, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkBindBufferMemory(VkDevice device,
+                                                     VkBuffer buffer,
+                                                     VkDeviceMemory memory,
+                                                     VkDeviceSize offset)
+    -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkBindBufferMemory(device, buffer, memory, offset);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = find_id(VK_OBJECT_TYPE_BUFFER, buffer);
+  add_state(id, TraceRecord(TraceOp::bind_buffer_memory)
+                    .put(id)
+                    .put(find_id(VK_OBJECT_TYPE_DEVICE_MEMORY, memory))
+                    .put(offset));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateImage(
+    VkDevice device, const VkImageCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkImage* image) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateImage(device, create_info, allocator, image);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_IMAGE, *image);
+  add_state(id, image_create_record(id, *create_info));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyImage(
+    VkDevice device, VkImage image, const VkAllocationCallbacks* allocator)
+    -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_IMAGE, image);
+  }
+  ORIGINAL.vkDestroyImage(device, image, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkBindImageMemory(VkDevice device,
+                                                    VkImage image,
+                                                    VkDeviceMemory memory,
+                                                    VkDeviceSize offset)
+    -> VkResult
+{
+  VkResult result = ORIGINAL.vkBindImageMemory(device, image, memory, offset);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = find_id(VK_OBJECT_TYPE_IMAGE, image);
+  add_state(id, TraceRecord(TraceOp::bind_image_memory)
+                    .put(id)
+                    .put(find_id(VK_OBJECT_TYPE_DEVICE_MEMORY, memory))
+                    .put(offset));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateImageView(
+    VkDevice device, const VkImageViewCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkImageView* view) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateImageView(device, create_info, allocator, view);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  VkImageViewCreateInfo info = *create_info;
+  info.pNext = nullptr;
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  info.image = as_id(VK_OBJECT_TYPE_IMAGE, info.image);
+  uint32_t id = register_object(VK_OBJECT_TYPE_IMAGE_VIEW, *view);
+  add_state(id, TraceRecord(TraceOp::create_image_view).put(id).put(info));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyImageView(
+    VkDevice device, VkImageView view,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_IMAGE_VIEW, view);
+  }
+  ORIGINAL.vkDestroyImageView(device, view, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateSampler(
+    VkDevice device, const VkSamplerCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkSampler* sampler) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateSampler(device, create_info, allocator, sampler);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  VkSamplerCreateInfo info = *create_info;
+  info.pNext = nullptr;
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_SAMPLER, *sampler);
+  add_state(id, TraceRecord(TraceOp::create_sampler).put(id).put(info));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroySampler(
+    VkDevice device, VkSampler sampler,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_SAMPLER, sampler);
+  }
+  ORIGINAL.vkDestroySampler(device, sampler, allocator);
+}
+
+// Pipelines and descriptors.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateShaderModule(
+    VkDevice device, const VkShaderModuleCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkShaderModule* module)
+    -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateShaderModule(device, create_info, allocator, module);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_SHADER_MODULE, *module);
+  add_state(id, TraceRecord(TraceOp::create_shader_module)
+                    .put(id)
+                    .put_array(create_info->pCode,
+                               static_cast<uint32_t>(create_info->codeSize /
+                                                     sizeof(uint32_t))));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyShaderModule(
+    VkDevice device, VkShaderModule module,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_SHADER_MODULE, module);
+  }
+  ORIGINAL.vkDestroyShaderModule(device, module, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateDescriptorSetLayout(
+    VkDevice device, const VkDescriptorSetLayoutCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkDescriptorSetLayout* layout)
+    -> VkResult
+{
+  VkResult result = ORIGINAL.vkCreateDescriptorSetLayout(device, create_info,
+                                                         allocator, layout);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::vector<VkDescriptorSetLayoutBinding> bindings(
+      create_info->pBindings,
+      create_info->pBindings + create_info->bindingCount);
+  for (VkDescriptorSetLayoutBinding& binding : bindings) {
+    binding.pImmutableSamplers = nullptr;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, *layout);
+  TraceRecord record(TraceOp::create_descriptor_set_layout);
+  record.put(id).put(create_info->flags).put_array(
+      bindings.data(), create_info->bindingCount);
+  for (uint32_t i = 0; i < create_info->bindingCount; ++i) {
+    const VkDescriptorSetLayoutBinding& binding = create_info->pBindings[i];
+    put_ids(record, VK_OBJECT_TYPE_SAMPLER, binding.pImmutableSamplers,
+            binding.pImmutableSamplers != nullptr ? binding.descriptorCount
+                                                  : 0);
+  }
+  add_state(id, record);
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyDescriptorSetLayout(
+    VkDevice device, VkDescriptorSetLayout layout,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, layout);
+  }
+  ORIGINAL.vkDestroyDescriptorSetLayout(device, layout, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreatePipelineLayout(
+    VkDevice device, const VkPipelineLayoutCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkPipelineLayout* layout)
+    -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreatePipelineLayout(device, create_info, allocator, layout);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_PIPELINE_LAYOUT, *layout);
+  TraceRecord record(TraceOp::create_pipeline_layout);
+  record.put(id);
+  put_ids(record, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+          create_info->pSetLayouts, create_info->setLayoutCount);
+  record.put_array(create_info->pPushConstantRanges,
+                   create_info->pushConstantRangeCount);
+  add_state(id, record);
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyPipelineLayout(
+    VkDevice device, VkPipelineLayout layout,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_PIPELINE_LAYOUT, layout);
+  }
+  ORIGINAL.vkDestroyPipelineLayout(device, layout, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateComputePipelines(
+    VkDevice device, VkPipelineCache cache, uint32_t create_info_count,
+    const VkComputePipelineCreateInfo* create_infos,
+    const VkAllocationCallbacks* allocator, VkPipeline* pipelines)
+    -> VkResult
+{
+  VkResult result = ORIGINAL.vkCreateComputePipelines(
+      device, cache, create_info_count, create_infos, allocator, pipelines);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  for (uint32_t i = 0; i < create_info_count; ++i) {
+    const VkComputePipelineCreateInfo& info = create_infos[i];
+    const VkSpecializationInfo* specialization =
+        info.stage.pSpecializationInfo;
+    uint32_t id = register_object(VK_OBJECT_TYPE_PIPELINE, pipelines[i]);
+    TraceRecord record(TraceOp::create_compute_pipeline);
+    record.put(id)
+        .put(info.flags)
+        .put(find_id(VK_OBJECT_TYPE_PIPELINE_LAYOUT, info.layout))
+        .put(info.stage.flags)
+        .put(info.stage.stage)
+        .put(find_id(VK_OBJECT_TYPE_SHADER_MODULE, info.stage.module))
+        .put_array(info.stage.pName,
+                   static_cast<uint32_t>(strlen(info.stage.pName) + 1));
+    if (specialization != nullptr) {
+      record.put_array(specialization->pMapEntries,
+                       specialization->mapEntryCount);
+      record.put_array(
+          static_cast<const std::byte*>(specialization->pData),
+          static_cast<uint32_t>(specialization->dataSize));
+    }
+    else {
+      record.put_array<VkSpecializationMapEntry>(nullptr, 0);
+      record.put_array<std::byte>(nullptr, 0);
+    }
+    add_state(id, record);
+  }
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyPipeline(
+    VkDevice device, VkPipeline pipeline,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_PIPELINE, pipeline);
+  }
+  ORIGINAL.vkDestroyPipeline(device, pipeline, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateDescriptorPool(
+    VkDevice device, const VkDescriptorPoolCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkDescriptorPool* pool)
+    -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateDescriptorPool(device, create_info, allocator, pool);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_DESCRIPTOR_POOL, *pool);
+  add_state(id, TraceRecord(TraceOp::create_descriptor_pool)
+                    .put(id)
+                    .put(create_info->flags)
+                    .put(create_info->maxSets)
+                    .put_array(create_info->pPoolSizes,
+                               create_info->poolSizeCount));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyDescriptorPool(
+    VkDevice device, VkDescriptorPool pool,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_DESCRIPTOR_POOL, pool);
+  }
+  ORIGINAL.vkDestroyDescriptorPool(device, pool, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkAllocateDescriptorSets(
+    VkDevice device, const VkDescriptorSetAllocateInfo* allocate_info,
+    VkDescriptorSet* sets) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkAllocateDescriptorSets(device, allocate_info, sets);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t pool =
+      find_id(VK_OBJECT_TYPE_DESCRIPTOR_POOL, allocate_info->descriptorPool);
+  for (uint32_t i = 0; i < allocate_info->descriptorSetCount; ++i) {
+    uint32_t id = register_object(VK_OBJECT_TYPE_DESCRIPTOR_SET, sets[i], pool);
+    add_state(id, TraceRecord(TraceOp::allocate_descriptor_set)
+                      .put(id)
+                      .put(pool)
+                      .put(find_id(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                                   allocate_info->pSetLayouts[i])));
+  }
+  return result;
+}
+
+// Setups keep the last write of every binding, the call goes to the trace
+// as made.
+VKAPI_ATTR auto VKAPI_CALL capture_vkUpdateDescriptorSets(
+    VkDevice device, uint32_t write_count, const VkWriteDescriptorSet* writes,
+    uint32_t copy_count, const VkCopyDescriptorSet* copies) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    std::vector<VkCopyDescriptorSet> stored(copies, copies + copy_count);
+    for (VkCopyDescriptorSet& copy : stored) {
+      copy.pNext = nullptr;
+      copy.srcSet = as_id(VK_OBJECT_TYPE_DESCRIPTOR_SET, copy.srcSet);
+      copy.dstSet = as_id(VK_OBJECT_TYPE_DESCRIPTOR_SET, copy.dstSet);
+    }
+    for (uint32_t i = 0; i < write_count; ++i) {
+      const VkWriteDescriptorSet& write = writes[i];
+      uint32_t set = find_id(VK_OBJECT_TYPE_DESCRIPTOR_SET, write.dstSet);
+      if (set == 0) {
+        continue;
+      }
+      DescriptorKey key = {set, write.dstBinding, write.dstArrayElement};
+      auto previous = DESCRIPTOR_WRITES.find(key);
+      if (previous != DESCRIPTOR_WRITES.end()) {
+        std::vector<uint64_t>& records = OBJECTS[set].records;
+        records.erase(
+            std::find(records.begin(), records.end(), previous->second));
+        STATE.erase(previous->second);
+      }
+      TraceRecord record(TraceOp::update_descriptor_sets);
+      record.put(uint32_t{1});
+      put_descriptor_write(record, write);
+      record.put_array<VkCopyDescriptorSet>(nullptr, 0);
+      DESCRIPTOR_WRITES[key] = keep_state(set, record);
+    }
+    for (const VkCopyDescriptorSet& copy : stored) {
+      keep_state(handle_as_id(copy.dstSet),
+                 TraceRecord(TraceOp::update_descriptor_sets)
+                     .put(uint32_t{0})
+                     .put_array(&copy, 1));
+    }
+
+    if (CAPTURING) {
+      TraceRecord record(TraceOp::update_descriptor_sets);
+      record.put(write_count);
+      for (uint32_t i = 0; i < write_count; ++i) {
+        put_descriptor_write(record, writes[i]);
+      }
+      record.put_array(stored.data(), copy_count);
+      write(record);
+    }
+  }
+  ORIGINAL.vkUpdateDescriptorSets(device, write_count, writes, copy_count,
+                                  copies);
+}
+
+// Command pools and buffers.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateCommandPool(
+    VkDevice device, const VkCommandPoolCreateInfo* create_info,
+    const VkAllocationCallbacks* allocator, VkCommandPool* pool) -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkCreateCommandPool(device, create_info, allocator, pool);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_COMMAND_POOL, *pool);
+  add_state(id, TraceRecord(TraceOp::create_command_pool)
+                    .put(id)
+                    .put(create_info->flags)
+                    .put(create_info->queueFamilyIndex));
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroyCommandPool(
+    VkDevice device, VkCommandPool pool,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    destroyed(VK_OBJECT_TYPE_COMMAND_POOL, pool);
+  }
+  ORIGINAL.vkDestroyCommandPool(device, pool, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkResetCommandPool(
+    VkDevice device, VkCommandPool pool, VkCommandPoolResetFlags flags)
+    -> VkResult
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    write(TraceRecord(TraceOp::reset_command_pool)
+              .put(find_id(VK_OBJECT_TYPE_COMMAND_POOL, pool))
+              .put(flags));
+  }
+  return ORIGINAL.vkResetCommandPool(device, pool, flags);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkAllocateCommandBuffers(
+    VkDevice device, const VkCommandBufferAllocateInfo* allocate_info,
+    VkCommandBuffer* command_buffers) -> VkResult
+{
+  VkResult result = ORIGINAL.vkAllocateCommandBuffers(device, allocate_info,
+                                                      command_buffers);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t pool =
+      find_id(VK_OBJECT_TYPE_COMMAND_POOL, allocate_info->commandPool);
+  for (uint32_t i = 0; i < allocate_info->commandBufferCount; ++i) {
+    uint32_t id = register_object(VK_OBJECT_TYPE_COMMAND_BUFFER,
+                                  command_buffers[i], pool);
+    add_state(id, TraceRecord(TraceOp::allocate_command_buffer)
+                      .put(id)
+                      .put(pool)
+                      .put(allocate_info->level));
+    COMMAND_BUFFERS.emplace(
+        command_buffers[i],
+        CommandBufferState{id, TraceRecord(TraceOp::command_buffer), true});
+  }
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkFreeCommandBuffers(
+    VkDevice device, VkCommandPool pool, uint32_t command_buffer_count,
+    const VkCommandBuffer* command_buffers) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    for (uint32_t i = 0; i < command_buffer_count; ++i) {
+      destroyed(VK_OBJECT_TYPE_COMMAND_BUFFER, command_buffers[i]);
+    }
+  }
+  ORIGINAL.vkFreeCommandBuffers(device, pool, command_buffer_count,
+                                command_buffers);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkBeginCommandBuffer(
+    VkCommandBuffer command_buffer, const VkCommandBufferBeginInfo* begin_info)
+    -> VkResult
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    auto state = COMMAND_BUFFERS.find(command_buffer);
+    if (state != COMMAND_BUFFERS.end()) {
+      state->second.record = TraceRecord(TraceOp::command_buffer);
+      state->second.record.put(state->second.id).put(begin_info->flags);
+      state->second.emitted = false;
+    }
+  }
+  return ORIGINAL.vkBeginCommandBuffer(command_buffer, begin_info);
+}
+
+// Commands.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdPipelineBarrier(
+    VkCommandBuffer command_buffer, VkPipelineStageFlags source_stages,
+    VkPipelineStageFlags destination_stages, VkDependencyFlags dependencies,
+    uint32_t memory_barrier_count, const VkMemoryBarrier* memory_barriers,
+    uint32_t buffer_barrier_count, const VkBufferMemoryBarrier* buffer_barriers,
+    uint32_t image_barrier_count, const VkImageMemoryBarrier* image_barriers)
+    -> void
+{
+  std::vector<VkMemoryBarrier> memory(memory_barriers,
+                                      memory_barriers + memory_barrier_count);
+  std::vector<VkBufferMemoryBarrier> buffers(
+      buffer_barriers, buffer_barriers + buffer_barrier_count);
+  std::vector<VkImageMemoryBarrier> images(
+      image_barriers, image_barriers + image_barrier_count);
+  for (VkMemoryBarrier& barrier : memory) {
+    barrier.pNext = nullptr;
+  }
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    for (VkBufferMemoryBarrier& barrier : buffers) {
+      barrier.pNext = nullptr;
+      barrier.buffer = as_id(VK_OBJECT_TYPE_BUFFER, barrier.buffer);
+    }
+    for (VkImageMemoryBarrier& barrier : images) {
+      barrier.pNext = nullptr;
+      barrier.image = as_id(VK_OBJECT_TYPE_IMAGE, barrier.image);
+    }
+  }
+  record_command(command_buffer,
+                 TraceRecord(TraceOp::cmd_pipeline_barrier)
+                     .put(source_stages)
+                     .put(destination_stages)
+                     .put(dependencies)
+                     .put_array(memory.data(), memory_barrier_count)
+                     .put_array(buffers.data(), buffer_barrier_count)
+                     .put_array(images.data(), image_barrier_count));
+  ORIGINAL.vkCmdPipelineBarrier(command_buffer, source_stages,
+                                destination_stages, dependencies,
+                                memory_barrier_count, memory_barriers,
+                                buffer_barrier_count, buffer_barriers,
+                                image_barrier_count, image_barriers);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdClearColorImage(
+    VkCommandBuffer command_buffer, VkImage image, VkImageLayout layout,
+    const VkClearColorValue* color, uint32_t range_count,
+    const VkImageSubresourceRange* ranges) -> void
+{
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    id = find_id(VK_OBJECT_TYPE_IMAGE, image);
+  }
+  record_command(command_buffer, TraceRecord(TraceOp::cmd_clear_color_image)
+                                     .put(id)
+                                     .put(layout)
+                                     .put(*color)
+                                     .put_array(ranges, range_count));
+  ORIGINAL.vkCmdClearColorImage(command_buffer, image, layout, color,
+                                range_count, ranges);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdBindPipeline(
+    VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point,
+    VkPipeline pipeline) -> void
+{
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    id = find_id(VK_OBJECT_TYPE_PIPELINE, pipeline);
+  }
+  record_command(command_buffer,
+                 TraceRecord(TraceOp::cmd_bind_pipeline).put(bind_point).put(
+                     id));
+  ORIGINAL.vkCmdBindPipeline(command_buffer, bind_point, pipeline);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdBindDescriptorSets(
+    VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point,
+    VkPipelineLayout layout, uint32_t first_set, uint32_t set_count,
+    const VkDescriptorSet* sets, uint32_t dynamic_offset_count,
+    const uint32_t* dynamic_offsets) -> void
+{
+  TraceRecord record(TraceOp::cmd_bind_descriptor_sets);
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    record.put(bind_point)
+        .put(find_id(VK_OBJECT_TYPE_PIPELINE_LAYOUT, layout))
+        .put(first_set);
+    put_ids(record, VK_OBJECT_TYPE_DESCRIPTOR_SET, sets, set_count);
+  }
+  record.put_array(dynamic_offsets, dynamic_offset_count);
+  record_command(command_buffer, record);
+  ORIGINAL.vkCmdBindDescriptorSets(command_buffer, bind_point, layout,
+                                   first_set, set_count, sets,
+                                   dynamic_offset_count, dynamic_offsets);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdPushConstants(
+    VkCommandBuffer command_buffer, VkPipelineLayout layout,
+    VkShaderStageFlags stages, uint32_t offset, uint32_t size,
+    const void* values) -> void
+{
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    id = find_id(VK_OBJECT_TYPE_PIPELINE_LAYOUT, layout);
+  }
+  record_command(command_buffer,
+                 TraceRecord(TraceOp::cmd_push_constants)
+                     .put(id)
+                     .put(stages)
+                     .put(offset)
+                     .put_array(static_cast<const std::byte*>(values), size));
+  ORIGINAL.vkCmdPushConstants(command_buffer, layout, stages, offset, size,
+                              values);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdDispatch(
+    VkCommandBuffer command_buffer, uint32_t x, uint32_t y, uint32_t z)
+    -> void
+{
+  record_command(command_buffer,
+                 TraceRecord(TraceOp::cmd_dispatch).put(x).put(y).put(z));
+  ORIGINAL.vkCmdDispatch(command_buffer, x, y, z);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdCopyBuffer(
+    VkCommandBuffer command_buffer, VkBuffer source, VkBuffer destination,
+    uint32_t region_count, const VkBufferCopy* regions) -> void
+{
+  TraceRecord record(TraceOp::cmd_copy_buffer);
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    record.put(find_id(VK_OBJECT_TYPE_BUFFER, source))
+        .put(find_id(VK_OBJECT_TYPE_BUFFER, destination));
+  }
+  record.put_array(regions, region_count);
+  record_command(command_buffer, record);
+  ORIGINAL.vkCmdCopyBuffer(command_buffer, source, destination, region_count,
+                           regions);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdCopyBufferToImage(
+    VkCommandBuffer command_buffer, VkBuffer source, VkImage destination,
+    VkImageLayout layout, uint32_t region_count,
+    const VkBufferImageCopy* regions) -> void
+{
+  TraceRecord record(TraceOp::cmd_copy_buffer_to_image);
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    record.put(find_id(VK_OBJECT_TYPE_BUFFER, source))
+        .put(find_id(VK_OBJECT_TYPE_IMAGE, destination));
+  }
+  record.put(layout).put_array(regions, region_count);
+  record_command(command_buffer, record);
+  ORIGINAL.vkCmdCopyBufferToImage(command_buffer, source, destination,
+                                  layout, region_count, regions);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdCopyImage(
+    VkCommandBuffer command_buffer, VkImage source,
+    VkImageLayout source_layout, VkImage destination,
+    VkImageLayout destination_layout, uint32_t region_count,
+    const VkImageCopy* regions) -> void
+{
+  TraceRecord record(TraceOp::cmd_copy_image);
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    record.put(find_id(VK_OBJECT_TYPE_IMAGE, source))
+        .put(source_layout)
+        .put(find_id(VK_OBJECT_TYPE_IMAGE, destination))
+        .put(destination_layout);
+  }
+  record.put_array(regions, region_count);
+  record_command(command_buffer, record);
+  ORIGINAL.vkCmdCopyImage(command_buffer, source, source_layout, destination,
+                          destination_layout, region_count, regions);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdBlitImage(
+    VkCommandBuffer command_buffer, VkImage source,
+    VkImageLayout source_layout, VkImage destination,
+    VkImageLayout destination_layout, uint32_t region_count,
+    const VkImageBlit* regions, VkFilter filter) -> void
+{
+  TraceRecord record(TraceOp::cmd_blit_image);
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    record.put(find_id(VK_OBJECT_TYPE_IMAGE, source))
+        .put(source_layout)
+        .put(find_id(VK_OBJECT_TYPE_IMAGE, destination))
+        .put(destination_layout)
+        .put(filter);
+  }
+  record.put_array(regions, region_count);
+  record_command(command_buffer, record);
+  ORIGINAL.vkCmdBlitImage(command_buffer, source, source_layout, destination,
+                          destination_layout, region_count, regions, filter);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdBindVertexBuffers(
+    VkCommandBuffer command_buffer, uint32_t first_binding,
+    uint32_t binding_count, const VkBuffer* buffers,
+    const VkDeviceSize* offsets) -> void
+{
+  TraceRecord record(TraceOp::cmd_bind_vertex_buffers);
+  record.put(first_binding);
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    put_ids(record, VK_OBJECT_TYPE_BUFFER, buffers, binding_count);
+  }
+  record.put_array(offsets, binding_count);
+  record_command(command_buffer, record);
+  ORIGINAL.vkCmdBindVertexBuffers(command_buffer, first_binding,
+                                  binding_count, buffers, offsets);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdBindIndexBuffer(
+    VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset,
+    VkIndexType index_type) -> void
+{
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    id = find_id(VK_OBJECT_TYPE_BUFFER, buffer);
+  }
+  record_command(command_buffer, TraceRecord(TraceOp::cmd_bind_index_buffer)
+                                     .put(id)
+                                     .put(index_type)
+                                     .put(offset));
+  ORIGINAL.vkCmdBindIndexBuffer(command_buffer, buffer, offset, index_type);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdDrawIndexed(
+    VkCommandBuffer command_buffer, uint32_t index_count,
+    uint32_t instance_count, uint32_t first_index, int32_t vertex_offset,
+    uint32_t first_instance) -> void
+{
+  record_command(command_buffer, TraceRecord(TraceOp::cmd_draw_indexed)
+                                     .put(index_count)
+                                     .put(instance_count)
+                                     .put(first_index)
+                                     .put(vertex_offset)
+                                     .put(first_instance));
+  ORIGINAL.vkCmdDrawIndexed(command_buffer, index_count, instance_count,
+                            first_index, vertex_offset, first_instance);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdDrawIndexedIndirect(
+    VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset,
+    uint32_t draw_count, uint32_t stride) -> void
+{
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    id = find_id(VK_OBJECT_TYPE_BUFFER, buffer);
+  }
+  record_command(command_buffer,
+                 TraceRecord(TraceOp::cmd_draw_indexed_indirect)
+                     .put(id)
+                     .put(draw_count)
+                     .put(offset)
+                     .put(stride));
+  ORIGINAL.vkCmdDrawIndexedIndirect(command_buffer, buffer, offset,
+                                    draw_count, stride);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCmdDrawIndexedIndirectCountKHR(
+    VkCommandBuffer command_buffer, VkBuffer buffer, VkDeviceSize offset,
+    VkBuffer count_buffer, VkDeviceSize count_offset, uint32_t max_draw_count,
+    uint32_t stride) -> void
+{
+  TraceRecord record(TraceOp::cmd_draw_indexed_indirect_count);
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    record.put(find_id(VK_OBJECT_TYPE_BUFFER, buffer))
+        .put(find_id(VK_OBJECT_TYPE_BUFFER, count_buffer));
+  }
+  record.put(offset).put(count_offset).put(max_draw_count).put(stride);
+  record_command(command_buffer, record);
+  ORIGINAL.vkCmdDrawIndexedIndirectCountKHR(command_buffer, buffer, offset,
+                                            count_buffer, count_offset,
+                                            max_draw_count, stride);
+}
+
+// Swap chains. Replay has no surface, it renders to images of its own.
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkCreateSwapchainKHR(
+    VkDevice device, const VkSwapchainCreateInfoKHR* create_info,
+    const VkAllocationCallbacks* allocator, VkSwapchainKHR* swap_chain)
+    -> VkResult
+{
+  VkResult result = ORIGINAL.vkCreateSwapchainKHR(device, create_info,
+                                                  allocator, swap_chain);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t id = register_object(VK_OBJECT_TYPE_SWAPCHAIN_KHR, *swap_chain);
+  SWAPCHAINS[id] = *create_info;
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkDestroySwapchainKHR(
+    VkDevice device, VkSwapchainKHR swap_chain,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+    uint32_t id = find_id(VK_OBJECT_TYPE_SWAPCHAIN_KHR, swap_chain);
+    if (id != 0) {
+      for (uint32_t image : OBJECTS[id].children) {
+        write(TraceRecord(TraceOp::destroy)
+                  .put(VK_OBJECT_TYPE_IMAGE)
+                  .put(image));
+      }
+      forget(id);
+    }
+  }
+  ORIGINAL.vkDestroySwapchainKHR(device, swap_chain, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkGetSwapchainImagesKHR(
+    VkDevice device, VkSwapchainKHR swap_chain, uint32_t* image_count,
+    VkImage* images) -> VkResult
+{
+  VkResult result = ORIGINAL.vkGetSwapchainImagesKHR(device, swap_chain,
+                                                     image_count, images);
+  if (images == nullptr ||
+      (result != VK_SUCCESS && result != VK_INCOMPLETE)) {
+    return result;
+  }
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  uint32_t swap_chain_id = find_id(VK_OBJECT_TYPE_SWAPCHAIN_KHR, swap_chain);
+  const VkSwapchainCreateInfoKHR& swap_chain_info = SWAPCHAINS[swap_chain_id];
+  VkImageCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  info.imageType = VK_IMAGE_TYPE_2D;
+  info.format = swap_chain_info.imageFormat;
+  info.extent = {swap_chain_info.imageExtent.width,
+                 swap_chain_info.imageExtent.height, 1};
+  info.mipLevels = 1;
+  info.arrayLayers = swap_chain_info.imageArrayLayers;
+  info.samples = VK_SAMPLE_COUNT_1_BIT;
+  info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  info.usage = swap_chain_info.imageUsage;
+  info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  for (uint32_t i = 0; i < *image_count; ++i) {
+    if (find_id(VK_OBJECT_TYPE_IMAGE, images[i]) != 0) {
+      continue;
+    }
+    uint32_t id =
+        register_object(VK_OBJECT_TYPE_IMAGE, images[i], swap_chain_id);
+    add_state(id, TraceRecord(TraceOp::create_swapchain_image).put(id).put(
+                      info));
+  }
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkAcquireNextImageKHR(
+    VkDevice device, VkSwapchainKHR swap_chain, uint64_t timeout,
+    VkSemaphore semaphore, VkFence fence, uint32_t* image_index) -> VkResult
+{
+  VkResult result = ORIGINAL.vkAcquireNextImageKHR(
+      device, swap_chain, timeout, semaphore, fence, image_index);
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (CAPTURING &&
+      (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)) {
+    write(TraceRecord(TraceOp::acquire_next_image)
+              .put(find_id(VK_OBJECT_TYPE_SEMAPHORE, semaphore))
+              .put(find_id(VK_OBJECT_TYPE_FENCE, fence)));
+    OBSERVED_FENCES.erase(find_id(VK_OBJECT_TYPE_FENCE, fence));
+  }
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL capture_vkQueuePresentKHR(
+    VkQueue queue, const VkPresentInfoKHR* present_info) -> VkResult
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (CAPTURING) {
+    TraceRecord record(TraceOp::queue_present);
+    put_ids(record, VK_OBJECT_TYPE_SEMAPHORE, present_info->pWaitSemaphores,
+            present_info->waitSemaphoreCount);
+    write(record);
+  }
+  return ORIGINAL.vkQueuePresentKHR(queue, present_info);
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::enable_capture() -> void
+{
+  ENABLED = true;
+}
+
+auto gfx::vk_api::capture_enabled() -> bool
+{
+  return ENABLED;
+}
+
+auto gfx::vk_api::install_capture(VulkanDevice& device) -> void
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (ORIGINAL.logical_device != VK_NULL_HANDLE) {
+    GFX_LOG_ERROR("Only one device can be captured at a time!");
+    std::terminate();
+  }
+  ORIGINAL = device;
+
+  // Functions the device did not load stay null.
+#define capture_function(fun)   \
+  if (device.fun != nullptr) {  \
+    device.fun = capture_##fun; \
+  }
+
+  capture_function(vkGetDeviceQueue);
+  capture_function(vkDeviceWaitIdle);
+  capture_function(vkDestroyDevice);
+  capture_function(vkCreateSemaphore);
+  capture_function(vkCreateCommandPool);
+  capture_function(vkAllocateCommandBuffers);
+  capture_function(vkResetCommandPool);
+  capture_function(vkBeginCommandBuffer);
+  capture_function(vkCmdPipelineBarrier);
+  capture_function(vkCmdClearColorImage);
+  capture_function(vkQueueSubmit);
+  capture_function(vkFreeCommandBuffers);
+  capture_function(vkDestroyCommandPool);
+  capture_function(vkDestroySemaphore);
+  capture_function(vkCreateFence);
+  capture_function(vkDestroyFence);
+  capture_function(vkResetFences);
+  capture_function(vkWaitForFences);
+  capture_function(vkGetFenceStatus);
+  capture_function(vkQueueWaitIdle);
+  capture_function(vkAllocateMemory);
+  capture_function(vkMapMemory);
+  capture_function(vkCreateBuffer);
+  capture_function(vkBindBufferMemory);
+  capture_function(vkCreateImage);
+  capture_function(vkBindImageMemory);
+  capture_function(vkCreateImageView);
+  capture_function(vkCreateSampler);
+  capture_function(vkCreateShaderModule);
+  capture_function(vkCreateDescriptorSetLayout);
+  capture_function(vkCreatePipelineLayout);
+  capture_function(vkCreateComputePipelines);
+  capture_function(vkCreateDescriptorPool);
+  capture_function(vkAllocateDescriptorSets);
+  capture_function(vkUpdateDescriptorSets);
+  capture_function(vkCmdBindPipeline);
+  capture_function(vkCmdBindDescriptorSets);
+  capture_function(vkCmdPushConstants);
+  capture_function(vkCmdDispatch);
+  capture_function(vkCmdCopyBuffer);
+  capture_function(vkCmdCopyBufferToImage);
+  capture_function(vkCmdCopyImage);
+  capture_function(vkCmdBlitImage);
+  capture_function(vkCmdBindVertexBuffers);
+  capture_function(vkCmdBindIndexBuffer);
+  capture_function(vkCmdDrawIndexed);
+  capture_function(vkCmdDrawIndexedIndirect);
+  capture_function(vkFreeMemory);
+  capture_function(vkDestroyBuffer);
+  capture_function(vkDestroyImage);
+  capture_function(vkDestroyImageView);
+  capture_function(vkDestroySampler);
+  capture_function(vkDestroyShaderModule);
+  capture_function(vkDestroyPipelineLayout);
+  capture_function(vkDestroyPipeline);
+  capture_function(vkDestroyDescriptorSetLayout);
+  capture_function(vkDestroyDescriptorPool);
+  capture_function(vkGetSemaphoreCounterValueKHR);
+  capture_function(vkWaitSemaphoresKHR);
+  capture_function(vkSignalSemaphoreKHR);
+  capture_function(vkCmdDrawIndexedIndirectCountKHR);
+  capture_function(vkCreateSwapchainKHR);
+  capture_function(vkGetSwapchainImagesKHR);
+  capture_function(vkAcquireNextImageKHR);
+  capture_function(vkQueuePresentKHR);
+  capture_function(vkDestroySwapchainKHR);
+
+#undef capture_function
+}
+
+auto gfx::vk_api::begin_capture(const VulkanDevice& device, const char* path,
+                                uint32_t frame_count) -> bool
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (CAPTURING || frame_count == 0) {
+    return false;
+  }
+  if (ORIGINAL.logical_device == VK_NULL_HANDLE ||
+      ORIGINAL.logical_device != device.logical_device) {
+    GFX_LOG_ERROR("The device was not created for capture!");
+    return false;
+  }
+  OUTPUT.open(path, std::ios::binary | std::ios::trunc);
+  if (!OUTPUT) {
+    GFX_LOG_ERROR("Could not create {}.", path);
+    return false;
+  }
+
+  // Work submitted before the capture would never signal in replay, and
+  // mapped memory must settle before its snapshot.
+  ORIGINAL.vkDeviceWaitIdle(ORIGINAL.logical_device);
+  CAPTURING = true;
+  FRAME_COUNT = frame_count;
+  FRAMES = 0;
+  NEXT_BLOB = 1;
+  TraceHeader header = {TRACE_MAGIC,
+                        TRACE_VERSION,
+                        sizeof(void*),
+                        0,
+                        device.graphics_family,
+                        device.compute_family,
+                        0,
+                        0};
+  OUTPUT.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // Setup, synchronization objects as they are now.
+  for (const auto& [key, state] : STATE) {
+    const CapturedObject& owner = OBJECTS[state.owner];
+    if (state.op == TraceOp::create_semaphore) {
+      uint64_t value = 0;
+      if (owner.timeline) {
+        ORIGINAL.vkGetSemaphoreCounterValueKHR(
+            ORIGINAL.logical_device,
+            reinterpret_cast<VkSemaphore>(owner.handle), &value);
+      }
+      OBSERVED_VALUES[state.owner] = value;
+      write(semaphore_record(state.owner, owner.timeline, value));
+      continue;
+    }
+    if (state.op == TraceOp::create_fence) {
+      bool signaled =
+          ORIGINAL.vkGetFenceStatus(ORIGINAL.logical_device,
+                                    reinterpret_cast<VkFence>(owner.handle)) ==
+          VK_SUCCESS;
+      if (signaled) {
+        OBSERVED_FENCES.insert(state.owner);
+      }
+      write(fence_record(state.owner, signaled));
+      continue;
+    }
+    OUTPUT.write(reinterpret_cast<const char*>(state.bytes.data()),
+                 state.bytes.size());
+  }
+  write_memory_changes();
+  write(TraceRecord(TraceOp::setup_end));
+  for (auto& [command_buffer, state] : COMMAND_BUFFERS) {
+    state.emitted = false;
+  }
+  return true;
+}
+
+auto gfx::vk_api::end_capture_frame() -> void
+{
+  std::lock_guard<std::mutex> lock(CAPTURE_MUTEX);
+  if (!CAPTURING) {
+    return;
+  }
+  write(TraceRecord(TraceOp::frame_end));
+  if (++FRAMES == FRAME_COUNT) {
+    finish_capture();
+  }
+}
+
+auto gfx::vk_api::capturing() -> bool
+{
+  return CAPTURING;
+}
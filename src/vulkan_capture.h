@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// ************************************************************ //
+// Frame capture                                                //
+//                                                              //
+// Records the Vulkan calls a device makes through its function //
+// table into a trace that vulkan-learning-replay re-issues on  //
+// any device. Once enabled, devices are created with wrappers  //
+// in their table that keep what is needed to recreate every    //
+// live object. A capture writes those objects and the contents //
+// of mapped memory first, then the calls of the next frames.   //
+// Handles become ids in creation order, and mapped memory is   //
+// compared at every submit in chunks stored once each.         //
+// Device local contents written before the capture are not in  //
+// the trace, replay starts them uninitialized.                 //
+// ************************************************************ //
+
+// Call before creating the device to capture.
+auto enable_capture() -> void;
+auto capture_enabled() -> bool;
+// Wraps the device functions, called by device creation.
+auto install_capture(VulkanDevice& device) -> void;
+
+// Starts writing the trace, until frame_count frames ended. Returns false if
+// the file cannot be created or a capture is in progress.
+auto begin_capture(const VulkanDevice& device, const char* path,
+                   uint32_t frame_count) -> bool;
+// Marks the end of a frame, the application calls it once per frame.
+auto end_capture_frame() -> void;
+auto capturing() -> bool;
+
+}  // namespace gfx::vk_api
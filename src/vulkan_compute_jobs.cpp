@@ -0,0 +1,648 @@
+#include "vulkan_compute_jobs.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include "host_allocator.h"
+#include "log.h"
+#include "shader_reflection.h"
+#include "vulkan_builders.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_recovery.h"
+#include "vulkan_startup.h"
+#include "vulkan_sync.h"
+
+namespace gfx::vk_api {
+
+namespace {
+
+// Minimums the specification guarantees, without the device limits.
+constexpr uint32_t MIN_MAX_GROUP_COUNT = 65535;
+constexpr VkDeviceSize MAX_MIN_OFFSET_ALIGNMENT = 256;
+
+auto create_command_pool(VulkanDevice& device, uint32_t family,
+                         VkCommandPool& pool) -> VkResult
+{
+  VkCommandPoolCreateInfo create_info =
+      build<VkCommandPoolCreateInfo>()
+          .set(&VkCommandPoolCreateInfo::flags,
+               VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)
+          .set(&VkCommandPoolCreateInfo::queueFamilyIndex, family);
+  return device.vkCreateCommandPool(device.logical_device, &create_info,
+                                    allocation_callbacks(), &pool);
+}
+
+auto allocate_command_buffer(VulkanDevice& device, VkCommandPool pool,
+                             VkCommandBuffer& command_buffer) -> VkResult
+{
+  VkCommandBufferAllocateInfo allocate_info =
+      build<VkCommandBufferAllocateInfo>()
+          .set(&VkCommandBufferAllocateInfo::commandPool, pool)
+          .set(&VkCommandBufferAllocateInfo::level,
+               VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+          .set(&VkCommandBufferAllocateInfo::commandBufferCount, 1);
+  return device.vkAllocateCommandBuffers(device.logical_device,
+                                         &allocate_info, &command_buffer);
+}
+
+auto begin(VulkanDevice& device, VkCommandBuffer command_buffer) -> void
+{
+  VkCommandBufferBeginInfo begin_info =
+      build<VkCommandBufferBeginInfo>().set(
+          &VkCommandBufferBeginInfo::flags,
+          VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  device.vkBeginCommandBuffer(command_buffer, &begin_info);
+}
+
+auto memory_barrier(VulkanDevice& device, VkCommandBuffer command_buffer,
+                    VkPipelineStageFlags source_stage,
+                    VkAccessFlags source_access,
+                    VkPipelineStageFlags destination_stage,
+                    VkAccessFlags destination_access) -> void
+{
+  VkMemoryBarrier barrier =
+      build<VkMemoryBarrier>()
+          .set(&VkMemoryBarrier::srcAccessMask, source_access)
+          .set(&VkMemoryBarrier::dstAccessMask, destination_access);
+  device.vkCmdPipelineBarrier(command_buffer, source_stage, destination_stage,
+                              0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Returns the value of the submission on the timeline, 0 on failure. With a
+// wait timeline, the stage waits for it to reach the wait value.
+auto submit_to(QueueTimeline& timeline, VkCommandBuffer command_buffer,
+               QueueTimeline* wait_timeline = nullptr,
+               uint64_t wait_value = 0, VkPipelineStageFlags wait_stage = 0)
+    -> uint64_t
+{
+  VkSemaphore semaphore =
+      wait_timeline != nullptr ? wait_timeline->semaphore() : VK_NULL_HANDLE;
+  using TimelineInfo = VkTimelineSemaphoreSubmitInfoKHR;
+  auto timeline_info =
+      build<TimelineInfo>()
+          .set(&TimelineInfo::waitSemaphoreValueCount, 1)
+          .set(&TimelineInfo::pWaitSemaphoreValues, &wait_value)
+          .get();
+  auto submit_info =
+      build<VkSubmitInfo>()
+          .set(&VkSubmitInfo::commandBufferCount, 1)
+          .set(&VkSubmitInfo::pCommandBuffers, &command_buffer);
+  if (wait_timeline != nullptr) {
+    submit_info.set(&VkSubmitInfo::waitSemaphoreCount, 1)
+        .set(&VkSubmitInfo::pWaitSemaphores, &semaphore)
+        .set(&VkSubmitInfo::pWaitDstStageMask, &wait_stage)
+        .next(timeline_info);
+  }
+  return timeline.submit(&submit_info.get(), 1);
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::create_compute_kernel(VulkanDevice& device,
+                                        ShaderCache& shader_cache,
+                                        const Shader& shader,
+                                        ComputeKernel& kernel) -> VkResult
+{
+  kernel = {};
+  const ShaderReflection& reflection = *shader.reflection;
+  if (reflection.stage != VK_SHADER_STAGE_COMPUTE_BIT) {
+    GFX_LOG_ERROR("Compute kernels must be valid compute shaders!");
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  // The bindings are sorted by set, then binding.
+  for (size_t i = 0; i < reflection.bindings.size(); ++i) {
+    const ShaderBinding& binding = reflection.bindings[i];
+    if (binding.set != 0 || binding.binding != i ||
+        binding.type != VK_DESCRIPTOR_TYPE_STORAGE_BUFFER ||
+        binding.count != 1) {
+      GFX_LOG_ERROR("Compute kernels bind storage buffers to the first "
+                    "bindings of set 0 only!");
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+  }
+  // Local sizes given by specialization constants are not reflected.
+  bool local_size_known =
+      std::none_of(std::begin(reflection.local_size),
+                   std::end(reflection.local_size),
+                   [](uint32_t size) { return size == 0; });
+  if (reflection.bindings.empty() || !local_size_known ||
+      reflection.push_constant_size < sizeof(ComputeRange)) {
+    GFX_LOG_ERROR("Compute kernels need storage buffers, a constant local "
+                  "size and push constants starting with their range!");
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  std::copy(std::begin(reflection.local_size),
+            std::end(reflection.local_size), kernel.local_size);
+  kernel.binding_count = static_cast<uint32_t>(reflection.bindings.size());
+  kernel.constant_size = reflection.push_constant_size - sizeof(ComputeRange);
+
+  // The storage buffers and the push constants of the compute stage, as
+  // the layout above.
+  const PipelineLayout* layout = nullptr;
+  VkResult result = shader_cache.pipeline_layout({&shader}, layout);
+  if (result != VK_SUCCESS) {
+    kernel = {};
+    return result;
+  }
+  kernel.set_layout = layout->set_layouts[0];
+  kernel.pipeline_layout = layout->layout;
+  result = create_compute_pipeline(device, shader.module,
+                                   kernel.pipeline_layout, kernel.pipeline);
+  if (result != VK_SUCCESS) {
+    kernel = {};
+    return result;
+  }
+  // The cache is restored first, it was registered before the kernel.
+  ComputeKernel* target = &kernel;
+  ShaderCache* cache = &shader_cache;
+  const Shader* source = &shader;
+  kernel.resource_id = device.resources->add(
+      [target](VulkanDevice& device) {
+        device.deletion_queue->destroy(target->pipeline);
+        target->pipeline = VK_NULL_HANDLE;
+      },
+      [target, cache, source](VulkanDevice& device) {
+        const PipelineLayout* layout = nullptr;
+        VkResult result = cache->pipeline_layout({source}, layout);
+        if (result != VK_SUCCESS) {
+          return result;
+        }
+        target->set_layout = layout->set_layouts[0];
+        target->pipeline_layout = layout->layout;
+        return create_compute_pipeline(device, source->module,
+                                       target->pipeline_layout,
+                                       target->pipeline);
+      });
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::destroy_compute_kernel(VulkanDevice& device,
+                                         ComputeKernel& kernel) -> void
+{
+  device.resources->remove(kernel.resource_id);
+  device.deletion_queue->destroy(kernel.pipeline);
+  kernel = {};
+}
+
+gfx::vk_api::ComputeJobQueue::ComputeJobQueue(VulkanDevice& device,
+                                              uint32_t jobs_in_flight)
+    : device_(device),
+      split_(device.compute_queue != device.graphics_queue &&
+             device.timeline_semaphore_supported),
+      max_group_count_{MIN_MAX_GROUP_COUNT, MIN_MAX_GROUP_COUNT,
+                       MIN_MAX_GROUP_COUNT},
+      offset_alignment_(MAX_MIN_OFFSET_ALIGNMENT),
+      slots_(std::max(jobs_in_flight, 1u)),
+      submitted_(0),
+      finished_(0),
+      held_readback_(0),
+      resource_id_(0),
+      job_counter_(register_counter("vk.compute.jobs")),
+      dispatch_counter_(register_counter("vk.compute.dispatches")),
+      byte_counter_(register_counter("vk.compute.bytes", MetricUnit::bytes))
+{
+  PhysicalDeviceInfo info;
+  if (physical_device_info(device_.physical_device, info)) {
+    const VkPhysicalDeviceLimits& limits = info.properties.limits;
+    std::copy(std::begin(limits.maxComputeWorkGroupCount),
+              std::end(limits.maxComputeWorkGroupCount), max_group_count_);
+    offset_alignment_ =
+        std::max<VkDeviceSize>(limits.minStorageBufferOffsetAlignment, 1);
+  }
+
+  for (Slot& slot : slots_) {
+    slot = {};
+  }
+}
+
+auto gfx::vk_api::ComputeJobQueue::create(
+    VulkanDevice& device, uint32_t jobs_in_flight,
+    std::unique_ptr<ComputeJobQueue>& queue) -> VkResult
+{
+  std::unique_ptr<ComputeJobQueue> created(
+      new ComputeJobQueue(device, jobs_in_flight));
+  VkResult result = created->create_();
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create the compute job queue: {}!",
+                  result_name(result));
+    return result;
+  }
+  ComputeJobQueue* self = created.get();
+  self->resource_id_ = device.resources->add(
+      [self](VulkanDevice&) { self->release_(); },
+      [self](VulkanDevice&) { return self->create_(); });
+  queue = std::move(created);
+  return VK_SUCCESS;
+}
+
+gfx::vk_api::ComputeJobQueue::~ComputeJobQueue()
+{
+  if (resource_id_ != 0) {
+    device_.resources->remove(resource_id_);
+  }
+  wait_idle();
+  release_();
+}
+
+auto gfx::vk_api::ComputeJobQueue::submit(const ComputeJob& job) -> uint64_t
+{
+  const ComputeKernel& kernel = *job.kernel;
+  if (job.buffers.size() != kernel.binding_count) {
+    GFX_LOG_ERROR("A compute job has {} buffers, its kernel {} bindings!",
+                  job.buffers.size(), kernel.binding_count);
+    return 0;
+  }
+  // Unset push constants are undefined, not zero.
+  if (kernel.constant_size > 0 && job.constants == nullptr) {
+    GFX_LOG_ERROR("A compute job lacks the {} bytes of its kernel constants!",
+                  kernel.constant_size);
+    return 0;
+  }
+  uint64_t ticket = submitted_ + 1;
+  Slot& slot = slot_(ticket);
+  // The outputs of the job the slot held are written, failed or not.
+  if (slot.ticket > finished_) {
+    wait(slot.ticket);
+  }
+
+  // Every binding at its own offset of the staging and storage buffers.
+  VkDeviceSize size = 0;
+  slot.offsets.clear();
+  for (const ComputeBuffer& buffer : job.buffers) {
+    if (buffer.size == 0) {
+      GFX_LOG_ERROR("Compute job buffers cannot be empty!");
+      return 0;
+    }
+    size = (size + offset_alignment_ - 1) / offset_alignment_ *
+           offset_alignment_;
+    slot.offsets.push_back(size);
+    size += buffer.size;
+  }
+  if (reserve_(slot, size) != VK_SUCCESS) {
+    return 0;
+  }
+  VkDescriptorSet set = descriptor_set_(slot, kernel);
+  if (set == VK_NULL_HANDLE) {
+    return 0;
+  }
+  slot.buffers = job.buffers;
+
+  std::vector<VkDescriptorBufferInfo> buffer_infos;
+  VkDeviceSize uploaded = 0;
+  for (size_t i = 0; i < job.buffers.size(); ++i) {
+    const ComputeBuffer& buffer = job.buffers[i];
+    buffer_infos.push_back(
+        {slot.storage.buffer, slot.offsets[i], buffer.size});
+    if (buffer.input != nullptr) {
+      memcpy(static_cast<std::byte*>(slot.staging.mapped) + slot.offsets[i],
+             buffer.input, buffer.size);
+      uploaded += buffer.size;
+    }
+  }
+  // Consecutive bindings of the same type are written at once.
+  VkWriteDescriptorSet write =
+      build<VkWriteDescriptorSet>()
+          .set(&VkWriteDescriptorSet::dstSet, set)
+          .set(&VkWriteDescriptorSet::dstBinding, 0)
+          .set(&VkWriteDescriptorSet::descriptorCount, kernel.binding_count)
+          .set(&VkWriteDescriptorSet::descriptorType,
+               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+          .set(&VkWriteDescriptorSet::pBufferInfo, buffer_infos.data());
+  device_.vkUpdateDescriptorSets(device_.logical_device, 1, &write, 0,
+                                 nullptr);
+
+  slot.ticket = ticket;
+  slot.dispatch_value = 0;
+  slot.retire_value = 0;
+  slot.failed = false;
+  submitted_ = ticket;
+  job_counter_.add();
+  byte_counter_.add(uploaded);
+
+  if (!split_) {
+    VkCommandBuffer command_buffer = slot.dispatch;
+    device_.vkResetCommandPool(device_.logical_device, slot.compute_pool, 0);
+    begin(device_, command_buffer);
+    record_copies_(command_buffer, slot, true);
+    memory_barrier(device_, command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    record_dispatch_(command_buffer, job, set);
+    memory_barrier(device_, command_buffer,
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                   VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_READ_BIT);
+    record_copies_(command_buffer, slot, false);
+    memory_barrier(device_, command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                   VK_ACCESS_HOST_READ_BIT);
+    device_.vkEndCommandBuffer(command_buffer);
+    slot.retire_value = submit_to(*device_.compute_timeline, command_buffer);
+    slot.failed = slot.retire_value == 0;
+    return slot.failed ? 0 : ticket;
+  }
+
+  // The semaphores order the queues and make the writes visible, only the
+  // host read needs a barrier.
+  device_.vkResetCommandPool(device_.logical_device, slot.copy_pool, 0);
+  device_.vkResetCommandPool(device_.logical_device, slot.compute_pool, 0);
+  begin(device_, slot.upload);
+  record_copies_(slot.upload, slot, true);
+  device_.vkEndCommandBuffer(slot.upload);
+  begin(device_, slot.dispatch);
+  record_dispatch_(slot.dispatch, job, set);
+  device_.vkEndCommandBuffer(slot.dispatch);
+  begin(device_, slot.readback);
+  record_copies_(slot.readback, slot, false);
+  memory_barrier(device_, slot.readback, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                 VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                 VK_ACCESS_HOST_READ_BIT);
+  device_.vkEndCommandBuffer(slot.readback);
+
+  uint64_t upload_value = submit_to(*device_.graphics_timeline, slot.upload);
+  if (upload_value != 0) {
+    slot.dispatch_value =
+        submit_to(*device_.compute_timeline, slot.dispatch,
+                  device_.graphics_timeline.get(), upload_value,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  }
+  // Behind the upload of this job on the graphics queue, the readback of the
+  // previous one does not hold it up while the previous kernel runs.
+  submit_readback_();
+  if (slot.dispatch_value == 0) {
+    slot.failed = true;
+    return 0;
+  }
+  held_readback_ = ticket;
+  return ticket;
+}
+
+auto gfx::vk_api::ComputeJobQueue::wait(uint64_t ticket) -> bool
+{
+  if (held_readback_ != 0 && held_readback_ <= ticket) {
+    submit_readback_();
+  }
+  bool succeeded = ticket <= submitted_;
+  while (finished_ < std::min(ticket, submitted_)) {
+    succeeded = finish_(slot_(finished_ + 1)) && succeeded;
+  }
+  return succeeded;
+}
+
+auto gfx::vk_api::ComputeJobQueue::wait_idle() -> bool
+{
+  return wait(submitted_);
+}
+
+auto gfx::vk_api::ComputeJobQueue::overlaps_queues() const -> bool
+{
+  return split_;
+}
+
+auto gfx::vk_api::ComputeJobQueue::create_() -> VkResult
+{
+  // The destructor releases what was created before a failure.
+  for (Slot& slot : slots_) {
+    VkResult result =
+        create_command_pool(device_, device_.compute_family, slot.compute_pool);
+    if (result == VK_SUCCESS) {
+      result = allocate_command_buffer(device_, slot.compute_pool,
+                                       slot.dispatch);
+    }
+    if (result == VK_SUCCESS && split_) {
+      result =
+          create_command_pool(device_, device_.graphics_family, slot.copy_pool);
+    }
+    if (result == VK_SUCCESS && split_) {
+      result = allocate_command_buffer(device_, slot.copy_pool, slot.upload);
+    }
+    if (result == VK_SUCCESS && split_) {
+      result = allocate_command_buffer(device_, slot.copy_pool, slot.readback);
+    }
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+  }
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::ComputeJobQueue::release_() -> void
+{
+  // Waiting for them would fail on the lost device, their outputs are never
+  // written.
+  held_readback_ = 0;
+  for (uint64_t ticket = finished_ + 1; ticket <= submitted_; ++ticket) {
+    slot_(ticket).failed = true;
+  }
+  DeletionQueue& deletion_queue = *device_.deletion_queue;
+  for (Slot& slot : slots_) {
+    // The command buffers go away with their pools, the sets with theirs.
+    deletion_queue.destroy(slot.copy_pool);
+    deletion_queue.destroy(slot.compute_pool);
+    for (const auto& [binding_count, set] : slot.sets) {
+      deletion_queue.destroy(set.first);
+    }
+    destroy_buffer(device_, slot.staging);
+    destroy_buffer(device_, slot.storage);
+    slot.copy_pool = VK_NULL_HANDLE;
+    slot.compute_pool = VK_NULL_HANDLE;
+    slot.upload = VK_NULL_HANDLE;
+    slot.dispatch = VK_NULL_HANDLE;
+    slot.readback = VK_NULL_HANDLE;
+    slot.sets.clear();
+  }
+}
+
+auto gfx::vk_api::ComputeJobQueue::slot_(uint64_t ticket) -> Slot&
+{
+  return slots_[(ticket - 1) % slots_.size()];
+}
+
+auto gfx::vk_api::ComputeJobQueue::reserve_(Slot& slot, VkDeviceSize size)
+    -> VkResult
+{
+  if (slot.storage.size >= size) {
+    return VK_SUCCESS;
+  }
+  // The slot is idle, its previous job was finished.
+  destroy_buffer(device_, slot.staging);
+  destroy_buffer(device_, slot.storage);
+  // Cached memory makes the readback copies fast, when the device has some.
+  VkResult result = create_buffer(
+      device_, size,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_CACHED_BIT, false, slot.staging);
+  if (result == VK_SUCCESS) {
+    result = create_buffer(device_, size,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, split_,
+                           slot.storage);
+  }
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create the compute job buffers: {}!",
+                  result_name(result));
+    destroy_buffer(device_, slot.staging);
+    destroy_buffer(device_, slot.storage);
+  }
+  return result;
+}
+
+auto gfx::vk_api::ComputeJobQueue::descriptor_set_(Slot& slot,
+                                                   const ComputeKernel& kernel)
+    -> VkDescriptorSet
+{
+  auto found = slot.sets.find(kernel.binding_count);
+  if (found != slot.sets.end()) {
+    return found->second.second;
+  }
+
+  VkDescriptorPoolSize pool_size = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                    kernel.binding_count};
+  using PoolInfo = VkDescriptorPoolCreateInfo;
+  VkDescriptorPoolCreateInfo pool_create_info =
+      build<PoolInfo>()
+          .set(&PoolInfo::maxSets, 1)
+          .set(&PoolInfo::poolSizeCount, 1)
+          .set(&PoolInfo::pPoolSizes, &pool_size);
+  VkDescriptorPool pool;
+  if (device_.vkCreateDescriptorPool(device_.logical_device,
+                                     &pool_create_info, allocation_callbacks(),
+                                     &pool) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create a compute job descriptor pool!");
+    return VK_NULL_HANDLE;
+  }
+  using AllocateInfo = VkDescriptorSetAllocateInfo;
+  VkDescriptorSetAllocateInfo set_allocate_info =
+      build<AllocateInfo>()
+          .set(&AllocateInfo::descriptorPool, pool)
+          .set(&AllocateInfo::descriptorSetCount, 1)
+          .set(&AllocateInfo::pSetLayouts, &kernel.set_layout);
+  VkDescriptorSet set;
+  if (device_.vkAllocateDescriptorSets(device_.logical_device,
+                                       &set_allocate_info,
+                                       &set) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not allocate a compute job descriptor set!");
+    device_.vkDestroyDescriptorPool(device_.logical_device, pool,
+                                    allocation_callbacks());
+    return VK_NULL_HANDLE;
+  }
+  slot.sets.emplace(kernel.binding_count, std::pair(pool, set));
+  return set;
+}
+
+auto gfx::vk_api::ComputeJobQueue::record_copies_(
+    VkCommandBuffer command_buffer, const Slot& slot, bool inputs) -> void
+{
+  std::vector<VkBufferCopy> regions;
+  for (size_t i = 0; i < slot.buffers.size(); ++i) {
+    const ComputeBuffer& buffer = slot.buffers[i];
+    if (inputs ? buffer.input != nullptr : buffer.output != nullptr) {
+      regions.push_back({slot.offsets[i], slot.offsets[i], buffer.size});
+    }
+  }
+  if (regions.empty()) {
+    return;
+  }
+  device_.vkCmdCopyBuffer(
+      command_buffer, inputs ? slot.staging.buffer : slot.storage.buffer,
+      inputs ? slot.storage.buffer : slot.staging.buffer,
+      static_cast<uint32_t>(regions.size()), regions.data());
+}
+
+auto gfx::vk_api::ComputeJobQueue::record_dispatch_(
+    VkCommandBuffer command_buffer, const ComputeJob& job,
+    VkDescriptorSet set) -> void
+{
+  const ComputeKernel& kernel = *job.kernel;
+  device_.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            kernel.pipeline);
+  device_.vkCmdBindDescriptorSets(command_buffer,
+                                  VK_PIPELINE_BIND_POINT_COMPUTE,
+                                  kernel.pipeline_layout, 0, 1, &set, 0,
+                                  nullptr);
+  // Kept by every dispatch, only the range changes.
+  if (kernel.constant_size > 0) {
+    device_.vkCmdPushConstants(command_buffer, kernel.pipeline_layout,
+                               VK_SHADER_STAGE_COMPUTE_BIT,
+                               sizeof(ComputeRange), kernel.constant_size,
+                               job.constants);
+  }
+
+  uint64_t groups[3];
+  for (int d = 0; d < 3; ++d) {
+    groups[d] = (uint64_t{job.size[d]} + kernel.local_size[d] - 1) /
+                kernel.local_size[d];
+  }
+  ComputeRange range = {{0, 0, 0, 0},
+                        {job.size[0], job.size[1], job.size[2], 0}};
+  uint64_t dispatches = 0;
+  for (uint64_t z = 0; z < groups[2]; z += max_group_count_[2]) {
+    for (uint64_t y = 0; y < groups[1]; y += max_group_count_[1]) {
+      for (uint64_t x = 0; x < groups[0]; x += max_group_count_[0]) {
+        // Below the size, the groups before it cover less than the range.
+        range.origin[0] = static_cast<uint32_t>(x * kernel.local_size[0]);
+        range.origin[1] = static_cast<uint32_t>(y * kernel.local_size[1]);
+        range.origin[2] = static_cast<uint32_t>(z * kernel.local_size[2]);
+        device_.vkCmdPushConstants(command_buffer, kernel.pipeline_layout,
+                                   VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                   sizeof(range), &range);
+        device_.vkCmdDispatch(
+            command_buffer,
+            static_cast<uint32_t>(std::min<uint64_t>(max_group_count_[0],
+                                                     groups[0] - x)),
+            static_cast<uint32_t>(std::min<uint64_t>(max_group_count_[1],
+                                                     groups[1] - y)),
+            static_cast<uint32_t>(std::min<uint64_t>(max_group_count_[2],
+                                                     groups[2] - z)));
+        ++dispatches;
+      }
+    }
+  }
+  dispatch_counter_.add(dispatches);
+}
+
+auto gfx::vk_api::ComputeJobQueue::submit_readback_() -> bool
+{
+  if (held_readback_ == 0) {
+    return true;
+  }
+  Slot& slot = slot_(held_readback_);
+  held_readback_ = 0;
+  slot.retire_value = submit_to(
+      *device_.graphics_timeline, slot.readback,
+      device_.compute_timeline.get(), slot.dispatch_value,
+      VK_PIPELINE_STAGE_TRANSFER_BIT);
+  slot.failed = slot.retire_value == 0;
+  return !slot.failed;
+}
+
+auto gfx::vk_api::ComputeJobQueue::finish_(Slot& slot) -> bool
+{
+  finished_ = slot.ticket;
+  QueueTimeline& timeline =
+      split_ ? *device_.graphics_timeline : *device_.compute_timeline;
+  bool succeeded = !slot.failed && timeline.wait_until(slot.retire_value);
+  if (succeeded) {
+    VkDeviceSize read_back = 0;
+    for (size_t i = 0; i < slot.buffers.size(); ++i) {
+      const ComputeBuffer& buffer = slot.buffers[i];
+      if (buffer.output != nullptr) {
+        memcpy(buffer.output,
+               static_cast<const std::byte*>(slot.staging.mapped) +
+                   slot.offsets[i],
+               buffer.size);
+        read_back += buffer.size;
+      }
+    }
+    byte_counter_.add(read_back);
+  }
+  slot.buffers.clear();
+  return succeeded;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+#include "shader_cache.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// Leading push constants of every kernel. A job is split into dispatches of
+// at most maxComputeWorkGroupCount groups, each kernel invocation handles
+// the element origin + gl_GlobalInvocationID and returns when it is not
+// below size:
+//   layout(push_constant) uniform Range { uvec4 origin; uvec4 size; };
+// The job's own constants follow, from offset 32.
+struct ComputeRange {
+  uint32_t origin[4];
+  uint32_t size[4];
+};
+
+// A compute shader whose set 0 holds storage buffers only, at bindings 0 to
+// binding_count - 1, and whose push constants start with a ComputeRange.
+// The layouts belong to the shader cache.
+struct ComputeKernel {
+  VkDescriptorSetLayout set_layout;
+  VkPipelineLayout pipeline_layout;
+  VkPipeline pipeline;
+  uint32_t local_size[3];
+  uint32_t binding_count;
+  // Bytes of the push constants after the range.
+  uint32_t constant_size;
+  // Registration with the device resources.
+  uint64_t resource_id;
+};
+
+// Returns VK_ERROR_INITIALIZATION_FAILED when the shader does not have the
+// interface above. The pipeline layout is the shader cache's, which must
+// outlive the kernel. The kernel must stay at its address until destroyed,
+// its pipeline is created again from the shader once the device is
+// recovered.
+auto create_compute_kernel(VulkanDevice& device, ShaderCache& shader_cache,
+                           const Shader& shader, ComputeKernel& kernel)
+    -> VkResult;
+// Hands the pipeline to the deletion queue.
+auto destroy_compute_kernel(VulkanDevice& device, ComputeKernel& kernel)
+    -> void;
+
+// Storage buffer of a binding. The input, when set, is uploaded before the
+// kernel runs, the output, when set, receives the buffer once it ran.
+// Buffers with neither are scratch memory of the kernel.
+struct ComputeBuffer {
+  const void* input;
+  void* output;
+  VkDeviceSize size;
+};
+
+struct ComputeJob {
+  const ComputeKernel* kernel;
+  // One per binding of the kernel.
+  std::vector<ComputeBuffer> buffers;
+  // Invocations along each dimension of the range, 1 for the unused ones.
+  uint32_t size[3];
+  // The kernel's constant_size bytes, required when it has constants.
+  const void* constants;
+};
+
+// ************************************************************ //
+// ComputeJobQueue                                              //
+//                                                              //
+// Headless batch processing: every job uploads its inputs,     //
+// runs a kernel over its range and reads its outputs back.     //
+// Jobs take turns in a few slots, each with its own staging    //
+// and storage buffers, so the CPU fills the staging memory of  //
+// the next job and copies out the results of the previous one  //
+// while the GPU runs the current one. When find_queue_families //
+// found an async compute family and the device has timeline    //
+// semaphores, the copies run on the graphics queue and the     //
+// dispatches on the compute queue, waiting on each other's     //
+// timeline, and the readback of a job is submitted after the   //
+// upload of the next, so the copies of one job overlap the     //
+// dispatches of its neighbours on the GPU too. Otherwise a job //
+// is a single command buffer on the compute queue. Jobs,       //
+// dispatches and bytes moved are counted as vk.compute.*. The  //
+// jobs in flight when the device is lost fail, the slots are   //
+// created again once it is recovered. Not thread safe, one     //
+// thread submits and waits.                                    //
+// ************************************************************ //
+class ComputeJobQueue {
+ public:
+  // Returns the result of creating the command pools and buffers, queue is
+  // only set on success.
+  static auto create(VulkanDevice& device, uint32_t jobs_in_flight,
+                     std::unique_ptr<ComputeJobQueue>& queue) -> VkResult;
+  // Waits for the jobs in flight and writes their outputs.
+  ~ComputeJobQueue();
+
+  ComputeJobQueue(const ComputeJobQueue&) = delete;
+  ComputeJobQueue& operator=(const ComputeJobQueue&) = delete;
+
+  // Starts the job and returns its ticket, 0 on failure, as for a job
+  // without the constants its kernel takes. When every slot is busy, waits
+  // for the oldest job and writes its outputs first. The inputs are copied
+  // before returning, the outputs must stay valid until the job is waited
+  // for.
+  auto submit(const ComputeJob& job) -> uint64_t;
+  // Blocks until the job and those before it retired and their outputs are
+  // written. Returns false if one of them failed.
+  auto wait(uint64_t ticket) -> bool;
+  auto wait_idle() -> bool;
+
+  // The copies and the dispatches run on different queues.
+  auto overlaps_queues() const -> bool;
+
+ private:
+  ComputeJobQueue(VulkanDevice& device, uint32_t jobs_in_flight);
+
+  struct Slot {
+    VkCommandPool copy_pool;
+    VkCommandPool compute_pool;
+    VkCommandBuffer upload;
+    VkCommandBuffer dispatch;
+    VkCommandBuffer readback;
+    // Host visible, the inputs are uploaded from it and the outputs read
+    // back into it, at the offsets of their bindings.
+    Buffer staging;
+    Buffer storage;
+    // Set of each binding count, the set layouts of kernels with as many
+    // bindings are identical, so any of them can use it.
+    std::unordered_map<uint32_t, std::pair<VkDescriptorPool, VkDescriptorSet>>
+        sets;
+    std::vector<ComputeBuffer> buffers;
+    std::vector<VkDeviceSize> offsets;
+    uint64_t ticket;
+    // Reached on the compute timeline once the kernel ran, when split.
+    uint64_t dispatch_value;
+    // Reached once the outputs are in staging, on the graphics timeline
+    // when split, the compute timeline otherwise.
+    uint64_t retire_value;
+    bool failed;
+  };
+
+  auto create_() -> VkResult;
+  // Fails the jobs in flight and destroys the slots' objects.
+  auto release_() -> void;
+  auto slot_(uint64_t ticket) -> Slot&;
+  // Grows the slot's buffers, which are left empty on failure.
+  auto reserve_(Slot& slot, VkDeviceSize size) -> VkResult;
+  auto descriptor_set_(Slot& slot, const ComputeKernel& kernel)
+      -> VkDescriptorSet;
+  // Copies between staging and storage, input or output bindings only.
+  auto record_copies_(VkCommandBuffer command_buffer, const Slot& slot,
+                      bool inputs) -> void;
+  auto record_dispatch_(VkCommandBuffer command_buffer, const ComputeJob& job,
+                        VkDescriptorSet set) -> void;
+  // Submits the readback of the job whose readback was held back.
+  auto submit_readback_() -> bool;
+  // Waits for the job of the slot and copies its outputs.
+  auto finish_(Slot& slot) -> bool;
+
+  VulkanDevice& device_;
+  // The copies run on the graphics queue, the dispatches on the compute one.
+  bool split_;
+  uint32_t max_group_count_[3];
+  VkDeviceSize offset_alignment_;
+  std::vector<Slot> slots_;
+  uint64_t submitted_;
+  // Last job whose outputs were written.
+  uint64_t finished_;
+  // Job whose readback is recorded but not submitted yet, 0 for none.
+  uint64_t held_readback_;
+  uint64_t resource_id_;
+
+  Counter job_counter_;
+  Counter dispatch_counter_;
+  Counter byte_counter_;
+};
+
+}  // namespace gfx::vk_api
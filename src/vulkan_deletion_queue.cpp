@@ -0,0 +1,263 @@
+#include "vulkan_deletion_queue.h"
+#include <algorithm>
+#include "host_allocator.h"
+#include "log.h"
+#include "vulkan_sync.h"
+
+gfx::vk_api::DeletionQueue::DeletionQueue(VulkanDevice& device,
+                                          uint32_t frames_in_flight,
+                                          size_t capacity_per_frame)
+    : device_(device.logical_device),
+      functions_(device),
+      timelines_{device.graphics_timeline, device.compute_timeline},
+      timeline_count_(device.compute_timeline != device.graphics_timeline ? 2
+                                                                          : 1),
+      slots_(frames_in_flight + 1),
+      capacity_(std::max<size_t>(capacity_per_frame, 1)),
+      current_(0),
+      frame_(0),
+      stats_(),
+      latency_frames_sum_(0),
+      latency_ms_sum_(0.0)
+{
+  // Only the function table is needed, drop the shared subsystems so they do
+  // not keep each other alive.
+  functions_.graphics_timeline.reset();
+  functions_.compute_timeline.reset();
+  functions_.deletion_queue.reset();
+
+  for (FrameSlot& slot : slots_) {
+    slot.entries.reserve(capacity_);
+    slot.frame = 0;
+    slot.retire_values[0] = 0;
+    slot.retire_values[1] = 0;
+    slot.closed = false;
+  }
+  stats_.min_latency_frames = UINT64_MAX;
+}
+
+gfx::vk_api::DeletionQueue::~DeletionQueue() { flush(); }
+
+auto gfx::vk_api::DeletionQueue::next_frame() -> void { advance_(false); }
+
+auto gfx::vk_api::DeletionQueue::collect() -> size_t
+{
+  uint64_t completed[2];
+  for (size_t i = 0; i < timeline_count_; ++i) {
+    completed[i] = timelines_[i]->completed_value();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t destroyed = 0;
+  // Walk from the oldest slot to the newest.
+  for (size_t i = 1; i < slots_.size(); ++i) {
+    FrameSlot& slot = slots_[(current_ + i) % slots_.size()];
+    bool retired = slot.closed;
+    for (size_t j = 0; j < timeline_count_ && retired; ++j) {
+      retired = slot.retire_values[j] <= completed[j];
+    }
+    if (retired) {
+      destroyed += free_slot_(slot);
+    }
+  }
+  return destroyed;
+}
+
+auto gfx::vk_api::DeletionQueue::flush() -> void
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    close_slot_(slots_[current_]);
+  }
+  for (size_t i = 0; i < timeline_count_; ++i) {
+    timelines_[i]->wait_idle();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 1; i <= slots_.size(); ++i) {
+    FrameSlot& slot = slots_[(current_ + i) % slots_.size()];
+    if (slot.closed) {
+      free_slot_(slot);
+    }
+  }
+  slots_[current_].frame = frame_;
+  slots_[current_].closed = false;
+}
+
+auto gfx::vk_api::DeletionQueue::stats() const -> DeletionQueueStats
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  DeletionQueueStats stats = stats_;
+  if (stats.destroyed > 0) {
+    stats.average_latency_frames =
+        static_cast<double>(latency_frames_sum_) / stats.destroyed;
+    stats.average_latency_ms = latency_ms_sum_ / stats.destroyed;
+  }
+  else {
+    stats.min_latency_frames = 0;
+  }
+  return stats;
+}
+
+auto gfx::vk_api::DeletionQueue::advance_(bool only_if_full) -> void
+{
+  // Make sure the slot we are about to reuse is no longer in use by the GPU.
+  // This only blocks when the CPU runs more than frames_in_flight ahead.
+  uint64_t wait_values[2] = {0, 0};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (only_if_full && slots_[current_].entries.size() < capacity_) {
+      return;
+    }
+    const FrameSlot& next = slots_[(current_ + 1) % slots_.size()];
+    if (next.closed) {
+      wait_values[0] = next.retire_values[0];
+      wait_values[1] = next.retire_values[1];
+    }
+  }
+  for (size_t i = 0; i < timeline_count_; ++i) {
+    if (wait_values[i] != 0) {
+      timelines_[i]->wait_until(wait_values[i]);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Another thread may have closed the full frame while this one waited.
+  if (only_if_full && slots_[current_].entries.size() < capacity_) {
+    return;
+  }
+  if (only_if_full) {
+    ++stats_.full_frames;
+  }
+  close_slot_(slots_[current_]);
+
+  ++frame_;
+  current_ = (current_ + 1) % slots_.size();
+  FrameSlot& opening = slots_[current_];
+  if (opening.closed) {
+    free_slot_(opening);
+  }
+  opening.frame = frame_;
+  opening.closed = false;
+}
+
+auto gfx::vk_api::DeletionQueue::close_slot_(FrameSlot& slot) -> void
+{
+  // Called with mutex_ held.
+  slot.closed = true;
+  for (size_t i = 0; i < timeline_count_; ++i) {
+    slot.retire_values[i] = timelines_[i]->last_submitted_value();
+  }
+}
+
+auto gfx::vk_api::DeletionQueue::enqueue_(VkObjectType type, uint64_t handle)
+    -> void
+{
+  Entry entry = {type, handle, Clock::now()};
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (slots_[current_].entries.size() >= capacity_) {
+    lock.unlock();
+    advance_(true);
+    lock.lock();
+  }
+  slots_[current_].entries.push_back(entry);
+
+  ++stats_.enqueued;
+  ++stats_.pending;
+  if (stats_.pending > stats_.peak_pending) {
+    stats_.peak_pending = stats_.pending;
+  }
+}
+
+auto gfx::vk_api::DeletionQueue::free_slot_(FrameSlot& slot) -> size_t
+{
+  // Called with mutex_ held.
+  Clock::time_point now = Clock::now();
+  uint64_t latency_frames = frame_ - slot.frame;
+
+  size_t count = 0;
+  for (const Entry& entry : slot.entries) {
+    destroy_object_(entry);
+
+    double latency_ms =
+        std::chrono::duration<double, std::milli>(now - entry.released)
+            .count();
+    latency_ms_sum_ += latency_ms;
+    if (latency_ms > stats_.max_latency_ms) {
+      stats_.max_latency_ms = latency_ms;
+    }
+    ++count;
+  }
+
+  if (count > 0) {
+    latency_frames_sum_ += latency_frames * count;
+    if (latency_frames < stats_.min_latency_frames) {
+      stats_.min_latency_frames = latency_frames;
+    }
+    if (latency_frames > stats_.max_latency_frames) {
+      stats_.max_latency_frames = latency_frames;
+    }
+  }
+  stats_.destroyed += count;
+  stats_.pending -= count;
+
+  // Fixed slot storage is kept.
+  slot.entries.clear();
+  slot.closed = false;
+  return count;
+}
+
+auto gfx::vk_api::DeletionQueue::destroy_object_(const Entry& entry) -> void
+{
+  const VulkanDevice& d = functions_;
+
+#define vk_destroy_object(type, handle_type, fun)                  \
+  case type:                                                       \
+    d.fun(device_, reinterpret_cast<handle_type>(entry.handle),    \
+          allocation_callbacks());                                 \
+    break;
+
+  switch (entry.type) {
+    vk_destroy_object(VK_OBJECT_TYPE_SEMAPHORE, VkSemaphore,
+                      vkDestroySemaphore);
+    vk_destroy_object(VK_OBJECT_TYPE_FENCE, VkFence, vkDestroyFence);
+    vk_destroy_object(VK_OBJECT_TYPE_DEVICE_MEMORY, VkDeviceMemory,
+                      vkFreeMemory);
+    vk_destroy_object(VK_OBJECT_TYPE_BUFFER, VkBuffer, vkDestroyBuffer);
+    vk_destroy_object(VK_OBJECT_TYPE_BUFFER_VIEW, VkBufferView,
+                      vkDestroyBufferView);
+    vk_destroy_object(VK_OBJECT_TYPE_IMAGE, VkImage, vkDestroyImage);
+    vk_destroy_object(VK_OBJECT_TYPE_IMAGE_VIEW, VkImageView,
+                      vkDestroyImageView);
+    vk_destroy_object(VK_OBJECT_TYPE_SAMPLER, VkSampler, vkDestroySampler);
+    vk_destroy_object(VK_OBJECT_TYPE_SHADER_MODULE, VkShaderModule,
+                      vkDestroyShaderModule);
+    vk_destroy_object(VK_OBJECT_TYPE_PIPELINE_CACHE, VkPipelineCache,
+                      vkDestroyPipelineCache);
+    vk_destroy_object(VK_OBJECT_TYPE_PIPELINE_LAYOUT, VkPipelineLayout,
+                      vkDestroyPipelineLayout);
+    vk_destroy_object(VK_OBJECT_TYPE_PIPELINE, VkPipeline, vkDestroyPipeline);
+    vk_destroy_object(VK_OBJECT_TYPE_RENDER_PASS, VkRenderPass,
+                      vkDestroyRenderPass);
+    vk_destroy_object(VK_OBJECT_TYPE_FRAMEBUFFER, VkFramebuffer,
+                      vkDestroyFramebuffer);
+    vk_destroy_object(VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                      VkDescriptorSetLayout, vkDestroyDescriptorSetLayout);
+    vk_destroy_object(VK_OBJECT_TYPE_DESCRIPTOR_POOL, VkDescriptorPool,
+                      vkDestroyDescriptorPool);
+    vk_destroy_object(VK_OBJECT_TYPE_COMMAND_POOL, VkCommandPool,
+                      vkDestroyCommandPool);
+    vk_destroy_object(VK_OBJECT_TYPE_QUERY_POOL, VkQueryPool,
+                      vkDestroyQueryPool);
+    vk_destroy_object(VK_OBJECT_TYPE_EVENT, VkEvent, vkDestroyEvent);
+    vk_destroy_object(VK_OBJECT_TYPE_SWAPCHAIN_KHR, VkSwapchainKHR,
+                      vkDestroySwapchainKHR);
+    default:
+      GFX_LOG_ERROR("Deletion queue cannot destroy object type {}!",
+                    entry.type);
+      break;
+  }
+
+#undef vk_destroy_object
+}
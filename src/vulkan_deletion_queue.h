@@ -0,0 +1,153 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// Maps a Vulkan handle type to its VkObjectType. Non-dispatchable handles
+// are only distinct types on 64-bit targets, on 32-bit ones they are all
+// uint64_t and the type has to be named.
+template <typename T>
+struct ObjectTypeOf;
+
+#if VK_USE_64_BIT_PTR_DEFINES == 1
+
+#define vk_object_type(handle, type)            \
+  template <>                                   \
+  struct ObjectTypeOf<handle> {                 \
+    static constexpr VkObjectType value = type; \
+  }
+
+vk_object_type(VkSemaphore, VK_OBJECT_TYPE_SEMAPHORE);
+vk_object_type(VkFence, VK_OBJECT_TYPE_FENCE);
+vk_object_type(VkDeviceMemory, VK_OBJECT_TYPE_DEVICE_MEMORY);
+vk_object_type(VkBuffer, VK_OBJECT_TYPE_BUFFER);
+vk_object_type(VkBufferView, VK_OBJECT_TYPE_BUFFER_VIEW);
+vk_object_type(VkImage, VK_OBJECT_TYPE_IMAGE);
+vk_object_type(VkImageView, VK_OBJECT_TYPE_IMAGE_VIEW);
+vk_object_type(VkSampler, VK_OBJECT_TYPE_SAMPLER);
+vk_object_type(VkShaderModule, VK_OBJECT_TYPE_SHADER_MODULE);
+vk_object_type(VkPipelineCache, VK_OBJECT_TYPE_PIPELINE_CACHE);
+vk_object_type(VkPipelineLayout, VK_OBJECT_TYPE_PIPELINE_LAYOUT);
+vk_object_type(VkPipeline, VK_OBJECT_TYPE_PIPELINE);
+vk_object_type(VkRenderPass, VK_OBJECT_TYPE_RENDER_PASS);
+vk_object_type(VkFramebuffer, VK_OBJECT_TYPE_FRAMEBUFFER);
+vk_object_type(VkDescriptorSetLayout, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
+vk_object_type(VkDescriptorPool, VK_OBJECT_TYPE_DESCRIPTOR_POOL);
+vk_object_type(VkCommandPool, VK_OBJECT_TYPE_COMMAND_POOL);
+vk_object_type(VkQueryPool, VK_OBJECT_TYPE_QUERY_POOL);
+vk_object_type(VkEvent, VK_OBJECT_TYPE_EVENT);
+vk_object_type(VkSwapchainKHR, VK_OBJECT_TYPE_SWAPCHAIN_KHR);
+
+#undef vk_object_type
+#endif
+
+struct DeletionQueueStats {
+  uint64_t enqueued;
+  uint64_t destroyed;
+  // Frames closed early because their slot was full.
+  uint64_t full_frames;
+  uint64_t pending;
+  uint64_t peak_pending;
+  // Latency between the release of an object and its destruction.
+  uint64_t min_latency_frames;
+  uint64_t max_latency_frames;
+  double average_latency_frames;
+  double average_latency_ms;
+  double max_latency_ms;
+};
+
+// ************************************************************ //
+// DeletionQueue                                                //
+//                                                              //
+// Frame indexed deferred destruction of Vulkan objects.        //
+// Objects released during a frame are stored in that frame's   //
+// slot, which is tagged with the values of the frame's last    //
+// submissions on the graphics and compute timelines when the   //
+// frame ends. A slot is freed in bulk once the GPU reaches     //
+// both. Slots have a fixed capacity: a full slot ends its      //
+// frame early, so the footprint stays bounded even for         //
+// headless work that never calls next_frame(). Objects are     //
+// released once the work using them is submitted, from any     //
+// thread.                                                      //
+// ************************************************************ //
+class DeletionQueue {
+ public:
+  DeletionQueue(VulkanDevice& device, uint32_t frames_in_flight = 3,
+                size_t capacity_per_frame = 256);
+  ~DeletionQueue();
+
+  DeletionQueue(const DeletionQueue&) = delete;
+  DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+  // Destroys the object once the current frame's GPU work retires. The
+  // handle type gives the object type on 64-bit targets only.
+  template <typename T>
+  auto destroy(T handle) -> void
+  {
+    destroy(ObjectTypeOf<T>::value, reinterpret_cast<uint64_t>(handle));
+  }
+  auto destroy(VkObjectType type, uint64_t handle) -> void
+  {
+    if (handle != 0) {
+      enqueue_(type, handle);
+    }
+  }
+
+  // Closes the current frame. Its slot retires when the graphics and compute
+  // timelines reach their last submitted values. Waits for the oldest frame
+  // if the ring wraps around onto a slot the GPU still uses.
+  auto next_frame() -> void;
+  // Frees the slots whose GPU work already retired, without blocking.
+  auto collect() -> size_t;
+  // Waits for every submitted frame and frees everything.
+  auto flush() -> void;
+
+  auto stats() const -> DeletionQueueStats;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    VkObjectType type;
+    uint64_t handle;
+    Clock::time_point released;
+  };
+
+  struct FrameSlot {
+    std::vector<Entry> entries;
+    uint64_t frame;
+    // Of each timeline, in the order of timelines_.
+    uint64_t retire_values[2];
+    bool closed;
+  };
+
+  // Closes the current frame, only if its slot is full when only_if_full.
+  auto advance_(bool only_if_full) -> void;
+  auto close_slot_(FrameSlot& slot) -> void;
+  auto enqueue_(VkObjectType type, uint64_t handle) -> void;
+  auto free_slot_(FrameSlot& slot) -> size_t;
+  auto destroy_object_(const Entry& entry) -> void;
+
+  VkDevice device_;
+  VulkanDevice functions_;
+  // The graphics timeline, then the compute one when it is another queue.
+  std::shared_ptr<QueueTimeline> timelines_[2];
+  size_t timeline_count_;
+
+  mutable std::mutex mutex_;
+  std::vector<FrameSlot> slots_;
+  size_t capacity_;
+  size_t current_;
+  uint64_t frame_;
+
+  DeletionQueueStats stats_;
+  uint64_t latency_frames_sum_;
+  double latency_ms_sum_;
+};
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,147 @@
+#include "vulkan_dynamic_resolution.h"
+#include <algorithm>
+#include "host_allocator.h"
+#include "log.h"
+#include "vulkan_builders.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_recovery.h"
+#include "vulkan_startup.h"
+
+namespace {
+
+// Slots never written hold this frame.
+constexpr uint64_t NO_FRAME = ~0ull;
+
+}  // namespace
+
+gfx::vk_api::GpuFrameTimer::GpuFrameTimer(VulkanDevice& device,
+                                          uint32_t frames_in_flight)
+    : device_(device),
+      pool_(VK_NULL_HANDLE),
+      period_ms_(0.0),
+      valid_mask_(0),
+      pending_(frames_in_flight, NO_FRAME),
+      resource_id_(0)
+{
+  PhysicalDeviceInfo info;
+  uint32_t valid_bits =
+      physical_device_info(device_.physical_device, info)
+          ? info.queue_families[device_.graphics_family].timestampValidBits
+          : 0;
+  if (valid_bits == 0) {
+    GFX_LOG_WARNING("The graphics queue has no timestamps, frames are not "
+                    "timed.");
+    return;
+  }
+  period_ms_ = info.properties.limits.timestampPeriod / 1e6;
+  valid_mask_ = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+  create_pool_();
+  resource_id_ = device_.resources->add(
+      [this](VulkanDevice& device) {
+        device.deletion_queue->destroy(pool_);
+        pool_ = VK_NULL_HANDLE;
+        std::fill(pending_.begin(), pending_.end(), NO_FRAME);
+      },
+      [this](VulkanDevice&) {
+        create_pool_();
+        return VK_SUCCESS;
+      });
+}
+
+gfx::vk_api::GpuFrameTimer::~GpuFrameTimer()
+{
+  if (resource_id_ != 0) {
+    device_.resources->remove(resource_id_);
+  }
+  device_.deletion_queue->destroy(pool_);
+}
+
+auto gfx::vk_api::GpuFrameTimer::create_pool_() -> void
+{
+  VkQueryPoolCreateInfo create_info =
+      build<VkQueryPoolCreateInfo>()
+          .set(&VkQueryPoolCreateInfo::queryType, VK_QUERY_TYPE_TIMESTAMP)
+          .set(&VkQueryPoolCreateInfo::queryCount,
+               2 * static_cast<uint32_t>(pending_.size()));
+  if (device_.vkCreateQueryPool(device_.logical_device, &create_info,
+                                allocation_callbacks(),
+                                &pool_) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create the frame timestamps query pool!");
+    pool_ = VK_NULL_HANDLE;
+  }
+}
+
+auto gfx::vk_api::GpuFrameTimer::supported() const -> bool
+{
+  return pool_ != VK_NULL_HANDLE;
+}
+
+auto gfx::vk_api::GpuFrameTimer::begin(VkCommandBuffer command_buffer,
+                                       uint64_t frame) -> void
+{
+  if (!supported()) {
+    return;
+  }
+  uint32_t slot = static_cast<uint32_t>(frame % pending_.size());
+  device_.vkCmdResetQueryPool(command_buffer, pool_, 2 * slot, 2);
+  device_.vkCmdWriteTimestamp(command_buffer,
+                              VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool_,
+                              2 * slot);
+}
+
+auto gfx::vk_api::GpuFrameTimer::end(VkCommandBuffer command_buffer,
+                                     uint64_t frame) -> void
+{
+  if (!supported()) {
+    return;
+  }
+  uint32_t slot = static_cast<uint32_t>(frame % pending_.size());
+  device_.vkCmdWriteTimestamp(command_buffer,
+                              VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool_,
+                              2 * slot + 1);
+  pending_[slot] = frame;
+}
+
+auto gfx::vk_api::GpuFrameTimer::read(uint64_t frame, double& gpu_ms) -> bool
+{
+  uint32_t slot = static_cast<uint32_t>(frame % pending_.size());
+  if (!supported() || pending_[slot] != frame) {
+    return false;
+  }
+  // Without the wait flag, VK_NOT_READY until both timestamps are written.
+  uint64_t timestamps[2];
+  if (device_.vkGetQueryPoolResults(
+          device_.logical_device, pool_, 2 * slot, 2, sizeof(timestamps),
+          timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  pending_[slot] = NO_FRAME;
+  gpu_ms = ((timestamps[1] - timestamps[0]) & valid_mask_) * period_ms_;
+  return true;
+}
+
+auto gfx::vk_api::render_extent(const ResolutionController& controller,
+                                VkExtent2D output) -> VkExtent2D
+{
+  return {controller.scaled(output.width), controller.scaled(output.height)};
+}
+
+auto gfx::vk_api::record_upscale(VulkanDevice& device,
+                                 VkCommandBuffer command_buffer,
+                                 VkImage source, VkExtent2D source_extent,
+                                 VkImage destination,
+                                 VkExtent2D destination_extent) -> void
+{
+  VkImageBlit region = {};
+  region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.srcOffsets[1] = {static_cast<int32_t>(source_extent.width),
+                          static_cast<int32_t>(source_extent.height), 1};
+  region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.dstOffsets[1] = {static_cast<int32_t>(destination_extent.width),
+                          static_cast<int32_t>(destination_extent.height), 1};
+  device.vkCmdBlitImage(command_buffer, source,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, destination,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region,
+                        VK_FILTER_LINEAR);
+}
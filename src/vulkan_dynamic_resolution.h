@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "dynamic_resolution.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// ************************************************************ //
+// Dynamic resolution                                           //
+//                                                              //
+// The frame renders at render_extent(), the output extent      //
+// (the swap chain extent of the surface) scaled by the         //
+// controller, and record_upscale() blits it to the output. The //
+// GPU time of every frame, measured by the GpuFrameTimer once  //
+// the frame retired, feeds the controller, which picks the     //
+// scale of the next frame.                                     //
+// ************************************************************ //
+
+// Timestamps around the GPU work of each frame in flight, on the graphics
+// queue. The frames in flight when the device is lost are never timed, the
+// query pool is created again once it is recovered.
+class GpuFrameTimer {
+ public:
+  GpuFrameTimer(VulkanDevice& device, uint32_t frames_in_flight);
+  ~GpuFrameTimer();
+
+  GpuFrameTimer(const GpuFrameTimer&) = delete;
+  GpuFrameTimer& operator=(const GpuFrameTimer&) = delete;
+
+  // False when the graphics queue has no timestamps, nothing is then
+  // recorded nor read.
+  auto supported() const -> bool;
+  // Recorded first and last in the frame's command buffers, the frame is
+  // the frame number.
+  auto begin(VkCommandBuffer command_buffer, uint64_t frame) -> void;
+  auto end(VkCommandBuffer command_buffer, uint64_t frame) -> void;
+  // GPU time of the frame, once the GPU retired it. Returns false when the
+  // frame was not timed or its timestamps are not available yet.
+  auto read(uint64_t frame, double& gpu_ms) -> bool;
+
+ private:
+  // Left null on failure, the frames are then not timed.
+  auto create_pool_() -> void;
+
+  VulkanDevice& device_;
+  VkQueryPool pool_;
+  double period_ms_;
+  uint64_t valid_mask_;
+  // Frame whose timestamps each slot holds, until read.
+  std::vector<uint64_t> pending_;
+  uint64_t resource_id_;
+};
+
+// Scaled side by side, each at least 1.
+auto render_extent(const ResolutionController& controller, VkExtent2D output)
+    -> VkExtent2D;
+// Linear blit of the rendered image to the output. The source must be in the
+// transfer source layout and the destination in the transfer destination
+// one.
+auto record_upscale(VulkanDevice& device, VkCommandBuffer command_buffer,
+                    VkImage source, VkExtent2D source_extent,
+                    VkImage destination, VkExtent2D destination_extent)
+    -> void;
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,105 @@
+#pragma once
+
+#if defined(VK_USE_PLATFORM_WIN32_KHR) && !defined(NOMINMAX)
+// vulkan.h pulls in windows.h, which must not define min and max.
+#define NOMINMAX
+#endif
+#include <vulkan/vulkan.h>
+
+// ************************************************************ //
+// Extension definitions                                        //
+//                                                              //
+// The vendored Vulkan headers predate some of the extensions   //
+// we rely on. Their definitions are mirrored here and only     //
+// used when the headers do not provide them already.           //
+// ************************************************************ //
+
+#if !defined(VK_KHR_timeline_semaphore)
+#define VK_KHR_timeline_semaphore 1
+#define VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME "VK_KHR_timeline_semaphore"
+
+constexpr VkStructureType
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR =
+        static_cast<VkStructureType>(1000207000);
+constexpr VkStructureType
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_PROPERTIES_KHR =
+        static_cast<VkStructureType>(1000207001);
+constexpr VkStructureType VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR =
+    static_cast<VkStructureType>(1000207002);
+constexpr VkStructureType VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR =
+    static_cast<VkStructureType>(1000207003);
+constexpr VkStructureType VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR =
+    static_cast<VkStructureType>(1000207004);
+constexpr VkStructureType VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR =
+    static_cast<VkStructureType>(1000207005);
+
+typedef enum VkSemaphoreTypeKHR {
+  VK_SEMAPHORE_TYPE_BINARY_KHR = 0,
+  VK_SEMAPHORE_TYPE_TIMELINE_KHR = 1,
+  VK_SEMAPHORE_TYPE_MAX_ENUM_KHR = 0x7FFFFFFF
+} VkSemaphoreTypeKHR;
+
+typedef enum VkSemaphoreWaitFlagBitsKHR {
+  VK_SEMAPHORE_WAIT_ANY_BIT_KHR = 0x00000001,
+  VK_SEMAPHORE_WAIT_FLAG_BITS_MAX_ENUM_KHR = 0x7FFFFFFF
+} VkSemaphoreWaitFlagBitsKHR;
+typedef VkFlags VkSemaphoreWaitFlagsKHR;
+
+typedef struct VkPhysicalDeviceTimelineSemaphoreFeaturesKHR {
+  VkStructureType sType;
+  void* pNext;
+  VkBool32 timelineSemaphore;
+} VkPhysicalDeviceTimelineSemaphoreFeaturesKHR;
+
+typedef struct VkSemaphoreTypeCreateInfoKHR {
+  VkStructureType sType;
+  const void* pNext;
+  VkSemaphoreTypeKHR semaphoreType;
+  uint64_t initialValue;
+} VkSemaphoreTypeCreateInfoKHR;
+
+typedef struct VkTimelineSemaphoreSubmitInfoKHR {
+  VkStructureType sType;
+  const void* pNext;
+  uint32_t waitSemaphoreValueCount;
+  const uint64_t* pWaitSemaphoreValues;
+  uint32_t signalSemaphoreValueCount;
+  const uint64_t* pSignalSemaphoreValues;
+} VkTimelineSemaphoreSubmitInfoKHR;
+
+typedef struct VkSemaphoreWaitInfoKHR {
+  VkStructureType sType;
+  const void* pNext;
+  VkSemaphoreWaitFlagsKHR flags;
+  uint32_t semaphoreCount;
+  const VkSemaphore* pSemaphores;
+  const uint64_t* pValues;
+} VkSemaphoreWaitInfoKHR;
+
+typedef struct VkSemaphoreSignalInfoKHR {
+  VkStructureType sType;
+  const void* pNext;
+  VkSemaphore semaphore;
+  uint64_t value;
+} VkSemaphoreSignalInfoKHR;
+
+typedef VkResult(VKAPI_PTR* PFN_vkGetSemaphoreCounterValueKHR)(
+    VkDevice device, VkSemaphore semaphore, uint64_t* pValue);
+typedef VkResult(VKAPI_PTR* PFN_vkWaitSemaphoresKHR)(
+    VkDevice device, const VkSemaphoreWaitInfoKHR* pWaitInfo, uint64_t timeout);
+typedef VkResult(VKAPI_PTR* PFN_vkSignalSemaphoreKHR)(
+    VkDevice device, const VkSemaphoreSignalInfoKHR* pSignalInfo);
+#endif
+
+// Newer headers tell whether non-dispatchable handles are pointers, and so
+// distinct types, or all uint64_t. This is their test.
+#if !defined(VK_USE_64_BIT_PTR_DEFINES)
+#if defined(__LP64__) || defined(_WIN64) ||                   \
+    (defined(__x86_64__) && !defined(__ILP32__)) ||           \
+    defined(_M_X64) || defined(__ia64) || defined(_M_IA64) || \
+    defined(__aarch64__) || defined(__powerpc64__)
+#define VK_USE_64_BIT_PTR_DEFINES 1
+#else
+#define VK_USE_64_BIT_PTR_DEFINES 0
+#endif
+#endif
@@ -0,0 +1,181 @@
+#include "vulkan_metrics.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "log.h"
+#include "metrics.h"
+
+namespace gfx::vk_api {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct DeviceMetrics {
+  Counter submits = register_counter("vk.submits");
+  Counter presents = register_counter("vk.presents");
+  Counter allocations = register_counter("vk.allocations");
+  Counter frees = register_counter("vk.frees");
+  Histogram acquire_wait = register_histogram("vk.acquire_wait");
+  Counter frames = register_counter("frame.count");
+  Histogram frame_time = register_histogram("frame.time");
+  Histogram frame_submits =
+      register_histogram("frame.submits", MetricUnit::none);
+  // Bytes allocated from every heap of the device.
+  std::vector<Gauge> heap_bytes;
+};
+
+// The table the wrappers forward to.
+VulkanDevice ORIGINAL;
+// Replaced at every install, the names registered stay the same.
+std::unique_ptr<DeviceMetrics> METRICS;
+// Heap and size of the live allocations, to count frees.
+std::mutex MEMORY_MUTEX;
+std::unordered_map<VkDeviceMemory, std::pair<uint32_t, VkDeviceSize>>
+    ALLOCATIONS;
+// Since the last frame end.
+std::atomic<uint64_t> FRAME_SUBMITS(0);
+Clock::time_point LAST_FRAME_END;
+
+VKAPI_ATTR auto VKAPI_CALL metrics_vkDestroyDevice(
+    VkDevice device, const VkAllocationCallbacks* allocator) -> void
+{
+  {
+    // Memory the device frees with it.
+    std::lock_guard<std::mutex> lock(MEMORY_MUTEX);
+    for (const auto& [memory, allocation] : ALLOCATIONS) {
+      METRICS->heap_bytes[allocation.first].add(
+          -static_cast<int64_t>(allocation.second));
+    }
+    ALLOCATIONS.clear();
+  }
+  auto destroy_device = ORIGINAL.vkDestroyDevice;
+  ORIGINAL = {};
+  destroy_device(device, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL metrics_vkQueueSubmit(VkQueue queue,
+                                                 uint32_t submit_count,
+                                                 const VkSubmitInfo* submits,
+                                                 VkFence fence) -> VkResult
+{
+  METRICS->submits.add();
+  FRAME_SUBMITS.fetch_add(1, std::memory_order_relaxed);
+  return ORIGINAL.vkQueueSubmit(queue, submit_count, submits, fence);
+}
+
+VKAPI_ATTR auto VKAPI_CALL metrics_vkAllocateMemory(
+    VkDevice device, const VkMemoryAllocateInfo* allocate_info,
+    const VkAllocationCallbacks* allocator, VkDeviceMemory* memory)
+    -> VkResult
+{
+  VkResult result =
+      ORIGINAL.vkAllocateMemory(device, allocate_info, allocator, memory);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  uint32_t heap =
+      ORIGINAL.memory_properties.memoryTypes[allocate_info->memoryTypeIndex]
+          .heapIndex;
+  METRICS->allocations.add();
+  METRICS->heap_bytes[heap].add(
+      static_cast<int64_t>(allocate_info->allocationSize));
+  std::lock_guard<std::mutex> lock(MEMORY_MUTEX);
+  ALLOCATIONS[*memory] = {heap, allocate_info->allocationSize};
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL metrics_vkFreeMemory(
+    VkDevice device, VkDeviceMemory memory,
+    const VkAllocationCallbacks* allocator) -> void
+{
+  if (memory != VK_NULL_HANDLE) {
+    std::lock_guard<std::mutex> lock(MEMORY_MUTEX);
+    auto allocation = ALLOCATIONS.find(memory);
+    if (allocation != ALLOCATIONS.end()) {
+      METRICS->frees.add();
+      METRICS->heap_bytes[allocation->second.first].add(
+          -static_cast<int64_t>(allocation->second.second));
+      ALLOCATIONS.erase(allocation);
+    }
+  }
+  ORIGINAL.vkFreeMemory(device, memory, allocator);
+}
+
+VKAPI_ATTR auto VKAPI_CALL metrics_vkAcquireNextImageKHR(
+    VkDevice device, VkSwapchainKHR swap_chain, uint64_t timeout,
+    VkSemaphore semaphore, VkFence fence, uint32_t* image_index) -> VkResult
+{
+  auto start = Clock::now();
+  VkResult result = ORIGINAL.vkAcquireNextImageKHR(
+      device, swap_chain, timeout, semaphore, fence, image_index);
+  METRICS->acquire_wait.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           start)
+          .count());
+  return result;
+}
+
+VKAPI_ATTR auto VKAPI_CALL metrics_vkQueuePresentKHR(
+    VkQueue queue, const VkPresentInfoKHR* present_info) -> VkResult
+{
+  // One call presents to every surface.
+  METRICS->presents.add(present_info->swapchainCount);
+  return ORIGINAL.vkQueuePresentKHR(queue, present_info);
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::install_metrics(VulkanDevice& device) -> void
+{
+  if (ORIGINAL.logical_device != VK_NULL_HANDLE) {
+    GFX_LOG_WARNING("Metrics already count another device, not this one.");
+    return;
+  }
+  ORIGINAL = device;
+  METRICS = std::make_unique<DeviceMetrics>();
+  for (uint32_t i = 0; i < device.memory_properties.memoryHeapCount; ++i) {
+    std::string name = "vk.heap" + std::to_string(i) + ".bytes";
+    METRICS->heap_bytes.push_back(
+        register_gauge(name.c_str(), MetricUnit::bytes));
+  }
+  LAST_FRAME_END = Clock::now();
+
+  // Functions the device did not load stay null.
+#define metrics_function(fun)   \
+  if (device.fun != nullptr) {  \
+    device.fun = metrics_##fun; \
+  }
+
+  metrics_function(vkDestroyDevice);
+  metrics_function(vkQueueSubmit);
+  metrics_function(vkAllocateMemory);
+  metrics_function(vkFreeMemory);
+  metrics_function(vkAcquireNextImageKHR);
+  metrics_function(vkQueuePresentKHR);
+
+#undef metrics_function
+}
+
+auto gfx::vk_api::end_metrics_frame() -> void
+{
+  if (METRICS == nullptr) {
+    return;
+  }
+  auto now = Clock::now();
+  METRICS->frames.add();
+  METRICS->frame_time.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now -
+                                                           LAST_FRAME_END)
+          .count());
+  METRICS->frame_submits.record(
+      FRAME_SUBMITS.exchange(0, std::memory_order_relaxed));
+  LAST_FRAME_END = now;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// ************************************************************ //
+// Vulkan metrics                                               //
+//                                                              //
+// Counts what a device does through its function table into    //
+// the metrics registry: submits, memory allocations and frees, //
+// the memory allocated from every heap, and the time spent     //
+// waiting to acquire swap chain images. With the frame times   //
+// and submits per frame recorded at end_metrics_frame(), it is //
+// what vkl-top shows of a running process.                     //
+// ************************************************************ //
+
+// Wraps the device functions, called by device creation when metrics are
+// enabled. Only the first device is counted.
+auto install_metrics(VulkanDevice& device) -> void;
+
+// Marks the end of a frame, the application calls it once per frame.
+auto end_metrics_frame() -> void;
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,1296 @@
+#include "vulkan_null_driver.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "log.h"
+
+// Every function the null driver stubs, in the order of the tables in
+// vulkan_api.h.
+#define null_driver_functions(function)              \
+  function(vkCreateInstance)                         \
+  function(vkEnumerateInstanceExtensionProperties)   \
+  function(vkEnumeratePhysicalDevices)               \
+  function(vkGetPhysicalDeviceProperties)            \
+  function(vkGetPhysicalDeviceFeatures)              \
+  function(vkGetPhysicalDeviceQueueFamilyProperties) \
+  function(vkGetPhysicalDeviceMemoryProperties)      \
+  function(vkCreateDevice)                           \
+  function(vkGetDeviceProcAddr)                      \
+  function(vkDestroyInstance)                        \
+  function(vkEnumerateDeviceExtensionProperties)     \
+  function(vkGetPhysicalDeviceFeatures2KHR)          \
+  function(vkGetDeviceQueue)                         \
+  function(vkDeviceWaitIdle)                         \
+  function(vkDestroyDevice)                          \
+  function(vkCreateSemaphore)                        \
+  function(vkCreateCommandPool)                      \
+  function(vkAllocateCommandBuffers)                 \
+  function(vkResetCommandPool)                       \
+  function(vkBeginCommandBuffer)                     \
+  function(vkCmdPipelineBarrier)                     \
+  function(vkCmdClearColorImage)                     \
+  function(vkEndCommandBuffer)                       \
+  function(vkQueueSubmit)                            \
+  function(vkFreeCommandBuffers)                     \
+  function(vkDestroyCommandPool)                     \
+  function(vkDestroySemaphore)                       \
+  function(vkCreateFence)                            \
+  function(vkDestroyFence)                           \
+  function(vkResetFences)                            \
+  function(vkWaitForFences)                          \
+  function(vkGetFenceStatus)                         \
+  function(vkQueueWaitIdle)                          \
+  function(vkAllocateMemory)                         \
+  function(vkMapMemory)                              \
+  function(vkCreateBuffer)                           \
+  function(vkGetBufferMemoryRequirements)            \
+  function(vkBindBufferMemory)                       \
+  function(vkCreateImage)                            \
+  function(vkGetImageMemoryRequirements)             \
+  function(vkBindImageMemory)                        \
+  function(vkCreateImageView)                        \
+  function(vkCreateSampler)                          \
+  function(vkCreateRenderPass)                       \
+  function(vkCreateFramebuffer)                      \
+  function(vkCreateQueryPool)                        \
+  function(vkCmdResetQueryPool)                      \
+  function(vkCmdWriteTimestamp)                      \
+  function(vkGetQueryPoolResults)                    \
+  function(vkCreateShaderModule)                     \
+  function(vkCreateDescriptorSetLayout)              \
+  function(vkCreatePipelineLayout)                   \
+  function(vkCreateComputePipelines)                 \
+  function(vkCreateDescriptorPool)                   \
+  function(vkAllocateDescriptorSets)                 \
+  function(vkUpdateDescriptorSets)                   \
+  function(vkCmdBindPipeline)                        \
+  function(vkCmdBindDescriptorSets)                  \
+  function(vkCmdPushConstants)                       \
+  function(vkCmdDispatch)                            \
+  function(vkCmdCopyBuffer)                          \
+  function(vkCmdCopyBufferToImage)                   \
+  function(vkCmdCopyImage)                           \
+  function(vkCmdBlitImage)                           \
+  function(vkCmdBindVertexBuffers)                   \
+  function(vkCmdBindIndexBuffer)                     \
+  function(vkCmdDrawIndexed)                         \
+  function(vkCmdDrawIndexedIndirect)                 \
+  function(vkFreeMemory)                             \
+  function(vkDestroyBuffer)                          \
+  function(vkDestroyBufferView)                      \
+  function(vkDestroyImage)                           \
+  function(vkDestroyImageView)                       \
+  function(vkDestroySampler)                         \
+  function(vkDestroyShaderModule)                    \
+  function(vkDestroyPipelineCache)                   \
+  function(vkDestroyPipelineLayout)                  \
+  function(vkDestroyPipeline)                        \
+  function(vkDestroyRenderPass)                      \
+  function(vkDestroyFramebuffer)                     \
+  function(vkDestroyDescriptorSetLayout)             \
+  function(vkDestroyDescriptorPool)                  \
+  function(vkDestroyQueryPool)                       \
+  function(vkDestroyEvent)                           \
+  function(vkGetSemaphoreCounterValueKHR)            \
+  function(vkWaitSemaphoresKHR)                      \
+  function(vkSignalSemaphoreKHR)                     \
+  function(vkCmdDrawIndexedIndirectCountKHR)
+
+namespace gfx::vk_api {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Function : uint32_t {
+#define null_driver_enum(fun) fun,
+  null_driver_functions(null_driver_enum)
+#undef null_driver_enum
+  count
+};
+
+constexpr const char* FUNCTION_NAMES[] = {
+#define null_driver_name(fun) #fun,
+    null_driver_functions(null_driver_name)
+#undef null_driver_name
+};
+
+constexpr uint32_t HOST_VISIBLE_MEMORY_TYPE = 1;
+constexpr VkDeviceSize HEAP_SIZE = 4ull << 30;
+constexpr VkDeviceSize MEMORY_ALIGNMENT = 256;
+
+struct Counters {
+  std::atomic<uint64_t> calls[static_cast<uint32_t>(Function::count)];
+  std::atomic<uint64_t> commands;
+  std::atomic<uint64_t> pipeline_barriers;
+  std::atomic<uint64_t> barriers;
+  std::atomic<uint64_t> draws;
+  std::atomic<uint64_t> dispatches;
+  std::atomic<uint64_t> copies;
+  std::atomic<uint64_t> submits;
+  std::atomic<uint64_t> submitted_batches;
+  std::atomic<uint64_t> submitted_command_buffers;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> allocated_bytes;
+  std::atomic<uint64_t> live_allocations;
+  std::atomic<uint64_t> objects_created;
+  std::atomic<uint64_t> objects_destroyed;
+  std::atomic<uint64_t> waits;
+};
+
+struct Memory {
+  VkDeviceSize size;
+  uint32_t type;
+  // Created on the first map, device local memory has none.
+  std::unique_ptr<std::byte[]> host;
+};
+
+// Values are signaled in submission order, the GPU runs one batch at a time.
+// Pending signals are few, a vector keeps its storage as they retire where
+// a deque would allocate and free its blocks.
+struct Timeline {
+  uint64_t value;
+  std::vector<std::pair<uint64_t, Clock::time_point>> pending;
+};
+
+bool ENABLED;
+NullDriverConfig CONFIG;
+Counters COUNTERS;
+std::atomic<uint64_t> NEXT_HANDLE(1);
+
+// Guards the objects below, the counters are atomic.
+std::mutex STATE_MUTEX;
+std::unordered_map<uint64_t, Memory> MEMORY;
+std::unordered_map<uint64_t, Timeline> TIMELINES;
+// Of the buffers and images, for their memory requirements.
+std::unordered_map<uint64_t, VkDeviceSize> OBJECT_SIZES;
+// When the fence got signaled, the max time point while it is unsignaled.
+std::unordered_map<uint64_t, Clock::time_point> FENCES;
+// End of the last batch submitted.
+Clock::time_point GPU_IDLE_AT;
+// Submits left before the injected device loss, -1 when none is pending.
+std::atomic<int64_t> SUBMITS_BEFORE_LOSS(-1);
+// Until the next vkCreateDevice.
+std::atomic<bool> LOST(false);
+
+template <typename T>
+auto make_handle() -> T
+{
+  return (T)(uintptr_t)NEXT_HANDLE.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+auto handle_key(T handle) -> uint64_t
+{
+  return (uint64_t)(handle);
+}
+
+auto spin(std::chrono::nanoseconds duration) -> void
+{
+  if (duration.count() == 0) {
+    return;
+  }
+  auto end = Clock::now() + duration;
+  while (Clock::now() < end) {
+  }
+}
+
+auto enter(Function function) -> void
+{
+  COUNTERS.calls[static_cast<uint32_t>(function)].fetch_add(
+      1, std::memory_order_relaxed);
+  spin(std::chrono::nanoseconds(CONFIG.call_ns));
+}
+
+auto count(std::atomic<uint64_t>& counter, uint64_t value = 1) -> void
+{
+  counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+// Timeouts are in nanoseconds, UINT64_MAX waits forever.
+auto deadline(uint64_t timeout) -> Clock::time_point
+{
+  auto now = Clock::now();
+  if (timeout >= static_cast<uint64_t>((Clock::time_point::max() - now)
+                                           .count())) {
+    return Clock::time_point::max();
+  }
+  return now + std::chrono::nanoseconds(timeout);
+}
+
+// Returns when the timeline reaches the value, the max time point if no
+// submission signals it. Expects STATE_MUTEX held.
+auto reached_at(Timeline& timeline, uint64_t value) -> Clock::time_point
+{
+  auto now = Clock::now();
+  auto retired = timeline.pending.begin();
+  while (retired != timeline.pending.end() && retired->second <= now) {
+    // A host signal may have gone past the submitted value meanwhile.
+    timeline.value = std::max(timeline.value, retired->first);
+    ++retired;
+  }
+  timeline.pending.erase(timeline.pending.begin(), retired);
+  if (timeline.value >= value) {
+    return now;
+  }
+  for (const auto& [pending_value, ready] : timeline.pending) {
+    if (pending_value >= value) {
+      return ready;
+    }
+  }
+  return Clock::time_point::max();
+}
+
+// Sleeps until the time point unless it is past the deadline. Returns
+// VK_TIMEOUT in that case, and fails waits that can never end instead of
+// hanging.
+auto wait_until(Clock::time_point ready, Clock::time_point end) -> VkResult
+{
+  if (ready == Clock::time_point::max() && end == Clock::time_point::max()) {
+    GFX_LOG_ERROR("Null driver: waiting forever on work never submitted!");
+    return VK_ERROR_DEVICE_LOST;
+  }
+  if (ready > end) {
+    std::this_thread::sleep_until(end);
+    return VK_TIMEOUT;
+  }
+  std::this_thread::sleep_until(ready);
+  return VK_SUCCESS;
+}
+
+template <typename T>
+auto find_in_chain(const void* next, VkStructureType type) -> const T*
+{
+  for (auto* structure = static_cast<const VkBaseInStructure*>(next);
+       structure != nullptr; structure = structure->pNext) {
+    if (structure->sType == type) {
+      return reinterpret_cast<const T*>(structure);
+    }
+  }
+  return nullptr;
+}
+
+// Two call idiom of the enumerations.
+template <typename T>
+auto enumerate(const T* items, uint32_t item_count, uint32_t* count,
+               T* out) -> VkResult
+{
+  if (out == nullptr) {
+    *count = item_count;
+    return VK_SUCCESS;
+  }
+  uint32_t written = std::min(*count, item_count);
+  std::copy(items, items + written, out);
+  *count = written;
+  return written < item_count ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+// Counts the submit toward the pending loss, true once the device is lost.
+auto submit_lost() -> bool
+{
+  int64_t left = SUBMITS_BEFORE_LOSS.load();
+  while (left >= 0 && !SUBMITS_BEFORE_LOSS.compare_exchange_weak(left,
+                                                                 left - 1)) {
+  }
+  if (left == 0) {
+    LOST.store(true);
+  }
+  return LOST.load();
+}
+
+auto create_object() -> void
+{
+  count(COUNTERS.objects_created);
+}
+
+auto destroy_object(uint64_t handle) -> void
+{
+  if (handle != 0) {
+    count(COUNTERS.objects_destroyed);
+  }
+}
+
+// Creation functions without anything to simulate.
+#define null_driver_create(fun, Info, Handle)                            \
+  VKAPI_ATTR auto VKAPI_CALL null_##fun(VkDevice, const Info*,           \
+                                        const VkAllocationCallbacks*,    \
+                                        Handle* handle)                  \
+      ->VkResult                                                         \
+  {                                                                      \
+    enter(Function::fun);                                                \
+    create_object();                                                     \
+    *handle = make_handle<Handle>();                                     \
+    return VK_SUCCESS;                                                   \
+  }
+
+#define null_driver_destroy(fun, Handle)                                  \
+  VKAPI_ATTR auto VKAPI_CALL null_##fun(VkDevice, Handle handle,          \
+                                        const VkAllocationCallbacks*)     \
+      ->void                                                              \
+  {                                                                       \
+    enter(Function::fun);                                                 \
+    destroy_object(handle_key(handle));                                   \
+  }
+
+auto get_proc_address(const char* name) -> PFN_vkVoidFunction;
+
+// Instance.
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetInstanceProcAddr(VkInstance,
+                                                      const char* name)
+    -> PFN_vkVoidFunction
+{
+  if (strcmp(name, "vkGetInstanceProcAddr") == 0) {
+    return reinterpret_cast<PFN_vkVoidFunction>(&null_vkGetInstanceProcAddr);
+  }
+  return get_proc_address(name);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCreateInstance(
+    const VkInstanceCreateInfo* create_info, const VkAllocationCallbacks*,
+    VkInstance* instance) -> VkResult
+{
+  enter(Function::vkCreateInstance);
+  // Only headless instances.
+  for (uint32_t i = 0; i < create_info->enabledExtensionCount; ++i) {
+    if (strcmp(create_info->ppEnabledExtensionNames[i],
+               VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) != 0) {
+      return VK_ERROR_EXTENSION_NOT_PRESENT;
+    }
+  }
+  create_object();
+  *instance = make_handle<VkInstance>();
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkEnumerateInstanceExtensionProperties(
+    const char*, uint32_t* count, VkExtensionProperties* properties)
+    -> VkResult
+{
+  enter(Function::vkEnumerateInstanceExtensionProperties);
+  const VkExtensionProperties extension = {
+      VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME, 1};
+  return enumerate(&extension, 1, count, properties);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkEnumeratePhysicalDevices(
+    VkInstance, uint32_t* count, VkPhysicalDevice* devices) -> VkResult
+{
+  enter(Function::vkEnumeratePhysicalDevices);
+  // A single device, the same for every instance.
+  static const VkPhysicalDevice DEVICE = make_handle<VkPhysicalDevice>();
+  return enumerate(&DEVICE, 1, count, devices);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetPhysicalDeviceProperties(
+    VkPhysicalDevice, VkPhysicalDeviceProperties* properties) -> void
+{
+  enter(Function::vkGetPhysicalDeviceProperties);
+  *properties = {};
+  properties->apiVersion = VK_MAKE_VERSION(1, 1, 0);
+  properties->driverVersion = 1;
+  properties->deviceType = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+  strcpy(properties->deviceName, "Null driver");
+  VkPhysicalDeviceLimits& limits = properties->limits;
+  limits.maxImageDimension1D = 16384;
+  limits.maxImageDimension2D = 16384;
+  limits.maxImageDimension3D = 2048;
+  limits.maxImageDimensionCube = 16384;
+  limits.maxImageArrayLayers = 2048;
+  limits.maxUniformBufferRange = 65536;
+  limits.maxStorageBufferRange = UINT32_MAX;
+  limits.maxPushConstantsSize = 256;
+  limits.maxMemoryAllocationCount = 4096;
+  limits.maxSamplerAllocationCount = 4000;
+  limits.bufferImageGranularity = 1;
+  limits.maxBoundDescriptorSets = 8;
+  limits.maxComputeWorkGroupCount[0] = 65535;
+  limits.maxComputeWorkGroupCount[1] = 65535;
+  limits.maxComputeWorkGroupCount[2] = 65535;
+  limits.maxComputeWorkGroupInvocations = 1024;
+  limits.maxComputeWorkGroupSize[0] = 1024;
+  limits.maxComputeWorkGroupSize[1] = 1024;
+  limits.maxComputeWorkGroupSize[2] = 64;
+  limits.maxDrawIndexedIndexValue = UINT32_MAX;
+  limits.maxDrawIndirectCount = UINT32_MAX;
+  limits.maxSamplerAnisotropy = 16.0f;
+  limits.maxViewports = 16;
+  limits.maxViewportDimensions[0] = 16384;
+  limits.maxViewportDimensions[1] = 16384;
+  limits.minMemoryMapAlignment = 64;
+  limits.minTexelBufferOffsetAlignment = 16;
+  limits.minUniformBufferOffsetAlignment = 64;
+  limits.minStorageBufferOffsetAlignment = 16;
+  limits.maxFramebufferWidth = 16384;
+  limits.maxFramebufferHeight = 16384;
+  limits.maxFramebufferLayers = 2048;
+  limits.maxColorAttachments = 8;
+  limits.timestampComputeAndGraphics = VK_TRUE;
+  limits.timestampPeriod = 1.0f;
+  limits.optimalBufferCopyOffsetAlignment = 1;
+  limits.optimalBufferCopyRowPitchAlignment = 1;
+  limits.nonCoherentAtomSize = 64;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetPhysicalDeviceFeatures(
+    VkPhysicalDevice, VkPhysicalDeviceFeatures* features) -> void
+{
+  enter(Function::vkGetPhysicalDeviceFeatures);
+  // Every feature, the stubs ignore them anyway.
+  auto* flags = reinterpret_cast<VkBool32*>(features);
+  std::fill(flags, flags + sizeof(*features) / sizeof(VkBool32), VK_TRUE);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetPhysicalDeviceQueueFamilyProperties(
+    VkPhysicalDevice, uint32_t* count,
+    VkQueueFamilyProperties* properties) -> void
+{
+  enter(Function::vkGetPhysicalDeviceQueueFamilyProperties);
+  VkQueueFamilyProperties family = {};
+  family.queueFlags =
+      VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
+  family.queueCount = 1;
+  family.timestampValidBits = 64;
+  family.minImageTransferGranularity = {1, 1, 1};
+  enumerate(&family, 1, count, properties);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetPhysicalDeviceMemoryProperties(
+    VkPhysicalDevice, VkPhysicalDeviceMemoryProperties* properties) -> void
+{
+  enter(Function::vkGetPhysicalDeviceMemoryProperties);
+  *properties = {};
+  properties->memoryTypeCount = 2;
+  properties->memoryTypes[0] = {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0};
+  properties->memoryTypes[HOST_VISIBLE_MEMORY_TYPE] = {
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      1};
+  properties->memoryHeapCount = 2;
+  properties->memoryHeaps[0] = {HEAP_SIZE, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT};
+  properties->memoryHeaps[1] = {HEAP_SIZE, 0};
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCreateDevice(VkPhysicalDevice,
+                                               const VkDeviceCreateInfo*,
+                                               const VkAllocationCallbacks*,
+                                               VkDevice* device) -> VkResult
+{
+  enter(Function::vkCreateDevice);
+  // The new device replaces the lost one.
+  SUBMITS_BEFORE_LOSS.store(-1);
+  LOST.store(false);
+  create_object();
+  *device = make_handle<VkDevice>();
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetDeviceProcAddr(VkDevice,
+                                                    const char* name)
+    -> PFN_vkVoidFunction
+{
+  enter(Function::vkGetDeviceProcAddr);
+  return get_proc_address(name);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkDestroyInstance(
+    VkInstance instance, const VkAllocationCallbacks*) -> void
+{
+  enter(Function::vkDestroyInstance);
+  destroy_object(handle_key(instance));
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkEnumerateDeviceExtensionProperties(
+    VkPhysicalDevice, const char*, uint32_t* count,
+    VkExtensionProperties* properties) -> VkResult
+{
+  enter(Function::vkEnumerateDeviceExtensionProperties);
+  const VkExtensionProperties extensions[] = {
+      {VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, 1},
+      {VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, 2}};
+  return enumerate(extensions, CONFIG.timeline_semaphores ? 2 : 1, count,
+                   properties);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetPhysicalDeviceFeatures2KHR(
+    VkPhysicalDevice device, VkPhysicalDeviceFeatures2* features) -> void
+{
+  enter(Function::vkGetPhysicalDeviceFeatures2KHR);
+  null_vkGetPhysicalDeviceFeatures(device, &features->features);
+  for (auto* next = static_cast<VkBaseOutStructure*>(features->pNext);
+       next != nullptr; next = next->pNext) {
+    if (next->sType ==
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR) {
+      reinterpret_cast<VkPhysicalDeviceTimelineSemaphoreFeaturesKHR*>(next)
+          ->timelineSemaphore = CONFIG.timeline_semaphores;
+    }
+  }
+}
+
+// Device.
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetDeviceQueue(VkDevice, uint32_t,
+                                                 uint32_t, VkQueue* queue)
+    -> void
+{
+  enter(Function::vkGetDeviceQueue);
+  // A single queue, it does not matter which device asks for it.
+  static const VkQueue QUEUE = make_handle<VkQueue>();
+  *queue = QUEUE;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkDeviceWaitIdle(VkDevice) -> VkResult
+{
+  enter(Function::vkDeviceWaitIdle);
+  count(COUNTERS.waits);
+  if (LOST.load()) {
+    return VK_ERROR_DEVICE_LOST;
+  }
+  Clock::time_point idle_at;
+  {
+    std::lock_guard<std::mutex> lock(STATE_MUTEX);
+    idle_at = GPU_IDLE_AT;
+  }
+  std::this_thread::sleep_until(idle_at);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkDestroyDevice(
+    VkDevice device, const VkAllocationCallbacks*) -> void
+{
+  enter(Function::vkDestroyDevice);
+  destroy_object(handle_key(device));
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCreateSemaphore(
+    VkDevice, const VkSemaphoreCreateInfo* create_info,
+    const VkAllocationCallbacks*, VkSemaphore* semaphore) -> VkResult
+{
+  enter(Function::vkCreateSemaphore);
+  create_object();
+  *semaphore = make_handle<VkSemaphore>();
+  auto* type_info = find_in_chain<VkSemaphoreTypeCreateInfoKHR>(
+      create_info->pNext, VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR);
+  if (type_info != nullptr &&
+      type_info->semaphoreType == VK_SEMAPHORE_TYPE_TIMELINE_KHR) {
+    std::lock_guard<std::mutex> lock(STATE_MUTEX);
+    TIMELINES[handle_key(*semaphore)] = {type_info->initialValue, {}};
+  }
+  return VK_SUCCESS;
+}
+
+null_driver_create(vkCreateCommandPool, VkCommandPoolCreateInfo,
+                   VkCommandPool)
+
+VKAPI_ATTR auto VKAPI_CALL null_vkAllocateCommandBuffers(
+    VkDevice, const VkCommandBufferAllocateInfo* allocate_info,
+    VkCommandBuffer* command_buffers) -> VkResult
+{
+  enter(Function::vkAllocateCommandBuffers);
+  for (uint32_t i = 0; i < allocate_info->commandBufferCount; ++i) {
+    create_object();
+    command_buffers[i] = make_handle<VkCommandBuffer>();
+  }
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkResetCommandPool(VkDevice, VkCommandPool,
+                                                   VkCommandPoolResetFlags)
+    -> VkResult
+{
+  enter(Function::vkResetCommandPool);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkBeginCommandBuffer(
+    VkCommandBuffer, const VkCommandBufferBeginInfo*) -> VkResult
+{
+  enter(Function::vkBeginCommandBuffer);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdPipelineBarrier(
+    VkCommandBuffer, VkPipelineStageFlags, VkPipelineStageFlags,
+    VkDependencyFlags, uint32_t memory_barrier_count, const VkMemoryBarrier*,
+    uint32_t buffer_barrier_count, const VkBufferMemoryBarrier*,
+    uint32_t image_barrier_count, const VkImageMemoryBarrier*) -> void
+{
+  enter(Function::vkCmdPipelineBarrier);
+  count(COUNTERS.commands);
+  count(COUNTERS.pipeline_barriers);
+  count(COUNTERS.barriers,
+        memory_barrier_count + buffer_barrier_count + image_barrier_count);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdClearColorImage(
+    VkCommandBuffer, VkImage, VkImageLayout, const VkClearColorValue*,
+    uint32_t, const VkImageSubresourceRange*) -> void
+{
+  enter(Function::vkCmdClearColorImage);
+  count(COUNTERS.commands);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkEndCommandBuffer(VkCommandBuffer)
+    -> VkResult
+{
+  enter(Function::vkEndCommandBuffer);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkQueueSubmit(VkQueue, uint32_t submit_count,
+                                              const VkSubmitInfo* submits,
+                                              VkFence fence) -> VkResult
+{
+  enter(Function::vkQueueSubmit);
+  spin(std::chrono::microseconds(CONFIG.submit_us));
+  if (submit_lost()) {
+    return VK_ERROR_DEVICE_LOST;
+  }
+  count(COUNTERS.submits);
+  count(COUNTERS.submitted_batches, submit_count);
+
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  GPU_IDLE_AT = std::max(GPU_IDLE_AT, Clock::now());
+  for (uint32_t i = 0; i < submit_count; ++i) {
+    const VkSubmitInfo& submit = submits[i];
+    count(COUNTERS.submitted_command_buffers, submit.commandBufferCount);
+    GPU_IDLE_AT += std::chrono::microseconds(CONFIG.gpu_batch_us);
+    auto* timeline_info = find_in_chain<VkTimelineSemaphoreSubmitInfoKHR>(
+        submit.pNext, VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR);
+    for (uint32_t j = 0; j < submit.signalSemaphoreCount; ++j) {
+      auto timeline = TIMELINES.find(handle_key(submit.pSignalSemaphores[j]));
+      // Binary semaphores order the queues, and there is a single queue.
+      if (timeline == TIMELINES.end() || timeline_info == nullptr ||
+          j >= timeline_info->signalSemaphoreValueCount) {
+        continue;
+      }
+      timeline->second.pending.emplace_back(
+          timeline_info->pSignalSemaphoreValues[j], GPU_IDLE_AT);
+    }
+  }
+  if (fence != VK_NULL_HANDLE) {
+    FENCES[handle_key(fence)] = GPU_IDLE_AT;
+  }
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkFreeCommandBuffers(
+    VkDevice, VkCommandPool, uint32_t command_buffer_count,
+    const VkCommandBuffer* command_buffers) -> void
+{
+  enter(Function::vkFreeCommandBuffers);
+  for (uint32_t i = 0; i < command_buffer_count; ++i) {
+    destroy_object(handle_key(command_buffers[i]));
+  }
+}
+
+null_driver_destroy(vkDestroyCommandPool, VkCommandPool)
+
+VKAPI_ATTR auto VKAPI_CALL null_vkDestroySemaphore(
+    VkDevice, VkSemaphore semaphore, const VkAllocationCallbacks*) -> void
+{
+  enter(Function::vkDestroySemaphore);
+  destroy_object(handle_key(semaphore));
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  TIMELINES.erase(handle_key(semaphore));
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCreateFence(
+    VkDevice, const VkFenceCreateInfo* create_info,
+    const VkAllocationCallbacks*, VkFence* fence) -> VkResult
+{
+  enter(Function::vkCreateFence);
+  create_object();
+  *fence = make_handle<VkFence>();
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  FENCES[handle_key(*fence)] =
+      (create_info->flags & VK_FENCE_CREATE_SIGNALED_BIT) != 0
+          ? Clock::time_point::min()
+          : Clock::time_point::max();
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkDestroyFence(VkDevice, VkFence fence,
+                                               const VkAllocationCallbacks*)
+    -> void
+{
+  enter(Function::vkDestroyFence);
+  destroy_object(handle_key(fence));
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  FENCES.erase(handle_key(fence));
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkResetFences(VkDevice, uint32_t fence_count,
+                                              const VkFence* fences)
+    -> VkResult
+{
+  enter(Function::vkResetFences);
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  for (uint32_t i = 0; i < fence_count; ++i) {
+    FENCES[handle_key(fences[i])] = Clock::time_point::max();
+  }
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkWaitForFences(VkDevice,
+                                                uint32_t fence_count,
+                                                const VkFence* fences,
+                                                VkBool32 wait_all,
+                                                uint64_t timeout) -> VkResult
+{
+  enter(Function::vkWaitForFences);
+  count(COUNTERS.waits);
+  if (LOST.load()) {
+    return VK_ERROR_DEVICE_LOST;
+  }
+  auto end = deadline(timeout);
+  Clock::time_point ready;
+  {
+    std::lock_guard<std::mutex> lock(STATE_MUTEX);
+    ready = wait_all ? Clock::time_point::min() : Clock::time_point::max();
+    for (uint32_t i = 0; i < fence_count; ++i) {
+      Clock::time_point signaled_at = FENCES[handle_key(fences[i])];
+      ready = wait_all ? std::max(ready, signaled_at)
+                       : std::min(ready, signaled_at);
+    }
+  }
+  return wait_until(ready, end);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetFenceStatus(VkDevice, VkFence fence)
+    -> VkResult
+{
+  enter(Function::vkGetFenceStatus);
+  if (LOST.load()) {
+    return VK_ERROR_DEVICE_LOST;
+  }
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  return FENCES[handle_key(fence)] <= Clock::now() ? VK_SUCCESS
+                                                   : VK_NOT_READY;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkQueueWaitIdle(VkQueue) -> VkResult
+{
+  enter(Function::vkQueueWaitIdle);
+  count(COUNTERS.waits);
+  if (LOST.load()) {
+    return VK_ERROR_DEVICE_LOST;
+  }
+  Clock::time_point idle_at;
+  {
+    std::lock_guard<std::mutex> lock(STATE_MUTEX);
+    idle_at = GPU_IDLE_AT;
+  }
+  std::this_thread::sleep_until(idle_at);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkAllocateMemory(
+    VkDevice, const VkMemoryAllocateInfo* allocate_info,
+    const VkAllocationCallbacks*, VkDeviceMemory* memory) -> VkResult
+{
+  enter(Function::vkAllocateMemory);
+  spin(std::chrono::microseconds(CONFIG.allocation_us));
+  if (allocate_info->memoryTypeIndex > HOST_VISIBLE_MEMORY_TYPE ||
+      allocate_info->allocationSize > HEAP_SIZE) {
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  count(COUNTERS.allocations);
+  count(COUNTERS.allocated_bytes, allocate_info->allocationSize);
+  count(COUNTERS.live_allocations);
+  *memory = make_handle<VkDeviceMemory>();
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  MEMORY[handle_key(*memory)] = {allocate_info->allocationSize,
+                                 allocate_info->memoryTypeIndex, nullptr};
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkMapMemory(VkDevice, VkDeviceMemory memory,
+                                            VkDeviceSize offset, VkDeviceSize,
+                                            VkMemoryMapFlags, void** data)
+    -> VkResult
+{
+  enter(Function::vkMapMemory);
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  auto allocation = MEMORY.find(handle_key(memory));
+  if (allocation == MEMORY.end() ||
+      allocation->second.type != HOST_VISIBLE_MEMORY_TYPE) {
+    return VK_ERROR_MEMORY_MAP_FAILED;
+  }
+  Memory& mapped = allocation->second;
+  if (!mapped.host) {
+    mapped.host = std::make_unique<std::byte[]>(mapped.size);
+  }
+  *data = mapped.host.get() + offset;
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCreateBuffer(
+    VkDevice, const VkBufferCreateInfo* create_info,
+    const VkAllocationCallbacks*, VkBuffer* buffer) -> VkResult
+{
+  enter(Function::vkCreateBuffer);
+  create_object();
+  *buffer = make_handle<VkBuffer>();
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  OBJECT_SIZES[handle_key(*buffer)] = create_info->size;
+  return VK_SUCCESS;
+}
+
+// Any memory type fits any object.
+auto memory_requirements(uint64_t object) -> VkMemoryRequirements
+{
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  VkDeviceSize size = OBJECT_SIZES[object];
+  return {(size + MEMORY_ALIGNMENT - 1) / MEMORY_ALIGNMENT * MEMORY_ALIGNMENT,
+          MEMORY_ALIGNMENT, (1u << 0) | (1u << HOST_VISIBLE_MEMORY_TYPE)};
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetBufferMemoryRequirements(
+    VkDevice, VkBuffer buffer, VkMemoryRequirements* requirements) -> void
+{
+  enter(Function::vkGetBufferMemoryRequirements);
+  *requirements = memory_requirements(handle_key(buffer));
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkBindBufferMemory(VkDevice, VkBuffer,
+                                                   VkDeviceMemory,
+                                                   VkDeviceSize) -> VkResult
+{
+  enter(Function::vkBindBufferMemory);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCreateImage(
+    VkDevice, const VkImageCreateInfo* create_info,
+    const VkAllocationCallbacks*, VkImage* image) -> VkResult
+{
+  enter(Function::vkCreateImage);
+  create_object();
+  *image = make_handle<VkImage>();
+  // Sized as if every texel took 16 bytes, with a full mip chain.
+  const VkExtent3D& extent = create_info->extent;
+  VkDeviceSize texels = VkDeviceSize{extent.width} * extent.height *
+                        extent.depth * create_info->arrayLayers;
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  OBJECT_SIZES[handle_key(*image)] =
+      texels * 16 * (create_info->mipLevels > 1 ? 2 : 1);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetImageMemoryRequirements(
+    VkDevice, VkImage image, VkMemoryRequirements* requirements) -> void
+{
+  enter(Function::vkGetImageMemoryRequirements);
+  *requirements = memory_requirements(handle_key(image));
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkBindImageMemory(VkDevice, VkImage,
+                                                  VkDeviceMemory,
+                                                  VkDeviceSize) -> VkResult
+{
+  enter(Function::vkBindImageMemory);
+  return VK_SUCCESS;
+}
+
+null_driver_create(vkCreateImageView, VkImageViewCreateInfo, VkImageView)
+null_driver_create(vkCreateSampler, VkSamplerCreateInfo, VkSampler)
+null_driver_create(vkCreateRenderPass, VkRenderPassCreateInfo, VkRenderPass)
+null_driver_create(vkCreateFramebuffer, VkFramebufferCreateInfo,
+                   VkFramebuffer)
+null_driver_create(vkCreateQueryPool, VkQueryPoolCreateInfo, VkQueryPool)
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdResetQueryPool(VkCommandBuffer,
+                                                    VkQueryPool, uint32_t,
+                                                    uint32_t) -> void
+{
+  enter(Function::vkCmdResetQueryPool);
+  count(COUNTERS.commands);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdWriteTimestamp(VkCommandBuffer,
+                                                    VkPipelineStageFlagBits,
+                                                    VkQueryPool, uint32_t)
+    -> void
+{
+  enter(Function::vkCmdWriteTimestamp);
+  count(COUNTERS.commands);
+}
+
+// The work takes no time, every timestamp is 0.
+VKAPI_ATTR auto VKAPI_CALL null_vkGetQueryPoolResults(
+    VkDevice, VkQueryPool, uint32_t, uint32_t, size_t data_size, void* data,
+    VkDeviceSize, VkQueryResultFlags) -> VkResult
+{
+  enter(Function::vkGetQueryPoolResults);
+  memset(data, 0, data_size);
+  return VK_SUCCESS;
+}
+null_driver_create(vkCreateShaderModule, VkShaderModuleCreateInfo,
+                   VkShaderModule)
+null_driver_create(vkCreateDescriptorSetLayout,
+                   VkDescriptorSetLayoutCreateInfo, VkDescriptorSetLayout)
+null_driver_create(vkCreatePipelineLayout, VkPipelineLayoutCreateInfo,
+                   VkPipelineLayout)
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCreateComputePipelines(
+    VkDevice, VkPipelineCache, uint32_t create_info_count,
+    const VkComputePipelineCreateInfo*, const VkAllocationCallbacks*,
+    VkPipeline* pipelines) -> VkResult
+{
+  enter(Function::vkCreateComputePipelines);
+  for (uint32_t i = 0; i < create_info_count; ++i) {
+    create_object();
+    pipelines[i] = make_handle<VkPipeline>();
+  }
+  return VK_SUCCESS;
+}
+
+null_driver_create(vkCreateDescriptorPool, VkDescriptorPoolCreateInfo,
+                   VkDescriptorPool)
+
+VKAPI_ATTR auto VKAPI_CALL null_vkAllocateDescriptorSets(
+    VkDevice, const VkDescriptorSetAllocateInfo* allocate_info,
+    VkDescriptorSet* descriptor_sets) -> VkResult
+{
+  enter(Function::vkAllocateDescriptorSets);
+  for (uint32_t i = 0; i < allocate_info->descriptorSetCount; ++i) {
+    create_object();
+    descriptor_sets[i] = make_handle<VkDescriptorSet>();
+  }
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkUpdateDescriptorSets(
+    VkDevice, uint32_t, const VkWriteDescriptorSet*, uint32_t,
+    const VkCopyDescriptorSet*) -> void
+{
+  enter(Function::vkUpdateDescriptorSets);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdBindPipeline(VkCommandBuffer,
+                                                  VkPipelineBindPoint,
+                                                  VkPipeline) -> void
+{
+  enter(Function::vkCmdBindPipeline);
+  count(COUNTERS.commands);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdBindDescriptorSets(
+    VkCommandBuffer, VkPipelineBindPoint, VkPipelineLayout, uint32_t,
+    uint32_t, const VkDescriptorSet*, uint32_t, const uint32_t*) -> void
+{
+  enter(Function::vkCmdBindDescriptorSets);
+  count(COUNTERS.commands);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdPushConstants(VkCommandBuffer,
+                                                   VkPipelineLayout,
+                                                   VkShaderStageFlags,
+                                                   uint32_t, uint32_t,
+                                                   const void*) -> void
+{
+  enter(Function::vkCmdPushConstants);
+  count(COUNTERS.commands);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdDispatch(VkCommandBuffer, uint32_t,
+                                              uint32_t, uint32_t) -> void
+{
+  enter(Function::vkCmdDispatch);
+  count(COUNTERS.commands);
+  count(COUNTERS.dispatches);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdCopyBuffer(VkCommandBuffer, VkBuffer,
+                                                VkBuffer, uint32_t,
+                                                const VkBufferCopy*) -> void
+{
+  enter(Function::vkCmdCopyBuffer);
+  count(COUNTERS.commands);
+  count(COUNTERS.copies);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdCopyBufferToImage(
+    VkCommandBuffer, VkBuffer, VkImage, VkImageLayout, uint32_t,
+    const VkBufferImageCopy*) -> void
+{
+  enter(Function::vkCmdCopyBufferToImage);
+  count(COUNTERS.commands);
+  count(COUNTERS.copies);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdCopyImage(VkCommandBuffer, VkImage,
+                                               VkImageLayout, VkImage,
+                                               VkImageLayout, uint32_t,
+                                               const VkImageCopy*) -> void
+{
+  enter(Function::vkCmdCopyImage);
+  count(COUNTERS.commands);
+  count(COUNTERS.copies);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdBlitImage(VkCommandBuffer, VkImage,
+                                               VkImageLayout, VkImage,
+                                               VkImageLayout, uint32_t,
+                                               const VkImageBlit*, VkFilter)
+    -> void
+{
+  enter(Function::vkCmdBlitImage);
+  count(COUNTERS.commands);
+  count(COUNTERS.copies);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdBindVertexBuffers(VkCommandBuffer,
+                                                       uint32_t, uint32_t,
+                                                       const VkBuffer*,
+                                                       const VkDeviceSize*)
+    -> void
+{
+  enter(Function::vkCmdBindVertexBuffers);
+  count(COUNTERS.commands);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdBindIndexBuffer(VkCommandBuffer,
+                                                     VkBuffer, VkDeviceSize,
+                                                     VkIndexType) -> void
+{
+  enter(Function::vkCmdBindIndexBuffer);
+  count(COUNTERS.commands);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdDrawIndexed(VkCommandBuffer, uint32_t,
+                                                 uint32_t, uint32_t, int32_t,
+                                                 uint32_t) -> void
+{
+  enter(Function::vkCmdDrawIndexed);
+  count(COUNTERS.commands);
+  count(COUNTERS.draws);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdDrawIndexedIndirect(VkCommandBuffer,
+                                                         VkBuffer,
+                                                         VkDeviceSize,
+                                                         uint32_t, uint32_t)
+    -> void
+{
+  enter(Function::vkCmdDrawIndexedIndirect);
+  count(COUNTERS.commands);
+  count(COUNTERS.draws);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkFreeMemory(VkDevice, VkDeviceMemory memory,
+                                             const VkAllocationCallbacks*)
+    -> void
+{
+  enter(Function::vkFreeMemory);
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  if (MEMORY.erase(handle_key(memory)) > 0) {
+    COUNTERS.live_allocations.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkDestroyBuffer(VkDevice, VkBuffer buffer,
+                                                const VkAllocationCallbacks*)
+    -> void
+{
+  enter(Function::vkDestroyBuffer);
+  destroy_object(handle_key(buffer));
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  OBJECT_SIZES.erase(handle_key(buffer));
+}
+
+null_driver_destroy(vkDestroyBufferView, VkBufferView)
+
+VKAPI_ATTR auto VKAPI_CALL null_vkDestroyImage(VkDevice, VkImage image,
+                                               const VkAllocationCallbacks*)
+    -> void
+{
+  enter(Function::vkDestroyImage);
+  destroy_object(handle_key(image));
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  OBJECT_SIZES.erase(handle_key(image));
+}
+
+null_driver_destroy(vkDestroyImageView, VkImageView)
+null_driver_destroy(vkDestroySampler, VkSampler)
+null_driver_destroy(vkDestroyShaderModule, VkShaderModule)
+null_driver_destroy(vkDestroyPipelineCache, VkPipelineCache)
+null_driver_destroy(vkDestroyPipelineLayout, VkPipelineLayout)
+null_driver_destroy(vkDestroyPipeline, VkPipeline)
+null_driver_destroy(vkDestroyRenderPass, VkRenderPass)
+null_driver_destroy(vkDestroyFramebuffer, VkFramebuffer)
+null_driver_destroy(vkDestroyDescriptorSetLayout, VkDescriptorSetLayout)
+null_driver_destroy(vkDestroyDescriptorPool, VkDescriptorPool)
+null_driver_destroy(vkDestroyQueryPool, VkQueryPool)
+null_driver_destroy(vkDestroyEvent, VkEvent)
+
+VKAPI_ATTR auto VKAPI_CALL null_vkGetSemaphoreCounterValueKHR(
+    VkDevice, VkSemaphore semaphore, uint64_t* value) -> VkResult
+{
+  enter(Function::vkGetSemaphoreCounterValueKHR);
+  if (LOST.load()) {
+    return VK_ERROR_DEVICE_LOST;
+  }
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  Timeline& timeline = TIMELINES[handle_key(semaphore)];
+  reached_at(timeline, UINT64_MAX);
+  *value = timeline.value;
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkWaitSemaphoresKHR(
+    VkDevice, const VkSemaphoreWaitInfoKHR* wait_info, uint64_t timeout)
+    -> VkResult
+{
+  enter(Function::vkWaitSemaphoresKHR);
+  count(COUNTERS.waits);
+  if (LOST.load()) {
+    return VK_ERROR_DEVICE_LOST;
+  }
+  auto end = deadline(timeout);
+  bool wait_any = (wait_info->flags & VK_SEMAPHORE_WAIT_ANY_BIT_KHR) != 0;
+  Clock::time_point ready;
+  {
+    std::lock_guard<std::mutex> lock(STATE_MUTEX);
+    ready = wait_any ? Clock::time_point::max() : Clock::time_point::min();
+    for (uint32_t i = 0; i < wait_info->semaphoreCount; ++i) {
+      Clock::time_point reached =
+          reached_at(TIMELINES[handle_key(wait_info->pSemaphores[i])],
+                     wait_info->pValues[i]);
+      ready = wait_any ? std::min(ready, reached) : std::max(ready, reached);
+    }
+  }
+  return wait_until(ready, end);
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkSignalSemaphoreKHR(
+    VkDevice, const VkSemaphoreSignalInfoKHR* signal_info) -> VkResult
+{
+  enter(Function::vkSignalSemaphoreKHR);
+  std::lock_guard<std::mutex> lock(STATE_MUTEX);
+  Timeline& timeline = TIMELINES[handle_key(signal_info->semaphore)];
+  timeline.value = std::max(timeline.value, signal_info->value);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR auto VKAPI_CALL null_vkCmdDrawIndexedIndirectCountKHR(
+    VkCommandBuffer, VkBuffer, VkDeviceSize, VkBuffer, VkDeviceSize, uint32_t,
+    uint32_t) -> void
+{
+  enter(Function::vkCmdDrawIndexedIndirectCountKHR);
+  count(COUNTERS.commands);
+  count(COUNTERS.draws);
+}
+
+#undef null_driver_create
+#undef null_driver_destroy
+
+const PFN_vkVoidFunction FUNCTIONS[] = {
+#define null_driver_pointer(fun) \
+  reinterpret_cast<PFN_vkVoidFunction>(&null_##fun),
+    null_driver_functions(null_driver_pointer)
+#undef null_driver_pointer
+};
+
+auto get_proc_address(const char* name) -> PFN_vkVoidFunction
+{
+  for (size_t i = 0; i < std::size(FUNCTION_NAMES); ++i) {
+    if (strcmp(FUNCTION_NAMES[i], name) == 0) {
+      return FUNCTIONS[i];
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+#undef null_driver_functions
+
+auto gfx::vk_api::enable_null_driver(const NullDriverConfig& config) -> void
+{
+  CONFIG = config;
+  ENABLED = true;
+}
+
+auto gfx::vk_api::null_driver_enabled() -> bool
+{
+  return ENABLED;
+}
+
+auto gfx::vk_api::null_driver_entry_point() -> PFN_vkGetInstanceProcAddr
+{
+  return &null_vkGetInstanceProcAddr;
+}
+
+auto gfx::vk_api::lose_null_driver_device(uint32_t after_submits) -> void
+{
+  SUBMITS_BEFORE_LOSS.store(after_submits);
+}
+
+auto gfx::vk_api::null_driver_stats() -> NullDriverStats
+{
+  NullDriverStats stats = {};
+  for (const std::atomic<uint64_t>& calls : COUNTERS.calls) {
+    stats.calls += calls.load(std::memory_order_relaxed);
+  }
+  stats.commands = COUNTERS.commands.load(std::memory_order_relaxed);
+  stats.pipeline_barriers =
+      COUNTERS.pipeline_barriers.load(std::memory_order_relaxed);
+  stats.barriers = COUNTERS.barriers.load(std::memory_order_relaxed);
+  stats.draws = COUNTERS.draws.load(std::memory_order_relaxed);
+  stats.dispatches = COUNTERS.dispatches.load(std::memory_order_relaxed);
+  stats.copies = COUNTERS.copies.load(std::memory_order_relaxed);
+  stats.submits = COUNTERS.submits.load(std::memory_order_relaxed);
+  stats.submitted_batches =
+      COUNTERS.submitted_batches.load(std::memory_order_relaxed);
+  stats.submitted_command_buffers =
+      COUNTERS.submitted_command_buffers.load(std::memory_order_relaxed);
+  stats.allocations = COUNTERS.allocations.load(std::memory_order_relaxed);
+  stats.allocated_bytes =
+      COUNTERS.allocated_bytes.load(std::memory_order_relaxed);
+  stats.live_allocations =
+      COUNTERS.live_allocations.load(std::memory_order_relaxed);
+  stats.objects_created =
+      COUNTERS.objects_created.load(std::memory_order_relaxed);
+  stats.objects_destroyed =
+      COUNTERS.objects_destroyed.load(std::memory_order_relaxed);
+  stats.waits = COUNTERS.waits.load(std::memory_order_relaxed);
+  return stats;
+}
+
+auto gfx::vk_api::null_driver_call_count(const char* function_name)
+    -> uint64_t
+{
+  for (size_t i = 0; i < std::size(FUNCTION_NAMES); ++i) {
+    if (strcmp(FUNCTION_NAMES[i], function_name) == 0) {
+      return COUNTERS.calls[i].load(std::memory_order_relaxed);
+    }
+  }
+  return 0;
+}
+
+auto gfx::vk_api::reset_null_driver_stats() -> void
+{
+  for (std::atomic<uint64_t>& calls : COUNTERS.calls) {
+    calls.store(0, std::memory_order_relaxed);
+  }
+  for (std::atomic<uint64_t>* counter :
+       {&COUNTERS.commands, &COUNTERS.pipeline_barriers, &COUNTERS.barriers,
+        &COUNTERS.draws, &COUNTERS.dispatches, &COUNTERS.copies,
+        &COUNTERS.submits, &COUNTERS.submitted_batches,
+        &COUNTERS.submitted_command_buffers, &COUNTERS.allocations,
+        &COUNTERS.allocated_bytes, &COUNTERS.objects_created,
+        &COUNTERS.objects_destroyed, &COUNTERS.waits}) {
+    counter->store(0, std::memory_order_relaxed);
+  }
+}
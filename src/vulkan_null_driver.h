@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include "vulkan_ext.h"
+
+namespace gfx::vk_api {
+
+// Simulated costs of the null driver, none by default.
+struct NullDriverConfig {
+  // Spun on the calling thread by every call, standing in for the CPU work
+  // of a real driver.
+  uint32_t call_ns = 0;
+  // Added to the call cost of vkQueueSubmit and vkAllocateMemory.
+  uint32_t submit_us = 0;
+  uint32_t allocation_us = 0;
+  // Time the simulated GPU spends on each submitted batch. Batches run one
+  // after another, fences and timeline values signal when theirs ends.
+  uint32_t gpu_batch_us = 0;
+  // Without, the device takes the fence path of the queue timelines.
+  bool timeline_semaphores = true;
+};
+
+// What the application asked of the null driver since the last reset.
+struct NullDriverStats {
+  uint64_t calls;
+  // Every vkCmd* call, and the barriers, draws, dispatches and copies among
+  // them. Barriers count each memory, buffer and image barrier.
+  uint64_t commands;
+  uint64_t pipeline_barriers;
+  uint64_t barriers;
+  uint64_t draws;
+  uint64_t dispatches;
+  uint64_t copies;
+  // vkQueueSubmit calls, and the batches and command buffers they carried.
+  uint64_t submits;
+  uint64_t submitted_batches;
+  uint64_t submitted_command_buffers;
+  uint64_t allocations;
+  uint64_t allocated_bytes;
+  // Allocations not freed yet. Not affected by resets.
+  uint64_t live_allocations;
+  uint64_t objects_created;
+  uint64_t objects_destroyed;
+  // Fence, semaphore and idle waits.
+  uint64_t waits;
+};
+
+// ************************************************************ //
+// Null driver                                                  //
+//                                                              //
+// Fills the instance and device function tables with stubs     //
+// that do no GPU work, so the CPU side of the engine can be    //
+// measured with no ICD installed. Handles are unique counters, //
+// host visible memory is backed by host allocations, and work  //
+// completes after the configured GPU time. Every call is       //
+// counted along with the arguments the stats cover. Enable it  //
+// before initialize(true), only headless devices exist on it.  //
+// ************************************************************ //
+auto enable_null_driver(const NullDriverConfig& config = {}) -> void;
+auto null_driver_enabled() -> bool;
+// Stands in for the loader's vkGetInstanceProcAddr.
+auto null_driver_entry_point() -> PFN_vkGetInstanceProcAddr;
+
+auto null_driver_stats() -> NullDriverStats;
+// Calls of the function since the last reset, 0 for functions the null
+// driver does not stub.
+auto null_driver_call_count(const char* function_name) -> uint64_t;
+auto reset_null_driver_stats() -> void;
+// Loses the device at the submit after the given number of submits: that
+// submit and every wait after it return VK_ERROR_DEVICE_LOST. Creating a
+// device again ends the loss.
+auto lose_null_driver_device(uint32_t after_submits = 0) -> void;
+
+}  // namespace gfx::vk_api
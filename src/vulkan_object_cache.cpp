@@ -0,0 +1,351 @@
+#include "vulkan_object_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "host_allocator.h"
+#include "log.h"
+#include "vulkan_deletion_queue.h"
+
+namespace {
+
+// Logs create infos with a pNext chain, they cannot be keyed.
+auto has_chain(const void* next, const char* kind) -> bool
+{
+  if (next != nullptr) {
+    GFX_LOG_ERROR("Cached {} create infos cannot have a pNext chain!", kind);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+auto gfx::vk_api::ObjectCache::Key::equals(
+    const std::vector<uint32_t>& words) const -> bool
+{
+  return words.size() == size_ &&
+         memcmp(words.data(), data_(), size_ * sizeof(uint32_t)) == 0;
+}
+
+auto gfx::vk_api::ObjectCache::Key::to_vector() const
+    -> std::vector<uint32_t>
+{
+  return std::vector<uint32_t>(data_(), data_() + size_);
+}
+
+auto gfx::vk_api::ObjectCache::Key::append_word_(uint32_t word) -> void
+{
+  if (size_ < INLINE_WORDS) {
+    inline_words_[size_] = word;
+  }
+  else {
+    if (size_ == INLINE_WORDS) {
+      spilled_words_.assign(inline_words_.begin(), inline_words_.end());
+    }
+    spilled_words_.push_back(word);
+  }
+  ++size_;
+  hash_ ^= word;
+  hash_ *= 0x100000001b3ull;
+}
+
+auto gfx::vk_api::ObjectCache::Key::data_() const -> const uint32_t*
+{
+  return size_ <= INLINE_WORDS ? inline_words_.data()
+                               : spilled_words_.data();
+}
+
+gfx::vk_api::ObjectCache::Table::Table(const char* name, VkObjectType type)
+    : type(type),
+      hit_counter(register_counter(
+          (std::string("vk.cache.") + name + ".hits").c_str())),
+      miss_counter(register_counter(
+          (std::string("vk.cache.") + name + ".misses").c_str())),
+      hits(0),
+      misses(0),
+      evictions(0)
+{
+}
+
+gfx::vk_api::ObjectCache::ObjectCache(const VulkanDevice& device)
+    : device_(device.logical_device),
+      functions_(device),
+      render_passes_("render_pass", VK_OBJECT_TYPE_RENDER_PASS),
+      framebuffers_("framebuffer", VK_OBJECT_TYPE_FRAMEBUFFER),
+      image_views_("image_view", VK_OBJECT_TYPE_IMAGE_VIEW),
+      samplers_("sampler", VK_OBJECT_TYPE_SAMPLER)
+{
+}
+
+gfx::vk_api::ObjectCache::~ObjectCache() { clear(); }
+
+auto gfx::vk_api::ObjectCache::render_pass(
+    const VkRenderPassCreateInfo& create_info) -> VkRenderPass
+{
+  if (has_chain(create_info.pNext, "render pass")) {
+    return VK_NULL_HANDLE;
+  }
+  Key key;
+  key.append(create_info.flags);
+  key.append(create_info.attachmentCount);
+  key.append(create_info.pAttachments, create_info.attachmentCount);
+  key.append(create_info.subpassCount);
+  for (uint32_t i = 0; i < create_info.subpassCount; ++i) {
+    const VkSubpassDescription& subpass = create_info.pSubpasses[i];
+    key.append(subpass.flags);
+    key.append(subpass.pipelineBindPoint);
+    key.append(subpass.inputAttachmentCount);
+    key.append(subpass.pInputAttachments, subpass.inputAttachmentCount);
+    key.append(subpass.colorAttachmentCount);
+    key.append(subpass.pColorAttachments, subpass.colorAttachmentCount);
+    key.append_optional(subpass.pResolveAttachments,
+                        subpass.colorAttachmentCount);
+    key.append_optional(subpass.pDepthStencilAttachment, 1);
+    key.append(subpass.preserveAttachmentCount);
+    key.append(subpass.pPreserveAttachments, subpass.preserveAttachmentCount);
+  }
+  key.append(create_info.dependencyCount);
+  key.append(create_info.pDependencies, create_info.dependencyCount);
+
+  uint64_t handle = find_or_create_<uint64_t>(
+      render_passes_, key, nullptr, 0, [&](uint64_t& handle) {
+        VkRenderPass render_pass;
+        VkResult result = functions_.vkCreateRenderPass(
+            device_, &create_info, allocation_callbacks(), &render_pass);
+        handle = reinterpret_cast<uint64_t>(render_pass);
+        return result;
+      });
+  return reinterpret_cast<VkRenderPass>(handle);
+}
+
+auto gfx::vk_api::ObjectCache::framebuffer(
+    const VkFramebufferCreateInfo& create_info) -> VkFramebuffer
+{
+  if (has_chain(create_info.pNext, "framebuffer")) {
+    return VK_NULL_HANDLE;
+  }
+  Key key;
+  key.append(create_info.flags);
+  key.append(create_info.renderPass);
+  key.append(create_info.attachmentCount);
+  key.append(create_info.pAttachments, create_info.attachmentCount);
+  key.append(create_info.width);
+  key.append(create_info.height);
+  key.append(create_info.layers);
+
+  uint64_t handle = find_or_create_(
+      framebuffers_, key, create_info.pAttachments,
+      create_info.attachmentCount, [&](uint64_t& handle) {
+        VkFramebuffer framebuffer;
+        VkResult result = functions_.vkCreateFramebuffer(
+            device_, &create_info, allocation_callbacks(), &framebuffer);
+        handle = reinterpret_cast<uint64_t>(framebuffer);
+        return result;
+      });
+  return reinterpret_cast<VkFramebuffer>(handle);
+}
+
+auto gfx::vk_api::ObjectCache::image_view(
+    const VkImageViewCreateInfo& create_info) -> VkImageView
+{
+  if (has_chain(create_info.pNext, "image view")) {
+    return VK_NULL_HANDLE;
+  }
+  Key key;
+  key.append(create_info.flags);
+  key.append(create_info.image);
+  key.append(create_info.viewType);
+  key.append(create_info.format);
+  key.append(create_info.components);
+  key.append(create_info.subresourceRange);
+
+  uint64_t handle = find_or_create_(
+      image_views_, key, &create_info.image, 1, [&](uint64_t& handle) {
+        VkImageView view;
+        VkResult result = functions_.vkCreateImageView(
+            device_, &create_info, allocation_callbacks(), &view);
+        handle = reinterpret_cast<uint64_t>(view);
+        return result;
+      });
+  return reinterpret_cast<VkImageView>(handle);
+}
+
+auto gfx::vk_api::ObjectCache::sampler(const VkSamplerCreateInfo& create_info)
+    -> VkSampler
+{
+  if (has_chain(create_info.pNext, "sampler")) {
+    return VK_NULL_HANDLE;
+  }
+  Key key;
+  key.append(create_info.flags);
+  key.append(create_info.magFilter);
+  key.append(create_info.minFilter);
+  key.append(create_info.mipmapMode);
+  key.append(create_info.addressModeU);
+  key.append(create_info.addressModeV);
+  key.append(create_info.addressModeW);
+  key.append(create_info.mipLodBias);
+  key.append(create_info.anisotropyEnable);
+  key.append(create_info.maxAnisotropy);
+  key.append(create_info.compareEnable);
+  key.append(create_info.compareOp);
+  key.append(create_info.minLod);
+  key.append(create_info.maxLod);
+  key.append(create_info.borderColor);
+  key.append(create_info.unnormalizedCoordinates);
+
+  uint64_t handle = find_or_create_<uint64_t>(
+      samplers_, key, nullptr, 0, [&](uint64_t& handle) {
+        VkSampler sampler;
+        VkResult result = functions_.vkCreateSampler(
+            device_, &create_info, allocation_callbacks(), &sampler);
+        handle = reinterpret_cast<uint64_t>(sampler);
+        return result;
+      });
+  return reinterpret_cast<VkSampler>(handle);
+}
+
+auto gfx::vk_api::ObjectCache::evict_image(VkImage image) -> void
+{
+  std::vector<uint64_t> views =
+      evict_(image_views_, {reinterpret_cast<uint64_t>(image)});
+  if (!views.empty()) {
+    evict_(framebuffers_, views);
+  }
+}
+
+auto gfx::vk_api::ObjectCache::evict_image_view(VkImageView view) -> void
+{
+  evict_(framebuffers_, {reinterpret_cast<uint64_t>(view)});
+}
+
+auto gfx::vk_api::ObjectCache::clear() -> void
+{
+  // Framebuffers first, they refer to the render passes and the views.
+  for (Table* table :
+       {&framebuffers_, &image_views_, &render_passes_, &samplers_}) {
+    std::unique_lock<std::shared_mutex> lock(table->mutex);
+    for (const auto& [key, entry] : table->entries) {
+      destroy_(table->type, entry.handle);
+    }
+    table->evictions += table->entries.size();
+    table->entries.clear();
+  }
+}
+
+auto gfx::vk_api::ObjectCache::stats() const -> ObjectCacheStats
+{
+  return {kind_stats_(render_passes_), kind_stats_(framebuffers_),
+          kind_stats_(image_views_), kind_stats_(samplers_)};
+}
+
+auto gfx::vk_api::ObjectCache::find_(const Table& table, const Key& key)
+    -> const Entry*
+{
+  auto [begin, end] = table.entries.equal_range(key.hash());
+  for (auto it = begin; it != end; ++it) {
+    if (key.equals(it->second.key)) {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
+
+template <typename Dependency, typename Create>
+auto gfx::vk_api::ObjectCache::find_or_create_(Table& table, const Key& key,
+                                               const Dependency* dependencies,
+                                               uint32_t dependency_count,
+                                               Create create) -> uint64_t
+{
+  {
+    std::shared_lock<std::shared_mutex> lock(table.mutex);
+    if (const Entry* entry = find_(table, key)) {
+      table.hits.fetch_add(1, std::memory_order_relaxed);
+      table.hit_counter.add();
+      return entry->handle;
+    }
+  }
+
+  std::unique_lock<std::shared_mutex> lock(table.mutex);
+  // Another thread may have created it in between.
+  if (const Entry* entry = find_(table, key)) {
+    table.hits.fetch_add(1, std::memory_order_relaxed);
+    table.hit_counter.add();
+    return entry->handle;
+  }
+  table.misses.fetch_add(1, std::memory_order_relaxed);
+  table.miss_counter.add();
+  uint64_t handle = 0;
+  VkResult result = create(handle);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create the cached object: {}!",
+                  result_name(result));
+    return 0;
+  }
+  Entry entry = {key.to_vector(), handle, {}};
+  for (uint32_t i = 0; i < dependency_count; ++i) {
+    entry.dependencies.push_back(reinterpret_cast<uint64_t>(dependencies[i]));
+  }
+  table.entries.emplace(key.hash(), std::move(entry));
+  return handle;
+}
+
+auto gfx::vk_api::ObjectCache::evict_(Table& table,
+                                      const std::vector<uint64_t>& handles)
+    -> std::vector<uint64_t>
+{
+  std::vector<uint64_t> evicted;
+  std::unique_lock<std::shared_mutex> lock(table.mutex);
+  // Eviction follows resizes and streaming, a scan is cheap enough.
+  for (auto it = table.entries.begin(); it != table.entries.end();) {
+    const std::vector<uint64_t>& dependencies = it->second.dependencies;
+    bool depends = std::any_of(
+        dependencies.begin(), dependencies.end(), [&](uint64_t dependency) {
+          return std::find(handles.begin(), handles.end(), dependency) !=
+                 handles.end();
+        });
+    if (depends) {
+      destroy_(table.type, it->second.handle);
+      evicted.push_back(it->second.handle);
+      it = table.entries.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  table.evictions += evicted.size();
+  return evicted;
+}
+
+auto gfx::vk_api::ObjectCache::destroy_(VkObjectType type, uint64_t handle)
+    -> void
+{
+  DeletionQueue& deletion_queue = *functions_.deletion_queue;
+  switch (type) {
+    case VK_OBJECT_TYPE_RENDER_PASS:
+      deletion_queue.destroy(reinterpret_cast<VkRenderPass>(handle));
+      break;
+    case VK_OBJECT_TYPE_FRAMEBUFFER:
+      deletion_queue.destroy(reinterpret_cast<VkFramebuffer>(handle));
+      break;
+    case VK_OBJECT_TYPE_IMAGE_VIEW:
+      deletion_queue.destroy(reinterpret_cast<VkImageView>(handle));
+      break;
+    case VK_OBJECT_TYPE_SAMPLER:
+      deletion_queue.destroy(reinterpret_cast<VkSampler>(handle));
+      break;
+    default:
+      break;
+  }
+}
+
+auto gfx::vk_api::ObjectCache::kind_stats_(const Table& table) const
+    -> ObjectCacheKindStats
+{
+  std::shared_lock<std::shared_mutex> lock(table.mutex);
+  return {table.hits.load(std::memory_order_relaxed),
+          table.misses.load(std::memory_order_relaxed), table.evictions,
+          table.entries.size()};
+}
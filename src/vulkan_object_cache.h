@@ -0,0 +1,178 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <shared_mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "metrics.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+struct ObjectCacheKindStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t live;
+};
+
+struct ObjectCacheStats {
+  ObjectCacheKindStats render_passes;
+  ObjectCacheKindStats framebuffers;
+  ObjectCacheKindStats image_views;
+  ObjectCacheKindStats samplers;
+};
+
+// ************************************************************ //
+// ObjectCache                                                  //
+//                                                              //
+// Render passes, framebuffers, image views and samplers are    //
+// immutable, identical create infos give interchangeable       //
+// objects. The cache creates each distinct one once, keyed by  //
+// the contents of its create info, and owns it until the       //
+// device is destroyed or the object is evicted. Evicting an    //
+// image evicts its views, evicting a view the framebuffers     //
+// using it. Evicted objects go through the deletion queue, the //
+// frames in flight may still use them. Lookups take a shared   //
+// lock, only misses and evictions are exclusive, and do not    //
+// allocate unless the create info is unusually large. Hits and //
+// misses are counted in the metrics as vk.cache.*.             //
+// ************************************************************ //
+class ObjectCache {
+ public:
+  explicit ObjectCache(const VulkanDevice& device);
+  ~ObjectCache();
+
+  ObjectCache(const ObjectCache&) = delete;
+  ObjectCache& operator=(const ObjectCache&) = delete;
+
+  // Return VK_NULL_HANDLE if the creation failed. Create infos with a pNext
+  // chain cannot be keyed, they return VK_NULL_HANDLE too.
+  auto render_pass(const VkRenderPassCreateInfo& create_info) -> VkRenderPass;
+  auto framebuffer(const VkFramebufferCreateInfo& create_info)
+      -> VkFramebuffer;
+  auto image_view(const VkImageViewCreateInfo& create_info) -> VkImageView;
+  auto sampler(const VkSamplerCreateInfo& create_info) -> VkSampler;
+
+  // Called before the image is destroyed, e.g. by a swap chain recreation.
+  auto evict_image(VkImage image) -> void;
+  // Called before a view the cache does not own is destroyed.
+  auto evict_image_view(VkImageView view) -> void;
+  auto clear() -> void;
+
+  auto stats() const -> ObjectCacheStats;
+
+ private:
+  // Words of a create info, hashed as they are appended. Small keys stay
+  // on the stack, larger ones spill to the heap.
+  class Key {
+   public:
+    Key() : inline_words_{}, size_(0), hash_(0xcbf29ce484222325ull) {}
+
+    // For types without padding only, so that every byte of the key is
+    // defined.
+    template <typename T>
+    auto append(const T* values, uint32_t count) -> void
+    {
+      static_assert(std::is_trivially_copyable_v<T> &&
+                        sizeof(T) % sizeof(uint32_t) == 0,
+                    "Keys are made of whole words.");
+      for (uint32_t i = 0; i < count; ++i) {
+        uint32_t words[sizeof(T) / sizeof(uint32_t)];
+        memcpy(words, &values[i], sizeof(T));
+        for (uint32_t word : words) {
+          append_word_(word);
+        }
+      }
+    }
+    template <typename T>
+    auto append(const T& value) -> void
+    {
+      append(&value, 1);
+    }
+    // Optional arrays are keyed by their presence, then their contents.
+    template <typename T>
+    auto append_optional(const T* values, uint32_t count) -> void
+    {
+      append(static_cast<uint32_t>(values != nullptr));
+      if (values != nullptr) {
+        append(values, count);
+      }
+    }
+
+    auto hash() const -> uint64_t { return hash_; }
+    auto equals(const std::vector<uint32_t>& words) const -> bool;
+    auto to_vector() const -> std::vector<uint32_t>;
+
+   private:
+    static constexpr uint32_t INLINE_WORDS = 128;
+
+    auto append_word_(uint32_t word) -> void;
+    auto data_() const -> const uint32_t*;
+
+    std::array<uint32_t, INLINE_WORDS> inline_words_;
+    std::vector<uint32_t> spilled_words_;
+    size_t size_;
+    // 64 bits FNV-1a of the words.
+    uint64_t hash_;
+  };
+
+  struct Entry {
+    std::vector<uint32_t> key;
+    uint64_t handle;
+    // Objects whose eviction evicts this one.
+    std::vector<uint64_t> dependencies;
+  };
+
+  // Identity, the keys are hashed already.
+  struct KeyHash {
+    auto operator()(uint64_t hash) const -> size_t
+    {
+      return static_cast<size_t>(hash);
+    }
+  };
+
+  struct Table {
+    Table(const char* name, VkObjectType type);
+
+    mutable std::shared_mutex mutex;
+    // By key hash, the colliding keys are told apart by their words.
+    std::unordered_multimap<uint64_t, Entry, KeyHash> entries;
+    VkObjectType type;
+    Counter hit_counter;
+    Counter miss_counter;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    uint64_t evictions;
+  };
+
+  // Null if the table has no entry with the key.
+  static auto find_(const Table& table, const Key& key) -> const Entry*;
+  // create(uint64_t& handle) -> VkResult runs on a miss only, and the
+  // dependencies are only copied then.
+  template <typename Dependency, typename Create>
+  auto find_or_create_(Table& table, const Key& key,
+                       const Dependency* dependencies,
+                       uint32_t dependency_count, Create create) -> uint64_t;
+  // Evicts the entries depending on any of the handles, returns the handles
+  // evicted.
+  auto evict_(Table& table, const std::vector<uint64_t>& handles)
+      -> std::vector<uint64_t>;
+  auto destroy_(VkObjectType type, uint64_t handle) -> void;
+  auto kind_stats_(const Table& table) const -> ObjectCacheKindStats;
+
+  VkDevice device_;
+  VulkanDevice functions_;
+
+  Table render_passes_;
+  Table framebuffers_;
+  Table image_views_;
+  Table samplers_;
+};
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,408 @@
+#include "vulkan_recovery.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+#include "host_allocator.h"
+#include "log.h"
+#include "metrics.h"
+#include "vulkan_builders.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_startup.h"
+#include "vulkan_sync.h"
+
+auto gfx::vk_api::DeviceResources::add(Release release, Restore restore)
+    -> uint64_t
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t id = next_id_++;
+  resources_.push_back({id, std::move(release), std::move(restore)});
+  return id;
+}
+
+auto gfx::vk_api::DeviceResources::remove(uint64_t id) -> void
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  resources_.erase(std::remove_if(resources_.begin(), resources_.end(),
+                                  [id](const Resource& resource) {
+                                    return resource.id == id;
+                                  }),
+                   resources_.end());
+}
+
+auto gfx::vk_api::DeviceResources::release(VulkanDevice& device) -> void
+{
+  std::vector<Resource> resources = snapshot_();
+  for (auto it = resources.rbegin(); it != resources.rend(); ++it) {
+    it->release(device);
+  }
+}
+
+auto gfx::vk_api::DeviceResources::restore(VulkanDevice& device) -> VkResult
+{
+  for (const Resource& resource : snapshot_()) {
+    VkResult result = resource.restore(device);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+  }
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::DeviceResources::count() const -> size_t
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return resources_.size();
+}
+
+auto gfx::vk_api::DeviceResources::snapshot_() const -> std::vector<Resource>
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return resources_;
+}
+
+gfx::vk_api::ResidentBuffer::ResidentBuffer(VulkanDevice& device,
+                                            VkBufferUsageFlags usage,
+                                            VkMemoryPropertyFlags required,
+                                            const void* data,
+                                            VkDeviceSize size)
+    : device_(device),
+      usage_(usage),
+      required_(required),
+      contents_(static_cast<const std::byte*>(data),
+                static_cast<const std::byte*>(data) + size),
+      buffer_{},
+      staging_{},
+      next_slot_(0),
+      resource_id_(0)
+{
+  // Device local buffers are written by copies.
+  if (!(required_ & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+    usage_ |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  }
+}
+
+auto gfx::vk_api::ResidentBuffer::create(
+    VulkanDevice& device, VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags required, const void* data, VkDeviceSize size,
+    std::unique_ptr<ResidentBuffer>& buffer) -> VkResult
+{
+  std::unique_ptr<ResidentBuffer> resident(
+      new ResidentBuffer(device, usage, required, data, size));
+  VkResult result = resident->create_();
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create resident buffer: {}!",
+                  result_name(result));
+    return result;
+  }
+  // Registered once created, recovery only restores complete buffers.
+  ResidentBuffer* self = resident.get();
+  self->resource_id_ = device.resources->add(
+      [self](VulkanDevice&) { self->release_(); },
+      [self](VulkanDevice&) { return self->create_(); });
+  buffer = std::move(resident);
+  return VK_SUCCESS;
+}
+
+gfx::vk_api::ResidentBuffer::~ResidentBuffer()
+{
+  if (resource_id_ != 0) {
+    device_.resources->remove(resource_id_);
+  }
+  // The last copies may still run, the deletion queue waits for them.
+  if (buffer_.buffer != VK_NULL_HANDLE) {
+    destroy_buffer(device_, buffer_);
+  }
+  for (StagingSlot& slot : staging_) {
+    if (slot.buffer.buffer != VK_NULL_HANDLE) {
+      destroy_buffer(device_, slot.buffer);
+    }
+    device_.deletion_queue->destroy(slot.pool);
+  }
+}
+
+auto gfx::vk_api::ResidentBuffer::buffer() const -> const Buffer&
+{
+  return buffer_;
+}
+
+auto gfx::vk_api::ResidentBuffer::write(VkDeviceSize offset, const void* data,
+                                        VkDeviceSize size) -> VkResult
+{
+  if (offset > contents_.size() || size > contents_.size() - offset) {
+    GFX_LOG_ERROR("Resident buffer write of {} bytes at {} is past its {} "
+                  "bytes!",
+                  size, offset, contents_.size());
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  memcpy(contents_.data() + offset, data, size);
+  return upload_(offset, size);
+}
+
+auto gfx::vk_api::ResidentBuffer::create_() -> VkResult
+{
+  VkResult result = create_buffer(device_, contents_.size(), usage_,
+                                  required_, 0, false, buffer_);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  return upload_(0, contents_.size());
+}
+
+auto gfx::vk_api::ResidentBuffer::release_() -> void
+{
+  // The lost device frees the memory, nothing waits on it any more.
+  auto destroy = [this](Buffer& buffer) {
+    device_.vkDestroyBuffer(device_.logical_device, buffer.buffer,
+                            allocation_callbacks());
+    device_.vkFreeMemory(device_.logical_device, buffer.memory,
+                         allocation_callbacks());
+    buffer = {};
+  };
+  destroy(buffer_);
+  for (StagingSlot& slot : staging_) {
+    destroy(slot.buffer);
+    device_.vkDestroyCommandPool(device_.logical_device, slot.pool,
+                                 allocation_callbacks());
+    slot = {};
+  }
+  next_slot_ = 0;
+}
+
+auto gfx::vk_api::ResidentBuffer::upload_(VkDeviceSize offset,
+                                          VkDeviceSize size) -> VkResult
+{
+  if (size == 0) {
+    return VK_SUCCESS;
+  }
+  if (buffer_.mapped != nullptr) {
+    memcpy(static_cast<std::byte*>(buffer_.mapped) + offset,
+           contents_.data() + offset, size);
+    return VK_SUCCESS;
+  }
+
+  StagingSlot& slot = staging_[next_slot_];
+  VkResult result = prepare_slot_(slot, size);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  next_slot_ = (next_slot_ + 1) % STAGING_SLOTS;
+  memcpy(slot.buffer.mapped, contents_.data() + offset, size);
+
+  VkCommandBufferBeginInfo begin_info = build<VkCommandBufferBeginInfo>().set(
+      &VkCommandBufferBeginInfo::flags,
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  result = device_.vkBeginCommandBuffer(slot.command_buffer, &begin_info);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+  // The work submitted before may still read the range: the copy waits for
+  // it, and the work submitted after waits for the copy.
+  VkMemoryBarrier before_copy = build<VkMemoryBarrier>().set(
+      &VkMemoryBarrier::dstAccessMask, VK_ACCESS_TRANSFER_WRITE_BIT);
+  device_.vkCmdPipelineBarrier(slot.command_buffer,
+                               VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                               &before_copy, 0, nullptr, 0, nullptr);
+  VkBufferCopy copy = {0, offset, size};
+  device_.vkCmdCopyBuffer(slot.command_buffer, slot.buffer.buffer,
+                          buffer_.buffer, 1, &copy);
+  VkMemoryBarrier after_copy =
+      build<VkMemoryBarrier>()
+          .set(&VkMemoryBarrier::srcAccessMask, VK_ACCESS_TRANSFER_WRITE_BIT)
+          .set(&VkMemoryBarrier::dstAccessMask,
+               VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT);
+  device_.vkCmdPipelineBarrier(slot.command_buffer,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1,
+                               &after_copy, 0, nullptr, 0, nullptr);
+  result = device_.vkEndCommandBuffer(slot.command_buffer);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkSubmitInfo submit_info =
+      build<VkSubmitInfo>()
+          .set(&VkSubmitInfo::commandBufferCount, 1)
+          .set(&VkSubmitInfo::pCommandBuffers, &slot.command_buffer);
+  QueueTimeline& timeline = *device_.graphics_timeline;
+  slot.value = timeline.submit(&submit_info, 1, VK_NULL_HANDLE, &result);
+  return result;
+}
+
+auto gfx::vk_api::ResidentBuffer::prepare_slot_(StagingSlot& slot,
+                                                VkDeviceSize size)
+    -> VkResult
+{
+  // This only blocks when the writes run STAGING_SLOTS copies ahead of the
+  // GPU.
+  QueueTimeline& timeline = *device_.graphics_timeline;
+  if (slot.value != 0 && !timeline.wait_until(slot.value)) {
+    return timeline.device_lost() ? VK_ERROR_DEVICE_LOST
+                                  : VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+
+  VkResult result;
+  if (slot.pool == VK_NULL_HANDLE) {
+    VkCommandPoolCreateInfo pool_create_info =
+        build<VkCommandPoolCreateInfo>()
+            .set(&VkCommandPoolCreateInfo::flags,
+                 VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)
+            .set(&VkCommandPoolCreateInfo::queueFamilyIndex,
+                 device_.graphics_family);
+    result = device_.vkCreateCommandPool(device_.logical_device,
+                                         &pool_create_info,
+                                         allocation_callbacks(), &slot.pool);
+    if (result != VK_SUCCESS) {
+      slot.pool = VK_NULL_HANDLE;
+      return result;
+    }
+    VkCommandBufferAllocateInfo allocate_info =
+        build<VkCommandBufferAllocateInfo>()
+            .set(&VkCommandBufferAllocateInfo::commandPool, slot.pool)
+            .set(&VkCommandBufferAllocateInfo::level,
+                 VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+            .set(&VkCommandBufferAllocateInfo::commandBufferCount, 1);
+    result = device_.vkAllocateCommandBuffers(
+        device_.logical_device, &allocate_info, &slot.command_buffer);
+    if (result != VK_SUCCESS) {
+      device_.vkDestroyCommandPool(device_.logical_device, slot.pool,
+                                   allocation_callbacks());
+      slot.pool = VK_NULL_HANDLE;
+      return result;
+    }
+  } else {
+    result = device_.vkResetCommandPool(device_.logical_device, slot.pool, 0);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+  }
+
+  if (slot.buffer.size < size) {
+    if (slot.buffer.buffer != VK_NULL_HANDLE) {
+      destroy_buffer(device_, slot.buffer);
+    }
+    result = create_buffer(device_, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           0, false, slot.buffer);
+  }
+  return result;
+}
+
+namespace gfx::vk_api {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Time elapsed since the previous stage ended.
+auto end_stage(Clock::time_point& stage_start) -> double
+{
+  auto now = Clock::now();
+  std::chrono::duration<double, std::milli> elapsed = now - stage_start;
+  stage_start = now;
+  return elapsed.count();
+}
+
+auto record_recovery(Histogram& recovery_time, Counter& recoveries,
+                     Clock::time_point start, RecoveryTimings& stages,
+                     RecoveryTimings* timings) -> void
+{
+  auto elapsed = Clock::now() - start;
+  stages.total_ms =
+      std::chrono::duration<double, std::milli>(elapsed).count();
+  recoveries.add();
+  recovery_time.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  GFX_LOG_INFO("Recovered in {} ms.", stages.total_ms);
+  if (timings != nullptr) {
+    *timings = stages;
+  }
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::recover_device(VulkanDevice& device,
+                                 RecoveryTimings* timings) -> VkResult
+{
+  RecoveryTimings stages = {};
+  auto start = Clock::now();
+  auto stage_start = start;
+  GFX_LOG_WARNING("Recovering from {}.", result_name(VK_ERROR_DEVICE_LOST));
+
+  std::shared_ptr<DeviceResources> resources = device.resources;
+  if (resources) {
+    resources->release(device);
+  }
+  destroy_logical_device(device);
+  stages.teardown_ms = end_stage(stage_start);
+
+  // Same physical device and queue families, the objects restored expect
+  // its memory types and the surfaces were checked against its present
+  // queue.
+  PhysicalDeviceInfo physical_device;
+  if (!physical_device_info(device.physical_device, physical_device)) {
+    GFX_LOG_ERROR("The physical device of the lost device is gone!");
+    return VK_ERROR_DEVICE_LOST;
+  }
+  QueueFamilyIndices indices = {};
+  indices.graphics_family = device.graphics_family;
+  indices.present_family = device.present_family;
+  if (device.compute_family != device.graphics_family) {
+    indices.compute_family = device.compute_family;
+  }
+  VkResult result = create_logical_device(device, physical_device, indices,
+                                          device.presentable);
+  stages.device_ms = end_stage(stage_start);
+  if (result == VK_SUCCESS && resources) {
+    // Surfaces are registered, their swap chains come back with them.
+    result = resources->restore(device);
+    stages.resources_ms = end_stage(stage_start);
+    if (result != VK_SUCCESS) {
+      // Releasing is a no-op for the objects that were not restored.
+      resources->release(device);
+      destroy_logical_device(device);
+    }
+  }
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Device recovery failed: {}!", result_name(result));
+    return result;
+  }
+  static Histogram recovery_time = register_histogram("vk.device_recovery");
+  static Counter recoveries = register_counter("vk.device_recoveries");
+  record_recovery(recovery_time, recoveries, start, stages, timings);
+  return VK_SUCCESS;
+}
+
+auto gfx::vk_api::recover_surface(VulkanDevice& device, Surface& surface,
+                                  RecoveryTimings* timings) -> VkResult
+{
+  RecoveryTimings stages = {};
+  auto start = Clock::now();
+  auto stage_start = start;
+  GFX_LOG_WARNING("Recovering from {}.",
+                  result_name(VK_ERROR_SURFACE_LOST_KHR));
+
+  // The device and the other surfaces outlive it.
+  os::WindowParameters window = surface.window;
+  destroy_surface(device, surface);
+  stages.teardown_ms = end_stage(stage_start);
+
+  VkResult result = create_surface(device, window, surface);
+  if (result == VK_SUCCESS) {
+    result = create_surface_swap_chain(device, surface);
+  }
+  stages.swap_chain_ms = end_stage(stage_start);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Surface recovery failed: {}!", result_name(result));
+    return result;
+  }
+  // Kept apart from the device recoveries, which cost far more.
+  static Histogram recovery_time = register_histogram("vk.surface_recovery");
+  static Counter recoveries = register_counter("vk.surface_recoveries");
+  record_recovery(recovery_time, recoveries, start, stages, timings);
+  return VK_SUCCESS;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// ************************************************************ //
+// Device recovery                                              //
+//                                                              //
+// A lost device cannot be used any more, every object created  //
+// from it is gone with it. Recovery destroys what is left,     //
+// creates the logical device again on the same physical device //
+// into the same VulkanDevice, and restores the objects         //
+// registered with the device resources, the surfaces with      //
+// their swap chains and the buffers from the CPU copies they   //
+// keep. Users holding the VulkanDevice by reference see the    //
+// new handles. A lost surface takes nothing else with it.      //
+// ************************************************************ //
+
+// Objects the device creates again once recovered. Release destroys the
+// object with the lost device still loaded, restore creates it on the new
+// one. Objects are released in the reverse order of their registration and
+// restored in order.
+class DeviceResources {
+ public:
+  using Release = std::function<void(VulkanDevice&)>;
+  using Restore = std::function<VkResult(VulkanDevice&)>;
+
+  // Returns the id removing the object.
+  auto add(Release release, Restore restore) -> uint64_t;
+  auto remove(uint64_t id) -> void;
+  auto release(VulkanDevice& device) -> void;
+  // Stops at the first object that fails, returns its result.
+  auto restore(VulkanDevice& device) -> VkResult;
+  auto count() const -> size_t;
+
+ private:
+  struct Resource {
+    uint64_t id;
+    Release release;
+    Restore restore;
+  };
+
+  // The callbacks run on a copy, they may add and remove objects.
+  auto snapshot_() const -> std::vector<Resource>;
+
+  mutable std::mutex mutex_;
+  uint64_t next_id_ = 1;
+  std::vector<Resource> resources_;
+};
+
+// Buffer whose contents live on the CPU as well, uploaded again once the
+// device is recovered. Host visible buffers are written in place, the
+// caller keeps the GPU from reading a range while it is written. Device
+// local ones are written by copies from a ring of staging slots submitted on
+// the graphics timeline: a copy runs after the work submitted before it and
+// before the work submitted after it, so writes neither wait for the copy
+// nor overwrite data earlier submissions still read. A slot keeps its
+// command pool and the largest staging buffer it needed, and is reused once
+// its last copy retired.
+class ResidentBuffer {
+ public:
+  // A device local write only blocks when the copy of the write this many
+  // writes before has not retired yet.
+  static constexpr uint32_t STAGING_SLOTS = 3;
+
+  // Returns the result of creating or uploading the buffer, buffer is only
+  // set on success.
+  static auto create(VulkanDevice& device, VkBufferUsageFlags usage,
+                     VkMemoryPropertyFlags required, const void* data,
+                     VkDeviceSize size, std::unique_ptr<ResidentBuffer>& buffer)
+      -> VkResult;
+  ~ResidentBuffer();
+
+  ResidentBuffer(const ResidentBuffer&) = delete;
+  ResidentBuffer& operator=(const ResidentBuffer&) = delete;
+
+  auto buffer() const -> const Buffer&;
+  // Updates the copy and the buffer. Returns VK_ERROR_OUT_OF_DEVICE_MEMORY,
+  // changing nothing, when the range is not in the buffer.
+  auto write(VkDeviceSize offset, const void* data, VkDeviceSize size)
+      -> VkResult;
+
+ private:
+  struct StagingSlot {
+    Buffer buffer;
+    VkCommandPool pool;
+    VkCommandBuffer command_buffer;
+    // Graphics timeline value of the slot's last copy, 0 before the first.
+    uint64_t value;
+  };
+
+  ResidentBuffer(VulkanDevice& device, VkBufferUsageFlags usage,
+                 VkMemoryPropertyFlags required, const void* data,
+                 VkDeviceSize size);
+
+  auto create_() -> VkResult;
+  // Destroys the buffer and the staging slots at once, for a lost device.
+  auto release_() -> void;
+  auto upload_(VkDeviceSize offset, VkDeviceSize size) -> VkResult;
+  // Waits for the slot's last copy and makes room for size bytes.
+  auto prepare_slot_(StagingSlot& slot, VkDeviceSize size) -> VkResult;
+
+  VulkanDevice& device_;
+  VkBufferUsageFlags usage_;
+  VkMemoryPropertyFlags required_;
+  std::vector<std::byte> contents_;
+  Buffer buffer_;
+  StagingSlot staging_[STAGING_SLOTS];
+  uint32_t next_slot_;
+  uint64_t resource_id_;
+};
+
+struct RecoveryTimings {
+  // Releasing the objects and destroying the lost device.
+  double teardown_ms;
+  double device_ms;
+  // Surface recoveries only, a device recovery restores the swap chains with
+  // the other objects, in resources_ms.
+  double swap_chain_ms;
+  // Restoring the registered objects.
+  double resources_ms;
+  double total_ms;
+};
+
+// Recovers from VK_ERROR_DEVICE_LOST, the surfaces of the device get their
+// semaphores and swap chains back with the other registered objects.
+// Returns the result of the step that failed, the device is then left
+// destroyed, with the objects a failed restore did bring back released
+// again.
+auto recover_device(VulkanDevice& device, RecoveryTimings* timings = nullptr)
+    -> VkResult;
+// Recovers from VK_ERROR_SURFACE_LOST_KHR, only the surface and its swap
+// chain are created again.
+auto recover_surface(VulkanDevice& device, Surface& surface,
+                     RecoveryTimings* timings = nullptr) -> VkResult;
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,212 @@
+#include "vulkan_startup.h"
+#include <cstring>
+#include <future>
+#include <iomanip>
+#include <mutex>
+#include "frame_arena.h"
+#include "log.h"
+#include "vulkan_api.h"
+#include "vulkan_builders.h"
+
+namespace gfx::vk_api {
+
+namespace {
+
+std::mutex SNAPSHOT_MUTEX;
+std::future<void> SNAPSHOT_TASK;
+VkInstance SNAPSHOT_INSTANCE;
+PhysicalDeviceSnapshot SNAPSHOT;
+StartupTimings TIMINGS;
+
+auto query_physical_device(VkPhysicalDevice device) -> PhysicalDeviceInfo
+{
+  PhysicalDeviceInfo info = {};
+  StartupTimer timer(info.query_ms);
+  info.handle = device;
+  vkGetPhysicalDeviceProperties(device, &info.properties);
+  vkGetPhysicalDeviceFeatures(device, &info.features);
+  vkGetPhysicalDeviceMemoryProperties(device, &info.memory_properties);
+
+  uint32_t queue_family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count,
+                                           nullptr);
+  info.queue_families.resize(queue_family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count,
+                                           info.queue_families.data());
+
+  uint32_t extension_count = 0;
+  if (vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                           nullptr) == VK_SUCCESS) {
+    info.extensions.resize(extension_count);
+    if (vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                             info.extensions.data()) !=
+        VK_SUCCESS) {
+      info.extensions.clear();
+    }
+  }
+
+  // Extension features are reported through the properties2 extension,
+  // enabling one the device does not report is invalid.
+  if (vkGetPhysicalDeviceFeatures2KHR != nullptr &&
+      info.supports_extension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+    auto timeline_features =
+        make_struct<VkPhysicalDeviceTimelineSemaphoreFeaturesKHR>();
+    VkPhysicalDeviceFeatures2 features =
+        build<VkPhysicalDeviceFeatures2>().next(timeline_features);
+    vkGetPhysicalDeviceFeatures2KHR(device, &features);
+    info.timeline_semaphore = timeline_features.timelineSemaphore == VK_TRUE;
+  }
+  return info;
+}
+
+auto build_snapshot() -> void
+{
+  ArenaScope scratch;
+  ScratchVector<VkPhysicalDevice> devices(&frame_arena());
+  {
+    StartupTimer timer(TIMINGS.device_enumeration_ms);
+    uint32_t device_count = 0;
+    if (vkEnumeratePhysicalDevices(SNAPSHOT_INSTANCE, &device_count,
+                                   nullptr) != VK_SUCCESS) {
+      GFX_LOG_ERROR("Error occurred during physical devices enumeration!");
+      return;
+    }
+    devices.resize(device_count);
+    if (vkEnumeratePhysicalDevices(SNAPSHOT_INSTANCE, &device_count,
+                                   devices.data()) != VK_SUCCESS) {
+      GFX_LOG_ERROR("Error occurred during physical devices enumeration!");
+      return;
+    }
+    devices.resize(device_count);
+  }
+  if (devices.empty()) {
+    return;
+  }
+
+  StartupTimer timer(TIMINGS.device_queries_ms);
+  // Physical device queries need no external synchronization, every device
+  // but the first is queried on its own worker.
+  std::vector<std::future<PhysicalDeviceInfo>> workers;
+  workers.reserve(devices.size() - 1);
+  for (size_t i = 1; i < devices.size(); ++i) {
+    workers.push_back(
+        std::async(std::launch::async, query_physical_device, devices[i]));
+  }
+  SNAPSHOT.devices.reserve(devices.size());
+  SNAPSHOT.devices.push_back(query_physical_device(devices[0]));
+  for (auto& worker : workers) {
+    SNAPSHOT.devices.push_back(worker.get());
+  }
+  for (const auto& device : SNAPSHOT.devices) {
+    TIMINGS.device_queries_serial_ms += device.query_ms;
+  }
+}
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+auto gfx::vk_api::PhysicalDeviceInfo::supports_extension(
+    const char* extension_name) const -> bool
+{
+  for (const auto& extension : extensions) {
+    if (strcmp(extension.extensionName, extension_name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+auto gfx::vk_api::PhysicalDeviceSnapshot::find(VkPhysicalDevice device) const
+    -> const PhysicalDeviceInfo*
+{
+  for (const auto& info : devices) {
+    if (info.handle == device) {
+      return &info;
+    }
+  }
+  return nullptr;
+}
+
+auto gfx::vk_api::begin_physical_device_snapshot(VkInstance instance) -> void
+{
+  std::lock_guard<std::mutex> lock(SNAPSHOT_MUTEX);
+  if (SNAPSHOT_TASK.valid() || !SNAPSHOT.devices.empty()) {
+    return;
+  }
+  SNAPSHOT_INSTANCE = instance;
+  SNAPSHOT_TASK = std::async(std::launch::async, build_snapshot);
+}
+
+auto gfx::vk_api::physical_device_snapshot() -> const PhysicalDeviceSnapshot&
+{
+  std::lock_guard<std::mutex> lock(SNAPSHOT_MUTEX);
+  if (SNAPSHOT_TASK.valid()) {
+    StartupTimer timer(TIMINGS.snapshot_wait_ms);
+    SNAPSHOT_TASK.get();
+  }
+  return SNAPSHOT;
+}
+
+auto gfx::vk_api::physical_device_info(VkPhysicalDevice device,
+                                       PhysicalDeviceInfo& info) -> bool
+{
+  std::lock_guard<std::mutex> lock(SNAPSHOT_MUTEX);
+  if (SNAPSHOT_TASK.valid()) {
+    StartupTimer timer(TIMINGS.snapshot_wait_ms);
+    SNAPSHOT_TASK.get();
+  }
+  const PhysicalDeviceInfo* found = SNAPSHOT.find(device);
+  if (found == nullptr) {
+    return false;
+  }
+  info = *found;
+  return true;
+}
+
+auto gfx::vk_api::release_physical_device_snapshot() -> void
+{
+  std::lock_guard<std::mutex> lock(SNAPSHOT_MUTEX);
+  if (SNAPSHOT_TASK.valid()) {
+    SNAPSHOT_TASK.get();
+  }
+  SNAPSHOT.devices.clear();
+}
+
+auto gfx::vk_api::startup_timings() -> StartupTimings& { return TIMINGS; }
+
+auto gfx::vk_api::print_startup_timings(std::ostream& out) -> void
+{
+  const StartupTimings& t = TIMINGS;
+  double serial_total = t.library_load_ms + t.instance_extensions_ms +
+                        t.instance_creation_ms + t.entry_points_ms +
+                        t.device_enumeration_ms + t.device_queries_serial_ms +
+                        t.surface_creation_ms + t.device_selection_ms +
+                        t.device_creation_ms;
+  // Only the part of the snapshot create_device waited for is on the critical
+  // path.
+  double critical_path = t.library_load_ms + t.instance_extensions_ms +
+                         t.instance_creation_ms + t.entry_points_ms +
+                         t.snapshot_wait_ms + t.surface_creation_ms +
+                         t.device_selection_ms + t.device_creation_ms;
+
+  auto line = [&out](const char* name, double ms) {
+    out << "  " << std::left << std::setw(28) << name << std::right
+        << std::setw(10) << std::fixed << std::setprecision(3) << ms
+        << " ms\n";
+  };
+  out << "Startup timings:\n";
+  line("library load", t.library_load_ms);
+  line("instance extensions", t.instance_extensions_ms);
+  line("instance creation", t.instance_creation_ms);
+  line("entry points", t.entry_points_ms);
+  line("device enumeration", t.device_enumeration_ms);
+  line("device queries", t.device_queries_ms);
+  line("device queries (serial)", t.device_queries_serial_ms);
+  line("snapshot wait", t.snapshot_wait_ms);
+  line("surface creation", t.surface_creation_ms);
+  line("device selection", t.device_selection_ms);
+  line("device creation", t.device_creation_ms);
+  line("serial startup", serial_total);
+  line("critical path", critical_path);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include "vulkan_ext.h"
+
+namespace gfx::vk_api {
+
+// Everything the device selection needs to know about a physical device,
+// queried once.
+struct PhysicalDeviceInfo {
+  VkPhysicalDevice handle;
+  VkPhysicalDeviceProperties properties;
+  VkPhysicalDeviceFeatures features;
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  std::vector<VkQueueFamilyProperties> queue_families;
+  std::vector<VkExtensionProperties> extensions;
+  // The timelineSemaphore feature of VK_KHR_timeline_semaphore, false when
+  // the extension is missing or its features cannot be queried.
+  bool timeline_semaphore;
+  // Time spent querying this device.
+  double query_ms;
+
+  auto supports_extension(const char* extension_name) const -> bool;
+};
+
+struct PhysicalDeviceSnapshot {
+  std::vector<PhysicalDeviceInfo> devices;
+
+  auto find(VkPhysicalDevice device) const -> const PhysicalDeviceInfo*;
+};
+
+// Wall clock time of each startup step, in milliseconds.
+struct StartupTimings {
+  double library_load_ms;
+  double instance_extensions_ms;
+  double instance_creation_ms;
+  double entry_points_ms;
+  double device_enumeration_ms;
+  // Wall time of the device queries, and what they would take run serially.
+  double device_queries_ms;
+  double device_queries_serial_ms;
+  // Time create_device blocked on the snapshot. The rest of the snapshot was
+  // hidden behind the work done between initialize() and create_device().
+  double snapshot_wait_ms;
+  double surface_creation_ms;
+  double device_selection_ms;
+  double device_creation_ms;
+};
+
+// ************************************************************ //
+// Physical device snapshot                                     //
+//                                                              //
+// Physical devices are enumerated in the background as soon    //
+// as the instance exists, and each one is queried for its      //
+// properties, features, queue families and extensions on its   //
+// own worker. The results are kept for the instance lifetime   //
+// so nothing is queried twice.                                 //
+// ************************************************************ //
+auto begin_physical_device_snapshot(VkInstance instance) -> void;
+// Blocks until the snapshot is ready. The reference is only valid until
+// release_physical_device_snapshot(), which destroy() calls; keep it for
+// the startup steps alone.
+auto physical_device_snapshot() -> const PhysicalDeviceSnapshot&;
+// Copies the info of a device of the snapshot, for users outside startup.
+// Returns false when the snapshot does not have it, or was released.
+auto physical_device_info(VkPhysicalDevice device, PhysicalDeviceInfo& info)
+    -> bool;
+// Waits for the background queries and drops the snapshot, before the
+// instance is destroyed.
+auto release_physical_device_snapshot() -> void;
+
+auto startup_timings() -> StartupTimings&;
+auto print_startup_timings(std::ostream& out) -> void;
+
+// Adds the lifetime of the scope to a startup timing.
+class StartupTimer {
+ public:
+  explicit StartupTimer(double& target)
+      : target_(target), start_(std::chrono::steady_clock::now())
+  {
+  }
+  ~StartupTimer()
+  {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    target_ += elapsed.count();
+  }
+
+  StartupTimer(const StartupTimer&) = delete;
+  StartupTimer& operator=(const StartupTimer&) = delete;
+
+ private:
+  double& target_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace gfx::vk_api
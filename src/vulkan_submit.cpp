@@ -0,0 +1,353 @@
+#include "vulkan_submit.h"
+#include <algorithm>
+#include <thread>
+#include "frame_arena.h"
+#include "log.h"
+#include "vulkan_builders.h"
+#include "vulkan_sync.h"
+
+namespace gfx::vk_api {
+
+namespace {
+
+constexpr uint32_t BANK_BIT = 0x80000000u;
+constexpr uint32_t COUNT_MASK = ~BANK_BIT;
+
+}  // namespace
+
+}  // namespace gfx::vk_api
+
+gfx::vk_api::SubmitAggregator::SubmitAggregator(VulkanDevice& device,
+                                                uint32_t requests_per_frame)
+    : vkQueueSubmit_(device.vkQueueSubmit),
+      timeline_queue_(VK_NULL_HANDLE),
+      state_(0),
+      last_requests_(0),
+      last_batches_(0),
+      last_queue_submits_(0),
+      last_failed_submits_(0),
+      last_result_(VK_SUCCESS),
+      requests_metric_(
+          register_histogram("submit.requests", MetricUnit::none)),
+      queue_submits_metric_(
+          register_histogram("submit.queue_submits", MetricUnit::none))
+{
+  for (Bank& bank : banks_) {
+    bank.nodes.reserve(requests_per_frame);
+    for (uint32_t i = 0; i < requests_per_frame; ++i) {
+      bank.nodes.push_back(std::make_unique<Node>());
+      bank.nodes.back()->index = i;
+    }
+    bank.capacity.store(requests_per_frame);
+    bank.overflow.store(nullptr);
+  }
+  pending_.reserve(requests_per_frame);
+}
+
+gfx::vk_api::SubmitAggregator::~SubmitAggregator()
+{
+  for (Bank& bank : banks_) {
+    Node* node = bank.overflow.exchange(nullptr);
+    while (node != nullptr) {
+      Node* next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+}
+
+auto gfx::vk_api::SubmitAggregator::set_timeline(
+    VkQueue queue, std::shared_ptr<QueueTimeline> timeline) -> void
+{
+  timeline_queue_ = queue;
+  timeline_ = std::move(timeline);
+}
+
+auto gfx::vk_api::SubmitAggregator::enqueue(const SubmitRequest& request)
+    -> void
+{
+  // Reserving a node is a single atomic add, it also picks the bank.
+  uint32_t state = state_.fetch_add(1, std::memory_order_acq_rel);
+  Bank& bank = banks_[(state & BANK_BIT) != 0];
+  uint32_t index = state & COUNT_MASK;
+  bool pooled = index < bank.capacity.load(std::memory_order_acquire);
+  Node* node = pooled ? bank.nodes[index].get() : new Node();
+
+  node->queue = request.queue;
+  node->command_buffers.assign(
+      request.command_buffers,
+      request.command_buffers + request.command_buffer_count);
+  node->wait_semaphores.assign(request.wait_semaphores,
+                               request.wait_semaphores + request.wait_count);
+  node->wait_stages.assign(request.wait_count,
+                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+  node->wait_values.assign(request.wait_count, 0);
+  for (uint32_t i = 0; i < request.wait_count; ++i) {
+    if (request.wait_stages != nullptr) {
+      node->wait_stages[i] = request.wait_stages[i];
+    }
+    if (request.wait_values != nullptr) {
+      node->wait_values[i] = request.wait_values[i];
+    }
+  }
+  node->signal_semaphores.assign(
+      request.signal_semaphores,
+      request.signal_semaphores + request.signal_count);
+  node->signal_values.assign(request.signal_count, 0);
+  if (request.signal_values != nullptr) {
+    std::copy(request.signal_values,
+              request.signal_values + request.signal_count,
+              node->signal_values.begin());
+  }
+  node->fence = request.fence;
+  node->index = index;
+
+  if (pooled) {
+    node->ready.store(true, std::memory_order_release);
+    return;
+  }
+  // Lock-free push: producers only ever race on the list head.
+  node->next = bank.overflow.load(std::memory_order_relaxed);
+  while (!bank.overflow.compare_exchange_weak(node->next, node,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+  }
+}
+
+auto gfx::vk_api::SubmitAggregator::flush() -> SubmitStats
+{
+  // Later requests go to the other bank, this one is drained.
+  uint32_t state = state_.load(std::memory_order_relaxed);
+  while (!state_.compare_exchange_weak(state, ~state & BANK_BIT,
+                                       std::memory_order_acq_rel)) {
+  }
+  drain_(banks_[(state & BANK_BIT) != 0], state & COUNT_MASK);
+
+  SubmitStats stats = {};
+  stats.requests = static_cast<uint32_t>(pending_.size());
+  stats.result = VK_SUCCESS;
+
+  // Requests are walked in enqueue order and each run on the same queue is
+  // submitted before the next one starts: a request may wait on a semaphore
+  // signalled by an earlier request of another queue, whose submission must
+  // come first.
+  ArenaScope scratch;
+  ScratchVector<VkQueue> failed_queues(&frame_arena());
+  size_t run = 0;
+  while (run < pending_.size()) {
+    VkQueue queue = pending_[run]->queue;
+    size_t run_end = run + 1;
+    while (run_end < pending_.size() && pending_[run_end]->queue == queue) {
+      ++run_end;
+    }
+    size_t run_begin = run;
+    run = run_end;
+    if (std::find(failed_queues.begin(), failed_queues.end(), queue) !=
+        failed_queues.end()) {
+      continue;
+    }
+
+    build_batches_(run_begin, run_end);
+    stats.batches += static_cast<uint32_t>(batches_.size());
+
+    size_t first = 0;
+    for (const auto& call : calls_) {
+      VkResult result =
+          submit_batches_(queue, first, call.first - first, call.second);
+      ++stats.queue_submits;
+      if (result != VK_SUCCESS) {
+        ++stats.failed_submits;
+        if (stats.result == VK_SUCCESS) {
+          stats.result = result;
+        }
+        failed_queues.push_back(queue);
+        break;
+      }
+      first = call.first;
+    }
+  }
+
+  for (Node* pending : pending_) {
+    pending->ready.store(false, std::memory_order_relaxed);
+  }
+  pending_.clear();
+
+  last_requests_.store(stats.requests);
+  last_batches_.store(stats.batches);
+  last_queue_submits_.store(stats.queue_submits);
+  last_failed_submits_.store(stats.failed_submits);
+  last_result_.store(stats.result);
+  requests_metric_.record(stats.requests);
+  queue_submits_metric_.record(stats.queue_submits);
+  return stats;
+}
+
+auto gfx::vk_api::SubmitAggregator::last_frame_stats() const -> SubmitStats
+{
+  return {last_requests_.load(), last_batches_.load(),
+          last_queue_submits_.load(), last_failed_submits_.load(),
+          last_result_.load()};
+}
+
+auto gfx::vk_api::SubmitAggregator::drain_(Bank& bank, uint32_t count)
+    -> void
+{
+  // Producers that reserved a node before the switch may still be filling
+  // it, they only copy the request.
+  uint32_t pooled = std::min(count, bank.capacity.load());
+  for (uint32_t i = 0; i < pooled; ++i) {
+    while (!bank.nodes[i]->ready.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+  // The nodes past the pool join it, at their reserved index. The pool only
+  // grows once every producer pushed its node, none reads it any more.
+  if (count > pooled) {
+    Node* adopted_nodes = nullptr;
+    for (uint32_t adopted = pooled; adopted < count;) {
+      Node* node = bank.overflow.exchange(nullptr, std::memory_order_acquire);
+      while (node != nullptr) {
+        Node* next = node->next;
+        node->next = adopted_nodes;
+        adopted_nodes = node;
+        ++adopted;
+        node = next;
+      }
+      if (adopted < count) {
+        std::this_thread::yield();
+      }
+    }
+    bank.nodes.resize(count);
+    while (adopted_nodes != nullptr) {
+      Node* next = adopted_nodes->next;
+      adopted_nodes->ready.store(true, std::memory_order_relaxed);
+      bank.nodes[adopted_nodes->index].reset(adopted_nodes);
+      adopted_nodes = next;
+    }
+    bank.capacity.store(count, std::memory_order_release);
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    pending_.push_back(bank.nodes[i].get());
+  }
+}
+
+auto gfx::vk_api::SubmitAggregator::build_batches_(size_t first,
+                                                   size_t last) -> void
+{
+  batches_.clear();
+  calls_.clear();
+  wait_semaphores_.clear();
+  wait_stages_.clear();
+  wait_values_.clear();
+  command_buffers_.clear();
+  signal_semaphores_.clear();
+  signal_values_.clear();
+
+  Batch* current = nullptr;
+  for (size_t i = first; i < last; ++i) {
+    const Node* request = pending_[i];
+
+    // Waits of a batch happen before any of its commands, so a request that
+    // waits can only join a batch that has neither commands nor signals yet.
+    // Anything else can be appended: the batch signals are simply moved after
+    // the appended commands, which is a stronger guarantee.
+    bool has_waits = !request->wait_semaphores.empty();
+    if (current == nullptr ||
+        (has_waits &&
+         (current->command_buffer_count > 0 || current->signal_count > 0))) {
+      batches_.push_back({wait_semaphores_.size(), 0, command_buffers_.size(),
+                          0, signal_semaphores_.size(), 0, false});
+      current = &batches_.back();
+    }
+
+    wait_semaphores_.insert(wait_semaphores_.end(),
+                            request->wait_semaphores.begin(),
+                            request->wait_semaphores.end());
+    wait_stages_.insert(wait_stages_.end(), request->wait_stages.begin(),
+                        request->wait_stages.end());
+    wait_values_.insert(wait_values_.end(), request->wait_values.begin(),
+                        request->wait_values.end());
+    current->wait_count += request->wait_semaphores.size();
+
+    command_buffers_.insert(command_buffers_.end(),
+                            request->command_buffers.begin(),
+                            request->command_buffers.end());
+    current->command_buffer_count += request->command_buffers.size();
+
+    signal_semaphores_.insert(signal_semaphores_.end(),
+                              request->signal_semaphores.begin(),
+                              request->signal_semaphores.end());
+    signal_values_.insert(signal_values_.end(),
+                          request->signal_values.begin(),
+                          request->signal_values.end());
+    current->signal_count += request->signal_semaphores.size();
+
+    auto non_zero = [](uint64_t value) { return value != 0; };
+    current->timeline |=
+        std::any_of(request->wait_values.begin(), request->wait_values.end(),
+                    non_zero) ||
+        std::any_of(request->signal_values.begin(),
+                    request->signal_values.end(), non_zero);
+
+    // A vkQueueSubmit call signals a single fence after all its batches.
+    if (request->fence != VK_NULL_HANDLE) {
+      calls_.emplace_back(batches_.size(), request->fence);
+      current = nullptr;
+    }
+  }
+  if (calls_.empty() || calls_.back().first != batches_.size()) {
+    calls_.emplace_back(batches_.size(), VkFence(VK_NULL_HANDLE));
+  }
+
+  // All flattened arrays are final, the submit infos can point into them.
+  timeline_infos_.clear();
+  timeline_infos_.reserve(batches_.size());
+  submit_infos_.clear();
+  for (const Batch& batch : batches_) {
+    auto submit_info = make_struct<VkSubmitInfo>();
+    submit_info.waitSemaphoreCount = static_cast<uint32_t>(batch.wait_count);
+    submit_info.pWaitSemaphores = wait_semaphores_.data() + batch.first_wait;
+    submit_info.pWaitDstStageMask = wait_stages_.data() + batch.first_wait;
+    submit_info.commandBufferCount =
+        static_cast<uint32_t>(batch.command_buffer_count);
+    submit_info.pCommandBuffers =
+        command_buffers_.data() + batch.first_command_buffer;
+    submit_info.signalSemaphoreCount =
+        static_cast<uint32_t>(batch.signal_count);
+    submit_info.pSignalSemaphores =
+        signal_semaphores_.data() + batch.first_signal;
+
+    if (batch.timeline) {
+      auto timeline_info = make_struct<VkTimelineSemaphoreSubmitInfoKHR>();
+      timeline_info.waitSemaphoreValueCount = submit_info.waitSemaphoreCount;
+      timeline_info.pWaitSemaphoreValues =
+          wait_values_.data() + batch.first_wait;
+      timeline_info.signalSemaphoreValueCount =
+          submit_info.signalSemaphoreCount;
+      timeline_info.pSignalSemaphoreValues =
+          signal_values_.data() + batch.first_signal;
+      timeline_infos_.push_back(timeline_info);
+      submit_info.pNext = &timeline_infos_.back();
+    }
+    submit_infos_.push_back(submit_info);
+  }
+}
+
+auto gfx::vk_api::SubmitAggregator::submit_batches_(VkQueue queue,
+                                                    size_t first, size_t count,
+                                                    VkFence fence) -> VkResult
+{
+  VkResult result;
+  if (timeline_ && queue == timeline_queue_) {
+    timeline_->submit(submit_infos_.data() + first,
+                      static_cast<uint32_t>(count), fence, &result);
+    return result;
+  }
+  result = vkQueueSubmit_(queue, static_cast<uint32_t>(count),
+                          submit_infos_.data() + first, fence);
+  if (result != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not submit aggregated batches: {}!",
+                  result_name(result));
+  }
+  return result;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "metrics.h"
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// Work handed to the aggregator by a producer, enqueue() copies it. Semaphore
+// values are only used for timeline semaphores, binary semaphores take 0. The
+// wait stages and the values may be null: waits are then on all commands,
+// values are 0.
+struct SubmitRequest {
+  VkQueue queue;
+  uint32_t command_buffer_count;
+  const VkCommandBuffer* command_buffers;
+  uint32_t wait_count;
+  const VkSemaphore* wait_semaphores;
+  const VkPipelineStageFlags* wait_stages;
+  const uint64_t* wait_values;
+  uint32_t signal_count;
+  const VkSemaphore* signal_semaphores;
+  const uint64_t* signal_values;
+  VkFence fence;
+};
+
+struct SubmitStats {
+  uint32_t requests;
+  uint32_t batches;
+  // Number of vkQueueSubmit calls, and those that failed. The requests of a
+  // queue after a failed call are dropped, their waits may never be met.
+  uint32_t queue_submits;
+  uint32_t failed_submits;
+  // VK_SUCCESS, or the result of the first call that failed.
+  VkResult result;
+};
+
+// ************************************************************ //
+// SubmitAggregator                                             //
+//                                                              //
+// Collects the submissions of every producer during a frame    //
+// and issues them in flush() with as few VkSubmitInfo batches  //
+// and vkQueueSubmit calls as ordering allows. Requests are     //
+// submitted in enqueue order, a call never spans a change of   //
+// queue.                                                       //
+// Enqueueing is lock-free and can happen from any thread,      //
+// flush() is called once per frame by the render thread.       //
+// Requests are copied into nodes pooled across frames, in two  //
+// banks: producers fill one while flush() drains the other.    //
+// Once the pools fit the busiest frame, nothing is allocated.  //
+// Every flush records its requests and vkQueueSubmit calls in  //
+// the submit.requests and submit.queue_submits histograms.     //
+// ************************************************************ //
+class SubmitAggregator {
+ public:
+  SubmitAggregator(VulkanDevice& device, uint32_t requests_per_frame = 64);
+  ~SubmitAggregator();
+
+  SubmitAggregator(const SubmitAggregator&) = delete;
+  SubmitAggregator& operator=(const SubmitAggregator&) = delete;
+
+  // Routes the submissions on the timeline's queue through it, so they are
+  // tracked and serialized with its other submissions.
+  auto set_timeline(VkQueue queue, std::shared_ptr<QueueTimeline> timeline)
+      -> void;
+
+  auto enqueue(const SubmitRequest& request) -> void;
+  // Submits everything enqueued so far, in enqueue order. Consecutive
+  // requests on a queue share vkQueueSubmit calls, a change of queue starts
+  // a new one so work on another queue is never submitted ahead of what it
+  // waits on.
+  auto flush() -> SubmitStats;
+
+  // Counters of the last flush.
+  auto last_frame_stats() const -> SubmitStats;
+
+ private:
+  // A request, its arrays keep their capacity from frame to frame.
+  struct Node {
+    VkQueue queue;
+    std::vector<VkCommandBuffer> command_buffers;
+    std::vector<VkSemaphore> wait_semaphores;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    std::vector<uint64_t> wait_values;
+    std::vector<VkSemaphore> signal_semaphores;
+    std::vector<uint64_t> signal_values;
+    VkFence fence;
+    // Position in the bank.
+    uint32_t index;
+    // Set once the producer filled the node.
+    std::atomic<bool> ready;
+    // Link of the overflow list.
+    Node* next;
+  };
+
+  struct Bank {
+    std::vector<std::unique_ptr<Node>> nodes;
+    // Size of nodes for the producers, which must not read the vector
+    // itself: it only grows once they all published their requests.
+    std::atomic<uint32_t> capacity;
+    // Requests past the pool, allocated by the producers. flush() adds them
+    // to the pool.
+    std::atomic<Node*> overflow;
+  };
+
+  // Flattened submission data, reused from frame to frame.
+  struct Batch {
+    size_t first_wait;
+    size_t wait_count;
+    size_t first_command_buffer;
+    size_t command_buffer_count;
+    size_t first_signal;
+    size_t signal_count;
+    bool timeline;
+  };
+
+  // Waits for the producers still filling the bank's nodes and lists its
+  // requests in pending_.
+  auto drain_(Bank& bank, uint32_t count) -> void;
+  // Batches the pending requests [first, last), which share a queue.
+  auto build_batches_(size_t first, size_t last) -> void;
+  auto submit_batches_(VkQueue queue, size_t first, size_t count,
+                       VkFence fence) -> VkResult;
+
+  PFN_vkQueueSubmit vkQueueSubmit_;
+  VkQueue timeline_queue_;
+  std::shared_ptr<QueueTimeline> timeline_;
+
+  // The bank producers use in the top bit, the requests enqueued in it
+  // below.
+  std::atomic<uint32_t> state_;
+  Bank banks_[2];
+
+  std::vector<Node*> pending_;
+  std::vector<Batch> batches_;
+  // Index one past the last batch of each vkQueueSubmit call, with its fence.
+  std::vector<std::pair<size_t, VkFence>> calls_;
+  std::vector<VkSemaphore> wait_semaphores_;
+  std::vector<VkPipelineStageFlags> wait_stages_;
+  std::vector<uint64_t> wait_values_;
+  std::vector<VkCommandBuffer> command_buffers_;
+  std::vector<VkSemaphore> signal_semaphores_;
+  std::vector<uint64_t> signal_values_;
+  std::vector<VkTimelineSemaphoreSubmitInfoKHR> timeline_infos_;
+  std::vector<VkSubmitInfo> submit_infos_;
+
+  std::atomic<uint32_t> last_requests_;
+  std::atomic<uint32_t> last_batches_;
+  std::atomic<uint32_t> last_queue_submits_;
+  std::atomic<uint32_t> last_failed_submits_;
+  std::atomic<VkResult> last_result_;
+  // Per flush, which the render thread does once per frame.
+  Histogram requests_metric_;
+  Histogram queue_submits_metric_;
+};
+
+}  // namespace gfx::vk_api
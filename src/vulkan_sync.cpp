@@ -0,0 +1,366 @@
+#include "vulkan_sync.h"
+#include <algorithm>
+#include <chrono>
+#include "frame_arena.h"
+#include "host_allocator.h"
+#include "log.h"
+#include "vulkan_builders.h"
+
+gfx::vk_api::QueueTimeline::QueueTimeline(VulkanDevice& device, VkQueue queue)
+    : device_(device.logical_device),
+      queue_(queue),
+      semaphore_(VK_NULL_HANDLE),
+      vkQueueSubmit_(device.vkQueueSubmit),
+      vkCreateFence_(device.vkCreateFence),
+      vkDestroyFence_(device.vkDestroyFence),
+      vkResetFences_(device.vkResetFences),
+      vkWaitForFences_(device.vkWaitForFences),
+      vkGetFenceStatus_(device.vkGetFenceStatus),
+      vkDestroySemaphore_(device.vkDestroySemaphore),
+      vkGetSemaphoreCounterValueKHR_(device.vkGetSemaphoreCounterValueKHR),
+      vkWaitSemaphoresKHR_(device.vkWaitSemaphoresKHR),
+      submitted_(0),
+      completed_(0),
+      lost_(false),
+      deferred_head_(0),
+      deferred_count_(0)
+{
+  if (device.timeline_semaphore_supported) {
+    semaphore_ = create_timeline_semaphore(device, 0);
+  }
+}
+
+gfx::vk_api::QueueTimeline::~QueueTimeline()
+{
+  wait_idle();
+  collect();
+
+  for (auto& slot : pending_fences_) {
+    vkDestroyFence_(device_, slot->fence, allocation_callbacks());
+  }
+  for (auto& slot : retired_fences_) {
+    vkDestroyFence_(device_, slot->fence, allocation_callbacks());
+  }
+  for (auto& slot : free_fences_) {
+    vkDestroyFence_(device_, slot->fence, allocation_callbacks());
+  }
+  if (semaphore_ != VK_NULL_HANDLE) {
+    vkDestroySemaphore_(device_, semaphore_, allocation_callbacks());
+  }
+}
+
+auto gfx::vk_api::QueueTimeline::submit(const VkSubmitInfo* submits,
+                                        uint32_t submit_count, VkFence fence,
+                                        VkResult* result) -> uint64_t
+{
+  VkResult ignored;
+  VkResult& call_result = result != nullptr ? *result : ignored;
+  std::lock_guard<std::mutex> lock(submit_mutex_);
+  uint64_t value = submitted_.load() + 1;
+
+  if (uses_timeline_semaphore()) {
+    // Signal operations cover every command earlier in submission order, so
+    // an empty trailing batch is enough to signal the whole submission.
+    using TimelineInfo = VkTimelineSemaphoreSubmitInfoKHR;
+    auto timeline_info =
+        build<TimelineInfo>()
+            .set(&TimelineInfo::signalSemaphoreValueCount, 1)
+            .set(&TimelineInfo::pSignalSemaphoreValues, &value)
+            .get();
+    VkSubmitInfo signal_submit =
+        build<VkSubmitInfo>()
+            .set(&VkSubmitInfo::signalSemaphoreCount, 1)
+            .set(&VkSubmitInfo::pSignalSemaphores, &semaphore_)
+            .next(timeline_info);
+
+    ArenaScope scratch;
+    ScratchVector<VkSubmitInfo> batches(submits, submits + submit_count,
+                                        &frame_arena());
+    batches.push_back(signal_submit);
+    call_result = check_lost_(vkQueueSubmit_(
+        queue_, static_cast<uint32_t>(batches.size()), batches.data(), fence));
+    if (call_result != VK_SUCCESS) {
+      GFX_LOG_ERROR("Could not submit to the queue timeline!");
+      return 0;
+    }
+    submitted_.store(value);
+    return value;
+  }
+
+  std::shared_ptr<FenceSlot> slot = acquire_fence_();
+  if (!slot) {
+    call_result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    return 0;
+  }
+  slot->value = value;
+  // A call signals a single fence. The caller's fence takes the batches and an
+  // empty submission signals ours once all prior work on the queue is done.
+  if (fence != VK_NULL_HANDLE) {
+    call_result = vkQueueSubmit_(queue_, submit_count, submits, fence);
+    if (call_result == VK_SUCCESS) {
+      call_result = vkQueueSubmit_(queue_, 0, nullptr, slot->fence);
+      // The batches are on the queue but no value tracks them, nothing can
+      // tell when their objects are free again: stop as a lost device does.
+      if (call_result != VK_SUCCESS) {
+        call_result = VK_ERROR_DEVICE_LOST;
+      }
+    }
+  }
+  else {
+    call_result = vkQueueSubmit_(queue_, submit_count, submits, slot->fence);
+  }
+  if (check_lost_(call_result) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not submit to the queue timeline!");
+    std::lock_guard<std::mutex> fence_lock(fence_mutex_);
+    free_fences_.push_back(slot);
+    return 0;
+  }
+  {
+    std::lock_guard<std::mutex> fence_lock(fence_mutex_);
+    pending_fences_.push_back(slot);
+    submitted_.store(value);
+  }
+  submitted_cv_.notify_all();
+  return value;
+}
+
+auto gfx::vk_api::QueueTimeline::last_submitted_value() const -> uint64_t
+{
+  return submitted_.load();
+}
+
+auto gfx::vk_api::QueueTimeline::completed_value() -> uint64_t
+{
+  if (uses_timeline_semaphore()) {
+    uint64_t value = 0;
+    if (check_lost_(vkGetSemaphoreCounterValueKHR_(device_, semaphore_,
+                                                   &value)) == VK_SUCCESS) {
+      advance_completed_(value);
+    }
+  }
+  else {
+    std::lock_guard<std::mutex> lock(fence_mutex_);
+    poll_fences_();
+  }
+  return completed_.load();
+}
+
+auto gfx::vk_api::QueueTimeline::wait_until(uint64_t value, uint64_t timeout)
+    -> bool
+{
+  if (completed_.load() >= value) {
+    return true;
+  }
+  if (lost_.load()) {
+    return false;
+  }
+
+  if (uses_timeline_semaphore()) {
+    // Waiting before the value is submitted is valid for timeline semaphores.
+    VkSemaphoreWaitInfoKHR wait_info =
+        build<VkSemaphoreWaitInfoKHR>()
+            .set(&VkSemaphoreWaitInfoKHR::semaphoreCount, 1)
+            .set(&VkSemaphoreWaitInfoKHR::pSemaphores, &semaphore_)
+            .set(&VkSemaphoreWaitInfoKHR::pValues, &value);
+    if (check_lost_(vkWaitSemaphoresKHR_(device_, &wait_info, timeout)) !=
+        VK_SUCCESS) {
+      return false;
+    }
+    advance_completed_(value);
+    return true;
+  }
+
+  // Fence mode: wait for the submission carrying the value to exist, then for
+  // its fence. Slots are shared so they are not recycled while we wait.
+  std::shared_ptr<FenceSlot> slot;
+  {
+    std::unique_lock<std::mutex> lock(fence_mutex_);
+    auto submitted = [this, value] {
+      return submitted_.load() >= value || lost_.load();
+    };
+    if (timeout == UINT64_MAX) {
+      submitted_cv_.wait(lock, submitted);
+    }
+    else if (!submitted_cv_.wait_for(lock, std::chrono::nanoseconds(timeout),
+                                     submitted)) {
+      return false;
+    }
+
+    poll_fences_();
+    if (completed_.load() >= value) {
+      return true;
+    }
+    if (lost_.load()) {
+      return false;
+    }
+    for (auto& pending : pending_fences_) {
+      if (pending->value >= value) {
+        slot = pending;
+        break;
+      }
+    }
+  }
+  if (!slot) {
+    return completed_.load() >= value;
+  }
+
+  if (check_lost_(vkWaitForFences_(device_, 1, &slot->fence, VK_TRUE,
+                                   timeout)) != VK_SUCCESS) {
+    return false;
+  }
+  advance_completed_(slot->value);
+  return true;
+}
+
+auto gfx::vk_api::QueueTimeline::wait_idle() -> bool
+{
+  return wait_until(submitted_.load());
+}
+
+auto gfx::vk_api::QueueTimeline::defer(uint64_t value, Deleter deleter)
+    -> void
+{
+  std::lock_guard<std::mutex> lock(deferred_mutex_);
+  if (deferred_count_ == deferred_.size()) {
+    std::vector<Deferred> grown(std::max<size_t>(2 * deferred_.size(), 16));
+    for (size_t i = 0; i < deferred_count_; ++i) {
+      grown[i] = std::move(deferred_at_(i));
+    }
+    deferred_ = std::move(grown);
+    deferred_head_ = 0;
+  }
+  // Keep the ring sorted by value; deleters are almost always deferred
+  // against the latest submission so the insertion point is the back.
+  size_t position = deferred_count_;
+  while (position > 0 && deferred_at_(position - 1).value > value) {
+    deferred_at_(position) = std::move(deferred_at_(position - 1));
+    --position;
+  }
+  deferred_at_(position) = Deferred{value, std::move(deleter)};
+  ++deferred_count_;
+}
+
+auto gfx::vk_api::QueueTimeline::defer(Deleter deleter) -> void
+{
+  defer(submitted_.load(), std::move(deleter));
+}
+
+auto gfx::vk_api::QueueTimeline::collect() -> size_t
+{
+  // The work of a lost device is gone, nothing uses the objects any more.
+  uint64_t completed = lost_.load() ? UINT64_MAX : completed_value();
+
+  ArenaScope scratch;
+  ScratchVector<Deleter> ready(&frame_arena());
+  {
+    std::lock_guard<std::mutex> lock(deferred_mutex_);
+    while (deferred_count_ > 0 && deferred_at_(0).value <= completed) {
+      ready.push_back(std::move(deferred_at_(0).deleter));
+      deferred_head_ = (deferred_head_ + 1) % deferred_.size();
+      --deferred_count_;
+    }
+  }
+  for (auto& deleter : ready) {
+    deleter();
+  }
+  return ready.size();
+}
+
+auto gfx::vk_api::QueueTimeline::device_lost() const -> bool
+{
+  return lost_.load();
+}
+
+auto gfx::vk_api::QueueTimeline::uses_timeline_semaphore() const -> bool
+{
+  return semaphore_ != VK_NULL_HANDLE;
+}
+
+auto gfx::vk_api::QueueTimeline::semaphore() const -> VkSemaphore
+{
+  return semaphore_;
+}
+
+auto gfx::vk_api::QueueTimeline::acquire_fence_() -> std::shared_ptr<FenceSlot>
+{
+  {
+    std::lock_guard<std::mutex> lock(fence_mutex_);
+    poll_fences_();
+    if (!free_fences_.empty()) {
+      std::shared_ptr<FenceSlot> slot = free_fences_.back();
+      free_fences_.pop_back();
+      return slot;
+    }
+  }
+
+  constexpr auto fence_create_info = make_struct<VkFenceCreateInfo>();
+  auto slot = std::make_shared<FenceSlot>();
+  if (vkCreateFence_(device_, &fence_create_info, allocation_callbacks(),
+                     &slot->fence) != VK_SUCCESS) {
+    GFX_LOG_ERROR("Could not create fence!");
+    return nullptr;
+  }
+  return slot;
+}
+
+auto gfx::vk_api::QueueTimeline::poll_fences_() -> void
+{
+  // Called with fence_mutex_ held.
+  while (!pending_fences_.empty()) {
+    std::shared_ptr<FenceSlot>& slot = pending_fences_.front();
+    if (check_lost_locked_(vkGetFenceStatus_(device_, slot->fence)) !=
+        VK_SUCCESS) {
+      break;
+    }
+    advance_completed_(slot->value);
+    retired_fences_.push_back(std::move(slot));
+    pending_fences_.erase(pending_fences_.begin());
+  }
+
+  // A fence can only be reset once no other thread is waiting on it.
+  for (size_t i = 0; i < retired_fences_.size();) {
+    if (retired_fences_[i].use_count() == 1) {
+      vkResetFences_(device_, 1, &retired_fences_[i]->fence);
+      free_fences_.push_back(std::move(retired_fences_[i]));
+      retired_fences_[i] = std::move(retired_fences_.back());
+      retired_fences_.pop_back();
+    }
+    else {
+      ++i;
+    }
+  }
+}
+
+auto gfx::vk_api::QueueTimeline::deferred_at_(size_t i) -> Deferred&
+{
+  return deferred_[(deferred_head_ + i) % deferred_.size()];
+}
+
+auto gfx::vk_api::QueueTimeline::advance_completed_(uint64_t value) -> void
+{
+  uint64_t current = completed_.load();
+  while (current < value && !completed_.compare_exchange_weak(current, value)) {
+  }
+}
+
+auto gfx::vk_api::QueueTimeline::check_lost_(VkResult result) -> VkResult
+{
+  if (result == VK_ERROR_DEVICE_LOST && !lost_.load()) {
+    std::lock_guard<std::mutex> lock(fence_mutex_);
+    check_lost_locked_(result);
+  }
+  return result;
+}
+
+auto gfx::vk_api::QueueTimeline::check_lost_locked_(VkResult result)
+    -> VkResult
+{
+  // Set under fence_mutex_, as submitted_ is, so that a thread waiting for a
+  // submission in fence mode cannot check its predicate between the store
+  // and the notification and then sleep forever.
+  if (result == VK_ERROR_DEVICE_LOST && !lost_.exchange(true)) {
+    GFX_LOG_ERROR("Device lost, the queue timeline stops.");
+    submitted_cv_.notify_all();
+  }
+  return result;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "vulkan_api.h"
+
+namespace gfx::vk_api {
+
+// Callable run by a deferred deletion. Stored inline, unlike a
+// std::function, so deferring never allocates: the captures must fit in
+// CAPACITY bytes, which is checked at compile time.
+class Deleter {
+ public:
+  static constexpr size_t CAPACITY = 48;
+
+  Deleter() = default;
+  template <typename F, typename = std::enable_if_t<
+                            !std::is_same_v<std::decay_t<F>, Deleter>>>
+  Deleter(F&& function)
+  {
+    using Function = std::decay_t<F>;
+    static_assert(sizeof(Function) <= CAPACITY &&
+                      alignof(Function) <= alignof(std::max_align_t),
+                  "The deleter captures too much to be stored inline.");
+    new (storage_) Function(std::forward<F>(function));
+    call_ = [](void* storage) { (*static_cast<Function*>(storage))(); };
+    relocate_ = [](void* to, void* from) {
+      if (to != nullptr) {
+        new (to) Function(std::move(*static_cast<Function*>(from)));
+      }
+      static_cast<Function*>(from)->~Function();
+    };
+  }
+  ~Deleter() { reset(); }
+
+  Deleter(Deleter&& other) noexcept { *this = std::move(other); }
+  Deleter& operator=(Deleter&& other) noexcept
+  {
+    if (this != &other) {
+      reset();
+      if (other.call_ != nullptr) {
+        other.relocate_(storage_, other.storage_);
+        std::swap(call_, other.call_);
+        std::swap(relocate_, other.relocate_);
+      }
+    }
+    return *this;
+  }
+
+  auto operator()() -> void { call_(storage_); }
+  explicit operator bool() const { return call_ != nullptr; }
+  auto reset() -> void
+  {
+    if (call_ != nullptr) {
+      relocate_(nullptr, storage_);
+      call_ = nullptr;
+      relocate_ = nullptr;
+    }
+  }
+
+ private:
+  alignas(std::max_align_t) std::byte storage_[CAPACITY];
+  void (*call_)(void*) = nullptr;
+  // Move constructs the callable at to, when not null, and destroys it.
+  void (*relocate_)(void* to, void* from) = nullptr;
+};
+
+// ************************************************************ //
+// QueueTimeline                                                //
+//                                                              //
+// Tracks the GPU progress of a single queue with a monotonic   //
+// counter. Every submission made through the timeline gets the //
+// next value, which the GPU signals once the work retires.     //
+// A timeline semaphore is used when the device supports it,    //
+// otherwise each submission is tagged with a pooled fence.     //
+// Once a call reports VK_ERROR_DEVICE_LOST the timeline is     //
+// lost: waits return false at once and deferred deleters run   //
+// without waiting, nothing will ever complete. Deleters wait   //
+// in a ring which only grows past the most ever pending, so    //
+// deferring allocates nothing in steady state.                 //
+// ************************************************************ //
+class QueueTimeline {
+ public:
+  QueueTimeline(VulkanDevice& device, VkQueue queue);
+  ~QueueTimeline();
+
+  QueueTimeline(const QueueTimeline&) = delete;
+  QueueTimeline& operator=(const QueueTimeline&) = delete;
+
+  // Submits the batches and signals the next timeline value once they all
+  // complete. Returns the value assigned to the submission, or 0 on failure.
+  // The optional fence is signaled along with the value. In fence mode it
+  // takes a second call, if only the first one goes through the timeline is
+  // lost. The result of the submission goes to result when given.
+  auto submit(const VkSubmitInfo* submits, uint32_t submit_count,
+              VkFence fence = VK_NULL_HANDLE, VkResult* result = nullptr)
+      -> uint64_t;
+  // Runs fn(queue) with submissions through the timeline held off, for the
+  // other calls on the queue Vulkan requires to be externally synchronized
+  // with them, like vkQueuePresentKHR or vkQueueWaitIdle. Returns what fn
+  // returns.
+  template <typename F>
+  auto with_queue(F&& fn) -> decltype(fn(VkQueue{}))
+  {
+    std::lock_guard<std::mutex> lock(submit_mutex_);
+    return fn(queue_);
+  }
+  // Last value handed out by submit().
+  auto last_submitted_value() const -> uint64_t;
+  // Highest value known to be reached by the GPU.
+  auto completed_value() -> uint64_t;
+  // Blocks the calling thread until the GPU reached the value. Safe to call
+  // from any thread. Returns false on timeout or error.
+  auto wait_until(uint64_t value, uint64_t timeout = UINT64_MAX) -> bool;
+  // Blocks until every submission made so far has retired.
+  auto wait_idle() -> bool;
+
+  // Runs the deleter once the GPU reached the value.
+  auto defer(uint64_t value, Deleter deleter) -> void;
+  // Runs the deleter once the work submitted so far has retired.
+  auto defer(Deleter deleter) -> void;
+  // Runs the deleters whose value has been reached, returns how many ran.
+  auto collect() -> size_t;
+
+  // A call on the queue or its semaphore reported the device lost.
+  auto device_lost() const -> bool;
+
+  auto uses_timeline_semaphore() const -> bool;
+  // The timeline semaphore, VK_NULL_HANDLE in fence mode. Other queues can
+  // wait on it with a VkTimelineSemaphoreSubmitInfoKHR.
+  auto semaphore() const -> VkSemaphore;
+
+ private:
+  struct FenceSlot {
+    VkFence fence;
+    uint64_t value;
+  };
+
+  struct Deferred {
+    uint64_t value;
+    Deleter deleter;
+  };
+
+  auto acquire_fence_() -> std::shared_ptr<FenceSlot>;
+  auto poll_fences_() -> void;
+  auto advance_completed_(uint64_t value) -> void;
+  // Marks the timeline lost when the result says so, returns the result.
+  auto check_lost_(VkResult result) -> VkResult;
+  // Same, with fence_mutex_ already held.
+  auto check_lost_locked_(VkResult result) -> VkResult;
+  // The i-th pending deleter from the oldest, with deferred_mutex_ held.
+  auto deferred_at_(size_t i) -> Deferred&;
+
+  VkDevice device_;
+  VkQueue queue_;
+  VkSemaphore semaphore_;
+
+  PFN_vkQueueSubmit vkQueueSubmit_;
+  PFN_vkCreateFence vkCreateFence_;
+  PFN_vkDestroyFence vkDestroyFence_;
+  PFN_vkResetFences vkResetFences_;
+  PFN_vkWaitForFences vkWaitForFences_;
+  PFN_vkGetFenceStatus vkGetFenceStatus_;
+  PFN_vkDestroySemaphore vkDestroySemaphore_;
+  PFN_vkGetSemaphoreCounterValueKHR vkGetSemaphoreCounterValueKHR_;
+  PFN_vkWaitSemaphoresKHR vkWaitSemaphoresKHR_;
+
+  std::atomic<uint64_t> submitted_;
+  std::atomic<uint64_t> completed_;
+  std::atomic<bool> lost_;
+
+  // Guards the queue, which Vulkan requires to be externally synchronized.
+  std::mutex submit_mutex_;
+  // Guards the fence lists in fence mode.
+  std::mutex fence_mutex_;
+  std::condition_variable submitted_cv_;
+  // In submission order. Few are pending, a vector keeps its storage as
+  // they retire where a deque would allocate and free its blocks.
+  std::vector<std::shared_ptr<FenceSlot>> pending_fences_;
+  // Signaled fences still referenced by a waiting thread.
+  std::vector<std::shared_ptr<FenceSlot>> retired_fences_;
+  std::vector<std::shared_ptr<FenceSlot>> free_fences_;
+
+  std::mutex deferred_mutex_;
+  // Ring sorted by value from deferred_head_, of deferred_count_ deleters.
+  std::vector<Deferred> deferred_;
+  size_t deferred_head_;
+  size_t deferred_count_;
+};
+
+}  // namespace gfx::vk_api
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "vulkan_ext.h"
+
+namespace gfx::vk_api {
+
+constexpr uint32_t TRACE_MAGIC = 0x544c4b56;  // "VKLT"
+constexpr uint32_t TRACE_VERSION = 2;
+// Mapped memory is compared and deduplicated in chunks of this many bytes.
+constexpr uint32_t TRACE_CHUNK_SIZE = 64 << 10;
+// Records, and the arrays in them, start on this boundary so replay can read
+// Vulkan structures in place.
+constexpr uint32_t TRACE_ALIGNMENT = 8;
+
+struct TraceHeader {
+  uint32_t magic;
+  uint32_t version;
+  // Structures are stored as is, with their handles replaced by ids.
+  uint32_t pointer_size;
+  uint32_t frame_count;
+  // Queue families of the captured device, replay maps them to its own.
+  uint32_t graphics_family;
+  uint32_t compute_family;
+  // Object and blob ids of the trace are below these, replay rejects the
+  // others.
+  uint32_t id_count;
+  uint32_t blob_count;
+};
+
+// Every record is its op and payload size as uint32_t, then the payload.
+// Objects are referred to by ids, assigned in creation order from 1, with 0
+// for null handles. Queue families are stored as captured.
+enum class TraceOp : uint32_t {
+  // Setup, the objects alive when the capture began and their memory
+  // contents, ending with setup_end. Objects created while capturing use the
+  // same records.
+  blob = 1,  // Blob id, size, bytes. Later records refer to the id.
+  memory_write,  // Memory, offset in its mapping, blob.
+  allocate_memory,  // Memory, size, property flags of the captured type.
+  map_memory,  // Memory, offset, size. Mapped for the rest of the trace.
+  create_buffer,  // Buffer, VkBufferCreateInfo, queue families.
+  bind_buffer_memory,  // Buffer, memory, offset.
+  create_image,  // Image, VkImageCreateInfo, queue families.
+  bind_image_memory,  // Image, memory, offset.
+  // Image, the VkImageCreateInfo matching the swap chain. Replay backs it
+  // with its own memory.
+  create_swapchain_image,
+  create_image_view,  // View, VkImageViewCreateInfo.
+  create_sampler,  // Sampler, VkSamplerCreateInfo.
+  create_shader_module,  // Module, SPIR-V words.
+  // Layout, flags, bindings, immutable samplers of every binding.
+  create_descriptor_set_layout,
+  create_pipeline_layout,  // Layout, set layouts, push constant ranges.
+  // Pipeline, pipeline flags, layout, stage flags, stage, module, entry
+  // point, specialization map entries and data.
+  create_compute_pipeline,
+  create_descriptor_pool,  // Pool, flags, max sets, pool sizes.
+  allocate_descriptor_set,  // Set, pool, layout.
+  // Writes, each with its image, buffer or texel buffer infos, then copies.
+  update_descriptor_sets,
+  create_command_pool,  // Pool, flags, queue family.
+  allocate_command_buffer,  // Command buffer, pool, level.
+  create_semaphore,  // Semaphore, timeline, value.
+  create_fence,  // Fence, signaled.
+  destroy,  // VkObjectType, object.
+  setup_end,
+  // Frames.
+  reset_command_pool,  // Pool, flags.
+  // Command buffer, usage flags, then its commands as nested records.
+  command_buffer,
+  // Queue family, fence, then per batch its waits with their stages and
+  // values, command buffers, signals and their values.
+  queue_submit,
+  reset_fences,  // Fences.
+  wait_for_fences,  // Wait all, fences.
+  wait_semaphores,  // Flags, semaphores, values.
+  signal_semaphore,  // Semaphore, value.
+  acquire_next_image,  // Semaphore, fence the acquire signaled.
+  queue_present,  // Semaphores the present waited for.
+  queue_wait_idle,  // Queue family.
+  device_wait_idle,
+  frame_end,
+  // Commands, only inside command_buffer records.
+  cmd_pipeline_barrier,
+  cmd_clear_color_image,
+  cmd_bind_pipeline,
+  cmd_bind_descriptor_sets,
+  cmd_push_constants,
+  cmd_dispatch,
+  cmd_copy_buffer,
+  cmd_copy_buffer_to_image,
+  cmd_copy_image,
+  cmd_bind_vertex_buffers,
+  cmd_bind_index_buffer,
+  cmd_draw_indexed,
+  cmd_draw_indexed_indirect,
+  cmd_draw_indexed_indirect_count,
+  // Appended, older traces stay readable.
+  cmd_blit_image
+};
+
+// Builds the payload of a record. Vulkan structures go in unchanged, except
+// for their handles, which the writer replaces by ids, and their pointers,
+// which are meaningless in the file.
+class TraceRecord {
+ public:
+  explicit TraceRecord(TraceOp op) : op_(op) {}
+
+  template <typename T>
+  auto put(const T& value) -> TraceRecord&
+  {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only plain values can be stored.");
+    append_(&value, sizeof(T));
+    return *this;
+  }
+
+  // Count, then the values aligned.
+  template <typename T>
+  auto put_array(const T* values, uint32_t count) -> TraceRecord&
+  {
+    put(count);
+    align();
+    if (count > 0) {
+      append_(values, sizeof(T) * count);
+    }
+    return *this;
+  }
+
+  // Nested record, the commands of a command buffer, laid out as bytes()
+  // would.
+  auto put_record(const TraceRecord& record) -> TraceRecord&
+  {
+    align();
+    auto size = static_cast<uint32_t>(padded(record.payload_.size()));
+    put(record.op_);
+    put(size);
+    if (!record.payload_.empty()) {
+      append_(record.payload_.data(), record.payload_.size());
+    }
+    align();
+    return *this;
+  }
+
+  auto op() const -> TraceOp { return op_; }
+  auto empty() const -> bool { return payload_.empty(); }
+
+  // The whole record, padded to the alignment.
+  auto bytes() const -> std::vector<std::byte>
+  {
+    auto size = static_cast<uint32_t>(padded(payload_.size()));
+    std::vector<std::byte> bytes(2 * sizeof(uint32_t) + size);
+    memcpy(bytes.data(), &op_, sizeof(op_));
+    memcpy(bytes.data() + sizeof(op_), &size, sizeof(size));
+    if (!payload_.empty()) {
+      memcpy(bytes.data() + 2 * sizeof(uint32_t), payload_.data(),
+             payload_.size());
+    }
+    return bytes;
+  }
+
+ private:
+  static auto padded(size_t size) -> size_t
+  {
+    return (size + TRACE_ALIGNMENT - 1) / TRACE_ALIGNMENT * TRACE_ALIGNMENT;
+  }
+
+  auto align() -> void { payload_.resize(padded(payload_.size())); }
+
+  // Grows the payload and copies in place, inserting from a pointer range
+  // trips the -O3 null and overflow warnings of GCC.
+  auto append_(const void* data, size_t size) -> void
+  {
+    size_t offset = payload_.size();
+    payload_.resize(offset + size);
+    memcpy(payload_.data() + offset, data, size);
+  }
+
+  TraceOp op_;
+  std::vector<std::byte> payload_;
+};
+
+// Ids take the place of the handles in stored structures.
+template <typename T>
+auto id_as_handle(uint32_t id) -> T
+{
+  return reinterpret_cast<T>(uintptr_t{id});
+}
+
+template <typename T>
+auto handle_as_id(T handle) -> uint32_t
+{
+  return static_cast<uint32_t>(reinterpret_cast<uint64_t>(handle));
+}
+
+// Reads the records of a trace, or the payload of one, in place. The data
+// must start on the trace alignment. Reads past the end return zeros and
+// set the failed flag.
+class TraceReader {
+ public:
+  TraceReader(const std::byte* data, size_t size)
+      : data_(data), size_(size), offset_(0), failed_(false)
+  {
+  }
+
+  auto done() const -> bool { return offset_ >= size_ || failed_; }
+  auto failed() const -> bool { return failed_; }
+
+  // Returns false at the end or on a truncated record.
+  auto next(TraceOp& op, TraceReader& payload) -> bool
+  {
+    uint32_t size = 0;
+    op = get<TraceOp>();
+    size = get<uint32_t>();
+    if (failed_ || size > size_ - offset_) {
+      failed_ = true;
+      return false;
+    }
+    payload = TraceReader(data_ + offset_, size);
+    offset_ += size;
+    return true;
+  }
+
+  template <typename T>
+  auto get() -> T
+  {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only plain values can be read.");
+    T value;
+    if (sizeof(T) > size_ - offset_ || offset_ > size_) {
+      failed_ = true;
+      memset(&value, 0, sizeof(T));
+      return value;
+    }
+    memcpy(&value, data_ + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return value;
+  }
+
+  // Points in the trace, valid as long as its data.
+  template <typename T>
+  auto get_array(uint32_t& count) -> const T*
+  {
+    count = get<uint32_t>();
+    offset_ = (offset_ + TRACE_ALIGNMENT - 1) / TRACE_ALIGNMENT *
+              TRACE_ALIGNMENT;
+    if (failed_ || offset_ > size_ ||
+        uint64_t{count} * sizeof(T) > size_ - offset_) {
+      failed_ = true;
+      count = 0;
+      return nullptr;
+    }
+    const auto* values = reinterpret_cast<const T*>(data_ + offset_);
+    offset_ += sizeof(T) * count;
+    return values;
+  }
+
+  // Rest of the payload, the nested records.
+  auto rest() -> TraceReader
+  {
+    offset_ = (offset_ + TRACE_ALIGNMENT - 1) / TRACE_ALIGNMENT *
+              TRACE_ALIGNMENT;
+    size_t offset = std::min(offset_, size_);
+    offset_ = size_;
+    return TraceReader(data_ + offset, size_ - offset);
+  }
+
+ private:
+  const std::byte* data_;
+  size_t size_;
+  size_t offset_;
+  bool failed_;
+};
+
+}  // namespace gfx::vk_api
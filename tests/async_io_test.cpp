@@ -0,0 +1,288 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "async_io.h"
+#include "check.h"
+#include "thread_pool.h"
+
+namespace {
+
+using gfx::AsyncIo;
+using gfx::IoBackend;
+using gfx::IoFile;
+using gfx::IoPriority;
+using gfx::IoRequest;
+using gfx::IoResult;
+using gfx::IoStats;
+using gfx::IoStatus;
+using gfx::ThreadPool;
+
+constexpr uint64_t CHUNK_SIZE = 4096;
+// Not a multiple of the chunk size, the last chunk is short.
+constexpr uint64_t FILE_SIZE = 16 * CHUNK_SIZE + 100;
+
+auto pattern(uint64_t offset) -> std::byte
+{
+  return static_cast<std::byte>(offset * 7 % 251);
+}
+
+auto matches(const std::vector<std::byte>& data, uint64_t offset,
+             uint64_t size) -> bool
+{
+  for (uint64_t i = 0; i < size; ++i) {
+    if (data[i] != pattern(offset + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A read recording its result once its callback ran.
+struct PendingRead {
+  std::vector<std::byte> data;
+  IoResult result = {0, IoStatus::failed, ~0ull};
+  bool called = false;
+};
+
+auto read(AsyncIo& io, IoFile file, uint64_t offset, uint64_t size,
+          PendingRead& pending, IoPriority priority = IoPriority::normal)
+    -> IoRequest
+{
+  pending.data.assign(size, std::byte{0});
+  return io.read({file, offset, size, pending.data.data(), priority,
+                  [&pending](const IoResult& result) {
+                    pending.result = result;
+                    pending.called = true;
+                  }});
+}
+
+// Whole files and unaligned ranges come back in chunks, in one piece.
+auto test_chunked_reads(AsyncIo& io, IoFile file) -> void
+{
+  GFX_CHECK(io.size(file) == FILE_SIZE);
+  IoStats before = io.stats();
+  PendingRead whole;
+  PendingRead range;
+  IoRequest whole_request = read(io, file, 0, FILE_SIZE, whole);
+  read(io, file, 100, 5000, range);
+  io.wait(whole_request);
+  GFX_CHECK(whole.called && whole.result.request == whole_request);
+  GFX_CHECK(whole.result.status == IoStatus::done);
+  GFX_CHECK(whole.result.bytes == FILE_SIZE);
+  GFX_CHECK(matches(whole.data, 0, FILE_SIZE));
+  io.wait_idle();
+  GFX_CHECK(range.result.status == IoStatus::done);
+  GFX_CHECK(range.result.bytes == 5000);
+  GFX_CHECK(matches(range.data, 100, 5000));
+
+  IoStats stats = io.stats();
+  GFX_CHECK(stats.reads - before.reads == 2);
+  GFX_CHECK(stats.completed - before.completed == 2);
+  GFX_CHECK(stats.bytes_read - before.bytes_read == FILE_SIZE + 5000);
+  // The thread pool takes one submission per chunk.
+  GFX_CHECK(io.backend() != IoBackend::thread_pool ||
+            stats.submissions - before.submissions == 17 + 2);
+  GFX_CHECK(stats.queued == 0 && stats.in_flight == 0);
+
+  // Nothing to read, done without a submission.
+  PendingRead empty;
+  read(io, file, 0, 0, empty);
+  GFX_CHECK(io.poll() == 1);
+  GFX_CHECK(empty.called && empty.result.status == IoStatus::done);
+}
+
+// A read running past the end gets a short chunk, then nothing: it fails
+// with the bytes the file had.
+auto test_short_reads_fail(AsyncIo& io, IoFile file) -> void
+{
+  PendingRead tail;
+  PendingRead past;
+  read(io, file, FILE_SIZE - 1000, 3 * CHUNK_SIZE, tail);
+  read(io, file, FILE_SIZE + 10, 10, past);
+  io.wait_idle();
+  GFX_CHECK(tail.result.status == IoStatus::failed);
+  GFX_CHECK(tail.result.bytes == 1000);
+  GFX_CHECK(matches(tail.data, FILE_SIZE - 1000, 1000));
+  GFX_CHECK(past.result.status == IoStatus::failed);
+  GFX_CHECK(past.result.bytes == 0);
+}
+
+// One read in flight at a time: the queued ones go highest priority first.
+auto test_priorities(ThreadPool& thread_pool, IoBackend backend,
+                     const std::string& path) -> void
+{
+  AsyncIo io(thread_pool, {backend, 1, CHUNK_SIZE});
+  IoFile file = io.open(path.c_str());
+  std::vector<IoPriority> order;
+  std::vector<std::byte> data(3 * CHUNK_SIZE);
+  for (IoPriority priority :
+       {IoPriority::background, IoPriority::normal, IoPriority::urgent}) {
+    io.read({file, 0, CHUNK_SIZE,
+             data.data() + static_cast<uint32_t>(priority) * CHUNK_SIZE,
+             priority, [&order, priority](const IoResult& result) {
+               if (result.status == IoStatus::done) {
+                 order.push_back(priority);
+               }
+             }});
+  }
+  io.wait_idle();
+  GFX_CHECK(order.size() == 3);
+  if (order.size() == 3) {
+    GFX_CHECK(order[0] == IoPriority::urgent);
+    GFX_CHECK(order[1] == IoPriority::normal);
+    GFX_CHECK(order[2] == IoPriority::background);
+  }
+}
+
+// A queued read is dropped, one in flight finishes cancelled whatever its
+// chunk read. The reads after them are not confused with the cancel
+// entries of the ring.
+auto test_cancellation(ThreadPool& thread_pool, IoBackend backend,
+                       const std::string& path) -> void
+{
+  {
+    AsyncIo io(thread_pool, {backend, 1, CHUNK_SIZE});
+    IoFile file = io.open(path.c_str());
+    PendingRead in_flight;
+    PendingRead queued;
+    IoRequest in_flight_request = read(io, file, 0, FILE_SIZE, in_flight);
+    IoRequest queued_request = read(io, file, 0, CHUNK_SIZE, queued);
+    io.poll();
+    GFX_CHECK(io.stats().in_flight == 1 && io.stats().queued == 1);
+    GFX_CHECK(io.cancel(queued_request));
+    GFX_CHECK(io.stats().queued == 0);
+    GFX_CHECK(io.cancel(in_flight_request));
+    GFX_CHECK(io.cancel(in_flight_request));
+    io.wait_idle();
+    GFX_CHECK(in_flight.result.status == IoStatus::cancelled);
+    GFX_CHECK(in_flight.result.bytes <= CHUNK_SIZE);
+    GFX_CHECK(queued.result.status == IoStatus::cancelled);
+    GFX_CHECK(queued.result.bytes == 0);
+    GFX_CHECK(!io.cancel(in_flight_request));
+    GFX_CHECK(io.stats().cancelled == 2);
+
+    PendingRead after;
+    io.wait(read(io, file, 0, 2 * CHUNK_SIZE, after));
+    GFX_CHECK(after.result.status == IoStatus::done);
+    GFX_CHECK(matches(after.data, 0, 2 * CHUNK_SIZE));
+  }
+
+  // The destructor cancels what is left, the callbacks still run.
+  PendingRead in_flight;
+  PendingRead queued;
+  {
+    AsyncIo io(thread_pool, {backend, 1, CHUNK_SIZE});
+    IoFile file = io.open(path.c_str());
+    read(io, file, 0, FILE_SIZE, in_flight);
+    read(io, file, 0, CHUNK_SIZE, queued);
+    io.poll();
+  }
+  GFX_CHECK(in_flight.called &&
+            in_flight.result.status == IoStatus::cancelled);
+  GFX_CHECK(queued.called && queued.result.status == IoStatus::cancelled);
+}
+
+// A chunk completing with EAGAIN is read again, any other error fails the
+// read. On the ring, a busy enter keeps the entries for the next poll and
+// a failed one takes them back and fails their reads.
+auto test_injected_faults(AsyncIo& io, IoFile file) -> void
+{
+  PendingRead retried;
+  io.inject_faults({0, 0, EAGAIN, 1});
+  io.wait(read(io, file, 0, 2 * CHUNK_SIZE, retried));
+  GFX_CHECK(retried.result.status == IoStatus::done);
+  GFX_CHECK(retried.result.bytes == 2 * CHUNK_SIZE);
+  GFX_CHECK(matches(retried.data, 0, 2 * CHUNK_SIZE));
+
+  PendingRead failed;
+  io.inject_faults({0, 0, EIO, 1});
+  io.wait(read(io, file, 0, 2 * CHUNK_SIZE, failed));
+  GFX_CHECK(failed.result.status == IoStatus::failed);
+  GFX_CHECK(failed.result.bytes == 0);
+
+  if (io.backend() != IoBackend::io_uring) {
+    return;
+  }
+  PendingRead busy;
+  io.inject_faults({EAGAIN, 1, 0, 0});
+  IoRequest busy_request = read(io, file, 0, CHUNK_SIZE, busy);
+  io.poll();
+  GFX_CHECK(!busy.called && io.stats().in_flight == 1);
+  io.wait(busy_request);
+  GFX_CHECK(busy.result.status == IoStatus::done);
+  GFX_CHECK(matches(busy.data, 0, CHUNK_SIZE));
+
+  PendingRead refused;
+  PendingRead later;
+  io.inject_faults({EINVAL, 1, 0, 0});
+  read(io, file, 0, CHUNK_SIZE, refused);
+  read(io, file, CHUNK_SIZE, CHUNK_SIZE, later);
+  io.poll();
+  GFX_CHECK(refused.called && refused.result.status == IoStatus::failed);
+  GFX_CHECK(later.called && later.result.status == IoStatus::failed);
+  GFX_CHECK(io.stats().in_flight == 0);
+
+  // The ring still works.
+  PendingRead recovered;
+  io.wait(read(io, file, CHUNK_SIZE, CHUNK_SIZE, recovered));
+  GFX_CHECK(recovered.result.status == IoStatus::done);
+  GFX_CHECK(matches(recovered.data, CHUNK_SIZE, CHUNK_SIZE));
+}
+
+auto test_backend(ThreadPool& thread_pool, IoBackend backend,
+                  const std::string& path) -> void
+{
+  AsyncIo io(thread_pool, {backend, 4, CHUNK_SIZE});
+  GFX_CHECK(backend != IoBackend::thread_pool ||
+            io.backend() == IoBackend::thread_pool);
+  GFX_CHECK(io.open((path + ".missing").c_str()) == gfx::INVALID_IO_FILE);
+  IoFile file = io.open(path.c_str());
+  GFX_CHECK(file != gfx::INVALID_IO_FILE);
+  if (file == gfx::INVALID_IO_FILE) {
+    return;
+  }
+  test_chunked_reads(io, file);
+  test_short_reads_fail(io, file);
+  test_injected_faults(io, file);
+  io.close(file);
+
+  test_priorities(thread_pool, backend, path);
+  test_cancellation(thread_pool, backend, path);
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Async I/O tests                                              //
+//                                                              //
+// Reads a generated file in chunks, past its end, by priority  //
+// and with cancellations, then with injected chunk and         //
+// submission errors. Runs once on the thread pool and once on  //
+// the default backend, io_uring where the kernel has it.       //
+// Usage: vulkan-learning-async-io-test                         //
+// ************************************************************ //
+auto main() -> int
+{
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-io-test";
+  std::filesystem::create_directories(directory);
+  std::string path = (directory / "data.bin").string();
+  std::vector<std::byte> data(FILE_SIZE);
+  for (uint64_t i = 0; i < FILE_SIZE; ++i) {
+    data[i] = pattern(i);
+  }
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(reinterpret_cast<const char*>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+
+  ThreadPool thread_pool(2);
+  test_backend(thread_pool, IoBackend::thread_pool, path);
+  test_backend(thread_pool, IoBackend::automatic, path);
+  std::filesystem::remove_all(directory);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "vulkan_capture.h"
+#include "vulkan_test.h"
+#include "vulkan_trace.h"
+
+namespace {
+
+using gfx::vk_api::Buffer;
+using gfx::vk_api::TRACE_CHUNK_SIZE;
+using gfx::vk_api::TraceHeader;
+using gfx::vk_api::TraceOp;
+using gfx::vk_api::TraceReader;
+using gfx::vk_api::VulkanDevice;
+
+constexpr uint32_t FRAMES = 2;
+// Two identical chunks and a short one.
+constexpr VkDeviceSize SOURCE_SIZE = 2 * TRACE_CHUNK_SIZE + 256;
+
+auto read_file(const std::string& path) -> std::vector<std::byte>
+{
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  std::vector<std::byte> data(bytes.size());
+  memcpy(data.data(), bytes.data(), bytes.size());
+  return data;
+}
+
+auto write_file(const std::string& path, const std::vector<std::byte>& data)
+    -> void
+{
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(reinterpret_cast<const char*>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+}
+
+auto replay(const std::string& replay_path, const std::string& trace_path)
+    -> bool
+{
+  std::string command =
+      "\"" + replay_path + "\" \"" + trace_path + "\" --null-driver --loops 2";
+  return std::system(command.c_str()) == 0;
+}
+
+// Copies the mapped source to a device local buffer every frame, the
+// second frame after changing the first chunk of the source.
+auto capture(VulkanDevice& device, const std::string& trace_path) -> void
+{
+  Buffer source;
+  Buffer destination;
+  GFX_CHECK(gfx::vk_api::create_buffer(
+                device, SOURCE_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                0, false, source) == VK_SUCCESS);
+  GFX_CHECK(gfx::vk_api::create_buffer(
+                device, SOURCE_SIZE, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false,
+                destination) == VK_SUCCESS);
+  if (source.mapped == nullptr) {
+    return;
+  }
+  auto* bytes = static_cast<std::byte*>(source.mapped);
+  for (VkDeviceSize i = 0; i < SOURCE_SIZE; ++i) {
+    bytes[i] = static_cast<std::byte>(i % TRACE_CHUNK_SIZE % 251);
+  }
+
+  GFX_CHECK(gfx::vk_api::begin_capture(device, trace_path.c_str(), FRAMES));
+  GFX_CHECK(gfx::vk_api::capturing());
+  for (uint32_t frame = 0; frame < FRAMES; ++frame) {
+    if (frame > 0) {
+      bytes[0] = std::byte{0xff};
+    }
+    GFX_CHECK(gfx::test::submit_and_wait(
+                  device, [&](VkCommandBuffer command_buffer) {
+                    VkBufferCopy region = {0, 0, SOURCE_SIZE};
+                    device.vkCmdCopyBuffer(command_buffer, source.buffer,
+                                           destination.buffer, 1, &region);
+                  }) == VK_SUCCESS);
+    gfx::vk_api::end_capture_frame();
+  }
+  GFX_CHECK(!gfx::vk_api::capturing());
+  gfx::vk_api::destroy_buffer(device, source);
+  gfx::vk_api::destroy_buffer(device, destination);
+}
+
+// The header bounds the ids, identical chunks share a blob, and replay
+// rejects ids past the bounds.
+auto test_trace(const std::string& replay_path, const std::string& trace_path)
+    -> void
+{
+  std::vector<std::byte> trace = read_file(trace_path);
+  TraceHeader header = {};
+  GFX_CHECK(trace.size() > sizeof(header));
+  if (trace.size() <= sizeof(header)) {
+    return;
+  }
+  memcpy(&header, trace.data(), sizeof(header));
+  GFX_CHECK(header.magic == gfx::vk_api::TRACE_MAGIC);
+  GFX_CHECK(header.frame_count == FRAMES);
+  GFX_CHECK(header.id_count > 1 && header.blob_count > 1);
+
+  uint32_t blobs = 0;
+  uint32_t memory_writes = 0;
+  uint32_t frames = 0;
+  TraceReader reader(trace.data() + sizeof(header),
+                     trace.size() - sizeof(header));
+  TraceOp op;
+  TraceReader payload(nullptr, 0);
+  while (!reader.done() && reader.next(op, payload)) {
+    if (op == TraceOp::blob) {
+      auto id = payload.get<uint32_t>();
+      GFX_CHECK(id > 0 && id < header.blob_count);
+      ++blobs;
+    }
+    memory_writes += op == TraceOp::memory_write ? 1 : 0;
+    frames += op == TraceOp::frame_end ? 1 : 0;
+  }
+  GFX_CHECK(!reader.failed());
+  GFX_CHECK(frames == FRAMES);
+  GFX_CHECK(blobs == header.blob_count - 1);
+  // The second chunk of the source is the first one's blob.
+  GFX_CHECK(blobs < memory_writes);
+
+  GFX_CHECK(replay(replay_path, trace_path));
+
+  std::string corrupt_path = trace_path + ".corrupt";
+  std::vector<std::byte> corrupt = trace;
+  uint32_t count = header.id_count - 1;
+  memcpy(corrupt.data() + offsetof(TraceHeader, id_count), &count,
+         sizeof(count));
+  write_file(corrupt_path, corrupt);
+  GFX_CHECK(!replay(replay_path, corrupt_path));
+  corrupt = trace;
+  count = header.blob_count - 1;
+  memcpy(corrupt.data() + offsetof(TraceHeader, blob_count), &count,
+         sizeof(count));
+  write_file(corrupt_path, corrupt);
+  GFX_CHECK(!replay(replay_path, corrupt_path));
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Capture tests                                                //
+//                                                              //
+// Captures frames copying mapped memory on the null driver,    //
+// checks the records of the trace and replays it with the      //
+// replay tool, then checks that the tool rejects the trace     //
+// with the id counts of its header lowered.                    //
+// Usage: vulkan-learning-capture-test path/to/replay           //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  if (argc != 2) {
+    std::cerr << "Usage: vulkan-learning-capture-test path/to/replay"
+              << std::endl;
+    return 1;
+  }
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-capture-test";
+  std::filesystem::create_directories(directory);
+  std::string trace_path = (directory / "frames.trace").string();
+
+  gfx::vk_api::enable_capture();
+  VulkanDevice device;
+  if (gfx::test::create_device(false, device) != VK_SUCCESS) {
+    return 1;
+  }
+  capture(device, trace_path);
+  gfx::test::destroy_device(device);
+  test_trace(argv[1], trace_path);
+  std::filesystem::remove_all(directory);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
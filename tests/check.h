@@ -0,0 +1,20 @@
+#pragma once
+
+#include <iostream>
+
+namespace gfx::test {
+
+// Number of failed checks so far, main returns it.
+inline int failures = 0;
+
+}  // namespace gfx::test
+
+// Reports a failed condition and keeps going, so one run shows every failure.
+#define GFX_CHECK(condition)                                              \
+  do {                                                                    \
+    if (!(condition)) {                                                   \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: "      \
+                << #condition << std::endl;                               \
+      ++gfx::test::failures;                                              \
+    }                                                                     \
+  } while (false)
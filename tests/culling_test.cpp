@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "culling.h"
+#include "geometry.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::vk_api::BoundingSphere;
+using gfx::vk_api::CullingView;
+using gfx::vk_api::DepthPyramid;
+using gfx::vk_api::GeometryBatcher;
+using gfx::vk_api::GeometryLimits;
+using gfx::vk_api::GeometryShaders;
+using gfx::vk_api::Instance;
+using gfx::vk_api::MeshHandle;
+using gfx::vk_api::Vertex;
+using gfx::vk_api::VulkanDevice;
+namespace math = gfx::math;
+
+constexpr uint32_t MESH_COUNT = 8;
+// Not a multiple of the culling chunks.
+constexpr uint32_t INSTANCE_COUNT = 1500;
+// Spheres closer than this to a plane are left out, float rounding of the
+// SIMD kernels and the GPU may then legitimately disagree.
+constexpr float PLANE_MARGIN = 1e-2f;
+constexpr const char* BUILD_DRAWS_PATH = "shaders/build_draws.comp.spv";
+constexpr const char* CULL_INSTANCES_PATH = "shaders/cull_instances.comp.spv";
+
+// Scalar culling of one instance, what every path must agree with.
+auto reference_sphere(const BoundingSphere& bounds, const Instance& instance)
+    -> math::Sphere
+{
+  math::Affine transform;
+  memcpy(transform.rows, instance.transform, sizeof(transform.rows));
+  return math::transform_sphere(transform, bounds);
+}
+
+// Signed distance of the sphere to the nearest plane, negative when outside
+// of one of them.
+auto plane_distance(const math::Frustum& frustum, const math::Sphere& sphere)
+    -> float
+{
+  float nearest = INFINITY;
+  for (const math::Vec4& plane : frustum.planes) {
+    nearest = std::min(nearest,
+                       math::dot(math::Vec3{plane.x, plane.y, plane.z},
+                                 sphere.center) +
+                           plane.w + sphere.radius);
+  }
+  return nearest;
+}
+
+// Meshes of different sizes, and instances scattered around the camera with
+// random rotations and scales, about half of them in view. Some instances
+// have no mesh.
+struct Scene {
+  Scene()
+      : view_projection(math::perspective(1.0f, 16.0f / 9.0f, 0.1f, 100.0f) *
+                        math::look_at({0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f},
+                                      {0.0f, 1.0f, 0.0f})),
+        frustum(math::extract_frustum(view_projection))
+  {
+    for (uint32_t i = 0; i < MESH_COUNT; ++i) {
+      float size = 0.5f + static_cast<float>(i);
+      vertices.push_back({{-size, -size, -size}, {}, {}});
+      vertices.push_back({{size, size * 0.5f, size}, {}, {}});
+      bounds.push_back(
+          gfx::vk_api::compute_bounding_sphere(&vertices[2 * i], 2));
+    }
+
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_int_distribution<uint32_t> mesh(0, MESH_COUNT);
+    while (instances.size() < INSTANCE_COUNT) {
+      Instance instance = {};
+      math::Affine transform = math::compose(
+          {position(random), position(random), position(random) - 40.0f},
+          math::axis_angle(math::normalize(math::Vec3{unit(random),
+                                                      unit(random),
+                                                      unit(random) + 0.1f}),
+                           6.0f * unit(random)),
+          {0.5f + unit(random), 0.5f + unit(random), 0.5f + unit(random)});
+      memcpy(instance.transform, transform.rows, sizeof(instance.transform));
+      instance.mesh = mesh(random);
+      if (instance.mesh == MESH_COUNT) {
+        instance.mesh = UINT32_MAX;
+      }
+      else if (std::fabs(plane_distance(
+                   frustum, reference_sphere(bounds[instance.mesh],
+                                             instance))) < PLANE_MARGIN) {
+        continue;
+      }
+      instances.push_back(instance);
+    }
+  }
+
+  auto visible(uint32_t i) const -> bool
+  {
+    const Instance& instance = instances[i];
+    return instance.mesh < MESH_COUNT &&
+           math::is_visible(frustum,
+                            reference_sphere(bounds[instance.mesh], instance));
+  }
+
+  math::Mat4 view_projection;
+  math::Frustum frustum;
+  std::vector<Vertex> vertices;
+  std::vector<BoundingSphere> bounds;
+  std::vector<Instance> instances;
+};
+
+// Visible instances of every mesh, sorted.
+auto reference_visible(const Scene& scene)
+    -> std::vector<std::vector<uint32_t>>
+{
+  std::vector<std::vector<uint32_t>> visible(MESH_COUNT);
+  for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+    if (scene.visible(i)) {
+      visible[scene.instances[i].mesh].push_back(i);
+    }
+  }
+  return visible;
+}
+
+// The instances each command of a build draws, sorted.
+auto drawn_instances(const VkDrawIndexedIndirectCommand* commands,
+                     const uint32_t* instance_indices)
+    -> std::vector<std::vector<uint32_t>>
+{
+  std::vector<std::vector<uint32_t>> drawn(MESH_COUNT);
+  for (uint32_t mesh = 0; mesh < MESH_COUNT; ++mesh) {
+    const uint32_t* first = instance_indices + commands[mesh].firstInstance;
+    drawn[mesh].assign(first, first + commands[mesh].instanceCount);
+    std::sort(drawn[mesh].begin(), drawn[mesh].end());
+  }
+  return drawn;
+}
+
+auto test_bounding_sphere_encloses_vertices() -> void
+{
+  Vertex vertices[] = {{{1.0f, 2.0f, 3.0f}, {}, {}},
+                       {{-1.0f, 0.0f, 3.0f}, {}, {}},
+                       {{0.0f, 4.0f, -1.0f}, {}, {}}};
+  BoundingSphere sphere =
+      gfx::vk_api::compute_bounding_sphere(vertices, std::size(vertices));
+  for (const Vertex& vertex : vertices) {
+    math::Vec3 position = {vertex.position[0], vertex.position[1],
+                           vertex.position[2]};
+    GFX_CHECK(math::length(position - sphere.center) <=
+              sphere.radius + 1e-5f);
+  }
+  GFX_CHECK(gfx::vk_api::compute_bounding_sphere(vertices, 0).radius == 0.0f);
+}
+
+auto test_cpu_culling_matches_reference() -> void
+{
+  Scene scene;
+  std::vector<uint32_t> expected;
+  for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+    if (scene.visible(i)) {
+      expected.push_back(i);
+    }
+  }
+  // Neither everything nor nothing in view.
+  GFX_CHECK(expected.size() > INSTANCE_COUNT / 10);
+  GFX_CHECK(expected.size() < INSTANCE_COUNT * 9 / 10);
+
+  std::vector<uint32_t> visible(INSTANCE_COUNT);
+  uint32_t count = gfx::vk_api::cull_instances(
+      scene.frustum, scene.bounds.data(), MESH_COUNT, scene.instances.data(),
+      INSTANCE_COUNT, visible.data());
+  visible.resize(count);
+  GFX_CHECK(visible == expected);
+}
+
+// Batcher holding the scene, culled on the GPU when given the shaders.
+auto create_batcher(VulkanDevice& device, const Scene& scene,
+                    const GeometryShaders& shaders)
+    -> std::unique_ptr<GeometryBatcher>
+{
+  GeometryLimits limits;
+  limits.mesh_capacity = MESH_COUNT;
+  limits.instance_capacity = INSTANCE_COUNT;
+  limits.frames_in_flight = 1;
+  std::unique_ptr<GeometryBatcher> batcher;
+  GFX_CHECK(GeometryBatcher::create(device, limits, shaders, batcher) ==
+            VK_SUCCESS);
+  if (!batcher) {
+    return nullptr;
+  }
+  uint32_t index = 0;
+  for (uint32_t i = 0; i < MESH_COUNT; ++i) {
+    MeshHandle mesh;
+    GFX_CHECK(batcher->add_mesh(&scene.vertices[2 * i], 2, &index, 1, mesh) ==
+              VK_SUCCESS);
+  }
+  std::vector<math::Affine> transforms(INSTANCE_COUNT);
+  std::vector<uint32_t> meshes(INSTANCE_COUNT);
+  for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+    memcpy(transforms[i].rows, scene.instances[i].transform,
+           sizeof(transforms[i].rows));
+    meshes[i] = scene.instances[i].mesh;
+  }
+  GFX_CHECK(batcher->resize_instances(INSTANCE_COUNT) == VK_SUCCESS);
+  batcher->write_instances(0, INSTANCE_COUNT, transforms.data(),
+                           meshes.data());
+  return batcher;
+}
+
+auto test_batcher_cpu_culling_matches_reference(VulkanDevice& device) -> void
+{
+  Scene scene;
+  std::unique_ptr<GeometryBatcher> batcher =
+      create_batcher(device, scene, {});
+  if (!batcher) {
+    return;
+  }
+  GFX_CHECK(!batcher->uses_gpu_culling());
+
+  CullingView view = {scene.view_projection, nullptr, false};
+  batcher->record_build(VK_NULL_HANDLE, &view);
+  std::vector<std::vector<uint32_t>> expected = reference_visible(scene);
+  GFX_CHECK(drawn_instances(batcher->draw_commands(),
+                            batcher->instance_indices()) == expected);
+  uint32_t visible_count = 0;
+  for (const std::vector<uint32_t>& mesh : expected) {
+    visible_count += static_cast<uint32_t>(mesh.size());
+  }
+  GFX_CHECK(batcher->stats().visible_instances == visible_count);
+}
+
+auto test_depth_pyramid_levels(VulkanDevice& device) -> void
+{
+  // The null driver takes any SPIR-V, only the magic number is given.
+  std::vector<uint32_t> spirv = {0x07230203};
+  std::unique_ptr<DepthPyramid> pyramid;
+  GFX_CHECK(DepthPyramid::create(device, VK_NULL_HANDLE, 640, 360, spirv,
+                                 pyramid) == VK_SUCCESS);
+  if (!pyramid) {
+    return;
+  }
+  GFX_CHECK(pyramid->mip_count() == 10);
+  GFX_CHECK(pyramid->view() != VK_NULL_HANDLE);
+  GFX_CHECK(pyramid->sampler() != VK_NULL_HANDLE);
+}
+
+// Culls the scene with the cull_instances compute pass and compares the
+// visible instances of every mesh with the scalar reference.
+auto test_gpu_culling_matches_reference(VulkanDevice& device,
+                                        const GeometryShaders& shaders)
+    -> bool
+{
+  Scene scene;
+  std::unique_ptr<GeometryBatcher> batcher =
+      create_batcher(device, scene, shaders);
+  if (!batcher || !batcher->uses_gpu_culling()) {
+    return false;
+  }
+
+  CullingView view = {scene.view_projection, nullptr, false};
+  GFX_CHECK(gfx::test::submit_and_wait(device, [&](VkCommandBuffer commands) {
+    batcher->record_build(commands, &view);
+  }) == VK_SUCCESS);
+  GFX_CHECK(drawn_instances(batcher->draw_commands(),
+                            batcher->instance_indices()) ==
+            reference_visible(scene));
+  return true;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Culling tests                                                //
+//                                                              //
+// Checks the SIMD frustum culling against a scalar reference,  //
+// then the batcher's CPU culling and the depth pyramid on the  //
+// null driver. With --gpu, culls on the device with the        //
+// cull_instances pass and compares the visible instances with  //
+// the reference, skipped without a device or the shaders.      //
+// Usage: vulkan-learning-culling-test [--gpu]                  //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  bool gpu = argc > 1 && strcmp(argv[1], "--gpu") == 0;
+  if (!gpu) {
+    test_bounding_sphere_encloses_vertices();
+    test_cpu_culling_matches_reference();
+  }
+  VulkanDevice device;
+  if (gfx::test::create_device(gpu, device) != VK_SUCCESS) {
+    return gpu ? gfx::test::SKIPPED : 1;
+  }
+
+  bool skipped = false;
+  if (gpu) {
+    GeometryShaders shaders;
+    shaders.build_draws = gfx::vk_api::load_spirv(BUILD_DRAWS_PATH);
+    shaders.cull_instances = gfx::vk_api::load_spirv(CULL_INSTANCES_PATH);
+    skipped = shaders.build_draws.empty() || shaders.cull_instances.empty() ||
+              !test_gpu_culling_matches_reference(device, shaders);
+    if (skipped) {
+      std::cerr << "No culling pipeline, skipping." << std::endl;
+    }
+  }
+  else {
+    test_batcher_cpu_culling_matches_reference(device);
+    test_depth_pyramid_levels(device);
+  }
+  gfx::test::destroy_device(device);
+
+  if (gfx::test::failures > 0) {
+    return 1;
+  }
+  return skipped ? gfx::test::SKIPPED : 0;
+}
@@ -0,0 +1,167 @@
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include "check.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::vk_api::build;
+using gfx::vk_api::DeletionQueue;
+using gfx::vk_api::DeletionQueueStats;
+using gfx::vk_api::null_driver_call_count;
+using gfx::vk_api::QueueTimeline;
+using gfx::vk_api::VulkanDevice;
+
+// Long enough that a batch just submitted is still running when checked.
+constexpr uint32_t GPU_BATCH_US = 20000;
+
+auto submit_empty(QueueTimeline& timeline, VkFence fence = VK_NULL_HANDLE)
+    -> uint64_t
+{
+  VkSubmitInfo submit_info = build<VkSubmitInfo>();
+  return timeline.submit(&submit_info, 1, fence);
+}
+
+// Values come from the timeline semaphore, or from a fence per submission
+// that is recycled once signaled. A fence of the caller takes a second
+// submission in fence mode.
+auto test_timeline_values(VulkanDevice& device, bool timeline_semaphores)
+    -> void
+{
+  QueueTimeline& timeline = *device.graphics_timeline;
+  GFX_CHECK(timeline.uses_timeline_semaphore() == timeline_semaphores);
+  GFX_CHECK((timeline.semaphore() != VK_NULL_HANDLE) == timeline_semaphores);
+
+  uint64_t submits = null_driver_call_count("vkQueueSubmit");
+  uint64_t value = submit_empty(timeline);
+  GFX_CHECK(value == timeline.last_submitted_value());
+  GFX_CHECK(timeline.completed_value() < value);
+  bool deleted = false;
+  timeline.defer(value, [&deleted] { deleted = true; });
+  GFX_CHECK(timeline.collect() == 0 && !deleted);
+  GFX_CHECK(timeline.wait_until(value));
+  GFX_CHECK(timeline.completed_value() >= value);
+  GFX_CHECK(timeline.collect() == 1 && deleted);
+  GFX_CHECK(null_driver_call_count("vkQueueSubmit") - submits == 1);
+
+  VkFence fence = gfx::vk_api::create_fence(device, false);
+  submits = null_driver_call_count("vkQueueSubmit");
+  value = submit_empty(timeline, fence);
+  GFX_CHECK(value != 0);
+  GFX_CHECK(null_driver_call_count("vkQueueSubmit") - submits ==
+            (timeline_semaphores ? 1 : 2));
+  GFX_CHECK(timeline.wait_until(value));
+  GFX_CHECK(device.vkGetFenceStatus(device.logical_device, fence) ==
+            VK_SUCCESS);
+  device.vkDestroyFence(device.logical_device, fence,
+                        gfx::vk_api::allocation_callbacks());
+
+  uint64_t fences = null_driver_call_count("vkCreateFence");
+  for (int i = 0; i < 8; ++i) {
+    GFX_CHECK(timeline.wait_until(submit_empty(timeline)));
+  }
+  GFX_CHECK(null_driver_call_count("vkCreateFence") - fences <=
+            (timeline_semaphores ? 0 : 1));
+  GFX_CHECK(timeline.wait_idle());
+}
+
+// Two slots of 4 objects besides the current one. The 5th object of a frame
+// closes it early, a closed slot waits for both timelines, and the stats
+// count the frames and time between release and destruction.
+auto test_deletion_queue(VulkanDevice& device) -> void
+{
+  // A second timeline on the same queue stands in for a compute queue, the
+  // null driver only has one.
+  std::shared_ptr<QueueTimeline> graphics = device.graphics_timeline;
+  auto compute = std::make_shared<QueueTimeline>(device, device.graphics_queue);
+  device.compute_timeline = compute;
+  {
+    DeletionQueue queue(device, 2, 4);
+    uint64_t destroyed = null_driver_call_count("vkDestroySemaphore");
+    auto destroyed_since = [&destroyed]() {
+      return null_driver_call_count("vkDestroySemaphore") - destroyed;
+    };
+
+    for (int i = 0; i < 5; ++i) {
+      queue.destroy(gfx::vk_api::create_semaphore(device));
+    }
+    DeletionQueueStats stats = queue.stats();
+    GFX_CHECK(stats.full_frames == 1);
+    GFX_CHECK(stats.enqueued == 5 && stats.pending == 5);
+    // Nothing was submitted, the early closed frame retired already.
+    GFX_CHECK(queue.collect() == 4);
+    GFX_CHECK(destroyed_since() == 4);
+
+    // The graphics batch ends first, the compute one runs after it.
+    uint64_t graphics_value = submit_empty(*graphics);
+    uint64_t compute_value = submit_empty(*compute);
+    queue.destroy(gfx::vk_api::create_semaphore(device));
+    queue.next_frame();
+    GFX_CHECK(graphics->wait_until(graphics_value));
+    GFX_CHECK(queue.collect() == 0);
+    GFX_CHECK(compute->wait_until(compute_value));
+    GFX_CHECK(queue.collect() == 2);
+    GFX_CHECK(destroyed_since() == 6);
+
+    // Released two frames ago.
+    queue.destroy(gfx::vk_api::create_semaphore(device));
+    queue.next_frame();
+    queue.next_frame();
+    GFX_CHECK(queue.collect() == 1);
+    stats = queue.stats();
+    GFX_CHECK(stats.destroyed == 7 && stats.pending == 0);
+    GFX_CHECK(stats.peak_pending == 5);
+    GFX_CHECK(stats.min_latency_frames == 1);
+    GFX_CHECK(stats.max_latency_frames == 2);
+    // Six objects freed a frame after their release, one two frames after.
+    GFX_CHECK(stats.average_latency_frames > 1.14 &&
+              stats.average_latency_frames < 1.15);
+    GFX_CHECK(stats.max_latency_ms >= GPU_BATCH_US / 1000.0);
+    GFX_CHECK(stats.average_latency_ms <= stats.max_latency_ms);
+
+    queue.destroy(gfx::vk_api::create_semaphore(device));
+    submit_empty(*compute);
+  }
+  // Destroying the queue waits for the timelines and frees the rest.
+  GFX_CHECK(compute->completed_value() == compute->last_submitted_value());
+  device.compute_timeline = graphics;
+}
+
+auto test_with_null_driver(bool timeline_semaphores) -> void
+{
+  gfx::vk_api::NullDriverConfig config;
+  config.gpu_batch_us = GPU_BATCH_US;
+  config.timeline_semaphores = timeline_semaphores;
+  gfx::vk_api::enable_null_driver(config);
+  VulkanDevice device;
+  if (gfx::vk_api::initialize(true) != VK_SUCCESS ||
+      gfx::vk_api::create_headless_device(device) != VK_SUCCESS) {
+    std::cerr << "Could not create the device." << std::endl;
+    ++gfx::test::failures;
+    return;
+  }
+  test_timeline_values(device, timeline_semaphores);
+  test_deletion_queue(device);
+  gfx::test::destroy_device(device);
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Deletion queue tests                                         //
+//                                                              //
+// Checks the values of a queue timeline, then releases objects //
+// to a deletion queue between submissions to two timelines,    //
+// with slow simulated GPU batches. Runs on the null driver     //
+// with timeline semaphores, then with the fence fallback.      //
+// Usage: vulkan-learning-deletion-queue-test                   //
+// ************************************************************ //
+auto main() -> int
+{
+  test_with_null_driver(true);
+  test_with_null_driver(false);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
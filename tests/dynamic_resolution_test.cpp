@@ -0,0 +1,130 @@
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include "check.h"
+#include "dynamic_resolution.h"
+
+namespace {
+
+using gfx::ResolutionController;
+using gfx::ResolutionSettings;
+
+constexpr float EPSILON = 1e-5f;
+
+auto near(double a, double b) -> bool { return std::abs(a - b) < EPSILON; }
+
+// Smoothed times in [14.4, 17.6] ms keep the scale, whatever the noise.
+auto test_hysteresis_band_keeps_the_scale() -> void
+{
+  ResolutionController controller;
+  for (int frame = 0; frame < 100; ++frame) {
+    GFX_CHECK(controller.update(frame % 2 == 0 ? 14.5 : 17.5) == 1.0f);
+  }
+  for (int frame = 0; frame < 100; ++frame) {
+    GFX_CHECK(controller.update(17.4) == 1.0f);
+  }
+  GFX_CHECK(controller.smoothed_ms() <= 17.6);
+
+  // Just past the band, the scale moves.
+  ResolutionController outside;
+  GFX_CHECK(outside.update(17.7) < 1.0f);
+}
+
+// Twice the target would take a scale of 0.707, the step stops at 0.9. The
+// smoothed time is predicted for the new scale.
+auto test_changes_are_limited_to_one_step() -> void
+{
+  ResolutionController controller;
+  GFX_CHECK(near(controller.update(32.0), 0.9));
+  GFX_CHECK(near(controller.smoothed_ms(), 32.0 * 0.81));
+  GFX_CHECK(controller.scaled(1000) == 900);
+
+  ResolutionSettings settings;
+  settings.max_step = 0.5f;
+  ResolutionController large_steps(settings);
+  GFX_CHECK(near(large_steps.update(32.0), std::sqrt(0.5)));
+}
+
+// The frames in flight during a change ran at the old scale, their times
+// are ignored, then the next one counts again.
+auto test_settle_frames_are_ignored() -> void
+{
+  ResolutionController controller;
+  float scale = controller.update(32.0);
+  double smoothed_ms = controller.smoothed_ms();
+  for (uint32_t frame = 0; frame < ResolutionSettings{}.settle_frames;
+       ++frame) {
+    GFX_CHECK(controller.update(1000.0) == scale);
+    GFX_CHECK(controller.smoothed_ms() == smoothed_ms);
+  }
+  GFX_CHECK(controller.update(1000.0) < scale);
+
+  ResolutionSettings settings;
+  settings.settle_frames = 0;
+  ResolutionController unsettled(settings);
+  scale = unsettled.update(32.0);
+  GFX_CHECK(unsettled.update(32.0) < scale);
+}
+
+// A constant overload drives the scale down to min_scale, a constant
+// underload back up to max_scale, one step at most per change.
+auto test_scale_is_clamped() -> void
+{
+  ResolutionSettings settings;
+  ResolutionController controller(settings);
+  float previous = controller.scale();
+  for (int frame = 0; frame < 200; ++frame) {
+    float scale = controller.update(100.0);
+    GFX_CHECK(scale >= settings.min_scale);
+    GFX_CHECK(std::abs(scale - previous) <= settings.max_step + EPSILON);
+    previous = scale;
+  }
+  GFX_CHECK(controller.scale() == settings.min_scale);
+  GFX_CHECK(controller.scaled(1) == 1);
+
+  for (int frame = 0; frame < 200; ++frame) {
+    float scale = controller.update(1.0);
+    GFX_CHECK(scale <= settings.max_scale);
+    GFX_CHECK(std::abs(scale - previous) <= settings.max_step + EPSILON);
+    previous = scale;
+  }
+  GFX_CHECK(controller.scale() == settings.max_scale);
+}
+
+// Frames whose GPU time follows the pixel count, 24 ms at full resolution.
+// The scale settles where the time is in the band, and then stays.
+auto test_trace_converges() -> void
+{
+  ResolutionSettings settings;
+  ResolutionController controller(settings);
+  uint32_t late_changes = 0;
+  float scale = controller.scale();
+  for (int frame = 0; frame < 300; ++frame) {
+    // Some noise, within the band once smoothed.
+    double noise = frame % 3 == 0 ? 0.5 : -0.25;
+    float next = controller.update(24.0 * scale * scale + noise);
+    if (frame >= 100 && next != scale) {
+      ++late_changes;
+    }
+    scale = next;
+  }
+  double gpu_ms = 24.0 * scale * scale;
+  GFX_CHECK(gpu_ms >= settings.target_ms * (1.0 - settings.hysteresis));
+  GFX_CHECK(gpu_ms <= settings.target_ms * (1.0 + settings.hysteresis));
+  GFX_CHECK(late_changes == 0);
+}
+
+}  // namespace
+
+auto main() -> int
+{
+  test_hysteresis_band_keeps_the_scale();
+  test_changes_are_limited_to_one_step();
+  test_settle_frames_are_ignored();
+  test_scale_is_clamped();
+  test_trace_converges();
+  if (gfx::test::failures > 0) {
+    std::cerr << gfx::test::failures << " checks failed." << std::endl;
+  }
+  return gfx::test::failures > 0 ? 1 : 0;
+}
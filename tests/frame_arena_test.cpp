@@ -0,0 +1,306 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "check.h"
+#include "frame_arena.h"
+#include "log.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_metrics.h"
+#include "vulkan_submit.h"
+#include "vulkan_sync.h"
+#include "vulkan_test.h"
+
+namespace {
+
+// Calls to the global operator new, from any thread.
+std::atomic<uint64_t> HEAP_ALLOCATIONS(0);
+
+auto counted_allocate(std::size_t size, std::size_t alignment) -> void*
+{
+  HEAP_ALLOCATIONS.fetch_add(1, std::memory_order_relaxed);
+  void* p = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    p = std::malloc(size > 0 ? size : 1);
+  }
+  else if (posix_memalign(&p, alignment, size > 0 ? size : 1) != 0) {
+    p = nullptr;
+  }
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+}  // namespace
+
+// Every heap allocation of the test binary goes through these, the array
+// and nothrow forms of the standard library call them.
+auto operator new(std::size_t size) -> void*
+{
+  return counted_allocate(size, alignof(std::max_align_t));
+}
+
+auto operator new(std::size_t size, std::align_val_t alignment) -> void*
+{
+  return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+auto operator delete(void* p) noexcept -> void { std::free(p); }
+
+auto operator delete(void* p, std::size_t) noexcept -> void { std::free(p); }
+
+auto operator delete(void* p, std::align_val_t) noexcept -> void
+{
+  std::free(p);
+}
+
+auto operator delete(void* p, std::size_t, std::align_val_t) noexcept -> void
+{
+  std::free(p);
+}
+
+namespace {
+
+using gfx::ArenaScope;
+using gfx::FrameArena;
+using gfx::ScratchVector;
+using gfx::vk_api::build;
+using gfx::vk_api::SubmitRequest;
+using gfx::vk_api::VulkanDevice;
+
+constexpr int FRAMES = 200;
+constexpr int WARM_UP_FRAMES = 8;
+constexpr uint32_t FRAMES_IN_FLIGHT = 3;
+
+struct Frame {
+  VkCommandPool pool;
+  VkCommandBuffer command_buffer;
+  uint64_t retired_value;
+};
+
+// What a deferred deletion captures, larger than what std::function stores
+// without allocating.
+struct Retired {
+  uint64_t* deleted;
+  uint64_t* last_value;
+  uint64_t value;
+};
+
+// Scratch usage of one frame: a few containers whose sizes change from frame
+// to frame, like the enumeration and submit paths.
+auto run_frame(int frame) -> void
+{
+  ArenaScope scratch;
+  ScratchVector<uint32_t> indices(&gfx::frame_arena());
+  for (int i = 0; i < 64 + frame % 32; ++i) {
+    indices.push_back(i);
+  }
+  ScratchVector<uint64_t> values(256 + frame % 128, &gfx::frame_arena());
+  {
+    ArenaScope nested;
+    ScratchVector<char> names(4096, &gfx::frame_arena());
+    GFX_CHECK(names.size() == 4096);
+  }
+  GFX_CHECK(indices.size() == static_cast<size_t>(64 + frame % 32));
+  GFX_CHECK(values.size() == static_cast<size_t>(256 + frame % 128));
+}
+
+auto test_steady_state_frames_do_not_allocate() -> void
+{
+  FrameArena& arena = gfx::frame_arena();
+  for (int frame = 0; frame < WARM_UP_FRAMES; ++frame) {
+    run_frame(frame);
+  }
+  size_t warm = arena.upstream_allocations();
+  size_t capacity = arena.capacity();
+  GFX_CHECK(warm > 0);
+  uint64_t allocations = HEAP_ALLOCATIONS.load();
+  for (int frame = WARM_UP_FRAMES; frame < FRAMES; ++frame) {
+    run_frame(frame);
+    GFX_CHECK(arena.bytes_used() == 0);
+  }
+  GFX_CHECK(arena.upstream_allocations() == warm);
+  GFX_CHECK(arena.capacity() == capacity);
+  GFX_CHECK(HEAP_ALLOCATIONS.load() == allocations);
+}
+
+// One frame of the render loop on the null driver, which has no swap chain:
+// the frame acquires its slot once the GPU retired it, records, submits
+// through the aggregator, defers a deletion on the timeline, releases an
+// object to the deletion queue and advances it.
+auto run_vulkan_frame(VulkanDevice& device, Frame& frame, Retired retired)
+    -> void
+{
+  device.graphics_timeline->wait_until(frame.retired_value);
+  device.graphics_timeline->collect();
+  device.vkResetCommandPool(device.logical_device, frame.pool, 0);
+
+  VkCommandBufferBeginInfo begin_info = build<VkCommandBufferBeginInfo>().set(
+      &VkCommandBufferBeginInfo::flags,
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  device.vkBeginCommandBuffer(frame.command_buffer, &begin_info);
+  device.vkCmdDispatch(frame.command_buffer, 1, 1, 1);
+  device.vkEndCommandBuffer(frame.command_buffer);
+
+  SubmitRequest request = {};
+  request.queue = device.graphics_queue;
+  request.command_buffer_count = 1;
+  request.command_buffers = &frame.command_buffer;
+  device.submit_aggregator->enqueue(request);
+  GFX_CHECK(device.submit_aggregator->flush().result == VK_SUCCESS);
+  frame.retired_value = device.graphics_timeline->last_submitted_value();
+
+  retired.value = frame.retired_value;
+  device.graphics_timeline->defer([retired] {
+    ++*retired.deleted;
+    *retired.last_value = retired.value;
+  });
+  device.deletion_queue->destroy(gfx::vk_api::create_semaphore(device));
+  device.deletion_queue->next_frame();
+  device.deletion_queue->collect();
+  gfx::vk_api::end_metrics_frame();
+}
+
+// Once the pools, rings and arenas fit a frame, the render loop makes no
+// heap allocation at all, on either path of the queue timelines.
+auto test_steady_state_vulkan_frames_do_not_allocate(bool timeline_semaphores)
+    -> void
+{
+  gfx::vk_api::NullDriverConfig config;
+  config.timeline_semaphores = timeline_semaphores;
+  gfx::vk_api::enable_null_driver(config);
+  VulkanDevice device;
+  if (gfx::vk_api::initialize(true) != VK_SUCCESS ||
+      gfx::vk_api::create_headless_device(device) != VK_SUCCESS) {
+    std::cerr << "Could not create the device." << std::endl;
+    ++gfx::test::failures;
+    return;
+  }
+  GFX_CHECK(device.graphics_timeline->uses_timeline_semaphore() ==
+            timeline_semaphores);
+  Frame frames[FRAMES_IN_FLIGHT];
+  for (Frame& frame : frames) {
+    VkCommandPoolCreateInfo pool_create_info =
+        build<VkCommandPoolCreateInfo>().set(
+            &VkCommandPoolCreateInfo::queueFamilyIndex,
+            device.graphics_family);
+    GFX_CHECK(device.vkCreateCommandPool(
+                  device.logical_device, &pool_create_info,
+                  gfx::vk_api::allocation_callbacks(),
+                  &frame.pool) == VK_SUCCESS);
+    VkCommandBufferAllocateInfo allocate_info =
+        build<VkCommandBufferAllocateInfo>()
+            .set(&VkCommandBufferAllocateInfo::commandPool, frame.pool)
+            .set(&VkCommandBufferAllocateInfo::level,
+                 VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+            .set(&VkCommandBufferAllocateInfo::commandBufferCount, 1);
+    GFX_CHECK(device.vkAllocateCommandBuffers(device.logical_device,
+                                              &allocate_info,
+                                              &frame.command_buffer) ==
+              VK_SUCCESS);
+    frame.retired_value = 0;
+  }
+
+  uint64_t deleted = 0;
+  uint64_t last_value = 0;
+  Retired retired = {&deleted, &last_value, 0};
+  int frame = 0;
+  for (; frame < WARM_UP_FRAMES; ++frame) {
+    run_vulkan_frame(device, frames[frame % FRAMES_IN_FLIGHT], retired);
+  }
+  // The logger thread formats the messages of the device creation.
+  gfx::flush_log();
+  uint64_t allocations = HEAP_ALLOCATIONS.load();
+  for (; frame < FRAMES; ++frame) {
+    run_vulkan_frame(device, frames[frame % FRAMES_IN_FLIGHT], retired);
+  }
+  GFX_CHECK(HEAP_ALLOCATIONS.load() == allocations);
+  GFX_CHECK(deleted > 0);
+
+  device.graphics_timeline->wait_idle();
+  GFX_CHECK(device.graphics_timeline->collect() > 0);
+  GFX_CHECK(deleted == FRAMES);
+  GFX_CHECK(last_value == device.graphics_timeline->last_submitted_value());
+  for (Frame& frame : frames) {
+    device.vkDestroyCommandPool(device.logical_device, frame.pool,
+                                gfx::vk_api::allocation_callbacks());
+  }
+  gfx::test::destroy_device(device);
+}
+
+auto test_rewind_across_chunks() -> void
+{
+  FrameArena arena(256);
+  GFX_CHECK(arena.allocate(64, 16) != nullptr);
+  FrameArena::Marker marker = arena.marker();
+  size_t used = arena.bytes_used();
+  GFX_CHECK(used >= 64);
+  for (int i = 0; i < 32; ++i) {
+    GFX_CHECK(arena.allocate(200, 8) != nullptr);
+  }
+  GFX_CHECK(arena.bytes_used() > used);
+  GFX_CHECK(arena.peak_bytes_used() >= arena.bytes_used());
+  size_t chunks = arena.upstream_allocations();
+  GFX_CHECK(chunks > 1);
+
+  arena.rewind(marker);
+  GFX_CHECK(arena.bytes_used() == used);
+  // The chunks are reused after the rewind.
+  for (int i = 0; i < 32; ++i) {
+    GFX_CHECK(arena.allocate(200, 8) != nullptr);
+  }
+  GFX_CHECK(arena.upstream_allocations() == chunks);
+}
+
+auto test_alignment() -> void
+{
+  FrameArena arena(1024);
+  for (size_t alignment = 1; alignment <= 256; alignment *= 2) {
+    GFX_CHECK(arena.allocate(3, 1) != nullptr);
+    void* p = arena.allocate(24, alignment);
+    GFX_CHECK(reinterpret_cast<uintptr_t>(p) % alignment == 0);
+  }
+}
+
+auto test_capacity_counts_every_chunk() -> void
+{
+  FrameArena arena(128);
+  GFX_CHECK(arena.capacity() == 0);
+  GFX_CHECK(arena.allocate(100, 8) != nullptr);
+  size_t one = arena.capacity();
+  GFX_CHECK(one >= 100);
+  // Does not fit in the first chunk, a larger one is added.
+  GFX_CHECK(arena.allocate(1000, 8) != nullptr);
+  GFX_CHECK(arena.upstream_allocations() == 2);
+  GFX_CHECK(arena.capacity() >= one + 1000);
+  GFX_CHECK(arena.bytes_used() >= one + 1000);
+  GFX_CHECK(arena.bytes_used() <= arena.capacity());
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Frame arena tests                                            //
+//                                                              //
+// Counts every call to the global operator new, and checks     //
+// that steady state frames allocate nothing: scratch           //
+// containers on the frame arena, and a render loop on the null //
+// driver. Also checks rewinds, alignment and chunk growth of   //
+// the arena itself.                                            //
+// Usage: vulkan-learning-frame-arena-test                      //
+// ************************************************************ //
+auto main() -> int
+{
+  test_steady_state_frames_do_not_allocate();
+  test_steady_state_vulkan_frames_do_not_allocate(true);
+  test_steady_state_vulkan_frames_do_not_allocate(false);
+  test_rewind_across_chunks();
+  test_alignment();
+  test_capacity_counts_every_chunk();
+  if (gfx::test::failures > 0) {
+    std::cerr << gfx::test::failures << " checks failed." << std::endl;
+  }
+  return gfx::test::failures > 0 ? 1 : 0;
+}
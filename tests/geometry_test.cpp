@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "geometry.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::vk_api::GeometryBatcher;
+using gfx::vk_api::GeometryLimits;
+using gfx::vk_api::GeometryShaders;
+using gfx::vk_api::Instance;
+using gfx::vk_api::MeshHandle;
+using gfx::vk_api::MeshRange;
+using gfx::vk_api::Vertex;
+using gfx::vk_api::VulkanDevice;
+
+constexpr uint32_t MESH_COUNT = 24;
+constexpr uint32_t INSTANCE_COUNT = 1000;
+constexpr const char* BUILD_DRAWS_PATH = "shaders/build_draws.comp.spv";
+
+const float IDENTITY[12] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+                            0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+
+// Meshes with a different index count each, and instances spread over them.
+// Some instances have no mesh, and some meshes no instances.
+struct Scene {
+  Scene()
+  {
+    uint32_t first_index = 0;
+    for (uint32_t i = 0; i < MESH_COUNT; ++i) {
+      meshes.push_back({first_index, 3 * (i + 1), static_cast<int32_t>(4 * i)});
+      first_index += 3 * (i + 1);
+    }
+    std::mt19937 random(7);
+    std::uniform_int_distribution<uint32_t> mesh(0, MESH_COUNT + 1);
+    for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+      Instance instance = {};
+      memcpy(instance.transform, IDENTITY, sizeof(IDENTITY));
+      instance.mesh = mesh(random);
+      // Leave the last meshes empty.
+      if (instance.mesh >= MESH_COUNT - 2) {
+        instance.mesh = instance.mesh >= MESH_COUNT ? UINT32_MAX : 0;
+      }
+      instances.push_back(instance);
+    }
+  }
+
+  std::vector<MeshRange> meshes;
+  std::vector<Instance> instances;
+};
+
+// One mesh after the other, the instances of each in the order given.
+auto reference_commands(const Scene& scene,
+                        const std::vector<uint32_t>& instances,
+                        std::vector<VkDrawIndexedIndirectCommand>& commands,
+                        std::vector<uint32_t>& instance_indices) -> uint32_t
+{
+  commands.clear();
+  instance_indices.clear();
+  uint32_t non_empty = 0;
+  for (uint32_t mesh = 0; mesh < scene.meshes.size(); ++mesh) {
+    auto first_instance = static_cast<uint32_t>(instance_indices.size());
+    for (uint32_t index : instances) {
+      if (scene.instances[index].mesh == mesh) {
+        instance_indices.push_back(index);
+      }
+    }
+    auto count =
+        static_cast<uint32_t>(instance_indices.size()) - first_instance;
+    const MeshRange& range = scene.meshes[mesh];
+    commands.push_back({range.index_count, count, range.first_index,
+                        range.vertex_offset, first_instance});
+    non_empty += count > 0 ? 1 : 0;
+  }
+  return non_empty;
+}
+
+auto same(const VkDrawIndexedIndirectCommand& a,
+          const VkDrawIndexedIndirectCommand& b) -> bool
+{
+  return a.indexCount == b.indexCount && a.instanceCount == b.instanceCount &&
+         a.firstIndex == b.firstIndex && a.vertexOffset == b.vertexOffset &&
+         a.firstInstance == b.firstInstance;
+}
+
+// Compares built commands with the reference. Within a mesh the GPU writes
+// the instances in any order, only the set of each mesh is compared then.
+auto check_commands(const VkDrawIndexedIndirectCommand* commands,
+                    const uint32_t* instance_indices,
+                    const std::vector<VkDrawIndexedIndirectCommand>& expected,
+                    const std::vector<uint32_t>& expected_indices,
+                    bool ordered) -> void
+{
+  for (size_t mesh = 0; mesh < expected.size(); ++mesh) {
+    GFX_CHECK(same(commands[mesh], expected[mesh]));
+    if (!same(commands[mesh], expected[mesh])) {
+      continue;
+    }
+    uint32_t first = expected[mesh].firstInstance;
+    uint32_t count = expected[mesh].instanceCount;
+    std::vector<uint32_t> built(instance_indices + first,
+                                instance_indices + first + count);
+    std::vector<uint32_t> wanted(expected_indices.begin() + first,
+                                 expected_indices.begin() + first + count);
+    if (!ordered) {
+      std::sort(built.begin(), built.end());
+      std::sort(wanted.begin(), wanted.end());
+    }
+    GFX_CHECK(built == wanted);
+  }
+}
+
+auto test_cpu_build_matches_reference() -> void
+{
+  Scene scene;
+  std::vector<uint32_t> all(INSTANCE_COUNT);
+  for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+    all[i] = i;
+  }
+  std::vector<VkDrawIndexedIndirectCommand> expected;
+  std::vector<uint32_t> expected_indices;
+  uint32_t expected_non_empty =
+      reference_commands(scene, all, expected, expected_indices);
+  GFX_CHECK(expected_non_empty == MESH_COUNT - 2);
+
+  std::vector<VkDrawIndexedIndirectCommand> commands(MESH_COUNT);
+  std::vector<uint32_t> instance_indices(INSTANCE_COUNT);
+  uint32_t non_empty = gfx::vk_api::build_draw_commands(
+      scene.meshes.data(), MESH_COUNT, scene.instances.data(), INSTANCE_COUNT,
+      commands.data(), instance_indices.data());
+  GFX_CHECK(non_empty == expected_non_empty);
+  check_commands(commands.data(), instance_indices.data(), expected,
+                 expected_indices, true);
+}
+
+auto test_cpu_visible_build_matches_reference() -> void
+{
+  Scene scene;
+  std::vector<uint32_t> visible;
+  for (uint32_t i = 0; i < INSTANCE_COUNT; i += 3) {
+    visible.push_back(i);
+  }
+  std::vector<VkDrawIndexedIndirectCommand> expected;
+  std::vector<uint32_t> expected_indices;
+  uint32_t expected_non_empty =
+      reference_commands(scene, visible, expected, expected_indices);
+
+  std::vector<VkDrawIndexedIndirectCommand> commands(MESH_COUNT);
+  std::vector<uint32_t> instance_indices(visible.size());
+  uint32_t non_empty = gfx::vk_api::build_visible_draw_commands(
+      scene.meshes.data(), MESH_COUNT, scene.instances.data(), visible.data(),
+      static_cast<uint32_t>(visible.size()), commands.data(),
+      instance_indices.data());
+  GFX_CHECK(non_empty == expected_non_empty);
+  check_commands(commands.data(), instance_indices.data(), expected,
+                 expected_indices, true);
+}
+
+// Adds the scene's meshes to the batcher and mirrors its instances, the
+// scene's mesh ranges are replaced with the batcher's.
+auto fill_batcher(GeometryBatcher& batcher, Scene& scene) -> bool
+{
+  std::vector<Vertex> vertices(4 * MESH_COUNT, Vertex{});
+  std::vector<uint32_t> indices(3 * MESH_COUNT * (MESH_COUNT + 1) / 2, 0);
+  for (uint32_t i = 0; i < MESH_COUNT; ++i) {
+    MeshHandle mesh;
+    if (batcher.add_mesh(vertices.data(), 4, indices.data(),
+                         scene.meshes[i].index_count, mesh) != VK_SUCCESS) {
+      return false;
+    }
+    scene.meshes[i] = batcher.mesh(mesh);
+  }
+  std::vector<gfx::math::Affine> transforms(INSTANCE_COUNT);
+  std::vector<uint32_t> meshes(INSTANCE_COUNT);
+  for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+    memcpy(transforms[i].rows, scene.instances[i].transform,
+           sizeof(transforms[i].rows));
+    meshes[i] = scene.instances[i].mesh;
+  }
+  if (batcher.resize_instances(INSTANCE_COUNT) != VK_SUCCESS) {
+    return false;
+  }
+  batcher.write_instances(0, INSTANCE_COUNT, transforms.data(),
+                          meshes.data());
+  return true;
+}
+
+auto test_batcher_cpu_build_matches_reference(VulkanDevice& device) -> void
+{
+  GeometryLimits limits;
+  limits.mesh_capacity = MESH_COUNT;
+  limits.instance_capacity = INSTANCE_COUNT;
+  std::unique_ptr<GeometryBatcher> batcher;
+  GFX_CHECK(GeometryBatcher::create(device, limits, {}, batcher) ==
+            VK_SUCCESS);
+  if (!batcher) {
+    return;
+  }
+  GFX_CHECK(!batcher->uses_gpu_build());
+
+  Scene scene;
+  GFX_CHECK(fill_batcher(*batcher, scene));
+  std::vector<uint32_t> all(INSTANCE_COUNT);
+  for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+    all[i] = i;
+  }
+  std::vector<VkDrawIndexedIndirectCommand> expected;
+  std::vector<uint32_t> expected_indices;
+  reference_commands(scene, all, expected, expected_indices);
+
+  batcher->record_build(VK_NULL_HANDLE);
+  check_commands(batcher->draw_commands(), batcher->instance_indices(),
+                 expected, expected_indices, true);
+}
+
+auto test_full_batcher_returns_errors(VulkanDevice& device) -> void
+{
+  GeometryLimits limits;
+  limits.vertex_capacity = 8;
+  limits.index_capacity = 8;
+  limits.mesh_capacity = 2;
+  limits.instance_capacity = 4;
+  std::unique_ptr<GeometryBatcher> batcher;
+  GFX_CHECK(GeometryBatcher::create(device, limits, {}, batcher) ==
+            VK_SUCCESS);
+  if (!batcher) {
+    return;
+  }
+
+  Vertex vertices[8] = {};
+  uint32_t indices[8] = {};
+  MeshHandle mesh = {};
+  GFX_CHECK(batcher->add_mesh(vertices, 4, indices, 3, mesh) == VK_SUCCESS);
+  GFX_CHECK(batcher->add_mesh(vertices, 5, indices, 3, mesh) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(batcher->add_mesh(vertices, 4, indices, 6, mesh) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(batcher->add_mesh(vertices, 4, indices, 3, mesh) == VK_SUCCESS);
+  GFX_CHECK(mesh.index == 1);
+  GFX_CHECK(batcher->add_mesh(vertices, 0, indices, 0, mesh) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(batcher->stats().meshes == 2);
+  GFX_CHECK(batcher->stats().vertices == 8);
+
+  uint32_t instance = 0;
+  for (uint32_t i = 0; i < limits.instance_capacity; ++i) {
+    GFX_CHECK(batcher->add_instance(mesh, IDENTITY, instance) == VK_SUCCESS);
+    GFX_CHECK(instance == i);
+  }
+  GFX_CHECK(batcher->add_instance(mesh, IDENTITY, instance) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(batcher->resize_instances(limits.instance_capacity + 1) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(batcher->stats().instances == limits.instance_capacity);
+  batcher->clear_instances();
+  GFX_CHECK(batcher->stats().instances == 0);
+}
+
+// Runs the build_draws compute pass on the device and compares what it
+// wrote with the CPU reference.
+auto test_gpu_build_matches_reference(VulkanDevice& device,
+                                      const std::vector<uint32_t>& spirv)
+    -> bool
+{
+  GeometryLimits limits;
+  limits.mesh_capacity = MESH_COUNT;
+  limits.instance_capacity = INSTANCE_COUNT;
+  limits.frames_in_flight = 1;
+  GeometryShaders shaders;
+  shaders.build_draws = spirv;
+  std::unique_ptr<GeometryBatcher> batcher;
+  GFX_CHECK(GeometryBatcher::create(device, limits, shaders, batcher) ==
+            VK_SUCCESS);
+  if (!batcher || !batcher->uses_gpu_build()) {
+    return false;
+  }
+
+  Scene scene;
+  GFX_CHECK(fill_batcher(*batcher, scene));
+  std::vector<uint32_t> all(INSTANCE_COUNT);
+  for (uint32_t i = 0; i < INSTANCE_COUNT; ++i) {
+    all[i] = i;
+  }
+  std::vector<VkDrawIndexedIndirectCommand> expected;
+  std::vector<uint32_t> expected_indices;
+  reference_commands(scene, all, expected, expected_indices);
+
+  GFX_CHECK(gfx::test::submit_and_wait(device, [&](VkCommandBuffer commands) {
+    batcher->record_build(commands);
+  }) == VK_SUCCESS);
+  check_commands(batcher->draw_commands(), batcher->instance_indices(),
+                 expected, expected_indices, false);
+  return true;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Geometry tests                                               //
+//                                                              //
+// Checks the CPU builds of the indirect commands against a     //
+// plain per mesh reference, then the batcher on the null       //
+// driver. With --gpu, runs the build_draws compute pass on the //
+// device instead and compares it with the reference, skipped   //
+// without a device or shaders/build_draws.comp.spv.            //
+// Usage: vulkan-learning-geometry-test [--gpu]                 //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  bool gpu = argc > 1 && strcmp(argv[1], "--gpu") == 0;
+  if (!gpu) {
+    test_cpu_build_matches_reference();
+    test_cpu_visible_build_matches_reference();
+  }
+  VulkanDevice device;
+  if (gfx::test::create_device(gpu, device) != VK_SUCCESS) {
+    return gpu ? gfx::test::SKIPPED : 1;
+  }
+
+  bool skipped = false;
+  if (gpu) {
+    std::vector<uint32_t> spirv = gfx::vk_api::load_spirv(BUILD_DRAWS_PATH);
+    skipped = spirv.empty() || !test_gpu_build_matches_reference(device, spirv);
+    if (skipped) {
+      std::cerr << "No build_draws pipeline, skipping." << std::endl;
+    }
+  }
+  else {
+    test_batcher_cpu_build_matches_reference(device);
+    test_full_batcher_returns_errors(device);
+  }
+  gfx::test::destroy_device(device);
+
+  if (gfx::test::failures > 0) {
+    return 1;
+  }
+  return skipped ? gfx::test::SKIPPED : 0;
+}
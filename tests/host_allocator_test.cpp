@@ -0,0 +1,196 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "check.h"
+#include "host_allocator.h"
+
+namespace {
+
+using gfx::vk_api::HostAllocator;
+using gfx::vk_api::HostAllocatorReport;
+
+constexpr size_t SMALLEST_SIZE_CLASS = 64;
+constexpr size_t SIZE_CLASS_COUNT = 7;
+// Taken by the header of a block with the default alignment.
+constexpr size_t HEADER_SIZE = 32;
+
+auto allocate(HostAllocator& allocator, size_t size, size_t alignment = 16,
+              VkSystemAllocationScope scope = VK_SYSTEM_ALLOCATION_SCOPE_OBJECT)
+    -> void*
+{
+  const VkAllocationCallbacks* callbacks = allocator.callbacks();
+  return callbacks->pfnAllocation(callbacks->pUserData, size, alignment,
+                                  scope);
+}
+
+auto reallocate(HostAllocator& allocator, void* original, size_t size,
+                size_t alignment = 16) -> void*
+{
+  const VkAllocationCallbacks* callbacks = allocator.callbacks();
+  return callbacks->pfnReallocation(callbacks->pUserData, original, size,
+                                    alignment,
+                                    VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+}
+
+auto deallocate(HostAllocator& allocator, void* memory) -> void
+{
+  const VkAllocationCallbacks* callbacks = allocator.callbacks();
+  callbacks->pfnFree(callbacks->pUserData, memory);
+}
+
+// The largest size of every class grows in place, one byte more moves to
+// the next class. Past the last class the block is not pooled.
+auto test_size_classes() -> void
+{
+  HostAllocator allocator;
+  void* memory = allocate(allocator, 1);
+  GFX_CHECK(memory != nullptr);
+  uint64_t slab_size = allocator.report().pooled_bytes;
+  GFX_CHECK(slab_size > 0);
+  for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+    size_t largest = (SMALLEST_SIZE_CLASS << i) - HEADER_SIZE;
+    void* grown = reallocate(allocator, memory, largest);
+    GFX_CHECK(grown == memory);
+    memory = grown;
+    memset(memory, static_cast<int>(i), largest);
+    void* moved = reallocate(allocator, memory, largest + 1);
+    GFX_CHECK(moved != nullptr && moved != memory);
+    auto* bytes = static_cast<unsigned char*>(moved);
+    GFX_CHECK(bytes[0] == i && bytes[largest - 1] == i);
+    memory = moved;
+  }
+  // One slab per class, the last move went to the system allocator.
+  GFX_CHECK(allocator.report().pooled_bytes == SIZE_CLASS_COUNT * slab_size);
+  deallocate(allocator, memory);
+
+  // Shrinking a pooled block stays in place.
+  memory = allocate(allocator, 1000);
+  GFX_CHECK(reallocate(allocator, memory, 16) == memory);
+  deallocate(allocator, memory);
+  GFX_CHECK(allocate(allocator, 0) == nullptr);
+  GFX_CHECK(allocator.report().total.live_allocations == 0);
+}
+
+// Any power of two alignment is honored, a reallocation to a larger one
+// moves the block.
+auto test_alignment() -> void
+{
+  HostAllocator allocator;
+  std::vector<void*> blocks;
+  for (size_t alignment = 1; alignment <= 8192; alignment *= 2) {
+    for (size_t size : {1, 24, 100, 3000}) {
+      void* memory = allocate(allocator, size, alignment);
+      GFX_CHECK(memory != nullptr);
+      GFX_CHECK(reinterpret_cast<uintptr_t>(memory) % alignment == 0);
+      memset(memory, 0xab, size);
+      blocks.push_back(memory);
+    }
+  }
+  void* memory = allocate(allocator, 40);
+  memset(memory, 0xcd, 40);
+  void* aligned = reallocate(allocator, memory, 40, 1024);
+  GFX_CHECK(reinterpret_cast<uintptr_t>(aligned) % 1024 == 0);
+  GFX_CHECK(static_cast<unsigned char*>(aligned)[39] == 0xcd);
+  blocks.push_back(aligned);
+  for (void* block : blocks) {
+    deallocate(allocator, block);
+  }
+  GFX_CHECK(allocator.report().total.bytes == 0);
+}
+
+// Bytes and counts per scope and in total, peaks staying after frees.
+auto test_scope_accounting() -> void
+{
+  HostAllocator allocator;
+  void* object = allocate(allocator, 100);
+  void* command =
+      allocate(allocator, 200, 16, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+  HostAllocatorReport report = allocator.report();
+  const auto& objects = report.scopes[VK_SYSTEM_ALLOCATION_SCOPE_OBJECT];
+  const auto& commands = report.scopes[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND];
+  GFX_CHECK(objects.bytes == 100 && objects.live_allocations == 1);
+  GFX_CHECK(commands.bytes == 200 && commands.live_allocations == 1);
+  GFX_CHECK(report.scopes[VK_SYSTEM_ALLOCATION_SCOPE_DEVICE].allocations ==
+            0);
+  GFX_CHECK(report.total.bytes == 300 && report.total.allocations == 2);
+
+  // In place, then moved: the scope of the block is kept.
+  object = reallocate(allocator, object, 150);
+  object = reallocate(allocator, object, 1000);
+  deallocate(allocator, command);
+  report = allocator.report();
+  GFX_CHECK(report.scopes[VK_SYSTEM_ALLOCATION_SCOPE_OBJECT].bytes == 1000);
+  GFX_CHECK(report.scopes[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND].bytes == 0);
+  GFX_CHECK(report.scopes[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND].peak_bytes ==
+            200);
+  GFX_CHECK(report.total.live_allocations == 1);
+  // 150 and 200 before the move, then both blocks of the move.
+  GFX_CHECK(report.total.peak_bytes == 150 + 200 + 1000);
+
+  deallocate(allocator, object);
+  report = allocator.report();
+  GFX_CHECK(report.total.bytes == 0 && report.total.live_allocations == 0);
+  GFX_CHECK(report.total.allocations == 3);
+
+  const VkAllocationCallbacks* callbacks = allocator.callbacks();
+  callbacks->pfnInternalAllocation(
+      callbacks->pUserData, 4096, VK_INTERNAL_ALLOCATION_TYPE_EXECUTABLE,
+      VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+  GFX_CHECK(allocator.report().internal_bytes == 4096);
+  callbacks->pfnInternalFree(callbacks->pUserData, 4096,
+                             VK_INTERNAL_ALLOCATION_TYPE_EXECUTABLE,
+                             VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+  GFX_CHECK(allocator.report().internal_bytes == 0);
+}
+
+// Slabs go back to the system once empty, but for the last one with room.
+auto test_empty_slabs_are_released() -> void
+{
+  HostAllocator allocator;
+  std::vector<void*> blocks = {allocate(allocator, 1)};
+  uint64_t slab_size = allocator.report().pooled_bytes;
+  while (allocator.report().pooled_bytes < 3 * slab_size) {
+    blocks.push_back(allocate(allocator, 1));
+  }
+  // The third slab only has the last block, the first slab has room once
+  // its first block is freed.
+  deallocate(allocator, blocks.front());
+  deallocate(allocator, blocks.back());
+  GFX_CHECK(allocator.report().pooled_bytes == 2 * slab_size);
+  GFX_CHECK(allocator.report().released_slabs == 1);
+  blocks.erase(blocks.begin());
+  blocks.back() = allocate(allocator, 1);
+  GFX_CHECK(allocator.report().pooled_bytes == 2 * slab_size);
+
+  for (void* block : blocks) {
+    deallocate(allocator, block);
+  }
+  GFX_CHECK(allocator.report().pooled_bytes == slab_size);
+  GFX_CHECK(allocator.report().released_slabs == 2);
+  for (int i = 0; i < 4; ++i) {
+    deallocate(allocator, allocate(allocator, 1));
+  }
+  GFX_CHECK(allocator.report().pooled_bytes == slab_size);
+  GFX_CHECK(allocator.report().released_slabs == 2);
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Host allocator tests                                         //
+//                                                              //
+// Drives the allocation callbacks directly: the size class     //
+// chosen for a size, alignments up to larger than a class,     //
+// reallocations in place and moved, the accounting per scope   //
+// and the release of empty slabs.                              //
+// Usage: vulkan-learning-host-allocator-test                   //
+// ************************************************************ //
+auto main() -> int
+{
+  test_size_classes();
+  test_alignment();
+  test_scope_accounting();
+  test_empty_slabs_are_released();
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "log.h"
+
+namespace {
+
+constexpr uint32_t PRODUCERS = 4;
+// Fewer than a ring holds, none is dropped.
+constexpr uint32_t PRODUCER_MESSAGES = 200;
+// Many more than a ring holds, logged faster than the log thread wakes up.
+constexpr uint32_t BURST_MESSAGES = 20000;
+constexpr const char* AFTER_ERROR = "after the error";
+
+struct Line {
+  double seconds;
+  std::string level;
+  std::string text;
+};
+
+// Producers alternate info and warning messages, that is stdout and
+// stderr, starting together. A burst follows on one thread, then an
+// error and a line written right after it returned.
+auto produce() -> int
+{
+  std::atomic<bool> start(false);
+  std::vector<std::thread> producers;
+  for (uint32_t producer = 0; producer < PRODUCERS; ++producer) {
+    producers.emplace_back([&start, producer] {
+      while (!start.load()) {
+        std::this_thread::yield();
+      }
+      for (uint32_t i = 0; i < PRODUCER_MESSAGES; ++i) {
+        if (i % 2 == 0) {
+          GFX_LOG_INFO("producer {} message {}", producer, i);
+        }
+        else {
+          GFX_LOG_WARNING("producer {} message {}", producer, i);
+        }
+      }
+    });
+  }
+  start = true;
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  gfx::flush_log();
+
+  std::thread([] {
+    for (uint32_t i = 0; i < BURST_MESSAGES; ++i) {
+      GFX_LOG_INFO("burst {}", i);
+    }
+  }).join();
+  gfx::flush_log();
+
+  GFX_LOG_ERROR("error {}", 1);
+  fprintf(stdout, "%s\n", AFTER_ERROR);
+  fflush(stdout);
+  return 0;
+}
+
+auto read_lines(const std::string& path) -> std::vector<Line>
+{
+  std::vector<Line> lines;
+  std::ifstream file(path);
+  std::string text;
+  while (std::getline(file, text)) {
+    size_t close = text.find("] ");
+    if (text.empty() || text[0] != '[' || close == std::string::npos) {
+      lines.push_back({-1.0, "", text});
+      continue;
+    }
+    size_t level_end = text.find(' ', close + 2);
+    size_t text_start = text.find_first_not_of(' ', level_end);
+    if (level_end == std::string::npos || text_start == std::string::npos) {
+      lines.push_back({-1.0, "", text});
+      continue;
+    }
+    lines.push_back({std::stod(text.substr(1, close - 1)),
+                     text.substr(close + 2, level_end - close - 2),
+                     text.substr(text_start)});
+  }
+  return lines;
+}
+
+// The lines of both streams come out in time order, the messages of each
+// producer in the order logged, and what the full ring dropped is
+// reported.
+auto test_output(const std::vector<Line>& lines) -> void
+{
+  std::vector<uint32_t> next(PRODUCERS, 0);
+  double previous = 0.0;
+  uint32_t burst = 0;
+  uint64_t dropped = 0;
+  size_t error = lines.size();
+  size_t after_error = lines.size();
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const Line& line = lines[i];
+    if (line.text == AFTER_ERROR) {
+      after_error = i;
+      continue;
+    }
+    GFX_CHECK(line.seconds >= previous);
+    previous = line.seconds;
+
+    unsigned producer = 0;
+    unsigned message = 0;
+    unsigned long long count = 0;
+    if (sscanf(line.text.c_str(), "producer %u message %u", &producer,
+               &message) == 2) {
+      GFX_CHECK(producer < PRODUCERS && burst == 0);
+      if (producer < PRODUCERS) {
+        GFX_CHECK(message == next[producer]);
+        next[producer] = message + 1;
+      }
+      GFX_CHECK(line.level == (message % 2 == 0 ? "info" : "warning"));
+    }
+    else if (line.text.rfind("burst ", 0) == 0) {
+      ++burst;
+    }
+    else if (sscanf(line.text.c_str(), "%llu log messages dropped",
+                    &count) == 1) {
+      GFX_CHECK(line.level == "warning");
+      dropped += count;
+    }
+    else if (line.text == "error 1") {
+      GFX_CHECK(line.level == "error");
+      error = i;
+    }
+    else {
+      GFX_CHECK(line.text.empty());
+    }
+  }
+  for (uint32_t count : next) {
+    GFX_CHECK(count == PRODUCER_MESSAGES);
+  }
+  GFX_CHECK(dropped > 0);
+  GFX_CHECK(burst + dropped == BURST_MESSAGES);
+  // Errors are written before the call returns.
+  GFX_CHECK(error < after_error && after_error < lines.size());
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Log tests                                                    //
+//                                                              //
+// Runs itself with produce to log from several threads at      //
+// once, to stdout and stderr, with a burst overflowing a ring  //
+// and an error, then checks the lines it wrote: time order,    //
+// the order of each producer, the count of dropped messages    //
+// and the error written before returning.                      //
+// Usage: vulkan-learning-log-test                              //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  if (argc == 2 && std::string(argv[1]) == "produce") {
+    return produce();
+  }
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-log-test";
+  std::filesystem::create_directories(directory);
+  std::string path = (directory / "log.txt").string();
+  std::string command =
+      "\"" + std::string(argv[0]) + "\" produce > \"" + path + "\" 2>&1";
+  GFX_CHECK(std::system(command.c_str()) == 0);
+  test_output(read_lines(path));
+  std::filesystem::remove_all(directory);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
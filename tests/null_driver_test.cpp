@@ -0,0 +1,138 @@
+#include <cstdint>
+#include <iostream>
+#include "check.h"
+#include "vulkan_startup.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::vk_api::NullDriverStats;
+using gfx::vk_api::build;
+using gfx::vk_api::VulkanDevice;
+using gfx::vk_api::null_driver_call_count;
+using gfx::vk_api::null_driver_stats;
+using gfx::vk_api::reset_null_driver_stats;
+
+// One barrier call with three barriers, and a few commands of each kind.
+auto test_commands_are_counted(VulkanDevice& device) -> void
+{
+  reset_null_driver_stats();
+  GFX_CHECK(gfx::test::submit_and_wait(device, [&](VkCommandBuffer commands) {
+    VkMemoryBarrier memory_barrier = build<VkMemoryBarrier>();
+    VkBufferMemoryBarrier buffer_barrier = build<VkBufferMemoryBarrier>();
+    VkBufferMemoryBarrier buffer_barriers[2] = {buffer_barrier,
+                                                buffer_barrier};
+    device.vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                                &memory_barrier, 2, buffer_barriers, 0,
+                                nullptr);
+    device.vkCmdDispatch(commands, 1, 1, 1);
+    device.vkCmdDispatch(commands, 8, 1, 1);
+    VkBufferCopy region = {0, 0, 4};
+    device.vkCmdCopyBuffer(commands, VK_NULL_HANDLE, VK_NULL_HANDLE, 1,
+                           &region);
+    for (int i = 0; i < 3; ++i) {
+      device.vkCmdDrawIndexed(commands, 3, 1, 0, 0, 0);
+    }
+  }) == VK_SUCCESS);
+
+  NullDriverStats stats = null_driver_stats();
+  GFX_CHECK(stats.commands == 7);
+  GFX_CHECK(stats.pipeline_barriers == 1);
+  GFX_CHECK(stats.barriers == 3);
+  GFX_CHECK(stats.dispatches == 2);
+  GFX_CHECK(stats.copies == 1);
+  GFX_CHECK(stats.draws == 3);
+  GFX_CHECK(stats.submits == 1);
+  GFX_CHECK(stats.submitted_batches == 1);
+  GFX_CHECK(stats.submitted_command_buffers == 1);
+  GFX_CHECK(stats.waits >= 1);
+  GFX_CHECK(stats.calls >= stats.commands + stats.submits);
+
+  GFX_CHECK(null_driver_call_count("vkCmdPipelineBarrier") == 1);
+  GFX_CHECK(null_driver_call_count("vkCmdDispatch") == 2);
+  GFX_CHECK(null_driver_call_count("vkCmdDrawIndexed") == 3);
+  GFX_CHECK(null_driver_call_count("vkQueueSubmit") == 1);
+  GFX_CHECK(null_driver_call_count("vkCreateCommandPool") == 1);
+  GFX_CHECK(null_driver_call_count("vkDestroyCommandPool") == 1);
+  GFX_CHECK(null_driver_call_count("vkNotAFunction") == 0);
+}
+
+// Live allocations are not reset, only the allocations made since.
+auto test_allocations_are_counted(VulkanDevice& device) -> void
+{
+  reset_null_driver_stats();
+  uint64_t live_allocations = null_driver_stats().live_allocations;
+  VkDeviceMemory memory[2] = {};
+  for (uint32_t i = 0; i < 2; ++i) {
+    VkMemoryAllocateInfo allocate_info =
+        build<VkMemoryAllocateInfo>().set(
+            &VkMemoryAllocateInfo::allocationSize, VkDeviceSize{1024} << i);
+    GFX_CHECK(device.vkAllocateMemory(device.logical_device, &allocate_info,
+                                      nullptr, &memory[i]) == VK_SUCCESS);
+  }
+  NullDriverStats stats = null_driver_stats();
+  GFX_CHECK(stats.allocations == 2);
+  GFX_CHECK(stats.allocated_bytes == 3072);
+  GFX_CHECK(stats.live_allocations == live_allocations + 2);
+
+  device.vkFreeMemory(device.logical_device, memory[0], nullptr);
+  reset_null_driver_stats();
+  stats = null_driver_stats();
+  GFX_CHECK(stats.allocations == 0);
+  GFX_CHECK(stats.allocated_bytes == 0);
+  GFX_CHECK(stats.live_allocations == live_allocations + 1);
+  device.vkFreeMemory(device.logical_device, memory[1], nullptr);
+  GFX_CHECK(null_driver_stats().live_allocations == live_allocations);
+}
+
+auto test_reset_clears_the_counters(VulkanDevice& device) -> void
+{
+  GFX_CHECK(gfx::test::submit_and_wait(device, [&](VkCommandBuffer commands) {
+    device.vkCmdDispatch(commands, 1, 1, 1);
+  }) == VK_SUCCESS);
+  reset_null_driver_stats();
+  NullDriverStats stats = null_driver_stats();
+  GFX_CHECK(stats.calls == 0);
+  GFX_CHECK(stats.commands == 0);
+  GFX_CHECK(stats.dispatches == 0);
+  GFX_CHECK(stats.submits == 0);
+  GFX_CHECK(stats.objects_created == 0);
+  GFX_CHECK(null_driver_call_count("vkCmdDispatch") == 0);
+}
+
+// A second instance starts its timings over.
+auto test_startup_timings_restart() -> void
+{
+  gfx::vk_api::startup_timings().device_creation_ms = 1e9;
+  GFX_CHECK(gfx::vk_api::initialize(true) == VK_SUCCESS);
+  const gfx::vk_api::StartupTimings& timings = gfx::vk_api::startup_timings();
+  GFX_CHECK(timings.device_creation_ms == 0);
+  gfx::vk_api::destroy();
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Null driver tests                                            //
+//                                                              //
+// Checks the counters the CPU cost of the engine is measured   //
+// with: commands, barriers, submits and allocations are        //
+// counted as recorded, per function too, until a reset. The    //
+// startup timings of a second instance start over.             //
+// Usage: vulkan-learning-null-driver-test                      //
+// ************************************************************ //
+auto main() -> int
+{
+  VulkanDevice device;
+  if (gfx::test::create_device(false, device) != VK_SUCCESS) {
+    return 1;
+  }
+  test_commands_are_counted(device);
+  test_allocations_are_counted(device);
+  test_reset_clears_the_counters(device);
+  gfx::test::destroy_device(device);
+  test_startup_timings_restart();
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
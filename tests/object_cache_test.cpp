@@ -0,0 +1,173 @@
+#include <cstdint>
+#include "check.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_object_cache.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::vk_api::ObjectCache;
+using gfx::vk_api::ObjectCacheStats;
+using gfx::vk_api::VulkanDevice;
+using gfx::vk_api::build;
+using gfx::vk_api::null_driver_call_count;
+using gfx::vk_api::reset_null_driver_stats;
+
+// Never dereferenced by the null driver.
+auto fake_image(uint32_t index) -> VkImage
+{
+  return reinterpret_cast<VkImage>(uintptr_t{index} + 1);
+}
+
+auto view_create_info(VkImage image) -> VkImageViewCreateInfo
+{
+  return build<VkImageViewCreateInfo>()
+      .set(&VkImageViewCreateInfo::image, image)
+      .set(&VkImageViewCreateInfo::viewType, VK_IMAGE_VIEW_TYPE_2D)
+      .set(&VkImageViewCreateInfo::format, VK_FORMAT_B8G8R8A8_UNORM)
+      .set(&VkImageViewCreateInfo::subresourceRange,
+           {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1});
+}
+
+auto framebuffer_create_info(VkRenderPass render_pass,
+                             const VkImageView& view)
+    -> VkFramebufferCreateInfo
+{
+  return build<VkFramebufferCreateInfo>()
+      .set(&VkFramebufferCreateInfo::renderPass, render_pass)
+      .set(&VkFramebufferCreateInfo::attachmentCount, 1)
+      .set(&VkFramebufferCreateInfo::pAttachments, &view)
+      .set(&VkFramebufferCreateInfo::width, 64)
+      .set(&VkFramebufferCreateInfo::height, 64)
+      .set(&VkFramebufferCreateInfo::layers, 1);
+}
+
+auto color_pass(ObjectCache& cache) -> VkRenderPass
+{
+  VkAttachmentDescription attachment = {};
+  attachment.format = VK_FORMAT_B8G8R8A8_UNORM;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  VkAttachmentReference color = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color;
+  return cache.render_pass(
+      build<VkRenderPassCreateInfo>()
+          .set(&VkRenderPassCreateInfo::attachmentCount, 1)
+          .set(&VkRenderPassCreateInfo::pAttachments, &attachment)
+          .set(&VkRenderPassCreateInfo::subpassCount, 1)
+          .set(&VkRenderPassCreateInfo::pSubpasses, &subpass));
+}
+
+// Identical create infos share an object and count as hits, any field
+// that differs creates another one.
+auto test_identical_create_infos_hit(VulkanDevice& device) -> void
+{
+  ObjectCache cache(device);
+  reset_null_driver_stats();
+
+  VkRenderPass render_pass = color_pass(cache);
+  GFX_CHECK(render_pass != VK_NULL_HANDLE);
+  GFX_CHECK(color_pass(cache) == render_pass);
+
+  VkSamplerCreateInfo sampler_info =
+      build<VkSamplerCreateInfo>()
+          .set(&VkSamplerCreateInfo::magFilter, VK_FILTER_LINEAR)
+          .set(&VkSamplerCreateInfo::minFilter, VK_FILTER_LINEAR)
+          .set(&VkSamplerCreateInfo::maxLod, 4.0f);
+  VkSampler sampler = cache.sampler(sampler_info);
+  GFX_CHECK(cache.sampler(sampler_info) == sampler);
+  sampler_info.maxLod = 8.0f;
+  GFX_CHECK(cache.sampler(sampler_info) != sampler);
+
+  VkImageViewCreateInfo view_info = view_create_info(fake_image(0));
+  VkImageView view = cache.image_view(view_info);
+  GFX_CHECK(cache.image_view(view_info) == view);
+  // A chain cannot be keyed, whatever it holds.
+  view_info.pNext = &sampler_info;
+  GFX_CHECK(cache.image_view(view_info) == VK_NULL_HANDLE);
+
+  ObjectCacheStats stats = cache.stats();
+  GFX_CHECK(stats.render_passes.hits == 1);
+  GFX_CHECK(stats.render_passes.misses == 1);
+  GFX_CHECK(stats.samplers.hits == 1);
+  GFX_CHECK(stats.samplers.misses == 2);
+  GFX_CHECK(stats.samplers.live == 2);
+  GFX_CHECK(stats.image_views.hits == 1);
+  GFX_CHECK(stats.image_views.misses == 1);
+  GFX_CHECK(null_driver_call_count("vkCreateRenderPass") == 1);
+  GFX_CHECK(null_driver_call_count("vkCreateSampler") == 2);
+  GFX_CHECK(null_driver_call_count("vkCreateImageView") == 1);
+}
+
+// Evicting an image evicts its views, and the framebuffers using them,
+// through the deletion queue. The other image keeps its own.
+auto test_eviction_follows_the_dependencies(VulkanDevice& device) -> void
+{
+  ObjectCache cache(device);
+  VkRenderPass render_pass = color_pass(cache);
+  VkImageView views[2];
+  VkFramebuffer framebuffers[2];
+  for (uint32_t i = 0; i < 2; ++i) {
+    views[i] = cache.image_view(view_create_info(fake_image(i)));
+    framebuffers[i] =
+        cache.framebuffer(framebuffer_create_info(render_pass, views[i]));
+  }
+  device.deletion_queue->flush();
+  reset_null_driver_stats();
+
+  cache.evict_image(fake_image(0));
+  ObjectCacheStats stats = cache.stats();
+  GFX_CHECK(stats.image_views.evictions == 1);
+  GFX_CHECK(stats.image_views.live == 1);
+  GFX_CHECK(stats.framebuffers.evictions == 1);
+  GFX_CHECK(stats.framebuffers.live == 1);
+  GFX_CHECK(stats.render_passes.live == 1);
+  // Nothing is destroyed before the frame retires.
+  GFX_CHECK(null_driver_call_count("vkDestroyImageView") == 0);
+  device.deletion_queue->flush();
+  GFX_CHECK(null_driver_call_count("vkDestroyImageView") == 1);
+  GFX_CHECK(null_driver_call_count("vkDestroyFramebuffer") == 1);
+
+  // The survivors still hit, the evicted view is created again.
+  GFX_CHECK(cache.image_view(view_create_info(fake_image(1))) == views[1]);
+  GFX_CHECK(cache.framebuffer(framebuffer_create_info(
+                render_pass, views[1])) == framebuffers[1]);
+  GFX_CHECK(cache.image_view(view_create_info(fake_image(0))) != views[0]);
+  GFX_CHECK(cache.stats().image_views.misses == 3);
+
+  // A view the cache does not own only takes its framebuffers along.
+  cache.evict_image_view(views[1]);
+  stats = cache.stats();
+  GFX_CHECK(stats.framebuffers.live == 0);
+  GFX_CHECK(stats.image_views.live == 2);
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Object cache tests                                           //
+//                                                              //
+// Requests render passes, samplers, image views and            //
+// framebuffers from a cache on the null driver, and checks the //
+// hits and misses against the objects created, then that       //
+// evicting an image takes its views and their framebuffers     //
+// with it, through the deletion queue.                         //
+// Usage: vulkan-learning-object-cache-test                     //
+// ************************************************************ //
+auto main() -> int
+{
+  VulkanDevice device;
+  if (gfx::test::create_device(false, device) != VK_SUCCESS) {
+    return 1;
+  }
+  test_identical_create_infos_hit(device);
+  test_eviction_follows_the_dependencies(device);
+  gfx::test::destroy_device(device);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
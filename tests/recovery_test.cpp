@@ -0,0 +1,477 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "culling.h"
+#include "geometry.h"
+#include "shader_cache.h"
+#include "texture_streamer.h"
+#include "vulkan_compute_jobs.h"
+#include "vulkan_deletion_queue.h"
+#include "vulkan_dynamic_resolution.h"
+#include "vulkan_recovery.h"
+#include "vulkan_sync.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::ThreadPool;
+using gfx::vk_api::build;
+using gfx::vk_api::ComputeJob;
+using gfx::vk_api::ComputeJobQueue;
+using gfx::vk_api::ComputeKernel;
+using gfx::vk_api::CullingView;
+using gfx::vk_api::DepthPyramid;
+using gfx::vk_api::GeometryBatcher;
+using gfx::vk_api::GeometryLimits;
+using gfx::vk_api::GeometryShaders;
+using gfx::vk_api::GpuFrameTimer;
+using gfx::vk_api::MeshHandle;
+using gfx::vk_api::NullDriverStats;
+using gfx::vk_api::PipelineLayout;
+using gfx::vk_api::ResidentBuffer;
+using gfx::vk_api::Shader;
+using gfx::vk_api::ShaderCache;
+using gfx::vk_api::TextureHandle;
+using gfx::vk_api::TextureStreamer;
+using gfx::vk_api::TextureStreamingLimits;
+using gfx::vk_api::Vertex;
+using gfx::vk_api::VulkanDevice;
+using gfx::vk_api::null_driver_stats;
+using gfx::vk_api::reset_null_driver_stats;
+
+constexpr uint32_t TEXTURE_SIZE = 16;
+constexpr uint32_t RGBA8_BYTES = 4;
+constexpr uint32_t MAX_FRAMES = 1000;
+
+const float IDENTITY[12] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f,
+                            0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+
+// The interface of a compute kernel, without code, which the null driver
+// never runs: one storage buffer at set 0 binding 0, a local size of 1 and
+// the 32 bytes of the ComputeRange push constants.
+const uint32_t KERNEL_SPIRV[] = {
+    0x07230203, 0x00010000, 0, 11, 0,
+    // OpEntryPoint GLCompute %1 "main"
+    (5 << 16) | 15, 5, 1, 0x6e69616d, 0,
+    // OpExecutionMode %1 LocalSize 1 1 1
+    (6 << 16) | 16, 1, 17, 1, 1, 1,
+    // OpDecorate %9 DescriptorSet 0, OpDecorate %9 Binding 0
+    (4 << 16) | 71, 9, 34, 0, (4 << 16) | 71, 9, 33, 0,
+    // OpMemberDecorate %5 0 Offset 0, OpMemberDecorate %5 1 Offset 16
+    (5 << 16) | 72, 5, 0, 35, 0, (5 << 16) | 72, 5, 1, 35, 16,
+    // %2 = OpTypeInt 32 0, %3 = OpTypeVector %2 4
+    (4 << 16) | 21, 2, 32, 0, (4 << 16) | 23, 3, 2, 4,
+    // %5 = OpTypeStruct %3 %3, %6 = OpTypePointer PushConstant %5,
+    // %7 = OpVariable %6 PushConstant
+    (4 << 16) | 30, 5, 3, 3, (4 << 16) | 32, 6, 9, 5, (4 << 16) | 59, 6, 7,
+    9,
+    // %8 = OpTypeStruct %2, %10 = OpTypePointer StorageBuffer %8,
+    // %9 = OpVariable %10 StorageBuffer
+    (3 << 16) | 30, 8, 2, (4 << 16) | 32, 10, 12, 8, (4 << 16) | 59, 10, 9,
+    12};
+
+// The null driver takes any SPIR-V, only the magic number is given.
+const std::vector<uint32_t> ANY_SPIRV = {0x07230203};
+
+// Single level RGBA8 KTX2 file.
+auto write_ktx2(const std::string& path) -> void
+{
+  uint32_t dfd[11] = {44, 0, 2 | (40u << 16), 0, 0, RGBA8_BYTES, 0, 0, 0, 0, 0};
+  uint32_t header[20] = {};
+  const uint8_t identifier[12] = {0xab, 'K', 'T', 'X', ' ', '2',
+                                  '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+  memcpy(header, identifier, sizeof(identifier));
+  header[3] = VK_FORMAT_R8G8B8A8_UNORM;
+  header[4] = 1;
+  header[5] = TEXTURE_SIZE;
+  header[6] = TEXTURE_SIZE;
+  header[9] = 1;
+  header[10] = 1;
+  uint64_t dfd_offset = sizeof(header) + sizeof(gfx::Ktx2Level);
+  header[12] = static_cast<uint32_t>(dfd_offset);
+  header[13] = sizeof(dfd);
+
+  uint64_t size = uint64_t{TEXTURE_SIZE} * TEXTURE_SIZE * RGBA8_BYTES;
+  gfx::Ktx2Level level = {(dfd_offset + sizeof(dfd) + 15) / 16 * 16, size,
+                          size};
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(&level), sizeof(level));
+  file.write(reinterpret_cast<const char*>(dfd), sizeof(dfd));
+  std::vector<char> texels(size, 1);
+  file.seekp(static_cast<std::streamoff>(level.offset));
+  file.write(texels.data(), static_cast<std::streamsize>(texels.size()));
+}
+
+// Loses the device at the next submit and recovers it.
+auto lose_and_recover(VulkanDevice& device) -> void
+{
+  gfx::vk_api::lose_null_driver_device();
+  VkSubmitInfo submit_info = build<VkSubmitInfo>();
+  GFX_CHECK(device.graphics_timeline->submit(&submit_info, 1) == 0);
+  GFX_CHECK(device.graphics_timeline->device_lost());
+  GFX_CHECK(gfx::vk_api::recover_device(device) == VK_SUCCESS);
+}
+
+// The modules and layouts change in place, the kernel gets a new pipeline
+// on them. The job in flight when the device was lost fails, the next one
+// runs on new slots.
+auto test_shaders_and_jobs_come_back(VulkanDevice& device,
+                                     const std::string& kernel_path,
+                                     const std::string& index_path) -> void
+{
+  ShaderCache shader_cache(device, index_path);
+  const Shader* shader = nullptr;
+  GFX_CHECK(shader_cache.load(kernel_path, shader) == VK_SUCCESS);
+  if (shader == nullptr) {
+    return;
+  }
+  const PipelineLayout* layout = nullptr;
+  GFX_CHECK(shader_cache.pipeline_layout({shader}, layout) == VK_SUCCESS);
+  ComputeKernel kernel;
+  GFX_CHECK(gfx::vk_api::create_compute_kernel(device, shader_cache, *shader,
+                                               kernel) == VK_SUCCESS);
+  std::unique_ptr<ComputeJobQueue> queue;
+  GFX_CHECK(ComputeJobQueue::create(device, 2, queue) == VK_SUCCESS);
+  if (layout == nullptr || !queue) {
+    return;
+  }
+
+  uint32_t input = 7;
+  uint32_t output = 0;
+  ComputeJob job = {&kernel,
+                    {{&input, &output, sizeof(input)}},
+                    {1, 1, 1},
+                    nullptr};
+  GFX_CHECK(queue->wait(queue->submit(job)));
+  uint64_t in_flight = queue->submit(job);
+  GFX_CHECK(in_flight != 0);
+
+  VkShaderModule module = shader->module;
+  VkPipelineLayout pipeline_layout = layout->layout;
+  VkDescriptorSetLayout set_layout = layout->set_layouts[0];
+  VkPipeline pipeline = kernel.pipeline;
+  lose_and_recover(device);
+
+  GFX_CHECK(shader->module != VK_NULL_HANDLE && shader->module != module);
+  GFX_CHECK(layout->layout != VK_NULL_HANDLE &&
+            layout->layout != pipeline_layout);
+  GFX_CHECK(layout->set_layouts.size() == 1);
+  GFX_CHECK(layout->set_layouts[0] != VK_NULL_HANDLE &&
+            layout->set_layouts[0] != set_layout);
+  GFX_CHECK(kernel.pipeline != VK_NULL_HANDLE && kernel.pipeline != pipeline);
+  GFX_CHECK(kernel.pipeline_layout == layout->layout);
+  GFX_CHECK(kernel.set_layout == layout->set_layouts[0]);
+
+  GFX_CHECK(!queue->wait(in_flight));
+  GFX_CHECK(queue->wait(queue->submit(job)));
+  queue.reset();
+  gfx::vk_api::destroy_compute_kernel(device, kernel);
+}
+
+// The same commands are built from the restored meshes and instances, and
+// the compute passes record again.
+auto test_geometry_comes_back(VulkanDevice& device) -> void
+{
+  GeometryLimits limits;
+  limits.vertex_capacity = 64;
+  limits.index_capacity = 64;
+  limits.mesh_capacity = 4;
+  limits.instance_capacity = 16;
+  std::unique_ptr<GeometryBatcher> cpu_batcher;
+  std::unique_ptr<GeometryBatcher> gpu_batcher;
+  GFX_CHECK(GeometryBatcher::create(device, limits, {}, cpu_batcher) ==
+            VK_SUCCESS);
+  GeometryShaders shaders = {ANY_SPIRV, ANY_SPIRV, ANY_SPIRV, ANY_SPIRV};
+  GFX_CHECK(GeometryBatcher::create(device, limits, shaders, gpu_batcher) ==
+            VK_SUCCESS);
+  std::unique_ptr<DepthPyramid> pyramid;
+  auto depth_view = reinterpret_cast<VkImageView>(uintptr_t{1});
+  GFX_CHECK(DepthPyramid::create(device, depth_view, 64, 32, ANY_SPIRV,
+                                 pyramid) == VK_SUCCESS);
+  if (!cpu_batcher || !gpu_batcher || !pyramid) {
+    return;
+  }
+  GFX_CHECK(gpu_batcher->uses_gpu_culling());
+
+  Vertex vertices[3] = {};
+  uint32_t indices[6] = {0, 1, 2, 2, 1, 0};
+  for (GeometryBatcher* batcher : {cpu_batcher.get(), gpu_batcher.get()}) {
+    MeshHandle meshes[2];
+    GFX_CHECK(batcher->add_mesh(vertices, 3, indices, 3, meshes[0]) ==
+              VK_SUCCESS);
+    GFX_CHECK(batcher->add_mesh(vertices, 3, indices, 6, meshes[1]) ==
+              VK_SUCCESS);
+    for (uint32_t i = 0; i < 5; ++i) {
+      uint32_t instance = 0;
+      GFX_CHECK(batcher->add_instance(meshes[i % 2], IDENTITY, instance) ==
+                VK_SUCCESS);
+    }
+  }
+
+  // Builds every frame in flight, the last one is compared.
+  auto build_frames = [&](GeometryBatcher& batcher) {
+    CullingView view = {gfx::math::identity(), pyramid.get(), false};
+    for (uint32_t i = 0; i < limits.frames_in_flight; ++i) {
+      GFX_CHECK(gfx::test::submit_and_wait(
+                    device, [&](VkCommandBuffer commands) {
+                      pyramid->record_build(commands);
+                      batcher.record_build(
+                          commands, &batcher == gpu_batcher.get() ? &view
+                                                                  : nullptr);
+                    }) == VK_SUCCESS);
+    }
+  };
+  build_frames(*cpu_batcher);
+  std::vector<VkDrawIndexedIndirectCommand> commands(
+      cpu_batcher->draw_commands(), cpu_batcher->draw_commands() + 2);
+  std::vector<uint32_t> instance_indices(
+      cpu_batcher->instance_indices(), cpu_batcher->instance_indices() + 5);
+  VkImageView pyramid_view = pyramid->view();
+  lose_and_recover(device);
+
+  build_frames(*cpu_batcher);
+  GFX_CHECK(memcmp(cpu_batcher->draw_commands(), commands.data(),
+                   commands.size() * sizeof(commands[0])) == 0);
+  GFX_CHECK(memcmp(cpu_batcher->instance_indices(), instance_indices.data(),
+                   instance_indices.size() * sizeof(uint32_t)) == 0);
+  GFX_CHECK(cpu_batcher->stats().meshes == 2);
+  GFX_CHECK(cpu_batcher->stats().instances == 5);
+
+  // The depth buffer went away with the device, the pyramid waits for the
+  // new one. The culling still runs, without occlusion.
+  GFX_CHECK(pyramid->view() != VK_NULL_HANDLE &&
+            pyramid->view() != pyramid_view);
+  GFX_CHECK(gpu_batcher->uses_gpu_culling());
+  reset_null_driver_stats();
+  build_frames(*gpu_batcher);
+  GFX_CHECK(null_driver_stats().dispatches == 2 * limits.frames_in_flight);
+  pyramid->set_depth_view(depth_view);
+  reset_null_driver_stats();
+  build_frames(*gpu_batcher);
+  GFX_CHECK(null_driver_stats().dispatches ==
+            (2 + pyramid->mip_count()) * limits.frames_in_flight);
+}
+
+// Frames in flight when the device was lost are not timed, the next are.
+auto test_frame_timer_comes_back(VulkanDevice& device) -> void
+{
+  GpuFrameTimer timer(device, 2);
+  GFX_CHECK(timer.supported());
+  auto time_frame = [&](uint64_t frame) {
+    GFX_CHECK(gfx::test::submit_and_wait(device, [&](VkCommandBuffer commands) {
+      timer.begin(commands, frame);
+      timer.end(commands, frame);
+    }) == VK_SUCCESS);
+  };
+  time_frame(0);
+  lose_and_recover(device);
+
+  double gpu_ms = 0.0;
+  GFX_CHECK(timer.supported());
+  GFX_CHECK(!timer.read(0, gpu_ms));
+  time_frame(1);
+  GFX_CHECK(timer.read(1, gpu_ms));
+}
+
+// Records and submits frames until no step is pending.
+auto stream(VulkanDevice& device, TextureStreamer& streamer) -> void
+{
+  for (uint32_t i = 0; i < MAX_FRAMES; ++i) {
+    VkResult uploaded = VK_SUCCESS;
+    GFX_CHECK(gfx::test::submit_and_wait(device, [&](VkCommandBuffer commands) {
+      uploaded = streamer.record_uploads(commands);
+    }) == VK_SUCCESS);
+    GFX_CHECK(uploaded == VK_SUCCESS);
+    if (streamer.stats().pending_steps == 0) {
+      return;
+    }
+    // Gives the thread pool time to decode.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  GFX_CHECK(streamer.stats().pending_steps == 0);
+}
+
+// Textures lose their levels with the device, and stream in again.
+auto test_textures_come_back(VulkanDevice& device, ThreadPool& thread_pool,
+                             const std::string& texture_path) -> void
+{
+  std::unique_ptr<TextureStreamer> streamer;
+  GFX_CHECK(TextureStreamer::create(device, thread_pool, {}, streamer) ==
+            VK_SUCCESS);
+  if (!streamer) {
+    return;
+  }
+  TextureHandle texture = 0;
+  GFX_CHECK(streamer->load(texture_path.c_str(), texture) == VK_SUCCESS);
+  stream(device, *streamer);
+  VkImageView view = streamer->view(texture);
+  GFX_CHECK(view != VK_NULL_HANDLE);
+  VkDeviceSize resident_bytes = streamer->stats().resident_bytes;
+  lose_and_recover(device);
+
+  GFX_CHECK(streamer->view(texture) == VK_NULL_HANDLE);
+  GFX_CHECK(streamer->resident_level(texture) == 1);
+  GFX_CHECK(streamer->stats().resident_bytes == 0);
+  stream(device, *streamer);
+  GFX_CHECK(streamer->view(texture) != VK_NULL_HANDLE &&
+            streamer->view(texture) != view);
+  GFX_CHECK(streamer->resident_level(texture) == 0);
+  GFX_CHECK(streamer->stats().resident_bytes == resident_bytes);
+}
+
+// Device local writes go through the staging slots: no command pool or
+// staging buffer per write, one copy and one submission each. A write past
+// the end changes nothing, and the slots come back empty after a recovery.
+auto test_resident_writes_use_the_staging_ring(VulkanDevice& device) -> void
+{
+  constexpr uint32_t WRITES = 10;
+  std::vector<std::byte> contents(256, std::byte{5});
+  std::unique_ptr<ResidentBuffer> buffer;
+  GFX_CHECK(ResidentBuffer::create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                   contents.data(), contents.size(),
+                                   buffer) == VK_SUCCESS);
+  if (!buffer) {
+    return;
+  }
+
+  reset_null_driver_stats();
+  std::byte value{7};
+  for (uint32_t i = 0; i < WRITES; ++i) {
+    GFX_CHECK(buffer->write(i * 16, &value, 1) == VK_SUCCESS);
+  }
+  // The first slot was created along with the buffer.
+  GFX_CHECK(gfx::vk_api::null_driver_call_count("vkCreateCommandPool") ==
+            ResidentBuffer::STAGING_SLOTS - 1);
+  GFX_CHECK(gfx::vk_api::null_driver_call_count("vkCreateBuffer") ==
+            ResidentBuffer::STAGING_SLOTS - 1);
+  NullDriverStats stats = null_driver_stats();
+  GFX_CHECK(stats.copies == WRITES);
+  GFX_CHECK(stats.submits == WRITES);
+
+  GFX_CHECK(buffer->write(contents.size() - 1, contents.data(), 2) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(buffer->write(contents.size() + 1, contents.data(), 0) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(null_driver_stats().copies == WRITES);
+
+  lose_and_recover(device);
+  GFX_CHECK(buffer->buffer().buffer != VK_NULL_HANDLE);
+  GFX_CHECK(buffer->write(0, &value, 1) == VK_SUCCESS);
+}
+
+// Everything released with the lost device is created again, and nothing
+// more: the device memory allocations are the same before and after.
+auto test_recovery_keeps_the_allocations(VulkanDevice& device) -> void
+{
+  std::vector<std::byte> contents(256, std::byte{5});
+  std::unique_ptr<ResidentBuffer> buffer;
+  GFX_CHECK(ResidentBuffer::create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                   contents.data(), contents.size(),
+                                   buffer) == VK_SUCCESS);
+  GeometryShaders shaders;
+  shaders.build_draws = ANY_SPIRV;
+  std::unique_ptr<GeometryBatcher> batcher;
+  GFX_CHECK(GeometryBatcher::create(device, {}, shaders, batcher) ==
+            VK_SUCCESS);
+  std::unique_ptr<DepthPyramid> pyramid;
+  GFX_CHECK(DepthPyramid::create(device, VK_NULL_HANDLE, 64, 64, ANY_SPIRV,
+                                 pyramid) == VK_SUCCESS);
+  GpuFrameTimer timer(device, 3);
+  if (!buffer || !batcher || !pyramid) {
+    return;
+  }
+
+  device.deletion_queue->flush();
+  uint64_t live_allocations = null_driver_stats().live_allocations;
+  lose_and_recover(device);
+  device.deletion_queue->flush();
+  GFX_CHECK(null_driver_stats().live_allocations == live_allocations);
+  GFX_CHECK(memcmp(buffer->buffer().mapped, contents.data(),
+                   contents.size()) == 0);
+}
+
+// A restore that fails leaves no device and nothing of it behind, the
+// objects restored before the failing one are released again.
+auto test_failed_restore_destroys_the_device(VulkanDevice& device) -> void
+{
+  std::vector<std::byte> contents(256, std::byte{5});
+  std::unique_ptr<ResidentBuffer> buffer;
+  GFX_CHECK(ResidentBuffer::create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                   contents.data(), contents.size(),
+                                   buffer) == VK_SUCCESS);
+  uint64_t failing = device.resources->add(
+      [](VulkanDevice&) {},
+      [](VulkanDevice&) { return VK_ERROR_OUT_OF_DEVICE_MEMORY; });
+  if (!buffer) {
+    device.resources->remove(failing);
+    return;
+  }
+
+  gfx::vk_api::lose_null_driver_device();
+  VkSubmitInfo submit_info = build<VkSubmitInfo>();
+  GFX_CHECK(device.graphics_timeline->submit(&submit_info, 1) == 0);
+  GFX_CHECK(gfx::vk_api::recover_device(device) ==
+            VK_ERROR_OUT_OF_DEVICE_MEMORY);
+  GFX_CHECK(device.logical_device == VK_NULL_HANDLE);
+  GFX_CHECK(buffer->buffer().buffer == VK_NULL_HANDLE);
+  GFX_CHECK(null_driver_stats().live_allocations == 0);
+  device.resources->remove(failing);
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Device recovery tests                                        //
+//                                                              //
+// Loses the null driver's device with every subsystem holding  //
+// GPU objects alive, recovers it, and checks they all come     //
+// back on the new device: shaders, layouts and kernels, the    //
+// compute job slots, the geometry buffers and passes, the      //
+// depth pyramid, the frame timer, the streamed textures and    //
+// the resident buffers, along with the staging slots of their  //
+// writes. A failed recovery comes last, it leaves the device   //
+// destroyed.                                                   //
+// Usage: vulkan-learning-recovery-test                         //
+// ************************************************************ //
+auto main() -> int
+{
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-recovery-test";
+  std::filesystem::create_directories(directory);
+  std::string kernel_path = (directory / "kernel.comp.spv").string();
+  std::string index_path = (directory / "shaders.index").string();
+  std::string texture_path = (directory / "texture.ktx2").string();
+  std::ofstream(kernel_path, std::ios::binary | std::ios::trunc)
+      .write(reinterpret_cast<const char*>(KERNEL_SPIRV),
+             sizeof(KERNEL_SPIRV));
+  write_ktx2(texture_path);
+
+  VulkanDevice device;
+  if (gfx::test::create_device(false, device) != VK_SUCCESS) {
+    return 1;
+  }
+  ThreadPool thread_pool(2);
+  test_shaders_and_jobs_come_back(device, kernel_path, index_path);
+  test_geometry_comes_back(device);
+  test_frame_timer_comes_back(device);
+  test_textures_come_back(device, thread_pool, texture_path);
+  test_resident_writes_use_the_staging_ring(device);
+  test_recovery_keeps_the_allocations(device);
+  test_failed_restore_destroys_the_device(device);
+  GFX_CHECK(device.resources->count() == 0);
+  gfx::test::destroy_device(device);
+  std::filesystem::remove_all(directory);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "check.h"
+#include "dirty_ranges.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+namespace {
+
+using gfx::DirtyRanges;
+using gfx::Entity;
+using gfx::InstanceUpdates;
+using gfx::Scene;
+namespace math = gfx::math;
+
+constexpr gfx::ComponentMask BOUNDED = gfx::RENDERABLE | gfx::BOUNDS_COMPONENT;
+constexpr uint32_t ELEMENTS = 256;
+constexpr int RANDOM_STEPS = 2000;
+
+auto equal(const DirtyRanges& dirty,
+           std::initializer_list<DirtyRanges::Range> expected) -> bool
+{
+  const std::vector<DirtyRanges::Range>& ranges = dirty.ranges();
+  if (ranges.size() != expected.size()) {
+    return false;
+  }
+  size_t i = 0;
+  for (const DirtyRanges::Range& range : expected) {
+    if (ranges[i].begin != range.begin || ranges[i].end != range.end) {
+      return false;
+    }
+    ++i;
+  }
+  return true;
+}
+
+auto translation(const math::Affine& affine) -> math::Vec3
+{
+  return {affine.rows[3], affine.rows[7], affine.rows[11]};
+}
+
+auto near(math::Vec3 a, math::Vec3 b) -> bool
+{
+  return math::length(a - b) < 1e-4f;
+}
+
+auto test_overlapping_and_touching_ranges_merge() -> void
+{
+  DirtyRanges dirty;
+  dirty.add(10, 20);
+  dirty.add(5, 5);
+  GFX_CHECK(equal(dirty, {{10, 20}}));
+  dirty.add(20, 25);
+  dirty.add(30, 40);
+  GFX_CHECK(equal(dirty, {{10, 25}, {30, 40}}));
+  dirty.add(5, 12);
+  dirty.add(50);
+  GFX_CHECK(equal(dirty, {{5, 25}, {30, 40}, {50, 51}}));
+  GFX_CHECK(dirty.element_count() == 31);
+  // Spans the gaps, everything merges.
+  dirty.add(24, 50);
+  GFX_CHECK(equal(dirty, {{5, 51}}));
+  dirty.clear();
+  GFX_CHECK(dirty.empty());
+}
+
+auto test_truncate_drops_removed_elements() -> void
+{
+  DirtyRanges dirty;
+  dirty.add(0, 5);
+  dirty.add(10, 20);
+  dirty.add(30, 40);
+  dirty.truncate(40);
+  GFX_CHECK(equal(dirty, {{0, 5}, {10, 20}, {30, 40}}));
+  dirty.truncate(15);
+  GFX_CHECK(equal(dirty, {{0, 5}, {10, 15}}));
+  dirty.truncate(10);
+  GFX_CHECK(equal(dirty, {{0, 5}}));
+  dirty.truncate(0);
+  GFX_CHECK(dirty.empty());
+}
+
+// Past the limit, the two ranges with the smallest gap merge.
+auto test_closest_ranges_merge_past_the_limit() -> void
+{
+  DirtyRanges dirty(3);
+  dirty.add(0, 1);
+  dirty.add(10, 11);
+  dirty.add(13, 14);
+  GFX_CHECK(equal(dirty, {{0, 1}, {10, 11}, {13, 14}}));
+  dirty.add(30, 31);
+  GFX_CHECK(equal(dirty, {{0, 1}, {10, 14}, {30, 31}}));
+  // The first gap is now the smallest.
+  dirty.add(3, 4);
+  GFX_CHECK(equal(dirty, {{0, 4}, {10, 14}, {30, 31}}));
+  dirty.add(40, 41);
+  GFX_CHECK(equal(dirty, {{0, 14}, {30, 31}, {40, 41}}));
+}
+
+// Random additions against a flag per element: the ranges cover exactly the
+// added elements without a limit, and a superset of them within it.
+auto test_ranges_match_added_elements() -> void
+{
+  std::mt19937 random(5);
+  std::uniform_int_distribution<uint32_t> element(0, ELEMENTS - 1);
+  std::uniform_int_distribution<uint32_t> length(0, 8);
+  for (size_t max_ranges : {size_t{1024}, size_t{4}}) {
+    DirtyRanges dirty(max_ranges);
+    std::vector<bool> added(ELEMENTS + 8, false);
+    for (int i = 0; i < RANDOM_STEPS; ++i) {
+      if (i % 100 == 0) {
+        dirty.clear();
+        added.assign(added.size(), false);
+      }
+      uint32_t begin = element(random);
+      uint32_t end = begin + length(random);
+      dirty.add(begin, end);
+      for (uint32_t j = begin; j < end; ++j) {
+        added[j] = true;
+      }
+
+      std::vector<bool> covered(added.size(), false);
+      bool ordered = dirty.ranges().size() <= max_ranges;
+      uint32_t previous_end = 0;
+      for (const DirtyRanges::Range& range : dirty.ranges()) {
+        // Sorted, disjoint and not touching, or they would have merged.
+        ordered = ordered && range.begin < range.end &&
+                  (&range == &dirty.ranges().front() ||
+                   range.begin > previous_end);
+        previous_end = range.end;
+        for (uint32_t j = range.begin; j < range.end; ++j) {
+          covered[j] = true;
+        }
+      }
+      bool matches = true;
+      for (size_t j = 0; j < added.size(); ++j) {
+        matches = matches && (max_ranges == 4 ? !added[j] || covered[j]
+                                              : added[j] == covered[j]);
+      }
+      GFX_CHECK(ordered);
+      GFX_CHECK(matches);
+    }
+  }
+}
+
+// Removing a row moves the archetype's last entity into it, its handle
+// still finds its components. Changing components moves the entity to
+// another archetype with the components both have.
+auto test_entities_move_across_archetypes(gfx::ThreadPool& thread_pool)
+    -> void
+{
+  Scene scene(thread_pool);
+  std::vector<Entity> drawn;
+  for (uint32_t i = 0; i < 5; ++i) {
+    drawn.push_back(scene.create(gfx::RENDERABLE));
+    scene.set_transform(drawn.back(), {static_cast<float>(i), 0.0f, 0.0f},
+                        math::identity_quat(), {1.0f, 1.0f, 1.0f});
+    scene.set_mesh(drawn.back(), i);
+  }
+  Entity hidden = scene.create(gfx::TRANSFORM_COMPONENT);
+  GFX_CHECK(scene.stats().entities == 6);
+  GFX_CHECK(scene.stats().archetypes == 2);
+
+  scene.destroy(drawn[1]);
+  GFX_CHECK(!scene.alive(drawn[1]));
+  GFX_CHECK(scene.alive(drawn[4]));
+  scene.update_transforms();
+  for (uint32_t i : {0, 2, 3, 4}) {
+    GFX_CHECK(near(translation(scene.world_transform(drawn[i])),
+                   {static_cast<float>(i), 0.0f, 0.0f}));
+  }
+
+  // The freed index is reused with another generation.
+  Entity reused = scene.create(gfx::RENDERABLE);
+  GFX_CHECK(reused.index == drawn[1].index);
+  GFX_CHECK(reused.generation != drawn[1].generation);
+  GFX_CHECK(!scene.alive(drawn[1]));
+
+  scene.add_components(drawn[2], gfx::BOUNDS_COMPONENT);
+  GFX_CHECK(scene.components(drawn[2]) == BOUNDED);
+  GFX_CHECK(scene.stats().archetypes == 3);
+  scene.set_bounds(drawn[2], {{0.0f, 1.0f, 0.0f}, 2.0f});
+  scene.update_transforms();
+  GFX_CHECK(near(translation(scene.world_transform(drawn[2])),
+                 {2.0f, 0.0f, 0.0f}));
+  math::Sphere bounds = scene.world_bounds(drawn[2]);
+  GFX_CHECK(near(bounds.center, {2.0f, 1.0f, 0.0f}));
+  GFX_CHECK(std::fabs(bounds.radius - 2.0f) < 1e-4f);
+
+  scene.remove_components(drawn[3], gfx::MESH_COMPONENT);
+  GFX_CHECK(scene.components(drawn[3]) == gfx::TRANSFORM_COMPONENT);
+  scene.update_transforms();
+  GFX_CHECK(near(translation(scene.world_transform(drawn[3])),
+                 {3.0f, 0.0f, 0.0f}));
+  GFX_CHECK(near(translation(scene.world_transform(hidden)),
+                 {0.0f, 0.0f, 0.0f}));
+  GFX_CHECK(scene.stats().entities == 6);
+
+  // Only the renderable entities are instances.
+  GFX_CHECK(scene.collect_instance_updates().instance_count == 4);
+}
+
+// What the renderer should hold: the renderable rows, archetype after
+// archetype.
+auto rebuild_instances(Scene& scene, std::vector<math::Affine>& transforms,
+                       std::vector<uint32_t>& meshes) -> void
+{
+  transforms.clear();
+  meshes.clear();
+  scene.for_each(gfx::RENDERABLE, [&](gfx::Archetype& archetype) {
+    math::AffineSoA world = archetype.world_transforms();
+    for (uint32_t row = 0; row < archetype.size(); ++row) {
+      math::Affine affine;
+      for (uint32_t i = 0; i < 12; ++i) {
+        affine.rows[i] = world.rows[i][row];
+      }
+      transforms.push_back(affine);
+      meshes.push_back(archetype.meshes()[row]);
+    }
+  });
+}
+
+// Random edits of a scene, the instances mirrored from the updates alone
+// must match a rebuild after every collect. Removals and component changes
+// renumber the instances of the following archetypes.
+auto test_instance_updates_match_a_rebuild(gfx::ThreadPool& thread_pool)
+    -> void
+{
+  Scene scene(thread_pool);
+  const gfx::ComponentMask masks[] = {
+      gfx::RENDERABLE, BOUNDED, gfx::RENDERABLE | gfx::MATERIAL_COMPONENT,
+      gfx::TRANSFORM_COMPONENT};
+  std::vector<Entity> entities;
+  std::vector<math::Affine> mirror_transforms;
+  std::vector<uint32_t> mirror_meshes;
+  std::vector<math::Affine> transforms;
+  std::vector<uint32_t> meshes;
+
+  std::mt19937 random(17);
+  std::uniform_int_distribution<int> operation(0, 9);
+  std::uniform_int_distribution<uint32_t> mask(0, std::size(masks) - 1);
+  std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+  bool matches = true;
+  uint32_t renumbered = 0;
+  for (int step = 0; step < RANDOM_STEPS; ++step) {
+    int op = operation(random);
+    if (entities.empty() || op < 3) {
+      entities.push_back(scene.create(masks[mask(random)]));
+    }
+    else {
+      size_t pick = random() % entities.size();
+      Entity entity = entities[pick];
+      gfx::ComponentMask components = scene.components(entity);
+      if (op == 3) {
+        scene.destroy(entity);
+        entities[pick] = entities.back();
+        entities.pop_back();
+      }
+      else if (op == 4) {
+        scene.add_components(entity, gfx::MESH_COMPONENT |
+                                         gfx::BOUNDS_COMPONENT);
+      }
+      else if (op == 5) {
+        scene.remove_components(entity, gfx::MESH_COMPONENT);
+      }
+      else if (op < 8 && (components & gfx::TRANSFORM_COMPONENT)) {
+        scene.set_transform(
+            entity, {position(random), position(random), position(random)},
+            math::normalize(math::Quat{position(random), position(random),
+                                       position(random), 1.0f}),
+            {1.0f, 2.0f, 1.0f});
+      }
+      else if (components & gfx::MESH_COMPONENT) {
+        scene.set_mesh(entity, static_cast<uint32_t>(random() % 64));
+      }
+    }
+    if (step % 7 != 0) {
+      continue;
+    }
+
+    scene.update_transforms();
+    const InstanceUpdates& updates = scene.collect_instance_updates();
+    mirror_transforms.resize(updates.instance_count);
+    mirror_meshes.resize(updates.instance_count);
+    for (const InstanceUpdates::Range& range : updates.ranges) {
+      if (range.first + range.count > updates.instance_count) {
+        matches = false;
+        continue;
+      }
+      for (uint32_t i = 0; i < range.count; ++i) {
+        mirror_transforms[range.first + i] = range.transforms[i];
+        mirror_meshes[range.first + i] = range.meshes[i];
+      }
+    }
+    renumbered += scene.stats().uploaded_instances;
+
+    rebuild_instances(scene, transforms, meshes);
+    matches = matches && meshes == mirror_meshes;
+    for (size_t i = 0; i < transforms.size() && matches; ++i) {
+      for (uint32_t j = 0; j < 12; ++j) {
+        matches = matches &&
+                  transforms[i].rows[j] == mirror_transforms[i].rows[j];
+      }
+    }
+  }
+  GFX_CHECK(matches);
+  GFX_CHECK(renumbered > 0);
+
+  // Nothing changed since, nothing is sent.
+  scene.update_transforms();
+  scene.collect_instance_updates();
+  scene.update_transforms();
+  GFX_CHECK(scene.collect_instance_updates().ranges.empty());
+  GFX_CHECK(scene.stats().uploaded_instances == 0);
+}
+
+}  // namespace
+
+auto main() -> int
+{
+  gfx::ThreadPool thread_pool(2);
+  test_overlapping_and_touching_ranges_merge();
+  test_truncate_drops_removed_elements();
+  test_closest_ranges_merge_past_the_limit();
+  test_ranges_match_added_elements();
+  test_entities_move_across_archetypes(thread_pool);
+  test_instance_updates_match_a_rebuild(thread_pool);
+  if (gfx::test::failures > 0) {
+    std::cerr << gfx::test::failures << " checks failed." << std::endl;
+  }
+  return gfx::test::failures > 0 ? 1 : 0;
+}
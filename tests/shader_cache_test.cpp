@@ -0,0 +1,223 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "shader_cache.h"
+#include "shader_reflection.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::vk_api::reflect_spirv;
+using gfx::vk_api::Shader;
+using gfx::vk_api::ShaderCache;
+using gfx::vk_api::ShaderReflection;
+using gfx::vk_api::VulkanDevice;
+
+constexpr uint32_t SPIRV_HEADER_WORDS = 5;
+constexpr uint32_t OP_ENTRY_POINT = 15;
+constexpr uint32_t OP_EXECUTION_MODE = 16;
+constexpr uint32_t OP_TYPE_INT = 21;
+constexpr uint32_t OP_TYPE_FLOAT = 22;
+constexpr uint32_t OP_TYPE_VECTOR = 23;
+constexpr uint32_t OP_TYPE_IMAGE = 25;
+constexpr uint32_t OP_TYPE_SAMPLED_IMAGE = 27;
+constexpr uint32_t OP_TYPE_ARRAY = 28;
+constexpr uint32_t OP_TYPE_STRUCT = 30;
+constexpr uint32_t OP_TYPE_POINTER = 32;
+constexpr uint32_t OP_CONSTANT = 43;
+constexpr uint32_t OP_VARIABLE = 59;
+constexpr uint32_t OP_DECORATE = 71;
+constexpr uint32_t OP_MEMBER_DECORATE = 72;
+constexpr uint32_t DECORATION_ARRAY_STRIDE = 6;
+constexpr uint32_t DECORATION_BINDING = 33;
+constexpr uint32_t DECORATION_DESCRIPTOR_SET = 34;
+constexpr uint32_t DECORATION_OFFSET = 35;
+constexpr uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+constexpr uint32_t STORAGE_PUSH_CONSTANT = 9;
+
+// Appends an instruction, its word count is worked out.
+auto op(std::vector<uint32_t>& code, uint32_t opcode,
+        std::initializer_list<uint32_t> operands) -> void
+{
+  code.push_back(static_cast<uint32_t>(operands.size() + 1) << 16 | opcode);
+  code.insert(code.end(), operands);
+}
+
+// A compute entry point with a local size of local_size_x 4 1, an array of
+// 4 combined image samplers at set 0 binding 1, a storage image at set 1
+// binding 0 and a push constant block of a uint and 3 vec4 with a stride
+// of 16, 64 bytes.
+auto interface_spirv(uint32_t local_size_x) -> std::vector<uint32_t>
+{
+  std::vector<uint32_t> code = {0x07230203, 0x00010000, 0, 19, 0};
+  op(code, OP_ENTRY_POINT, {5, 1, 0x6e69616d, 0});
+  op(code, OP_EXECUTION_MODE, {1, 17, local_size_x, 4, 1});
+  op(code, OP_DECORATE, {9, DECORATION_DESCRIPTOR_SET, 0});
+  op(code, OP_DECORATE, {9, DECORATION_BINDING, 1});
+  op(code, OP_DECORATE, {12, DECORATION_DESCRIPTOR_SET, 1});
+  op(code, OP_DECORATE, {12, DECORATION_BINDING, 0});
+  op(code, OP_DECORATE, {15, DECORATION_ARRAY_STRIDE, 16});
+  op(code, OP_MEMBER_DECORATE, {16, 0, DECORATION_OFFSET, 0});
+  op(code, OP_MEMBER_DECORATE, {16, 1, DECORATION_OFFSET, 16});
+  op(code, OP_TYPE_INT, {2, 32, 0});
+  op(code, OP_TYPE_FLOAT, {3, 32});
+  // %4 = OpTypeImage %3 2D depth 0 arrayed 0 ms 0 sampled 1 Unknown
+  op(code, OP_TYPE_IMAGE, {4, 3, 1, 0, 0, 0, 1, 0});
+  op(code, OP_TYPE_SAMPLED_IMAGE, {5, 4});
+  op(code, OP_CONSTANT, {2, 6, 4});
+  op(code, OP_TYPE_ARRAY, {7, 5, 6});
+  op(code, OP_TYPE_POINTER, {8, STORAGE_UNIFORM_CONSTANT, 7});
+  op(code, OP_VARIABLE, {8, 9, STORAGE_UNIFORM_CONSTANT});
+  // %10 = OpTypeImage %3 2D depth 0 arrayed 0 ms 0 sampled 2 R32f
+  op(code, OP_TYPE_IMAGE, {10, 3, 1, 0, 0, 0, 2, 3});
+  op(code, OP_TYPE_POINTER, {11, STORAGE_UNIFORM_CONSTANT, 10});
+  op(code, OP_VARIABLE, {11, 12, STORAGE_UNIFORM_CONSTANT});
+  op(code, OP_TYPE_VECTOR, {13, 3, 4});
+  op(code, OP_CONSTANT, {2, 14, 3});
+  op(code, OP_TYPE_ARRAY, {15, 13, 14});
+  op(code, OP_TYPE_STRUCT, {16, 2, 15});
+  op(code, OP_TYPE_POINTER, {17, STORAGE_PUSH_CONSTANT, 16});
+  op(code, OP_VARIABLE, {17, 18, STORAGE_PUSH_CONSTANT});
+  return code;
+}
+
+auto write_spirv(const std::string& path, const std::vector<uint32_t>& code)
+    -> void
+{
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      .write(reinterpret_cast<const char*>(code.data()),
+             static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+}
+
+auto test_interface_is_reflected() -> void
+{
+  std::vector<uint32_t> code = interface_spirv(8);
+  ShaderReflection reflection = {};
+  GFX_CHECK(reflect_spirv(code.data(), code.size(), reflection));
+  GFX_CHECK(reflection.stage == VK_SHADER_STAGE_COMPUTE_BIT);
+  GFX_CHECK(reflection.local_size[0] == 8 && reflection.local_size[1] == 4 &&
+            reflection.local_size[2] == 1);
+  GFX_CHECK(reflection.push_constant_size == 64);
+  GFX_CHECK(reflection.bindings.size() == 2);
+  if (reflection.bindings.size() != 2) {
+    return;
+  }
+  const gfx::vk_api::ShaderBinding& textures = reflection.bindings[0];
+  GFX_CHECK(textures.set == 0 && textures.binding == 1);
+  GFX_CHECK(textures.type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+  GFX_CHECK(textures.count == 4);
+  GFX_CHECK(textures.stages == VK_SHADER_STAGE_COMPUTE_BIT);
+  const gfx::vk_api::ShaderBinding& image = reflection.bindings[1];
+  GFX_CHECK(image.set == 1 && image.binding == 0);
+  GFX_CHECK(image.type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+  GFX_CHECK(image.count == 1);
+}
+
+// Cutting the module anywhere but between two instructions leaves one
+// running past the end, or a header short of its bound.
+auto test_malformed_modules_are_rejected() -> void
+{
+  std::vector<uint32_t> code = interface_spirv(8);
+  std::vector<bool> boundary(code.size() + 1, false);
+  for (size_t word = SPIRV_HEADER_WORDS; word < code.size();
+       word += code[word] >> 16) {
+    boundary[word] = true;
+  }
+  for (size_t word_count = 0; word_count < code.size(); ++word_count) {
+    if (!boundary[word_count]) {
+      ShaderReflection reflection = {};
+      GFX_CHECK(!reflect_spirv(code.data(), word_count, reflection));
+    }
+  }
+
+  // More ids than words.
+  std::vector<uint32_t> bound = code;
+  bound[3] = static_cast<uint32_t>(bound.size() + 1);
+  ShaderReflection reflection = {};
+  GFX_CHECK(!reflect_spirv(bound.data(), bound.size(), reflection));
+
+  // The push constant block only has members 0 and 1.
+  std::vector<uint32_t> member = code;
+  op(member, OP_MEMBER_DECORATE, {16, 2, DECORATION_OFFSET, 80});
+  reflection = {};
+  GFX_CHECK(!reflect_spirv(member.data(), member.size(), reflection));
+  // Nor one that would size its layouts to 4G members.
+  member[member.size() - 3] = 0xffffffff;
+  reflection = {};
+  GFX_CHECK(!reflect_spirv(member.data(), member.size(), reflection));
+}
+
+// Files of the same content share a module. A stale index entry can give a
+// file the hash of another content, it is caught by comparing the code.
+auto test_hash_hits_compare_the_code(VulkanDevice& device,
+                                     const std::filesystem::path& directory)
+    -> void
+{
+  std::string index_path = (directory / "shaders.index").string();
+  std::string first_path = (directory / "first.comp.spv").string();
+  std::string copy_path = (directory / "copy.comp.spv").string();
+  std::string changed_path = (directory / "changed.comp.spv").string();
+  std::vector<uint32_t> code = interface_spirv(8);
+  write_spirv(first_path, code);
+  write_spirv(copy_path, code);
+  write_spirv(changed_path, code);
+  {
+    ShaderCache shader_cache(device, index_path);
+    const Shader* shader = nullptr;
+    GFX_CHECK(shader_cache.load(changed_path, shader) == VK_SUCCESS);
+  }
+  // Same size and modification time, the index entry still matches.
+  auto modified = std::filesystem::last_write_time(changed_path);
+  write_spirv(changed_path, interface_spirv(16));
+  std::filesystem::last_write_time(changed_path, modified);
+
+  ShaderCache shader_cache(device, index_path);
+  const Shader* first = nullptr;
+  const Shader* copy = nullptr;
+  const Shader* changed = nullptr;
+  GFX_CHECK(shader_cache.load(first_path, first) == VK_SUCCESS);
+  GFX_CHECK(shader_cache.load(copy_path, copy) == VK_SUCCESS);
+  GFX_CHECK(first != nullptr && copy != nullptr &&
+            first->module == copy->module);
+  GFX_CHECK(shader_cache.stats().modules == 1);
+  GFX_CHECK(shader_cache.load(changed_path, changed) ==
+            VK_ERROR_INITIALIZATION_FAILED);
+  GFX_CHECK(shader_cache.stats().modules == 1);
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Shader cache tests                                           //
+//                                                              //
+// Reflects a handcrafted SPIR-V module with descriptor arrays, //
+// a storage image and a push constant block, then checks that  //
+// truncated modules, a bound past the end and decorations of   //
+// missing members are rejected. On the null driver, loads      //
+// files sharing a content hash, one of them changed behind a   //
+// stale index entry.                                           //
+// Usage: vulkan-learning-shader-cache-test                     //
+// ************************************************************ //
+auto main() -> int
+{
+  test_interface_is_reflected();
+  test_malformed_modules_are_rejected();
+
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-shader-test";
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  VulkanDevice device;
+  if (gfx::test::create_device(false, device) != VK_SUCCESS) {
+    return 1;
+  }
+  test_hash_hits_compare_the_code(device, directory);
+  gfx::test::destroy_device(device);
+  std::filesystem::remove_all(directory);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
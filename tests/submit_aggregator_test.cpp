@@ -0,0 +1,226 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "vulkan_submit.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::vk_api::SubmitAggregator;
+using gfx::vk_api::SubmitRequest;
+using gfx::vk_api::SubmitStats;
+using gfx::vk_api::VulkanDevice;
+
+constexpr uint32_t PRODUCERS = 4;
+constexpr uint32_t REQUESTS_PER_PRODUCER = 5000;
+// Far below a frame's requests, most of them overflow the pool.
+constexpr uint32_t POOLED_REQUESTS = 4;
+
+// Command buffers of every vkQueueSubmit call, in submission order. Only
+// the flushing thread submits.
+std::vector<VkCommandBuffer> SUBMITTED;
+uint32_t SUBMIT_CALLS = 0;
+// Queue of every vkQueueSubmit call.
+std::vector<VkQueue> SUBMIT_QUEUES;
+
+VKAPI_ATTR auto VKAPI_CALL record_submit(VkQueue queue, uint32_t submit_count,
+                                         const VkSubmitInfo* submits,
+                                         VkFence) -> VkResult
+{
+  ++SUBMIT_CALLS;
+  SUBMIT_QUEUES.push_back(queue);
+  for (uint32_t i = 0; i < submit_count; ++i) {
+    SUBMITTED.insert(SUBMITTED.end(), submits[i].pCommandBuffers,
+                     submits[i].pCommandBuffers +
+                         submits[i].commandBufferCount);
+  }
+  return VK_SUCCESS;
+}
+
+// Never dereferenced, they tell the producer and the request apart.
+auto fake_handle(uint32_t producer, uint32_t request) -> VkCommandBuffer
+{
+  return reinterpret_cast<VkCommandBuffer>(
+      uintptr_t{producer} * REQUESTS_PER_PRODUCER + request + 1);
+}
+
+auto request_of(VkQueue queue, const VkCommandBuffer& command_buffer)
+    -> SubmitRequest
+{
+  SubmitRequest request = {};
+  request.queue = queue;
+  request.command_buffer_count = 1;
+  request.command_buffers = &command_buffer;
+  return request;
+}
+
+// Producers enqueue while the render thread flushes, so banks switch and
+// overflow nodes join the pool as requests keep coming. Every request is
+// submitted once, each producer's in enqueue order.
+auto test_requests_from_many_threads(VulkanDevice& device) -> void
+{
+  VulkanDevice recording = device;
+  recording.vkQueueSubmit = record_submit;
+  SubmitAggregator aggregator(recording, POOLED_REQUESTS);
+  SUBMITTED.clear();
+
+  std::atomic<uint32_t> running = PRODUCERS;
+  std::vector<std::thread> producers;
+  for (uint32_t producer = 0; producer < PRODUCERS; ++producer) {
+    producers.emplace_back([&, producer] {
+      for (uint32_t i = 0; i < REQUESTS_PER_PRODUCER; ++i) {
+        VkCommandBuffer command_buffer = fake_handle(producer, i);
+        aggregator.enqueue(request_of(device.graphics_queue, command_buffer));
+      }
+      --running;
+    });
+  }
+  uint32_t requests = 0;
+  uint32_t flushes = 0;
+  while (running.load() > 0) {
+    SubmitStats stats = aggregator.flush();
+    GFX_CHECK(stats.result == VK_SUCCESS);
+    requests += stats.requests;
+    ++flushes;
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  SubmitStats stats = aggregator.flush();
+  requests += stats.requests;
+  GFX_CHECK(aggregator.flush().requests == 0);
+
+  GFX_CHECK(requests == PRODUCERS * REQUESTS_PER_PRODUCER);
+  GFX_CHECK(SUBMITTED.size() == PRODUCERS * REQUESTS_PER_PRODUCER);
+  std::vector<uint32_t> next(PRODUCERS, 0);
+  bool ordered = true;
+  for (VkCommandBuffer command_buffer : SUBMITTED) {
+    auto index = reinterpret_cast<uintptr_t>(command_buffer) - 1;
+    auto producer = static_cast<uint32_t>(index / REQUESTS_PER_PRODUCER);
+    auto request = static_cast<uint32_t>(index % REQUESTS_PER_PRODUCER);
+    if (producer >= PRODUCERS || request != next[producer]) {
+      ordered = false;
+      break;
+    }
+    ++next[producer];
+  }
+  GFX_CHECK(ordered);
+  GFX_CHECK(flushes > 0);
+}
+
+// A request that waits starts a new batch unless the current one is empty,
+// and a fence ends the vkQueueSubmit call.
+auto test_batches_follow_the_requests(VulkanDevice& device) -> void
+{
+  VulkanDevice recording = device;
+  recording.vkQueueSubmit = record_submit;
+  SubmitAggregator aggregator(recording, POOLED_REQUESTS);
+  SUBMITTED.clear();
+  SUBMIT_CALLS = 0;
+
+  VkCommandBuffer command_buffers[5];
+  for (uint32_t i = 0; i < 5; ++i) {
+    command_buffers[i] = fake_handle(0, i);
+  }
+  auto semaphore = reinterpret_cast<VkSemaphore>(uintptr_t{1});
+  auto fence = reinterpret_cast<VkFence>(uintptr_t{2});
+  SubmitRequest requests[5];
+  for (uint32_t i = 0; i < 5; ++i) {
+    requests[i] = request_of(device.graphics_queue, command_buffers[i]);
+  }
+  requests[1].wait_count = 1;
+  requests[1].wait_semaphores = &semaphore;
+  requests[2].signal_count = 1;
+  requests[2].signal_semaphores = &semaphore;
+  requests[3].fence = fence;
+  for (const SubmitRequest& request : requests) {
+    aggregator.enqueue(request);
+  }
+
+  SubmitStats stats = aggregator.flush();
+  GFX_CHECK(stats.result == VK_SUCCESS);
+  GFX_CHECK(stats.requests == 5);
+  // [0], [1 2 3] up to the fence, then [4].
+  GFX_CHECK(stats.batches == 3);
+  GFX_CHECK(stats.queue_submits == 2);
+  GFX_CHECK(SUBMIT_CALLS == 2);
+  GFX_CHECK(SUBMITTED.size() == 5);
+  GFX_CHECK(aggregator.last_frame_stats().batches == 3);
+}
+
+// The first queue signals a semaphore the second waits on, which signals
+// one the first queue then waits on. Each run of requests on a queue is
+// submitted before the next, in enqueue order, or the second queue's wait
+// would be submitted before its signal.
+auto test_queues_keep_enqueue_order(VulkanDevice& device) -> void
+{
+  VulkanDevice recording = device;
+  recording.vkQueueSubmit = record_submit;
+  SubmitAggregator aggregator(recording, POOLED_REQUESTS);
+  SUBMITTED.clear();
+  SUBMIT_CALLS = 0;
+  SUBMIT_QUEUES.clear();
+
+  auto first_queue = reinterpret_cast<VkQueue>(uintptr_t{1});
+  auto second_queue = reinterpret_cast<VkQueue>(uintptr_t{2});
+  auto first_signal = reinterpret_cast<VkSemaphore>(uintptr_t{1});
+  auto second_signal = reinterpret_cast<VkSemaphore>(uintptr_t{2});
+  VkCommandBuffer command_buffers[3];
+  for (uint32_t i = 0; i < 3; ++i) {
+    command_buffers[i] = fake_handle(0, i);
+  }
+
+  SubmitRequest signal_first = request_of(first_queue, command_buffers[0]);
+  signal_first.signal_count = 1;
+  signal_first.signal_semaphores = &first_signal;
+  SubmitRequest wait_first = request_of(second_queue, command_buffers[1]);
+  wait_first.wait_count = 1;
+  wait_first.wait_semaphores = &first_signal;
+  wait_first.signal_count = 1;
+  wait_first.signal_semaphores = &second_signal;
+  SubmitRequest wait_second = request_of(first_queue, command_buffers[2]);
+  wait_second.wait_count = 1;
+  wait_second.wait_semaphores = &second_signal;
+  aggregator.enqueue(signal_first);
+  aggregator.enqueue(wait_first);
+  aggregator.enqueue(wait_second);
+
+  SubmitStats stats = aggregator.flush();
+  GFX_CHECK(stats.result == VK_SUCCESS);
+  GFX_CHECK(stats.requests == 3);
+  GFX_CHECK(stats.batches == 3);
+  GFX_CHECK(stats.queue_submits == 3);
+  GFX_CHECK(SUBMIT_QUEUES ==
+            std::vector<VkQueue>({first_queue, second_queue, first_queue}));
+  GFX_CHECK(SUBMITTED == std::vector<VkCommandBuffer>(command_buffers,
+                                                      command_buffers + 3));
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Submit aggregator tests                                      //
+//                                                              //
+// Enqueues from several producer threads while the render      //
+// thread flushes, with a pool much smaller than the requests,  //
+// and checks every request is submitted once and in order.     //
+// Also checks how requests are grouped into batches and        //
+// vkQueueSubmit calls, and that requests on several queues     //
+// are submitted in enqueue order.                              //
+// Usage: vulkan-learning-submit-aggregator-test                //
+// ************************************************************ //
+auto main() -> int
+{
+  VulkanDevice device;
+  if (gfx::test::create_device(false, device) != VK_SUCCESS) {
+    return 1;
+  }
+  test_requests_from_many_threads(device);
+  test_batches_follow_the_requests(device);
+  test_queues_keep_enqueue_order(device);
+  gfx::test::destroy_device(device);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
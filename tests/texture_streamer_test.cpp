@@ -0,0 +1,257 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "texture_streamer.h"
+#include "vulkan_test.h"
+
+namespace {
+
+using gfx::ThreadPool;
+using gfx::vk_api::TextureHandle;
+using gfx::vk_api::TextureStreamer;
+using gfx::vk_api::TextureStreamingLimits;
+using gfx::vk_api::VulkanDevice;
+
+constexpr uint32_t SIZE = 256;
+constexpr uint32_t LEVEL_COUNT = 9;
+// Levels of 16x16 texels and smaller, 4 to 8, form the mip tail.
+constexpr uint32_t TAIL_SIZE = 16;
+constexpr uint32_t TAIL_LEVEL = 4;
+constexpr uint32_t RGBA8_BYTES = 4;
+constexpr uint32_t MAX_FRAMES = 1000;
+
+// Uncompressed RGBA8 KTX2 file with every level, smallest level first.
+// The base level takes base_size bytes, which is wrong when not the
+// default.
+auto write_ktx2(const std::string& path, uint32_t seed,
+                uint64_t base_size = uint64_t{SIZE} * SIZE * RGBA8_BYTES)
+    -> void
+{
+  uint32_t dfd[11] = {44, 0, 2 | (40u << 16), 0, 0, RGBA8_BYTES, 0, 0, 0, 0, 0};
+  uint32_t header[20] = {};
+  const uint8_t identifier[12] = {0xab, 'K', 'T', 'X', ' ', '2',
+                                  '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+  memcpy(header, identifier, sizeof(identifier));
+  header[3] = VK_FORMAT_R8G8B8A8_UNORM;
+  header[4] = 1;
+  header[5] = SIZE;
+  header[6] = SIZE;
+  header[9] = 1;
+  header[10] = LEVEL_COUNT;
+  uint64_t dfd_offset = sizeof(header) + LEVEL_COUNT * sizeof(gfx::Ktx2Level);
+  header[12] = static_cast<uint32_t>(dfd_offset);
+  header[13] = sizeof(dfd);
+
+  std::vector<gfx::Ktx2Level> level_index(LEVEL_COUNT);
+  uint64_t offset = (dfd_offset + sizeof(dfd) + 15) / 16 * 16;
+  for (uint32_t level = LEVEL_COUNT; level-- > 0;) {
+    uint64_t extent = SIZE >> level;
+    uint64_t size = level > 0 ? extent * extent * RGBA8_BYTES : base_size;
+    level_index[level] = {offset, size, size};
+    offset = (offset + size + 15) / 16 * 16;
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(level_index.data()),
+             LEVEL_COUNT * sizeof(gfx::Ktx2Level));
+  file.write(reinterpret_cast<const char*>(dfd), sizeof(dfd));
+  for (uint32_t level = LEVEL_COUNT; level-- > 0;) {
+    std::vector<char> texels(level_index[level].uncompressed_size,
+                             static_cast<char>(seed + level));
+    file.seekp(static_cast<std::streamoff>(level_index[level].offset));
+    file.write(texels.data(), static_cast<std::streamsize>(texels.size()));
+  }
+}
+
+// Records and submits frames until no step is pending, calling frame()
+// before each. Returns the levels evicted over all the frames.
+template <typename Frame>
+auto stream(VulkanDevice& device, TextureStreamer& streamer, Frame frame)
+    -> uint32_t
+{
+  uint32_t evicted_levels = 0;
+  for (uint32_t i = 0; i < MAX_FRAMES; ++i) {
+    frame();
+    VkResult uploaded = VK_SUCCESS;
+    GFX_CHECK(gfx::test::submit_and_wait(device, [&](VkCommandBuffer commands) {
+      uploaded = streamer.record_uploads(commands);
+    }) == VK_SUCCESS);
+    GFX_CHECK(uploaded == VK_SUCCESS);
+    evicted_levels += streamer.stats().evicted_levels;
+    if (streamer.stats().pending_steps == 0) {
+      break;
+    }
+    // Gives the thread pool time to decode.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  GFX_CHECK(streamer.stats().pending_steps == 0);
+  return evicted_levels;
+}
+
+auto test_levels_stream_in(VulkanDevice& device, ThreadPool& thread_pool,
+                           const std::string& path) -> void
+{
+  TextureStreamingLimits limits;
+  limits.mip_tail_size = TAIL_SIZE;
+  std::unique_ptr<TextureStreamer> streamer;
+  GFX_CHECK(TextureStreamer::create(device, thread_pool, limits, streamer) ==
+            VK_SUCCESS);
+  if (!streamer) {
+    return;
+  }
+
+  TextureHandle texture = 0;
+  GFX_CHECK(streamer->load(path.c_str(), texture) == VK_SUCCESS);
+  GFX_CHECK(streamer->resident_level(texture) == LEVEL_COUNT);
+  GFX_CHECK(streamer->view(texture) == VK_NULL_HANDLE);
+  stream(device, *streamer, [] {});
+  GFX_CHECK(streamer->resident_level(texture) == TAIL_LEVEL);
+  GFX_CHECK(streamer->view(texture) != VK_NULL_HANDLE);
+  GFX_CHECK(streamer->stats().complete_textures == 1);
+
+  // Grows one level per step, and the mip tail stays resident.
+  std::vector<uint32_t> levels;
+  stream(device, *streamer, [&] {
+    streamer->request(texture, 0);
+    uint32_t level = streamer->resident_level(texture);
+    if (levels.empty() || levels.back() != level) {
+      levels.push_back(level);
+    }
+  });
+  levels.push_back(streamer->resident_level(texture));
+  GFX_CHECK((levels == std::vector<uint32_t>{4, 3, 2, 1, 0}));
+  GFX_CHECK(streamer->view(texture) != VK_NULL_HANDLE);
+  GFX_CHECK(streamer->stats().complete_textures == 1);
+  GFX_CHECK(streamer->stats().resident_bytes > 0);
+}
+
+// The null driver sizes a full 256x256 image at 2 MiB, and the 128x128 one
+// at 512 KiB. Both textures complete do not fit in the budget, so the one
+// not requested anymore loses its finest level.
+auto test_unrequested_levels_are_evicted(VulkanDevice& device,
+                                         ThreadPool& thread_pool,
+                                         const std::string& first_path,
+                                         const std::string& second_path)
+    -> void
+{
+  TextureStreamingLimits limits;
+  limits.mip_tail_size = TAIL_SIZE;
+  limits.memory_budget = 2560 << 10;
+  std::unique_ptr<TextureStreamer> streamer;
+  GFX_CHECK(TextureStreamer::create(device, thread_pool, limits, streamer) ==
+            VK_SUCCESS);
+  if (!streamer) {
+    return;
+  }
+
+  TextureHandle first = 0;
+  GFX_CHECK(streamer->load(first_path.c_str(), first) == VK_SUCCESS);
+  uint32_t evicted_levels =
+      stream(device, *streamer, [&] { streamer->request(first, 0); });
+  GFX_CHECK(streamer->resident_level(first) == 0);
+  GFX_CHECK(evicted_levels == 0);
+
+  TextureHandle second = 0;
+  GFX_CHECK(streamer->load(second_path.c_str(), second) == VK_SUCCESS);
+  evicted_levels =
+      stream(device, *streamer, [&] { streamer->request(second, 0); });
+  GFX_CHECK(streamer->resident_level(second) == 0);
+  GFX_CHECK(streamer->resident_level(first) > 0);
+  GFX_CHECK(streamer->resident_level(first) <= TAIL_LEVEL);
+  GFX_CHECK(evicted_levels > 0);
+  GFX_CHECK(streamer->stats().resident_bytes <= limits.memory_budget);
+  GFX_CHECK(streamer->view(first) != VK_NULL_HANDLE);
+
+  // Requested again, it grows back once the other is not needed anymore.
+  stream(device, *streamer, [&] { streamer->request(first, 0); });
+  GFX_CHECK(streamer->resident_level(first) == 0);
+  GFX_CHECK(streamer->resident_level(second) > 0);
+}
+
+auto test_load_returns_errors(VulkanDevice& device, ThreadPool& thread_pool,
+                              const std::string& path,
+                              const std::string& invalid_path,
+                              const std::string& empty_level_path,
+                              const std::string& short_level_path) -> void
+{
+  TextureStreamingLimits limits;
+  limits.mip_tail_size = TAIL_SIZE;
+  std::unique_ptr<TextureStreamer> streamer;
+  GFX_CHECK(TextureStreamer::create(device, thread_pool, limits, streamer) ==
+            VK_SUCCESS);
+  if (streamer) {
+    TextureHandle texture = 0;
+    GFX_CHECK(streamer->load(invalid_path.c_str(), texture) ==
+              VK_ERROR_FORMAT_NOT_SUPPORTED);
+    // Levels smaller than their extent would be read past their end.
+    GFX_CHECK(streamer->load(empty_level_path.c_str(), texture) ==
+              VK_ERROR_FORMAT_NOT_SUPPORTED);
+    GFX_CHECK(streamer->load(short_level_path.c_str(), texture) ==
+              VK_ERROR_FORMAT_NOT_SUPPORTED);
+    GFX_CHECK(streamer->stats().textures == 0);
+  }
+
+  // A 256 texels row takes 1 KiB, more than a frame's 512 bytes.
+  limits.staging_size = 512 * limits.frames_in_flight;
+  streamer.reset();
+  GFX_CHECK(TextureStreamer::create(device, thread_pool, limits, streamer) ==
+            VK_SUCCESS);
+  if (streamer) {
+    TextureHandle texture = 0;
+    GFX_CHECK(streamer->load(path.c_str(), texture) ==
+              VK_ERROR_OUT_OF_DEVICE_MEMORY);
+    GFX_CHECK(streamer->stats().textures == 0);
+  }
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Texture streamer tests                                       //
+//                                                              //
+// Streams generated KTX2 textures on the null driver: checks   //
+// the mip tail loads first and every level follows one step at //
+// a time, that levels of textures no longer requested are      //
+// evicted past the memory budget, and that load() reports the  //
+// files it cannot stream.                                      //
+// Usage: vulkan-learning-texture-streamer-test                 //
+// ************************************************************ //
+auto main() -> int
+{
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "vulkan-learning-streamer-test";
+  std::filesystem::create_directories(directory);
+  std::string first_path = (directory / "first.ktx2").string();
+  std::string second_path = (directory / "second.ktx2").string();
+  std::string invalid_path = (directory / "invalid.ktx2").string();
+  std::string empty_level_path = (directory / "empty_level.ktx2").string();
+  std::string short_level_path = (directory / "short_level.ktx2").string();
+  write_ktx2(first_path, 1);
+  write_ktx2(second_path, 2);
+  write_ktx2(empty_level_path, 3, 0);
+  write_ktx2(short_level_path, 4, SIZE * RGBA8_BYTES);
+  std::ofstream(invalid_path) << "Not a KTX2 file.";
+
+  VulkanDevice device;
+  if (gfx::test::create_device(false, device) != VK_SUCCESS) {
+    return 1;
+  }
+  ThreadPool thread_pool(2);
+  test_levels_stream_in(device, thread_pool, first_path);
+  test_unrequested_levels_are_evicted(device, thread_pool, first_path,
+                                      second_path);
+  test_load_returns_errors(device, thread_pool, first_path, invalid_path,
+                           empty_level_path, short_level_path);
+  gfx::test::destroy_device(device);
+  std::filesystem::remove_all(directory);
+
+  return gfx::test::failures > 0 ? 1 : 0;
+}
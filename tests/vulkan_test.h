@@ -0,0 +1,92 @@
+#pragma once
+
+#include <iostream>
+#include "host_allocator.h"
+#include "vulkan_api.h"
+#include "vulkan_builders.h"
+#include "vulkan_null_driver.h"
+#include "vulkan_sync.h"
+
+namespace gfx::test {
+
+// Exit code ctest reports as skipped.
+constexpr int SKIPPED = 77;
+
+// Headless device on the null driver, or on a real device with gpu. The
+// instance is initialized along, destroy_device() releases both.
+inline auto create_device(bool gpu, vk_api::VulkanDevice& device) -> VkResult
+{
+  if (!gpu) {
+    vk_api::enable_null_driver();
+  }
+  VkResult result = vk_api::initialize(true);
+  if (result == VK_SUCCESS) {
+    result = vk_api::create_headless_device(device);
+  }
+  if (result != VK_SUCCESS) {
+    std::cerr << "Could not create the device: "
+              << vk_api::result_name(result) << "." << std::endl;
+  }
+  return result;
+}
+
+inline auto destroy_device(vk_api::VulkanDevice& device) -> void
+{
+  gfx::destroy_device(device);
+  vk_api::destroy();
+}
+
+// Records a one time command buffer of the graphics queue with
+// record(command_buffer), submits it and waits until the queue is idle.
+template <typename Record>
+auto submit_and_wait(vk_api::VulkanDevice& device, Record record) -> VkResult
+{
+  using vk_api::build;
+  VkCommandPoolCreateInfo pool_create_info =
+      build<VkCommandPoolCreateInfo>().set(
+          &VkCommandPoolCreateInfo::queueFamilyIndex, device.graphics_family);
+  VkCommandPool pool;
+  VkResult result = device.vkCreateCommandPool(
+      device.logical_device, &pool_create_info,
+      vk_api::allocation_callbacks(), &pool);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  VkCommandBufferAllocateInfo allocate_info =
+      build<VkCommandBufferAllocateInfo>()
+          .set(&VkCommandBufferAllocateInfo::commandPool, pool)
+          .set(&VkCommandBufferAllocateInfo::level,
+               VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+          .set(&VkCommandBufferAllocateInfo::commandBufferCount, 1);
+  VkCommandBuffer command_buffer;
+  result = device.vkAllocateCommandBuffers(device.logical_device,
+                                           &allocate_info, &command_buffer);
+  VkCommandBufferBeginInfo begin_info = build<VkCommandBufferBeginInfo>().set(
+      &VkCommandBufferBeginInfo::flags,
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  if (result == VK_SUCCESS) {
+    result = device.vkBeginCommandBuffer(command_buffer, &begin_info);
+  }
+  if (result == VK_SUCCESS) {
+    record(command_buffer);
+    result = device.vkEndCommandBuffer(command_buffer);
+  }
+  VkSubmitInfo submit_info =
+      build<VkSubmitInfo>()
+          .set(&VkSubmitInfo::commandBufferCount, 1)
+          .set(&VkSubmitInfo::pCommandBuffers, &command_buffer);
+  if (result == VK_SUCCESS) {
+    result = device.graphics_timeline->with_queue([&](VkQueue queue) {
+      VkResult submit_result =
+          device.vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+      return submit_result == VK_SUCCESS ? device.vkQueueWaitIdle(queue)
+                                         : submit_result;
+    });
+  }
+  device.vkDestroyCommandPool(device.logical_device, pool,
+                              vk_api::allocation_callbacks());
+  return result;
+}
+
+}  // namespace gfx::test
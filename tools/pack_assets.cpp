@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "asset_archive.h"
+
+#if defined(GFX_HAS_LZ4)
+#include <lz4.h>
+#endif
+#if defined(GFX_HAS_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(GFX_HAS_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace {
+
+// Payloads that do not shrink by at least a sixteenth are stored as is,
+// which keeps them readable in place.
+constexpr uint64_t MIN_SAVING_DIVISOR = 16;
+
+struct Codec {
+  const char* name;
+  gfx::ArchiveCompression compression;
+};
+
+constexpr Codec CODECS[] = {{"none", gfx::ArchiveCompression::none},
+                            {"lz4", gfx::ArchiveCompression::lz4},
+                            {"zstd", gfx::ArchiveCompression::zstd},
+                            {"zlib", gfx::ArchiveCompression::zlib}};
+
+// Appends the compressed chunk to out, or the chunk itself if it does not
+// shrink. Returns the stored size.
+auto compress_chunk(gfx::ArchiveCompression compression, const char* source,
+                    size_t size, std::vector<char>& out) -> uint32_t
+{
+  size_t start = out.size();
+  size_t written = 0;
+  switch (compression) {
+#if defined(GFX_HAS_LZ4)
+    case gfx::ArchiveCompression::lz4: {
+      out.resize(start + LZ4_compressBound(static_cast<int>(size)));
+      written = static_cast<size_t>(std::max(
+          LZ4_compress_default(source, out.data() + start,
+                               static_cast<int>(size),
+                               static_cast<int>(out.size() - start)),
+          0));
+      break;
+    }
+#endif
+#if defined(GFX_HAS_ZSTD)
+    case gfx::ArchiveCompression::zstd: {
+      out.resize(start + ZSTD_compressBound(size));
+      written = ZSTD_compress(out.data() + start, out.size() - start, source,
+                              size, 12);
+      if (ZSTD_isError(written)) {
+        written = 0;
+      }
+      break;
+    }
+#endif
+#if defined(GFX_HAS_ZLIB)
+    case gfx::ArchiveCompression::zlib: {
+      uLongf bound = compressBound(static_cast<uLong>(size));
+      out.resize(start + bound);
+      if (compress2(reinterpret_cast<Bytef*>(out.data() + start), &bound,
+                    reinterpret_cast<const Bytef*>(source),
+                    static_cast<uLong>(size), Z_BEST_COMPRESSION) == Z_OK) {
+        written = bound;
+      }
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+  // Equal sizes mean a raw chunk to the reader.
+  if (written == 0 || written >= size) {
+    out.resize(start);
+    out.insert(out.end(), source, source + size);
+    return static_cast<uint32_t>(size);
+  }
+  out.resize(start + written);
+  return static_cast<uint32_t>(written);
+}
+
+// Chunk sizes, then the chunks, as AssetArchive::read() expects them.
+auto compress(gfx::ArchiveCompression compression,
+              const std::vector<char>& data) -> std::vector<char>
+{
+  size_t chunk_count =
+      (data.size() + gfx::ARCHIVE_CHUNK_SIZE - 1) / gfx::ARCHIVE_CHUNK_SIZE;
+  std::vector<char> out(chunk_count * sizeof(uint32_t));
+  for (size_t i = 0; i < chunk_count; ++i) {
+    size_t offset = i * gfx::ARCHIVE_CHUNK_SIZE;
+    size_t size = std::min<size_t>(gfx::ARCHIVE_CHUNK_SIZE,
+                                   data.size() - offset);
+    uint32_t stored =
+        compress_chunk(compression, data.data() + offset, size, out);
+    memcpy(out.data() + i * sizeof(uint32_t), &stored, sizeof(stored));
+  }
+  return out;
+}
+
+auto align(uint64_t offset) -> uint64_t
+{
+  return (offset + gfx::ARCHIVE_ALIGNMENT - 1) / gfx::ARCHIVE_ALIGNMENT *
+         gfx::ARCHIVE_ALIGNMENT;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Asset packer                                                 //
+//                                                              //
+// Packs every file under a directory in one archive, keyed by  //
+// the hash of its path relative to the directory. Payloads are //
+// written one at a time, so the assets never all sit in        //
+// memory, then the sorted entries go in front of them.         //
+// Usage: vulkan-learning-pack [none|lz4|zstd|zlib] directory   //
+//        archive                                               //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  gfx::ArchiveCompression compression = gfx::ArchiveCompression::none;
+  int first_path = 1;
+  if (argc == 4) {
+    const Codec* codec = std::find_if(
+        std::begin(CODECS), std::end(CODECS),
+        [&](const Codec& c) { return strcmp(c.name, argv[1]) == 0; });
+    if (codec == std::end(CODECS)) {
+      std::cerr << "Unknown compression " << argv[1] << "." << std::endl;
+      return 1;
+    }
+    if (!gfx::AssetArchive::supports(codec->compression)) {
+      std::cerr << "This build has no " << codec->name << " support."
+                << std::endl;
+      return 1;
+    }
+    compression = codec->compression;
+    first_path = 2;
+  }
+  else if (argc != 3) {
+    std::cerr << "Usage: vulkan-learning-pack [none|lz4|zstd|zlib] "
+                 "directory archive"
+              << std::endl;
+    return 1;
+  }
+  std::filesystem::path root = argv[first_path];
+  std::string archive_path = argv[first_path + 1];
+
+  std::vector<std::filesystem::path> paths;
+  std::error_code error;
+  for (const auto& item :
+       std::filesystem::recursive_directory_iterator(root, error)) {
+    if (item.is_regular_file()) {
+      paths.push_back(item.path());
+    }
+  }
+  if (error) {
+    std::cerr << "Could not list " << root << ": " << error.message()
+              << std::endl;
+    return 1;
+  }
+
+  std::string temporary_path = archive_path + ".tmp";
+  std::ofstream archive(temporary_path, std::ios::binary | std::ios::trunc);
+  if (!archive) {
+    std::cerr << "Could not create " << temporary_path << "." << std::endl;
+    return 1;
+  }
+  std::vector<gfx::ArchiveEntry> entries;
+  std::vector<std::string> names;
+  uint64_t offset = align(sizeof(gfx::ArchiveHeader) +
+                          paths.size() * sizeof(gfx::ArchiveEntry));
+  uint64_t input_bytes = 0;
+  uint32_t compressed_count = 0;
+  for (const std::filesystem::path& path : paths) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      std::cerr << "Could not read " << path << "." << std::endl;
+      return 1;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+
+    gfx::ArchiveEntry entry = {};
+    names.push_back(path.lexically_relative(root).generic_string());
+    entry.hash = gfx::hash_asset_path(names.back());
+    entry.offset = offset;
+    entry.uncompressed_size = data.size();
+    std::vector<char> stored;
+    if (compression != gfx::ArchiveCompression::none) {
+      stored = compress(compression, data);
+    }
+    if (!stored.empty() &&
+        stored.size() <= data.size() - data.size() / MIN_SAVING_DIVISOR) {
+      entry.compression = compression;
+      ++compressed_count;
+    }
+    else {
+      stored = std::move(data);
+    }
+    entry.size = stored.size();
+    entries.push_back(entry);
+
+    archive.seekp(static_cast<std::streamoff>(offset));
+    archive.write(stored.data(), static_cast<std::streamsize>(stored.size()));
+    offset = align(offset + stored.size());
+    input_bytes += entry.uncompressed_size;
+  }
+
+  // Collisions would make one of the assets unreachable.
+  std::vector<size_t> order(entries.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return entries[a].hash < entries[b].hash;
+  });
+  std::vector<gfx::ArchiveEntry> sorted;
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (i > 0 && entries[order[i]].hash == entries[order[i - 1]].hash) {
+      std::cerr << names[order[i]] << " and " << names[order[i - 1]]
+                << " have the same hash, rename one of them." << std::endl;
+      archive.close();
+      std::filesystem::remove(temporary_path);
+      return 1;
+    }
+    sorted.push_back(entries[order[i]]);
+  }
+
+  gfx::ArchiveHeader header = {gfx::ARCHIVE_MAGIC,
+                               gfx::ARCHIVE_VERSION,
+                               static_cast<uint32_t>(sorted.size()),
+                               gfx::ARCHIVE_ALIGNMENT,
+                               gfx::ARCHIVE_CHUNK_SIZE,
+                               0};
+  archive.seekp(0);
+  archive.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  archive.write(reinterpret_cast<const char*>(sorted.data()),
+                static_cast<std::streamsize>(sorted.size() *
+                                             sizeof(gfx::ArchiveEntry)));
+  archive.close();
+  if (!archive) {
+    std::cerr << "Could not write " << temporary_path << "." << std::endl;
+    std::filesystem::remove(temporary_path);
+    return 1;
+  }
+  // Readers never see a partial archive.
+  std::filesystem::rename(temporary_path, archive_path, error);
+  if (error) {
+    std::cerr << "Could not replace " << archive_path << ": "
+              << error.message() << std::endl;
+    return 1;
+  }
+
+  std::cout << "Packed " << sorted.size() << " files, " << compressed_count
+            << " compressed, " << input_bytes << " bytes into "
+            << std::filesystem::file_size(archive_path) << "." << std::endl;
+  return 0;
+}
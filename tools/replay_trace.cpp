@@ -0,0 +1,1457 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "host_allocator.h"
+#include "log.h"
+#include "mapped_file.h"
+#include "vulkan_api.h"
+#include "vulkan_builders.h"
+#include "vulkan_null_driver.h"
+#include "vulkan_startup.h"
+#include "vulkan_trace.h"
+
+namespace {
+
+using namespace gfx::vk_api;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  const char* trace_path = nullptr;
+  const char* device_name = nullptr;
+  // The first loop warms up and is not measured when there are others.
+  int loops = 10;
+  bool null_driver = false;
+};
+
+struct ReplayObject {
+  VkObjectType type;
+  uint64_t handle;
+  // Pool of descriptor sets and command buffers.
+  uint32_t parent;
+  // Memory of swap chain images, and of resources whose captured binding
+  // does not fit the memory of this device.
+  VkDeviceMemory owned_memory;
+  // Memory objects.
+  VkDeviceSize size;
+  uint32_t memory_type;
+  std::byte* mapped;
+  VkDeviceSize mapped_size;
+  // Semaphores.
+  bool timeline;
+  bool signaled;
+  // State at the end of the setup, restored between loops.
+  bool from_setup;
+  uint64_t setup_value;
+  bool setup_signaled;
+};
+
+struct Blob {
+  const std::byte* data;
+  uint32_t size;
+};
+
+auto elapsed_ms(Clock::time_point start) -> double
+{
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+  return elapsed.count();
+}
+
+// Nearest rank on sorted samples.
+auto percentile(const std::vector<double>& sorted, double fraction) -> double
+{
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  auto rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+// Records creating an object, whose id comes first in the payload.
+auto creates_object(TraceOp op) -> bool
+{
+  switch (op) {
+    case TraceOp::allocate_memory:
+    case TraceOp::create_buffer:
+    case TraceOp::create_image:
+    case TraceOp::create_swapchain_image:
+    case TraceOp::create_image_view:
+    case TraceOp::create_sampler:
+    case TraceOp::create_shader_module:
+    case TraceOp::create_descriptor_set_layout:
+    case TraceOp::create_pipeline_layout:
+    case TraceOp::create_compute_pipeline:
+    case TraceOp::create_descriptor_pool:
+    case TraceOp::allocate_descriptor_set:
+    case TraceOp::create_command_pool:
+    case TraceOp::allocate_command_buffer:
+    case TraceOp::create_semaphore:
+    case TraceOp::create_fence:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// ************************************************************ //
+// Replayer                                                     //
+//                                                              //
+// Re-issues the records of a trace on a device. Ids index the  //
+// objects created for them, queue families and memory types    //
+// are mapped to the closest ones of the device. Timeline       //
+// values are shifted every loop so they keep increasing, and   //
+// the synchronization objects get back their setup state.      //
+// ************************************************************ //
+class Replayer {
+ public:
+  Replayer(VulkanDevice& device, const TraceHeader& header)
+      : device_(device),
+        header_(header),
+        objects_(header.id_count),
+        blobs_(header.blob_count),
+        value_offset_(0),
+        highest_value_(0),
+        in_setup_(true),
+        fallback_allocations_(0),
+        skipped_writes_(0)
+  {
+  }
+
+  Replayer(const Replayer&) = delete;
+  Replayer& operator=(const Replayer&) = delete;
+
+  // Returns false on records this device cannot replay.
+  auto replay(TraceOp op, TraceReader& payload) -> bool;
+  auto end_setup() -> void;
+  // Waits for the loop's work and restores the setup state.
+  auto end_loop() -> void;
+  auto destroy_all() -> void;
+
+  auto fallback_allocations() const -> uint32_t
+  {
+    return fallback_allocations_;
+  }
+  auto skipped_writes() const -> uint32_t { return skipped_writes_; }
+
+ private:
+  template <typename T>
+  auto get_(uint32_t id) const -> T
+  {
+    if (id == 0 || id >= objects_.size()) {
+      return VK_NULL_HANDLE;
+    }
+    return reinterpret_cast<T>(objects_[id].handle);
+  }
+
+  auto live_(uint32_t id) const -> bool
+  {
+    return id < objects_.size() && objects_[id].handle != 0;
+  }
+
+  template <typename T>
+  auto set_(uint32_t id, VkObjectType type, T handle, uint32_t parent = 0)
+      -> ReplayObject&
+  {
+    // Objects the frames create again on every loop.
+    destroy_(id);
+    objects_[id] = {};
+    objects_[id].type = type;
+    objects_[id].handle = reinterpret_cast<uint64_t>(handle);
+    objects_[id].parent = parent;
+    objects_[id].from_setup = in_setup_;
+    return objects_[id];
+  }
+
+  template <typename T>
+  auto handles_(const uint32_t* ids, uint32_t count) const -> std::vector<T>
+  {
+    std::vector<T> handles(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      handles[i] = get_<T>(ids[i]);
+    }
+    return handles;
+  }
+
+  auto value_(uint64_t value) -> uint64_t
+  {
+    highest_value_ = std::max(highest_value_, value + value_offset_);
+    return value + value_offset_;
+  }
+
+  auto queue_(uint32_t family) const -> VkQueue
+  {
+    return family == header_.compute_family &&
+                   family != header_.graphics_family
+               ? device_.compute_queue
+               : device_.graphics_queue;
+  }
+
+  auto family_(uint32_t family) const -> uint32_t
+  {
+    return family == header_.compute_family &&
+                   family != header_.graphics_family
+               ? device_.compute_family
+               : device_.graphics_family;
+  }
+
+  auto fail_(const char* what) const -> bool
+  {
+    std::cerr << "Replay failed: " << what << "." << std::endl;
+    return false;
+  }
+
+  auto destroy_(uint32_t id) -> void;
+  auto bind_memory_(uint32_t id, uint32_t memory, VkDeviceSize offset,
+                    const VkMemoryRequirements& requirements,
+                    VkDeviceMemory& bound, VkDeviceSize& bound_offset)
+      -> bool;
+  auto empty_submit_(VkSemaphore wait, VkSemaphore signal, VkFence fence)
+      -> void;
+  auto update_descriptor_sets_(TraceReader& payload) -> bool;
+  auto record_commands_(TraceReader& payload) -> bool;
+  auto replay_command_(VkCommandBuffer command_buffer, TraceOp op,
+                       TraceReader& payload) -> bool;
+  auto queue_submit_(TraceReader& payload) -> bool;
+
+  VulkanDevice& device_;
+  TraceHeader header_;
+  std::vector<ReplayObject> objects_;
+  std::vector<Blob> blobs_;
+  uint64_t value_offset_;
+  uint64_t highest_value_;
+  bool in_setup_;
+  uint32_t fallback_allocations_;
+  uint32_t skipped_writes_;
+};
+
+auto Replayer::destroy_(uint32_t id) -> void
+{
+  if (!live_(id)) {
+    return;
+  }
+  ReplayObject& object = objects_[id];
+  VkDevice device = device_.logical_device;
+  const VkAllocationCallbacks* allocator = allocation_callbacks();
+  switch (object.type) {
+    case VK_OBJECT_TYPE_DEVICE_MEMORY:
+      device_.vkFreeMemory(device, get_<VkDeviceMemory>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_BUFFER:
+      device_.vkDestroyBuffer(device, get_<VkBuffer>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_IMAGE:
+      device_.vkDestroyImage(device, get_<VkImage>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_IMAGE_VIEW:
+      device_.vkDestroyImageView(device, get_<VkImageView>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_SAMPLER:
+      device_.vkDestroySampler(device, get_<VkSampler>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_SHADER_MODULE:
+      device_.vkDestroyShaderModule(device, get_<VkShaderModule>(id),
+                                    allocator);
+      break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+      device_.vkDestroyDescriptorSetLayout(
+          device, get_<VkDescriptorSetLayout>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+      device_.vkDestroyPipelineLayout(device, get_<VkPipelineLayout>(id),
+                                      allocator);
+      break;
+    case VK_OBJECT_TYPE_PIPELINE:
+      device_.vkDestroyPipeline(device, get_<VkPipeline>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+    case VK_OBJECT_TYPE_COMMAND_POOL:
+      // Their sets and command buffers go along.
+      for (ReplayObject& child : objects_) {
+        if (child.parent == id) {
+          child.handle = 0;
+        }
+      }
+      if (object.type == VK_OBJECT_TYPE_DESCRIPTOR_POOL) {
+        device_.vkDestroyDescriptorPool(
+            device, get_<VkDescriptorPool>(id), allocator);
+      }
+      else {
+        device_.vkDestroyCommandPool(device, get_<VkCommandPool>(id),
+                                     allocator);
+      }
+      break;
+    case VK_OBJECT_TYPE_COMMAND_BUFFER: {
+      auto command_buffer = get_<VkCommandBuffer>(id);
+      device_.vkFreeCommandBuffers(device,
+                                   get_<VkCommandPool>(object.parent), 1,
+                                   &command_buffer);
+      break;
+    }
+    case VK_OBJECT_TYPE_SEMAPHORE:
+      device_.vkDestroySemaphore(device, get_<VkSemaphore>(id), allocator);
+      break;
+    case VK_OBJECT_TYPE_FENCE:
+      device_.vkDestroyFence(device, get_<VkFence>(id), allocator);
+      break;
+    default:
+      // Descriptor sets are never freed on their own.
+      break;
+  }
+  if (object.owned_memory != VK_NULL_HANDLE) {
+    device_.vkFreeMemory(device, object.owned_memory, allocator);
+  }
+  object.handle = 0;
+  object.owned_memory = VK_NULL_HANDLE;
+}
+
+// Binds at the captured offset when it fits the allocation and its type,
+// otherwise to memory of its own. Host writes to the captured memory do not
+// reach it then.
+auto Replayer::bind_memory_(uint32_t id, uint32_t memory, VkDeviceSize offset,
+                            const VkMemoryRequirements& requirements,
+                            VkDeviceMemory& bound, VkDeviceSize& bound_offset)
+    -> bool
+{
+  if (!live_(memory)) {
+    return fail_("binding to freed memory");
+  }
+  const ReplayObject& allocation = objects_[memory];
+  if ((requirements.memoryTypeBits & (1u << allocation.memory_type)) != 0 &&
+      offset % requirements.alignment == 0 &&
+      offset + requirements.size <= allocation.size) {
+    bound = get_<VkDeviceMemory>(memory);
+    bound_offset = offset;
+    return true;
+  }
+  VkMemoryPropertyFlags flags =
+      device_.memory_properties.memoryTypes[allocation.memory_type]
+          .propertyFlags;
+  VkMemoryAllocateInfo allocate_info =
+      build<VkMemoryAllocateInfo>()
+          .set(&VkMemoryAllocateInfo::allocationSize, requirements.size)
+          .set(&VkMemoryAllocateInfo::memoryTypeIndex,
+               find_memory_type(device_, requirements.memoryTypeBits, 0,
+                                flags));
+  if (device_.vkAllocateMemory(device_.logical_device, &allocate_info,
+                               allocation_callbacks(),
+                               &objects_[id].owned_memory) != VK_SUCCESS) {
+    return fail_("no memory for a resource");
+  }
+  ++fallback_allocations_;
+  bound = objects_[id].owned_memory;
+  bound_offset = 0;
+  return true;
+}
+
+// Stands in for acquires and presents, which have no swap chain here.
+auto Replayer::empty_submit_(VkSemaphore wait, VkSemaphore signal,
+                             VkFence fence) -> void
+{
+  VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkSubmitInfo submit_info =
+      build<VkSubmitInfo>()
+          .set(&VkSubmitInfo::waitSemaphoreCount,
+               wait != VK_NULL_HANDLE ? 1 : 0)
+          .set(&VkSubmitInfo::pWaitSemaphores, &wait)
+          .set(&VkSubmitInfo::pWaitDstStageMask, &stage)
+          .set(&VkSubmitInfo::signalSemaphoreCount,
+               signal != VK_NULL_HANDLE ? 1 : 0)
+          .set(&VkSubmitInfo::pSignalSemaphores, &signal);
+  device_.vkQueueSubmit(device_.graphics_queue, 1, &submit_info, fence);
+}
+
+auto Replayer::update_descriptor_sets_(TraceReader& payload) -> bool
+{
+  uint32_t write_count = payload.get<uint32_t>();
+  for (uint32_t i = 0; i < write_count; ++i) {
+    auto write = payload.get<VkWriteDescriptorSet>();
+    uint32_t count = 0;
+    const auto* images = payload.get_array<VkDescriptorImageInfo>(count);
+    std::vector<VkDescriptorImageInfo> image_infos(images, images + count);
+    const auto* buffers = payload.get_array<VkDescriptorBufferInfo>(count);
+    std::vector<VkDescriptorBufferInfo> buffer_infos(buffers,
+                                                     buffers + count);
+    const auto* views = payload.get_array<uint32_t>(count);
+    std::vector<uint32_t> view_ids(views, views + count);
+
+    // Writes of objects destroyed since are dropped.
+    bool dead = !live_(handle_as_id(write.dstSet));
+    for (VkDescriptorImageInfo& info : image_infos) {
+      uint32_t sampler = handle_as_id(info.sampler);
+      uint32_t view = handle_as_id(info.imageView);
+      dead |= (sampler != 0 && !live_(sampler)) || (view != 0 && !live_(view));
+      info.sampler = get_<VkSampler>(sampler);
+      info.imageView = get_<VkImageView>(view);
+    }
+    for (VkDescriptorBufferInfo& info : buffer_infos) {
+      uint32_t buffer = handle_as_id(info.buffer);
+      dead |= buffer != 0 && !live_(buffer);
+      info.buffer = get_<VkBuffer>(buffer);
+    }
+    std::vector<VkBufferView> texel_views =
+        handles_<VkBufferView>(view_ids.data(), count);
+    if (dead || payload.failed()) {
+      ++skipped_writes_;
+      continue;
+    }
+    write.dstSet = get_<VkDescriptorSet>(handle_as_id(write.dstSet));
+    write.pImageInfo = image_infos.empty() ? nullptr : image_infos.data();
+    write.pBufferInfo = buffer_infos.empty() ? nullptr : buffer_infos.data();
+    write.pTexelBufferView =
+        texel_views.empty() ? nullptr : texel_views.data();
+    device_.vkUpdateDescriptorSets(device_.logical_device, 1, &write, 0,
+                                   nullptr);
+  }
+  uint32_t copy_count = 0;
+  const auto* copies = payload.get_array<VkCopyDescriptorSet>(copy_count);
+  for (uint32_t i = 0; i < copy_count; ++i) {
+    VkCopyDescriptorSet copy = copies[i];
+    uint32_t source = handle_as_id(copy.srcSet);
+    uint32_t destination = handle_as_id(copy.dstSet);
+    if (!live_(source) || !live_(destination)) {
+      ++skipped_writes_;
+      continue;
+    }
+    copy.srcSet = get_<VkDescriptorSet>(source);
+    copy.dstSet = get_<VkDescriptorSet>(destination);
+    device_.vkUpdateDescriptorSets(device_.logical_device, 0, nullptr, 1,
+                                   &copy);
+  }
+  return !payload.failed();
+}
+
+auto Replayer::record_commands_(TraceReader& payload) -> bool
+{
+  auto command_buffer =
+      get_<VkCommandBuffer>(payload.get<uint32_t>());
+  auto usage = payload.get<VkCommandBufferUsageFlags>();
+  if (command_buffer == VK_NULL_HANDLE) {
+    return fail_("recording a freed command buffer");
+  }
+  VkCommandBufferBeginInfo begin_info = build<VkCommandBufferBeginInfo>().set(
+      &VkCommandBufferBeginInfo::flags, usage);
+  device_.vkBeginCommandBuffer(command_buffer, &begin_info);
+  TraceReader commands = payload.rest();
+  TraceOp op;
+  TraceReader command(nullptr, 0);
+  while (!commands.done()) {
+    if (!commands.next(op, command) ||
+        !replay_command_(command_buffer, op, command)) {
+      return fail_("bad command");
+    }
+  }
+  device_.vkEndCommandBuffer(command_buffer);
+  return true;
+}
+
+auto Replayer::replay_command_(VkCommandBuffer command_buffer, TraceOp op,
+                               TraceReader& payload) -> bool
+{
+  uint32_t count = 0;
+  switch (op) {
+    case TraceOp::cmd_pipeline_barrier: {
+      auto source_stages = payload.get<VkPipelineStageFlags>();
+      auto destination_stages = payload.get<VkPipelineStageFlags>();
+      auto dependencies = payload.get<VkDependencyFlags>();
+      const auto* memory = payload.get_array<VkMemoryBarrier>(count);
+      std::vector<VkMemoryBarrier> memory_barriers(memory, memory + count);
+      const auto* buffers = payload.get_array<VkBufferMemoryBarrier>(count);
+      std::vector<VkBufferMemoryBarrier> buffer_barriers(buffers,
+                                                         buffers + count);
+      for (VkBufferMemoryBarrier& barrier : buffer_barriers) {
+        barrier.buffer = get_<VkBuffer>(handle_as_id(barrier.buffer));
+      }
+      const auto* images = payload.get_array<VkImageMemoryBarrier>(count);
+      std::vector<VkImageMemoryBarrier> image_barriers(images,
+                                                       images + count);
+      for (VkImageMemoryBarrier& barrier : image_barriers) {
+        barrier.image = get_<VkImage>(handle_as_id(barrier.image));
+      }
+      device_.vkCmdPipelineBarrier(
+          command_buffer, source_stages, destination_stages, dependencies,
+          static_cast<uint32_t>(memory_barriers.size()),
+          memory_barriers.data(),
+          static_cast<uint32_t>(buffer_barriers.size()),
+          buffer_barriers.data(),
+          static_cast<uint32_t>(image_barriers.size()),
+          image_barriers.data());
+      break;
+    }
+    case TraceOp::cmd_clear_color_image: {
+      auto image = get_<VkImage>(payload.get<uint32_t>());
+      auto layout = payload.get<VkImageLayout>();
+      auto color = payload.get<VkClearColorValue>();
+      const auto* ranges = payload.get_array<VkImageSubresourceRange>(count);
+      device_.vkCmdClearColorImage(command_buffer, image, layout, &color,
+                                   count, ranges);
+      break;
+    }
+    case TraceOp::cmd_bind_pipeline: {
+      auto bind_point = payload.get<VkPipelineBindPoint>();
+      auto pipeline = get_<VkPipeline>(payload.get<uint32_t>());
+      device_.vkCmdBindPipeline(command_buffer, bind_point, pipeline);
+      break;
+    }
+    case TraceOp::cmd_bind_descriptor_sets: {
+      auto bind_point = payload.get<VkPipelineBindPoint>();
+      auto layout = get_<VkPipelineLayout>(payload.get<uint32_t>());
+      auto first_set = payload.get<uint32_t>();
+      const auto* set_ids = payload.get_array<uint32_t>(count);
+      std::vector<VkDescriptorSet> sets =
+          handles_<VkDescriptorSet>(set_ids, count);
+      uint32_t offset_count = 0;
+      const auto* offsets = payload.get_array<uint32_t>(offset_count);
+      device_.vkCmdBindDescriptorSets(command_buffer, bind_point, layout,
+                                      first_set, count, sets.data(),
+                                      offset_count, offsets);
+      break;
+    }
+    case TraceOp::cmd_push_constants: {
+      auto layout = get_<VkPipelineLayout>(payload.get<uint32_t>());
+      auto stages = payload.get<VkShaderStageFlags>();
+      auto offset = payload.get<uint32_t>();
+      const auto* values = payload.get_array<std::byte>(count);
+      device_.vkCmdPushConstants(command_buffer, layout, stages, offset,
+                                 count, values);
+      break;
+    }
+    case TraceOp::cmd_dispatch: {
+      auto x = payload.get<uint32_t>();
+      auto y = payload.get<uint32_t>();
+      auto z = payload.get<uint32_t>();
+      device_.vkCmdDispatch(command_buffer, x, y, z);
+      break;
+    }
+    case TraceOp::cmd_copy_buffer: {
+      auto source = get_<VkBuffer>(payload.get<uint32_t>());
+      auto destination = get_<VkBuffer>(payload.get<uint32_t>());
+      const auto* regions = payload.get_array<VkBufferCopy>(count);
+      device_.vkCmdCopyBuffer(command_buffer, source, destination, count,
+                              regions);
+      break;
+    }
+    case TraceOp::cmd_copy_buffer_to_image: {
+      auto source = get_<VkBuffer>(payload.get<uint32_t>());
+      auto destination = get_<VkImage>(payload.get<uint32_t>());
+      auto layout = payload.get<VkImageLayout>();
+      const auto* regions = payload.get_array<VkBufferImageCopy>(count);
+      device_.vkCmdCopyBufferToImage(command_buffer, source, destination,
+                                     layout, count, regions);
+      break;
+    }
+    case TraceOp::cmd_copy_image: {
+      auto source = get_<VkImage>(payload.get<uint32_t>());
+      auto source_layout = payload.get<VkImageLayout>();
+      auto destination = get_<VkImage>(payload.get<uint32_t>());
+      auto destination_layout = payload.get<VkImageLayout>();
+      const auto* regions = payload.get_array<VkImageCopy>(count);
+      device_.vkCmdCopyImage(command_buffer, source, source_layout,
+                             destination, destination_layout, count,
+                             regions);
+      break;
+    }
+    case TraceOp::cmd_blit_image: {
+      auto source = get_<VkImage>(payload.get<uint32_t>());
+      auto source_layout = payload.get<VkImageLayout>();
+      auto destination = get_<VkImage>(payload.get<uint32_t>());
+      auto destination_layout = payload.get<VkImageLayout>();
+      auto filter = payload.get<VkFilter>();
+      const auto* regions = payload.get_array<VkImageBlit>(count);
+      device_.vkCmdBlitImage(command_buffer, source, source_layout,
+                             destination, destination_layout, count, regions,
+                             filter);
+      break;
+    }
+    case TraceOp::cmd_bind_vertex_buffers: {
+      auto first_binding = payload.get<uint32_t>();
+      const auto* buffer_ids = payload.get_array<uint32_t>(count);
+      std::vector<VkBuffer> buffers = handles_<VkBuffer>(buffer_ids, count);
+      const auto* offsets = payload.get_array<VkDeviceSize>(count);
+      device_.vkCmdBindVertexBuffers(command_buffer, first_binding, count,
+                                     buffers.data(), offsets);
+      break;
+    }
+    case TraceOp::cmd_bind_index_buffer: {
+      auto buffer = get_<VkBuffer>(payload.get<uint32_t>());
+      auto index_type = payload.get<VkIndexType>();
+      auto offset = payload.get<VkDeviceSize>();
+      device_.vkCmdBindIndexBuffer(command_buffer, buffer, offset,
+                                   index_type);
+      break;
+    }
+    case TraceOp::cmd_draw_indexed: {
+      auto index_count = payload.get<uint32_t>();
+      auto instance_count = payload.get<uint32_t>();
+      auto first_index = payload.get<uint32_t>();
+      auto vertex_offset = payload.get<int32_t>();
+      auto first_instance = payload.get<uint32_t>();
+      device_.vkCmdDrawIndexed(command_buffer, index_count, instance_count,
+                               first_index, vertex_offset, first_instance);
+      break;
+    }
+    case TraceOp::cmd_draw_indexed_indirect: {
+      auto buffer = get_<VkBuffer>(payload.get<uint32_t>());
+      auto draw_count = payload.get<uint32_t>();
+      auto offset = payload.get<VkDeviceSize>();
+      auto stride = payload.get<uint32_t>();
+      device_.vkCmdDrawIndexedIndirect(command_buffer, buffer, offset,
+                                       draw_count, stride);
+      break;
+    }
+    case TraceOp::cmd_draw_indexed_indirect_count: {
+      if (device_.vkCmdDrawIndexedIndirectCountKHR == nullptr) {
+        return fail_("the device has no draw indirect count");
+      }
+      auto buffer = get_<VkBuffer>(payload.get<uint32_t>());
+      auto count_buffer = get_<VkBuffer>(payload.get<uint32_t>());
+      auto offset = payload.get<VkDeviceSize>();
+      auto count_offset = payload.get<VkDeviceSize>();
+      auto max_draw_count = payload.get<uint32_t>();
+      auto stride = payload.get<uint32_t>();
+      device_.vkCmdDrawIndexedIndirectCountKHR(command_buffer, buffer, offset,
+                                               count_buffer, count_offset,
+                                               max_draw_count, stride);
+      break;
+    }
+    default:
+      return false;
+  }
+  return !payload.failed();
+}
+
+auto Replayer::queue_submit_(TraceReader& payload) -> bool
+{
+  VkQueue queue = queue_(payload.get<uint32_t>());
+  auto fence = get_<VkFence>(payload.get<uint32_t>());
+  auto batch_count = payload.get<uint32_t>();
+
+  struct Batch {
+    std::vector<VkSemaphore> waits;
+    std::vector<VkPipelineStageFlags> stages;
+    std::vector<uint64_t> wait_values;
+    std::vector<VkCommandBuffer> command_buffers;
+    std::vector<VkSemaphore> signals;
+    std::vector<uint64_t> signal_values;
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info;
+  };
+  std::vector<Batch> batches(batch_count);
+  std::vector<VkSubmitInfo> submits(batch_count);
+  for (uint32_t i = 0; i < batch_count; ++i) {
+    Batch& batch = batches[i];
+    uint32_t count = 0;
+    const auto* wait_ids = payload.get_array<uint32_t>(count);
+    batch.waits = handles_<VkSemaphore>(wait_ids, count);
+    const auto* stages = payload.get_array<VkPipelineStageFlags>(count);
+    batch.stages.assign(stages, stages + count);
+    const auto* wait_values = payload.get_array<uint64_t>(count);
+    batch.wait_values.assign(wait_values, wait_values + count);
+    for (size_t j = 0; j < batch.waits.size(); ++j) {
+      ReplayObject& semaphore = objects_[wait_ids[j]];
+      if (semaphore.timeline) {
+        batch.wait_values[j] = value_(batch.wait_values[j]);
+      }
+      semaphore.signaled = false;
+    }
+    const auto* command_buffer_ids = payload.get_array<uint32_t>(count);
+    batch.command_buffers =
+        handles_<VkCommandBuffer>(command_buffer_ids, count);
+    const auto* signal_ids = payload.get_array<uint32_t>(count);
+    batch.signals = handles_<VkSemaphore>(signal_ids, count);
+    const auto* signal_values = payload.get_array<uint64_t>(count);
+    batch.signal_values.assign(signal_values, signal_values + count);
+    for (size_t j = 0; j < batch.signals.size(); ++j) {
+      ReplayObject& semaphore = objects_[signal_ids[j]];
+      if (semaphore.timeline) {
+        batch.signal_values[j] = value_(batch.signal_values[j]);
+      }
+      semaphore.signaled = true;
+    }
+    if (payload.failed()) {
+      return fail_("truncated submission");
+    }
+
+    batch.timeline_info =
+        build<VkTimelineSemaphoreSubmitInfoKHR>()
+            .set(&VkTimelineSemaphoreSubmitInfoKHR::waitSemaphoreValueCount,
+                 batch.wait_values.size())
+            .set(&VkTimelineSemaphoreSubmitInfoKHR::pWaitSemaphoreValues,
+                 batch.wait_values.data())
+            .set(&VkTimelineSemaphoreSubmitInfoKHR::signalSemaphoreValueCount,
+                 batch.signal_values.size())
+            .set(&VkTimelineSemaphoreSubmitInfoKHR::pSignalSemaphoreValues,
+                 batch.signal_values.data())
+            .get();
+    auto submit_info =
+        build<VkSubmitInfo>()
+            .set(&VkSubmitInfo::waitSemaphoreCount, batch.waits.size())
+            .set(&VkSubmitInfo::pWaitSemaphores, batch.waits.data())
+            .set(&VkSubmitInfo::pWaitDstStageMask, batch.stages.data())
+            .set(&VkSubmitInfo::commandBufferCount,
+                 batch.command_buffers.size())
+            .set(&VkSubmitInfo::pCommandBuffers,
+                 batch.command_buffers.data())
+            .set(&VkSubmitInfo::signalSemaphoreCount, batch.signals.size())
+            .set(&VkSubmitInfo::pSignalSemaphores, batch.signals.data());
+    if (device_.timeline_semaphore_supported) {
+      submit_info.next(batch.timeline_info);
+    }
+    submits[i] = submit_info.get();
+  }
+  if (device_.vkQueueSubmit(queue, batch_count, submits.data(), fence) !=
+      VK_SUCCESS) {
+    return fail_("queue submission");
+  }
+  return true;
+}
+
+auto Replayer::replay(TraceOp op, TraceReader& payload) -> bool
+{
+  // Ids index the objects, sized by the header.
+  if (creates_object(op)) {
+    TraceReader id_reader = payload;
+    auto id = id_reader.get<uint32_t>();
+    if (id == 0 || id >= objects_.size()) {
+      return fail_("object id beyond the trace's count");
+    }
+  }
+
+  VkDevice device = device_.logical_device;
+  const VkAllocationCallbacks* allocator = allocation_callbacks();
+  uint32_t count = 0;
+  switch (op) {
+    case TraceOp::blob: {
+      auto id = payload.get<uint32_t>();
+      const auto* data = payload.get_array<std::byte>(count);
+      if (id == 0 || id >= blobs_.size()) {
+        return fail_("blob id beyond the trace's count");
+      }
+      blobs_[id] = {data, count};
+      break;
+    }
+    case TraceOp::memory_write: {
+      auto id = payload.get<uint32_t>();
+      auto offset = payload.get<VkDeviceSize>();
+      auto blob = payload.get<uint32_t>();
+      if (!live_(id) || objects_[id].mapped == nullptr ||
+          blob >= blobs_.size()) {
+        return fail_("write to unmapped memory");
+      }
+      const ReplayObject& memory = objects_[id];
+      VkDeviceSize size = std::min<VkDeviceSize>(
+          blobs_[blob].size,
+          memory.mapped_size - std::min(offset, memory.mapped_size));
+      memcpy(memory.mapped + offset, blobs_[blob].data,
+             static_cast<size_t>(size));
+      break;
+    }
+    case TraceOp::allocate_memory: {
+      auto id = payload.get<uint32_t>();
+      auto size = payload.get<VkDeviceSize>();
+      auto flags = payload.get<VkMemoryPropertyFlags>();
+      // Host access is required, the rest only preferred.
+      uint32_t memory_type = find_memory_type(
+          device_, UINT32_MAX,
+          flags & (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+          flags);
+      if (memory_type == UINT32_MAX) {
+        return fail_("no memory type with host access");
+      }
+      VkMemoryAllocateInfo allocate_info =
+          build<VkMemoryAllocateInfo>()
+              .set(&VkMemoryAllocateInfo::allocationSize, size)
+              .set(&VkMemoryAllocateInfo::memoryTypeIndex, memory_type);
+      VkDeviceMemory memory;
+      if (device_.vkAllocateMemory(device, &allocate_info, allocator,
+                                   &memory) != VK_SUCCESS) {
+        return fail_("memory allocation");
+      }
+      ReplayObject& object = set_(id, VK_OBJECT_TYPE_DEVICE_MEMORY, memory);
+      object.size = size;
+      object.memory_type = memory_type;
+      break;
+    }
+    case TraceOp::map_memory: {
+      auto id = payload.get<uint32_t>();
+      auto offset = payload.get<VkDeviceSize>();
+      auto size = payload.get<VkDeviceSize>();
+      if (!live_(id) || offset + size > objects_[id].size) {
+        return fail_("mapping past the allocation");
+      }
+      void* data = nullptr;
+      if (device_.vkMapMemory(device, get_<VkDeviceMemory>(id), offset, size,
+                              0, &data) != VK_SUCCESS) {
+        return fail_("memory mapping");
+      }
+      objects_[id].mapped = static_cast<std::byte*>(data);
+      objects_[id].mapped_size = size;
+      break;
+    }
+    case TraceOp::create_buffer: {
+      auto id = payload.get<uint32_t>();
+      auto info = payload.get<VkBufferCreateInfo>();
+      const auto* families = payload.get_array<uint32_t>(count);
+      std::vector<uint32_t> mapped_families(count);
+      for (uint32_t i = 0; i < count; ++i) {
+        mapped_families[i] = family_(families[i]);
+      }
+      // Families the device merged into one are not shared anymore.
+      std::sort(mapped_families.begin(), mapped_families.end());
+      mapped_families.erase(
+          std::unique(mapped_families.begin(), mapped_families.end()),
+          mapped_families.end());
+      info.queueFamilyIndexCount =
+          static_cast<uint32_t>(mapped_families.size());
+      info.pQueueFamilyIndices = mapped_families.data();
+      if (info.queueFamilyIndexCount < 2) {
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      }
+      VkBuffer buffer;
+      if (device_.vkCreateBuffer(device, &info, allocator, &buffer) !=
+          VK_SUCCESS) {
+        return fail_("buffer creation");
+      }
+      set_(id, VK_OBJECT_TYPE_BUFFER, buffer);
+      break;
+    }
+    case TraceOp::bind_buffer_memory: {
+      auto id = payload.get<uint32_t>();
+      auto memory = payload.get<uint32_t>();
+      auto offset = payload.get<VkDeviceSize>();
+      auto buffer = get_<VkBuffer>(id);
+      VkMemoryRequirements requirements;
+      device_.vkGetBufferMemoryRequirements(device, buffer, &requirements);
+      VkDeviceMemory bound;
+      VkDeviceSize bound_offset;
+      if (!bind_memory_(id, memory, offset, requirements, bound,
+                        bound_offset)) {
+        return false;
+      }
+      device_.vkBindBufferMemory(device, buffer, bound, bound_offset);
+      break;
+    }
+    case TraceOp::create_image:
+    case TraceOp::create_swapchain_image: {
+      auto id = payload.get<uint32_t>();
+      auto info = payload.get<VkImageCreateInfo>();
+      std::vector<uint32_t> mapped_families;
+      if (op == TraceOp::create_image) {
+        const auto* families = payload.get_array<uint32_t>(count);
+        for (uint32_t i = 0; i < count; ++i) {
+          mapped_families.push_back(family_(families[i]));
+        }
+        std::sort(mapped_families.begin(), mapped_families.end());
+        mapped_families.erase(
+            std::unique(mapped_families.begin(), mapped_families.end()),
+            mapped_families.end());
+      }
+      info.queueFamilyIndexCount =
+          static_cast<uint32_t>(mapped_families.size());
+      info.pQueueFamilyIndices = mapped_families.data();
+      if (info.queueFamilyIndexCount < 2) {
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      }
+      VkImage image;
+      if (device_.vkCreateImage(device, &info, allocator, &image) !=
+          VK_SUCCESS) {
+        return fail_("image creation");
+      }
+      ReplayObject& object = set_(id, VK_OBJECT_TYPE_IMAGE, image);
+      if (op == TraceOp::create_image) {
+        break;
+      }
+      VkMemoryRequirements requirements;
+      device_.vkGetImageMemoryRequirements(device, image, &requirements);
+      VkMemoryAllocateInfo allocate_info =
+          build<VkMemoryAllocateInfo>()
+              .set(&VkMemoryAllocateInfo::allocationSize, requirements.size)
+              .set(&VkMemoryAllocateInfo::memoryTypeIndex,
+                   find_memory_type(device_, requirements.memoryTypeBits, 0,
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+      if (device_.vkAllocateMemory(device, &allocate_info, allocator,
+                                   &object.owned_memory) != VK_SUCCESS) {
+        return fail_("swap chain image allocation");
+      }
+      device_.vkBindImageMemory(device, image, object.owned_memory, 0);
+      break;
+    }
+    case TraceOp::bind_image_memory: {
+      auto id = payload.get<uint32_t>();
+      auto memory = payload.get<uint32_t>();
+      auto offset = payload.get<VkDeviceSize>();
+      auto image = get_<VkImage>(id);
+      VkMemoryRequirements requirements;
+      device_.vkGetImageMemoryRequirements(device, image, &requirements);
+      VkDeviceMemory bound;
+      VkDeviceSize bound_offset;
+      if (!bind_memory_(id, memory, offset, requirements, bound,
+                        bound_offset)) {
+        return false;
+      }
+      device_.vkBindImageMemory(device, image, bound, bound_offset);
+      break;
+    }
+    case TraceOp::create_image_view: {
+      auto id = payload.get<uint32_t>();
+      auto info = payload.get<VkImageViewCreateInfo>();
+      info.image = get_<VkImage>(handle_as_id(info.image));
+      VkImageView view;
+      if (device_.vkCreateImageView(device, &info, allocator, &view) !=
+          VK_SUCCESS) {
+        return fail_("image view creation");
+      }
+      set_(id, VK_OBJECT_TYPE_IMAGE_VIEW, view);
+      break;
+    }
+    case TraceOp::create_sampler: {
+      auto id = payload.get<uint32_t>();
+      auto info = payload.get<VkSamplerCreateInfo>();
+      VkSampler sampler;
+      if (device_.vkCreateSampler(device, &info, allocator, &sampler) !=
+          VK_SUCCESS) {
+        return fail_("sampler creation");
+      }
+      set_(id, VK_OBJECT_TYPE_SAMPLER, sampler);
+      break;
+    }
+    case TraceOp::create_shader_module: {
+      auto id = payload.get<uint32_t>();
+      const auto* code = payload.get_array<uint32_t>(count);
+      VkShaderModuleCreateInfo info =
+          build<VkShaderModuleCreateInfo>()
+              .set(&VkShaderModuleCreateInfo::codeSize,
+                   count * sizeof(uint32_t))
+              .set(&VkShaderModuleCreateInfo::pCode, code);
+      VkShaderModule module;
+      if (device_.vkCreateShaderModule(device, &info, allocator, &module) !=
+          VK_SUCCESS) {
+        return fail_("shader module creation");
+      }
+      set_(id, VK_OBJECT_TYPE_SHADER_MODULE, module);
+      break;
+    }
+    case TraceOp::create_descriptor_set_layout: {
+      auto id = payload.get<uint32_t>();
+      auto flags = payload.get<VkDescriptorSetLayoutCreateFlags>();
+      const auto* bindings =
+          payload.get_array<VkDescriptorSetLayoutBinding>(count);
+      std::vector<VkDescriptorSetLayoutBinding> layout_bindings(
+          bindings, bindings + count);
+      std::vector<std::vector<VkSampler>> samplers(count);
+      for (uint32_t i = 0; i < count; ++i) {
+        uint32_t sampler_count = 0;
+        const auto* sampler_ids = payload.get_array<uint32_t>(sampler_count);
+        samplers[i] = handles_<VkSampler>(sampler_ids, sampler_count);
+        layout_bindings[i].pImmutableSamplers =
+            samplers[i].empty() ? nullptr : samplers[i].data();
+      }
+      VkDescriptorSetLayoutCreateInfo info =
+          build<VkDescriptorSetLayoutCreateInfo>()
+              .set(&VkDescriptorSetLayoutCreateInfo::flags, flags)
+              .set(&VkDescriptorSetLayoutCreateInfo::bindingCount, count)
+              .set(&VkDescriptorSetLayoutCreateInfo::pBindings,
+                   layout_bindings.data());
+      VkDescriptorSetLayout layout;
+      if (device_.vkCreateDescriptorSetLayout(device, &info, allocator,
+                                              &layout) != VK_SUCCESS) {
+        return fail_("descriptor set layout creation");
+      }
+      set_(id, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, layout);
+      break;
+    }
+    case TraceOp::create_pipeline_layout: {
+      auto id = payload.get<uint32_t>();
+      const auto* set_layout_ids = payload.get_array<uint32_t>(count);
+      std::vector<VkDescriptorSetLayout> set_layouts =
+          handles_<VkDescriptorSetLayout>(set_layout_ids, count);
+      uint32_t range_count = 0;
+      const auto* ranges = payload.get_array<VkPushConstantRange>(range_count);
+      VkPipelineLayoutCreateInfo info =
+          build<VkPipelineLayoutCreateInfo>()
+              .set(&VkPipelineLayoutCreateInfo::setLayoutCount, count)
+              .set(&VkPipelineLayoutCreateInfo::pSetLayouts,
+                   set_layouts.data())
+              .set(&VkPipelineLayoutCreateInfo::pushConstantRangeCount,
+                   range_count)
+              .set(&VkPipelineLayoutCreateInfo::pPushConstantRanges, ranges);
+      VkPipelineLayout layout;
+      if (device_.vkCreatePipelineLayout(device, &info, allocator, &layout) !=
+          VK_SUCCESS) {
+        return fail_("pipeline layout creation");
+      }
+      set_(id, VK_OBJECT_TYPE_PIPELINE_LAYOUT, layout);
+      break;
+    }
+    case TraceOp::create_compute_pipeline: {
+      auto id = payload.get<uint32_t>();
+      auto flags = payload.get<VkPipelineCreateFlags>();
+      auto layout = get_<VkPipelineLayout>(payload.get<uint32_t>());
+      auto stage_flags = payload.get<VkPipelineShaderStageCreateFlags>();
+      auto stage = payload.get<VkShaderStageFlagBits>();
+      auto module = get_<VkShaderModule>(payload.get<uint32_t>());
+      const auto* name = payload.get_array<char>(count);
+      if (count == 0 || name[count - 1] != '\0') {
+        return fail_("bad entry point");
+      }
+      uint32_t entry_count = 0;
+      const auto* entries =
+          payload.get_array<VkSpecializationMapEntry>(entry_count);
+      uint32_t data_size = 0;
+      const auto* data = payload.get_array<std::byte>(data_size);
+      VkSpecializationInfo specialization = {entry_count, entries, data_size,
+                                             data};
+      VkPipelineShaderStageCreateInfo stage_info =
+          build<VkPipelineShaderStageCreateInfo>()
+              .set(&VkPipelineShaderStageCreateInfo::flags, stage_flags)
+              .set(&VkPipelineShaderStageCreateInfo::stage, stage)
+              .set(&VkPipelineShaderStageCreateInfo::module, module)
+              .set(&VkPipelineShaderStageCreateInfo::pName, name)
+              .set(&VkPipelineShaderStageCreateInfo::pSpecializationInfo,
+                   entry_count > 0 ? &specialization : nullptr);
+      VkComputePipelineCreateInfo info =
+          build<VkComputePipelineCreateInfo>()
+              .set(&VkComputePipelineCreateInfo::flags, flags)
+              .set(&VkComputePipelineCreateInfo::stage, stage_info)
+              .set(&VkComputePipelineCreateInfo::layout, layout)
+              .set(&VkComputePipelineCreateInfo::basePipelineIndex, -1);
+      VkPipeline pipeline;
+      if (device_.vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &info,
+                                           allocator,
+                                           &pipeline) != VK_SUCCESS) {
+        return fail_("compute pipeline creation");
+      }
+      set_(id, VK_OBJECT_TYPE_PIPELINE, pipeline);
+      break;
+    }
+    case TraceOp::create_descriptor_pool: {
+      auto id = payload.get<uint32_t>();
+      auto flags = payload.get<VkDescriptorPoolCreateFlags>();
+      auto max_sets = payload.get<uint32_t>();
+      const auto* sizes = payload.get_array<VkDescriptorPoolSize>(count);
+      VkDescriptorPoolCreateInfo info =
+          build<VkDescriptorPoolCreateInfo>()
+              .set(&VkDescriptorPoolCreateInfo::flags, flags)
+              .set(&VkDescriptorPoolCreateInfo::maxSets, max_sets)
+              .set(&VkDescriptorPoolCreateInfo::poolSizeCount, count)
+              .set(&VkDescriptorPoolCreateInfo::pPoolSizes, sizes);
+      VkDescriptorPool pool;
+      if (device_.vkCreateDescriptorPool(device, &info, allocator, &pool) !=
+          VK_SUCCESS) {
+        return fail_("descriptor pool creation");
+      }
+      set_(id, VK_OBJECT_TYPE_DESCRIPTOR_POOL, pool);
+      break;
+    }
+    case TraceOp::allocate_descriptor_set: {
+      auto id = payload.get<uint32_t>();
+      auto pool = payload.get<uint32_t>();
+      auto layout = get_<VkDescriptorSetLayout>(payload.get<uint32_t>());
+      VkDescriptorSetAllocateInfo info =
+          build<VkDescriptorSetAllocateInfo>()
+              .set(&VkDescriptorSetAllocateInfo::descriptorPool,
+                   get_<VkDescriptorPool>(pool))
+              .set(&VkDescriptorSetAllocateInfo::descriptorSetCount, 1)
+              .set(&VkDescriptorSetAllocateInfo::pSetLayouts, &layout);
+      VkDescriptorSet set;
+      if (device_.vkAllocateDescriptorSets(device, &info, &set) !=
+          VK_SUCCESS) {
+        return fail_("descriptor set allocation");
+      }
+      set_(id, VK_OBJECT_TYPE_DESCRIPTOR_SET, set, pool);
+      break;
+    }
+    case TraceOp::update_descriptor_sets:
+      return update_descriptor_sets_(payload);
+    case TraceOp::create_command_pool: {
+      auto id = payload.get<uint32_t>();
+      auto flags = payload.get<VkCommandPoolCreateFlags>();
+      auto family = payload.get<uint32_t>();
+      // Loops record the command buffers again without a pool reset.
+      VkCommandPoolCreateInfo info =
+          build<VkCommandPoolCreateInfo>()
+              .set(&VkCommandPoolCreateInfo::flags,
+                   flags | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT)
+              .set(&VkCommandPoolCreateInfo::queueFamilyIndex,
+                   family_(family));
+      VkCommandPool pool;
+      if (device_.vkCreateCommandPool(device, &info, allocator, &pool) !=
+          VK_SUCCESS) {
+        return fail_("command pool creation");
+      }
+      set_(id, VK_OBJECT_TYPE_COMMAND_POOL, pool);
+      break;
+    }
+    case TraceOp::allocate_command_buffer: {
+      auto id = payload.get<uint32_t>();
+      auto pool = payload.get<uint32_t>();
+      auto level = payload.get<VkCommandBufferLevel>();
+      VkCommandBufferAllocateInfo info =
+          build<VkCommandBufferAllocateInfo>()
+              .set(&VkCommandBufferAllocateInfo::commandPool,
+                   get_<VkCommandPool>(pool))
+              .set(&VkCommandBufferAllocateInfo::level, level)
+              .set(&VkCommandBufferAllocateInfo::commandBufferCount, 1);
+      VkCommandBuffer command_buffer;
+      if (device_.vkAllocateCommandBuffers(device, &info, &command_buffer) !=
+          VK_SUCCESS) {
+        return fail_("command buffer allocation");
+      }
+      set_(id, VK_OBJECT_TYPE_COMMAND_BUFFER, command_buffer, pool);
+      break;
+    }
+    case TraceOp::create_semaphore: {
+      auto id = payload.get<uint32_t>();
+      bool timeline = payload.get<uint32_t>() != 0;
+      auto value = payload.get<uint64_t>();
+      if (timeline && !device_.timeline_semaphore_supported) {
+        return fail_("the device has no timeline semaphores");
+      }
+      VkSemaphore semaphore = timeline
+                                  ? create_timeline_semaphore(device_,
+                                                              value_(value))
+                                  : create_semaphore(device_);
+      if (semaphore == VK_NULL_HANDLE) {
+        return fail_("semaphore creation");
+      }
+      ReplayObject& object = set_(id, VK_OBJECT_TYPE_SEMAPHORE, semaphore);
+      object.timeline = timeline;
+      object.setup_value = value;
+      break;
+    }
+    case TraceOp::create_fence: {
+      auto id = payload.get<uint32_t>();
+      bool signaled = payload.get<uint32_t>() != 0;
+      VkFence fence = create_fence(device_, signaled);
+      if (fence == VK_NULL_HANDLE) {
+        return fail_("fence creation");
+      }
+      ReplayObject& object = set_(id, VK_OBJECT_TYPE_FENCE, fence);
+      object.setup_signaled = signaled;
+      break;
+    }
+    case TraceOp::destroy: {
+      payload.get<VkObjectType>();
+      destroy_(payload.get<uint32_t>());
+      break;
+    }
+    case TraceOp::reset_command_pool: {
+      auto pool = get_<VkCommandPool>(payload.get<uint32_t>());
+      auto flags = payload.get<VkCommandPoolResetFlags>();
+      device_.vkResetCommandPool(device, pool, flags);
+      break;
+    }
+    case TraceOp::command_buffer:
+      return record_commands_(payload);
+    case TraceOp::queue_submit:
+      return queue_submit_(payload);
+    case TraceOp::reset_fences: {
+      const auto* ids = payload.get_array<uint32_t>(count);
+      std::vector<VkFence> fences = handles_<VkFence>(ids, count);
+      device_.vkResetFences(device, count, fences.data());
+      break;
+    }
+    case TraceOp::wait_for_fences: {
+      auto wait_all = payload.get<VkBool32>();
+      const auto* ids = payload.get_array<uint32_t>(count);
+      std::vector<VkFence> fences = handles_<VkFence>(ids, count);
+      if (device_.vkWaitForFences(device, count, fences.data(), wait_all,
+                                  UINT64_MAX) != VK_SUCCESS) {
+        return fail_("fence wait");
+      }
+      break;
+    }
+    case TraceOp::wait_semaphores: {
+      auto flags = payload.get<VkSemaphoreWaitFlagsKHR>();
+      const auto* ids = payload.get_array<uint32_t>(count);
+      std::vector<VkSemaphore> semaphores = handles_<VkSemaphore>(ids, count);
+      const auto* values = payload.get_array<uint64_t>(count);
+      std::vector<uint64_t> shifted(count);
+      for (uint32_t i = 0; i < count; ++i) {
+        shifted[i] = value_(values[i]);
+      }
+      VkSemaphoreWaitInfoKHR wait_info =
+          build<VkSemaphoreWaitInfoKHR>()
+              .set(&VkSemaphoreWaitInfoKHR::flags, flags)
+              .set(&VkSemaphoreWaitInfoKHR::semaphoreCount, count)
+              .set(&VkSemaphoreWaitInfoKHR::pSemaphores, semaphores.data())
+              .set(&VkSemaphoreWaitInfoKHR::pValues, shifted.data());
+      if (device_.vkWaitSemaphoresKHR(device, &wait_info, UINT64_MAX) !=
+          VK_SUCCESS) {
+        return fail_("semaphore wait");
+      }
+      break;
+    }
+    case TraceOp::signal_semaphore: {
+      auto semaphore = get_<VkSemaphore>(payload.get<uint32_t>());
+      auto value = payload.get<uint64_t>();
+      VkSemaphoreSignalInfoKHR signal_info =
+          build<VkSemaphoreSignalInfoKHR>()
+              .set(&VkSemaphoreSignalInfoKHR::semaphore, semaphore)
+              .set(&VkSemaphoreSignalInfoKHR::value, value_(value));
+      device_.vkSignalSemaphoreKHR(device, &signal_info);
+      break;
+    }
+    case TraceOp::acquire_next_image: {
+      auto semaphore = payload.get<uint32_t>();
+      auto fence = get_<VkFence>(payload.get<uint32_t>());
+      if (live_(semaphore)) {
+        objects_[semaphore].signaled = true;
+      }
+      empty_submit_(VK_NULL_HANDLE, get_<VkSemaphore>(semaphore), fence);
+      break;
+    }
+    case TraceOp::queue_present: {
+      const auto* ids = payload.get_array<uint32_t>(count);
+      for (uint32_t i = 0; i < count; ++i) {
+        if (live_(ids[i])) {
+          objects_[ids[i]].signaled = false;
+        }
+        empty_submit_(get_<VkSemaphore>(ids[i]), VK_NULL_HANDLE,
+                      VK_NULL_HANDLE);
+      }
+      break;
+    }
+    case TraceOp::queue_wait_idle:
+      device_.vkQueueWaitIdle(queue_(payload.get<uint32_t>()));
+      break;
+    case TraceOp::device_wait_idle:
+      device_.vkDeviceWaitIdle(device);
+      break;
+    default:
+      return fail_("unknown record");
+  }
+  return !payload.failed();
+}
+
+auto Replayer::end_setup() -> void
+{
+  in_setup_ = false;
+}
+
+auto Replayer::end_loop() -> void
+{
+  VkDevice device = device_.logical_device;
+  device_.vkDeviceWaitIdle(device);
+  value_offset_ = highest_value_ + 1;
+  for (uint32_t id = 0; id < objects_.size(); ++id) {
+    ReplayObject& object = objects_[id];
+    if (object.handle == 0) {
+      continue;
+    }
+    if (object.type == VK_OBJECT_TYPE_SEMAPHORE && object.timeline &&
+        object.from_setup) {
+      VkSemaphoreSignalInfoKHR signal_info =
+          build<VkSemaphoreSignalInfoKHR>()
+              .set(&VkSemaphoreSignalInfoKHR::semaphore,
+                   get_<VkSemaphore>(id))
+              .set(&VkSemaphoreSignalInfoKHR::value,
+                   value_(object.setup_value));
+      device_.vkSignalSemaphoreKHR(device, &signal_info);
+    }
+    else if (object.type == VK_OBJECT_TYPE_SEMAPHORE && object.signaled) {
+      // Nothing waited for it, a wait unsignals it.
+      empty_submit_(get_<VkSemaphore>(id), VK_NULL_HANDLE,
+                    VK_NULL_HANDLE);
+      object.signaled = false;
+    }
+    else if (object.type == VK_OBJECT_TYPE_FENCE && object.from_setup) {
+      auto fence = get_<VkFence>(id);
+      bool signaled =
+          device_.vkGetFenceStatus(device, fence) == VK_SUCCESS;
+      if (signaled && !object.setup_signaled) {
+        device_.vkResetFences(device, 1, &fence);
+      }
+      else if (!signaled && object.setup_signaled) {
+        device_.vkResetFences(device, 1, &fence);
+        empty_submit_(VK_NULL_HANDLE, VK_NULL_HANDLE, fence);
+      }
+    }
+  }
+  device_.vkDeviceWaitIdle(device);
+}
+
+auto Replayer::destroy_all() -> void
+{
+  device_.vkDeviceWaitIdle(device_.logical_device);
+  for (auto id = static_cast<uint32_t>(objects_.size()); id-- > 0;) {
+    destroy_(id);
+  }
+}
+
+auto parse_options(int argc, char** argv, Options& options) -> bool
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+    if (argument == "--null-driver") {
+      options.null_driver = true;
+      continue;
+    }
+    if (argument.rfind("--", 0) != 0) {
+      options.trace_path = argv[i];
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char* value = argv[++i];
+    if (argument == "--device") {
+      options.device_name = value;
+    }
+    else if (argument == "--loops") {
+      options.loops = std::max(std::atoi(value), 1);
+    }
+    else {
+      return false;
+    }
+  }
+  return options.trace_path != nullptr;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// Trace replay                                                 //
+//                                                              //
+// Re-issues a trace written by a capture on a headless device, //
+// as fast as the device allows: the setup once, then the       //
+// captured frames for the given number of loops. Presents and  //
+// acquires become empty submissions, since there is no window. //
+// Prints the frame time percentiles of every loop but the      //
+// first, and the driver calls per frame on the null driver.    //
+// Usage: vulkan-learning-replay trace [--device name] [--loops //
+//        n] [--null-driver]                                    //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    std::cerr << "Usage: vulkan-learning-replay trace [--device name] "
+                 "[--loops n] [--null-driver]"
+              << std::endl;
+    return 1;
+  }
+
+  os::MappedFile file;
+  TraceHeader header = {};
+  if (!file.open(options.trace_path) || file.size() < sizeof(header)) {
+    std::cerr << "Could not read " << options.trace_path << "." << std::endl;
+    return 1;
+  }
+  memcpy(&header, file.data(), sizeof(header));
+  if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+    std::cerr << options.trace_path << " is not a trace of this version."
+              << std::endl;
+    return 1;
+  }
+  if (header.pointer_size != sizeof(void*)) {
+    std::cerr << "The trace was captured by a " << header.pointer_size * 8
+              << " bit build." << std::endl;
+    return 1;
+  }
+
+  if (options.null_driver) {
+    enable_null_driver();
+  }
+  VulkanDevice device;
+  VkResult created = initialize(true);
+  if (created == VK_SUCCESS) {
+    created = create_headless_device(device, options.device_name);
+  }
+  if (created != VK_SUCCESS) {
+    std::cerr << "Could not create the device: " << result_name(created)
+              << "." << std::endl;
+    return 1;
+  }
+  std::string device_name =
+      physical_device_snapshot().find(device.physical_device)->properties
+          .deviceName;
+
+  bool replayed = true;
+  std::vector<double> frame_times;
+  uint64_t measured_calls = 0;
+  {
+    Replayer replayer(device, header);
+    TraceReader reader(file.data() + sizeof(header),
+                       file.size() - sizeof(header));
+    TraceOp op;
+    TraceReader payload(nullptr, 0);
+    bool setup_ended = false;
+    while (replayed && !setup_ended && reader.next(op, payload)) {
+      setup_ended = op == TraceOp::setup_end;
+      replayed = setup_ended || replayer.replay(op, payload);
+    }
+    // Truncated before the frames.
+    replayed = replayed && setup_ended;
+    replayer.end_setup();
+    const TraceReader frames = reader;
+
+    for (int loop = 0; replayed && loop < options.loops; ++loop) {
+      // The first loop warms up when others follow.
+      bool measured = loop > 0 || options.loops == 1;
+      reset_null_driver_stats();
+      TraceReader records = frames;
+      auto frame_start = Clock::now();
+      while (replayed && !records.done()) {
+        if (!records.next(op, payload)) {
+          replayed = false;
+          break;
+        }
+        if (op != TraceOp::frame_end) {
+          replayed = replayer.replay(op, payload);
+          continue;
+        }
+        if (measured) {
+          frame_times.push_back(elapsed_ms(frame_start));
+        }
+        frame_start = Clock::now();
+      }
+      if (measured) {
+        measured_calls += null_driver_stats().calls;
+      }
+      replayer.end_loop();
+    }
+    if (replayer.fallback_allocations() > 0) {
+      std::cout << replayer.fallback_allocations()
+                << " resources did not fit their captured memory binding."
+                << std::endl;
+    }
+    if (replayer.skipped_writes() > 0) {
+      std::cout << replayer.skipped_writes()
+                << " descriptor updates referred to destroyed objects."
+                << std::endl;
+    }
+    replayer.destroy_all();
+  }
+  gfx::destroy_device(device);
+  destroy();
+  if (!replayed) {
+    std::cerr << "Could not replay " << options.trace_path << "."
+              << std::endl;
+    return 1;
+  }
+  if (frame_times.empty()) {
+    std::cerr << options.trace_path << " has no complete frame." << std::endl;
+    return 1;
+  }
+
+  std::sort(frame_times.begin(), frame_times.end());
+  gfx::flush_log();
+  std::cout << "\n"
+            << device_name << ", " << header.frame_count << " frames x "
+            << options.loops << " loops:\n";
+  std::cout << std::fixed << std::setprecision(3)
+            << "frame ms p50 " << percentile(frame_times, 0.5) << ", p90 "
+            << percentile(frame_times, 0.9) << ", p99 "
+            << percentile(frame_times, 0.99) << ", max "
+            << percentile(frame_times, 1.0) << std::defaultfloat << std::endl;
+  if (options.null_driver && !frame_times.empty()) {
+    std::cout << "driver calls per frame "
+              << static_cast<double>(measured_calls) / frame_times.size()
+              << std::endl;
+  }
+  return 0;
+}
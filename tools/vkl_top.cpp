@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#else
+#include <cerrno>
+#include <signal.h>
+
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* CLEAR_SCREEN = "\x1b[H\x1b[2J";
+constexpr double PERCENTILES[] = {0.5, 0.9, 0.99};
+
+struct Options {
+  uint32_t pid = 0;
+  double interval = 1.0;
+  bool once = false;
+};
+
+// Values of every metric at one time, histograms in metric order.
+struct Sample {
+  Clock::time_point time;
+  uint32_t metric_count;
+  std::vector<uint64_t> values;
+  std::vector<uint64_t> sums;
+  std::vector<uint64_t> buckets;
+};
+
+#if defined(_WIN32)
+
+auto process_alive(uint32_t pid) -> bool
+{
+  HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+  if (process == nullptr) {
+    return false;
+  }
+  bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+  CloseHandle(process);
+  return alive;
+}
+
+// Named mappings cannot be listed, the process id must be given.
+auto metrics_processes() -> std::vector<uint32_t> { return {}; }
+
+#else
+
+auto process_alive(uint32_t pid) -> bool
+{
+  return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+}
+
+// Processes whose segments are in /dev/shm. Segments of processes that
+// crashed are left there, they are skipped.
+auto metrics_processes() -> std::vector<uint32_t>
+{
+  constexpr std::string_view PREFIX = "vkl-metrics.";
+  std::vector<uint32_t> pids;
+  std::error_code error;
+  for (const auto& entry :
+       std::filesystem::directory_iterator("/dev/shm", error)) {
+    std::string name = entry.path().filename().string();
+    if (name.compare(0, PREFIX.size(), PREFIX) != 0) {
+      continue;
+    }
+    uint32_t pid = std::strtoul(name.c_str() + PREFIX.size(), nullptr, 10);
+    if (pid != 0 && process_alive(pid)) {
+      pids.push_back(pid);
+    }
+  }
+  std::sort(pids.begin(), pids.end());
+  return pids;
+}
+
+#endif
+
+auto take_sample(const gfx::MetricsSegment& segment) -> Sample
+{
+  Sample sample;
+  sample.time = Clock::now();
+  sample.metric_count =
+      segment.metric_count.load(std::memory_order_acquire);
+  uint32_t histogram = 0;
+  for (uint32_t i = 0; i < sample.metric_count; ++i) {
+    const gfx::MetricSlot& slot = segment.metrics[i];
+    sample.values.push_back(slot.value.load(std::memory_order_relaxed));
+    if (slot.kind != gfx::MetricKind::histogram) {
+      continue;
+    }
+    const gfx::HistogramSlot& values = segment.histograms[histogram++];
+    sample.sums.push_back(values.sum.load(std::memory_order_relaxed));
+    for (const std::atomic<uint64_t>& bucket : values.buckets) {
+      sample.buckets.push_back(bucket.load(std::memory_order_relaxed));
+    }
+  }
+  return sample;
+}
+
+auto format_value(double value, gfx::MetricUnit unit) -> std::string
+{
+  char text[32];
+  switch (unit) {
+    case gfx::MetricUnit::bytes: {
+      constexpr const char* UNITS[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+      uint32_t power = 0;
+      while (std::abs(value) >= 1024.0 && power < 4) {
+        value /= 1024.0;
+        ++power;
+      }
+      snprintf(text, sizeof(text), "%.1f %s", value, UNITS[power]);
+      break;
+    }
+    case gfx::MetricUnit::nanoseconds:
+      snprintf(text, sizeof(text), "%.3f ms", value / 1e6);
+      break;
+    default:
+      snprintf(text, sizeof(text), "%.10g", value);
+      break;
+  }
+  return text;
+}
+
+// Middle of the bucket holding the percentile of the samples, from the
+// buckets of a single interval.
+auto percentile(const uint64_t* buckets, uint64_t count, double fraction)
+    -> double
+{
+  uint64_t rank = static_cast<uint64_t>(fraction * (count - 1));
+  uint64_t seen = 0;
+  for (uint32_t bucket = 0; bucket < gfx::HISTOGRAM_BUCKETS; ++bucket) {
+    seen += buckets[bucket];
+    if (seen > rank) {
+      double start = gfx::histogram_bucket_start(bucket);
+      // Buckets of a single value, the small ones, are exact.
+      if (bucket + 1 == gfx::HISTOGRAM_BUCKETS ||
+          gfx::histogram_bucket_start(bucket + 1) == start + 1) {
+        return start;
+      }
+      return (start + gfx::histogram_bucket_start(bucket + 1)) / 2.0;
+    }
+  }
+  return 0.0;
+}
+
+// Rates and histograms over the interval between the samples, metrics
+// registered in between start from zero.
+auto print(const gfx::MetricsSegment& segment, const Sample& previous,
+           const Sample& current, uint32_t pid) -> void
+{
+  double seconds =
+      std::chrono::duration<double>(current.time - previous.time).count();
+  auto delta = [&](const std::vector<uint64_t>& now,
+                   const std::vector<uint64_t>& before, size_t i) {
+    return now[i] - (i < before.size() ? before[i] : 0);
+  };
+  char line[160];
+  snprintf(line, sizeof(line), "vkl-top  pid %u  interval %.2f s", pid,
+           seconds);
+  std::cout << line << "\n\n";
+
+  snprintf(line, sizeof(line), "%-32s %16s %14s", "counter", "total", "/s");
+  std::cout << line << "\n";
+  for (uint32_t i = 0; i < current.metric_count; ++i) {
+    const gfx::MetricSlot& slot = segment.metrics[i];
+    if (slot.kind == gfx::MetricKind::counter) {
+      snprintf(line, sizeof(line), "%-32s %16s %14.1f", slot.name,
+               format_value(current.values[i], slot.unit).c_str(),
+               delta(current.values, previous.values, i) / seconds);
+      std::cout << line << "\n";
+    }
+  }
+
+  snprintf(line, sizeof(line), "\n%-32s %16s", "gauge", "value");
+  std::cout << line << "\n";
+  for (uint32_t i = 0; i < current.metric_count; ++i) {
+    const gfx::MetricSlot& slot = segment.metrics[i];
+    if (slot.kind == gfx::MetricKind::gauge) {
+      double value = static_cast<int64_t>(current.values[i]);
+      snprintf(line, sizeof(line), "%-32s %16s", slot.name,
+               format_value(value, slot.unit).c_str());
+      std::cout << line << "\n";
+    }
+  }
+
+  snprintf(line, sizeof(line), "\n%-32s %10s %12s %12s %12s %12s",
+           "histogram", "/s", "mean", "p50", "p90", "p99");
+  std::cout << line << "\n";
+  uint32_t histogram = 0;
+  std::vector<uint64_t> buckets(gfx::HISTOGRAM_BUCKETS);
+  for (uint32_t i = 0; i < current.metric_count; ++i) {
+    const gfx::MetricSlot& slot = segment.metrics[i];
+    if (slot.kind != gfx::MetricKind::histogram) {
+      continue;
+    }
+    uint64_t count = delta(current.values, previous.values, i);
+    uint64_t sum = delta(current.sums, previous.sums, histogram);
+    for (uint32_t bucket = 0; bucket < gfx::HISTOGRAM_BUCKETS; ++bucket) {
+      buckets[bucket] =
+          delta(current.buckets, previous.buckets,
+                histogram * gfx::HISTOGRAM_BUCKETS + bucket);
+    }
+    ++histogram;
+    int size = snprintf(line, sizeof(line), "%-32s %10.1f", slot.name,
+                        count / seconds);
+    if (count > 0) {
+      size += snprintf(line + size, sizeof(line) - size, " %12s",
+                       format_value(static_cast<double>(sum) / count,
+                                    slot.unit)
+                           .c_str());
+      for (double fraction : PERCENTILES) {
+        size += snprintf(
+            line + size, sizeof(line) - size, " %12s",
+            format_value(percentile(buckets.data(), count, fraction),
+                         slot.unit)
+                .c_str());
+      }
+    }
+    std::cout << line << "\n";
+  }
+  std::cout << std::flush;
+}
+
+auto parse_options(int argc, char** argv, Options& options) -> bool
+{
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+    if (argument == "--once") {
+      options.once = true;
+    }
+    else if (argument == "--interval" && i + 1 < argc) {
+      options.interval = std::max(std::strtod(argv[++i], nullptr), 0.05);
+    }
+    else if (argument[0] != '-' && options.pid == 0) {
+      options.pid = std::strtoul(argument.c_str(), nullptr, 10);
+      if (options.pid == 0) {
+        return false;
+      }
+    }
+    else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// ************************************************************ //
+// vkl-top                                                      //
+//                                                              //
+// Shows the metrics of a running process that enabled them,    //
+// refreshed every interval: counters with their rate, gauges,  //
+// and histograms with their rate, mean and percentiles over    //
+// the last interval. The metrics are read from the shared      //
+// memory of the process, it does nothing to be watched.        //
+// Without a process id, watches the only process with metrics  //
+// or lists them when there are several. With --once, prints a  //
+// single interval and exits.                                   //
+// Usage: vkl-top [--interval seconds] [--once] [pid]           //
+// ************************************************************ //
+auto main(int argc, char** argv) -> int
+{
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    std::cerr << "Usage: vkl-top [--interval seconds] [--once] [pid]"
+              << std::endl;
+    return 1;
+  }
+  if (options.pid == 0) {
+    std::vector<uint32_t> pids = metrics_processes();
+    if (pids.size() != 1) {
+      std::cerr << (pids.empty() ? "No process shares its metrics."
+                                 : "Several processes share their metrics:")
+                << std::endl;
+      for (uint32_t pid : pids) {
+        std::cerr << "  " << pid << std::endl;
+      }
+      return 1;
+    }
+    options.pid = pids.front();
+  }
+
+  gfx::MetricsView view;
+  if (!view.open(options.pid)) {
+    std::cerr << "Process " << options.pid << " shares no metrics."
+              << std::endl;
+    return 1;
+  }
+  const gfx::MetricsSegment& segment = *view.segment();
+  auto interval = std::chrono::duration<double>(options.interval);
+  Sample previous = take_sample(segment);
+  do {
+    std::this_thread::sleep_for(interval);
+    if (!process_alive(options.pid)) {
+      std::cerr << "Process " << options.pid << " exited." << std::endl;
+      return 0;
+    }
+    Sample current = take_sample(segment);
+    if (!options.once) {
+      std::cout << CLEAR_SCREEN;
+    }
+    print(segment, previous, current, options.pid);
+    previous = std::move(current);
+  } while (!options.once);
+  return 0;
+}